@@ -27,10 +27,10 @@
 
 #include "includes.h"
 #include "honas_input.h"
-#include "input_dns_relayd.h"
+#include "input_pcap.h"
 #include "logging.h"
 
-static const honas_input_t* input_modules[] = { &input_dns_relayd };
+static const honas_input_t* input_modules[] = { &input_pcap };
 static const size_t input_modules_count = sizeof(input_modules) / sizeof(input_modules[0]);
 
 int main(int argc, char **argv) {
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BLOCK_CODEC_H
+#define BLOCK_CODEC_H
+
+#include "byte_slice.h"
+#include "includes.h"
+
+/// \defgroup block_codec Block compression codecs
+
+/** Block compression codecs
+ *
+ * These codecs are used to compress the fixed size blocks of bloom filter data
+ * inside sealed honas state files. Each block is compressed independently so
+ * a single block can be decompressed without touching any of the others.
+ *
+ * The `RLE`, `SPARSE` and `SPARSE_INDEXED` codecs are always available. The
+ * `RLE` codec encodes runs of zero bytes and works well on mostly empty blocks.
+ * The `SPARSE` codec stores the (delta encoded) offsets of all bits set to 1
+ * and works well on blocks with a low fill rate. The `SPARSE_INDEXED` codec is
+ * the `SPARSE` codec with a small index in front that allows checking a single
+ * bit by only decoding the offsets of the sub-block it's in. The `ZSTD` codec
+ * is only available when honas was built with libzstd.
+ *
+ * All codecs except `ZSTD` support checking bits directly in the compressed
+ * data (see `block_codec_bit_is_set()`), but only for `RAW` and
+ * `SPARSE_INDEXED` this takes a bounded amount of work.
+ *
+ * \note The codec values are stored inside sealed state files and should never
+ *       be renumbered.
+ */
+enum block_codec {
+	BLOCK_CODEC_RAW = 0,    ///< Uncompressed block data
+	BLOCK_CODEC_RLE = 1,    ///< Zero byte run length encoding
+	BLOCK_CODEC_SPARSE = 2, ///< Delta encoded offsets of bits set
+	BLOCK_CODEC_ZSTD = 3,   ///< Zstandard compression
+	BLOCK_CODEC_SPARSE_INDEXED = 4, ///< Delta encoded offsets of bits set with a sub-block index
+	BLOCK_CODEC_MAX
+};
+
+/** Get the name of a codec
+ *
+ * \param codec The codec to get the name of
+ * \returns The name of the codec or `NULL` if the codec is unknown
+ * \ingroup block_codec
+ */
+extern const char* block_codec_name(enum block_codec codec);
+
+/** Lookup a codec by its name
+ *
+ * \param name  The name of the codec
+ * \param codec Updated with the codec that was found
+ * \returns `true` if a codec with that name exists, `false` otherwise
+ * \ingroup block_codec
+ */
+extern bool block_codec_from_name(const char* name, enum block_codec* codec);
+
+/** Check whether a codec is available in this build
+ *
+ * \param codec The codec to check
+ * \returns `true` if the codec can be used for compression and decompression
+ * \ingroup block_codec
+ */
+extern bool block_codec_available(enum block_codec codec);
+
+/** Compress a block
+ *
+ * The compressed data is only useful if it's smaller than the original, so
+ * compression is aborted as soon as the compressed data doesn't fit inside `dst`.
+ *
+ * \param codec The codec to compress the block with
+ * \param src   The uncompressed block data
+ * \param dst   The buffer to write the compressed data to
+ * \returns The size of the compressed data or -1 if it didn't fit in `dst` (or the codec is not available)
+ * \ingroup block_codec
+ */
+extern ssize_t block_codec_compress(enum block_codec codec, const byte_slice_t src, byte_slice_t dst);
+
+/** Decompress a block
+ *
+ * \param codec The codec the block was compressed with
+ * \param src   The compressed block data
+ * \param dst   The buffer for the uncompressed data (should be exactly the size of the uncompressed block)
+ * \returns 0 on success or -1 if the compressed data is corrupt (or the codec is not available)
+ * \ingroup block_codec
+ */
+extern int block_codec_decompress(enum block_codec codec, const byte_slice_t src, byte_slice_t dst);
+
+/** Check whether a codec supports checking bits without decompressing
+ *
+ * \param codec The codec to check
+ * \returns `true` if `block_codec_bit_is_set()` can be used on blocks compressed with the codec
+ * \ingroup block_codec
+ */
+extern bool block_codec_supports_probing(enum block_codec codec);
+
+/** Check if a bit is set in a compressed block
+ *
+ * \param codec     The codec the block was compressed with
+ * \param src       The compressed block data
+ * \param block_len The size of the uncompressed block
+ * \param bit       The offset of the bit within the (uncompressed) block
+ * \returns 1 if the bit is set, 0 if it's not or -1 if the compressed data is
+ *          corrupt (or the codec doesn't support probing)
+ * \ingroup block_codec
+ */
+extern int block_codec_bit_is_set(enum block_codec codec, const byte_slice_t src, size_t block_len, size_t bit);
+
+#endif /* BLOCK_CODEC_H */
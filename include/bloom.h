@@ -81,6 +81,41 @@ extern void bloom_set(byte_slice_t filter, const byte_slice_t hash, size_t num_b
  */
 extern bool bloom_is_set(const byte_slice_t filter, const byte_slice_t hash, size_t num_bits);
 
+/** Add a hashed value to a folded bloomfilter
+ * Like `bloom_set()` but for a `filter` that has been folded in half `fold_factor` times.
+ * The bit offsets are determined for the original (unfolded) filter size and are then
+ * mapped onto the folded filter.
+ * \warning The supplied hash length must be a multiple of `sizeof(uint32_t)`
+ * \param filter      The folded bloom filter to be updated
+ * \param hash        The hash of the data that should be added
+ * \param num_bits    The number of bits that should be set for this item (aka: `k` value)
+ * \param fold_factor The number of times the filter has been folded in half
+ * \ingroup bloom
+ */
+extern void bloom_set_folded(byte_slice_t filter, const byte_slice_t hash, size_t num_bits, uint32_t fold_factor);
+
+/** Check if hashed value is probably present in a folded bloom filter
+ * Like `bloom_is_set()` but for a `filter` that has been folded in half `fold_factor` times.
+ * \warning The supplied hash length must be a multiple of `sizeof(uint32_t)`
+ * \param filter      The folded bloom filter to be checked
+ * \param hash        The hash of the data that should be checked
+ * \param num_bits    The number of bits that should be set for this item (aka: `k` value)
+ * \param fold_factor The number of times the filter has been folded in half
+ * \returns `true` if the hashed value is probably present, `false` otherwise
+ * \ingroup bloom
+ */
+extern bool bloom_is_set_folded(const byte_slice_t filter, const byte_slice_t hash, size_t num_bits, uint32_t fold_factor);
+
+/** Fold a bloom filter
+ * Folding a filter in half (bitwise OR-ing the upper half onto the lower half) maps
+ * bit offset `o` onto `o % (m / 2)`. Folding it repeatedly is the same as bitwise OR-ing
+ * all `folded.len` sized parts of the filter together.
+ * \param folded The folded bloom filter that gets updated (its size should divide the size of `filter`)
+ * \param filter The bloom filter to fold
+ * \ingroup bloom
+ */
+extern void bloom_fold(byte_slice_t folded, const byte_slice_t filter);
+
 /** Determine the number of bits set to 1
  *
  * \param filter The bloom filter to check
@@ -113,4 +148,15 @@ extern uint32_t bloom_approx_count(size_t filtersize, size_t num_bits, size_t bi
  */
 extern void bloom_determine_offsets(size_t* bit_offsets, size_t bit_offsets_len, size_t filtersize, const byte_slice_t input_hash);
 
+/** Determine which bits should be set to 1 in a folded bloom filter for some hashed value
+ * \param bit_offsets     A sequence of bit indexes that will be updated to indicate which bits should be set
+ * \param bit_offsets_len The number of bit indexes that that should be filled (aka: the `k` value of the bloom filter)
+ * \param filtersize      The size in bytes of the folded bloom filter
+ * \param fold_factor     The number of times the filter has been folded in half
+ * \param input_hash      The hash of the data for which to determine the bit indexes
+ * \ingroup bloom
+ * \private
+ */
+extern void bloom_determine_folded_offsets(size_t* bit_offsets, size_t bit_offsets_len, size_t filtersize, uint32_t fold_factor, const byte_slice_t input_hash);
+
 #endif /* BLOOM_H */
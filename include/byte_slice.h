@@ -205,7 +205,7 @@ static inline bool byte_slice_bit_is_set(const byte_slice_t slice, size_t bit)
  * \param bits_len The number of bit indexes in the sequence
  * \ingroup byte_slice
  */
-static inline bool byte_slice_all_bits_set(const byte_slice_t slice, size_t* bits, size_t bits_len)
+static inline bool byte_slice_all_bits_set(const byte_slice_t slice, const size_t* bits, size_t bits_len)
 {
 	for (size_t i = 0; i < bits_len; i++)
 		if (!byte_slice_bit_is_set(slice, bits[i]))
@@ -220,7 +220,7 @@ static inline bool byte_slice_all_bits_set(const byte_slice_t slice, size_t* bit
  * \param bits_len The number of bit indexes in the sequence
  * \ingroup byte_slice
  */
-static inline bool byte_slice_any_bit_set(const byte_slice_t slice, size_t* bits, size_t bits_len)
+static inline bool byte_slice_any_bit_set(const byte_slice_t slice, const size_t* bits, size_t bits_len)
 {
 	for (size_t i = 0; i < bits_len; i++)
 		if (byte_slice_bit_is_set(slice, bits[i]))
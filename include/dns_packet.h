@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DNS_PACKET_H
+#define DNS_PACKET_H
+
+#include "honas_input.h"
+
+/** DNS packet parsing
+ *  ==================
+ *
+ * Parsing of DNS queries from captured packets, as shared by the input
+ * modules that capture packets (from files or from a network interface).
+ *
+ * A packet is parsed in place: `dns_packet_parse()` finds the DNS payload of
+ * a packet sent to port 53 over UDP or TCP (over IPv4 or IPv6 and one of the
+ * link types below), after which `dns_packet_next_query()` takes the queries
+ * (of the Internet class) from that payload one by one.
+ *
+ * \defgroup dns_packet DNS packet parsing
+ */
+
+/* Link types of captured packets, see https://www.tcpdump.org/linktypes.html */
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+/** A captured packet being parsed
+ *
+ * \ingroup dns_packet
+ */
+struct dns_packet {
+	/** The DNS payload that's left to parse (a TCP segment can hold several queries) */
+	const uint8_t* payload;
+	/** The length of the DNS payload (0 if the packet isn't a DNS packet) */
+	size_t payload_len;
+	/** Whether the payload is that of a TCP segment */
+	bool payload_is_tcp;
+	/** The capture timestamp of the packet, to be set by the caller */
+	uint64_t timestamp;
+	/** The sub-second part of the capture timestamp in nanoseconds, to be set by the caller (or 0 if unknown) */
+	uint32_t timestamp_nsec;
+	/** The source address of the packet */
+	struct in_addr46 client;
+};
+
+/** Find the DNS payload of a captured packet
+ *
+ * The payload is left empty for packets that aren't sent to port 53. The
+ * packet data isn't copied, so it must stay around for as long as queries are
+ * taken from the packet.
+ *
+ * \param packet    The packet to parse into
+ * \param link_type The link type of the packet data (one of the `LINKTYPE_` values)
+ * \param data      The packet data, beginning with its link layer header
+ * \param len       The captured length of the packet data
+ * \ingroup dns_packet
+ */
+extern void dns_packet_parse(struct dns_packet* packet, uint32_t link_type, const uint8_t* data, size_t len);
+
+/** Take the next query from a parsed packet
+ *
+ * The host name of the query's first question is converted to presentation
+ * format, escaped the way ldns does, and its client and timestamp are those
+ * of the packet. Other DNS messages than queries are skipped.
+ *
+ * \param packet The packet to take the query from
+ * \param lookup The lookup to fill in
+ * \returns `true` if a lookup was filled in or `false` once there are no more queries
+ * \ingroup dns_packet
+ */
+extern bool dns_packet_next_query(struct dns_packet* packet, struct honas_input_lookup* lookup);
+
+#endif /* DNS_PACKET_H */
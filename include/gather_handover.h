@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GATHER_HANDOVER_H
+#define GATHER_HANDOVER_H
+
+#include "gather_listener.h"
+#include "includes.h"
+
+/* Environment variable through which a new honas gather process learns its handover socket */
+#define GATHER_HANDOVER_SOCKET_ENV "HONAS_GATHER_HANDOVER_FD"
+
+#define GATHER_HANDOVER_MAGIC "HONASHND"
+#define CURRENT_GATHER_HANDOVER_VERSION 2
+
+/** Honas gather handover
+ *  =====================
+ *
+ * A running honas gather process can hand over to a newly started one (for
+ * example after an upgrade) without closing its listening socket and without
+ * saving and loading the active state:
+ *
+ * - The running process starts the new process using `gather_handover_spawn()`,
+ *   which connects both through a handover socket.
+ * - The running process stops accepting connections and drains the ones it has.
+ * - The running process copies the active state into a memory file (see
+ *   `honas_state_export()`) and sends it, along with the listening sockets,
+ *   using `gather_handover_send()`.
+ * - The new process picks up the handover socket with `gather_handover_socket()`,
+ *   receives the file descriptors with `gather_handover_receive()`, takes over
+ *   the active state and starts accepting connections. Then it acknowledges
+ *   the handover with `gather_handover_acknowledge()`.
+ * - The running process exits once `gather_handover_wait()` has seen the
+ *   acknowledgement. Otherwise it resumes accepting connections itself.
+ *
+ * \defgroup gather_handover Handing over to a new honas gather process
+ */
+
+/** Start a new honas gather process to hand over to
+ *
+ * The new process inherits the other end of the handover socket, whose file
+ * descriptor number is passed in the `GATHER_HANDOVER_SOCKET_ENV` environment
+ * variable. It is started in directory `dirfd`.
+ *
+ * \param program The executable of the new process
+ * \param argv    The arguments of the new process
+ * \param dirfd   The directory to start the new process in
+ * \param sock    Is set to the handover socket of this process
+ * \returns The process id of the new process or -1 on error (errno is set appropriately)
+ * \ingroup gather_handover
+ */
+extern pid_t gather_handover_spawn(const char* program, char* const argv[], int dirfd, int* sock);
+
+/** Get the handover socket inherited from the previous honas gather process
+ *
+ * \returns The handover socket (close-on-exec) or -1 if this process wasn't started for a handover
+ * \ingroup gather_handover
+ */
+extern int gather_handover_socket(void);
+
+/** Send the listening sockets and the active state to the new process
+ *
+ * \param sock            The handover socket
+ * \param listener_fds    The listening sockets
+ * \param nr_listener_fds The number of listening sockets (at most `GATHER_LISTENER_MAX_ENDPOINTS`)
+ * \param state_fd        The memory file holding the active state
+ * \returns 0 on success or -1 on error (errno is set appropriately)
+ * \ingroup gather_handover
+ */
+extern int gather_handover_send(int sock, const int* listener_fds, size_t nr_listener_fds, int state_fd);
+
+/** Receive the listening sockets and the active state from the previous process
+ *
+ * \param sock            The handover socket
+ * \param listener_fds    Is set to the listening sockets (close-on-exec; room for `GATHER_LISTENER_MAX_ENDPOINTS`)
+ * \param nr_listener_fds Is set to the number of listening sockets
+ * \param state_fd        Is set to the memory file holding the active state (close-on-exec)
+ * \returns 0 on success or -1 on error (errno is set appropriately; `EPROTO` for an unsupported handover message)
+ * \ingroup gather_handover
+ */
+extern int gather_handover_receive(int sock, int* listener_fds, size_t* nr_listener_fds, int* state_fd);
+
+/** Acknowledge the handover to the previous process
+ *
+ * \param sock The handover socket
+ * \returns 0 on success or -1 on error (errno is set appropriately)
+ * \ingroup gather_handover
+ */
+extern int gather_handover_acknowledge(int sock);
+
+/** Wait for the new process to acknowledge the handover
+ *
+ * \param sock    The handover socket
+ * \param timeout The maximum time to wait in milliseconds
+ * \returns 0 when acknowledged or -1 otherwise (errno is set appropriately; `ETIMEDOUT` on timeout)
+ * \ingroup gather_handover
+ */
+extern int gather_handover_wait(int sock, int timeout);
+
+#endif /* GATHER_HANDOVER_H */
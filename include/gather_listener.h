@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GATHER_LISTENER_H
+#define GATHER_LISTENER_H
+
+#include "includes.h"
+
+/* Maximum number of endpoints a honas gather process listens on */
+#define GATHER_LISTENER_MAX_ENDPOINTS 16
+
+/** Honas gather listeners
+ *  ======================
+ *
+ * The honas gather process accepts dnstap connections on any number of
+ * endpoints. An endpoint is either the absolute path of a unix socket or an
+ * IPv4 or IPv6 address and TCP port (`<ipv4>:<port>` or `[<ipv6>]:<port>`,
+ * with `*` for any address).
+ *
+ * TCP listening sockets are opened with `SO_REUSEPORT`, so several honas
+ * gather processes can listen on the same endpoint and have the kernel spread
+ * the connections between them.
+ *
+ * \defgroup gather_listener Listening for dnstap connections
+ */
+
+/** Parse a listener endpoint
+ *
+ * \param endpoint The endpoint to parse
+ * \param addr     Is set to the socket address of the endpoint
+ * \param addr_len Is set to the length of the socket address
+ * \returns 0 on success or -1 if the endpoint is invalid
+ * \ingroup gather_listener
+ */
+extern int gather_listener_parse(const char* endpoint, struct sockaddr_storage* addr, socklen_t* addr_len);
+
+/** Check a whitespace separated list of listener endpoints
+ *
+ * \param endpoints The endpoints to check
+ * \returns `true` if there are 1 to `GATHER_LISTENER_MAX_ENDPOINTS` endpoints that are all valid
+ * \ingroup gather_listener
+ */
+extern bool gather_listener_endpoints_are_valid(const char* endpoints);
+
+/** Open a non-blocking listening socket
+ *
+ * A stale unix socket file (of a process that didn't exit cleanly) is removed
+ * first.
+ *
+ * \param addr     The socket address to listen on
+ * \param addr_len The length of the socket address
+ * \param backlog  The maximum length of the queue of pending connections
+ * \returns The listening socket (close-on-exec) or -1 on error (errno is set appropriately)
+ * \ingroup gather_listener
+ */
+extern int gather_listener_open(const struct sockaddr* addr, socklen_t addr_len, int backlog);
+
+/** Get a description of the endpoint of a listening socket for logging
+ *
+ * \param fd         The listening socket
+ * \param buffer     The buffer to write the description to
+ * \param buffer_len The size of the buffer
+ * \returns `buffer`
+ * \ingroup gather_listener
+ */
+extern const char* gather_listener_name(int fd, char* buffer, size_t buffer_len);
+
+/** Remove the socket file of a unix listening socket
+ *
+ * Does nothing for TCP listening sockets.
+ *
+ * \param fd The listening socket
+ * \ingroup gather_listener
+ */
+extern void gather_listener_unlink(int fd);
+
+#endif /* GATHER_LISTENER_H */
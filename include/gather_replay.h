@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GATHER_REPLAY_H
+#define GATHER_REPLAY_H
+
+#include "includes.h"
+#include "honas_state.h"
+
+/** Replaying capture files
+ *  =======================
+ *
+ * With `--replay` the honas gather process registers the lookups of capture
+ * files into state files, instead of gathering them from dnstap connections.
+ *
+ * Dnstap capture files are in the Frame Streams file format (as written by
+ * the dnstap file output of Unbound or by `fstrm_capture`): a START control
+ * frame with the content type, the data frames and a STOP control frame.
+ * Every frame starts with its length, and control frames are preceded by a
+ * length of 0 (the escape sequence).
+ *
+ * Lookups are registered at the time they were made rather than at the time
+ * they're replayed. Whenever that time passes the end of the period of the
+ * current state, the state is saved and the state of a new period is created,
+ * just like the state is rotated when gathering live.
+ *
+ * \defgroup gather_replay Replaying capture files
+ */
+
+/** Called with the payload of every data frame of a dnstap capture file
+ *
+ * \param arg    The argument passed to `gather_replay_dnstap()`
+ * \param data   The payload of the data frame (a protobuf encoded dnstap message)
+ * \param length The length of the payload
+ * \returns 0 to continue or -1 to stop reading the capture file (errno should be set)
+ */
+typedef int(gather_replay_frame_fn_t)(void* arg, const uint8_t* data, size_t length);
+
+/** Called when the period of the state of a replay has ended
+ *
+ * \param arg   The argument the replay was initialized with
+ * \param state The state to save (and destroy)
+ */
+typedef void(gather_replay_end_period_fn_t)(void* arg, honas_state_t* state);
+
+/** Called when a replay enters a new period
+ *
+ * \param arg          The argument the replay was initialized with
+ * \param state        The state to create
+ * \param period_begin The time of the first lookup of the period
+ */
+typedef void(gather_replay_begin_period_fn_t)(void* arg, honas_state_t* state, uint64_t period_begin);
+
+/** Replay of capture files */
+struct gather_replay {
+	honas_state_t* state;                          ///< The state of the current period (no header before the first period)
+	uint64_t time;                                 ///< The time at which lookups are registered (0 until the first lookup with a time)
+	size_t nr_periods;                             ///< Number of periods entered so far
+	gather_replay_begin_period_fn_t* begin_period; ///< Called to create the state of a new period
+	gather_replay_end_period_fn_t* end_period;     ///< Called to save the state of a period that has ended
+	void* arg;                                     ///< The argument passed to `begin_period` and `end_period`
+};
+
+/** Read the frames of a dnstap capture file
+ *
+ * \param data      The contents of the capture file
+ * \param size      The size of the capture file
+ * \param process   Called with the payload of every data frame
+ * \param arg       The argument to pass to `process`
+ * \param nr_frames Is set to the number of data frames read
+ * \returns 0 if the capture file ended with the STOP control frame, 1 if it
+ *          ended before that (it's truncated) or -1 if it's not a valid
+ *          dnstap capture file (errno is set to `EBADMSG`) or `process`
+ *          stopped reading it (errno is set by `process`)
+ * \ingroup gather_replay
+ */
+extern int gather_replay_dnstap(const uint8_t* data, size_t size, gather_replay_frame_fn_t* process, void* arg, size_t* nr_frames);
+
+/** Initialize a replay
+ *
+ * \param replay       The replay to initialize
+ * \param state        The state to register lookups in (without header)
+ * \param begin_period Called to create the state of a new period
+ * \param end_period   Called to save the state of a period that has ended
+ * \param arg          The argument to pass to `begin_period` and `end_period`
+ * \ingroup gather_replay
+ */
+extern void gather_replay_init(struct gather_replay* replay, honas_state_t* state, gather_replay_begin_period_fn_t* begin_period, gather_replay_end_period_fn_t* end_period, void* arg);
+
+/** Advance a replay to the time a lookup was made
+ *
+ * The state is rotated when the time has passed the end of its period.
+ * Lookups from before the beginning of the current period (out of order) are
+ * registered in the current period, and lookups without a time at the time
+ * of the lookup before them.
+ *
+ * \param replay    The replay
+ * \param timestamp The time the lookup was made (0 if unknown)
+ * \returns `true` if the lookup is to be registered in the state of the
+ *          replay at its time, or `false` if its time is still unknown
+ * \ingroup gather_replay
+ */
+extern bool gather_replay_advance(struct gather_replay* replay, uint64_t timestamp);
+
+/** Finish a replay, saving the state of the last (partial) period
+ *
+ * \param replay The replay
+ * \ingroup gather_replay
+ */
+extern void gather_replay_finish(struct gather_replay* replay);
+
+#endif /* GATHER_REPLAY_H */
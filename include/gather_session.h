@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GATHER_SESSION_H
+#define GATHER_SESSION_H
+
+#include "includes.h"
+
+struct evbuffer;
+struct fstrm_control;
+
+/* Content type of the Frame Streams sessions that are accepted */
+#define GATHER_SESSION_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+
+/* Maximum size (in bytes) of a frame, including its length; larger data frames are skipped */
+#define GATHER_SESSION_MAX_FRAME_SIZE 262144
+
+/** Dnstap sessions
+ *  ===============
+ *
+ * Unbound sends dnstap data to the honas gather process using the
+ * bidirectional Frame Streams protocol. After connecting, the sender sends a
+ * READY control frame listing the content types it can send, which is
+ * answered with an ACCEPT control frame for the dnstap content type. The
+ * sender then sends a START control frame, followed by the data frames,
+ * until it ends the session with a STOP control frame. That's answered with
+ * a FINISH control frame, after which the connection is closed.
+ *
+ * A session processes the frames read from a connection and queues the
+ * control frames to send in response. It doesn't do any I/O itself, so the
+ * caller decides how the connection is read, written and closed.
+ *
+ * \defgroup gather_session Dnstap sessions
+ */
+
+/** State of a dnstap session */
+enum gather_session_state {
+	GATHER_SESSION_READING_CONTROL_READY, ///< Waiting for the READY control frame
+	GATHER_SESSION_READING_CONTROL_START, ///< Waiting for the START control frame (ACCEPT was sent)
+	GATHER_SESSION_READING_DATA,          ///< Reading data frames until the STOP control frame
+	GATHER_SESSION_STOPPED,               ///< The session has ended (FINISH was sent)
+};
+
+/** Called with the payload of every data frame of a dnstap session
+ *
+ * \param arg    The argument the session was initialized with
+ * \param data   The payload of the data frame (a protobuf encoded dnstap message)
+ * \param length The length of the payload
+ */
+typedef void(gather_session_frame_fn_t)(void* arg, const uint8_t* data, size_t length);
+
+/** Dnstap session */
+struct gather_session {
+	enum gather_session_state state;    ///< The state of the session
+	struct fstrm_control* control;      ///< The last control frame read or written
+	gather_session_frame_fn_t* process; ///< Called with the payload of every data frame
+	void* arg;                          ///< The argument passed to `process`
+	size_t bytes_skip;                  ///< Number of bytes of an oversized data frame still to be skipped
+	size_t count_read;                  ///< Number of data frames processed
+	size_t bytes_read;                  ///< Number of bytes of data frame payload processed
+};
+
+/** Initialize a dnstap session for a new connection
+ *
+ * \param session The session to initialize
+ * \param process Called with the payload of every data frame
+ * \param arg     The argument to pass to `process`
+ * \returns 0 on success or -1 on error (errno is set appropriately)
+ * \ingroup gather_session
+ */
+extern int gather_session_init(struct gather_session* session, gather_session_frame_fn_t* process, void* arg);
+
+/** Destroy a dnstap session
+ *
+ * \param session The session to destroy
+ * \ingroup gather_session
+ */
+extern void gather_session_destroy(struct gather_session* session);
+
+/** Process the frames read from the connection of a dnstap session
+ *
+ * Complete frames are removed from the input; a frame that has only partly
+ * arrived is left until the rest of it has been read. Data frames are passed
+ * on as they arrive, and the control frames to send in response are added to
+ * the output.
+ *
+ * \param session The session
+ * \param input   The data read from the connection
+ * \param output  The data to write to the connection
+ * \returns 0 if more input is expected, 1 if the session has ended (the
+ *          connection should be closed once the output has been written) or
+ *          -1 if the sender violated the protocol (errno is set to `EPROTO`)
+ *          or on error (errno is set appropriately)
+ * \ingroup gather_session
+ */
+extern int gather_session_process(struct gather_session* session, struct evbuffer* input, struct evbuffer* output);
+
+#endif /* GATHER_SESSION_H */
@@ -37,12 +37,17 @@
 typedef struct {
 	char* bloomfilter_path;
 	char* subnet_activity_path;
+	char* live_view_name;
+	char* listen;
+	char* overload_sampling;
 	uint32_t period_length;
 	uint32_t number_of_filters;
 	uint32_t number_of_bits_per_filter;
 	uint32_t number_of_hashes;
 	uint32_t number_of_filters_per_user;
 	uint32_t flatten_threshold;
+	uint32_t summary_size;
+	uint32_t shared_block_size;
 } honas_gather_config_t;
 
 /** Initialize honas gather configuration structure
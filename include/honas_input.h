@@ -31,6 +31,25 @@
 #include "config.h"
 #include "honas_state.h"
 
+/** Maximum length of a host name in presentation format (with every octet escaped as `\DDD`) */
+#define HONAS_INPUT_HOST_NAME_MAX 1024
+
+/** A host name lookup, as returned by the batched `next_batch` callback */
+struct honas_input_lookup {
+	/** When the lookup was made, in seconds since the Unix epoch (or 0 if unknown) */
+	uint64_t timestamp;
+	/** The sub-second part of when the lookup was made, in nanoseconds (or 0 if unknown) */
+	uint32_t timestamp_nsec;
+	/** The client that made the lookup */
+	struct in_addr46 client;
+	/** The DNS query type of the lookup */
+	uint16_t qtype;
+	/** The length of the host name in bytes */
+	size_t host_name_length;
+	/** The host name in presentation format (not nul-terminated) */
+	uint8_t host_name[HONAS_INPUT_HOST_NAME_MAX];
+};
+
 /** Callback function used to initialize some possible input state
  *
  * This function will always be called for all input modules, even those that
@@ -94,6 +113,23 @@ typedef void(input_finalize_config_fn_t)(void* input_state);
  */
 typedef ssize_t(input_next_fn_t)(void* input_state, struct in_addr46 *client, uint8_t **host_name);
 
+/** Callback function that gets called to read a batch of next inputs
+ *
+ * This function is only called for the selected input method, instead of
+ * 'next', and will be called multiple times. Reading many lookups per call
+ * saves a call per lookup for bulk input, such as capture files.
+ *
+ * The same rules for system call errors apply as for 'next'.
+ *
+ * \param input_state The honas input state context
+ * \param lookups     The lookups to fill in
+ * \param max_lookups The maximum number of lookups to fill in
+ * \returns The number of lookups filled in on success (at least 1),
+ *          0 if the end of the input has been reached
+ *          or -1 on error (errno must be set appropriately)
+ */
+typedef ssize_t(input_next_batch_fn_t)(void* input_state, struct honas_input_lookup* lookups, size_t max_lookups);
+
 /** Structure describing a honas input and is to be filled by specific honas input modules */
 typedef struct {
 	/** The name of the honas input module */
@@ -106,6 +142,8 @@ typedef struct {
 	input_finalize_config_fn_t* finalize_config;
 	/** Required callback function for retrieving the next host name lookup */
 	input_next_fn_t* next;
+	/** Optional callback function for retrieving a batch of next host name lookups */
+	input_next_batch_fn_t* next_batch;
 	/** Optional callback function for cleaning up the input module state */
 	input_destroy_fn_t* destroy;
 } honas_input_t;
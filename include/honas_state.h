@@ -39,10 +39,34 @@
 #include "subnet_activity.h"
 
 #include <ldns/ldns.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
 
 #define HONAS_STATE_FILE_MAGIC "DNSBLOOM"
-#define CURRENT_HONAS_STATE_MAJOR_VERSION 1
-#define CURRENT_HONAS_STATE_MINOR_VERSION 0
+#define CURRENT_HONAS_STATE_MAJOR_VERSION 2
+#define CURRENT_HONAS_STATE_MINOR_VERSION 2
+
+/* Version 1 state files can still be loaded */
+#define LEGACY_HONAS_STATE_MAJOR_VERSION 1
+#define LEGACY_HONAS_STATE_MINOR_VERSION 1
+
+/* Maximum number of times the filters can be folded in half */
+#define HONAS_STATE_MAX_FOLD_FACTOR 16
+
+/* The entity name of host name lookups by clients outside of all known subnets */
+#define HONAS_STATE_UNKNOWN_ENTITY "UNKNOWN"
+
+/* Maximum length of a canonical host name (without trailing '.') */
+#define HONAS_STATE_MAX_HOST_NAME_LENGTH 255
+
+/* Filename prefix for loading the live view of a honas state (see `honas_state_share()`) */
+#define HONAS_STATE_SHM_PREFIX "shm:"
+
+#define HONAS_LIVE_STATE_MAGIC "HONASLIV"
+#define CURRENT_HONAS_LIVE_STATE_MAJOR_VERSION 1
+#define CURRENT_HONAS_LIVE_STATE_MINOR_VERSION 0
+
+struct honas_sealed_state;
 
 /** Honas state
  *  ===========
@@ -70,6 +94,15 @@
  *       setting of the `period_begin` and `period_end` fields is a concern of
  *       the code calling these functions.
  *
+ * Completed honas states can be converted into a block compressed, read-only
+ * "sealed" honas state (see `sealed_state.h`). Sealed honas states can be
+ * loaded using `honas_state_load()` as well.
+ *
+ * A honas state that's being updated can be shared with other processes as a
+ * "live view" using `honas_state_share()`; these can load it read-only using
+ * `honas_state_load()` with the name of the shared memory segment prefixed by
+ * `shm:` as filename.
+ *
  * Registering host name lookups
  * -----------------------------
  *
@@ -116,6 +149,15 @@
  * can be made as long as they are backwards compatible by increasing the minor
  * number.
  *
+ * In version 1 state files the header is followed by `filter_bits_set`, the
+ * header extension (since version 1.1) and a fixed layout of filters and
+ * hyperloglog data described by the header fields.
+ *
+ * In version 2 state files the header is directly followed by a section
+ * table (see `struct honas_state_section_table`) describing where all data is
+ * located. The `first_filter_offset` and `padding_after_*` fields are 0 and
+ * there's no header extension.
+ *
  * \note All integers are in little endian byte order
  */
 struct honas_state_file_header {
@@ -148,9 +190,126 @@ struct honas_state_file_header {
 	// Stats (These only get updated by `honas_state_persist()` when saving to disk)
 	uint32_t estimated_number_of_clients;    ///< Estimated number of distinct clients
 	uint32_t estimated_number_of_host_names; ///< Estimated number of distinct host names
-	// followed by: uint32_t filter_bits_set[number_of_filters];
+	// version 1: followed by: uint32_t filter_bits_set[number_of_filters];
+	// version 1: followed by: struct honas_state_file_header_extension (since version 1.1)
+	// version 2: followed by: struct honas_state_section_table
+} __attribute__((packed));
+
+/** Honas state sampling information
+ *
+ * When `honas-gather` falls behind on its input it only registers the host
+ * name lookups of 1 in `sampling_rate` clients (see \ref overload). The
+ * lookups of all other clients are shed, and only counted here.
+ */
+struct honas_state_sampling {
+	uint32_t sampling_rate;           ///< Highest sampling rate (1 in N clients) applied during the period (1 if never sampled)
+	uint32_t reserved;                ///< Reserved for future use (should be 0)
+	uint64_t number_of_shed_requests; ///< Number of requests that were shed
+	uint64_t first_shed_request;      ///< Timestamp of the first request that was shed (0 if none)
+	uint64_t last_shed_request;       ///< Timestamp of the last request that was shed (0 if none)
 } __attribute__((packed));
 
+/** Honas state file header extension
+ *
+ * Present since state file version 1.1, directly following `filter_bits_set`.
+ * The sampling information was added later on; it's only present when the
+ * `extension_size` covers it.
+ *
+ * \note Folded filters are smaller than `number_of_bits_per_filter`, which
+ *       makes state files with folded filters fail the file size check of
+ *       version 1.0 readers.
+ */
+struct honas_state_file_header_extension {
+	uint32_t extension_size; ///< Size of the header extension (allows for future additions)
+	uint32_t fold_factor;    ///< Number of times the filters have been folded in half (see `honas_state_fold()`)
+	struct honas_state_sampling sampling; ///< Sampling information (if `extension_size` covers it)
+} __attribute__((packed));
+
+/* Size of the original (version 1.1) header extension */
+#define HONAS_STATE_FILE_HEADER_EXTENSION_MIN_SIZE offsetof(struct honas_state_file_header_extension, sampling)
+
+/** Types of honas state file sections */
+enum honas_state_section_type {
+	HONAS_STATE_SECTION_FILTER_BITS_SET = 1, ///< `uint32_t filter_bits_set[number_of_filters]`
+	HONAS_STATE_SECTION_FILTER = 2,          ///< A bloom filter (one section for each filter, in order)
+	HONAS_STATE_SECTION_CLIENT_HLL = 3,      ///< Hyperloglog data to estimate the number of distinct clients
+	HONAS_STATE_SECTION_HOST_NAME_HLL = 4,   ///< Hyperloglog data to estimate the number of distinct host names
+	HONAS_STATE_SECTION_SUMMARY = 5,         ///< All filters folded into a single small filter (optional, see `honas_state_t::summary_size`)
+	HONAS_STATE_SECTION_SAMPLING = 6,        ///< `struct honas_state_sampling` (optional, since version 2.1)
+	HONAS_STATE_SECTION_OFFSET_SCHEME = 7,   ///< `struct honas_state_offset_scheme` (required, since version 2.2)
+};
+
+/** How the bit offsets of a host name in each of the filters are determined */
+enum honas_state_offset_scheme_type {
+	HONAS_STATE_OFFSET_SCHEME_PER_FILTER = 0, ///< Each filter uses its own transform of the host name hash (the default)
+	HONAS_STATE_OFFSET_SCHEME_SHARED_BLOCKS = 1, ///< Each filter uses its own transform within a block shared by all filters (see `honas_state_use_shared_blocks()`)
+};
+
+/* Smallest block size of the shared blocks offset scheme (a cache line) */
+#define HONAS_STATE_MIN_SHARED_BLOCK_SIZE 64
+
+/** Honas state offset scheme
+ *
+ * State files without this section use `HONAS_STATE_OFFSET_SCHEME_PER_FILTER`.
+ */
+struct honas_state_offset_scheme {
+	uint32_t offset_scheme; ///< The offset scheme (see `enum honas_state_offset_scheme_type`)
+	uint32_t block_size;    ///< Size in bytes of the shared blocks (0 for `HONAS_STATE_OFFSET_SCHEME_PER_FILTER`)
+} __attribute__((packed));
+
+/* Readers that don't know the type of this section must refuse the state file */
+#define HONAS_STATE_SECTION_FLAG_REQUIRED 0x1
+/* The checksum of this section is valid */
+#define HONAS_STATE_SECTION_FLAG_CHECKSUM 0x2
+
+/** Honas state file section table
+ *
+ * Present since state file version 2, directly following the state file
+ * header. Readers skip sections of types they don't know about (unless the
+ * section is flagged as required), so new (optional) sections can be added
+ * without breaking existing readers.
+ */
+struct honas_state_section_table {
+	uint32_t number_of_sections; ///< Number of entries in the section table
+	uint32_t section_size;       ///< Size of each entry (allows for future additions)
+	// followed by: struct honas_state_section sections[number_of_sections];
+} __attribute__((packed));
+
+/** Honas state file section table entry */
+struct honas_state_section {
+	uint32_t type;     ///< Type of the section (see `enum honas_state_section_type`)
+	uint32_t flags;    ///< Section flags (`HONAS_STATE_SECTION_FLAG_*`)
+	uint64_t offset;   ///< Start of the section data from the beginning of the state file
+	uint64_t length;   ///< Length of the section data
+	uint32_t checksum; ///< CRC-32C of the section data (if `HONAS_STATE_SECTION_FLAG_CHECKSUM` is set)
+	uint32_t reserved; ///< Reserved for future use (should be 0)
+} __attribute__((packed));
+
+/** Live view header
+ *
+ * The shared memory segment of a shared honas state begins with this header,
+ * followed by a snapshot of `filter_bits_set`. The (version 2) honas state data
+ * itself begins at `state_offset`.
+ *
+ * The header fields and counters inside the honas state data are updated
+ * without synchronization, so readers use the snapshot instead. The snapshot
+ * is protected by a sequence lock: `sequence` is odd while it's being updated.
+ * The filters are read directly; their bits only ever change from 0 to 1.
+ *
+ * \note All integers are in host byte order
+ */
+struct honas_live_state_header {
+	char magic[8];          ///< Live view identification string (`HONASLIV`)
+	uint32_t major_version; ///< Live view major version
+	uint32_t minor_version; ///< Live view minor version
+	uint64_t sequence;      ///< Sequence lock of the snapshot
+	uint64_t state_offset;  ///< Start of the honas state data (page aligned)
+	uint64_t state_size;    ///< Size of the honas state data
+	uint64_t published;     ///< Time at which the snapshot was taken
+	struct honas_state_file_header state_header; ///< Snapshot of the honas state header
+	// followed by: uint32_t filter_bits_set[number_of_filters];
+};
+
 /** Opened Honas state handle */
 typedef struct {
 	/* Cached information based on data from the header (pointers point inside the honas state `mmap()`-ed data) */
@@ -160,6 +319,14 @@ typedef struct {
 	byte_slice_t client_count_registers;       ///< Hyperloglog data inside the honas state file to estimate number of distinct clients
 	byte_slice_t host_name_count_registers;    ///< Hyperloglog data inside the honas state file to estimate number of distinct host names
 	uint32_t* filter_bits_set;                 ///< References the sequence for `filter_bits_set` inside the honas state file header
+	struct honas_sealed_state* sealed;         ///< The sealed honas state when a sealed state file was loaded read-only (`filters` is `NULL` in that case)
+	uint32_t fold_factor;                      ///< Number of times the filters have been folded in half
+	struct honas_state_section_table* section_table; ///< The section table inside the honas state file (`NULL` for version 1 and sealed state files)
+	byte_slice_t summary;                      ///< The summary of all filters when loaded read-only from a state file that has one (empty otherwise)
+	uint32_t summary_size;                     ///< Maximum size of the summary of all filters added by `honas_state_persist()` (0 for none)
+	struct honas_live_state_header* live;      ///< The live view header when shared using `honas_state_share()` (`NULL` otherwise)
+	struct honas_state_sampling* sampling;     ///< Sampling information inside the honas state file (`NULL` when the state file has none)
+	uint32_t shared_block_size;                ///< Size in bytes of the block holding the bit offsets of a host name in all filters (0 when not shared, see `honas_state_use_shared_blocks()`)
 
 	/* HyperLogLog states for client and host name cardinality estimation */
 	hll client_count;    ///< Hyperloglog instance used to estimate the number of distinct clients
@@ -170,6 +337,19 @@ typedef struct {
 	size_t size; ///< The size of the `mmap()`-ed honas state file
 } honas_state_t;
 
+/** Get the number of bits actually stored for each filter
+ *
+ * This is `number_of_bits_per_filter` unless the filters have been folded.
+ *
+ * \param state The honas state
+ * \returns The number of bits stored for each filter
+ * \ingroup honas_state
+ */
+static inline uint32_t honas_state_stored_bits_per_filter(const honas_state_t* state)
+{
+	return state->header->number_of_bits_per_filter >> state->fold_factor;
+}
+
 /** Create a new honas state
  *
  * \param state                      The honas state structure that is to be initialized
@@ -183,14 +363,64 @@ typedef struct {
  */
 extern int honas_state_create(honas_state_t* state, uint32_t number_of_filters, uint32_t number_of_bits_per_filter, uint32_t number_of_hashes, uint32_t number_of_filters_per_user, uint32_t flatten_threshold);
 
+/** Create a new honas state with folded filters
+ *
+ * Like `honas_state_create()`, but each filter only stores `number_of_bits_per_filter >> fold_factor` bits.
+ *
+ * \param state                      The honas state structure that is to be initialized
+ * \param number_of_filters          Number of filters in the new honas state
+ * \param number_of_bits_per_filter  Number of bits each of the filters (before folding)
+ * \param number_of_hashes           The number of hashes that should be set in each filter for every value
+ * \param number_of_filters_per_user The number of filters that should be updated for each user
+ * \param flatten_threshold          The threshold of estimated distinct clients below which the search results should be flattened for the given properties
+ * \param fold_factor                The number of times the filters have been folded in half
+ * \returns 0 on success or -1 on error (errno is set appropriately)
+ * \ingroup honas_state
+ */
+extern int honas_state_create_folded(honas_state_t* state, uint32_t number_of_filters, uint32_t number_of_bits_per_filter, uint32_t number_of_hashes, uint32_t number_of_filters_per_user, uint32_t flatten_threshold, uint32_t fold_factor);
+
+/** Make all filters of a newly created honas state keep the bit offsets of a host name in a shared block
+ *
+ * By default the bit offsets of a host name lie anywhere in each filter, so
+ * that checking a host name touches up to `number_of_hashes` pages of every
+ * filter. With shared blocks the filters are divided into blocks of
+ * `block_size` bytes; the block is determined once for each host name and is
+ * the same in all filters, while the bit offsets within the block are still
+ * determined by the transform of the filter, so that the false positives of
+ * the filters stay independent. Checking a host name then only touches a
+ * single block of each filter, and sealing the honas state interleaves the
+ * blocks of all filters (see `sealed_state.h`).
+ *
+ * The offset scheme is stored in a required section, so programs that don't
+ * know about it refuse the state file instead of giving wrong results.
+ *
+ * \note This must be done before any host name lookups are registered
+ *
+ * \param state      The honas state created by `honas_state_create()` or `honas_state_create_folded()`
+ * \param block_size The size in bytes of the shared blocks (a power of two of at least `HONAS_STATE_MIN_SHARED_BLOCK_SIZE` that divides the (folded) filter size)
+ * \returns 0 on success or -1 if the block size isn't valid for the honas state (errno is set to `EINVAL`)
+ * \ingroup honas_state
+ */
+extern int honas_state_use_shared_blocks(honas_state_t* state, uint32_t block_size);
+
 /** Load a honas state from a file
  *
  * \note When opening the honas state as `read-only` only the functions `honas_state_check_host_name_lookups()` and `honas_state_destroy()` may be called
+ *       (and it may be used as `source` for `honas_state_aggregate_combine()`)
+ *
+ * Sealed honas state files are decompressed on demand when opened read-only and
+ * are decompressed entirely into memory when opened read-write.
+ *
+ * The live view of a honas state shared using `honas_state_share()` is loaded
+ * (read-only only) using its name prefixed by `HONAS_STATE_SHM_PREFIX` as
+ * `filename`. Its filters aren't copied, so searches see the host name lookups
+ * registered since loading as well. The header and `filter_bits_set` are those
+ * of the latest snapshot; a summary isn't used, as it's outdated.
  *
  * \param state     The honas state structure that is to be initialized
  * \param filename  The filename of the honas state on disk that should be loaded
  * \param read_only Whether the honas state should be opened read-only (and otherwise it will be opened for read-write)
- * \returns 0 on success or -1 on error (errno is set appropriately)
+ * \returns 0 on success, -1 on error (errno is set appropriately), 1 if the file is not a (supported) honas state or 2 if the file contains errors
  * \ingroup honas_state
  */
 extern int honas_state_load(honas_state_t* state, const char* filename, bool read_only);
@@ -243,6 +473,82 @@ struct dry_run_counters
 extern void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timestamp, const struct in_addr46* client, const uint8_t* host_name
 	, size_t host_name_length, const uint8_t* entity_prefix, size_t entity_prefix_length, struct dry_run_counters* p_dryrun, const ldns_rr_type qtype);
 
+/** Register a host name lookup that was shed
+ *
+ * This is the function that `honas-gather` uses instead of
+ * `honas_state_register_host_name_lookup()` for the lookups of clients that
+ * aren't sampled while overloaded. Only the sampling information is updated;
+ * it's ignored for honas states without sampling information.
+ *
+ * \param state         The honas state to update
+ * \param timestamp     The timestamp of the host name lookup request
+ * \param sampling_rate The sampling rate (1 in N clients) in effect
+ * \ingroup honas_state
+ */
+extern void honas_state_register_shed_host_name_lookup(honas_state_t* state, uint64_t timestamp, uint32_t sampling_rate);
+
+/** Canonicalize a host name the way it's registered in the honas state
+ *
+ * Host names are registered in lower case and without a trailing '.'. Longer
+ * host names than `HONAS_STATE_MAX_HOST_NAME_LENGTH` are truncated.
+ *
+ * \param host_name             The host name to canonicalize
+ * \param host_name_length      The length of the host name
+ * \param canonical_host_name   Updated with the zero terminated canonical host name (at least `HONAS_STATE_MAX_HOST_NAME_LENGTH + 1` bytes)
+ * \returns The length of the canonical host name
+ * \ingroup honas_state
+ */
+extern size_t honas_state_canonicalize_host_name(const uint8_t* host_name, size_t host_name_length, uint8_t* canonical_host_name);
+
+/** Determine the hash of a canonical host name as it's registered in the honas state
+ *
+ * \param entity_prefix         The entity name prefix (or `NULL` for none)
+ * \param entity_prefix_length  The entity name length
+ * \param host_name             The canonical host name (or one of its labels)
+ * \param host_name_length      The length of the host name
+ * \param host_name_hash        Updated with the `SHA256_DIGEST_LENGTH` byte hash of `host_name` (prefixed by "<entity_prefix>@")
+ * \ingroup honas_state
+ */
+extern void honas_state_host_name_hash(const uint8_t* entity_prefix, size_t entity_prefix_length, const uint8_t* host_name, size_t host_name_length, uint8_t* host_name_hash);
+
+/** The state of hashing the "<entity>@" prefix of entity specific host names
+ *
+ * Continuing from this SHA-256 midstate saves hashing the entity name prefix
+ * again for each host name.
+ */
+struct honas_entity_prefix {
+	EVP_MD_CTX* sha256; ///< SHA-256 midstate after the "<entity>@" prefix
+};
+
+/** Prepare hashing host names for an entity
+ *
+ * \param prefix                The entity prefix to initialize (to be destroyed using `honas_state_entity_prefix_destroy()`)
+ * \param entity_prefix         The entity name prefix
+ * \param entity_prefix_length  The entity name length
+ * \ingroup honas_state
+ */
+extern void honas_state_entity_prefix_init(struct honas_entity_prefix* prefix, const uint8_t* entity_prefix, size_t entity_prefix_length);
+
+/** Release the resources of an entity prefix
+ *
+ * \param prefix The entity prefix initialized by `honas_state_entity_prefix_init()`
+ * \ingroup honas_state
+ */
+extern void honas_state_entity_prefix_destroy(struct honas_entity_prefix* prefix);
+
+/** Determine the hash of an entity specific canonical host name as it's registered in the honas state
+ *
+ * This gives the same hash as `honas_state_host_name_hash()` with the entity name prefix of `prefix`.
+ * The prefix isn't changed, so it may be used by concurrent threads.
+ *
+ * \param prefix                The entity prefix (see `honas_state_entity_prefix_init()`)
+ * \param host_name             The canonical host name (or one of its labels)
+ * \param host_name_length      The length of the host name
+ * \param host_name_hash        Updated with the `SHA256_DIGEST_LENGTH` byte hash
+ * \ingroup honas_state
+ */
+extern void honas_state_entity_host_name_hash(const struct honas_entity_prefix* prefix, const uint8_t* host_name, size_t host_name_length, uint8_t* host_name_hash);
+
 /** Check if the host name hash matches possible lookups
  *
  * This is the function that `honas-search` uses to check which host name lookups might be present in the honas state.
@@ -251,11 +557,115 @@ extern void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t
  * \param host_name_hash The hash of th host name that is to be looked up
  * \param filters_hit    Optional bitset that gets updated with which filters had possible hits
  * \returns Number of filters with possible hits
+ * \note Filters of a sealed honas state that can't be checked due to a corrupt
+ *       block don't count as hit, see `honas_state_has_errors()`
  * \ingroup honas_state
  */
 extern uint32_t honas_state_check_host_name_lookups(honas_state_t* state, const byte_slice_t host_name_hash, bitset_t* filters_hit);
 
+/** Check if two honas states use the same bit offsets for a host name hash
+ *
+ * The bit offsets only depend on the number of filters, the number of bits per
+ * filter (before folding), the number of hashes and the size of the shared
+ * blocks (if any), so states sharing those can be checked using the offsets
+ * from `honas_state_host_name_offsets()` of either.
+ *
+ * \param state The honas state
+ * \param other The other honas state
+ * \returns `true` if the bit offsets are the same, `false` otherwise
+ * \ingroup honas_state
+ */
+extern bool honas_state_offsets_compatible(const honas_state_t* state, const honas_state_t* other);
+
+/** Determine the bit offsets of a host name hash in all filters of a honas state
+ *
+ * The offsets are those of the unfolded filters; `honas_state_check_host_name_offsets()`
+ * maps them onto the folded filters where needed. With shared blocks the
+ * offsets of all filters lie in the same block.
+ *
+ * \param state          The honas state
+ * \param host_name_hash The hash of the host name that is to be looked up
+ * \param bit_offsets    Updated with `number_of_hashes` bit offsets for each of the `number_of_filters` filters
+ * \ingroup honas_state
+ */
+extern void honas_state_host_name_offsets(const honas_state_t* state, const byte_slice_t host_name_hash, size_t* bit_offsets);
+
+/** Check if the host name with the given bit offsets matches possible lookups
+ *
+ * When the honas state has a summary of all filters, the filters are only
+ * checked if the summary contains the bit offsets as well. Host names that
+ * weren't looked up thereby mostly don't touch the (cold) filter pages.
+ *
+ * \param state       The honas state to check
+ * \param bit_offsets The bit offsets from `honas_state_host_name_offsets()` (of a compatible honas state)
+ * \param filters_hit Optional bitset that gets updated with which filters had possible hits
+ * \returns Number of filters with possible hits
+ * \note Filters of a sealed honas state that can't be checked due to a corrupt
+ *       block don't count as hit, see `honas_state_has_errors()`
+ * \ingroup honas_state
+ */
+extern uint32_t honas_state_check_host_name_offsets(honas_state_t* state, const size_t* bit_offsets, bitset_t* filters_hit);
+
+/** Check whether checking host names against the honas state ran into corrupt data
+ *
+ * Only sealed honas states are checked lazily, a block at a time; once a
+ * corrupt block has been found the results of the honas state are incomplete.
+ *
+ * \param state The honas state
+ * \returns `true` if a corrupt block has been found, `false` otherwise
+ * \ingroup honas_state
+ */
+extern bool honas_state_has_errors(const honas_state_t* state);
+
+/** Determine the filter bytes that checking the host name with the given bit offsets may read
+ *
+ * These are the bytes containing the (folded) bit offsets of each filter,
+ * except for the filters that the summary rules out, which aren't read at all.
+ *
+ * \param state       The honas state to check
+ * \param bit_offsets The bit offsets from `honas_state_host_name_offsets()` (of a compatible honas state)
+ * \param addresses   Updated with the address of each byte (room for `number_of_filters * number_of_hashes` addresses)
+ * \returns The number of addresses (0 for sealed honas states, which don't map their filters)
+ * \ingroup honas_state
+ */
+extern size_t honas_state_host_name_bytes(const honas_state_t* state, const size_t* bit_offsets, const uint8_t** addresses);
+
+/** Advise the kernel not to read ahead around the filter pages being checked
+ *
+ * Only the few host names that pass the summary touch the filters of a honas
+ * state with a summary. Reading ahead around each of those (for instance with a
+ * large `read_ahead_kb` of the block device) can read most of the filters
+ * anyway. This does slow down checking many host names that pass the summary.
+ *
+ * \param state The honas state loaded read-only (with a summary)
+ * \returns 0 on success, 1 if the honas state has no summary or -1 on error (errno is set appropriately)
+ * \ingroup honas_state
+ */
+extern int honas_state_advise_random_access(honas_state_t* state);
+
+/** Create a summary of all filters of a honas state
+ *
+ * The summary is the largest filter of at most `summary_size` bytes into
+ * which all filters can be folded, with all filters folded into it.
+ *
+ * \param state        The (unsealed) honas state
+ * \param summary_size The maximum size of the summary in bytes
+ * \param summary      Set to the newly allocated summary (to be freed by the caller), or an empty slice if there's none
+ * \returns 0 on success, 1 if the filters can't be folded into that size or too many of the bits of the summary would be set to be of any use, or -1 on error (errno is set appropriately)
+ * \ingroup honas_state
+ */
+extern int honas_state_create_summary(const honas_state_t* state, size_t summary_size, byte_slice_t* summary);
+
 /** Save the honas state to file
+ *
+ * A summary section with all filters folded into a single filter of at most
+ * `summary_size` bytes is added to version 2 honas states that don't have
+ * one yet. No summary is added when too many of its bits would be set to be
+ * of any use. The summary of a honas state that has one is always updated.
+ *
+ * The header, checksums, filter bits set, hyperloglog data and summary are
+ * updated in the state file only; the honas state data itself isn't changed,
+ * as it may be shared with other processes (see `honas_state_share()`).
  *
  * \param state    The honas state that is to be saved
  * \param filename The name of the file the state is to be saved to
@@ -265,12 +675,168 @@ extern uint32_t honas_state_check_host_name_lookups(honas_state_t* state, const
  */
 extern void honas_state_persist(honas_state_t* state, const char* filename, bool blocking);
 
+/** Share the honas state with other processes as a live view
+ *
+ * The honas state data is moved into a new POSIX shared memory segment named
+ * `name`, replacing any segment by that name (processes that have that one
+ * loaded keep using it). The addresses of the honas state data don't change.
+ * A snapshot of the header is published right away.
+ *
+ * \param state The version 2 honas state that is being updated
+ * \param name  The name of the shared memory segment (without leading '/')
+ * \returns 0 on success or -1 on error (errno is set appropriately; the honas state is unchanged)
+ * \ingroup honas_state
+ */
+extern int honas_state_share(honas_state_t* state, const char* name);
+
+/** Publish a snapshot of the header of a shared honas state
+ *
+ * Determines the estimated number of clients and host names, like
+ * `honas_state_persist()` does. The number of bits set in each filter is kept
+ * up to date while registering host name lookups, so it's only copied. Does
+ * nothing for honas states that aren't shared.
+ *
+ * \param state The honas state shared using `honas_state_share()`
+ * \ingroup honas_state
+ */
+extern void honas_state_publish(honas_state_t* state);
+
+/** Remove the shared memory segment of a live view
+ *
+ * \param name The name of the shared memory segment (without leading '/')
+ * \returns 0 on success or -1 on error (errno is set appropriately)
+ * \ingroup honas_state
+ */
+extern int honas_state_unshare(const char* name);
+
+/** Copy the honas state into a new memory file to hand it over to another process
+ *
+ * The hyperloglog data is made dense and stored in the honas state data first,
+ * like `honas_state_persist()` does, so the copy is complete. The honas state
+ * remains usable. The memory file can be passed to another process, which then
+ * takes the honas state over using `honas_state_import()`.
+ *
+ * \param state The honas state to be copied
+ * \returns The file descriptor of the memory file (close-on-exec) or -1 on error (errno is set appropriately)
+ * \ingroup honas_state
+ */
+extern int honas_state_export(honas_state_t* state);
+
+/** Take over a honas state from a memory file created by `honas_state_export()`
+ *
+ * The memory file is mapped shared and read-write, without copying. The file
+ * descriptor can be closed afterwards.
+ *
+ * \param state An empty honas state structure
+ * \param fd    The file descriptor of the memory file
+ * \returns 0 on success, -1 on error (errno is set appropriately), 1 when it's not a honas state and 2 when the honas state contains errors
+ * \ingroup honas_state
+ */
+extern int honas_state_import(honas_state_t* state, int fd);
+
+/** Fold the filters of a honas state
+ *
+ * Creates a new honas state in which each filter is folded in half until it's
+ * `number_of_bits_per_filter >> fold_factor` bits in size. This reduces the
+ * size of the state at the expense of a higher false positive rate. Lookups
+ * (and registrations) work on folded honas states just like on unfolded ones.
+ *
+ * \param folded      The honas state structure that is to be initialized with the folded state
+ * \param state       The honas state to fold
+ * \param fold_factor The total number of times the filters should be folded in half (should be at least the current fold factor of `state`)
+ * \returns 0 on success or -1 on error (errno is set appropriately, `EINVAL` if the filters can't be folded that many times)
+ * \ingroup honas_state
+ */
+extern int honas_state_fold(honas_state_t* folded, honas_state_t* state, uint32_t fold_factor);
+
+/** Get a section of a honas state by its position in the section table
+ *
+ * \param state The honas state
+ * \param index The index in the section table
+ * \returns The section or `NULL` if there's no such section (or the honas state has no section table)
+ * \ingroup honas_state
+ */
+extern const struct honas_state_section* honas_state_get_section(const honas_state_t* state, uint32_t index);
+
+/** Find a section in a honas state
+ *
+ * \param state The honas state
+ * \param type  The type of section to find
+ * \param index Which of the sections of that type to find (0 for the first)
+ * \returns The section or `NULL` if the honas state has no such section (or is a version 1 state)
+ * \ingroup honas_state
+ */
+extern const struct honas_state_section* honas_state_find_section(const honas_state_t* state, uint32_t type, uint32_t index);
+
+/** Get the data of a honas state section
+ *
+ * \param state   The honas state
+ * \param section The section of that honas state
+ * \returns The section data (inside the `mmap()`-ed honas state)
+ * \ingroup honas_state
+ */
+extern byte_slice_t honas_state_section_data(const honas_state_t* state, const struct honas_state_section* section);
+
+/** Get the name of a honas state section type
+ *
+ * \param type The type of section
+ * \returns The name of the section type or `NULL` if it's unknown
+ * \ingroup honas_state
+ */
+extern const char* honas_state_section_type_name(uint32_t type);
+
+/** Verify the checksums of all sections of a honas state
+ *
+ * The checksums are updated by `honas_state_persist()`. Sections without a
+ * (valid) checksum are skipped.
+ *
+ * \param state The honas state to verify
+ * \returns The number of sections for which the checksum doesn't match
+ * \ingroup honas_state
+ */
+extern uint32_t honas_state_verify_sections(const honas_state_t* state);
+
+/** Open an unnamed temporary file in the directory of `filename`
+ *
+ * The file can be linked to `filename` with `linkat()` once it's completely written.
+ *
+ * \param filename The name of the file that will eventually be written
+ * \returns The file descriptor of the temporary file or -1 on error (errno is set appropriately)
+ * \ingroup honas_state
+ * \private
+ */
+extern int honas_state_open_tmpfile(const char* filename);
+
+/** Determine the fold factor from a version 1 honas state file header
+ *
+ * \param header      The honas state file header
+ * \param header_size The number of bytes available for the header, `filter_bits_set` and the header extension
+ * \param fold_factor Updated with the fold factor
+ * \returns `true` on success, `false` if the header extension is invalid (or it's not a version 1 header)
+ * \ingroup honas_state
+ * \private
+ */
+extern bool honas_state_header_fold_factor(const struct honas_state_file_header* header, size_t header_size, uint32_t* fold_factor);
+
+/** Combine the sampling information of two honas states
+ *
+ * The highest sampling rate is kept, the number of shed requests is summed
+ * and the timestamps of the first and last shed requests are widened. Nothing
+ * is done when either of the honas states has no sampling information.
+ *
+ * \param target The honas state whose sampling information is updated
+ * \param source The honas state whose sampling information is added
+ * \ingroup honas_state
+ */
+extern void honas_state_combine_sampling(honas_state_t* target, const honas_state_t* source);
+
 /** Aggregate two Bloom filter states having the same parameters.
  *
  * Takes the bitwise OR of 'target' and 'source', and places the result in 'target'.
  *
  * Returns true if the operation succeeded, and false it failed. The operation may
- * fail if the parameters are not the same.
+ * fail if the parameters (including the fold factor and offset scheme) are not the same,
+ * or if a sealed 'source' has a corrupt block; 'target' is left unchanged in that case.
  */
 extern const bool honas_state_aggregate_combine(honas_state_t* target, honas_state_t* source);
 
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INPUT_AFPACKET_H
+#define INPUT_AFPACKET_H
+
+#include "honas_input.h"
+
+/** Network interface capture input
+ *  ================================
+ *
+ * The afpacket input module captures the host name lookups from the DNS
+ * queries seen on a network interface, such as a SPAN port or a mirror of the
+ * resolver's traffic, for sites where dnstap can't be enabled.
+ *
+ * Each worker thread captures from its own `AF_PACKET` socket with a memory
+ * mapped `TPACKET_V3` receive ring, and the sockets are joined in a
+ * `PACKET_FANOUT` group that spreads the packets over the workers by flow
+ * hash. The workers parse the DNS queries (sent to port 53 over UDP or TCP)
+ * in place from the ring, see \ref dns_packet, and hand them over in batches
+ * to the thread that reads the input, which is notified through the file
+ * descriptor returned by `input_afpacket_fd()`.
+ *
+ * The packets are dropped by the kernel (and reported) when the lookups
+ * aren't read fast enough, rather than holding up the capture.
+ *
+ * The module is configured with the following config items:
+ *
+ * - `capture_interface`: the name of the network interface to capture from (required);
+ * - `capture_threads`: the number of worker threads (default 1);
+ * - `capture_fanout_group`: the fanout group id, so that several processes
+ *   can share the capture (default a group of its own, derived from the
+ *   process id);
+ * - `capture_ring_size`: the size of the receive ring of each worker in MiB
+ *   (default 64).
+ *
+ * Capturing requires the `CAP_NET_RAW` capability.
+ *
+ * \defgroup input_afpacket Network interface capture input
+ */
+
+/** The afpacket input module
+ *
+ * \ingroup input_afpacket
+ */
+extern const honas_input_t input_afpacket;
+
+/** Check whether a network interface to capture from has been configured
+ *
+ * \param input_state The input state context of the afpacket input module
+ * \returns `true` if the `capture_interface` config item has been set
+ * \ingroup input_afpacket
+ */
+extern bool input_afpacket_is_configured(void* input_state);
+
+/** Get the file descriptor that becomes readable when captured lookups are ready
+ *
+ * The file descriptor stays readable until the `next_batch` (or `next`)
+ * callback returns `-1` with errno `EAGAIN`, after all ready lookups have
+ * been read.
+ *
+ * \param input_state The input state context of the afpacket input module (after `finalize_config`)
+ * \returns The file descriptor to wait on
+ * \ingroup input_afpacket
+ */
+extern int input_afpacket_fd(void* input_state);
+
+/** Stop capturing from the network interface
+ *
+ * The worker threads are stopped and the capture sockets are closed, which
+ * leaves the fanout group. The lookups parsed so far can still be read, until
+ * the `next_batch` callback returns `-1` with errno `EAGAIN`; the packets that
+ * weren't parsed yet are lost.
+ *
+ * \param input_state The input state context of the afpacket input module (after `finalize_config`)
+ * \ingroup input_afpacket
+ */
+extern void input_afpacket_stop(void* input_state);
+
+/** Start capturing from the network interface again, after `input_afpacket_stop()`
+ *
+ * \param input_state The input state context of the afpacket input module (after `finalize_config`)
+ * \returns 0 on success or -1 on failure, in which case the capture stays stopped
+ * \ingroup input_afpacket
+ */
+extern int input_afpacket_start(void* input_state);
+
+#endif /* INPUT_AFPACKET_H */
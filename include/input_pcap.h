@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INPUT_PCAP_H
+#define INPUT_PCAP_H
+
+#include "honas_input.h"
+
+/** Packet capture input
+ *  ====================
+ *
+ * The pcap input module reads the host name lookups from packet captures in
+ * the pcap or pcapng file format, as written by tcpdump, Wireshark or
+ * dumpcap, without depending on libpcap.
+ *
+ * DNS queries (of the Internet class) sent to port 53 over UDP or TCP are
+ * parsed from Ethernet (with VLAN tags), Linux cooked (v1 and v2), BSD
+ * loopback and raw IP captures over IPv4 and IPv6. Each query yields a
+ * lookup of its first question, with the client being the source address of
+ * the packet and the timestamp that of the capture.
+ *
+ * TCP streams aren't reassembled: only the DNS messages that begin and end
+ * within a single segment are parsed, as is the case for most queries. IP
+ * fragments other than the first are skipped.
+ *
+ * The capture is read from standard input, unless another file is set with
+ * `input_pcap_set_fd()`. A malformed or truncated capture ends the input
+ * (with a warning), as there's no way to resynchronize on the next packet.
+ *
+ * \defgroup input_pcap Packet capture input
+ */
+
+/** The pcap input module
+ *
+ * \ingroup input_pcap
+ */
+extern const honas_input_t input_pcap;
+
+/** Set the file the capture is read from
+ *
+ * \param input_state The input state context of the pcap input module
+ * \param fd          The file to read from, which is closed when the input state is destroyed
+ * \ingroup input_pcap
+ */
+extern void input_pcap_set_fd(void* input_state, int fd);
+
+/** Check whether a file begins like a pcap or pcapng capture
+ *
+ * \param fd The file to check (which isn't read from, so the offset stays the same)
+ * \returns `true` if the file begins with the magic number of a capture
+ * \ingroup input_pcap
+ */
+extern bool input_pcap_is_capture(int fd);
+
+#endif /* INPUT_PCAP_H */
@@ -84,6 +84,15 @@ struct instrumentation
 
 	// Specifies the number of invalid frames received by the listener.
 	size_t				n_invalid_frames;
+
+	// Specifies the number of queries that were shed because of overload.
+	size_t				n_shed_queries;
+
+	// Specifies the maximum processing lag (in milliseconds) of the input.
+	size_t				max_lag;
+
+	// Specifies the maximum sampling rate (1 in N clients) that was applied.
+	size_t				max_sampling_rate;
 };
 
 // Increments and updates the number of processed queries.
@@ -116,4 +125,10 @@ void instrumentation_update_subnet_activity(struct instrumentation* p_inst, cons
 // Increments the number of invalid frames received by the listener.
 void instrumentation_increment_invalid(struct instrumentation* p_inst);
 
+// Increments the number of queries that were shed because of overload.
+void instrumentation_increment_shed(struct instrumentation* p_inst);
+
+// Updates the maximum processing lag of the input and the maximum sampling rate.
+void instrumentation_update_lag(struct instrumentation* p_inst, const size_t lag, const size_t sampling_rate);
+
 #endif // INSTRUMENTATION_H
@@ -101,6 +101,17 @@ extern void json_printer_begin(json_printer_t* ctx, FILE* out);
  */
 extern void json_printer_end(json_printer_t* ctx);
 
+/** Abandon the streaming JSON printer
+ *
+ * Like `json_printer_end()`, but for output that couldn't be completed (for
+ * example due to an error in the input it was generated from). The JSON
+ * output that was generated so far is not validated.
+ *
+ * \param ctx The json printer context to be stopped
+ * \ingroup json_printer
+ */
+extern void json_printer_abort(json_printer_t* ctx);
+
 
 /** Print a json 32-bit unsigned integral number
  *
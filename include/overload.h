@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include "includes.h"
+#include "inet.h"
+
+/* Maximum number of levels of an overload policy */
+#define OVERLOAD_MAX_LEVELS 8
+
+/* Minimum number of seconds an overload level is kept once entered */
+#define OVERLOAD_MIN_HOLD_TIME 10
+
+/** Overload protection
+ *  ===================
+ *
+ * When the honas gather process falls behind on its input, for instance
+ * because the resolver is flooded with queries, it sheds load by sampling:
+ * only the host name lookups of 1 in N clients are registered.
+ *
+ * The clients are sampled deterministically by a hash of their address, so
+ * all lookups of a sampled client are registered. The hash is independent of
+ * the one used to select the filters of a client. Clients sampled at a higher
+ * sampling rate are sampled at all lower sampling rates as well.
+ *
+ * The load is measured as the processing lag: how long ago the lookups that
+ * are being processed were made. Normally this is at most a few milliseconds,
+ * but it grows as soon as the input arrives faster than it's processed, until
+ * the resolver or the kernel start dropping the input. Unlike the amount of
+ * input waiting to be processed, which is bounded by small socket and
+ * connection buffers, the lag keeps growing with every input buffer between
+ * the resolver and the gather process.
+ *
+ * An overload policy consists of levels, each a lag threshold (in
+ * milliseconds) and the sampling rate applied once the lag reaches it. A level
+ * is left again when the lag drops below half of its threshold, but not within
+ * `OVERLOAD_MIN_HOLD_TIME` seconds after the sampling rate was last raised.
+ * This keeps the sampling rate from flapping (which would register only part
+ * of the lookups of the clients that aren't sampled) when the input is
+ * processed in bursts.
+ *
+ * \defgroup overload Overload protection
+ */
+
+/** Overload policy level */
+struct overload_level {
+	uint64_t lag;           ///< Processing lag (in milliseconds) from which this level applies
+	uint32_t sampling_rate; ///< Sampling rate (1 in N clients) of this level
+};
+
+/** Overload policy */
+struct overload_policy {
+	struct overload_level levels[OVERLOAD_MAX_LEVELS]; ///< Levels in order of increasing lag and sampling rate
+	size_t nr_levels;                                   ///< Number of levels (0 if load is never shed)
+	size_t level;                                       ///< Number of levels currently entered (0 when not overloaded)
+	uint64_t raised;                                    ///< Time at which the sampling rate was last raised
+};
+
+/** Processing lag of an input */
+struct overload_lag {
+	uint64_t lag;         ///< The highest lag (in milliseconds) measured since the lag was last taken
+	uint64_t nr_measured; ///< Number of lookups measured in total
+	uint64_t nr_taken;    ///< Number of lookups measured when the lag was last taken
+	uint64_t nr_checked;  ///< Number of lookups measured at the previous idle check
+};
+
+/** Parse an overload policy
+ *
+ * The policy is a whitespace separated list of 1 to `OVERLOAD_MAX_LEVELS` levels in the form
+ * `<lag>:<sampling rate>`, where the lag has a `ms` or `s` suffix
+ * (e.g.: `100ms:2 1s:8`). Both the lags and the sampling rates
+ * should be increasing, and the sampling rates should be at least 2.
+ *
+ * \param policy The overload policy to initialize (not overloaded)
+ * \param spec   The overload policy to parse (or `NULL` for a policy that never sheds load)
+ * \returns 0 on success or -1 if the overload policy is invalid (errno is set to `EINVAL`)
+ * \ingroup overload
+ */
+extern int overload_policy_parse(struct overload_policy* policy, const char* spec);
+
+/** Check an overload policy
+ *
+ * \param spec The overload policy to check
+ * \returns `true` if the overload policy is valid
+ * \ingroup overload
+ */
+extern bool overload_policy_is_valid(const char* spec);
+
+/** Update the overload level for the current processing lag
+ *
+ * \param policy  The overload policy
+ * \param lag     The current processing lag (in milliseconds)
+ * \param now     The current time (in seconds)
+ * \returns The sampling rate to apply (1 when not overloaded)
+ * \ingroup overload
+ */
+extern uint32_t overload_policy_update(struct overload_policy* policy, uint64_t lag, uint64_t now);
+
+/** Get the sampling rate currently applied
+ *
+ * \param policy The overload policy
+ * \returns The sampling rate to apply (1 when not overloaded)
+ * \ingroup overload
+ */
+static inline uint32_t overload_policy_sampling_rate(const struct overload_policy* policy)
+{
+	return policy->level == 0 ? 1 : policy->levels[policy->level - 1].sampling_rate;
+}
+
+/** Measure the processing lag of a lookup
+ *
+ * \param lag         The processing lag of the input
+ * \param lookup_time When the lookup was made (in milliseconds since the Unix epoch)
+ * \param now         The current time (in milliseconds since the Unix epoch)
+ * \ingroup overload
+ */
+static inline void overload_lag_measure(struct overload_lag* lag, uint64_t lookup_time, uint64_t now)
+{
+	/* Lookups from the future (clock differences) aren't lagging */
+	if (now > lookup_time && now - lookup_time > lag->lag)
+		lag->lag = now - lookup_time;
+	lag->nr_measured++;
+}
+
+/** Take the processing lag measured since the lag was last taken
+ *
+ * \param lag    The processing lag of the input
+ * \param result Where to store the highest lag (in milliseconds) measured since the lag was last taken
+ * \returns `true` if any lookups were measured since the lag was last taken
+ * \ingroup overload
+ */
+static inline bool overload_lag_take(struct overload_lag* lag, uint64_t* result)
+{
+	if (lag->nr_measured == lag->nr_taken)
+		return false;
+
+	*result = lag->lag;
+	lag->lag = 0;
+	lag->nr_taken = lag->nr_measured;
+	return true;
+}
+
+/** Check if an input is idle
+ *
+ * An idle input isn't lagging, while its lag isn't measured either.
+ *
+ * \param lag The processing lag of the input
+ * \returns `true` if no lookups were measured since the previous check
+ * \ingroup overload
+ */
+static inline bool overload_lag_is_idle(struct overload_lag* lag)
+{
+	bool idle = lag->nr_measured == lag->nr_checked;
+	lag->nr_checked = lag->nr_measured;
+	return idle;
+}
+
+/** Check if the host name lookups of a client are sampled
+ *
+ * \param client        The client that made the host name lookup
+ * \param sampling_rate The sampling rate (1 in N clients)
+ * \returns `true` if the host name lookups of the client should be registered
+ * \ingroup overload
+ */
+extern bool overload_client_is_sampled(const struct in_addr46* client, uint32_t sampling_rate);
+
+#endif /* OVERLOAD_H */
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PAGE_PREFETCH_H
+#define PAGE_PREFETCH_H
+
+#include "includes.h"
+
+/** Page prefetching
+ *  ================
+ *
+ * Checking host names against a cold (not cached) honas state faults in each
+ * filter page it touches, one page read at a time. A page prefetcher collects
+ * the pages about to be touched and gives the kernel readahead hints for these
+ * up front, so that the reads are done concurrently and checking the host
+ * names afterwards mostly hits the page cache.
+ *
+ * The hints are given with `madvise(MADV_WILLNEED)`, which starts reading the
+ * pages of a file mapping in the background and returns without waiting for
+ * them. The collected pages are sorted and adjacent pages are merged into a
+ * single hint, so that fewer system calls are made for pages close together.
+ *
+ * \defgroup page_prefetch Prefetching pages of memory mapped files
+ */
+
+/** Page prefetcher */
+struct page_prefetch;
+
+/** Create a page prefetcher
+ *
+ * \param batch_size The maximum number of pages collected before readahead hints are given for them (at least 1)
+ * \returns The page prefetcher
+ * \ingroup page_prefetch
+ */
+extern struct page_prefetch* page_prefetch_create(unsigned int batch_size);
+
+/** Request the page containing an address of a shared or read-only file mapping to be read
+ *
+ * Requests for the most recently requested pages are skipped. Readahead hints
+ * for the collected pages are given when the batch is full or by
+ * `page_prefetch_submit()`.
+ *
+ * \param prefetch The page prefetcher
+ * \param address  An address within the page to prefetch
+ * \ingroup page_prefetch
+ */
+extern void page_prefetch_page(struct page_prefetch* prefetch, const void* address);
+
+/** Give readahead hints for the collected pages without waiting for them to be read
+ *
+ * \param prefetch The page prefetcher
+ * \ingroup page_prefetch
+ */
+extern void page_prefetch_submit(struct page_prefetch* prefetch);
+
+/** Get the number of pages requested to be prefetched
+ *
+ * \param prefetch The page prefetcher
+ * \returns The number of (not skipped) pages requested
+ * \ingroup page_prefetch
+ */
+extern size_t page_prefetch_nr_pages(const struct page_prefetch* prefetch);
+
+/** Get the number of readahead hints given
+ *
+ * \param prefetch The page prefetcher
+ * \returns The number of readahead hints (each for one or more adjacent pages) given
+ * \ingroup page_prefetch
+ */
+extern size_t page_prefetch_nr_hints(const struct page_prefetch* prefetch);
+
+/** Give readahead hints for the collected pages and release the resources of the page prefetcher
+ *
+ * \param prefetch The page prefetcher
+ * \ingroup page_prefetch
+ */
+extern void page_prefetch_destroy(struct page_prefetch* prefetch);
+
+#endif /* PAGE_PREFETCH_H */
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#include "byte_slice.h"
+#include "honas_state.h"
+#include "includes.h"
+
+#define PROBE_CACHE_FILE_MAGIC "HONASPRC"
+#define PROBE_CACHE_FILE_SUFFIX ".cache"
+#define CURRENT_PROBE_CACHE_MAJOR_VERSION 1
+#define CURRENT_PROBE_CACHE_MINOR_VERSION 0
+
+/* Limits the size of a probe cache; results beyond this aren't remembered */
+#define PROBE_CACHE_MAX_ENTRIES (4 * 1024 * 1024)
+
+/** Probe result cache
+ *  ==================
+ *
+ * A probe cache remembers the result of checking host name hashes against a
+ * state file, so that repeated searches (like periodic search jobs) don't
+ * have to check the filters of the state again. The cache is stored in a
+ * sidecar file next to the state file (`<state-file>.cache`).
+ *
+ * The cache file records the identity (device, inode, size and modification
+ * time) of the state file it belongs to; a cache file that doesn't match the
+ * state file anymore is ignored and replaced when the cache is saved.
+ *
+ * Layout of a probe cache file:
+ *
+ * - `struct probe_cache_file_header`
+ * - `number_of_entries` entries of: the host name hash (`SHA256_DIGEST_LENGTH`
+ *   bytes), the number of filters hit (`uint32_t`) and the filters hit
+ *   (`filters_hit_size` bytes)
+ *
+ * \defgroup probe_cache Probe result cache operations
+ */
+
+/** Probe cache file header
+ *
+ * \note All integers are in host byte order, as probe cache files are local to
+ *       the host searching the state files
+ */
+struct probe_cache_file_header {
+	char file_magic[8];     ///< Probe cache file identification string (`HONASPRC`)
+	uint32_t major_version; ///< Probe cache file major version
+	uint32_t minor_version; ///< Probe cache file minor version
+
+	uint64_t state_device;     ///< Device of the state file
+	uint64_t state_inode;      ///< Inode of the state file
+	uint64_t state_size;       ///< Size of the state file
+	int64_t state_mtime_sec;   ///< Modification time of the state file (seconds)
+	int64_t state_mtime_nsec;  ///< Modification time of the state file (nanoseconds)
+	uint32_t number_of_filters; ///< Number of filters of the state
+	uint32_t filters_hit_size; ///< Size of the filters hit of each entry
+	uint64_t number_of_entries; ///< Number of cached probe results
+} __attribute__((packed));
+
+/** Probe result cache of a single state file */
+struct probe_cache;
+
+/** Open the probe cache of a state file
+ *
+ * A missing, corrupt or outdated cache file results in an empty cache.
+ *
+ * \param state_file The state file the cache belongs to
+ * \param state      The loaded state
+ * \returns The probe cache or NULL if the identity of the state file couldn't be determined
+ * \ingroup probe_cache
+ */
+extern struct probe_cache* probe_cache_open(const char* state_file, const honas_state_t* state);
+
+/** Lookup a cached probe result
+ *
+ * Lookups can be done concurrently, as long as no results are added meanwhile.
+ *
+ * \param cache       The probe cache
+ * \param hash        The host name hash (`SHA256_DIGEST_LENGTH` bytes)
+ * \param hits        Set to the number of filters hit
+ * \param filters_hit Set to the filters hit (bits beyond the number of filters are cleared)
+ * \returns `true` if the result was cached, `false` otherwise
+ * \ingroup probe_cache
+ */
+extern bool probe_cache_lookup(const struct probe_cache* cache, const uint8_t* hash, uint32_t* hits, byte_slice_t filters_hit);
+
+/** Add a probe result to the cache, unless it's already cached
+ *
+ * \param cache       The probe cache
+ * \param hash        The host name hash (`SHA256_DIGEST_LENGTH` bytes)
+ * \param hits        The number of filters hit
+ * \param filters_hit The filters hit
+ * \ingroup probe_cache
+ */
+extern void probe_cache_add(struct probe_cache* cache, const uint8_t* hash, uint32_t hits, const byte_slice_t filters_hit);
+
+/** Save the probe cache to its file, if results were added
+ *
+ * \param cache The probe cache
+ * \returns 0 on success or -1 on error (with `errno` set)
+ * \ingroup probe_cache
+ */
+extern int probe_cache_save(struct probe_cache* cache);
+
+/** Release the resources of a probe cache
+ *
+ * \param cache The probe cache
+ * \ingroup probe_cache
+ */
+extern void probe_cache_destroy(struct probe_cache* cache);
+
+#endif /* PROBE_CACHE_H */
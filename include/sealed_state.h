@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEALED_STATE_H
+#define SEALED_STATE_H
+
+#include "block_codec.h"
+#include "honas_state.h"
+#include "includes.h"
+#include <pthread.h>
+
+#define HONAS_SEALED_STATE_FILE_MAGIC "HONASEAL"
+#define CURRENT_HONAS_SEALED_STATE_MAJOR_VERSION 1
+#define CURRENT_HONAS_SEALED_STATE_MINOR_VERSION 3
+
+/* Sealed states with interleaved filters use shared blocks, which version 1 readers don't know about */
+#define INTERLEAVED_HONAS_SEALED_STATE_MAJOR_VERSION 2
+#define INTERLEAVED_HONAS_SEALED_STATE_MINOR_VERSION 0
+
+/* The block index is followed by a CRC-32C checksum of the compressed data of each block */
+#define HONAS_SEALED_STATE_FLAG_BLOCK_CHECKSUMS 0x1
+/* The block checksums are followed by a summary of all filters */
+#define HONAS_SEALED_STATE_FLAG_SUMMARY 0x2
+/* The blocks of all filters are interleaved and are the shared blocks of the honas state (since version 2.0, which always has this flag) */
+#define HONAS_SEALED_STATE_FLAG_INTERLEAVED 0x4
+
+#define DEFAULT_SEALED_STATE_BLOCK_SIZE (64 * 1024)
+#define DEFAULT_SEALED_STATE_CACHE_BLOCKS 64
+
+/* The plain sparse codec is left out by default: the indexed variant is only
+ * slightly bigger but a lot faster to check single bits in */
+#define DEFAULT_SEALED_STATE_CODEC_MASK (~(1U << BLOCK_CODEC_SPARSE))
+
+/** Sealed honas state
+ *  ==================
+ *
+ * A sealed honas state is a read-only, block compressed variant of a
+ * completed honas state file.  It's created with `honas_sealed_state_write()`
+ * (see the `honas-seal` program) and is transparently supported by
+ * `honas_state_load()`.
+ *
+ * Each bloom filter is split into blocks of `block_size` bytes (the last block
+ * of a filter may be shorter) which are compressed independently using one of
+ * the codecs from `block_codec.h`. A block index with an entry for every block
+ * of every filter allows locating any block without reading the others.
+ *
+ * When loaded read-only only the blocks touched by lookups are decompressed
+ * into a small LRU block cache. When not all blocks fit in the cache, lookups
+ * in blocks that aren't cached are done directly on the compressed data if the
+ * codec supports it; with random lookups in big filters few cached blocks are
+ * ever reused and decompressing a whole block for a single bit is wasteful.
+ * When loaded read-write the whole state is
+ * decompressed into memory and behaves like a regular (unsealed) honas state;
+ * persisting it writes a regular honas state file.
+ *
+ * Honas states with shared blocks (see `honas_state_use_shared_blocks()`) are
+ * sealed with interleaved filters: the block size is the size of the shared
+ * blocks and the compressed data of block `b` of all filters is stored
+ * together, ordered by block and then by filter. The bit offsets of a host
+ * name lie in the same block of each filter, so checking a host name touches
+ * a single stretch of the file instead of a block in a different place for
+ * each filter. The block index is the same as for other sealed states.
+ *
+ * A sealed state carries the summary of all filters of the honas state it was
+ * created from (see `honas_state_create_summary()`) uncompressed, so that
+ * lookups of host names that the summary rules out don't touch any blocks.
+ *
+ * The compressed data of each block is verified against its checksum the
+ * first time the block is used. A corrupt block doesn't end the process:
+ * the functions checking bits report an error and the sealed state is marked
+ * as corrupt (see `honas_state_has_errors()`), so that a search can skip its
+ * results and continue with the other states.
+ *
+ * A sealed state loaded read-only may be checked by concurrent threads: the
+ * functions checking bits and decompressing filters take a lock around their
+ * use of the block cache and checksum administration.
+ *
+ * Layout of a sealed state file:
+ *
+ * - `struct honas_sealed_state_file_header`
+ * - Copy of the original `struct honas_state_file_header` followed by `filter_bits_set`
+ * - Client and host name hyperloglog data (uncompressed)
+ * - Block index: `struct honas_sealed_state_block[number_of_filters * blocks_per_filter]`
+ * - Block checksums: `uint32_t[number_of_filters * blocks_per_filter]` (since version 1.2)
+ * - `struct honas_sealed_state_summary` followed by the summary (since version 1.3, when flagged)
+ * - Compressed block data
+ *
+ * \defgroup sealed_state Sealed honas state operations
+ */
+
+/** Sealed honas state file header
+ *
+ * \note All integers are in little endian byte order
+ */
+struct honas_sealed_state_file_header {
+	char file_magic[8];     ///< Sealed honas state file identification string (`HONASEAL`)
+	uint32_t major_version; ///< Sealed state file major version
+	uint32_t minor_version; ///< Sealed state file minor version
+
+	uint32_t block_size;        ///< Uncompressed size of each filter block
+	uint32_t blocks_per_filter; ///< Number of blocks each filter is split into
+
+	uint64_t state_header_offset;  ///< Start of the copy of the original honas state header
+	uint32_t state_header_size;    ///< Size of the original honas state header (including `filter_bits_set`)
+	uint32_t flags;                ///< Flags (`HONAS_SEALED_STATE_FLAG_*`; 0 before version 1.2)
+	uint64_t client_hll_offset;    ///< Start of the client hyperloglog data
+	uint64_t host_name_hll_offset; ///< Start of the host name hyperloglog data
+	uint64_t block_index_offset;   ///< Start of the block index
+} __attribute__((packed));
+
+/** Sealed honas state block index entry */
+struct honas_sealed_state_block {
+	uint64_t offset;   ///< Start of the compressed block data
+	uint32_t size;     ///< Size of the compressed block data
+	uint16_t codec;    ///< Codec the block was compressed with (see `enum block_codec`)
+	uint16_t reserved; ///< Reserved for future use (should be 0)
+} __attribute__((packed));
+
+/** Sealed honas state summary header (8 byte aligned) */
+struct honas_sealed_state_summary {
+	uint64_t size;     ///< Size of the summary that follows
+	uint32_t checksum; ///< CRC-32C checksum of the summary
+	uint32_t reserved; ///< Reserved for future use (should be 0)
+} __attribute__((packed));
+
+/** Opened sealed honas state */
+typedef struct honas_sealed_state {
+	const struct honas_sealed_state_file_header* header; ///< Sealed state header
+	const struct honas_state_file_header* state_header;  ///< Copy of the original honas state header
+	const struct honas_sealed_state_block* blocks;       ///< The block index
+	const uint32_t* block_checksums;                     ///< The checksums of the compressed blocks (NULL when absent)
+	byte_slice_t summary;                                ///< The summary of all filters (empty when absent)
+	const uint8_t* data;                                 ///< The `mmap()`-ed sealed state file
+	size_t size;                                         ///< The size of the `mmap()`-ed sealed state file
+	size_t filter_size;                                  ///< The size in bytes of each filter
+	uint32_t shared_block_size;                          ///< The size of the shared blocks of the interleaved filters (0 when the filters aren't interleaved)
+
+	/* LRU cache of decompressed blocks */
+	uint32_t cache_blocks;      ///< Number of blocks that fit in the cache
+	uint8_t* cache_data;        ///< Decompressed block data (`cache_blocks * block_size` bytes)
+	uint32_t* cache_block_nrs;  ///< Which block is stored in each cache slot
+	uint64_t* cache_last_used;  ///< When each cache slot was last used (0 when unused)
+	int32_t* block_cache_slots; ///< Which cache slot each block is stored in (-1 when not cached)
+	uint64_t cache_clock;       ///< Incremented on every cache access
+	uint64_t cache_hits;        ///< Number of block lookups served from the cache
+	uint64_t cache_misses;      ///< Number of block lookups that required decompression
+	bool probe_uncached;        ///< Whether to check bits in uncached blocks without decompressing them
+	uint64_t block_probes;      ///< Number of bits checked directly on compressed block data
+
+	uint8_t* block_verified;    ///< Whether the checksum of each block has been verified (NULL without checksums)
+	bool corrupt;               ///< Whether a corrupt block has been encountered
+
+	pthread_mutex_t lock;       ///< Protects the block cache, checksum administration and statistics against concurrent use
+} honas_sealed_state_t;
+
+/** Statistics about writing a sealed honas state */
+struct honas_sealed_state_write_stats {
+	uint64_t* filter_compressed_sizes;      ///< Optional array (`number_of_filters` entries) updated with the compressed size of each filter
+	uint32_t codec_blocks[BLOCK_CODEC_MAX]; ///< Number of blocks stored using each codec
+	uint64_t summary_size;                  ///< Size of the summary of all filters (0 if none)
+	uint64_t file_size;                     ///< Size of the sealed state file
+};
+
+/** Open a sealed honas state from `mmap()`-ed data
+ *
+ * \param sealed       The sealed honas state structure that is to be initialized
+ * \param data         The sealed honas state file data
+ * \param size         The size of the sealed honas state file data
+ * \param cache_blocks The number of decompressed blocks to cache
+ * \returns 0 on success, 1 if the data is not a sealed honas state or 2 if the data contains errors
+ * \ingroup sealed_state
+ */
+extern int honas_sealed_state_open(honas_sealed_state_t* sealed, const void* data, size_t size, uint32_t cache_blocks);
+
+/** Close a sealed honas state
+ *
+ * \note This does not unmap the data passed to `honas_sealed_state_open()`
+ *
+ * \param sealed The sealed honas state to close
+ * \ingroup sealed_state
+ */
+extern void honas_sealed_state_close(honas_sealed_state_t* sealed);
+
+/** Get the client hyperloglog data of a sealed honas state
+ *
+ * \param sealed The sealed honas state
+ * \returns The client hyperloglog data
+ * \ingroup sealed_state
+ */
+extern byte_slice_t honas_sealed_state_client_hll_data(const honas_sealed_state_t* sealed);
+
+/** Get the host name hyperloglog data of a sealed honas state
+ *
+ * \param sealed The sealed honas state
+ * \returns The host name hyperloglog data
+ * \ingroup sealed_state
+ */
+extern byte_slice_t honas_sealed_state_host_name_hll_data(const honas_sealed_state_t* sealed);
+
+/** Get a decompressed filter block
+ *
+ * The block is served from, or added to, the LRU block cache. The returned
+ * data stays valid until the next call to this function.
+ *
+ * \note Unlike the other functions this doesn't take the lock of the sealed
+ *       state, so it may not be used while other threads use the sealed state
+ *
+ * \param sealed The sealed honas state
+ * \param filter The index of the filter
+ * \param block  The index of the block within the filter
+ * \param data   Set to the decompressed block data
+ * \returns 0 on success or -1 if the block is corrupt (errno is set to `EBADMSG`)
+ * \ingroup sealed_state
+ */
+extern int honas_sealed_state_block(honas_sealed_state_t* sealed, uint32_t filter, uint32_t block, byte_slice_t* data);
+
+/** Check if all bits are set in a filter
+ *
+ * \param sealed      The sealed honas state
+ * \param filter      The index of the filter to check
+ * \param bit_offsets The bit offsets that should be checked (preferably sorted)
+ * \param nr_offsets  The number of bit offsets
+ * \returns 1 if all bits are set to 1, 0 otherwise or -1 if a block is corrupt (errno is set to `EBADMSG`)
+ * \ingroup sealed_state
+ */
+extern int honas_sealed_state_all_bits_set(honas_sealed_state_t* sealed, uint32_t filter, const size_t* bit_offsets, size_t nr_offsets);
+
+/** Decompress a whole filter
+ *
+ * \param sealed The sealed honas state
+ * \param filter The index of the filter to decompress
+ * \param dst    Buffer of (exactly) the filter size to decompress into
+ * \returns 0 on success or -1 if the filter data is corrupt (errno is set to `EBADMSG`)
+ * \ingroup sealed_state
+ */
+extern int honas_sealed_state_decompress_filter(honas_sealed_state_t* sealed, uint32_t filter, byte_slice_t dst);
+
+/** Bitwise OR a filter into another filter
+ *
+ * \param sealed The sealed honas state
+ * \param filter The index of the filter in the sealed state
+ * \param target The filter that gets updated
+ * \returns 0 on success or -1 if the filter data is corrupt (errno is set to `EBADMSG`)
+ * \ingroup sealed_state
+ */
+extern int honas_sealed_state_bitwise_or_filter(honas_sealed_state_t* sealed, uint32_t filter, byte_slice_t target);
+
+/** Determine the compressed size of a filter
+ *
+ * \param sealed The sealed honas state
+ * \param filter The index of the filter
+ * \returns The total size of all compressed blocks of the filter
+ * \ingroup sealed_state
+ */
+extern uint64_t honas_sealed_state_filter_compressed_size(const honas_sealed_state_t* sealed, uint32_t filter);
+
+/** Write a honas state as sealed honas state file
+ *
+ * For each block all codecs in `codec_mask` are tried and the smallest result
+ * is stored. Blocks that don't compress are stored using `BLOCK_CODEC_RAW`.
+ *
+ * Honas states with shared blocks are written with interleaved filters (as
+ * version 2 sealed state file), using the size of the shared blocks instead
+ * of `block_size`.
+ *
+ * The summary the honas state was loaded with is carried over. A honas state
+ * without one gets a summary of at most `summary_size` bytes (see
+ * `honas_state_t::summary_size`), unless no summary would be of any use.
+ *
+ * \param state      The (unsealed) honas state to write
+ * \param filename   The name of the file the sealed state is to be written to (must not exist)
+ * \param block_size The uncompressed size of the filter blocks (a multiple of 8)
+ * \param codec_mask Bitmask (`1 << codec`) of codecs that may be used
+ * \param stats      Optional statistics about the sealed state
+ * \returns 0 on success or -1 on error (errno is set appropriately)
+ * \ingroup sealed_state
+ */
+extern int honas_sealed_state_write(const honas_state_t* state, const char* filename, uint32_t block_size, uint32_t codec_mask, struct honas_sealed_state_write_stats* stats);
+
+#endif /* SEALED_STATE_H */
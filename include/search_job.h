@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEARCH_JOB_H
+#define SEARCH_JOB_H
+
+#include "honas_state.h"
+#include "includes.h"
+#include "probe_cache.h"
+
+/* Number of host names parsed before they're handed over to the worker threads */
+#define SEARCH_BATCH_SIZE 16384
+/* Number of batch entries checked by a worker thread at a time */
+#define SEARCH_CHUNK_SIZE 256
+/* Limits the memory used for remembering the results of host names that occur more than once */
+#define SEARCH_MEMO_MAX_SIZE (256 * 1024 * 1024)
+/* Maximum number of filter pages each worker thread collects before giving readahead hints for them */
+#define SEARCH_PREFETCH_BATCH_SIZE 256
+
+#define BINARY_SEARCH_JOB_FILE_MAGIC "HONASBSJ"
+#define CURRENT_BINARY_SEARCH_JOB_MAJOR_VERSION 1
+#define CURRENT_BINARY_SEARCH_JOB_MINOR_VERSION 0
+
+#define COMPILED_SEARCH_JOB_FILE_MAGIC "HONASCSJ"
+#define CURRENT_COMPILED_SEARCH_JOB_MAJOR_VERSION 1
+#define CURRENT_COMPILED_SEARCH_JOB_MINOR_VERSION 1
+
+#define BINARY_SEARCH_RESULT_FILE_MAGIC "HONASBSR"
+#define CURRENT_BINARY_SEARCH_RESULT_MAJOR_VERSION 1
+#define CURRENT_BINARY_SEARCH_RESULT_MINOR_VERSION 0
+
+/* Maximum length of a host name key in a binary or compiled search job */
+#define SEARCH_JOB_FILE_MAX_KEY_LENGTH 65536
+/* Maximum length of the host name hashes in a binary search job */
+#define BINARY_SEARCH_JOB_MAX_HASH_LENGTH 64
+
+/// \defgroup search_job Performing search jobs on honas states
+
+/** Binary search job file header
+ *
+ * A binary search job contains the same groups and host names as a JSON
+ * search job, but with raw host name hashes of `hash_length` bytes (normally
+ * the 32 byte SHA-256 hashes) that don't need decoding.
+ *
+ * The header is followed by a `struct search_job_file_entry` for each group
+ * begin, host name and group end, in the order of the search job. Each host
+ * name entry is followed by its key (`key_length` bytes, without terminating
+ * zero) and its hash. The key is optional; host names without a key are
+ * reported using their hex encoded hash.
+ *
+ * All integers are stored in host byte order.
+ */
+struct binary_search_job_header {
+	char file_magic[8];     ///< Binary search job identification string (`HONASBSJ`)
+	uint32_t major_version; ///< Binary search job major version
+	uint32_t minor_version; ///< Binary search job minor version
+	uint32_t hash_length;   ///< The length of each host name hash
+	uint32_t reserved;      ///< Reserved (should be 0)
+};
+
+/** Compiled search job file header
+ *
+ * A compiled search job contains the groups and host names of a search job
+ * together with the bit offsets of each host name, for states with a specific
+ * number of filters, bits per filter and hashes. Performing a compiled search
+ * job skips decoding and hashing the host names altogether, which pays off
+ * when the same search job is performed on many state files.
+ *
+ * The header is followed by a `struct search_job_file_entry` for each group
+ * begin, host name and group end, in the order of the original search job.
+ * Each host name entry is followed by its key (`key_length` bytes, without
+ * terminating zero) and the bit offsets of all filters
+ * (`uint32_t[number_of_filters][number_of_hashes]`, sorted per filter).
+ *
+ * All integers are stored in host byte order.
+ */
+struct compiled_search_job_header {
+	char file_magic[8];                 ///< Compiled search job identification string (`HONASCSJ`)
+	uint32_t major_version;             ///< Compiled search job major version
+	uint32_t minor_version;             ///< Compiled search job minor version
+	uint32_t number_of_filters;         ///< Number of filters the bit offsets were determined for
+	uint32_t number_of_bits_per_filter; ///< Number of bits per filter the bit offsets were determined for
+	uint32_t number_of_hashes;          ///< Number of hashes (bit offsets per filter) of each host name
+	uint32_t shared_block_size;         ///< Size of the shared blocks the bit offsets were determined for (0 when not shared, always before version 1.1)
+};
+
+/** Types of binary and compiled search job entries */
+enum search_job_file_entry_type {
+	SEARCH_JOB_FILE_GROUP_BEGIN = 0, ///< The beginning of a group
+	SEARCH_JOB_FILE_HOST_NAME = 1,   ///< A host name, followed by its key and hash or bit offsets
+	SEARCH_JOB_FILE_GROUP_END = 2,   ///< The end of a group
+};
+
+/** Binary and compiled search job entry */
+struct search_job_file_entry {
+	uint32_t type;       ///< The type of entry (see `enum search_job_file_entry_type`)
+	uint32_t key_length; ///< The length of the host name key (host names only)
+	uint64_t group_id;   ///< The id of the group (group ends only)
+};
+
+/** Search result formats */
+enum search_result_format {
+	SEARCH_RESULT_FORMAT_JSON,   ///< JSON documents (see the README)
+	SEARCH_RESULT_FORMAT_CSV,    ///< A CSV line for each host name with hits
+	SEARCH_RESULT_FORMAT_BINARY, ///< A binary search result file
+};
+
+/** Binary search result file header
+ *
+ * The header is followed by a `struct binary_search_result_entry` for each
+ * searched state, which is followed by the entries for the host names with
+ * hits and their groups. The host names with hits of a group precede the entry
+ * of the group itself. Groups without any hits have no entry.
+ *
+ * All integers are stored in host byte order.
+ */
+struct binary_search_result_header {
+	char file_magic[8];     ///< Binary search result identification string (`HONASBSR`)
+	uint32_t major_version; ///< Binary search result major version
+	uint32_t minor_version; ///< Binary search result minor version
+};
+
+/** Types of binary search result entries */
+enum binary_search_result_entry_type {
+	BINARY_SEARCH_RESULT_STATE = 0,     ///< `value` is the period begin and `hits` the number of filters
+	BINARY_SEARCH_RESULT_HOST_NAME = 1, ///< `value` is the index of the host name in the search job
+	BINARY_SEARCH_RESULT_GROUP = 2,     ///< `value` is the group id and `hits` the number of filters hit by all host names
+};
+
+/* The results of the state have been flattened */
+#define BINARY_SEARCH_RESULT_FLATTENED 0x1
+
+/** Binary search result entry */
+struct binary_search_result_entry {
+	uint16_t type;  ///< The type of entry (see `enum binary_search_result_entry_type`)
+	uint16_t flags; ///< Flags (`BINARY_SEARCH_RESULT_FLATTENED`; states only)
+	uint32_t hits;  ///< The number of filters hit
+	uint64_t value; ///< Type specific value
+};
+
+/** A honas state that is to be searched */
+struct search_job_state {
+	/** The loaded honas state */
+	honas_state_t* state;
+
+	/** Whether the number of filters hit should be flattened to 0 or 1 */
+	bool flatten_results;
+
+	/** Earlier probe results of the state, that are used and extended by the search (optional) */
+	struct probe_cache* probe_cache;
+
+	/** A coarser state combined from (at least) this state, which is only searched to skip checking
+	 * host names that it doesn't contain against this state (optional; it may be covered itself) */
+	const struct search_job_state* covered_by;
+
+	/** Whether the filter pages of the state should be prefetched before checking the host names (when it's not sealed) */
+	bool prefetch;
+};
+
+/** The entities whose specific variants of plaintext host names are searched as well */
+struct search_job_entities {
+	/** The entity names (as used by `honas-gather`) */
+	const char** names;
+
+	/** The number of entity names */
+	size_t nr_names;
+};
+
+/** Perform a search job on a number of honas states
+ *
+ * The search job is read from `job_fh` and the host names are checked in
+ * batches of `SEARCH_BATCH_SIZE` host names by the worker threads, while the
+ * next batch is being read. The results are reported in the order of the
+ * search job. JSON, binary and compiled search jobs are recognized
+ * automatically; all states should match the configuration a compiled search
+ * job was compiled for.
+ *
+ * The result of a single state is written directly to `result_fh`. The results
+ * of multiple states are combined into a single document, keyed by the period
+ * beginning of each state in the order in which the states were supplied.
+ *
+ * When `entities` are given, the "<entity>@<host name>" variant of each
+ * plaintext host name is checked for each of the entities as well. Only the
+ * variants with hits are reported, right after their host name; they don't
+ * count towards the filters hit by all host names of the group. In binary
+ * results the variants are numbered right after their host name, in the order
+ * of the entities.
+ *
+ * Host names (and their variants) that occur more than once in the search job
+ * are only checked once. Host names found in the probe cache of a state aren't
+ * checked against that state at all; the results of the other host names are
+ * added to the probe cache. Compiled search jobs lack the host name hashes
+ * the probe caches are keyed by, so these don't use the probe caches.
+ *
+ * The states are only read, so multiple search jobs can be performed on the
+ * same states at the same time as long as none of them are sealed (sealed states
+ * share a block cache and are only checked by the calling thread) or use a
+ * probe cache.
+ *
+ * Host names are checked against the coarser states covering the states
+ * first; host names that don't hit any filter of a covering state can't be
+ * found in the covered state and aren't checked against it. The covering
+ * states themselves aren't reported. A covering state is only used for states
+ * that are both sealed or both not sealed.
+ *
+ * The filter pages of the states that are to be prefetched (and of the coarse
+ * states covering these that aren't covered themselves) are requested from
+ * disk for a whole chunk of `SEARCH_CHUNK_SIZE` host names before checking
+ * them, so that the pages are read concurrently instead of one page fault at a
+ * time. This pays off for states that aren't in the page cache yet.
+ *
+ * The results of a sealed state in which a corrupt block is found are left
+ * out, as these are incomplete; the other states are searched as usual, and
+ * coarse states with corrupt blocks no longer rule out any host names.
+ *
+ * \param states     The honas states to search
+ * \param nr_states  The number of honas states in `states` (at least 1)
+ * \param nr_threads The number of worker threads to use (0 to not use threads at all)
+ * \param format     The format of the search results
+ * \param entities   The entities to check the plaintext host names for (or `NULL`)
+ * \param job_fh     The file handle to read the search job from
+ * \param result_fh  The file handle to write the search results to
+ * \returns 0 on success or -1 if the search job couldn't be read (the results are incomplete) or the only state is corrupt
+ * \ingroup search_job
+ */
+extern int search_job_perform(const struct search_job_state* states, size_t nr_states, unsigned int nr_threads, enum search_result_format format, const struct search_job_entities* entities, FILE* job_fh, FILE* result_fh);
+
+/** Compile a search job for states with a specific geometry
+ *
+ * \param number_of_filters         The number of filters of the states
+ * \param number_of_bits_per_filter The number of bits per filter of the states (a multiple of 8)
+ * \param number_of_hashes          The number of hashes of the states
+ * \param shared_block_size         The size of the shared blocks of the states (0 for none, see `honas_state_use_shared_blocks()`)
+ * \param job_fh                    The file handle to read the JSON or binary search job from
+ * \param compiled_fh               The file handle to write the compiled search job to
+ * \returns 0 on success or -1 if the search job couldn't be read or written
+ * \ingroup search_job
+ */
+extern int search_job_compile(uint32_t number_of_filters, uint32_t number_of_bits_per_filter, uint32_t number_of_hashes, uint32_t shared_block_size, FILE* job_fh, FILE* compiled_fh);
+
+/** Convert a search job to a binary search job
+ *
+ * Host names with hashes of another length than SHA-256 hashes are skipped.
+ *
+ * \param job_fh    The file handle to read the JSON search job from
+ * \param binary_fh The file handle to write the binary search job to
+ * \returns 0 on success or -1 if the search job couldn't be read or written
+ * \ingroup search_job
+ */
+extern int search_job_convert(FILE* job_fh, FILE* binary_fh);
+
+#endif /* SEARCH_JOB_H */
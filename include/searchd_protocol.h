@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEARCHD_PROTOCOL_H
+#define SEARCHD_PROTOCOL_H
+
+#include "includes.h"
+
+/// \defgroup searchd_protocol The compact binary honas-searchd protocol
+
+/* Magic of a compact binary search request */
+#define SEARCHD_REQUEST_MAGIC "HSQ1"
+/* Magic of a compact binary search response */
+#define SEARCHD_RESPONSE_MAGIC "HSR1"
+
+/* Maximum number of host name hashes in a single binary search request */
+#define SEARCHD_MAX_REQUEST_HASHES (1 << 20)
+/* Maximum length of a host name hash in a binary search request */
+#define SEARCHD_MAX_HASH_LENGTH 64
+
+/** Status of a compact binary search response */
+enum searchd_response_status {
+	SEARCHD_STATUS_OK = 0,          ///< The request was handled
+	SEARCHD_STATUS_BAD_REQUEST = 1, ///< The request was malformed or exceeded the limits
+};
+
+/** Compact binary search request header
+ *
+ * All fields are in host byte order, as the protocol is only spoken over a local
+ * unix socket. The header is followed by `nr_hashes` host name hashes of
+ * `hash_length` bytes each.
+ *
+ * \ingroup searchd_protocol
+ */
+struct searchd_request {
+	char magic[4];          ///< `SEARCHD_REQUEST_MAGIC`
+	uint32_t nr_hashes;     ///< Number of host name hashes (at most `SEARCHD_MAX_REQUEST_HASHES`)
+	uint32_t hash_length;   ///< Length of each host name hash (at most `SEARCHD_MAX_HASH_LENGTH`)
+	uint32_t reserved;      ///< Must be 0
+	uint64_t period_begin;  ///< Only search states with a period beginning at or after this time
+	uint64_t period_end;    ///< Only search states with a period beginning before this time
+} __attribute__((packed));
+
+/** Compact binary search response header
+ *
+ * The header is followed by `nr_states` state results, ordered by period.
+ *
+ * \ingroup searchd_protocol
+ */
+struct searchd_response {
+	char magic[4];          ///< `SEARCHD_RESPONSE_MAGIC`
+	uint32_t status;        ///< A `searchd_response_status`
+	uint32_t nr_states;     ///< Number of searched states
+	uint32_t nr_hashes;     ///< Number of host name hashes of the request
+} __attribute__((packed));
+
+/** Result of a compact binary search for a single state
+ *
+ * The header is followed by `nr_hashes` 32-bit numbers of filters with possible
+ * hits, one for each host name hash in the order of the request.
+ *
+ * \ingroup searchd_protocol
+ */
+struct searchd_response_state {
+	uint64_t period_begin;               ///< Period begin of the searched state
+	uint64_t period_end;                 ///< Period end of the searched state
+	uint32_t number_of_filters;          ///< Number of filters in the searched state
+	uint32_t number_of_filters_per_user; ///< Number of filters each client is mapped to
+} __attribute__((packed));
+
+#endif /* SEARCHD_PROTOCOL_H */
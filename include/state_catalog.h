@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STATE_CATALOG_H
+#define STATE_CATALOG_H
+
+#include "honas_state.h"
+#include "includes.h"
+
+#define HONAS_CATALOG_FILE_MAGIC "HONASCAT"
+#define CURRENT_HONAS_CATALOG_MAJOR_VERSION 1
+#define CURRENT_HONAS_CATALOG_MINOR_VERSION 0
+
+/* Name of the catalog file in the root of the cataloged directory tree */
+#define HONAS_CATALOG_FILENAME ".honas_catalog"
+/* Only files with this suffix are considered to be state files */
+#define HONAS_CATALOG_STATE_FILE_SUFFIX ".hs"
+
+/** State file catalog
+ *  ==================
+ *
+ * A catalog is a compact index of all state files in a directory tree (for
+ * instance the archive maintained by `honas-compact`), stored in the
+ * `HONAS_CATALOG_FILENAME` file in the root of the tree. It's created and
+ * updated with `honas_state_catalog_update()` (see the `honas-catalog`
+ * program), which only opens the state files that were added or changed
+ * since the previous update.
+ *
+ * The catalog entries are ordered by period, so the state files covering a
+ * time range can be found with a binary search on the `mmap()`-ed catalog
+ * without opening any of the state files.
+ *
+ * Layout of a catalog file:
+ *
+ * - `struct honas_catalog_file_header`
+ * - Catalog entries: `struct honas_catalog_entry[number_of_entries]`
+ * - Filter bits set of all entries: `uint32_t[number_of_filter_bits_set]`
+ * - Paths of all entries (zero terminated and relative to the cataloged directory)
+ *
+ * \defgroup state_catalog State file catalog operations
+ */
+
+/** Catalog file header
+ *
+ * \note All integers are in little endian byte order
+ */
+struct honas_catalog_file_header {
+	char file_magic[8];     ///< Catalog file identification string (`HONASCAT`)
+	uint32_t major_version; ///< Catalog file major version
+	uint32_t minor_version; ///< Catalog file minor version
+
+	uint64_t number_of_entries;          ///< Number of cataloged state files
+	uint64_t number_of_filter_bits_set;  ///< Total number of filters of all cataloged state files
+	uint64_t entries_offset;             ///< Start of the catalog entries
+	uint64_t filter_bits_set_offset;     ///< Start of the filter bits set of all entries
+	uint64_t paths_offset;               ///< Start of the paths of all entries
+	uint64_t paths_size;                 ///< Size of the paths of all entries
+} __attribute__((packed));
+
+#define HONAS_CATALOG_ENTRY_FLAG_SEALED 0x1 ///< The state file is a sealed state file
+
+/** Catalog entry describing a single state file */
+struct honas_catalog_entry {
+	uint64_t period_begin;                   ///< Period begin timestamp of the state
+	uint64_t period_end;                     ///< Period end timestamp of the state
+	uint64_t number_of_requests;             ///< Number of requests registered in the state
+	uint64_t estimated_number_of_clients;    ///< Estimated number of distinct clients
+	uint64_t estimated_number_of_host_names; ///< Estimated number of distinct host names
+
+	uint64_t file_device;     ///< Device of the state file when it was cataloged
+	uint64_t file_inode;      ///< Inode of the state file when it was cataloged
+	uint64_t file_size;       ///< Size of the state file when it was cataloged
+	int64_t file_mtime_sec;   ///< Modification time of the state file when it was cataloged (seconds)
+	int64_t file_mtime_nsec;  ///< Modification time of the state file when it was cataloged (nanoseconds)
+
+	uint64_t filter_bits_set_index; ///< Index of the filter bits set of the first filter of the state
+	uint64_t path_offset;           ///< Offset of the path within the paths of all entries
+
+	uint32_t number_of_filters;          ///< Number of filters of the state
+	uint32_t number_of_bits_per_filter;  ///< Number of bits per filter of the state
+	uint32_t number_of_hashes;           ///< Number of hashes of the state
+	uint32_t number_of_filters_per_user; ///< Number of filters per user of the state
+	uint32_t stored_bits_per_filter;     ///< Number of bits actually stored for each (folded) filter
+	uint32_t flags;                      ///< Flags of the state file (see `HONAS_CATALOG_ENTRY_FLAG_*`)
+	uint32_t checksum;                   ///< CRC-32C of the contents of the state file
+	uint32_t reserved;                   ///< Reserved for future use (should be 0)
+} __attribute__((packed));
+
+/** Opened catalog */
+typedef struct honas_catalog {
+	const struct honas_catalog_file_header* header; ///< Catalog header
+	const struct honas_catalog_entry* entries;      ///< The catalog entries, ordered by period
+	const uint32_t* filter_bits_set;                ///< The filter bits set of all entries
+	const char* paths;                              ///< The paths of all entries
+	char* directory;                                ///< The cataloged directory
+	void* mmap;                                     ///< The `mmap()`-ed catalog file
+	size_t size;                                    ///< The size of the `mmap()`-ed catalog file
+} honas_catalog_t;
+
+/** Statistics about updating a catalog */
+struct honas_catalog_update_stats {
+	size_t nr_entries;  ///< Number of cataloged state files
+	size_t nr_added;    ///< Number of state files that were (re)opened for the catalog
+	size_t nr_removed;  ///< Number of previously cataloged state files that are gone or changed
+	size_t nr_skipped;  ///< Number of files that aren't (valid) state files
+};
+
+/** Open the catalog of a directory tree
+ *
+ * \param catalog   The catalog structure that is to be initialized
+ * \param directory The cataloged directory
+ * \returns 0 on success, 1 if the catalog file is not a catalog, 2 if the catalog file contains errors
+ *          or -1 on system errors (with `errno` set)
+ * \ingroup state_catalog
+ */
+extern int honas_state_catalog_open(honas_catalog_t* catalog, const char* directory);
+
+/** Close a catalog
+ *
+ * \param catalog The catalog to close
+ * \ingroup state_catalog
+ */
+extern void honas_state_catalog_close(honas_catalog_t* catalog);
+
+/** Find the catalog entries with a period beginning within a time range
+ *
+ * \param catalog The catalog
+ * \param begin   The begin of the time range (inclusive)
+ * \param end     The end of the time range (exclusive)
+ * \param first   Set to the index of the first entry within the time range
+ * \returns The number of (consecutive) entries within the time range
+ * \ingroup state_catalog
+ */
+extern size_t honas_state_catalog_find(const honas_catalog_t* catalog, uint64_t begin, uint64_t end, size_t* first);
+
+/** Select the catalog entries that cover a time range without overlapping
+ *
+ * Of the entries with a period beginning within the time range, those with
+ * the shortest periods are preferred: an entry is skipped when its period
+ * overlaps the period of an earlier selected entry. So when both the hourly
+ * state files of a day and the daily state file are cataloged, only the
+ * hourly state files are selected.
+ *
+ * \param catalog  The catalog
+ * \param begin    The begin of the time range (inclusive)
+ * \param end      The end of the time range (exclusive)
+ * \param selected Array receiving the selected entries (room for the number of entries returned by `honas_state_catalog_find()`)
+ * \returns The number of selected entries
+ * \ingroup state_catalog
+ */
+extern size_t honas_state_catalog_select(const honas_catalog_t* catalog, uint64_t begin, uint64_t end, const struct honas_catalog_entry** selected);
+
+/** Find the catalog entry covering the period of another entry
+ *
+ * Of the entries with a period beginning within the time range that cover the
+ * whole period of `entry` (and are longer), the one with the shortest period
+ * is returned. Only entries with the same number of filters, hashes and bits
+ * per filter that are folded at least as often as `entry` are considered, so
+ * host names that aren't found in the covering state can't be found in the
+ * state of `entry` either, provided the covering state was combined from (at
+ * least) the state of `entry`.
+ *
+ * \param catalog The catalog
+ * \param begin   The begin of the time range (inclusive)
+ * \param end     The end of the time range (exclusive)
+ * \param entry   The catalog entry of which the period has to be covered
+ * \returns The covering entry or `NULL` if there is none
+ * \ingroup state_catalog
+ */
+extern const struct honas_catalog_entry* honas_state_catalog_covering_entry(const honas_catalog_t* catalog, uint64_t begin, uint64_t end, const struct honas_catalog_entry* entry);
+
+/** Get the path of the state file of a catalog entry
+ *
+ * \param catalog The catalog
+ * \param entry   The catalog entry
+ * \param path    Buffer receiving the path (including the cataloged directory)
+ * \param len     The size of the `path` buffer
+ * \returns `false` if the path didn't fit, `true` otherwise
+ * \ingroup state_catalog
+ */
+extern bool honas_state_catalog_entry_path(const honas_catalog_t* catalog, const struct honas_catalog_entry* entry, char* path, size_t len);
+
+/** Get the filter bits set of the state of a catalog entry
+ *
+ * \param catalog The catalog
+ * \param entry   The catalog entry
+ * \returns The number of bits set in each of the `number_of_filters` filters
+ * \ingroup state_catalog
+ */
+extern const uint32_t* honas_state_catalog_entry_filter_bits_set(const honas_catalog_t* catalog, const struct honas_catalog_entry* entry);
+
+/** Create or update the catalog of a directory tree
+ *
+ * State files of which the path, device, inode, size and modification time
+ * are unchanged since the previous update are taken over from the existing
+ * catalog, all other state files are opened. The new catalog replaces the
+ * existing one at once, so it can be updated while being used.
+ *
+ * \param directory The directory to catalog
+ * \param stats     Optional statistics about the update
+ * \returns 0 on success or -1 on error (with `errno` set)
+ * \ingroup state_catalog
+ */
+extern int honas_state_catalog_update(const char* directory, struct honas_catalog_update_stats* stats);
+
+#endif /* STATE_CATALOG_H */
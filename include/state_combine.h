@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STATE_COMBINE_H
+#define STATE_COMBINE_H
+
+#include "honas_state.h"
+#include "includes.h"
+
+/* Number of bytes of a filter combined by a worker thread at a time */
+#define STATE_COMBINE_CHUNK_SIZE (256 * 1024)
+
+/// \defgroup state_combine Combining many honas states
+
+/** Check if two honas states can be combined
+ *
+ * \param state The honas state
+ * \param other The other honas state
+ * \returns `true` if both states have the same filter configuration (including the fold factor and offset scheme)
+ * \ingroup state_combine
+ */
+extern bool honas_state_combinable(const honas_state_t* state, const honas_state_t* other);
+
+/** Combine a number of honas states into a new honas state
+ *
+ * The filters of all sources are bitwise OR'ed together into a freshly created
+ * honas state. The work is split into chunks of `STATE_COMBINE_CHUNK_SIZE`
+ * bytes of a filter, and each worker thread ORs the same chunk of every source
+ * into the target before taking the next chunk. That way every byte of the
+ * target is written by exactly one thread while it's still in the CPU cache
+ * and the sources are only read once, sequentially (which the kernel is
+ * advised about, for aggressive read-ahead of state files).
+ *
+ * The sources are typically loaded read-only. Sealed sources are supported,
+ * but are decompressed by the calling thread as their block cache can't be
+ * shared between threads.
+ *
+ * The hyperloglogs are merged, the number of requests is summed up and the
+ * period covers the periods of all sources. The result can be saved to file
+ * using `honas_state_persist()`.
+ *
+ * \param target     The honas state structure that is to be initialized with the combined state
+ * \param sources    The honas states to combine
+ * \param nr_sources The number of honas states in `sources` (at least 1)
+ * \param nr_threads The number of worker threads to use (0 to not use threads at all)
+ * \returns 0 on success or -1 on error (errno is set appropriately, `EINVAL` if the sources can't be combined, `EBADMSG` if a sealed source contains a corrupt block)
+ * \ingroup state_combine
+ */
+extern int honas_state_combine_all(honas_state_t* target, honas_state_t* const* sources, size_t nr_sources, unsigned int nr_threads);
+
+#endif /* STATE_COMBINE_H */
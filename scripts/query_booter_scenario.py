@@ -7,7 +7,6 @@
 import sys
 import csv
 import json
-from hashlib import sha256
 import os
 import glob
 import ntpath
@@ -29,7 +28,7 @@ print("Processing domain names from input Booter file.")
 # Prepare Honas search query.
 searchdata = { "groups" : [] }
 searchdata["groups"].append({ "id" : 1 })
-searchdata["groups"][0]["hostnames"] = {}
+searchdata["groups"][0]["names"] = []
 
 # Prepare a dictionary containing all unique Booter domain names.
 # For convinience we store the number of times it occurred as value.
@@ -66,19 +65,19 @@ with open(ENTITY_FILE, 'r') as entity_file:
 q_count = 0
 for k, v in booters.items():
 	# Create Honas JSON query for this domain name.
-	searchdata["groups"][0]["hostnames"][k] = sha256(k).hexdigest()
+	searchdata["groups"][0]["names"].append(k)
 	q_count += 1
 
 	# Iterate through all entities in the entities file, and generate
 	# a query for every combination of domain name and entity.
 	for k1, v1 in entities.items():
 		compound = str(k1) + '@' + k
-		searchdata["groups"][0]["hostnames"][compound] = sha256(compound).hexdigest()
+		searchdata["groups"][0]["names"].append(compound)
 		q_count += 1
 
 	# Also generate an UNKNOWN entity query to identify unmapped requests.
 	unk = "UNKNOWN@" + k
-	searchdata["groups"][0]["hostnames"][unk] = sha256(unk).hexdigest()
+	searchdata["groups"][0]["names"].append(unk)
 	q_count += 1
 
 # Print statistics.
@@ -6,7 +6,6 @@
 
 import csv
 import json
-from hashlib import sha256
 import os
 import ntpath
 import argparse
@@ -33,7 +32,7 @@ print("Processing domain names from input blacklist file.")
 # Prepare Honas search query.
 searchdata = { "groups" : [] }
 searchdata["groups"].append({ "id" : 1 })
-searchdata["groups"][0]["hostnames"] = {}
+searchdata["groups"][0]["names"] = []
 
 # Prepare a dictionary containing all unique Booter domain names.
 # For convinience we store the number of times it occurred as value.
@@ -73,19 +72,19 @@ if results.verbose:
 q_count = 0
 for k, v in blacklistdomains.items():
 	# Create Honas JSON query for this domain name.
-	searchdata["groups"][0]["hostnames"][k] = sha256(k).hexdigest()
+	searchdata["groups"][0]["names"].append(k)
 	q_count += 1
 
 	# Iterate through all entities in the entities file, and generate
 	# a query for every combination of domain name and entity.
 	for k1, v1 in entities.items():
 		compound = str(k1) + '@' + k
-		searchdata["groups"][0]["hostnames"][compound] = sha256(compound).hexdigest()
+		searchdata["groups"][0]["names"].append(compound)
 		q_count += 1
 
 	# Also generate an UNKNOWN entity query to identify unmapped requests.
 	unk = "UNKNOWN@" + k
-	searchdata["groups"][0]["hostnames"][unk] = sha256(unk).hexdigest()
+	searchdata["groups"][0]["names"].append(unk)
 	q_count += 1
 
 # Print statistics.
@@ -97,7 +96,7 @@ with open(tmpfilename, 'w') as tmpfile:
 	tmpfile.write(json.dumps(searchdata, indent=4, ensure_ascii=False))
 
 # Execute query for the provided state file.
-searchresult = os.popen(HONAS_BIN_PATH + " " + results.state_file + " < " + tmpfilename).read()
+searchresult = os.popen(HONAS_BIN_PATH + " --probe-cache " + results.state_file + " < " + tmpfilename).read()
 
 # Parse the Honas search result and test whether false positives occurred.
 jsonresult = json.loads(searchresult)
@@ -9,7 +9,6 @@
 import sys
 import dpkt
 import json
-from hashlib import sha256
 import os
 
 # Check if we have an input PCAP file.
@@ -29,7 +28,7 @@ print("Processing DNS queries from input PCAP file.")
 # Prepare Honas search query.
 searchdata = { "groups" : [] }
 searchdata["groups"].append({ "id" : 1 })
-searchdata["groups"][0]["hostnames"] = {}
+searchdata["groups"][0]["names"] = []
 
 # Prepare a dictionary containing all unique domain names in the PCAP file.
 # For convinience we store the number of times it occurred as value.
@@ -72,8 +71,8 @@ for ts, pkt in dpkt.pcap.Reader(f):
 			else:
 				srcdomains[dnsname] = 1
 
-			# Create Honas JSON query for this domain name.
-			searchdata["groups"][0]["hostnames"][dnsname] = sha256(dnsname).hexdigest()
+				# Create Honas JSON query for this domain name.
+				searchdata["groups"][0]["names"].append(dnsname)
 
 			# Inrement counters.
 			pkt_count += 1
@@ -7,7 +7,6 @@
 import sys
 import csv
 import json
-from hashlib import sha256
 import os
 import ipaddress
 import glob
@@ -48,7 +47,7 @@ for fn in glob.iglob(targetdir + "/mail-2018-07-??.log"):
 	# Prepare Honas search query.
 	searchdata = { "groups" : [] }
 	searchdata["groups"].append({ "id" : 1 })
-	searchdata["groups"][0]["hostnames"] = {}
+	searchdata["groups"][0]["names"] = []
 
 	# Prepare a dictionary containing all unique IP-addresses in the spamfilter file.
 	# For convinience we store the number of times it occurred as value.
@@ -79,18 +78,18 @@ for fn in glob.iglob(targetdir + "/mail-2018-07-??.log"):
 			q_count += 1
 
 			# Create Honas JSON query for this domain name.
-			searchdata["groups"][0]["hostnames"][n] = sha256(n.encode('utf-8')).hexdigest()
+			searchdata["groups"][0]["names"].append(n)
 
 			# Iterate through all entities in the entities file, and generate
 			# a query for every combination of domain name and entity.
 			for k1, v1 in entities.items():
 				compound = str(k1) + '@' + str(n)
-				searchdata["groups"][0]["hostnames"][compound] = sha256(compound.encode('utf-8')).hexdigest()
+				searchdata["groups"][0]["names"].append(compound)
 				q_count += 1
 
 			# Also generate an UNKNOWN entity query to identify unmapped requests.
 			unk = "UNKNOWN@" + str(n)
-			searchdata["groups"][0]["hostnames"][unk] = sha256(unk.encode('utf-8')).hexdigest()
+			searchdata["groups"][0]["names"].append(unk)
 			q_count += 1
 
 		except ValueError:
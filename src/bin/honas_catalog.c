@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "defines.h"
+#include "includes.h"
+#include "logging.h"
+#include "state_catalog.h"
+#include "utils.h"
+
+#include <poll.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define WATCH_BUFFER_SIZE (64 * 1024)
+#define WATCH_SETTLE_TIME_MS 1000
+
+static void show_usage(char* program_name, FILE* out)
+{
+	fprintf(out, "Usage: %s [<options>] <directory>\n\n", program_name);
+	fprintf(out, "Options:\n");
+	fprintf(out, "  -h|--help           Show this message\n");
+	fprintf(out, "  -l|--list           List the cataloged state files instead of updating the\n");
+	fprintf(out, "                      catalog (<period-begin> <period-end> <path> per line)\n");
+	fprintf(out, "  -b|--begin <timestamp>\n");
+	fprintf(out, "                      Only list state files with a period beginning at or after\n");
+	fprintf(out, "                      this time\n");
+	fprintf(out, "  -e|--end <timestamp>\n");
+	fprintf(out, "                      Only list state files with a period beginning before this time\n");
+	fprintf(out, "  -S|--select         Only list the state files covering the time range without\n");
+	fprintf(out, "                      overlapping periods, preferring the shortest periods\n");
+	fprintf(out, "  -w|--watch          Keep updating the catalog as state files are added, changed\n");
+	fprintf(out, "                      or removed\n");
+	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
+	fprintf(out, "  -s|--syslog         Log messages to syslog\n");
+	fprintf(out, "  -v|--verbose        Be more verbose (can be used multiple times)\n");
+}
+
+static const struct option long_options[] = {
+	{ "help", no_argument, 0, 'h' },
+	{ "list", no_argument, 0, 'l' },
+	{ "begin", required_argument, 0, 'b' },
+	{ "end", required_argument, 0, 'e' },
+	{ "select", no_argument, 0, 'S' },
+	{ "watch", no_argument, 0, 'w' },
+	{ "quiet", no_argument, 0, 'q' },
+	{ "syslog", no_argument, 0, 's' },
+	{ "verbose", no_argument, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+static bool update_catalog(const char* directory)
+{
+	struct honas_catalog_update_stats stats;
+	if (honas_state_catalog_update(directory, &stats) == -1) {
+		log_perror(ERR, "Unable to update the catalog of '%s'", directory);
+		return false;
+	}
+	log_msg(INFO, "Cataloged %zu state files in '%s' (%zu added or changed, %zu removed, %zu skipped)",
+		stats.nr_entries, directory, stats.nr_added, stats.nr_removed, stats.nr_skipped);
+	return true;
+}
+
+static bool list_catalog(const char* directory, uint64_t period_begin, uint64_t period_end, bool select)
+{
+	honas_catalog_t catalog;
+	int result = honas_state_catalog_open(&catalog, directory);
+	if (result == -1) {
+		log_perror(ERR, "Unable to open the catalog of '%s'", directory);
+		return false;
+	} else if (result != 0) {
+		log_msg(ERR, "The catalog of '%s' is %s", directory, result == 1 ? "not a catalog file" : "corrupt");
+		return false;
+	}
+
+	size_t first;
+	size_t nr_entries = honas_state_catalog_find(&catalog, period_begin, period_end, &first);
+	const struct honas_catalog_entry** entries = calloc(nr_entries > 0 ? nr_entries : 1, sizeof(struct honas_catalog_entry*));
+	log_passert(entries != NULL, "Failed to allocate catalog entries");
+	if (select) {
+		nr_entries = honas_state_catalog_select(&catalog, period_begin, period_end, entries);
+	} else {
+		for (size_t i = 0; i < nr_entries; i++)
+			entries[i] = &catalog.entries[first + i];
+	}
+
+	char path[PATH_MAX];
+	for (size_t i = 0; i < nr_entries; i++) {
+		if (!honas_state_catalog_entry_path(&catalog, entries[i], path, sizeof(path)))
+			continue;
+		printf("%" PRIu64 "\t%" PRIu64 "\t%s\n", entries[i]->period_begin, entries[i]->period_end, path);
+	}
+
+	free(entries);
+	honas_state_catalog_close(&catalog);
+	return true;
+}
+
+/* Watch the directory and all of its (non hidden) subdirectories */
+static void add_watches(int inotify_fd, const char* directory)
+{
+	if (inotify_add_watch(inotify_fd, directory, WATCH_EVENTS | IN_ONLYDIR) == -1) {
+		log_perror(WARNING, "Unable to watch directory '%s'", directory);
+		return;
+	}
+
+	DIR* dir = opendir(directory);
+	if (dir == NULL)
+		return;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		char path[PATH_MAX];
+		struct stat st;
+		if (
+			entry->d_name[0] != '.'
+			&& snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name) < (int)sizeof(path)
+			&& lstat(path, &st) != -1
+			&& S_ISDIR(st.st_mode))
+			add_watches(inotify_fd, path);
+	}
+	closedir(dir);
+}
+
+/* Read the pending events; returns whether any of them could have changed the catalog */
+static bool read_watch_events(int inotify_fd)
+{
+	bool relevant = false;
+	uint8_t buf[WATCH_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len = read(inotify_fd, buf, sizeof(buf));
+	if (len == -1) {
+		log_passert(errno == EINTR || errno == EAGAIN, "Failed to read directory changes");
+		return false;
+	}
+
+	for (uint8_t* cur = buf; cur < buf + len;) {
+		const struct inotify_event* event = (const struct inotify_event*)cur;
+		cur += sizeof(struct inotify_event) + event->len;
+
+		/* The catalog file itself (and other hidden files) are ignored */
+		if (event->mask & IN_Q_OVERFLOW)
+			relevant = true;
+		else if (event->len > 0 && event->name[0] != '.')
+			relevant |= (event->mask & IN_ISDIR) || strstr(event->name, HONAS_CATALOG_STATE_FILE_SUFFIX) != NULL;
+	}
+	return relevant;
+}
+
+static void watch_catalog(const char* directory)
+{
+	int inotify_fd = inotify_init1(IN_CLOEXEC);
+	log_passert(inotify_fd != -1, "Unable to watch directory '%s'", directory);
+
+	for (;;) {
+		add_watches(inotify_fd, directory);
+		update_catalog(directory);
+
+		/* Wait for a relevant change; changes that follow it closely are handled at once */
+		struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+		while (!read_watch_events(inotify_fd))
+			;
+		while (poll(&pfd, 1, WATCH_SETTLE_TIME_MS) == 1)
+			read_watch_events(inotify_fd);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	char* program_name = "honas-catalog";
+	uint64_t period_begin = 0, period_end = UINT64_MAX;
+	bool list = false, select = false, watch = false;
+
+	/* Parse command line arguments */
+	while (1) {
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "hlb:e:Swqsv", long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 0:
+			fprintf(stderr, "Unimplemented option %s; Aborting!", long_options[option_index].name);
+			return 1;
+
+		case 'h':
+			show_usage(program_name, stdout);
+			return 0;
+
+		case 'l':
+			list = true;
+			break;
+
+		case 'b':
+			if (!my_strtouint64(optarg, &period_begin, NULL, 10)) {
+				fprintf(stderr, "Invalid value for 'begin': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'e':
+			if (!my_strtouint64(optarg, &period_end, NULL, 10)) {
+				fprintf(stderr, "Invalid value for 'end': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'S':
+			select = true;
+			break;
+
+		case 'w':
+			watch = true;
+			break;
+
+		case 'q':
+			log_set_min_log_level(log_get_min_log_level() - 1);
+			break;
+
+		case 's':
+			log_init_syslog(program_name, DEFAULT_LOG_FACILITY);
+			break;
+
+		case 'v':
+			log_set_min_log_level(log_get_min_log_level() + 1);
+			break;
+
+		case '?':
+			show_usage(program_name, stderr);
+			return 1;
+
+		default:
+			fprintf(stderr, "Unimplemented option '%c'; Aborting!", c);
+			return 1;
+		}
+	}
+	if (argc - optind > 1) {
+		fprintf(stderr, "Unsupported argument(s) supplied: %s!\n", argv[optind + 1]);
+		show_usage(program_name, stderr);
+		return 1;
+	} else if (argc - optind < 1) {
+		fprintf(stderr, "Required '<directory>' argument missing!\n");
+		return 1;
+	}
+	if (list && watch) {
+		fprintf(stderr, "Can't both list and watch the catalog!\n");
+		return 1;
+	}
+	const char* directory = argv[optind];
+
+	bool success;
+	if (list) {
+		success = list_catalog(directory, period_begin, period_end, select);
+	} else {
+		log_msg(INFO, "%s (version %s)", program_name, VERSION);
+		if (watch)
+			watch_catalog(directory);
+		success = update_catalog(directory);
+	}
+
+	log_destroy();
+	return success ? 0 : 1;
+}
@@ -30,19 +30,198 @@
 #include "honas_state.h"
 #include "includes.h"
 #include "logging.h"
+#include "state_catalog.h"
+#include "state_combine.h"
 
 static void show_usage(char* program_name, FILE* out)
 {
 	// At most 32 state files.
-	fprintf(out, "Usage: %s [<options>] <dst-state-file> <src-state-file>\n\n", program_name);
+	fprintf(out, "Usage: %s [<options>] <dst-state-file> [<src-state-file>]\n", program_name);
+	fprintf(out, "       %s [<options>] -o <output-state-file> <state-file>...\n", program_name);
+	fprintf(out, "       %s [<options>] -o <output-state-file> --catalog <directory> [<state-file>...]\n\n", program_name);
 	fprintf(out, "Options:\n");
 	fprintf(out, "  -h|--help           Show this message\n");
+	fprintf(out, "  -o|--output <file>  Combine all state files into this new state file\n");
+	fprintf(out, "  -a|--catalog <directory>\n");
+	fprintf(out, "                      Also combine the state files selected from the catalog of\n");
+	fprintf(out, "                      this directory (see honas-catalog) into the output state file\n");
+	fprintf(out, "  -b|--begin <timestamp>\n");
+	fprintf(out, "                      Select cataloged state files with a period beginning at or\n");
+	fprintf(out, "                      after this time\n");
+	fprintf(out, "  -e|--end <timestamp>\n");
+	fprintf(out, "                      Select cataloged state files with a period beginning before\n");
+	fprintf(out, "                      this time\n");
+	fprintf(out, "  -t|--threads <count>\n");
+	fprintf(out, "                      Number of threads used for combining state files into\n");
+	fprintf(out, "                      the output state file (default: number of online CPUs)\n");
+	fprintf(out, "  -F|--fold <N>       Fold the filters of the resulting state N times in half (at most %u)\n", HONAS_STATE_MAX_FOLD_FACTOR);
+	fprintf(out, "  -S|--summary-size <bytes>\n");
+	fprintf(out, "                      Add a summary of all filters of at most this size to the\n");
+	fprintf(out, "                      resulting state (see honas-search)\n");
 	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
 	fprintf(out, "  -v|--verbose        Be more verbose (can be used multiple times)\n");
 }
 
+// Replace the state with a copy of which the filters have been folded 'fold_factor' times.
+static bool fold_state(honas_state_t* state, const char* filename, uint32_t fold_factor)
+{
+	if (state->fold_factor == fold_factor)
+		return true;
+
+	if (state->fold_factor > fold_factor)
+	{
+		log_msg(ERR, "State file '%s' has already been folded %u times!", filename, state->fold_factor);
+		return false;
+	}
+
+	honas_state_t folded = { 0 };
+	if (honas_state_fold(&folded, state, fold_factor) == -1)
+	{
+		log_perror(ERR, "Failed to fold state file '%s' %u times", filename, fold_factor);
+		return false;
+	}
+
+	log_msg(INFO, "Folded state file '%s' %u times (%u bits per filter)", filename, fold_factor, honas_state_stored_bits_per_filter(&folded));
+	honas_state_destroy(state);
+	*state = folded;
+	return true;
+}
+
+// Combine all state files at once into a new output state file, which is written exactly once.
+static int combine_into_output(const char* output_filename, char** filenames, size_t nr_files, long fold_factor, uint32_t summary_size, unsigned int nr_threads)
+{
+	honas_state_t* states = (honas_state_t*)calloc(nr_files, sizeof(honas_state_t));
+	honas_state_t** sources = (honas_state_t**)calloc(nr_files, sizeof(honas_state_t*));
+	honas_state_t output_state = { 0 };
+	size_t nr_loaded = 0;
+	int result = 1;
+
+	if (!states || !sources)
+	{
+		log_msg(ERR, "Failed to allocate memory for the state files.");
+		goto out;
+	}
+
+	// Refuse to overwrite an existing state file.
+	if (access(output_filename, F_OK) != -1)
+	{
+		log_msg(ERR, "Output state file '%s' already exists!", output_filename);
+		goto out;
+	}
+
+	// Load all state files read-only.
+	for (; nr_loaded < nr_files; nr_loaded++)
+	{
+		if (honas_state_load(&states[nr_loaded], filenames[nr_loaded], true) != 0)
+		{
+			log_msg(ERR, "Error while loading state file '%s'!", filenames[nr_loaded]);
+			goto out;
+		}
+		log_msg(DEBUG, "Succesfully loaded state file '%s'!", filenames[nr_loaded]);
+
+		// Fold the state to the requested fold factor.
+		if (fold_factor != -1 && !fold_state(&states[nr_loaded], filenames[nr_loaded], fold_factor))
+		{
+			nr_loaded++;
+			goto out;
+		}
+		sources[nr_loaded] = &states[nr_loaded];
+	}
+
+	// Combine the data of all states.
+	if (honas_state_combine_all(&output_state, sources, nr_files, nr_threads) == -1)
+	{
+		log_perror(ERR, "Failed to combine the state files into '%s'", output_filename);
+		goto out;
+	}
+	log_msg(INFO, "Combined %zu state files into '%s'!", nr_files, output_filename);
+
+	// Persist the output state.
+	output_state.summary_size = summary_size;
+	honas_state_persist(&output_state, output_filename, true);
+	result = 0;
+
+out:
+	for (size_t i = 0; i < nr_loaded; i++)
+		honas_state_destroy(&states[i]);
+	honas_state_destroy(&output_state);
+	free(states);
+	free(sources);
+	return result;
+}
+
+// Select the state files of a time range from the catalog of a directory, followed by the given state files.
+static char** select_cataloged_state_files(const char* directory, uint64_t period_begin, uint64_t period_end, char** filenames, size_t nr_files, size_t* nr_selected)
+{
+	honas_catalog_t catalog;
+	*nr_selected = 0;
+	int result = honas_state_catalog_open(&catalog, directory);
+	if (result != 0)
+	{
+		if (result == -1)
+			log_perror(ERR, "Unable to open the catalog of '%s'", directory);
+		else
+			log_msg(ERR, "The catalog of '%s' is %s!", directory, result == 1 ? "not a catalog file" : "corrupt");
+		return NULL;
+	}
+
+	size_t first;
+	size_t nr_entries = honas_state_catalog_find(&catalog, period_begin, period_end, &first);
+	const struct honas_catalog_entry** entries = calloc(nr_entries + 1, sizeof(struct honas_catalog_entry*));
+	char** selected = calloc(nr_entries + nr_files + 1, sizeof(char*));
+	if (!entries || !selected)
+	{
+		log_msg(ERR, "Failed to allocate memory for the cataloged state files.");
+		goto err_out;
+	}
+
+	nr_entries = honas_state_catalog_select(&catalog, period_begin, period_end, entries);
+	for (size_t i = 0; i < nr_entries; i++)
+	{
+		char path[PATH_MAX];
+		if (!honas_state_catalog_entry_path(&catalog, entries[i], path, sizeof(path)))
+		{
+			log_msg(ERR, "Path of cataloged state file '%s' is too long!", catalog.paths + entries[i]->path_offset);
+			goto err_out;
+		}
+		if ((selected[(*nr_selected)++] = strdup(path)) == NULL)
+		{
+			log_msg(ERR, "Failed to allocate memory for the cataloged state files.");
+			goto err_out;
+		}
+	}
+	for (size_t i = 0; i < nr_files; i++)
+	{
+		if ((selected[(*nr_selected)++] = strdup(filenames[i])) == NULL)
+		{
+			log_msg(ERR, "Failed to allocate memory for the state files.");
+			goto err_out;
+		}
+	}
+	log_msg(INFO, "Selected %zu of the %" PRIu64 " cataloged state files!", nr_entries, catalog.header->number_of_entries);
+
+	free(entries);
+	honas_state_catalog_close(&catalog);
+	return selected;
+
+err_out:
+	for (size_t i = 0; selected && i < *nr_selected; i++)
+		free(selected[i]);
+	free(selected);
+	free(entries);
+	honas_state_catalog_close(&catalog);
+	return NULL;
+}
+
 static const struct option long_options[] = {
 	{ "help", no_argument, 0, 'h' },
+	{ "output", required_argument, 0, 'o' },
+	{ "catalog", required_argument, 0, 'a' },
+	{ "begin", required_argument, 0, 'b' },
+	{ "end", required_argument, 0, 'e' },
+	{ "threads", required_argument, 0, 't' },
+	{ "fold", required_argument, 0, 'F' },
+	{ "summary-size", required_argument, 0, 'S' },
 	{ "quiet", no_argument, 0, 'q' },
 	{ "verbose", no_argument, 0, 'v' },
 	{ 0, 0, 0, 0 }
@@ -55,13 +234,20 @@ int main(int argc, char** argv)
 	char* src_state_filename = NULL;
 	honas_state_t dst_state = { 0 };
 	honas_state_t src_state = { 0 };
+	char* output_filename = NULL;
+	char* catalog_directory = NULL;
+	uint64_t period_begin = 0, period_end = UINT64_MAX;
+	long fold_factor = -1;
+	unsigned long long summary_size = 0;
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char* endptr;
 
 	log_msg(INFO, "%s (version %s)", program_name, VERSION);
 
 	/* Parse command line arguments */
 	while (1) {
 		int option_index = 0;
-		int c = getopt_long(argc, argv, "hvq", long_options, &option_index);
+		int c = getopt_long(argc, argv, "ho:a:b:e:t:F:S:vq", long_options, &option_index);
 		if (c == -1)
 			break;
 		switch (c) {
@@ -77,6 +263,57 @@ int main(int argc, char** argv)
 			show_usage(program_name, stderr);
 			return 1;
 
+		case 'o':
+			output_filename = optarg;
+			break;
+
+		case 'a':
+			catalog_directory = optarg;
+			break;
+
+		case 'b':
+			errno = 0;
+			period_begin = strtoull(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || errno != 0) {
+				log_msg(ERR, "Invalid value for 'begin': %s", optarg);
+				return 1;
+			}
+			break;
+
+		case 'e':
+			errno = 0;
+			period_end = strtoull(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || errno != 0) {
+				log_msg(ERR, "Invalid value for 'end': %s", optarg);
+				return 1;
+			}
+			break;
+
+		case 't':
+			nr_threads = strtol(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || nr_threads < 1 || nr_threads > 1024) {
+				log_msg(ERR, "Invalid number of threads '%s'", optarg);
+				return 1;
+			}
+			break;
+
+		case 'F':
+			fold_factor = strtol(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || fold_factor < 0 || fold_factor > HONAS_STATE_MAX_FOLD_FACTOR) {
+				log_msg(ERR, "Invalid fold factor '%s', should be a number between 0 and %u", optarg, HONAS_STATE_MAX_FOLD_FACTOR);
+				return 1;
+			}
+			break;
+
+		case 'S':
+			errno = 0;
+			summary_size = strtoull(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || errno != 0 || summary_size > UINT32_MAX) {
+				log_msg(ERR, "Invalid summary size '%s'", optarg);
+				return 1;
+			}
+			break;
+
 		case 'q':
 			log_set_min_log_level(log_get_min_log_level() - 1);
 			break;
@@ -91,6 +328,30 @@ int main(int argc, char** argv)
 		}
 	}
 
+	// A catalog can only be used to select the state files to combine into a new output state file.
+	if (catalog_directory && !output_filename)
+	{
+		log_msg(ERR, "A catalog can only be used with an output state file!");
+		return 1;
+	}
+
+	// Combine the cataloged and given state files into a new output state file.
+	if (catalog_directory)
+	{
+		size_t nr_files = 0;
+		char** filenames = select_cataloged_state_files(catalog_directory, period_begin, period_end, &argv[optind], argc - optind, &nr_files);
+		int result = 1;
+		if (filenames && nr_files == 0)
+			log_msg(ERR, "None of the cataloged state files are within the requested periods!");
+		else if (filenames)
+			result = combine_into_output(output_filename, filenames, nr_files, fold_factor, summary_size, nr_threads > 1 ? nr_threads - 1 : 0);
+		for (size_t i = 0; filenames && i < nr_files; i++)
+			free(filenames[i]);
+		free(filenames);
+		log_destroy();
+		return result;
+	}
+
 	// Provide an error when the state files are missing.
 	if (optind == argc)
 	{
@@ -98,32 +359,41 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	// We must have a destination and source state file to combine.
-	if (argc - optind < 2)
+	// Combine all state files into a new output state file.
+	if (output_filename)
+	{
+		int result = combine_into_output(output_filename, &argv[optind], argc - optind, fold_factor, summary_size, nr_threads > 1 ? nr_threads - 1 : 0);
+		log_destroy();
+		return result;
+	}
+
+	// We must have a destination and source state file to combine, unless we're
+	// only folding the destination state file.
+	if (argc - optind < (fold_factor == -1 ? 2 : 1))
 	{
 		log_msg(ERR, "A destination and source state file are required!");
 		return 1;
 	}
 
 	// Store the state filenames.
-	dst_state_filename = malloc(strlen(argv[optind]));
+	dst_state_filename = strdup(argv[optind]);
 	if (!dst_state_filename)
 	{
 		log_msg(ERR, "Failed to allocate memory for the destination state filename.");
 		return 1;
 	}
 
-	src_state_filename = malloc(strlen(argv[optind + 1]));
-	if (!src_state_filename)
+	if (optind + 1 < argc)
 	{
-		log_msg(ERR, "Failed to allocate memory for the source state filename.");
-		free(dst_state_filename);
-		return 1;
+		src_state_filename = strdup(argv[optind + 1]);
+		if (!src_state_filename)
+		{
+			log_msg(ERR, "Failed to allocate memory for the source state filename.");
+			free(dst_state_filename);
+			return 1;
+		}
 	}
 
-	strcpy(dst_state_filename, argv[optind++]);
-	strcpy(src_state_filename, argv[optind]);
-
 	// Load destination state file.
 	if (honas_state_load(&dst_state, dst_state_filename, false) == -1)
 	{
@@ -137,34 +407,56 @@ int main(int argc, char** argv)
 		log_msg(DEBUG, "Succesfully loaded state file '%s'!", dst_state_filename);
 	}
 
-	// Load source state file.
-	if (honas_state_load(&src_state, src_state_filename, true) == -1)
+	// Fold the destination state file if requested.
+	if (fold_factor != -1 && !fold_state(&dst_state, dst_state_filename, fold_factor))
 	{
-		log_msg(ERR, "Error while loading state file '%s'!", src_state_filename);
 		free(dst_state_filename);
 		free(src_state_filename);
 		honas_state_destroy(&dst_state);
 		return 1;
 	}
-	else
-	{
-		log_msg(DEBUG, "Succesfully loaded state file '%s'!", src_state_filename);
-	}
 
-	// Aggregate data from both the target and source states.
-	if (honas_state_aggregate_combine(&dst_state, &src_state))
-	{
-		log_msg(INFO, "Aggregated states '%s' and '%s'!", dst_state_filename, src_state_filename);
-	}
-	else
+	if (src_state_filename)
 	{
-		log_msg(ERR, "Failed to aggregate states '%s' and '%s'!", dst_state_filename, src_state_filename);
-	}
+		// Load source state file.
+		if (honas_state_load(&src_state, src_state_filename, true) == -1)
+		{
+			log_msg(ERR, "Error while loading state file '%s'!", src_state_filename);
+			free(dst_state_filename);
+			free(src_state_filename);
+			honas_state_destroy(&dst_state);
+			return 1;
+		}
+		else
+		{
+			log_msg(DEBUG, "Succesfully loaded state file '%s'!", src_state_filename);
+		}
+
+		// Fold the source state to match the destination state if requested.
+		if (fold_factor != -1 && !fold_state(&src_state, src_state_filename, fold_factor))
+		{
+			free(dst_state_filename);
+			free(src_state_filename);
+			honas_state_destroy(&src_state);
+			honas_state_destroy(&dst_state);
+			return 1;
+		}
 
-	// Destroy the source state and free the filename.
-	honas_state_destroy(&src_state);
-	free(src_state_filename);
-	src_state_filename = NULL;
+		// Aggregate data from both the target and source states.
+		if (honas_state_aggregate_combine(&dst_state, &src_state))
+		{
+			log_msg(INFO, "Aggregated states '%s' and '%s'!", dst_state_filename, src_state_filename);
+		}
+		else
+		{
+			log_msg(ERR, "Failed to aggregate states '%s' and '%s'!", dst_state_filename, src_state_filename);
+		}
+
+		// Destroy the source state and free the filename.
+		honas_state_destroy(&src_state);
+		free(src_state_filename);
+		src_state_filename = NULL;
+	}
 
 	// Check if the destination filename exists, and unlink to allow writing.
 	if (access(dst_state_filename, F_OK) != -1)
@@ -173,6 +465,7 @@ int main(int argc, char** argv)
 	}
 
 	// Persist and destroy the destination state, and free the filename.
+	dst_state.summary_size = summary_size;
 	honas_state_persist(&dst_state, dst_state_filename, true);
 	honas_state_destroy(&dst_state);
 	free(dst_state_filename);
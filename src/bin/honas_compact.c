@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "defines.h"
+#include "honas_state.h"
+#include "includes.h"
+#include "logging.h"
+#include "state_catalog.h"
+#include "state_combine.h"
+#include "utils.h"
+
+#define SECONDS_PER_DAY 86400
+#define DAYS_PER_WEEK 7
+#define HOURLY_STATE_FORMAT "%Y-%m-%dT%H:%M:%S.hs"
+#define DAILY_STATE_FORMAT "%Y-%m-%d.hs"
+#define DAY_DIRECTORY_FORMAT "%d-%m-%Y"
+#define WEEKLY_STATE_FORMAT "%G-W%V.hs"
+#define WEEKLY_DIRECTORY "weekly"
+#define MANIFEST_FILENAME ".honas_compact_manifest"
+
+struct compact_options {
+	const char* archive_dir;
+	uint32_t states_per_day;
+	uint32_t summary_size;
+	unsigned int nr_threads;
+	bool weekly;
+	bool catalog;
+	bool dry_run;
+};
+
+struct archive_day {
+	time_t date;          ///< Midnight (UTC) of this day
+	char name[16];        ///< Name of the directory of this day (in `DAY_DIRECTORY_FORMAT`)
+	char** state_files;   ///< Names of the hourly state files of this day
+	size_t nr_state_files;
+	bool has_daily_state; ///< Whether the daily state exists (or has been created)
+};
+
+struct manifest {
+	char** entries; ///< Paths (relative to the archive directory) of the rollups that have been created
+	size_t nr_entries;
+};
+
+/* Parse `str` entirely according to the time `format` (interpreted as UTC) */
+static bool parse_time(const char* str, const char* format, time_t* result)
+{
+	struct tm tm = { 0 };
+	const char* rest = strptime(str, format, &tm);
+	if (rest == NULL || *rest != '\0')
+		return false;
+	*result = timegm(&tm);
+	return true;
+}
+
+static void format_time(char* buf, size_t len, const char* format, time_t time)
+{
+	struct tm tm;
+	strftime(buf, len, format, gmtime_r(&time, &tm));
+}
+
+static bool file_exists(const char* path)
+{
+	return access(path, F_OK) == 0;
+}
+
+static void manifest_load(struct manifest* manifest, const char* archive_dir)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", archive_dir, MANIFEST_FILENAME);
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		if (errno != ENOENT)
+			log_perror(WARNING, "Unable to read manifest '%s'", path);
+		return;
+	}
+
+	char line[PATH_MAX + 128];
+	char kind[16], entry[PATH_MAX];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "%15s %4095s", kind, entry) != 2)
+			continue;
+		manifest->entries = (char**)realloc(manifest->entries, (manifest->nr_entries + 1) * sizeof(char*));
+		log_passert(manifest->entries != NULL, "Failed to allocate manifest entries");
+		manifest->entries[manifest->nr_entries] = strdup(entry);
+		log_passert(manifest->entries[manifest->nr_entries] != NULL, "Failed to allocate manifest entry");
+		manifest->nr_entries++;
+	}
+	fclose(file);
+}
+
+static bool manifest_contains(const struct manifest* manifest, const char* entry)
+{
+	for (size_t i = 0; i < manifest->nr_entries; i++)
+		if (strcmp(manifest->entries[i], entry) == 0)
+			return true;
+	return false;
+}
+
+/* Record a created rollup in the manifest, in the form: <kind> <path> <number of inputs> <period begin> <period end> */
+static void manifest_append(struct manifest* manifest, const char* archive_dir, const char* kind, const char* entry, size_t nr_inputs, const honas_state_t* state)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", archive_dir, MANIFEST_FILENAME);
+	FILE* file = fopen(path, "a");
+	log_passert(file != NULL, "Unable to open manifest '%s'", path);
+	fprintf(file, "%s %s %zu %" PRIu64 " %" PRIu64 "\n", kind, entry, nr_inputs, state->header->period_begin, state->header->period_end);
+	log_passert(fclose(file) == 0, "Unable to write manifest '%s'", path);
+
+	manifest->entries = (char**)realloc(manifest->entries, (manifest->nr_entries + 1) * sizeof(char*));
+	log_passert(manifest->entries != NULL, "Failed to allocate manifest entries");
+	manifest->entries[manifest->nr_entries] = strdup(entry);
+	log_passert(manifest->entries[manifest->nr_entries] != NULL, "Failed to allocate manifest entry");
+	manifest->nr_entries++;
+}
+
+static void manifest_destroy(struct manifest* manifest)
+{
+	for (size_t i = 0; i < manifest->nr_entries; i++)
+		free(manifest->entries[i]);
+	free(manifest->entries);
+	manifest->entries = NULL;
+	manifest->nr_entries = 0;
+}
+
+/* Move all hourly state files from the spool directory into their day directory in the archive */
+static bool rotate_spool_dir(const char* spool_dir, const struct compact_options* options)
+{
+	DIR* dir = opendir(spool_dir);
+	if (dir == NULL) {
+		log_perror(ERR, "Unable to open spool directory '%s'", spool_dir);
+		return false;
+	}
+
+	bool success = true;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		time_t state_time;
+		if (!parse_time(entry->d_name, HOURLY_STATE_FORMAT, &state_time))
+			continue;
+
+		char day_name[16], day_path[PATH_MAX], src_path[PATH_MAX], dst_path[PATH_MAX];
+		format_time(day_name, sizeof(day_name), DAY_DIRECTORY_FORMAT, state_time);
+		snprintf(day_path, sizeof(day_path), "%s/%s", options->archive_dir, day_name);
+		snprintf(src_path, sizeof(src_path), "%s/%s", spool_dir, entry->d_name);
+		snprintf(dst_path, sizeof(dst_path), "%s/%s/%s", options->archive_dir, day_name, entry->d_name);
+
+		log_msg(INFO, "Moving state file '%s' to '%s'", src_path, dst_path);
+		if (options->dry_run)
+			continue;
+		if (mkdir(day_path, 0755) == -1 && errno != EEXIST) {
+			log_perror(ERR, "Unable to create archive directory '%s'", day_path);
+			success = false;
+		} else if (rename(src_path, dst_path) == -1) {
+			log_perror(ERR, "Unable to move state file '%s' to '%s'", src_path, dst_path);
+			success = false;
+		}
+	}
+	closedir(dir);
+	return success;
+}
+
+static int compare_archive_days(const void* a, const void* b)
+{
+	const struct archive_day* day_a = (const struct archive_day*)a;
+	const struct archive_day* day_b = (const struct archive_day*)b;
+	return (day_a->date > day_b->date) - (day_a->date < day_b->date);
+}
+
+/* Find all day directories in the archive directory, along with their hourly state files */
+static bool scan_archive_dir(const char* archive_dir, struct archive_day** result, size_t* nr_days)
+{
+	DIR* dir = opendir(archive_dir);
+	if (dir == NULL) {
+		log_perror(ERR, "Unable to open archive directory '%s'", archive_dir);
+		return false;
+	}
+
+	struct archive_day* days = NULL;
+	*nr_days = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		time_t date;
+		if (strlen(entry->d_name) >= sizeof(days->name) || !parse_time(entry->d_name, DAY_DIRECTORY_FORMAT, &date))
+			continue;
+
+		char day_path[PATH_MAX];
+		snprintf(day_path, sizeof(day_path), "%s/%s", archive_dir, entry->d_name);
+		DIR* day_dir = opendir(day_path);
+		if (day_dir == NULL) {
+			log_perror(WARNING, "Unable to open archive directory '%s'", day_path);
+			continue;
+		}
+
+		days = (struct archive_day*)realloc(days, (*nr_days + 1) * sizeof(struct archive_day));
+		log_passert(days != NULL, "Failed to allocate archive days");
+		struct archive_day* day = &days[(*nr_days)++];
+		memset(day, 0, sizeof(struct archive_day));
+		day->date = date;
+		strcpy(day->name, entry->d_name);
+
+		char daily_name[32];
+		format_time(daily_name, sizeof(daily_name), DAILY_STATE_FORMAT, date);
+		struct dirent* day_entry;
+		while ((day_entry = readdir(day_dir)) != NULL) {
+			time_t state_time;
+			if (strcmp(day_entry->d_name, daily_name) == 0) {
+				day->has_daily_state = true;
+			} else if (parse_time(day_entry->d_name, HOURLY_STATE_FORMAT, &state_time)) {
+				day->state_files = (char**)realloc(day->state_files, (day->nr_state_files + 1) * sizeof(char*));
+				log_passert(day->state_files != NULL, "Failed to allocate state file names");
+				day->state_files[day->nr_state_files] = strdup(day_entry->d_name);
+				log_passert(day->state_files[day->nr_state_files] != NULL, "Failed to allocate state file name");
+				day->nr_state_files++;
+			}
+		}
+		closedir(day_dir);
+		qsort(day->state_files, day->nr_state_files, sizeof(char*), cmpstringp);
+	}
+	closedir(dir);
+
+	qsort(days, *nr_days, sizeof(struct archive_day), compare_archive_days);
+	*result = days;
+	return true;
+}
+
+static void destroy_archive_days(struct archive_day* days, size_t nr_days)
+{
+	for (size_t i = 0; i < nr_days; i++) {
+		for (size_t j = 0; j < days[i].nr_state_files; j++)
+			free(days[i].state_files[j]);
+		free(days[i].state_files);
+	}
+	free(days);
+}
+
+/* Combine the state files into a new state file which is written exactly once */
+static bool create_rollup(char* const* state_paths, size_t nr_states, const char* rollup_path, uint32_t required_states, const struct compact_options* options, honas_state_t* rollup)
+{
+	honas_state_t* sources = (honas_state_t*)calloc(nr_states, sizeof(honas_state_t));
+	honas_state_t** source_ptrs = (honas_state_t**)calloc(nr_states, sizeof(honas_state_t*));
+	log_passert(sources != NULL && source_ptrs != NULL, "Failed to allocate honas states");
+	bool success = false;
+	size_t nr_loaded = 0;
+
+	for (; nr_loaded < nr_states; nr_loaded++) {
+		int result = honas_state_load(&sources[nr_loaded], state_paths[nr_loaded], true);
+		if (result != 0) {
+			if (result == -1)
+				log_perror(ERR, "Unable to load state file '%s'", state_paths[nr_loaded]);
+			else
+				log_msg(ERR, "Unable to load state file '%s': %s", state_paths[nr_loaded], result == 1 ? "not a honas state file" : "corrupt honas state file");
+			goto out;
+		}
+		source_ptrs[nr_loaded] = &sources[nr_loaded];
+	}
+
+	/* Determine the number of states in a complete day from the period length of the first state */
+	if (required_states == 0) {
+		uint64_t period_length = sources[0].header->period_end - sources[0].header->period_begin;
+		required_states = period_length > 0 && period_length <= SECONDS_PER_DAY ? SECONDS_PER_DAY / period_length : 1;
+	}
+	if (nr_states < required_states) {
+		log_msg(DEBUG, "Not creating '%s' yet, only %zu of %u state files are present", rollup_path, nr_states, required_states);
+		goto out;
+	}
+
+	log_msg(INFO, "Combining %zu state files into '%s'", nr_states, rollup_path);
+	if (options->dry_run) {
+		success = true;
+		goto out;
+	}
+	if (honas_state_combine_all(rollup, source_ptrs, nr_states, options->nr_threads) == -1) {
+		log_perror(ERR, "Unable to combine the state files for '%s'", rollup_path);
+		goto out;
+	}
+	rollup->summary_size = options->summary_size;
+	honas_state_persist(rollup, rollup_path, true);
+	success = true;
+
+out:
+	for (size_t i = 0; i < nr_loaded; i++)
+		honas_state_destroy(&sources[i]);
+	free(sources);
+	free(source_ptrs);
+	return success;
+}
+
+static void compact_day(struct archive_day* day, struct manifest* manifest, const struct compact_options* options)
+{
+	char daily_name[32], daily_entry[64], daily_path[PATH_MAX];
+	format_time(daily_name, sizeof(daily_name), DAILY_STATE_FORMAT, day->date);
+	snprintf(daily_entry, sizeof(daily_entry), "%s/%s", day->name, daily_name);
+	snprintf(daily_path, sizeof(daily_path), "%s/%s", options->archive_dir, daily_entry);
+
+	if (day->has_daily_state || manifest_contains(manifest, daily_entry) || day->nr_state_files == 0)
+		return;
+
+	char* state_paths[day->nr_state_files];
+	for (size_t i = 0; i < day->nr_state_files; i++) {
+		state_paths[i] = (char*)alloca(PATH_MAX);
+		snprintf(state_paths[i], PATH_MAX, "%s/%s/%s", options->archive_dir, day->name, day->state_files[i]);
+	}
+
+	honas_state_t daily = { 0 };
+	if (create_rollup(state_paths, day->nr_state_files, daily_path, options->states_per_day, options, &daily) && !options->dry_run) {
+		day->has_daily_state = true;
+		manifest_append(manifest, options->archive_dir, "daily", daily_entry, day->nr_state_files, &daily);
+	}
+	honas_state_destroy(&daily);
+}
+
+static void compact_week(struct archive_day* days, size_t nr_days, struct manifest* manifest, const struct compact_options* options)
+{
+	char weekly_name[32], weekly_entry[64], weekly_path[PATH_MAX];
+	format_time(weekly_name, sizeof(weekly_name), WEEKLY_STATE_FORMAT, days[0].date);
+	snprintf(weekly_entry, sizeof(weekly_entry), "%s/%s", WEEKLY_DIRECTORY, weekly_name);
+	snprintf(weekly_path, sizeof(weekly_path), "%s/%s", options->archive_dir, weekly_entry);
+
+	if (file_exists(weekly_path) || manifest_contains(manifest, weekly_entry))
+		return;
+
+	/* Only complete weeks are combined */
+	char* state_paths[DAYS_PER_WEEK];
+	size_t nr_states = 0;
+	for (size_t i = 0; i < nr_days && nr_states < DAYS_PER_WEEK; i++) {
+		if (!days[i].has_daily_state)
+			continue;
+		char daily_name[32];
+		format_time(daily_name, sizeof(daily_name), DAILY_STATE_FORMAT, days[i].date);
+		state_paths[nr_states] = (char*)alloca(PATH_MAX);
+		snprintf(state_paths[nr_states], PATH_MAX, "%s/%s/%s", options->archive_dir, days[i].name, daily_name);
+		nr_states++;
+	}
+	if (nr_states < DAYS_PER_WEEK) {
+		log_msg(DEBUG, "Not creating '%s' yet, only %zu of %u daily state files are present", weekly_path, nr_states, DAYS_PER_WEEK);
+		return;
+	}
+
+	char weekly_dir[PATH_MAX];
+	snprintf(weekly_dir, sizeof(weekly_dir), "%s/%s", options->archive_dir, WEEKLY_DIRECTORY);
+	if (!options->dry_run && mkdir(weekly_dir, 0755) == -1 && errno != EEXIST) {
+		log_perror(ERR, "Unable to create archive directory '%s'", weekly_dir);
+		return;
+	}
+
+	honas_state_t weekly = { 0 };
+	if (create_rollup(state_paths, nr_states, weekly_path, DAYS_PER_WEEK, options, &weekly) && !options->dry_run)
+		manifest_append(manifest, options->archive_dir, "weekly", weekly_entry, nr_states, &weekly);
+	honas_state_destroy(&weekly);
+}
+
+static void show_usage(char* program_name, FILE* out)
+{
+	fprintf(out, "Usage: %s [<options>] <archive-dir>\n\n", program_name);
+	fprintf(out, "Options:\n");
+	fprintf(out, "  -h|--help           Show this message\n");
+	fprintf(out, "  -r|--rotate <dir>   First move the state files in this directory (the\n");
+	fprintf(out, "                      'bloomfilter_path' of honas-gather) to the archive\n");
+	fprintf(out, "  -s|--states-per-day <count>\n");
+	fprintf(out, "                      Number of state files of a complete day (default:\n");
+	fprintf(out, "                      derived from the period length of the state files)\n");
+	fprintf(out, "  -w|--weekly         Also combine complete weeks of daily state files\n");
+	fprintf(out, "  -S|--summary-size <bytes>\n");
+	fprintf(out, "                      Add a summary of all filters of at most this size to\n");
+	fprintf(out, "                      the rollups (see honas-search)\n");
+	fprintf(out, "  -c|--catalog        Update the catalog of the archive afterwards (see\n");
+	fprintf(out, "                      honas-catalog)\n");
+	fprintf(out, "  -t|--threads <count>\n");
+	fprintf(out, "                      Number of threads used for combining state files\n");
+	fprintf(out, "                      (default: number of online CPUs)\n");
+	fprintf(out, "  -n|--dry-run        Only show what would be done\n");
+	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
+	fprintf(out, "  -v|--verbose        Be more verbose (can be used multiple times)\n");
+}
+
+static const struct option long_options[] = {
+	{ "help", no_argument, 0, 'h' },
+	{ "rotate", required_argument, 0, 'r' },
+	{ "states-per-day", required_argument, 0, 's' },
+	{ "weekly", no_argument, 0, 'w' },
+	{ "summary-size", required_argument, 0, 'S' },
+	{ "catalog", no_argument, 0, 'c' },
+	{ "threads", required_argument, 0, 't' },
+	{ "dry-run", no_argument, 0, 'n' },
+	{ "quiet", no_argument, 0, 'q' },
+	{ "verbose", no_argument, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char** argv)
+{
+	char* program_name = "honas-compact";
+	char* spool_dir = NULL;
+	uint32_t nr_threads;
+	struct compact_options options = { 0 };
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	options.nr_threads = nr_cpus > 1 ? nr_cpus - 1 : 0;
+
+	/* Parse command line arguments */
+	while (1) {
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "hr:s:wS:ct:nqv", long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 0:
+			fprintf(stderr, "Unimplemented option %s; Aborting!", long_options[option_index].name);
+			return 1;
+
+		case 'h':
+			show_usage(program_name, stdout);
+			return 0;
+
+		case 'r':
+			spool_dir = optarg;
+			break;
+
+		case 's':
+			if (!my_strtouint32(optarg, &options.states_per_day, NULL, 10) || options.states_per_day == 0) {
+				fprintf(stderr, "Invalid value for 'states-per-day': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'w':
+			options.weekly = true;
+			break;
+
+		case 'S':
+			if (!my_strtouint32(optarg, &options.summary_size, NULL, 10)) {
+				fprintf(stderr, "Invalid value for 'summary-size': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'c':
+			options.catalog = true;
+			break;
+
+		case 't':
+			if (!my_strtouint32(optarg, &nr_threads, NULL, 10) || nr_threads == 0) {
+				fprintf(stderr, "Invalid value for 'threads': %s!\n", optarg);
+				return 1;
+			}
+			/* The main thread is one of the threads doing the work */
+			options.nr_threads = nr_threads - 1;
+			break;
+
+		case 'n':
+			options.dry_run = true;
+			break;
+
+		case 'q':
+			log_set_min_log_level(log_get_min_log_level() - 1);
+			break;
+
+		case 'v':
+			log_set_min_log_level(log_get_min_log_level() + 1);
+			break;
+
+		case '?':
+			show_usage(program_name, stderr);
+			return 1;
+
+		default:
+			fprintf(stderr, "Unimplemented option '%c'; Aborting!", c);
+			return 1;
+		}
+	}
+	if (argc - optind > 1) {
+		fprintf(stderr, "Unsupported argument(s) supplied: %s!\n", argv[optind + 1]);
+		show_usage(program_name, stderr);
+		return 1;
+	} else if (argc - optind < 1) {
+		fprintf(stderr, "Required '<archive-dir>' argument missing!\n");
+		return 1;
+	}
+	options.archive_dir = argv[optind];
+
+	log_msg(INFO, "%s (version %s)", program_name, VERSION);
+
+	bool success = true;
+	if (spool_dir != NULL)
+		success = rotate_spool_dir(spool_dir, &options);
+
+	struct archive_day* days = NULL;
+	size_t nr_days = 0;
+	if (!scan_archive_dir(options.archive_dir, &days, &nr_days))
+		return 1;
+
+	struct manifest manifest = { 0 };
+	manifest_load(&manifest, options.archive_dir);
+
+	/* Hourly to daily */
+	for (size_t i = 0; i < nr_days; i++)
+		compact_day(&days[i], &manifest, &options);
+
+	/* Daily to weekly; the days are sorted, so the days of a week are adjacent */
+	for (size_t begin = 0, end; options.weekly && begin < nr_days; begin = end) {
+		char week[32], other_week[32];
+		format_time(week, sizeof(week), WEEKLY_STATE_FORMAT, days[begin].date);
+		for (end = begin + 1; end < nr_days; end++) {
+			format_time(other_week, sizeof(other_week), WEEKLY_STATE_FORMAT, days[end].date);
+			if (strcmp(week, other_week) != 0)
+				break;
+		}
+		compact_week(&days[begin], end - begin, &manifest, &options);
+	}
+
+	/* Catalog the resulting archive, so searches can select its state files at once */
+	struct honas_catalog_update_stats stats;
+	if (options.catalog && !options.dry_run) {
+		if (honas_state_catalog_update(options.archive_dir, &stats) == -1) {
+			log_perror(ERR, "Unable to update the catalog of '%s'", options.archive_dir);
+			success = false;
+		} else {
+			log_msg(INFO, "Cataloged %zu state files (%zu added or changed, %zu removed)", stats.nr_entries, stats.nr_added, stats.nr_removed);
+		}
+	}
+
+	manifest_destroy(&manifest);
+	destroy_archive_days(days, nr_days);
+	log_destroy();
+	return success ? 0 : 1;
+}
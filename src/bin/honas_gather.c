@@ -32,32 +32,40 @@
 #include "logging.h"
 #include "utils.h"
 
+#include "gather_handover.h"
+#include "gather_listener.h"
+#include "gather_replay.h"
+#include "gather_session.h"
 #include "honas_gather_config.h"
 #include "honas_state.h"
+#include "input_afpacket.h"
+#include "input_pcap.h"
 #include "instrumentation.h"
+#include "overload.h"
 #include "subnet_activity.h"
 #include "advice.h"
 
-#include <sys/un.h>
+#include <sys/wait.h>
 
-// Requires libevent2, libfstrm and ldns.
+// Requires libevent2 and ldns.
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 #include <event2/event.h>
 #include <event2/listener.h>
-#include <fstrm.h>
 #include <ldns/ldns.h>
 
 // Include protobuf compiled header.
 #include <dnstap.pb-c.h>
 
 #define UNIX_SOCKET_PATH	"/var/spool/honas/honas.sock"
-#define CONTENT_TYPE		"protobuf:dnstap.Dnstap"
-#define CAPTURE_HIGH_WATERMARK	262144
 #define HONAS_INSTRUMENTATION	"/var/spool/honas/instrumentation.log"
 #define HONAS_SUBNET_FILE	"/etc/honas/subnet_activity.json"
 #define HONAS_DRYRUNFILE	"/var/spool/honas/dry_run.log"
 #define FPR_THRESHOLD		0.001
+#define HANDOVER_DRAIN_TIMEOUT	5
+#define HANDOVER_ACK_TIMEOUT	30000
+#define LOOKUP_BATCH_SIZE	256
+#define CAPTURE_MAX_LOOKUPS	16384
 
 static const char active_state_file_name[] = "active_state";
 static honas_state_t current_active_state;
@@ -68,6 +76,8 @@ static int init_dirfd = 0;
 static char* config_file = DEFAULT_HONAS_GATHER_CONFIG_PATH;
 static FILE* inst_fd = NULL;
 static FILE* dryrun_fd = NULL;
+static char program_path[PATH_MAX];
+static char** program_argv = NULL;
 
 // Structure keeping track of the instrumentation information.
 struct instrumentation* inst_data;
@@ -79,20 +89,12 @@ struct instrumentation* inst_data;
 
 // --------------------------------------------------------------------------------------------------------
 
-typedef enum
-{
-	CONN_STATE_READING_CONTROL_READY,
-	CONN_STATE_READING_CONTROL_START,
-	CONN_STATE_READING_DATA,
-	CONN_STATE_STOPPED,
-} conn_state;
-
 // The Honas gather program context.
 struct capture
 {
-        struct sockaddr_un              addr;
         struct event_base*              ev_base;
-        struct evconnlistener*          ev_connlistener;
+        struct evconnlistener*          ev_connlisteners[GATHER_LISTENER_MAX_ENDPOINTS];
+	size_t				nr_connlisteners;
 	struct event*			ev_inst_timer;
 	int				remaining_connections;
 	bool				aggregate_subnets;
@@ -103,6 +105,19 @@ struct capture
 	struct dry_run_counters		dry_run_data;
 	bool				fpr_warning_passed;
 	struct event*			ev_state_rotation;
+	struct connection*		connections;
+	struct event*			ev_handover_signal;
+	struct event*			ev_handover_timer;
+	int				handover_sock;
+	pid_t				handover_pid;
+	bool				handed_over;
+	bool				replay;
+	struct gather_replay		replay_clock;
+	void*				capture_state;
+	struct event*			ev_capture;
+	struct honas_input_lookup*	capture_lookups;
+	struct overload_policy		overload;
+	struct overload_lag		lag;
 };
 
 // Global instance of capture context structure.
@@ -112,20 +127,11 @@ struct capture ctx;
 struct connection
 {
         struct capture*			context;
-	conn_state			state;
-	size_t				count_read;
-	size_t				bytes_read;
-	size_t				bytes_skip;
-	size_t				len_buf;
-	size_t				len_frame_payload;
-	size_t				len_frame_total;
         struct bufferevent*             bev;
-        struct evbuffer*                ev_input;
-        struct evbuffer*                ev_output;
-        struct fstrm_control*           control;
-	struct fstrm_reader_options*	reader_options;
-	struct fstrm_rdwr*		rdwr;
-	struct fstrm_reader*		reader;
+	struct gather_session		session;
+	struct connection*		prev;
+	struct connection*		next;
+	bool				draining;
 };
 
 // The query types we will save.
@@ -154,45 +160,27 @@ static bool query_is_valid_dns_type(const ldns_rr_type qtype)
 
 // --------------------------------------------------------------------------------------------------------
 
-// Verifies that the FrameStream data is actually DNStap data.
-static bool verify_content_type(struct fstrm_control* control, const uint8_t* content_type, const size_t len_content_type)
-{
-	fstrm_res res;
-	size_t n_content_type = 0;
-	const uint8_t *r_content_type = NULL;
-	size_t len_r_content_type = 0;
-
-	// Check the content type.
-	res = fstrm_control_get_num_field_content_type(control, &n_content_type);
-	if (res != fstrm_res_success)
-	{
-		return false;
-	}
-
-	if (n_content_type > 0)
-	{
-		res = fstrm_control_get_field_content_type(control, 0, &r_content_type, &len_r_content_type);
-		if (res != fstrm_res_success)
-			return false;
-
-		if (len_content_type != len_r_content_type)
-			return false;
-
-		if (memcmp(content_type, r_content_type, len_content_type) == 0)
-			return true;
-	}
-
-	return false;
-}
+static void process_data_frame(void* arg, const uint8_t* data, size_t length);
 
 // Initialized a newly accepted connection.
 static struct connection* conn_init(struct capture* pctx)
 {
 	// Initialize connection properties.
         struct connection* conn = calloc(1, sizeof(struct connection));
+        if (conn == NULL)
+                return NULL;
         conn->context = pctx;
-        conn->state = CONN_STATE_READING_CONTROL_READY;
-        conn->control = fstrm_control_init();
+        if (gather_session_init(&conn->session, process_data_frame, conn) == -1)
+        {
+                free(conn);
+                return NULL;
+        }
+
+	// Keep track of the open connections, so these can be drained on handover.
+	conn->next = pctx->connections;
+	if (conn->next != NULL)
+		conn->next->prev = conn;
+	pctx->connections = conn;
 	return conn;
 }
 
@@ -201,11 +189,31 @@ static void conn_destroy(struct connection** conn)
 {
         if (*conn != NULL)
         {
-                fstrm_control_destroy(&(*conn)->control);
+		if ((*conn)->prev != NULL)
+			(*conn)->prev->next = (*conn)->next;
+		else
+			(*conn)->context->connections = (*conn)->next;
+		if ((*conn)->next != NULL)
+			(*conn)->next->prev = (*conn)->prev;
+                gather_session_destroy(&(*conn)->session);
                 free(*conn);
         }
 }
 
+static void complete_handover(void);
+
+// Enables or disables accepting connections on all listening sockets.
+static void set_listeners_enabled(struct capture* ctx, bool enabled)
+{
+	for (size_t i = 0; i < ctx->nr_connlisteners; i++)
+	{
+		if (enabled)
+			evconnlistener_enable(ctx->ev_connlisteners[i]);
+		else
+			evconnlistener_disable(ctx->ev_connlisteners[i]);
+	}
+}
+
 // Closes an accepted connection.
 static void cb_close_conn(struct bufferevent* bev, short error, void *arg)
 {
@@ -218,7 +226,7 @@ static void cb_close_conn(struct bufferevent* bev, short error, void *arg)
         }
 
         // Print statistics.
-        log_msg(INFO, "Closing socket. Read %zd frames and %zd bytes).", conn->count_read, conn->bytes_read);
+        log_msg(INFO, "Closing socket. Read %zd frames and %zd bytes).", conn->session.count_read, conn->session.bytes_read);
 
         /*
          * The BEV_OPT_CLOSE_ON_FREE flag is set on our bufferevent's, so the
@@ -228,121 +236,179 @@ static void cb_close_conn(struct bufferevent* bev, short error, void *arg)
         bufferevent_free(bev);
         conn_destroy(&conn);
 
+	// The last connection has been drained, hand over to the new process.
+	if (ctx->handover_sock != -1)
+	{
+		if (ctx->connections == NULL)
+			complete_handover();
+		return;
+	}
+
 	++ctx->remaining_connections;
 	if (ctx->remaining_connections == 1)
 	{
-		evconnlistener_enable(ctx->ev_connlistener);
+		set_listeners_enabled(ctx, true);
 	}
 }
 
-// Is there a full frame available for reading?
-static bool can_read_full_frame(struct connection* conn)
+// Updates the overload level for the processing lag of the input: how long ago the lookups
+// that were processed last were made.
+static void update_overload(uint64_t lag)
 {
-	uint32_t tmp[2] = { 0 };
-
-	/*
-	 * This tracks the total number of bytes that must be removed from the
-	 * input buffer to read the entire frame. */
-	conn->len_frame_total = 0;
-
-	/* Check if the frame length field has fully arrived. */
-	if (conn->len_buf < sizeof(uint32_t))
-		return false;
+	const uint32_t previous_rate = overload_policy_sampling_rate(&ctx.overload);
+	const uint32_t sampling_rate = overload_policy_update(&ctx.overload, lag, time(NULL));
+	if (sampling_rate != previous_rate)
+	{
+		if (sampling_rate > 1)
+			log_msg(NOTICE, "Overloaded with a lag of %" PRIu64 " ms, registering the lookups of 1 in %" PRIu32 " clients", lag, sampling_rate);
+		else
+			log_msg(NOTICE, "No longer overloaded with a lag of %" PRIu64 " ms, registering the lookups of all clients", lag);
+	}
+	instrumentation_update_lag(inst_data, lag, sampling_rate);
+}
 
-	/* Read the frame length field. */
-	evbuffer_copyout(conn->ev_input, &tmp[0], sizeof(uint32_t));
-	conn->len_frame_payload = ntohl(tmp[0]);
+// Updates the overload level for the lag of the lookups processed since the last update.
+static void update_overload_lag(void)
+{
+	uint64_t lag;
+	if (overload_lag_take(&ctx.lag, &lag))
+		update_overload(lag);
+}
 
-	/* Account for the frame length field. */
-	conn->len_frame_total += sizeof(uint32_t);
+// Returns the current time in milliseconds since the Unix epoch.
+static uint64_t current_time_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
 
-	/* Account for the length of the frame payload. */
-	conn->len_frame_total += conn->len_frame_payload;
+// Measures the processing lag of a lookup made at the given time.
+static void measure_lag(uint64_t seconds, uint32_t nanoseconds, uint64_t now_ms)
+{
+	overload_lag_measure(&ctx.lag, seconds * 1000 + nanoseconds / 1000000, now_ms);
+}
 
-	/* Check if this is a control frame. */
-	if (conn->len_frame_payload == 0)
-	{
-		uint32_t len_control_frame = 0;
+// Checks whether the lookups of a client are to be registered. While overloaded, only the
+// lookups of the sampled clients are; those of the other clients are shed.
+static bool client_is_sampled(const struct in_addr46* client, uint64_t now)
+{
+	const uint32_t sampling_rate = overload_policy_sampling_rate(&ctx.overload);
+	if (overload_client_is_sampled(client, sampling_rate))
+		return true;
 
-		/*
-		 * Check if the control frame length field has fully arrived.
-		 * Note that the input buffer hasn't been drained, so we also
-		 * need to account for the initial frame length field. That is,
-		 * there must be at least 8 bytes available in the buffer.
-		 */
-		if (conn->len_buf < 2*sizeof(uint32_t))
-			return false;
+	honas_state_register_shed_host_name_lookup(&current_active_state, now, sampling_rate);
+	instrumentation_increment_shed(inst_data);
+	return false;
+}
 
-		/* Read the control frame length. */
-		evbuffer_copyout(conn->ev_input, &tmp[0], 2*sizeof(uint32_t));
-		len_control_frame = ntohl(tmp[1]);
+// Stores a host name lookup of an accepted type in the Bloom filters, as a lookup at time 'now'.
+static void register_lookup(const struct in_addr46* client, const char* hostname, size_t hostname_length, ldns_rr_type qtype, uint64_t now)
+{
+	// Create a buffer for the hostname, including space for a possible entity name.
+	char hn_buf[256] = { 0 };
 
-		/* Account for the length of the control frame length field. */
-		conn->len_frame_total += sizeof(uint32_t);
+	// Provide instrumentation data for subnet activity.
+	size_t in = 0, notin = 0;
 
-		/* Enforce minimum and maximum control frame size. */
-		if (len_control_frame < sizeof(uint32_t) ||
-		    len_control_frame > FSTRM_CONTROL_FRAME_LENGTH_MAX)
+	// Check whether subnet aggregation was requested.
+	if (ctx.aggregate_subnets)
+	{
+		// Look up the address in the prefix-entity mapping subsystem.
+		struct prefix_match* match_ptr = NULL;
+		if (subnet_activity_match_prefix(client, &ctx.subnet_metadata, &match_ptr) == SA_OK && match_ptr)
 		{
-			cb_close_conn(conn->bev, 0, conn);
-			return false;
+			strncpy(hn_buf, match_ptr->associated_entity->name, sizeof(match_ptr->associated_entity->name));
+			in = 1;
+		}
+		else
+		{
+			notin = 1;
 		}
 
-		/* Account for the control frame length. */
-		conn->len_frame_total += len_control_frame;
+		// Update instrumentation statistics.
+		instrumentation_update_subnet_activity(inst_data, in, notin);
 	}
 
-	/*
-	 * Check if the frame has fully arrived. 'len_buf' must have at least
-	 * the number of bytes needed in order to read the full frame, which is
-	 * exactly 'len_frame_total'.
-	 */
-	if (conn->len_buf < conn->len_frame_total)
+	// Debug which domain names are stored.
+	log_msg(DEBUG, "%s@%s stored in Bloom filter!", hn_buf, hostname);
+
+	// Store the DNS query in the Bloom filters.
+	honas_state_register_host_name_lookup(&current_active_state, now, client, (uint8_t*)hostname, hostname_length
+		, in == 1 ? (uint8_t*)hn_buf : (uint8_t*)HONAS_STATE_UNKNOWN_ENTITY, in == 1 ? strlen((char*)hn_buf) : strlen(HONAS_STATE_UNKNOWN_ENTITY)
+		, ctx.dry_run ? &ctx.dry_run_data : NULL, qtype);
+
+	// Calculate the actual false positive rate, and check whether it is still acceptable.
+	for (uint32_t i = 0; i < current_active_state.header->number_of_filters; i++)
 	{
-		log_msg(DEBUG, "Incomplete message (have %zd bytes, want %u)",  conn->len_buf, conn->len_frame_total);
-		if (conn->len_frame_total > CAPTURE_HIGH_WATERMARK)
+		const uint32_t bits_set = current_active_state.filter_bits_set[i];
+		const double fill_rate = (double)bits_set / (double)current_active_state.header->number_of_bits_per_filter;
+		const double act_fpr = pow(fill_rate, (double)current_active_state.header->number_of_hashes);
+
+		// Does the false positive rate of this filter exceed the threshold?
+		if (act_fpr > FPR_THRESHOLD && !ctx.fpr_warning_passed)
 		{
-			log_msg(DEBUG, "Skipping %zu byte message (%zu buffer)!", conn->len_frame_total, CAPTURE_HIGH_WATERMARK);
-			conn->bytes_skip = conn->len_frame_total;
+			log_msg(WARN, "The actual false positive rate %f of filter %i exceeds the threshold %f!", act_fpr, i, FPR_THRESHOLD);
+			ctx.fpr_warning_passed = true;
 		}
-		return false;
 	}
 
-	/* Success. The entire frame can now be read from the buffer. */
-	return true;
+	// Update the instrumentation elements.
+	instrumentation_increment_accepted(inst_data);
+	instrumentation_increment_type(inst_data, qtype);
+}
+
+// Registers a lookup read from an input module as a lookup at time 'now'.
+static void register_input_lookup(const struct honas_input_lookup* lookup, uint64_t now)
+{
+	if (client_is_sampled(&lookup->client, now) && query_is_valid_dns_type(lookup->qtype))
+	{
+		char hostname[HONAS_INPUT_HOST_NAME_MAX + 1];
+		memcpy(hostname, lookup->host_name, lookup->host_name_length);
+		hostname[lookup->host_name_length] = '\0';
+		register_lookup(&lookup->client, hostname, lookup->host_name_length, lookup->qtype, now);
+	}
+	instrumentation_increment_processed(inst_data);
 }
 
-// Processes a DNStap message, and gives output to the Bloom filters.
-static bool decode_dnstap_message(const Dnstap__Message* m)
+// Processes a DNStap message, and gives output to the Bloom filters as a lookup at time 'now'.
+static bool decode_dnstap_message(const Dnstap__Message* m, uint64_t now)
 {
 	bool return_val = false;
 
 	// Determine whether we are dealing with a DNS query, and we only want to process queries that have questions.
 	if (m->type == DNSTAP__MESSAGE__TYPE__CLIENT_QUERY && m->has_query_message)
 	{
+		// Retrieve the source IP-address of the query.
+		struct in_addr46 client = { 0 };
+		if (m->has_query_address)
+		{
+			if (m->query_address.len == 4)
+			{
+				// Store the IPv4 source address.
+				client.af = AF_INET;
+				memcpy(&client.in.addr4, m->query_address.data, sizeof(client.in.addr4));
+			}
+			else if (m->query_address.len == 16)
+			{
+				// Store the IPv6 source address.
+				client.af = AF_INET6;
+				memcpy(&client.in.addr6, m->query_address.data, sizeof(client.in.addr6));
+			}
+		}
+
+		// Shed the query before parsing it, if the client isn't sampled while overloaded.
+		if (!client_is_sampled(&client, now))
+		{
+			instrumentation_increment_processed(inst_data);
+			return true;
+		}
+
 		const ProtobufCBinaryData* message = &m->query_message;
 		ldns_pkt* pkt = NULL;
 		ldns_status status = ldns_wire2pkt(&pkt, message->data, message->len);
 		if (status == LDNS_STATUS_OK)
 		{
-			// Retrieve the source IP-address of the query.
-			struct in_addr46 client = { 0 };
-			if (m->has_query_address)
-			{
-				if (m->query_address.len == 4)
-				{
-					// Store the IPv4 source address.
-					client.af = AF_INET;
-					memcpy(&client.in.addr4, m->query_address.data, sizeof(client.in.addr4));
-				}
-				else if (m->query_address.len == 16)
-				{
-					// Store the IPv6 source address.
-					client.af = AF_INET6;
-					memcpy(&client.in.addr6, m->query_address.data, sizeof(client.in.addr6));
-				}
-			}
-
 			// Retrieve the resource record for the question.
 			const ldns_rr* rr = ldns_rr_list_rr(ldns_pkt_question(pkt), 0);
 			if (rr)
@@ -355,63 +421,13 @@ static bool decode_dnstap_message(const Dnstap__Message* m)
 				// Also, only queries for the A, NS, MX, AAAA record types are accepted.
 				if (qname && qclass == LDNS_RR_CLASS_IN && query_is_valid_dns_type(qtype))
 				{
-					// Create a buffer for the hostname, including space for a possible entity name.
-					char hn_buf[256] = { 0 };
-
-					// Provide instrumentation data for subnet activity.
-					size_t in = 0, notin = 0;
-
-					// Check whether subnet aggregation was requested.
-					if (ctx.aggregate_subnets)
-					{
-						// Look up the address in the prefix-entity mapping subsystem.
-						struct prefix_match* match_ptr = NULL;
-						if (subnet_activity_match_prefix(&client, &ctx.subnet_metadata, &match_ptr) == SA_OK && match_ptr)
-						{
-							strncpy(hn_buf, match_ptr->associated_entity->name, sizeof(match_ptr->associated_entity->name));
-							in = 1;
-						}
-						else
-						{
-							notin = 1;
-						}
-
-						// Update instrumentation statistics.
-						instrumentation_update_subnet_activity(inst_data, in, notin);
-					}
-
 					// Convert all DNS query data accordingly.
 					char* hostname = ldns_rdf2str(qname);
-					const size_t hostname_length = strlen(hostname);
 					char* class_str = ldns_rr_class2str(qclass);
 					char* type_str = ldns_rr_type2str(qtype);
 
-					// Debug which domain names are stored.
-					log_msg(DEBUG, "%s@%s stored in Bloom filter!", hn_buf, hostname);
-
 					// Store the DNS query in the Bloom filters.
-					honas_state_register_host_name_lookup(&current_active_state, time(NULL), &client, (uint8_t*)hostname, hostname_length
-						, in == 1 ? (uint8_t*)hn_buf : (uint8_t*)"UNKNOWN", in == 1 ? strlen((char*)hn_buf) : strlen("UNKNOWN")
-						, ctx.dry_run ? &ctx.dry_run_data : NULL, qtype);
-
-					// Calculate the actual false positive rate, and check whether it is still acceptable.
-					for (uint32_t i = 0; i < current_active_state.header->number_of_filters; i++)
-					{
-						const uint32_t bits_set = current_active_state.filter_bits_set[i];
-						const double fill_rate = (double)bits_set / (double)current_active_state.header->number_of_bits_per_filter;
-						const double act_fpr = pow(fill_rate, (double)current_active_state.header->number_of_hashes);
-
-						// Does the false positive rate of this filter exceed the threshold?
-						if (act_fpr > FPR_THRESHOLD && !ctx.fpr_warning_passed)
-						{
-							log_msg(WARN, "The actual false positive rate %f of filter %i exceeds the threshold %f!", act_fpr, i, FPR_THRESHOLD);
-							ctx.fpr_warning_passed = true;
-						}
-					}
-
-					// Update the instrumentation elements.
-					instrumentation_increment_accepted(inst_data);
-					instrumentation_increment_type(inst_data, qtype);
+					register_lookup(&client, hostname, strlen(hostname), qtype, now);
 
 					// Free the converted values.
 					free(type_str);
@@ -442,61 +458,11 @@ static bool decode_dnstap_message(const Dnstap__Message* m)
 }
 
 // Processes a data frame in the DNStap payload.
-static void process_data_frame(struct connection* conn)
+static void process_data_frame(void* arg, const uint8_t* data, size_t length)
 {
-	/*
-	 * Peek at 'conn->len_frame_total' bytes of data from the evbuffer, and
-	 * write them to the output file.
-	 */
-
-	/* Determine how many iovec's we need to read. */
-	const int n_vecs = evbuffer_peek(conn->ev_input, conn->len_frame_total, NULL, NULL, 0);
-
-	/* Allocate space for the iovec's. */
-	struct evbuffer_iovec vecs[n_vecs];
-
-	/* Retrieve the iovec's. */
-	const int n = evbuffer_peek(conn->ev_input, conn->len_frame_total, NULL, vecs, n_vecs);
-	assert(n == n_vecs);
-
-	// Find out what the total frame size is and read the data into a local buffer.
-	size_t bytes_read = 0;
-	uint8_t buf[4096];
-	for (int i = 0; i < n_vecs; i++)
-	{
-		size_t len = vecs[i].iov_len;
-
-		// Only read up to 'conn->len_frame_total' bytes.
-		if (bytes_read + len > conn->len_frame_total)
-		{
-			len = conn->len_frame_total - bytes_read;
-		}
-
-		// Read the IOvec into a local buffer.
-		memcpy(buf + bytes_read, vecs[i].iov_base, len);
-		bytes_read += len;
-	}
-
-	/* Check that exactly the right number of bytes were written. */
-	log_msg(DEBUG, "Read %zu bytes from the event buffer; total frame length is %zu.", bytes_read, conn->len_frame_total);
-	assert(bytes_read == conn->len_frame_total);
-
-	/* Delete the data frame from the input buffer. */
-	evbuffer_drain(conn->ev_input, conn->len_frame_total);
-
-	// Check whether the data frame actually has the correct content type.
-	log_msg(DEBUG, "Verifying content type of data frame...");
-	if (verify_content_type(conn->control, (const uint8_t*)CONTENT_TYPE, strlen(CONTENT_TYPE)))
-	{
-		log_msg(DEBUG, "Processing data frame of %zu bytes in size...", bytes_read);
-	}
-	else
-	{
-		log_msg(ERR, "Failed to process data frame: invalid content type!");
-	}
-
 	// Decode the frame as DNStap.
-	Dnstap__Dnstap *d = dnstap__dnstap__unpack(NULL, bytes_read, buf);
+	log_msg(DEBUG, "Processing data frame of %zu bytes in size...", length);
+	Dnstap__Dnstap *d = dnstap__dnstap__unpack(NULL, length, data);
 
 	// Check if both the unpacked data is valid, and if the unpacked data
 	// actually contains a valid message.
@@ -504,8 +470,12 @@ static void process_data_frame(struct connection* conn)
 	{
 		if (d->message)
 		{
+			// Measure how long ago the resolver logged the query.
+			if (d->message->has_query_time_sec)
+				measure_lag(d->message->query_time_sec, d->message->has_query_time_nsec ? d->message->query_time_nsec : 0, current_time_ms());
+
 			// Try to decode the DNStap message.
-			if (!decode_dnstap_message(d->message))
+			if (!decode_dnstap_message(d->message, time(NULL)))
 			{
 				log_msg(ERR, "Failed to decode the DNStap message!");
 				instrumentation_increment_invalid(inst_data);
@@ -519,282 +489,33 @@ static void process_data_frame(struct connection* conn)
 	{
 		log_msg(DEBUG, "Failed to unpack the frame into DNStap data!");
 	}
-
-	/* Accounting. */
-	conn->count_read += 1;
-	conn->bytes_read += bytes_read;
-}
-
-static bool match_content_type(struct connection* conn)
-{
-	fstrm_res res;
-
-	/* Match the "Content Type" against ours. */
-	res = fstrm_control_match_field_content_type(conn->control,
-		(const uint8_t *) CONTENT_TYPE, strlen(CONTENT_TYPE));
-	if (res != fstrm_res_success)
-	{
-		return false;
-	}
-
-	/* Success. */
-	return true;
-}
-
-// Loads the protobuf control frame from the stream.
-static bool load_control_frame(struct connection* conn)
-{
-	fstrm_res res;
-	uint8_t *control_frame = NULL;
-
-	/* Check if the frame is too big. */
-	if (conn->len_frame_total >= FSTRM_CONTROL_FRAME_LENGTH_MAX)
-	{
-		/* Malformed. */
-		return false;
-	}
-
-	/* Get a pointer to the full, linearized control frame. */
-	control_frame = evbuffer_pullup(conn->ev_input, conn->len_frame_total);
-	if (!control_frame)
-	{
-		/* Malformed. */
-		return false;
-	}
-	log_msg(DEBUG, "Reading FrameStream control frame (%u bytes).", conn->len_frame_total);
-
-	/* Decode the control frame. */
-	res = fstrm_control_decode(conn->control,
-				   control_frame,
-				   conn->len_frame_total,
-				   FSTRM_CONTROL_FLAG_WITH_HEADER);
-	if (res != fstrm_res_success)
-	{
-		/* Malformed. */
-		return false;
-	}
-
-	/* Drain the data read. */
-	evbuffer_drain(conn->ev_input, conn->len_frame_total);
-
-	/* Success. */
-	return true;
-}
-
-// Sends a control frame to the bufferevent.
-static bool send_frame(struct connection* conn, const void *data, size_t size)
-{
-	if (bufferevent_write(conn->bev, data, size) != 0)
-	{
-		log_msg(WARN, "Failed to write FrameStream control frame!");
-		return false;
-	}
-
-	return true;
-}
-
-// Writes a control frame to the stream.
-static bool write_control_frame(struct connection* conn)
-{
-	fstrm_res res;
-	uint8_t control_frame[FSTRM_CONTROL_FRAME_LENGTH_MAX];
-	size_t len_control_frame = sizeof(control_frame);
-
-	/* Encode the control frame. */
-	res = fstrm_control_encode(conn->control,
-		control_frame, &len_control_frame,
-		FSTRM_CONTROL_FLAG_WITH_HEADER);
-	if (res != fstrm_res_success)
-		return false;
-
-	/* Send the control frame. */
-	fstrm_control_type type = 0;
-	(void)fstrm_control_get_type(conn->control, &type);
-	if (!send_frame(conn, control_frame, len_control_frame))
-		return false;
-
-	/* Success. */
-	return true;
-}
-
-static bool process_control_frame_ready(struct connection* conn)
-{
-	fstrm_res res;
-
-	const uint8_t *content_type = NULL;
-	size_t len_content_type = 0;
-	size_t n_content_type = 0;
-
-	/* Retrieve the number of "Content Type" fields. */
-	res = fstrm_control_get_num_field_content_type(conn->control, &n_content_type);
-	if (res != fstrm_res_success)
-		return false;
-
-	for (size_t i = 0; i < n_content_type; i++) {
-		res = fstrm_control_get_field_content_type(conn->control, i,
-							   &content_type,
-							   &len_content_type);
-		if (res != fstrm_res_success)
-			return false;
-	}
-
-	/* Match the "Content Type" against ours. */
-	if (!match_content_type(conn))
-		return false;
-
-	/* Setup the ACCEPT frame. */
-	fstrm_control_reset(conn->control);
-	res = fstrm_control_set_type(conn->control, FSTRM_CONTROL_ACCEPT);
-	if (res != fstrm_res_success)
-		return false;
-	res = fstrm_control_add_field_content_type(conn->control,
-		(const uint8_t *) CONTENT_TYPE, strlen(CONTENT_TYPE));
-	if (res != fstrm_res_success)
-		return false;
-
-	/* Send the ACCEPT frame. */
-	if (!write_control_frame(conn))
-		return false;
-
-	/* Success. */
-	conn->state = CONN_STATE_READING_CONTROL_START;
-	return true;
-}
-
-static bool process_control_frame_start(struct connection* conn)
-{
-	/* Match the "Content Type" against ours. */
-	if (!match_content_type(conn))
-		return false;
-
-	/* Success. */
-	conn->state = CONN_STATE_READING_DATA;
-	return true;
-}
-
-static bool process_control_frame_stop(struct connection* conn)
-{
-	fstrm_res res;
-
-	/* Setup the FINISH frame. */
-	fstrm_control_reset(conn->control);
-	res = fstrm_control_set_type(conn->control, FSTRM_CONTROL_FINISH);
-	if (res != fstrm_res_success)
-		return false;
-
-	/* Send the FINISH frame. */
-	if (!write_control_frame(conn))
-		return false;
-
-	conn->state = CONN_STATE_STOPPED;
-
-	/* We return true here, which prevents the caller from closing
-	 * the connection directly (with the FINISH frame still in our
-	 * write buffer). The connection will be closed after the FINISH
-	 * frame is written and the write callback (cb_write) is called
-	 * to refill the write buffer.
-	 */
-	return true;
-}
-
-// Processes the control frame in the protobuf stream.
-static bool process_control_frame(struct connection* conn)
-{
-	fstrm_res res;
-	fstrm_control_type type;
-
-	/* Get the control frame type. */
-	res = fstrm_control_get_type(conn->control, &type);
-	if (res != fstrm_res_success)
-		return false;
-
-	switch (conn->state) {
-	case CONN_STATE_READING_CONTROL_READY: {
-		if (type != FSTRM_CONTROL_READY)
-			return false;
-		return process_control_frame_ready(conn);
-	}
-	case CONN_STATE_READING_CONTROL_START: {
-		if (type != FSTRM_CONTROL_START)
-			return false;
-		return process_control_frame_start(conn);
-	}
-	case CONN_STATE_READING_DATA: {
-		if (type != FSTRM_CONTROL_STOP)
-			return false;
-		return process_control_frame_stop(conn);
-	}
-	default:
-		return false;
-	}
-
-	/* Success. */
-	return true;
 }
 
 // Callback for reading from DNStap socket.
 static void cb_read(struct bufferevent *bev, void *arg)
 {
 	struct connection* conn = (struct connection*)arg;
-	conn->bev = bev;
-	conn->ev_input = bufferevent_get_input(conn->bev);
-	conn->ev_output = bufferevent_get_output(conn->bev);
 
-	for (;;)
+	/*
+	 * Process the frames that have fully arrived. The connection is closed
+	 * once the FINISH frame has been written (see cb_write), or right away if
+	 * the sender doesn't follow the protocol.
+	 */
+	if (gather_session_process(&conn->session, bufferevent_get_input(bev), bufferevent_get_output(bev)) == -1)
 	{
-		/* Get the number of bytes available in the buffer. */
-		conn->len_buf = evbuffer_get_length(conn->ev_input);
-
-		/* Check if there is any data available in the buffer. */
-		if (conn->len_buf <= 0)
-			return;
-
-		/* Check if the full frame has arrived. */
-		if ((conn->bytes_skip == 0) && !can_read_full_frame(conn))
-			return;
-
-		/* Skip bytes of oversized frames. */
-		if (conn->bytes_skip > 0)
-		{
-			size_t skip = conn->bytes_skip;
-
-			if (skip > conn->len_buf)
-			{
-				skip = conn->len_buf;
-			}
-
-			log_msg(DEBUG, "Skipping %zu bytes in frame.", skip);
-			evbuffer_drain(conn->ev_input, skip);
-			conn->bytes_skip -= skip;
-			continue;
-		}
+		log_perror(WARN, "Closing DNStap connection");
+		cb_close_conn(bev, 0, conn);
+	}
 
-		/* Process the frame. */
-		if (conn->len_frame_payload > 0)
-		{
-			/* This is a data frame. */
-			process_data_frame(conn);
-		}
-		else
-		{
-			/* This is a control frame. */
-			if (!load_control_frame(conn)) {
-				/* Malformed control frame, shut down the connection. */
-				cb_close_conn(conn->bev, 0, conn);
-				return;
-			}
+	// Check whether the input is falling behind.
+	update_overload_lag();
+}
 
-			if (!process_control_frame(conn)) {
-				/*
-				 * Invalid control state requested, or the
-				 * end-of-stream has been reached. Shut down
-				 * the connection.
-				 */
-				cb_close_conn(conn->bev, 0, conn);
-				return;
-			}
-		}
-	}
+// Ends our side of a connection that's being drained, once the pending control frames have been written.
+static void shutdown_connection_output(struct connection* conn)
+{
+	if (shutdown(bufferevent_getfd(conn->bev), SHUT_WR) == -1)
+		log_perror(WARN, "Failed to shut down connection for handover");
 }
 
 // Writes to the socket.
@@ -802,12 +523,26 @@ static void cb_write(struct bufferevent *bev, void *arg)
 {
 	struct connection* conn = (struct connection*)arg;
 
-	if (conn->state != CONN_STATE_STOPPED)
+	if (conn->session.state != GATHER_SESSION_STOPPED)
+	{
+		if (conn->draining)
+			shutdown_connection_output(conn);
 		return;
+	}
 
 	cb_close_conn(bev, 0, arg);
 }
 
+// Drains a connection. Frame Streams doesn't allow the receiver to stop the stream, so
+// instead the end of our side of the connection is signalled. Unbound then closes the
+// connection itself, while all it sent before is still read and processed as usual.
+static void drain_connection(struct connection* conn)
+{
+	conn->draining = true;
+	if (evbuffer_get_length(bufferevent_get_output(conn->bev)) == 0)
+		shutdown_connection_output(conn);
+}
+
 // Accepts connections from underlying libevent sockets.
 static void cb_accept_conn(struct evconnlistener *listener, evutil_socket_t fd, struct sockaddr *sa, int socklen, void *arg)
 {
@@ -820,7 +555,7 @@ static void cb_accept_conn(struct evconnlistener *listener, evutil_socket_t fd,
         struct bufferevent* bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
         if (!bev)
         {
-                log_msg(ERR, "Failed to accept connection on Unix socket!");
+                log_msg(ERR, "Failed to accept connection on socket!");
                 evutil_closesocket(fd);
                 return;
         }
@@ -829,21 +564,24 @@ static void cb_accept_conn(struct evconnlistener *listener, evutil_socket_t fd,
         struct connection* conn = conn_init(ctx);
 	if (conn)
 	{
+		conn->bev = bev;
 	        bufferevent_setcb(bev, cb_read, cb_write, cb_close_conn, (void*)conn);
-        	bufferevent_setwatermark(bev, EV_READ, 0, CAPTURE_HIGH_WATERMARK);
+        	bufferevent_setwatermark(bev, EV_READ, 0, GATHER_SESSION_MAX_FRAME_SIZE);
 	        bufferevent_enable(bev, EV_READ | EV_WRITE);
 
-	        log_msg(INFO, "Accepted new connection on the Unix socket!");
+	        log_msg(INFO, "Accepted new connection on the socket!");
 	}
 	else
 	{
 		log_msg(ERR, "Failed to initialize the connection!");
+		bufferevent_free(bev);
+		return;
 	}
 
 	--ctx->remaining_connections;
 	if (ctx->remaining_connections == 0)
 	{
-		evconnlistener_disable(listener);
+		set_listeners_enabled(ctx, false);
 	}
 }
 
@@ -854,21 +592,42 @@ static void cb_accept_error(struct evconnlistener *listener, void *arg)
         log_msg(ERR, "Failed to accept connection on socket: %s", evutil_socket_error_to_string(err));
 }
 
-// Initializes the DNStap input for Unbound.
-static bool init_dnstap_input()
+// Opens the listening sockets for the endpoints in the configuration (by default
+// the unix socket at UNIX_SOCKET_PATH).
+static bool open_listeners(int* listener_fds, size_t* nr_listener_fds)
 {
-        // If the Honas process was killed ungracefully, the socket file is still present.
-        if (access(UNIX_SOCKET_PATH, F_OK) != -1)
-        {
-                log_msg(INFO, "Unlinking existing socket file %s...", UNIX_SOCKET_PATH);
-                unlink(UNIX_SOCKET_PATH);
-        }
+	char* endpoints = strdup(config.listen != NULL ? config.listen : UNIX_SOCKET_PATH);
+	log_passert(endpoints != NULL, "Failed to allocate listener endpoints");
 
-        // Bind the socket to a file (see define on top of file for default). We already set
-        // the first byte of the 'sun_path' to zero with calloc.
-        ctx.addr.sun_family = AF_UNIX;
-        strncpy(ctx.addr.sun_path, UNIX_SOCKET_PATH, sizeof(ctx.addr.sun_path) - 1);
+	*nr_listener_fds = 0;
+	char* saveptr = NULL;
+	for (char* endpoint = strtok_r(endpoints, " \t", &saveptr); endpoint != NULL; endpoint = strtok_r(NULL, " \t", &saveptr))
+	{
+		struct sockaddr_storage addr;
+		socklen_t addr_len;
+		int fd = -1;
+		if (*nr_listener_fds == GATHER_LISTENER_MAX_ENDPOINTS || gather_listener_parse(endpoint, &addr, &addr_len) == -1)
+			log_msg(ERR, "Invalid listener endpoint '%s'", endpoint);
+		else if ((fd = gather_listener_open((struct sockaddr*)&addr, addr_len, SOMAXCONN)) == -1)
+			log_perror(ERR, "Failed to listen on '%s'", endpoint);
+		if (fd == -1)
+		{
+			while (*nr_listener_fds > 0)
+				close(listener_fds[--*nr_listener_fds]);
+			free(endpoints);
+			return false;
+		}
 
+		log_msg(INFO, "Listening on '%s'", endpoint);
+		listener_fds[(*nr_listener_fds)++] = fd;
+	}
+	free(endpoints);
+	return true;
+}
+
+// Initializes the DNStap input for Unbound on the listening sockets.
+static bool init_dnstap_input(const int* listener_fds, size_t nr_listener_fds)
+{
         // Create the event base.
         ctx.ev_base = event_base_new();
         if (!ctx.ev_base)
@@ -876,26 +635,99 @@ static bool init_dnstap_input()
                 return false;
         }
 
-        // Create the event connection listener.
+        // Create the event connection listeners; the sockets are already listening.
         unsigned flags = 0;
         flags |= LEV_OPT_CLOSE_ON_FREE; // Closes underlying sockets.
         flags |= LEV_OPT_CLOSE_ON_EXEC; // Sets FD_CLOEXEC on underlying sockets.
-        flags |= LEV_OPT_REUSEABLE;      // Sets SO_REUSEADDR on listener.
-        ctx.ev_connlistener = evconnlistener_new_bind(ctx.ev_base, cb_accept_conn, (void*)&ctx, flags, -1,
-                (struct sockaddr*)&ctx.addr, sizeof(ctx.addr));
-        if (!ctx.ev_connlistener)
+        for (size_t i = 0; i < nr_listener_fds; i++)
         {
-                event_base_free(ctx.ev_base);
-                ctx.ev_base = NULL;
-                return false;
+                evutil_make_socket_nonblocking(listener_fds[i]);
+                ctx.ev_connlisteners[i] = evconnlistener_new(ctx.ev_base, cb_accept_conn, (void*)&ctx, flags, 0, listener_fds[i]);
+                if (!ctx.ev_connlisteners[i])
+                {
+                        return false;
+                }
+                ctx.nr_connlisteners++;
+
+                // Set the error handling callback.
+                evconnlistener_set_error_cb(ctx.ev_connlisteners[i], cb_accept_error);
         }
 
-        // Set the error handling callback.
-        evconnlistener_set_error_cb(ctx.ev_connlistener, cb_accept_error);
-
 	return true;
 }
 
+// Registers the lookups captured from the network interface. At most CAPTURE_MAX_LOOKUPS
+// are registered at once, so that the other events get their turn; the event fires again
+// while there are lookups left.
+static void cb_capture(evutil_socket_t fd, short what, void *arg)
+{
+	size_t nr_lookups = 0;
+	while (nr_lookups < CAPTURE_MAX_LOOKUPS)
+	{
+		ssize_t nr_read = input_afpacket.next_batch(ctx.capture_state, ctx.capture_lookups, LOOKUP_BATCH_SIZE);
+		if (nr_read == -1)
+		{
+			if (errno != EAGAIN)
+				log_perror(ERR, "Failed to read captured lookups");
+			break;
+		}
+
+		const uint64_t now_ms = current_time_ms();
+		for (ssize_t i = 0; i < nr_read; i++)
+		{
+			measure_lag(ctx.capture_lookups[i].timestamp, ctx.capture_lookups[i].timestamp_nsec, now_ms);
+			register_input_lookup(&ctx.capture_lookups[i], now_ms / 1000);
+		}
+		nr_lookups += nr_read;
+	}
+
+	// Check whether the capture is falling behind.
+	update_overload_lag();
+}
+
+// Initializes the capture of DNS queries from a network interface, next to the DNStap input.
+static bool init_capture_input(void)
+{
+	input_afpacket.finalize_config(ctx.capture_state);
+	ctx.capture_lookups = malloc(LOOKUP_BATCH_SIZE * sizeof(struct honas_input_lookup));
+	ctx.ev_capture = event_new(ctx.ev_base, input_afpacket_fd(ctx.capture_state), EV_READ | EV_PERSIST, cb_capture, NULL);
+	return ctx.capture_lookups != NULL && ctx.ev_capture != NULL && event_add(ctx.ev_capture, NULL) == 0;
+}
+
+// Stops the capture from the network interface and registers the lookups that were
+// captured already. The capture is stopped before the active state is handed over, so
+// that the lookups seen after that aren't registered in a state that's no longer used.
+// This also means that the new process never shares a fanout group with this one.
+static void stop_capture_input(void)
+{
+	if (ctx.ev_capture == NULL)
+		return;
+
+	event_del(ctx.ev_capture);
+	input_afpacket_stop(ctx.capture_state);
+
+	ssize_t nr_read;
+	size_t nr_lookups = 0;
+	const uint64_t now = time(NULL);
+	while ((nr_read = input_afpacket.next_batch(ctx.capture_state, ctx.capture_lookups, LOOKUP_BATCH_SIZE)) > 0)
+	{
+		for (ssize_t i = 0; i < nr_read; i++)
+			register_input_lookup(&ctx.capture_lookups[i], now);
+		nr_lookups += nr_read;
+	}
+	log_msg(INFO, "Stopped capture, registered %zu remaining captured lookups", nr_lookups);
+}
+
+// Resumes the capture from the network interface after a failed handover.
+static void resume_capture_input(void)
+{
+	if (ctx.ev_capture == NULL)
+		return;
+
+	if (input_afpacket_start(ctx.capture_state) == -1 || event_add(ctx.ev_capture, NULL) == -1)
+		log_msg(ERR, "Failed to resume capture input after failed handover, only dnstap is gathered");
+}
+
 static void create_state(honas_gather_config_t* config, honas_state_t* state, uint64_t period_begin)
 {
 	uint64_t period_end = period_begin - (period_begin % config->period_length) + config->period_length;
@@ -907,6 +739,9 @@ static void create_state(honas_gather_config_t* config, honas_state_t* state, ui
 		config->number_of_filters_per_user,
 		config->flatten_threshold);
 	log_passert(result == 0, "Failed to create honas state");
+	if (config->shared_block_size != 0 && honas_state_use_shared_blocks(state, config->shared_block_size) == -1)
+		log_die("The shared block size %u doesn't divide the bloom filters", config->shared_block_size);
+	state->summary_size = config->summary_size;
 
 	state->header->period_begin = period_begin;
 	state->header->period_end = period_end;
@@ -926,7 +761,8 @@ static void finalize_state(honas_state_t* state)
 	struct tm period_end_ts;
 	strftime(period_file_name, sizeof(period_file_name), "%FT%T.hs", gmtime_r(&period_end_time, &period_end_ts));
 
-	honas_state_persist(state, period_file_name, false);
+	// A replay saves in the foreground, as it would otherwise fork for each period.
+	honas_state_persist(state, period_file_name, ctx.replay);
 	honas_state_destroy(state);
 
 	log_msg(NOTICE, "Saved honas state to '%s'", period_file_name);
@@ -935,6 +771,8 @@ static void finalize_state(honas_state_t* state)
 // Parse an item in the configuration.
 static int parse_config_item(const char* filename, honas_gather_config_t* config, unsigned int lineno, char* keyword, char* value, unsigned int length)
 {
+	if (input_afpacket.parse_config_item(filename, ctx.capture_state, lineno, keyword, value, length))
+		return 1;
 	return honas_gather_config_parse_item(filename, config, lineno, keyword, value, length);
 }
 
@@ -949,7 +787,9 @@ static void load_gather_config(honas_gather_config_t* config, int dirfd, const c
 // The signal shutdown handler.
 static void shutdown_handler(int signum __attribute__((unused)))
 {
-	event_base_loopexit(ctx.ev_base, NULL);
+	shutdown_pending = true;
+	if (ctx.ev_base != NULL)
+		event_base_loopexit(ctx.ev_base, NULL);
 }
 
 // Sets up signal handlers.
@@ -976,6 +816,13 @@ static bool setup_signal_handlers()
 		return false;
 	}
 
+	// Writing to a connection that was closed by its peer is handled as a connection error.
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL) != 0)
+	{
+		return false;
+	}
+
 	return true;
 }
 
@@ -1017,9 +864,150 @@ static void close_state(honas_state_t* state)
 	log_msg(NOTICE, "Saved honas state to '%s'", active_state_file_name);
 }
 
+/* Share the active state as live view, if configured, replacing the one of the
+ * previous period (which could have been configured by a different name).
+ */
+static void share_state(honas_gather_config_t* config, honas_state_t* state, const char* previous_live_view_name)
+{
+	if (previous_live_view_name != NULL && (config->live_view_name == NULL || strcmp(previous_live_view_name, config->live_view_name) != 0)) {
+		if (honas_state_unshare(previous_live_view_name) == -1 && errno != ENOENT)
+			log_perror(WARN, "Failed to remove live view '%s'", previous_live_view_name);
+	}
+	if (config->live_view_name == NULL)
+		return;
+
+	if (honas_state_share(state, config->live_view_name) == -1)
+		log_perror(WARN, "Failed to share honas state as live view '%s'", config->live_view_name);
+	else
+		log_msg(INFO, "Shared honas state as live view '%s'", config->live_view_name);
+}
+
+// Receives the listening sockets and the active state from the previous process.
+static void receive_handover(int handover_sock, honas_state_t* state, int* listener_fds, size_t* nr_listener_fds)
+{
+	int state_fd;
+	log_passert(gather_handover_receive(handover_sock, listener_fds, nr_listener_fds, &state_fd) != -1, "Failed to receive handover from previous process");
+
+	int result = honas_state_import(state, state_fd);
+	close(state_fd);
+	switch (result) {
+	case -1:
+		log_pfail("Failed to take over honas state");
+
+	case 0:
+		log_msg(INFO, "Took over honas state and %zu listening socket(s) from previous process", *nr_listener_fds);
+		return;
+
+	case 1:
+		log_die("Handed over honas state is not a valid honas state");
+
+	case 2:
+		log_die("Handed over honas state contains errors");
+
+	default:
+		log_die("Taking over honas state returned unsupported result code '%d'", result);
+	}
+}
+
+// Resumes normal operation after a failed handover.
+static void abort_handover(void)
+{
+	log_msg(ERR, "Handover to process %d failed, resuming", (int)ctx.handover_pid);
+
+	// Make sure the new process doesn't start accepting connections after all.
+	if (kill(ctx.handover_pid, SIGKILL) == 0 || errno == ESRCH)
+		waitpid(ctx.handover_pid, NULL, 0);
+	close(ctx.handover_sock);
+	ctx.handover_sock = -1;
+	ctx.handover_pid = 0;
+
+	// All connections have been closed, allow infinitely many connections again.
+	ctx.remaining_connections = -1;
+	set_listeners_enabled(&ctx, true);
+	resume_capture_input();
+}
+
+// Hands the listening socket and the active state over to the new process, once all connections are drained.
+static void complete_handover(void)
+{
+	if (ctx.ev_handover_timer)
+	{
+		event_free(ctx.ev_handover_timer);
+		ctx.ev_handover_timer = NULL;
+	}
+
+	stop_capture_input();
+	int state_fd = honas_state_export(&current_active_state);
+	if (state_fd == -1)
+	{
+		log_perror(ERR, "Failed to copy honas state for handover");
+		abort_handover();
+		return;
+	}
+	int listener_fds[GATHER_LISTENER_MAX_ENDPOINTS];
+	for (size_t i = 0; i < ctx.nr_connlisteners; i++)
+		listener_fds[i] = evconnlistener_get_fd(ctx.ev_connlisteners[i]);
+	int result = gather_handover_send(ctx.handover_sock, listener_fds, ctx.nr_connlisteners, state_fd);
+	close(state_fd);
+	if (result == -1 || gather_handover_wait(ctx.handover_sock, HANDOVER_ACK_TIMEOUT) == -1)
+	{
+		log_perror(ERR, "Failed to hand over to process %d", (int)ctx.handover_pid);
+		abort_handover();
+		return;
+	}
+
+	log_msg(NOTICE, "Handed over to process %d", (int)ctx.handover_pid);
+	close(ctx.handover_sock);
+	ctx.handover_sock = -1;
+	ctx.handed_over = true;
+	event_base_loopexit(ctx.ev_base, NULL);
+}
+
+// Closes the connections that weren't drained in time.
+static void handover_timeout_handler(evutil_socket_t fd, short what, void *arg)
+{
+	log_msg(WARN, "Connections not drained in time for handover, closing them");
+	while (ctx.connections != NULL && ctx.handover_sock != -1)
+		cb_close_conn(ctx.connections->bev, 0, ctx.connections);
+}
+
+// The handover signal handler; starts a new process to hand over to.
+static void handover_handler(evutil_socket_t fd, short what, void *arg)
+{
+	if (ctx.handover_sock != -1)
+	{
+		log_msg(WARN, "Ignoring handover request, a handover is already in progress");
+		return;
+	}
+
+	ctx.handover_pid = gather_handover_spawn(program_path, program_argv, init_dirfd, &ctx.handover_sock);
+	if (ctx.handover_pid == -1)
+	{
+		log_perror(ERR, "Failed to start new process '%s' for handover", program_path);
+		ctx.handover_sock = -1;
+		return;
+	}
+	log_msg(NOTICE, "Handing over to new process %d", (int)ctx.handover_pid);
+
+	// Stop accepting connections and drain the open ones: the data that was sent
+	// already is still processed, until Unbound closes the connection. Unbound
+	// then reconnects, which is accepted by the new process.
+	set_listeners_enabled(&ctx, false);
+	if (ctx.connections == NULL)
+	{
+		complete_handover();
+		return;
+	}
+	for (struct connection* conn = ctx.connections; conn != NULL; conn = conn->next)
+		drain_connection(conn);
+	struct timeval drain_timeout = { HANDOVER_DRAIN_TIMEOUT, 0 };
+	ctx.ev_handover_timer = evtimer_new(ctx.ev_base, handover_timeout_handler, NULL);
+	evtimer_add(ctx.ev_handover_timer, &drain_timeout);
+}
+
 static void show_usage(const char* program_name, FILE* out)
 {
-	fprintf(out, "Usage: %s [--help] [--config <file>]\n\n", program_name);
+	fprintf(out, "Usage: %s [--help] [--config <file>] [--replay <capture file>...]\n\n", program_name);
 	fprintf(out, "  -h|--help           Show this message\n");
 	fprintf(out, "  -c|--config <file>  Load config from file instead of " DEFAULT_HONAS_GATHER_CONFIG_PATH "\n");
 	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
@@ -1028,6 +1016,7 @@ static void show_usage(const char* program_name, FILE* out)
 	fprintf(out, "  -f|--fork           Fork the process as daemon (syslog must be enabled)\n");
 	fprintf(out, "  -a|--aggregate      Aggregates queries by subnet per filter (predefined subnets)\n");
 	fprintf(out, "  -d|--dry-run        Performs measurements and gives advice about Bloom filter configuration\n");
+	fprintf(out, "  -r|--replay         Replays dnstap or packet capture files into state files instead of listening\n");
 }
 
 static const struct option long_options[] = {
@@ -1039,6 +1028,7 @@ static const struct option long_options[] = {
 	{ "fork", no_argument, 0, 'f' },
 	{ "aggregate", no_argument, 0, 'a' },
 	{ "dry-run", no_argument, 0, 'd' },
+	{ "replay", no_argument, 0, 'r' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -1066,6 +1056,10 @@ static void instrumentation_event(evutil_socket_t fd, short what, void *arg)
 {
 	struct instrumentation* inst_arg = (struct instrumentation*)arg;
 
+	// An idle input doesn't lag, so that the overload level is left as well when no input arrives.
+	if (overload_lag_is_idle(&ctx.lag))
+		update_overload(0);
+
 	// Dump the instrumentation data to the logfile.
 	char dumped[1024];
 	instrumentation_dump(inst_arg, dumped, sizeof(dumped));
@@ -1298,6 +1292,59 @@ static const float timedifference_msec(struct timeval* t0, struct timeval* t1)
     return (t1->tv_sec - t0->tv_sec) * 1000.0f + (t1->tv_usec - t0->tv_usec) / 1000.0f;
 }
 
+// Reinitializes the subnet activity configuration, as this configuration may change.
+// Automatic reloading is the most convinient.
+static void reload_subnet_activity(void)
+{
+	// Measure the time it takes to reload the subnet activity configuration.
+	struct timeval t_stop, t_start;
+	gettimeofday(&t_start, NULL);
+
+	// Destroy the subnet activity subsystem.
+	if (subnet_activity_destroy(&ctx.subnet_metadata) == SA_OK)
+	{
+		log_msg(INFO, "Finalized subnet activity resources.");
+	}
+	else
+	{
+		log_msg(ERR, "Failed to finalize subnet activity resources in recheck handler!");
+	}
+
+	// Reinitialize the subnet aggregation subsystem.
+	if (subnet_activity_initialize(config.subnet_activity_path, &ctx.subnet_metadata) == SA_OK)
+	{
+		log_msg(INFO, "Succesfully initialized the subnet aggregation subsystem!");
+	}
+	else
+	{
+		log_msg(ERR, "Failed to initialize the subnet aggregation subsystem!");
+	}
+
+	// Log the time it took.
+	gettimeofday(&t_stop, NULL);
+	log_msg(INFO, "Subnet activity configuration reload took %f ms", timedifference_msec(&t_start, &t_stop));
+}
+
+// Finalizes the state of the period that has ended and creates the state for the
+// period containing 'now', reloading the configuration.
+static void rotate_state(honas_state_t* state, uint64_t now)
+{
+	// Finalize current state, reload config and create new current state
+	char* previous_live_view_name = config.live_view_name != NULL ? strdup(config.live_view_name) : NULL;
+	finalize_state(state);
+	load_gather_config(&config, init_dirfd, config_file);
+	create_state(&config, state, now);
+	share_state(&config, state, previous_live_view_name);
+	free(previous_live_view_name);
+
+	// Reset the false positive rate threshold warning.
+	ctx.fpr_warning_passed = false;
+
+	// Also reinitialize the subnet activity configuration.
+	if (ctx.aggregate_subnets)
+		reload_subnet_activity();
+}
+
 // The signal reload/recheck handler.
 static void recheck_handler(evutil_socket_t fd, short what, void *arg)
 {
@@ -1307,47 +1354,222 @@ static void recheck_handler(evutil_socket_t fd, short what, void *arg)
 	const int64_t wait = state_param->header->period_end - now;
 	if (wait <= 0)
 	{
-		// Finalize current state, reload config and create new current state
-		finalize_state(state_param);
-		load_gather_config(&config, init_dirfd, config_file);
-		create_state(&config, state_param, now);
+		rotate_state(state_param, now);
+	}
+	else
+	{
+		// Refresh the header snapshot of the live view (if shared).
+		honas_state_publish(state_param);
+	}
+}
 
-		// Reset the false positive rate threshold warning.
+// Creates the state of a replayed period. Like a rotation, the configuration is reloaded
+// for all but the first period.
+static void replay_begin_period(void* arg, honas_state_t* state, uint64_t period_begin)
+{
+	if (ctx.replay_clock.nr_periods > 1)
+	{
+		load_gather_config(&config, init_dirfd, config_file);
 		ctx.fpr_warning_passed = false;
-
-		// Also reinitialize the subnet activity configuration, as this configuration
-		// may change. Automatic reloading is the most convinient.
 		if (ctx.aggregate_subnets)
+			reload_subnet_activity();
+	}
+	create_state(&config, state, period_begin);
+}
+
+// Saves the state of a replayed period that has ended.
+static void replay_end_period(void* arg, honas_state_t* state)
+{
+	finalize_state(state);
+}
+
+// Advances the replay to the time a lookup was made. Lookups of which the time isn't
+// known yet are skipped.
+static bool replay_advance(uint64_t timestamp)
+{
+	if (gather_replay_advance(&ctx.replay_clock, timestamp))
+		return true;
+
+	instrumentation_increment_skipped(inst_data);
+	instrumentation_increment_processed(inst_data);
+	return false;
+}
+
+// Registers a message from a dnstap capture file as a lookup at the time the query was made.
+static void replay_message(const Dnstap__Message* m)
+{
+	if (!replay_advance(m->has_query_time_sec ? m->query_time_sec : 0))
+		return;
+
+	if (!decode_dnstap_message(m, ctx.replay_clock.time))
+	{
+		log_msg(DEBUG, "Failed to decode the DNStap message!");
+		instrumentation_increment_invalid(inst_data);
+	}
+}
+
+// Replays a packet capture (pcap or pcapng) through the pcap input module, which
+// parses the DNS queries from the packets in batches.
+static bool replay_packet_capture_file(const char* filename, int fd)
+{
+	void* input_state = NULL;
+	log_passert(input_pcap.init(&input_state) != -1, "Failed to initialize the pcap input");
+	input_pcap_set_fd(input_state, fd);
+	struct honas_input_lookup* lookups = malloc(LOOKUP_BATCH_SIZE * sizeof(struct honas_input_lookup));
+	log_passert(lookups != NULL, "Failed to allocate lookups");
+
+	bool result = true;
+	size_t nr_lookups = 0;
+	while (!shutdown_pending)
+	{
+		ssize_t nr_read = input_pcap.next_batch(input_state, lookups, LOOKUP_BATCH_SIZE);
+		if (nr_read == 0)
+			break;
+		if (nr_read == -1)
 		{
-			// Measure the time it takes to reload the subnet activity configuration.
-			struct timeval t_stop, t_start;
-			gettimeofday(&t_start, NULL);
+			if (errno == EINTR)
+				continue;
+			log_perror(ERR, "Failed to read capture file '%s'", filename);
+			result = false;
+			break;
+		}
 
-			// Destroy the subnet activity subsystem.
-			if (subnet_activity_destroy(&ctx.subnet_metadata) == SA_OK)
-			{
-				log_msg(INFO, "Finalized subnet activity resources.");
-			}
-			else
-			{
-				log_msg(ERR, "Failed to finalize subnet activity resources in recheck handler!");
-			}
+		for (ssize_t i = 0; i < nr_read; i++)
+		{
+			if (replay_advance(lookups[i].timestamp))
+				register_input_lookup(&lookups[i], ctx.replay_clock.time);
+		}
+		nr_lookups += nr_read;
+	}
+	log_msg(INFO, "Replayed %zu queries from capture file '%s'", nr_lookups, filename);
 
-			// Reinitialize the subnet aggregation subsystem.
-			if (subnet_activity_initialize(config.subnet_activity_path, &ctx.subnet_metadata) == SA_OK)
-			{
-				log_msg(INFO, "Succesfully initialized the subnet aggregation subsystem!");
-			}
-			else
-			{
-				log_msg(ERR, "Failed to initialize the subnet aggregation subsystem!");
-			}
+	free(lookups);
+	input_pcap.destroy(input_state);
+	return result;
+}
+
+// Decodes a data frame from a dnstap capture file, unless the replay is interrupted.
+static int replay_data_frame(void* arg, const uint8_t* data, size_t length)
+{
+	if (shutdown_pending)
+	{
+		errno = EINTR;
+		return -1;
+	}
+
+	Dnstap__Dnstap* d = dnstap__dnstap__unpack(NULL, length, data);
+	if (d)
+	{
+		if (d->message)
+			replay_message(d->message);
+		dnstap__dnstap__free_unpacked(d, NULL);
+	}
+	else
+	{
+		log_msg(DEBUG, "Failed to unpack the frame into DNStap data!");
+		instrumentation_increment_invalid(inst_data);
+	}
+	return 0;
+}
+
+// Replays a dnstap capture file in the Frame Streams file format (as written by the
+// dnstap file output of Unbound or by `fstrm_capture`). The file is mapped into memory
+// and the data frames are decoded in place.
+static bool replay_dnstap_file(const char* filename, int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+	{
+		log_perror(ERR, "Failed to determine the size of capture file '%s'", filename);
+		close(fd);
+		return false;
+	}
+	const size_t size = st.st_size;
+	if (size == 0)
+	{
+		log_msg(ERR, "Capture file '%s' is empty", filename);
+		close(fd);
+		return false;
+	}
+	const uint8_t* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		log_perror(ERR, "Failed to map capture file '%s'", filename);
+		return false;
+	}
+	if (madvise((void*)data, size, MADV_SEQUENTIAL) == -1)
+		log_perror(DEBUG, "Failed to advise sequential access of capture file '%s'", filename);
+
+	size_t nr_frames = 0;
+	const int result = gather_replay_dnstap(data, size, replay_data_frame, NULL, &nr_frames);
+	const bool interrupted = result == -1 && errno == EINTR;
+	if (result == -1 && !interrupted)
+		log_perror(ERR, "Capture file '%s' is not a valid dnstap capture file", filename);
+	else if (result == 1)
+		log_msg(WARN, "Capture file '%s' is truncated after %zu data frames", filename, nr_frames);
+	log_msg(INFO, "Replayed %zu data frames from capture file '%s'", nr_frames, filename);
+
+	munmap((void*)data, size);
+	return result != -1 || interrupted;
+}
+
+// Replays a capture file, either a packet capture or a dnstap capture.
+static bool replay_file(const char* filename)
+{
+	int fd = openat(init_dirfd, filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		log_perror(ERR, "Failed to open capture file '%s'", filename);
+		return false;
+	}
+	if (input_pcap_is_capture(fd))
+		return replay_packet_capture_file(filename, fd);
+	return replay_dnstap_file(filename, fd);
+}
 
-			// Log the time it took.
-			gettimeofday(&t_stop, NULL);
-			log_msg(INFO, "Subnet activity configuration reload took %f ms", timedifference_msec(&t_start, &t_stop));
+/* Replays capture files into state files as fast as possible, instead of
+ * gathering from the dnstap listeners. The states of all periods are saved as the
+ * state files they would have been, including the last one.
+ */
+static int replay(char** filenames, int nr_filenames)
+{
+	log_passert(instrumentation_initialize(&inst_data), "Failed to initialize instrumentation structure");
+	if (ctx.aggregate_subnets)
+	{
+		if (subnet_activity_initialize(config.subnet_activity_path, &ctx.subnet_metadata) == SA_OK)
+		{
+			log_msg(INFO, "Succesfully initialized the subnet aggregation subsystem!");
+		}
+		else
+		{
+			log_msg(ERR, "Failed to initialize the subnet aggregation subsystem!");
 		}
 	}
+
+	struct timespec t_start, t_stop;
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	gather_replay_init(&ctx.replay_clock, &current_active_state, replay_begin_period, replay_end_period, NULL);
+	int result = 0;
+	for (int i = 0; i < nr_filenames && !shutdown_pending; i++)
+	{
+		if (!replay_file(filenames[i]))
+			result = 1;
+	}
+	gather_replay_finish(&ctx.replay_clock);
+	clock_gettime(CLOCK_MONOTONIC, &t_stop);
+
+	const double seconds = (t_stop.tv_sec - t_start.tv_sec) + (t_stop.tv_nsec - t_start.tv_nsec) / 1e9;
+	log_msg(NOTICE, "Replayed %zu queries (%zu accepted, %zu skipped, %zu invalid) in %.3f seconds: %.0f queries/s"
+		, inst_data->n_processed_queries, inst_data->n_accepted_queries, inst_data->n_skipped_queries, inst_data->n_invalid_frames
+		, seconds, seconds > 0 ? inst_data->n_processed_queries / seconds : 0.0);
+
+	if (ctx.aggregate_subnets && subnet_activity_destroy(&ctx.subnet_metadata) == SA_OK)
+	{
+		log_msg(INFO, "Finalized subnet activity resources.");
+	}
+	instrumentation_destroy(inst_data);
+	return result;
 }
 
 // The Honas gather entrypoint.
@@ -1359,11 +1581,21 @@ int main(int argc, char** argv)
 
 	// Set entire capture context initially to zero.
 	memset(&ctx, 0, sizeof(struct capture));
+	ctx.handover_sock = -1;
+
+	// Remember how this program was started, for handing over to a new process (see `handover_handler`).
+	program_argv = argv;
+	ssize_t program_path_len = readlink("/proc/self/exe", program_path, sizeof(program_path) - 1);
+	if (program_path_len == -1)
+		snprintf(program_path, sizeof(program_path), "%s", argv[0]);
+	else
+		program_path[program_path_len] = '\0';
+	int handover_sock = gather_handover_socket();
 
 	/* Parse command line arguments */
 	while (1) {
 		int option_index = 0;
-		int c = getopt_long(argc, argv, "hc:qsvfad", long_options, &option_index);
+		int c = getopt_long(argc, argv, "hc:qsvfadr", long_options, &option_index);
 		if (c == -1)
 			break;
 
@@ -1409,19 +1641,29 @@ int main(int argc, char** argv)
 			ctx.dry_run = true;
 			break;
 
+		case 'r':
+			ctx.replay = true;
+			break;
+
 		default:
 			log_msg(CRIT, "Unimplemented option '%c'; Aborting!", c);
 			return 1;
 		}
 	}
-	if (optind < argc) {
+	if (ctx.replay && (optind == argc || ctx.dry_run || handover_sock != -1)) {
+		log_msg(CRIT, "A replay needs capture files and can't be combined with a dry run!");
+		show_usage(program_name, stderr);
+		return 1;
+	}
+	if (optind < argc && !ctx.replay) {
 		log_msg(CRIT, "Unsupported argument supplied: %s!", argv[optind]);
 		show_usage(program_name, stderr);
 		return 1;
 	}
 
-	// Check if forking was requested.
-	if (daemonize)
+	// Check if forking was requested. A process that takes over is already detached
+	// from the terminal, as its parent exits after the handover.
+	if (daemonize && handover_sock == -1)
 	{
 		// Check if syslog is enabled, otherwise forking doesn't work.
 		if (!syslogenabled)
@@ -1461,14 +1703,36 @@ int main(int argc, char** argv)
 	log_passert(init_dirfd != -1, "Failed to open initial working directory");
 
 	/* Initialize and read configuration */
+	log_passert(input_afpacket.init(&ctx.capture_state) != -1, "Failed to initialize the capture input");
 	honas_gather_config_init(&config);
 	load_gather_config(&config, init_dirfd, config_file);
 	honas_gather_config_finalize(&config);
 
-	/* Open or create honas state for this period */
-	if (!try_open_active_state(&current_active_state)) {
+	/* Replay capture files, instead of gathering */
+	if (ctx.replay) {
+		int result = replay(argv + optind, argc - optind);
+		input_afpacket.destroy(ctx.capture_state);
+		honas_gather_config_destroy(&config);
+		log_msg(NOTICE, "Exiting");
+		log_destroy();
+		return result;
+	}
+
+	/* Shed load according to the overload policy (if any) */
+	log_passert(overload_policy_parse(&ctx.overload, config.overload_sampling) != -1, "Failed to parse overload policy");
+
+	/* Take over, open or create honas state for this period */
+	int listener_fds[GATHER_LISTENER_MAX_ENDPOINTS];
+	size_t nr_listener_fds = 0;
+	if (handover_sock != -1) {
+		receive_handover(handover_sock, &current_active_state, listener_fds, &nr_listener_fds);
+		current_active_state.summary_size = config.summary_size;
+	} else if (!try_open_active_state(&current_active_state)) {
 		create_state(&config, &current_active_state, time(NULL));
+	} else {
+		current_active_state.summary_size = config.summary_size;
 	}
+	share_state(&config, &current_active_state, NULL);
 
 	// Start up the state rotation process. The recheck handler will schedule alarms.
 	recheck_handler(0, 0, &current_active_state);
@@ -1481,7 +1745,7 @@ int main(int argc, char** argv)
 	}
 
 	// Initialize the DNStap input feature.
-	if (!init_dnstap_input())
+	if ((handover_sock == -1 && !open_listeners(listener_fds, &nr_listener_fds)) || !init_dnstap_input(listener_fds, nr_listener_fds))
 	{
 		log_msg(ERR, "Failed to initialize DNStap input!");
 		return 1;
@@ -1491,6 +1755,24 @@ int main(int argc, char** argv)
 		log_msg(INFO, "Initialized DNStap input!");
 	}
 
+	// Capture DNS queries from a network interface as well, if configured.
+	if (input_afpacket_is_configured(ctx.capture_state) && !init_capture_input())
+	{
+		log_msg(ERR, "Failed to initialize capture input!");
+		return 1;
+	}
+
+	// Let the previous process know it can exit.
+	if (handover_sock != -1)
+	{
+		log_passert(gather_handover_acknowledge(handover_sock) != -1, "Failed to acknowledge handover to previous process");
+		close(handover_sock);
+	}
+
+	// Hand over to a new process on SIGUSR2.
+	ctx.ev_handover_signal = evsignal_new(ctx.ev_base, SIGUSR2, handover_handler, NULL);
+	event_add(ctx.ev_handover_signal, NULL);
+
 	// Add a recurring event each minute to perform state rotation.
 	struct timeval each_minute = { 60, 0 };
 	ctx.ev_state_rotation = event_new(ctx.ev_base, -1, EV_PERSIST, recheck_handler, &current_active_state);
@@ -1535,15 +1817,39 @@ int main(int argc, char** argv)
 	// Finalize application.
 	log_msg(NOTICE, "Done processing");
 
-	// Unlink socket file.
-	log_msg(INFO, "Unlinking socket file %s...", UNIX_SOCKET_PATH);
-	unlink(UNIX_SOCKET_PATH);
+	// Unlink socket files, unless the new process uses them now.
+	for (size_t i = 0; i < ctx.nr_connlisteners && !ctx.handed_over; i++)
+	{
+		char name[PATH_MAX];
+		log_msg(INFO, "Closing listener %s...", gather_listener_name(evconnlistener_get_fd(ctx.ev_connlisteners[i]), name, sizeof(name)));
+		gather_listener_unlink(evconnlistener_get_fd(ctx.ev_connlisteners[i]));
+	}
 
-	// Free the state rotation event.
+	// Free the state rotation and handover events.
 	if (ctx.ev_state_rotation)
 	{
 		event_free(ctx.ev_state_rotation);
 	}
+	if (ctx.ev_handover_signal)
+	{
+		event_free(ctx.ev_handover_signal);
+	}
+	if (ctx.ev_handover_timer)
+	{
+		event_free(ctx.ev_handover_timer);
+	}
+	if (ctx.handover_sock != -1)
+	{
+		close(ctx.handover_sock);
+	}
+
+	// Stop capturing from the network interface.
+	if (ctx.ev_capture)
+	{
+		event_free(ctx.ev_capture);
+	}
+	input_afpacket.destroy(ctx.capture_state);
+	free(ctx.capture_lookups);
 
 	// Clean up and finalize instrumentation.
 	finalize_instrumentation();
@@ -1566,17 +1872,23 @@ int main(int argc, char** argv)
 	}
 
 	// Clean up libevent resources.
-	if (ctx.ev_connlistener != NULL)
+	for (size_t i = 0; i < ctx.nr_connlisteners; i++)
 	{
-		evconnlistener_free(ctx.ev_connlistener);
+		evconnlistener_free(ctx.ev_connlisteners[i]);
 	}
 	if (ctx.ev_base != NULL)
 	{
 		event_base_free(ctx.ev_base);
 	}
 
-	/* Clean shutdown; persist active current state */
-	close_state(&current_active_state);
+	/* Clean shutdown; persist active current state, unless the new process took it over */
+	if (ctx.handed_over) {
+		honas_state_destroy(&current_active_state);
+	} else {
+		close_state(&current_active_state);
+		if (config.live_view_name != NULL && honas_state_unshare(config.live_view_name) == -1)
+			log_perror(WARN, "Failed to remove live view '%s'", config.live_view_name);
+	}
 
 	/* Destroy previously initialized data */
 	honas_gather_config_destroy(&config);
@@ -30,6 +30,7 @@
 #include "honas_state.h"
 #include "includes.h"
 #include "logging.h"
+#include "sealed_state.h"
 
 static char* get_version_string(uint32_t major_version, uint32_t minor_version)
 {
@@ -59,7 +60,7 @@ static const double bloom_actual_fpr(const double fr, const uint32_t k)
 
 static void show_plot_information(honas_state_t* state, FILE* out)
 {
-	uint32_t filter_size = state->header->number_of_bits_per_filter >> 3;
+	uint32_t filter_size = honas_state_stored_bits_per_filter(state) >> 3;
 	for (uint32_t i = 0; i < state->header->number_of_filters; i++) {
 		uint32_t bits_set = state->filter_bits_set[i];
 		uint32_t est_nr_host_names = bloom_approx_count(filter_size, state->header->number_of_hashes, bits_set);
@@ -82,24 +83,70 @@ static void show_general_information(honas_state_t* state, FILE* out)
 	fprintf(out, "Estimated number of host names: %u \n", state->header->estimated_number_of_host_names);
 	fprintf(out, "Number of requests            : %" PRIu64 "\n", state->header->number_of_requests);
 
+	if (state->sampling != NULL) {
+		fprintf(out, "\n## Sampling information ##\n\n");
+		fprintf(out, "Sampling rate          : 1 in %u clients\n", state->sampling->sampling_rate);
+		fprintf(out, "Number of shed requests: %" PRIu64 "\n", state->sampling->number_of_shed_requests);
+		if (state->sampling->number_of_shed_requests > 0) {
+			fprintf(out, "First shed request     : %s\n", get_timestamp_string(state->sampling->first_shed_request));
+			fprintf(out, "Last shed request      : %s\n", get_timestamp_string(state->sampling->last_shed_request));
+		}
+	}
+
 	fprintf(out, "\n## Filter configuration ##\n\n");
 	fprintf(out, "Number of filters         : %u\n", state->header->number_of_filters);
 	fprintf(out, "Number of filters per user: %u\n", state->header->number_of_filters_per_user);
 	fprintf(out, "Number of hashes          : %u\n", state->header->number_of_hashes);
 	fprintf(out, "Number of bits per filter : %u\n", state->header->number_of_bits_per_filter);
 	fprintf(out, "Flatten threshold         : %u\n", state->header->flatten_threshold);
+	fprintf(out, "Fold factor               : %u\n", state->fold_factor);
+	fprintf(out, "Number of bits stored     : %u\n", honas_state_stored_bits_per_filter(state));
+	if (state->shared_block_size != 0)
+		fprintf(out, "Shared block size         : %u\n", state->shared_block_size);
+	else
+		fprintf(out, "Shared block size         : none (bit offsets per filter)\n");
+
+	if (state->sealed != NULL) {
+		fprintf(out, "\n## Seal information ##\n\n");
+		fprintf(out, "Sealed file version: %s\n", get_version_string(state->sealed->header->major_version, state->sealed->header->minor_version));
+		fprintf(out, "Block size         : %u\n", state->sealed->header->block_size);
+		fprintf(out, "Blocks per filter  : %u\n", state->sealed->header->blocks_per_filter);
+		fprintf(out, "Interleaved filters: %s\n", state->sealed->shared_block_size != 0 ? "yes" : "no");
+	}
+
+	if (state->section_table != NULL) {
+		fprintf(out, "\n## Section information ##\n\n");
+		const struct honas_state_section* section;
+		for (uint32_t i = 0; (section = honas_state_get_section(state, i)) != NULL; i++) {
+			const char* type_name = honas_state_section_type_name(section->type);
+			fprintf(out, "%2u. %-15s (type %u%s) offset: %12" PRIu64 ", length: %12" PRIu64 ", checksum: ",
+				i + 1, type_name != NULL ? type_name : "unknown", section->type, (section->flags & HONAS_STATE_SECTION_FLAG_REQUIRED) ? ", required" : "",
+				section->offset, section->length);
+			if (section->flags & HONAS_STATE_SECTION_FLAG_CHECKSUM)
+				fprintf(out, "%08x\n", section->checksum);
+			else
+				fprintf(out, "none\n");
+		}
+	}
 
 	fprintf(out, "\n## Filter information ##\n\n");
-	uint32_t filter_size = state->header->number_of_bits_per_filter >> 3;
+	uint32_t filter_size = honas_state_stored_bits_per_filter(state) >> 3;
 	for (uint32_t i = 0; i < state->header->number_of_filters; i++) {
 		uint32_t bits_set = state->filter_bits_set[i];
 		uint32_t est_nr_host_names = bloom_approx_count(filter_size, state->header->number_of_hashes, bits_set);
 		fprintf(out, "%2u. Number of bits set: %10u (Estimated number of host names: %10u)\n", i + 1, bits_set, est_nr_host_names);
 
 		// Calculate and print the fill rate of the Bloom filter and its actual false positive rate.
-		const double fillrate = bloom_fill_rate(bits_set, state->header->number_of_bits_per_filter);
+		const double fillrate = bloom_fill_rate(bits_set, honas_state_stored_bits_per_filter(state));
 		fprintf(out, "    Fill Rate:        %.10f (False positive probability:   %.20f)\n"
 			, fillrate, bloom_actual_fpr(fillrate, state->header->number_of_hashes));
+
+		// For sealed states, print the compressed size of the Bloom filter.
+		if (state->sealed != NULL) {
+			uint64_t compressed_size = honas_sealed_state_filter_compressed_size(state->sealed, i);
+			fprintf(out, "    Compressed size:  %12" PRIu64 " (Compression ratio:           %.3f)\n"
+				, compressed_size, compressed_size ? (double)filter_size / compressed_size : INFINITY);
+		}
 	}
 	fprintf(out, "\n");
 }
@@ -112,6 +159,7 @@ static void show_usage(char* program_name, FILE* out)
 	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
 	fprintf(out, "  -v|--verbose        Be more verbose (can be used multiple times)\n");
 	fprintf(out, "  -p|--plotmode       Output timestamp and number of hostnames as CSV\n");
+	fprintf(out, "  -V|--verify         Verify the section checksums of the state file\n");
 }
 
 static const struct option long_options[] = {
@@ -119,6 +167,7 @@ static const struct option long_options[] = {
 	{ "quiet", no_argument, 0, 'q' },
 	{ "verbose", no_argument, 0, 'v' },
 	{ "plotmode", no_argument, 0, 'p' },
+	{ "verify", no_argument, 0, 'V' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -127,11 +176,12 @@ int main(int argc, char** argv)
 	char* program_name = "honas-info";
 	char* state_file = NULL;
 	bool plotmode = false;
+	bool verify = false;
 
 	/* Parse command line arguments */
 	while (1) {
 		int option_index = 0;
-		int c = getopt_long(argc, argv, "hvqp", long_options, &option_index);
+		int c = getopt_long(argc, argv, "hvqpV", long_options, &option_index);
 		if (c == -1)
 			break;
 		switch (c) {
@@ -159,6 +209,10 @@ int main(int argc, char** argv)
 			plotmode = true;
 			break;
 
+		case 'V':
+			verify = true;
+			break;
+
 		default:
 			fprintf(stderr, "Unimplemented option '%c'; Aborting!", c);
 			return 1;
@@ -179,11 +233,31 @@ int main(int argc, char** argv)
 
 	/* Load Honas state file */
 	honas_state_t state = { 0 };
-	if (honas_state_load(&state, state_file, true) == -1) {
+	switch (honas_state_load(&state, state_file, true)) {
+	case 0:
+		break;
+	case 1:
+		fprintf(stderr, "File '%s' is not a (supported) honas state file!\n", state_file);
+		return 1;
+	case 2:
+		fprintf(stderr, "State file '%s' is corrupt!\n", state_file);
+		return 1;
+	default:
 		fprintf(stderr, "Error while loading state file '%s': %s!\n", state_file, strerror(errno));
 		return 1;
 	}
 
+	/* Verify the section checksums */
+	if (verify) {
+		uint32_t mismatches = honas_state_verify_sections(&state);
+		if (mismatches > 0) {
+			fprintf(stderr, "State file '%s' has %u section(s) with a checksum mismatch!\n", state_file, mismatches);
+			honas_state_destroy(&state);
+			return 1;
+		}
+		log_msg(INFO, "All section checksums of state file '%s' are valid", state_file);
+	}
+
 	// Check if normal or plot mode was selected.
 	if (plotmode)
 	{
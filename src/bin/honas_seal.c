@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bloom.h"
+#include "defines.h"
+#include "honas_state.h"
+#include "includes.h"
+#include "logging.h"
+#include "sealed_state.h"
+#include "utils.h"
+
+static uint64_t get_monotonic_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static void show_compression_information(honas_state_t* state, uint64_t state_file_size, struct honas_sealed_state_write_stats* stats, FILE* out)
+{
+	uint64_t filter_size = honas_state_stored_bits_per_filter(state) >> 3;
+
+	fprintf(out, "\n## Compression information ##\n\n");
+	for (uint32_t i = 0; i < state->header->number_of_filters; i++) {
+		double fill_rate = (double)state->filter_bits_set[i] / (double)honas_state_stored_bits_per_filter(state);
+		uint64_t compressed_size = stats->filter_compressed_sizes[i];
+		fprintf(out, "%2u. Fill Rate: %.10f, Compressed size: %12" PRIu64 " of %12" PRIu64 " bytes (Ratio: %7.3f)\n",
+			i + 1, fill_rate, compressed_size, filter_size, compressed_size ? (double)filter_size / compressed_size : INFINITY);
+	}
+
+	fprintf(out, "\nBlocks per codec:");
+	for (int c = 0; c < BLOCK_CODEC_MAX; c++)
+		fprintf(out, " %s: %u", block_codec_name((enum block_codec)c), stats->codec_blocks[c]);
+	fprintf(out, "\nSummary size    : %12" PRIu64 " bytes\n", stats->summary_size);
+	fprintf(out, "State file size : %12" PRIu64 " bytes\n", state_file_size);
+	fprintf(out, "Sealed file size: %12" PRIu64 " bytes (Ratio: %.3f)\n", stats->file_size, (double)state_file_size / stats->file_size);
+}
+
+/* Compare the lookup latency of the original and the sealed state using random host name hashes */
+static void show_benchmark_information(honas_state_t* state, const char* sealed_state_file, uint32_t nr_lookups, FILE* out)
+{
+	honas_state_t sealed_state = { 0 };
+	log_passert(honas_state_load(&sealed_state, sealed_state_file, true) == 0, "Error while loading sealed state file '%s'", sealed_state_file);
+
+	uint8_t(*hashes)[32] = calloc(nr_lookups, 32);
+	log_passert(hashes != NULL, "Failed to allocate benchmark host name hashes");
+	srandom(nr_lookups);
+	for (uint32_t i = 0; i < nr_lookups; i++)
+		for (size_t j = 0; j < 32; j++)
+			hashes[i][j] = random();
+
+	uint64_t state_hits = 0, sealed_hits = 0;
+	uint64_t begin = get_monotonic_time_ns();
+	for (uint32_t i = 0; i < nr_lookups; i++)
+		state_hits += honas_state_check_host_name_lookups(state, byte_slice_from_array(hashes[i]), NULL);
+	uint64_t state_duration = get_monotonic_time_ns() - begin;
+
+	begin = get_monotonic_time_ns();
+	for (uint32_t i = 0; i < nr_lookups; i++)
+		sealed_hits += honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(hashes[i]), NULL);
+	uint64_t sealed_duration = get_monotonic_time_ns() - begin;
+
+	if (state_hits != sealed_hits)
+		log_die("Lookups in sealed state file '%s' differ from the original state file (%" PRIu64 " vs %" PRIu64 " hits)", sealed_state_file, sealed_hits, state_hits);
+
+	fprintf(out, "\n## Lookup latency (%u random lookups) ##\n\n", nr_lookups);
+	fprintf(out, "Uncompressed (mmap): %10.1f ns per lookup\n", (double)state_duration / nr_lookups);
+	fprintf(out, "Sealed             : %10.1f ns per lookup (Block cache hits: %" PRIu64 ", misses: %" PRIu64 ", in place bit checks: %" PRIu64 ")\n",
+		(double)sealed_duration / nr_lookups, sealed_state.sealed->cache_hits, sealed_state.sealed->cache_misses, sealed_state.sealed->block_probes);
+
+	free(hashes);
+	honas_state_destroy(&sealed_state);
+}
+
+static void show_usage(char* program_name, FILE* out)
+{
+	fprintf(out, "Usage: %s [<options>] <state-file> <sealed-state-file>\n\n", program_name);
+	fprintf(out, "Options:\n");
+	fprintf(out, "  -h|--help           Show this message\n");
+	fprintf(out, "  -b|--block-size <bytes>\n");
+	fprintf(out, "                      Uncompressed size of the filter blocks (default: %u)\n", DEFAULT_SEALED_STATE_BLOCK_SIZE);
+	fprintf(out, "                      (state files with shared blocks use their shared block\n");
+	fprintf(out, "                      size)\n");
+	fprintf(out, "  -c|--codec <codec>  Only use this codec for compressing blocks (default: use\n");
+	fprintf(out, "                      the best of all available codecs, except sparse, for\n");
+	fprintf(out, "                      each block)\n");
+	fprintf(out, "  -S|--summary-size <bytes>\n");
+	fprintf(out, "                      Add a summary of all filters of at most this size if\n");
+	fprintf(out, "                      the state file has none (see honas-search)\n");
+	fprintf(out, "  -B|--benchmark <lookups>\n");
+	fprintf(out, "                      Compare lookup latency of the sealed and original state\n");
+	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
+	fprintf(out, "  -v|--verbose        Be more verbose (can be used multiple times)\n");
+	fprintf(out, "\nAvailable codecs:");
+	for (int c = 0; c < BLOCK_CODEC_MAX; c++)
+		if (block_codec_available((enum block_codec)c))
+			fprintf(out, " %s", block_codec_name((enum block_codec)c));
+	fprintf(out, "\n");
+}
+
+static const struct option long_options[] = {
+	{ "help", no_argument, 0, 'h' },
+	{ "block-size", required_argument, 0, 'b' },
+	{ "codec", required_argument, 0, 'c' },
+	{ "summary-size", required_argument, 0, 'S' },
+	{ "benchmark", required_argument, 0, 'B' },
+	{ "quiet", no_argument, 0, 'q' },
+	{ "verbose", no_argument, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char** argv)
+{
+	char* program_name = "honas-seal";
+	char *state_file = NULL, *sealed_state_file = NULL;
+	uint32_t block_size = DEFAULT_SEALED_STATE_BLOCK_SIZE;
+	uint32_t codec_mask = DEFAULT_SEALED_STATE_CODEC_MASK;
+	uint32_t nr_benchmark_lookups = 0;
+	uint32_t summary_size = 0;
+	enum block_codec codec;
+
+	/* Parse command line arguments */
+	while (1) {
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "hb:c:S:B:qv", long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 0:
+			fprintf(stderr, "Unimplemented option %s; Aborting!", long_options[option_index].name);
+			return 1;
+
+		case 'h':
+			show_usage(program_name, stdout);
+			return 0;
+
+		case 'b':
+			if (!my_strtouint32(optarg, &block_size, NULL, 10) || block_size < 512 || (block_size & 0x7) != 0) {
+				fprintf(stderr, "Invalid value for 'block-size' (should be a multiple of 8 of at least 512): %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'c':
+			if (!block_codec_from_name(optarg, &codec) || !block_codec_available(codec)) {
+				fprintf(stderr, "Unknown or unavailable codec: %s!\n", optarg);
+				return 1;
+			}
+			codec_mask = 1U << codec;
+			break;
+
+		case 'S':
+			if (!my_strtouint32(optarg, &summary_size, NULL, 10)) {
+				fprintf(stderr, "Invalid value for 'summary-size': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'B':
+			if (!my_strtouint32(optarg, &nr_benchmark_lookups, NULL, 10) || nr_benchmark_lookups == 0) {
+				fprintf(stderr, "Invalid value for 'benchmark': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'q':
+			log_set_min_log_level(log_get_min_log_level() - 1);
+			break;
+
+		case 'v':
+			log_set_min_log_level(log_get_min_log_level() + 1);
+			break;
+
+		case '?':
+			show_usage(program_name, stderr);
+			return 1;
+
+		default:
+			fprintf(stderr, "Unimplemented option '%c'; Aborting!", c);
+			return 1;
+		}
+	}
+	if (argc - optind > 2) {
+		fprintf(stderr, "Unsupported argument(s) supplied: %s!\n", argv[optind + 2]);
+		show_usage(program_name, stderr);
+		return 1;
+	} else if (argc - optind < 2) {
+		fprintf(stderr, "Required '<state-file>' and '<sealed-state-file>' arguments missing!\n");
+		return 1;
+	} else {
+		state_file = argv[optind];
+		sealed_state_file = argv[optind + 1];
+	}
+
+	log_msg(INFO, "%s (version %s)", program_name, VERSION);
+
+	/* Load Honas state file */
+	honas_state_t state = { 0 };
+	if (honas_state_load(&state, state_file, true) != 0) {
+		fprintf(stderr, "Error while loading state file '%s': %s!\n", state_file, strerror(errno));
+		return 1;
+	}
+	if (state.sealed != NULL) {
+		fprintf(stderr, "State file '%s' is already sealed!\n", state_file);
+		honas_state_destroy(&state);
+		return 1;
+	}
+
+	/* Write the sealed state file */
+	state.summary_size = summary_size;
+	struct honas_sealed_state_write_stats stats = { 0 };
+	stats.filter_compressed_sizes = calloc(state.header->number_of_filters, sizeof(uint64_t));
+	log_passert(stats.filter_compressed_sizes != NULL, "Failed to allocate compression statistics");
+	if (honas_sealed_state_write(&state, sealed_state_file, block_size, codec_mask, &stats) == -1) {
+		fprintf(stderr, "Error while writing sealed state file '%s': %s!\n", sealed_state_file, strerror(errno));
+		free(stats.filter_compressed_sizes);
+		honas_state_destroy(&state);
+		return 1;
+	}
+	log_msg(INFO, "Sealed state file '%s' as '%s'", state_file, sealed_state_file);
+
+	show_compression_information(&state, state.size, &stats, stdout);
+	if (nr_benchmark_lookups > 0)
+		show_benchmark_information(&state, sealed_state_file, nr_benchmark_lookups, stdout);
+	fprintf(stdout, "\n");
+
+	/* Cleanup resources */
+	free(stats.filter_compressed_sizes);
+	honas_state_destroy(&state);
+	log_destroy();
+	return 0;
+}
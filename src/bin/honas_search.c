@@ -25,411 +25,154 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "bitset.h"
-#include "bloom.h"
 #include "defines.h"
 #include "honas_state.h"
 #include "includes.h"
-#include "json_printer.h"
 #include "logging.h"
+#include "search_job.h"
+#include "state_catalog.h"
+#include "subnet_activity.h"
 #include "utils.h"
 
-#include <yajl/yajl_parse.h>
+#include <sys/resource.h>
 
-#define READ_BLOCK_SIZE 65536
-#define SHA256_DIGEST_LENGTH 32
+/* Limits the size of the bit offsets of a host name in a compiled search job */
+#define MAX_COMPILED_BIT_OFFSETS 65536
 
-// Compute the fill rate of a Bloom filter, given s and m.
-static const double bloom_fill_rate(const uint32_t s, const uint32_t m)
-{
-        return (double)s / (double)m;
-}
-
-// Compute the actual false positive rate of a Bloom filter, given s, m and k.
-static const double bloom_actual_fpr(const double fr, const uint32_t k)
-{
-        return pow(fr, (double)k);
-}
-
-static bool _decode_nibble(char c, int* r)
-{
-	if (c >= '0' && c <= '9') {
-		*r = c - '0';
-	} else if (c >= 'A' && c <= 'F') {
-		*r = c - 'A' + 10;
-	} else if (c >= 'a' && c <= 'f') {
-		*r = c - 'a' + 10;
-	} else {
-		return false;
-	}
-	return true;
-}
-
-static bool decode_string_hex(const char* str, size_t strlen, uint8_t* dec, size_t declen)
-{
-	if (strlen != declen * 2)
-		return false;
-	int high, low;
-	for (size_t si = 0, di = 0; di < declen; si++, di++) {
-		if (!_decode_nibble(str[si], &high) || !_decode_nibble(str[++si], &low))
-			return false;
-		dec[di] = (high << 4) | low;
-	}
-	return true;
-}
+/* Size of the buffer used for writing the results */
+#define RESULT_BUFFER_SIZE (1 << 20)
 
-static char* get_version_string(uint32_t major_version, uint32_t minor_version)
+static uint64_t get_monotonic_time_ns(void)
 {
-	static char strbuf[22];
-	sprintf(strbuf, "%u.%u", major_version, minor_version);
-	return strbuf;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
 }
 
-static void add_general_information(honas_state_t* state, json_printer_t* printer)
+static int compare_search_state_periods(const void* a, const void* b)
 {
-	/* Gather and search versions */
-	json_printer_object_pair_string(printer, "node_version", VERSION);
-	json_printer_object_pair_string(printer, "state_file_version", get_version_string(state->header->major_version, state->header->minor_version));
-
-	/* Period information */
-	json_printer_object_pair_uint64(printer, "period_begin", state->header->period_begin);
-	json_printer_object_pair_uint64(printer, "first_request", state->header->first_request);
-	json_printer_object_pair_uint64(printer, "last_request", state->header->last_request);
-	json_printer_object_pair_uint64(printer, "period_end", state->header->period_end);
-	json_printer_object_pair_uint32(printer, "estimated_number_of_clients", state->header->estimated_number_of_clients);
-	json_printer_object_pair_uint32(printer, "estimated_number_of_host_names", state->header->estimated_number_of_host_names);
-	json_printer_object_pair_uint32(printer, "number_of_requests", state->header->number_of_requests);
-
-	/* Filter configuration */
-	json_printer_object_pair_uint32(printer, "number_of_filters", state->header->number_of_filters);
-	json_printer_object_pair_uint32(printer, "number_of_filters_per_user", state->header->number_of_filters_per_user);
-	json_printer_object_pair_uint32(printer, "number_of_hashes", state->header->number_of_hashes);
-	json_printer_object_pair_uint32(printer, "number_of_bits_per_filter", state->header->number_of_bits_per_filter);
-	json_printer_object_pair_uint32(printer, "flatten_threshold", state->header->flatten_threshold);
-
-	/* Filter information */
-	uint32_t filter_size = state->header->number_of_bits_per_filter >> 3;
-	json_printer_object_key(printer, "filters");
-	json_printer_array_begin(printer);
-	for (uint32_t i = 0; i < state->header->number_of_filters; i++) {
-		json_printer_object_begin(printer);
-		json_printer_object_pair_uint32(printer, "number_of_bits_set", state->filter_bits_set[i]);
-		json_printer_object_pair_uint32(printer, "estimated_number_of_host_names", bloom_approx_count(filter_size, state->header->number_of_hashes, state->filter_bits_set[i]));
-
-		// Calculate and print the actual false positive rate of this Bloom filter.
-		char fprstr[64];
-		const double act_fpr = bloom_actual_fpr(bloom_fill_rate(state->filter_bits_set[i], state->header->number_of_bits_per_filter), state->header->number_of_hashes);
-		snprintf(fprstr, sizeof(fprstr), "%.10f", act_fpr);
-		json_printer_object_pair_string(printer, "actual_false_positive_rate", fprstr);
-		json_printer_object_end(printer);
-	}
-	json_printer_array_end(printer);
+	uint64_t period_a = ((const struct search_job_state*)a)->state->header->period_begin;
+	uint64_t period_b = ((const struct search_job_state*)b)->state->header->period_begin;
+	return period_a < period_b ? -1 : period_a > period_b;
 }
 
-struct search_spec_context {
-	enum {
-		INIT,
-		SEARCH_SPEC,
-		SEARCH_SPEC_EXPECT_GROUPS_ARRAY,
-		GROUPS_ARRAY,
-		GROUP,
-		GROUP_EXPECT_ID,
-		GROUP_EXPECT_HOST_NAME_MAP,
-		HOST_NAME_MAP,
-		HOST_NAME_MAP_EXPECT_VALUE
-	} state;
-
-	honas_state_t* honas_state;
-	bool flatten_results;
-
-	json_printer_t printer;
-
-	uint64_t group_id;
-	bool group_has_results;
-	bool group_all_host_names_found;
-	bitset_t group_filters_hit;
-	bitset_t host_name_filters_hit;
-
-	char* host_name_key;
-	size_t host_name_key_alloc;
-	size_t host_name_key_len;
+/* The coarse state files of the catalog entries within the time range, that are
+ * searched first when drilling down */
+struct drill_down {
+	const honas_catalog_t* catalog;
+	uint64_t period_begin;
+	uint64_t period_end;
+	size_t first;                           ///< Index of the first catalog entry within the time range
+	size_t nr_entries;                      ///< Number of catalog entries within the time range
+	honas_state_t* states;                  ///< The coarse state of each catalog entry within the time range
+	struct search_job_state* search_states;
+	int8_t* loaded;                         ///< Whether the coarse state of each entry is loaded (-1 if not tried yet)
+	size_t nr_loaded;
+	bool prefetch;                          ///< Whether the filter pages of the coarse states are prefetched
 };
 
-static int search_spec_integer(struct search_spec_context* ctx, long long integerVal)
-{
-	switch (ctx->state) {
-	case GROUP_EXPECT_ID:
-		ctx->group_id = integerVal;
-		ctx->state = GROUP;
-		return 1;
-
-	default:
-		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
-		return 0;
-	}
-}
-
-static int search_spec_string(struct search_spec_context* ctx, const unsigned char* stringVal, size_t stringLen)
+/* Load the coarse state covering the period of a catalog entry, and the coarse states covering that
+ * one; coarse states that can't be loaded are skipped. Returns NULL if there is no such coarse state. */
+static const struct search_job_state* drill_down_covering_state(struct drill_down* dd, const struct honas_catalog_entry* entry)
 {
-	switch (ctx->state) {
-	case HOST_NAME_MAP_EXPECT_VALUE:
-		ctx->state = HOST_NAME_MAP;
-		{ /* Process hostname */
-			uint8_t bytes[stringLen/2];
-			char debug_msg[1024];
-			strncpy(debug_msg, (char*)stringVal, stringLen);
-			log_msg(DEBUG, "Decoding hex hostname hash '%s', of length: %zu", debug_msg, stringLen);
-			if (!decode_string_hex((char*)stringVal, stringLen, bytes, sizeof(bytes))) {
-				log_msg(WARN, "Unable to hex decode hostname hash '%s'", stringVal);
-				return 1;
+	const struct honas_catalog_entry* covering = entry;
+	while ((covering = honas_state_catalog_covering_entry(dd->catalog, dd->period_begin, dd->period_end, covering)) != NULL) {
+		size_t i = covering - &dd->catalog->entries[dd->first];
+		if (dd->loaded[i] < 0) {
+			char path[PATH_MAX];
+			honas_state_t* state = &dd->states[i];
+			dd->loaded[i] = 0;
+			if (!honas_state_catalog_entry_path(dd->catalog, covering, path, sizeof(path))) {
+				log_msg(WARNING, "Path of cataloged state file '%s' is too long", dd->catalog->paths + covering->path_offset);
+				continue;
 			}
-
-			/* Determine if and where to put possible filters hit information */
-			bitset_t *filters_hit;
-			if (!ctx->group_all_host_names_found) {
-				filters_hit = NULL;
-			} else if (ctx->group_has_results) {
-				bitset_clear(&ctx->host_name_filters_hit);
-				filters_hit = &ctx->host_name_filters_hit;
-			} else {
-				bitset_clear(&ctx->group_filters_hit);
-				filters_hit = &ctx->group_filters_hit;
+			if (honas_state_load(state, path, true) != 0) {
+				log_msg(WARNING, "Unable to load coarse state file '%s'; not drilling down from it", path);
+				continue;
 			}
-
-			uint32_t hits = honas_state_check_host_name_lookups(ctx->honas_state, byte_slice_from_array(bytes), filters_hit);
-			if (ctx->flatten_results)
-				hits = hits < ctx->honas_state->header->number_of_filters_per_user ? 0 : 1;
-
-			if (hits > 0) {
-				if (!ctx->group_has_results) {
-					/* First group results starts the group result output */
-					json_printer_object_begin(&ctx->printer);
-					json_printer_object_key(&ctx->printer, "hostnames");
-					json_printer_object_begin(&ctx->printer);
-					ctx->group_has_results = true;
-				} else if (ctx->group_all_host_names_found) {
-					bitset_bitwise_and(&ctx->group_filters_hit, filters_hit);
-				}
-
-				json_printer_object_pair_uint32(&ctx->printer, ctx->host_name_key, hits);
-			} else {
-				ctx->group_all_host_names_found = false;
+			if (state->header->period_begin != covering->period_begin || state->header->period_end != covering->period_end) {
+				log_msg(WARNING, "Coarse state file '%s' changed since it was cataloged; not drilling down from it", path);
+				honas_state_destroy(state);
+				continue;
 			}
+			log_msg(DEBUG, "Drilling down from coarse state file '%s'", path);
+			dd->search_states[i].state = state;
+			dd->search_states[i].prefetch = dd->prefetch;
+			dd->search_states[i].covered_by = drill_down_covering_state(dd, covering);
+			dd->loaded[i] = 1;
+			dd->nr_loaded++;
 		}
-		return 1;
-
-	default:
-		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
-		return 0;
-	}
-}
-
-static int search_spec_map_key(struct search_spec_context* ctx, const unsigned char* stringVal, size_t stringLen)
-{
-	switch (ctx->state) {
-	case SEARCH_SPEC:
-		if (stringLen == 6 && memcmp(stringVal, "groups", 6) == 0)
-			ctx->state = SEARCH_SPEC_EXPECT_GROUPS_ARRAY;
-		else
-			log_msg(INFO, "Ignoring unknown key '%s' in root", stringVal);
-		return 1;
-
-	case GROUP:
-		if (stringLen == 2 && memcmp(stringVal, "id", 2) == 0)
-			ctx->state = GROUP_EXPECT_ID;
-		else if (stringLen == 9 && memcmp(stringVal, "hostnames", 9) == 0)
-			ctx->state = GROUP_EXPECT_HOST_NAME_MAP;
-		else
-			log_msg(INFO, "Ignoring unknown key '%s' in group", stringVal);
-		return 1;
-
-	case HOST_NAME_MAP:
-		if (stringLen + 1 > ctx->host_name_key_alloc) {
-			/* Reallocate memory to double the needed length */
-			ctx->host_name_key_alloc = (stringLen + 1) * 2;
-			ctx->host_name_key = realloc(ctx->host_name_key, ctx->host_name_key_alloc);
-		}
-
-		/* Remember the host name key for now */
-		memcpy(ctx->host_name_key, stringVal, stringLen);
-		ctx->host_name_key_len = stringLen;
-		ctx->host_name_key[stringLen] = 0;
-
-		ctx->state = HOST_NAME_MAP_EXPECT_VALUE;
-		return 1;
-
-	default:
-		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
-		return 0;
-	}
-}
-
-static int search_spec_start_map(struct search_spec_context* ctx)
-{
-	switch (ctx->state) {
-	case INIT:
-		json_printer_object_begin(&ctx->printer);
-		add_general_information(ctx->honas_state, &ctx->printer);
-
-		ctx->state = SEARCH_SPEC;
-		return 1;
-
-	case GROUPS_ARRAY:
-		/* Reset group info; But only generate output if there are host name hits */
-		ctx->group_id = 0;
-		ctx->group_has_results = false;
-		ctx->group_all_host_names_found = true;
-
-		ctx->state = GROUP;
-		return 1;
-
-	case GROUP_EXPECT_HOST_NAME_MAP:
-		ctx->state = HOST_NAME_MAP;
-		return 1;
-
-	default:
-		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
-		return 0;
-	}
-}
-
-static int search_spec_end_map(struct search_spec_context* ctx)
-{
-	switch (ctx->state) {
-	case SEARCH_SPEC:
-		json_printer_object_end(&ctx->printer);
-		ctx->state = INIT;
-		return 1;
-
-	case GROUP:
-		/* Check if group had host name hits */
-		if (ctx->group_has_results) {
-			json_printer_object_end(&ctx->printer);
-			json_printer_object_pair_uint64(&ctx->printer, "id", ctx->group_id);
-			uint32_t hits = bitset_popcount(&ctx->group_filters_hit);
-			if (ctx->flatten_results)
-				hits = hits < ctx->honas_state->header->number_of_filters_per_user ? 0 : 1;
-			json_printer_object_pair_uint32(&ctx->printer, "hits_by_all_hostnames", ctx->group_all_host_names_found ? hits : 0);
-			json_printer_object_end(&ctx->printer);
-		}
-
-		ctx->state = GROUPS_ARRAY;
-		return 1;
-
-	case HOST_NAME_MAP:
-		ctx->state = GROUP;
-		return 1;
-
-	default:
-		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
-		return 0;
-	}
-}
-
-static int search_spec_start_array(struct search_spec_context* ctx)
-{
-	switch (ctx->state) {
-	case SEARCH_SPEC_EXPECT_GROUPS_ARRAY:
-		json_printer_object_pair_boolean(&ctx->printer, "flattened_results", ctx->flatten_results);
-		json_printer_object_key(&ctx->printer, "groups");
-		json_printer_array_begin(&ctx->printer);
-		ctx->state = GROUPS_ARRAY;
-		return 1;
-
-	default:
-		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
-		return 0;
+		if (dd->loaded[i] > 0)
+			return &dd->search_states[i];
 	}
+	return NULL;
 }
 
-static int search_spec_end_array(struct search_spec_context* ctx)
+/* Parse a state geometry: "<bits-per-filter>,<hashes>,<filters>[,<shared-block-size>]" */
+static bool parse_geometry(const char* str, uint32_t* number_of_bits_per_filter, uint32_t* number_of_hashes, uint32_t* number_of_filters, uint32_t* shared_block_size)
 {
-	switch (ctx->state) {
-	case GROUPS_ARRAY:
-		json_printer_array_end(&ctx->printer);
-		ctx->state = SEARCH_SPEC;
-		return 1;
-
-	default:
-		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
-		return 0;
-	}
-}
-
-static yajl_callbacks search_spec_json_callbacks = {
-	NULL,
-	NULL,
-	(int (*)(void* ctx, long long int v))search_spec_integer,
-	NULL,
-	NULL,
-	(int (*)(void* ctx, const unsigned char* s, size_t l))search_spec_string,
-	(int (*)(void* ctx))search_spec_start_map,
-	(int (*)(void* ctx, const unsigned char* s, size_t l))search_spec_map_key,
-	(int (*)(void* ctx))search_spec_end_map,
-	(int (*)(void* ctx))search_spec_start_array,
-	(int (*)(void* ctx))search_spec_end_array
-};
-
-static void perform_search_job(honas_state_t* honas_state, uint32_t flatten_threshold, FILE* job_fh, FILE* result_fh)
-{
-	struct search_spec_context ctx = {
-		.state = INIT,
-		.honas_state = honas_state,
-		.flatten_results = honas_state->header->estimated_number_of_host_names < flatten_threshold,
-		.host_name_key = NULL,
-		.host_name_key_alloc = 0,
-	};
-	bitset_create(&ctx.group_filters_hit, honas_state->header->number_of_filters);
-	bitset_create(&ctx.host_name_filters_hit, honas_state->header->number_of_filters);
-	json_printer_begin(&ctx.printer, result_fh);
-
-	yajl_handle yajl = yajl_alloc(&search_spec_json_callbacks, NULL, &ctx);
-	log_passert(yajl != NULL, "Failed to initialize yajl parser");
-
-	yajl_status status = yajl_status_ok;
-	uint8_t buf[READ_BLOCK_SIZE + 1];
-	ssize_t rd;
-	while (1) {
-		rd = fread(buf, 1, READ_BLOCK_SIZE, job_fh);
-		if (rd == 0) {
-			if (feof(job_fh))
-				break;
-			log_pfail("Error reading search job spec");
-		}
-
-		buf[rd] = 0;
-		status = yajl_parse(yajl, buf, rd);
-		if (status != yajl_status_ok)
-			break;
-	}
-	if (status == yajl_status_ok)
-		status = yajl_complete_parse(yajl);
-
-	if (status != yajl_status_ok) {
-		unsigned char* str = yajl_get_error(yajl, 1, buf, rd);
-		log_msg(CRIT, "Error parsing search spec: %s", str);
-		yajl_free_error(yajl, str);
-		exit(1);
-	}
-
-	bitset_destroy(&ctx.group_filters_hit);
-	bitset_destroy(&ctx.host_name_filters_hit);
-	json_printer_end(&ctx.printer);
-	yajl_free(yajl);
-	if (ctx.host_name_key != NULL)
-		free(ctx.host_name_key);
+	char* endptr;
+	*shared_block_size = 0;
+	return my_strtouint32(str, number_of_bits_per_filter, &endptr, 10) && *endptr++ == ','
+		&& my_strtouint32(endptr, number_of_hashes, &endptr, 10) && *endptr++ == ','
+		&& my_strtouint32(endptr, number_of_filters, &endptr, 10)
+		&& (*endptr == '\0' || (*endptr++ == ',' && my_strtouint32(endptr, shared_block_size, &endptr, 10) && *endptr == '\0'
+			&& *shared_block_size >= HONAS_STATE_MIN_SHARED_BLOCK_SIZE && (*shared_block_size & (*shared_block_size - 1)) == 0
+			&& (*number_of_bits_per_filter >> 3) % *shared_block_size == 0))
+		&& *number_of_bits_per_filter > 0 && (*number_of_bits_per_filter & 0x7) == 0
+		&& *number_of_hashes > 0 && *number_of_filters > 0
+		&& (uint64_t)*number_of_hashes * *number_of_filters <= MAX_COMPILED_BIT_OFFSETS;
 }
 
 static void show_usage(char* program_name, FILE* out)
 {
-	fprintf(out, "Usage: %s [<options>] <state-file>\n\n", program_name);
+	fprintf(out, "Usage: %s [<options>] <state-file>...\n", program_name);
+	fprintf(out, "       %s [<options>] --catalog <directory> [<state-file>...]\n", program_name);
+	fprintf(out, "       %s [<options>] --compile <file> (--geometry <m>,<k>,<filters>[,<block-size>] | <state-file>)\n", program_name);
+	fprintf(out, "       %s [<options>] --convert <file>\n\n", program_name);
 	fprintf(out, "Options:\n");
 	fprintf(out, "  -h|--help           Show this message\n");
-	fprintf(out, "  -j|--job <file>     File containing the search job (default: stdin)\n");
+	fprintf(out, "  -j|--job <file>     File containing the JSON, binary or compiled search job\n");
+	fprintf(out, "                      (default: stdin)\n");
+	fprintf(out, "  -C|--compiled <file>\n");
+	fprintf(out, "                      File containing the compiled search job (like --job, but\n");
+	fprintf(out, "                      refusing anything but a compiled search job)\n");
+	fprintf(out, "  -x|--convert <file> Convert the search job to a binary search job file instead\n");
+	fprintf(out, "                      of searching\n");
+	fprintf(out, "  -c|--compile <file> Compile the search job to this file instead of searching\n");
+	fprintf(out, "  -g|--geometry <m>,<k>,<filters>[,<block-size>]\n");
+	fprintf(out, "                      Compile for states with this number of bits per filter,\n");
+	fprintf(out, "                      hashes and filters, optionally with shared blocks\n");
+	fprintf(out, "                      (default: that of the state file)\n");
 	fprintf(out, "  -r|--result <file>  File to which the results will be saved (default: stdout)\n");
+	fprintf(out, "  -o|--output-format (json|csv|binary)\n");
+	fprintf(out, "                      Format of the results (default: json)\n");
+	fprintf(out, "  -E|--entities <subnet-activity-file>\n");
+	fprintf(out, "                      Also search the plaintext host names for each entity\n");
+	fprintf(out, "                      of this subnet activity file\n");
+	fprintf(out, "  -a|--catalog <directory>\n");
+	fprintf(out, "                      Also search the state files selected from the catalog of this\n");
+	fprintf(out, "                      directory (see honas-catalog) for the requested periods\n");
+	fprintf(out, "  -D|--drill-down     Search the coarser (daily) state files of the catalog first, and\n");
+	fprintf(out, "                      only search the finer (hourly) ones for the host names found in\n");
+	fprintf(out, "                      the coarser state file covering them\n");
+	fprintf(out, "  -P|--probe-cache    Use and update the probe result cache of each state file\n");
+	fprintf(out, "                      (<state-file>%s)\n", PROBE_CACHE_FILE_SUFFIX);
+	fprintf(out, "  -R|--no-read-ahead  Don't read ahead around the filter pages being checked in state\n");
+	fprintf(out, "                      files with a summary (for search jobs with mostly host names\n");
+	fprintf(out, "                      that weren't looked up)\n");
+	fprintf(out, "  -F|--prefetch       Prefetch the filter pages of a number of host names at a time,\n");
+	fprintf(out, "                      before checking them (for state files that aren't cached)\n");
 	fprintf(out, "  -f|--flatten-threshold <clients>\n");
 	fprintf(out, "                      If fewer than this amount of clients have been seen then\n");
 	fprintf(out, "                      flatten the results (default: never flatten)\n");
+	fprintf(out, "  -b|--begin <timestamp>\n");
+	fprintf(out, "                      Skip state files with a period beginning before this time\n");
+	fprintf(out, "  -e|--end <timestamp>\n");
+	fprintf(out, "                      Skip state files with a period beginning at or after this time\n");
+	fprintf(out, "  -t|--threads <count>\n");
+	fprintf(out, "                      Number of threads used for checking the host names\n");
+	fprintf(out, "                      (default: number of online CPUs)\n");
 	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
 	fprintf(out, "  -s|--syslog         Log messages to syslog\n");
 	fprintf(out, "  -v|--verbose        Be more verbose (can be used multiple times)\n");
@@ -438,8 +181,22 @@ static void show_usage(char* program_name, FILE* out)
 static const struct option long_options[] = {
 	{ "help", no_argument, 0, 'h' },
 	{ "job", required_argument, 0, 'j' },
+	{ "compiled", required_argument, 0, 'C' },
+	{ "convert", required_argument, 0, 'x' },
+	{ "compile", required_argument, 0, 'c' },
+	{ "geometry", required_argument, 0, 'g' },
 	{ "result", required_argument, 0, 'r' },
+	{ "output-format", required_argument, 0, 'o' },
+	{ "entities", required_argument, 0, 'E' },
+	{ "catalog", required_argument, 0, 'a' },
+	{ "drill-down", no_argument, 0, 'D' },
+	{ "probe-cache", no_argument, 0, 'P' },
+	{ "no-read-ahead", no_argument, 0, 'R' },
+	{ "prefetch", no_argument, 0, 'F' },
 	{ "flatten-threshold", required_argument, 0, 'f' },
+	{ "begin", required_argument, 0, 'b' },
+	{ "end", required_argument, 0, 'e' },
+	{ "threads", required_argument, 0, 't' },
 	{ "quiet", no_argument, 0, 'q' },
 	{ "syslog", no_argument, 0, 's' },
 	{ "verbose", no_argument, 0, 'v' },
@@ -449,13 +206,20 @@ static const struct option long_options[] = {
 int main(int argc, char** argv)
 {
 	char* program_name = "honas-search";
-	char *state_file = NULL, *job_file = NULL, *result_file = NULL;
+	char *job_file = NULL, *compiled_file = NULL, *result_file = NULL, *convert_file = NULL, *compile_file = NULL, *entities_file = NULL, *catalog_directory = NULL;
+	enum search_result_format result_format = SEARCH_RESULT_FORMAT_JSON;
+	uint32_t number_of_bits_per_filter = 0, number_of_hashes = 0, number_of_filters = 0;
+	uint32_t shared_block_size = 0;
 	uint32_t flatten_threshold = 0;
+	bool use_probe_caches = false, drill_down = false, no_read_ahead = false, prefetch = false;
+	uint64_t period_begin = 0, period_end = UINT64_MAX;
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char* endptr;
 
 	/* Parse command line arguments */
 	while (1) {
 		int option_index = 0;
-		int c = getopt_long(argc, argv, "hj:r:f:", long_options, &option_index);
+		int c = getopt_long(argc, argv, "hj:C:x:c:g:r:o:E:a:DPRFf:b:e:t:qsv", long_options, &option_index);
 		if (c == -1)
 			break;
 		switch (c) {
@@ -471,10 +235,66 @@ int main(int argc, char** argv)
 			job_file = optarg;
 			break;
 
+		case 'C':
+			compiled_file = optarg;
+			break;
+
+		case 'x':
+			convert_file = optarg;
+			break;
+
+		case 'c':
+			compile_file = optarg;
+			break;
+
+		case 'g':
+			if (!parse_geometry(optarg, &number_of_bits_per_filter, &number_of_hashes, &number_of_filters, &shared_block_size)) {
+				fprintf(stderr, "Invalid value for 'geometry': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
 		case 'r':
 			result_file = optarg;
 			break;
 
+		case 'o':
+			if (strcmp(optarg, "json") == 0) {
+				result_format = SEARCH_RESULT_FORMAT_JSON;
+			} else if (strcmp(optarg, "csv") == 0) {
+				result_format = SEARCH_RESULT_FORMAT_CSV;
+			} else if (strcmp(optarg, "binary") == 0) {
+				result_format = SEARCH_RESULT_FORMAT_BINARY;
+			} else {
+				fprintf(stderr, "Invalid value for 'output-format': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'E':
+			entities_file = optarg;
+			break;
+
+		case 'a':
+			catalog_directory = optarg;
+			break;
+
+		case 'D':
+			drill_down = true;
+			break;
+
+		case 'P':
+			use_probe_caches = true;
+			break;
+
+		case 'R':
+			no_read_ahead = true;
+			break;
+
+		case 'F':
+			prefetch = true;
+			break;
+
 		case 'f':
 			if (!my_strtouint32(optarg, &flatten_threshold, NULL, 10)) {
 				fprintf(stderr, "Invalid value for 'flatten-threshold': %s!\n", optarg);
@@ -482,6 +302,28 @@ int main(int argc, char** argv)
 			}
 			break;
 
+		case 'b':
+			if (!my_strtouint64(optarg, &period_begin, NULL, 10)) {
+				fprintf(stderr, "Invalid value for 'begin': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'e':
+			if (!my_strtouint64(optarg, &period_end, NULL, 10)) {
+				fprintf(stderr, "Invalid value for 'end': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 't':
+			nr_threads = strtol(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || nr_threads < 1 || nr_threads > 1024) {
+				fprintf(stderr, "Invalid number of threads '%s'!\n", optarg);
+				return 1;
+			}
+			break;
+
 		case 'q':
 			log_set_min_log_level(log_get_min_log_level() - 1);
 			break;
@@ -503,15 +345,37 @@ int main(int argc, char** argv)
 			return 1;
 		}
 	}
-	if (optind < argc - 1) {
-		fprintf(stderr, "Unsupported argument(s) supplied: %s!\n", argv[optind]);
-		show_usage(program_name, stderr);
-		return 1;
-	} else if (optind == argc) {
+	if (optind == argc && catalog_directory == NULL && convert_file == NULL && (compile_file == NULL || number_of_filters == 0)) {
 		fprintf(stderr, "Required '<state-file>' argument missing!\n");
 		return 1;
-	} else {
-		state_file = argv[optind];
+	}
+	if (compiled_file != NULL && job_file != NULL) {
+		fprintf(stderr, "Can't both use a search job and a compiled search job!\n");
+		return 1;
+	}
+	if (compiled_file != NULL && (compile_file != NULL || convert_file != NULL)) {
+		fprintf(stderr, "Can't compile or convert an already compiled search job!\n");
+		return 1;
+	}
+	if (compile_file != NULL && convert_file != NULL) {
+		fprintf(stderr, "Can't both compile and convert the search job!\n");
+		return 1;
+	}
+	if (entities_file != NULL && (compile_file != NULL || convert_file != NULL)) {
+		fprintf(stderr, "Entities can only be used when searching!\n");
+		return 1;
+	}
+	if (use_probe_caches && (compile_file != NULL || convert_file != NULL)) {
+		fprintf(stderr, "Probe caches can only be used when searching!\n");
+		return 1;
+	}
+	if (catalog_directory != NULL && (compile_file != NULL || convert_file != NULL)) {
+		fprintf(stderr, "A catalog can only be used when searching!\n");
+		return 1;
+	}
+	if (drill_down && catalog_directory == NULL) {
+		fprintf(stderr, "Drilling down requires a catalog!\n");
+		return 1;
 	}
 
 	log_msg(INFO, "%s (version %s)", program_name, VERSION);
@@ -521,11 +385,182 @@ int main(int argc, char** argv)
 	if (job_file != NULL) {
 		job_fh = fopen(job_file, "r");
 		log_passert(job_fh != NULL, "Unable to open search job file '%s'", job_file);
+	} else if (compiled_file != NULL) {
+		/* The kind of search job is recognized when it's read, so only check that it's a compiled one */
+		char magic[sizeof(COMPILED_SEARCH_JOB_FILE_MAGIC) - 1];
+		job_fh = fopen(compiled_file, "r");
+		log_passert(job_fh != NULL, "Unable to open compiled search job file '%s'", compiled_file);
+		if (fread(magic, sizeof(magic), 1, job_fh) != 1 || memcmp(magic, COMPILED_SEARCH_JOB_FILE_MAGIC, sizeof(magic)) != 0)
+			log_die("File '%s' is not a compiled search job", compiled_file);
+		rewind(job_fh);
+	}
+
+	/* Convert the search job to a binary one */
+	if (convert_file != NULL) {
+		FILE* binary_fh = fopen(convert_file, "w");
+		log_passert(binary_fh != NULL, "Unable to open binary search job file '%s'", convert_file);
+		int err = search_job_convert(job_fh, binary_fh);
+		log_passert(fclose(binary_fh) == 0, "Failed to close binary search job file");
+		log_passert(fclose(job_fh) == 0, "Failed to close job file");
+		if (err == -1) {
+			unlink(convert_file);
+			return 1;
+		}
+		log_destroy();
+		return 0;
+	}
+
+	/* Compile the search job for the geometry of the state file, unless one was given explicitly */
+	if (compile_file != NULL) {
+		if (number_of_filters == 0) {
+			honas_state_t state = { 0 };
+			log_passert(honas_state_load(&state, argv[optind], true) != -1, "Error while loading state file '%s'", argv[optind]);
+			if (state.header == NULL)
+				log_die("State file '%s' is not a valid honas state file", argv[optind]);
+			number_of_bits_per_filter = state.header->number_of_bits_per_filter;
+			number_of_hashes = state.header->number_of_hashes;
+			number_of_filters = state.header->number_of_filters;
+			shared_block_size = state.shared_block_size;
+			honas_state_destroy(&state);
+		}
+		FILE* compiled_fh = fopen(compile_file, "w");
+		log_passert(compiled_fh != NULL, "Unable to open compiled search job file '%s'", compile_file);
+		int err = search_job_compile(number_of_filters, number_of_bits_per_filter, number_of_hashes, shared_block_size, job_fh, compiled_fh);
+		log_passert(fclose(compiled_fh) == 0, "Failed to close compiled search job file");
+		log_passert(fclose(job_fh) == 0, "Failed to close job file");
+		if (err == -1) {
+			unlink(compile_file);
+			return 1;
+		}
+		log_destroy();
+		return 0;
+	}
+
+	/* Select the state files of the requested periods from the catalog, without opening the others */
+	size_t nr_state_files = 0;
+	char** state_files = NULL;
+	const struct search_job_state** state_files_covered_by = NULL;
+	struct drill_down dd = { 0 };
+	if (catalog_directory != NULL) {
+		honas_catalog_t catalog;
+		int result = honas_state_catalog_open(&catalog, catalog_directory);
+		log_passert(result != -1, "Unable to open the catalog of '%s'", catalog_directory);
+		if (result != 0)
+			log_die("The catalog of '%s' is %s", catalog_directory, result == 1 ? "not a catalog file" : "corrupt");
+		size_t first;
+		size_t nr_entries = honas_state_catalog_find(&catalog, period_begin, period_end, &first);
+		const struct honas_catalog_entry** entries = calloc(nr_entries + 1, sizeof(struct honas_catalog_entry*));
+		state_files = calloc(nr_entries + argc - optind + 1, sizeof(char*));
+		state_files_covered_by = calloc(nr_entries + argc - optind + 1, sizeof(struct search_job_state*));
+		log_passert(entries != NULL && state_files != NULL && state_files_covered_by != NULL, "Failed to allocate catalog entries");
+
+		/* When drilling down the finest state files are searched only for the host names found in the coarser ones covering them */
+		if (drill_down) {
+			dd.catalog = &catalog;
+			dd.period_begin = period_begin;
+			dd.period_end = period_end;
+			dd.first = first;
+			dd.nr_entries = nr_entries;
+			dd.prefetch = prefetch;
+			dd.states = calloc(nr_entries + 1, sizeof(honas_state_t));
+			dd.search_states = calloc(nr_entries + 1, sizeof(struct search_job_state));
+			dd.loaded = malloc(nr_entries + 1);
+			log_passert(dd.states != NULL && dd.search_states != NULL && dd.loaded != NULL, "Failed to allocate coarse states");
+			memset(dd.loaded, -1, nr_entries + 1);
+		}
+		nr_entries = honas_state_catalog_select(&catalog, period_begin, period_end, entries);
+		for (size_t i = 0; i < nr_entries; i++) {
+			char path[PATH_MAX];
+			if (!honas_state_catalog_entry_path(&catalog, entries[i], path, sizeof(path)))
+				log_die("Path of cataloged state file '%s' is too long", catalog.paths + entries[i]->path_offset);
+			state_files[nr_state_files] = strdup(path);
+			log_passert(state_files[nr_state_files] != NULL, "Failed to allocate state file path");
+			if (drill_down)
+				state_files_covered_by[nr_state_files] = drill_down_covering_state(&dd, entries[i]);
+			nr_state_files++;
+		}
+		log_msg(INFO, "Selected %zu of the %" PRIu64 " cataloged state files", nr_entries, catalog.header->number_of_entries);
+		if (drill_down)
+			log_msg(INFO, "Drilling down from %zu coarse state files", dd.nr_loaded);
+		dd.catalog = NULL;
+		free(entries);
+		honas_state_catalog_close(&catalog);
+	} else {
+		state_files = calloc(argc - optind, sizeof(char*));
+		state_files_covered_by = calloc(argc - optind, sizeof(struct search_job_state*));
+		log_passert(state_files != NULL && state_files_covered_by != NULL, "Failed to allocate state file paths");
+	}
+	size_t nr_cataloged_state_files = nr_state_files;
+	for (int i = optind; i < argc; i++) {
+		state_files[nr_state_files] = strdup(argv[i]);
+		log_passert(state_files[nr_state_files] != NULL, "Failed to allocate state file path");
+		nr_state_files++;
+	}
+	if (nr_state_files == 0)
+		log_die("None of the cataloged state files are within the requested periods");
+
+	/* Load Honas state files; skipping those outside of the requested periods */
+	honas_state_t* states = calloc(nr_state_files, sizeof(honas_state_t));
+	struct search_job_state* search_states = calloc(nr_state_files, sizeof(struct search_job_state));
+	log_passert(states != NULL && search_states != NULL, "Failed to allocate search states");
+	size_t nr_states = 0;
+	for (size_t i = 0; i < nr_state_files; i++) {
+		honas_state_t* state = &states[nr_states];
+		int result = honas_state_load(state, state_files[i], true);
+		if (result == -1 && errno == ENOENT && i < nr_cataloged_state_files) {
+			/* The catalog may be slightly behind on state files being removed */
+			log_msg(WARNING, "Skipping cataloged state file '%s' that no longer exists", state_files[i]);
+			continue;
+		}
+		log_passert(result != -1, "Error while loading state file '%s'", state_files[i]);
+		if (state->header == NULL)
+			log_die("State file '%s' is not a valid honas state file", state_files[i]);
+		if (state->header->period_begin < period_begin || state->header->period_begin >= period_end) {
+			log_msg(DEBUG, "Skipping state file '%s' outside of the requested periods", state_files[i]);
+			honas_state_destroy(state);
+			continue;
+		}
+		search_states[nr_states].state = state;
+		search_states[nr_states].flatten_results = state->header->estimated_number_of_host_names < flatten_threshold;
+		search_states[nr_states].prefetch = prefetch;
+		if (no_read_ahead && honas_state_advise_random_access(state) == -1)
+			log_perror(WARNING, "Unable to advise the kernel not to read ahead in state file '%s'", state_files[i]);
+		if (use_probe_caches && (search_states[nr_states].probe_cache = probe_cache_open(state_files[i], state)) == NULL)
+			log_perror(WARNING, "Unable to use a probe cache for state file '%s'", state_files[i]);
+
+		/* The coarse state has to cover the period of the state file as it is now */
+		const struct search_job_state* covered_by = state_files_covered_by[i];
+		if (covered_by != NULL && covered_by->state->header->period_begin <= state->header->period_begin && state->header->period_end <= covered_by->state->header->period_end)
+			search_states[nr_states].covered_by = covered_by;
+		nr_states++;
+	}
+	for (size_t i = 0; i < nr_state_files; i++)
+		free(state_files[i]);
+	free(state_files);
+	free(state_files_covered_by);
+	if (nr_states == 0)
+		log_die("None of the state files are within the requested periods");
+
+	/* Order the states by period; each period can only be searched once */
+	qsort(search_states, nr_states, sizeof(struct search_job_state), compare_search_state_periods);
+	for (size_t s = 1; s < nr_states; s++) {
+		if (search_states[s].state->header->period_begin == search_states[s - 1].state->header->period_begin)
+			log_die("Multiple state files for the period beginning at %" PRIu64, search_states[s].state->header->period_begin);
 	}
 
-	/* Load Honas state file */
-	honas_state_t state = { 0 };
-	log_passert(honas_state_load(&state, state_file, true) != -1, "Error while loading state file '%s'", state_file);
+	/* Load the entities of the subnet activity file; lookups by other clients are registered as unknown entity */
+	struct subnet_activity subnet_activity;
+	struct search_job_entities entities = { NULL, 0 };
+	if (entities_file != NULL) {
+		enum subnet_activity_error err = subnet_activity_initialize(entities_file, &subnet_activity);
+		if (err != SA_OK)
+			log_die("Unable to load subnet activity file '%s' (error %d)", entities_file, err);
+		entities.names = calloc(subnet_activity.registered_entities + 1, sizeof(char*));
+		log_passert(entities.names != NULL, "Failed to allocate entity names");
+		for (size_t e = 0; e < subnet_activity.registered_entities; e++)
+			entities.names[entities.nr_names++] = subnet_activity.entities[e]->name;
+		entities.names[entities.nr_names++] = HONAS_STATE_UNKNOWN_ENTITY;
+	}
 
 	/* Open result file */
 	FILE* result_fh = stdout;
@@ -533,14 +568,50 @@ int main(int argc, char** argv)
 		result_fh = fopen(result_file, "w");
 		log_passert(result_fh != NULL, "Unable to open result file '%s'", result_file);
 	}
-
-	/* Generate result data */
-	perform_search_job(&state, flatten_threshold, job_fh, result_fh);
+	setvbuf(result_fh, NULL, _IOFBF, RESULT_BUFFER_SIZE);
+
+	/* Generate result data; the major page faults are the pages of the state files that had to be read from disk */
+	unsigned int nr_worker_threads = nr_threads > 1 ? nr_threads - 1 : 0;
+	struct rusage usage_begin, usage_end;
+	getrusage(RUSAGE_SELF, &usage_begin);
+	uint64_t search_begin = get_monotonic_time_ns();
+	if (search_job_perform(search_states, nr_states, nr_worker_threads, result_format, &entities, job_fh, result_fh) == -1)
+		return 1;
+	uint64_t search_end = get_monotonic_time_ns();
+	getrusage(RUSAGE_SELF, &usage_end);
+	size_t nr_summaries = 0;
+	for (size_t s = 0; s < nr_states; s++)
+		nr_summaries += search_states[s].state->summary.len > 0;
+	log_msg(INFO, "Searched %zu state file(s) (%zu with a summary) in %.3f seconds, reading %ld page(s) from disk (%ld minor page faults)",
+		nr_states, nr_summaries, (search_end - search_begin) / 1e9, usage_end.ru_majflt - usage_begin.ru_majflt, usage_end.ru_minflt - usage_begin.ru_minflt);
 
 	/* Close all files and cleanup resources */
 	log_passert(fclose(result_fh) == 0, "Failed to close result file");
 	log_passert(fclose(job_fh) == 0, "Failed to close job file");
-	honas_state_destroy(&state);
+	for (size_t s = 0; s < nr_states; s++) {
+		struct probe_cache* probe_cache = search_states[s].probe_cache;
+		if (probe_cache != NULL) {
+			if (honas_state_has_errors(search_states[s].state))
+				log_msg(WARNING, "Not saving the probe cache of the corrupt state for the period beginning at %" PRIu64, search_states[s].state->header->period_begin);
+			else if (probe_cache_save(probe_cache) == -1)
+				log_perror(WARNING, "Unable to save the probe cache of the state for the period beginning at %" PRIu64, search_states[s].state->header->period_begin);
+			probe_cache_destroy(probe_cache);
+		}
+		honas_state_destroy(search_states[s].state);
+	}
+	free(search_states);
+	free(states);
+	for (size_t i = 0; i < dd.nr_entries; i++) {
+		if (dd.loaded[i] > 0)
+			honas_state_destroy(&dd.states[i]);
+	}
+	free(dd.search_states);
+	free(dd.states);
+	free(dd.loaded);
+	if (entities_file != NULL) {
+		free(entities.names);
+		subnet_activity_destroy(&subnet_activity);
+	}
 	log_destroy();
 	return 0;
 }
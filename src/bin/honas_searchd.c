@@ -0,0 +1,801 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "defines.h"
+#include "honas_state.h"
+#include "includes.h"
+#include "logging.h"
+#include "search_job.h"
+#include "searchd_protocol.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/un.h>
+
+// Requires libevent2.
+#include <event2/event.h>
+#include <event2/listener.h>
+
+#define DEFAULT_SEARCHD_SOCKET_PATH "/var/spool/honas/search.sock"
+/* Seconds a client may take to send its request or to read its results */
+#define SEARCHD_CLIENT_TIMEOUT 60
+/* Seconds to wait for more changes in the state directories before reloading */
+#define SEARCHD_RELOAD_DELAY 1
+/* Default number of clients that are served at once */
+#define SEARCHD_DEFAULT_CLIENT_THREADS 4
+/* Number of clients that may wait to be served; further clients are turned away */
+#define SEARCHD_MAX_PENDING_CLIENTS 64
+
+/* A loaded state file; shared by all archives that it's part of */
+struct searchd_state {
+	honas_state_t state;
+	char* path;
+	struct stat st;   ///< Used to recognize unchanged state files when reloading
+	uint32_t refs;
+};
+
+/* The states that searches are performed on; replaced as a whole when reloading */
+struct searchd_archive {
+	uint32_t refs;
+	size_t nr_states;
+	struct searchd_state** states; ///< Ordered by period
+};
+
+static struct {
+	struct event_base* ev_base;
+	struct evconnlistener* ev_connlistener;
+	struct event* ev_inotify;
+	struct event* ev_reload;
+	struct event* ev_hangup;
+	struct event* ev_shutdown[3];
+	int inotify_fd;
+
+	/* Configuration */
+	const char** directories;
+	size_t nr_directories;
+	const char* socket_path;
+	bool mlock;
+	bool hugepages;
+	uint32_t flatten_threshold;
+	unsigned int nr_threads;
+
+	/* The current archive; clients take a reference while searching it */
+	pthread_mutex_t archive_lock;
+	struct searchd_archive* archive;
+
+	/* The client threads, which take the accepted clients from the pending queue */
+	pthread_t* client_threads;
+	unsigned int nr_client_threads;
+	pthread_mutex_t clients_lock;
+	pthread_cond_t clients_pending;
+	int pending_clients[SEARCHD_MAX_PENDING_CLIENTS];
+	size_t pending_head;
+	size_t nr_pending;
+	bool stopping;
+} ctx;
+
+static void searchd_state_release(struct searchd_state* state)
+{
+	if (__atomic_sub_fetch(&state->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	log_msg(DEBUG, "Unloading state file '%s'", state->path);
+	honas_state_destroy(&state->state);
+	free(state->path);
+	free(state);
+}
+
+static struct searchd_archive* searchd_archive_acquire(void)
+{
+	pthread_mutex_lock(&ctx.archive_lock);
+	struct searchd_archive* archive = ctx.archive;
+	__atomic_add_fetch(&archive->refs, 1, __ATOMIC_ACQ_REL);
+	pthread_mutex_unlock(&ctx.archive_lock);
+	return archive;
+}
+
+static void searchd_archive_release(struct searchd_archive* archive)
+{
+	if (__atomic_sub_fetch(&archive->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	for (size_t i = 0; i < archive->nr_states; i++)
+		searchd_state_release(archive->states[i]);
+	free(archive->states);
+	free(archive);
+}
+
+/* Load a state file, keeping it resident as configured */
+static struct searchd_state* searchd_state_load(const char* path, const struct stat* st)
+{
+	struct searchd_state* state = calloc(1, sizeof(struct searchd_state));
+	log_passert(state != NULL, "Failed to allocate state");
+
+	/* Sealed states stay sealed; concurrent searches share their (locked) block cache */
+	int result = honas_state_load(&state->state, path, true);
+	switch (result) {
+	case 0:
+		break;
+	case 1:
+		log_msg(DEBUG, "Skipping '%s', which is not a honas state file", path);
+		free(state);
+		return NULL;
+	case 2:
+		log_msg(WARNING, "Skipping corrupt state file '%s'", path);
+		free(state);
+		return NULL;
+	default:
+		log_perror(ERR, "Failed to load state file '%s'", path);
+		free(state);
+		return NULL;
+	}
+
+	if (ctx.hugepages && madvise(state->state.mmap, state->state.size, MADV_HUGEPAGE) == -1)
+		log_perror(DEBUG, "Unable to use huge pages for state file '%s'", path);
+	if (ctx.mlock && mlock(state->state.mmap, state->state.size) == -1)
+		log_perror(WARNING, "Unable to mlock state file '%s'", path);
+	else if (madvise(state->state.mmap, state->state.size, MADV_WILLNEED) == -1)
+		log_perror(DEBUG, "Unable to preload state file '%s'", path);
+
+	state->path = strdup(path);
+	log_passert(state->path != NULL, "Failed to allocate state file path");
+	state->st = *st;
+	state->refs = 1;
+	log_msg(INFO, "Loaded state file '%s'", path);
+	return state;
+}
+
+/* Find an unchanged state file in the current archive */
+static struct searchd_state* searchd_find_loaded_state(const struct searchd_archive* archive, const char* path, const struct stat* st)
+{
+	for (size_t i = 0; archive != NULL && i < archive->nr_states; i++) {
+		struct searchd_state* state = archive->states[i];
+		if (
+			state->st.st_dev == st->st_dev
+			&& state->st.st_ino == st->st_ino
+			&& state->st.st_size == st->st_size
+			&& state->st.st_mtim.tv_sec == st->st_mtim.tv_sec
+			&& state->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec
+			&& strcmp(state->path, path) == 0)
+			return state;
+	}
+	return NULL;
+}
+
+/* Order by period begin, then by period end, so the finest state comes first */
+static int compare_searchd_state_periods(const void* a, const void* b)
+{
+	const struct honas_state_file_header* header_a = (*(struct searchd_state* const*)a)->state.header;
+	const struct honas_state_file_header* header_b = (*(struct searchd_state* const*)b)->state.header;
+	if (header_a->period_begin != header_b->period_begin)
+		return header_a->period_begin < header_b->period_begin ? -1 : 1;
+	if (header_a->period_end != header_b->period_end)
+		return header_a->period_end < header_b->period_end ? -1 : 1;
+	return strcmp((*(struct searchd_state* const*)a)->path, (*(struct searchd_state* const*)b)->path);
+}
+
+/* Rescan the state directories and replace the current archive; unchanged state files are reused */
+static void searchd_reload(void)
+{
+	struct searchd_archive* current = ctx.archive;
+	struct searchd_archive* archive = calloc(1, sizeof(struct searchd_archive));
+	log_passert(archive != NULL, "Failed to allocate archive");
+	archive->refs = 1;
+	size_t states_alloc = 0, nr_loaded = 0;
+
+	for (size_t d = 0; d < ctx.nr_directories; d++) {
+		DIR* dir = opendir(ctx.directories[d]);
+		if (dir == NULL) {
+			log_perror(ERR, "Failed to open state directory '%s'", ctx.directories[d]);
+			continue;
+		}
+
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (entry->d_name[0] == '.')
+				continue;
+
+			char path[PATH_MAX];
+			struct stat st;
+			if (snprintf(path, sizeof(path), "%s/%s", ctx.directories[d], entry->d_name) >= (int)sizeof(path))
+				continue;
+			if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+				continue;
+
+			struct searchd_state* state = searchd_find_loaded_state(current, path, &st);
+			if (state != NULL) {
+				__atomic_add_fetch(&state->refs, 1, __ATOMIC_ACQ_REL);
+			} else if ((state = searchd_state_load(path, &st)) != NULL) {
+				nr_loaded++;
+			} else {
+				continue;
+			}
+
+			if (archive->nr_states == states_alloc) {
+				states_alloc = states_alloc ? states_alloc * 2 : 64;
+				archive->states = realloc(archive->states, states_alloc * sizeof(struct searchd_state*));
+				log_passert(archive->states != NULL, "Failed to allocate archive states");
+			}
+			archive->states[archive->nr_states++] = state;
+		}
+		closedir(dir);
+	}
+
+	/* Order the states by period; the results are keyed by period begin, so each
+	 * period begin can only be searched once. Of states that begin at the same
+	 * time, the one with the shortest period (the finest granularity) is used. */
+	if (archive->nr_states > 0)
+		qsort(archive->states, archive->nr_states, sizeof(struct searchd_state*), compare_searchd_state_periods);
+	size_t nr_states = 0;
+	for (size_t i = 0; i < archive->nr_states; i++) {
+		struct searchd_state* state = archive->states[i];
+		const struct searchd_state* kept = nr_states > 0 ? archive->states[nr_states - 1] : NULL;
+		if (kept != NULL && kept->state.header->period_begin == state->state.header->period_begin) {
+			if (kept->state.header->period_end == state->state.header->period_end)
+				log_msg(WARNING, "Skipping state file '%s'; '%s' has the same period", state->path, kept->path);
+			else
+				log_msg(INFO, "Skipping state file '%s'; '%s' begins at the same time with a shorter period", state->path, kept->path);
+			searchd_state_release(state);
+			continue;
+		}
+		archive->states[nr_states++] = state;
+	}
+	archive->nr_states = nr_states;
+
+	/* Searches still in progress keep using the previous archive */
+	pthread_mutex_lock(&ctx.archive_lock);
+	ctx.archive = archive;
+	pthread_mutex_unlock(&ctx.archive_lock);
+	if (current != NULL)
+		searchd_archive_release(current);
+
+	log_msg(NOTICE, "Serving %zu state file(s) (%zu newly loaded)", archive->nr_states, nr_loaded);
+}
+
+/* Perform a JSON search job, as `honas-search` would, on all states */
+static void searchd_json_search(struct searchd_archive* archive, FILE* in, FILE* out)
+{
+	if (archive->nr_states == 0) {
+		fprintf(out, "{\"results\":{}}");
+		return;
+	}
+
+	struct search_job_state* states = calloc(archive->nr_states, sizeof(struct search_job_state));
+	log_passert(states != NULL, "Failed to allocate search states");
+	for (size_t i = 0; i < archive->nr_states; i++) {
+		states[i].state = &archive->states[i]->state;
+		states[i].flatten_results = states[i].state->header->estimated_number_of_host_names < ctx.flatten_threshold;
+	}
+	if (search_job_perform(states, archive->nr_states, ctx.nr_threads, SEARCH_RESULT_FORMAT_JSON, NULL, in, out) == -1)
+		log_msg(WARNING, "Failed to perform search job of client");
+	free(states);
+}
+
+static bool searchd_binary_respond(FILE* out, uint32_t status, uint32_t nr_states, uint32_t nr_hashes)
+{
+	struct searchd_response response = { .status = status, .nr_states = nr_states, .nr_hashes = nr_hashes };
+	memcpy(response.magic, SEARCHD_RESPONSE_MAGIC, sizeof(response.magic));
+	return fwrite(&response, sizeof(response), 1, out) == 1;
+}
+
+/* Perform a compact binary search request on the states within the requested periods */
+static void searchd_binary_search(struct searchd_archive* archive, FILE* in, FILE* out)
+{
+	struct searchd_request request;
+	if (fread(&request, sizeof(request), 1, in) != 1) {
+		log_msg(DEBUG, "Incomplete binary search request");
+		return;
+	}
+	if (
+		memcmp(request.magic, SEARCHD_REQUEST_MAGIC, sizeof(request.magic)) != 0
+		|| request.nr_hashes > SEARCHD_MAX_REQUEST_HASHES
+		|| request.hash_length == 0
+		|| request.hash_length > SEARCHD_MAX_HASH_LENGTH
+		|| request.reserved != 0) {
+		log_msg(WARNING, "Invalid binary search request");
+		searchd_binary_respond(out, SEARCHD_STATUS_BAD_REQUEST, 0, 0);
+		return;
+	}
+
+	size_t hashes_len = (size_t)request.nr_hashes * request.hash_length;
+	uint8_t* hashes = malloc(MAX(hashes_len, 1));
+	log_passert(hashes != NULL, "Failed to allocate search request");
+	if (fread(hashes, 1, hashes_len, in) != hashes_len) {
+		log_msg(DEBUG, "Incomplete binary search request");
+		free(hashes);
+		return;
+	}
+
+	/* Select the states within the requested periods */
+	size_t first = 0, nr_states = 0, max_nr_offsets = 1;
+	while (first < archive->nr_states && archive->states[first]->state.header->period_begin < request.period_begin)
+		first++;
+	while (first + nr_states < archive->nr_states && archive->states[first + nr_states]->state.header->period_begin < request.period_end) {
+		const struct honas_state_file_header* header = archive->states[first + nr_states]->state.header;
+		max_nr_offsets = MAX(max_nr_offsets, (size_t)header->number_of_filters * header->number_of_hashes);
+		nr_states++;
+	}
+
+	/* Check each host name hash against all states; reusing the bit offsets for consecutive compatible states */
+	uint32_t* hits = malloc(MAX(nr_states * request.nr_hashes, 1) * sizeof(uint32_t));
+	size_t* bit_offsets = malloc(max_nr_offsets * sizeof(size_t));
+	log_passert(hits != NULL && bit_offsets != NULL, "Failed to allocate search results");
+	for (size_t h = 0; h < request.nr_hashes; h++) {
+		byte_slice_t hash = byte_slice(hashes + h * request.hash_length, request.hash_length);
+		honas_state_t* offsets_state = NULL;
+		for (size_t s = 0; s < nr_states; s++) {
+			honas_state_t* state = &archive->states[first + s]->state;
+			if (offsets_state == NULL || !honas_state_offsets_compatible(offsets_state, state)) {
+				honas_state_host_name_offsets(state, hash, bit_offsets);
+				offsets_state = state;
+			}
+			hits[s * request.nr_hashes + h] = honas_state_check_host_name_offsets(state, bit_offsets, NULL);
+		}
+	}
+
+	bool written = searchd_binary_respond(out, SEARCHD_STATUS_OK, nr_states, request.nr_hashes);
+	for (size_t s = 0; written && s < nr_states; s++) {
+		const struct honas_state_file_header* header = archive->states[first + s]->state.header;
+		struct searchd_response_state result = {
+			.period_begin = header->period_begin,
+			.period_end = header->period_end,
+			.number_of_filters = header->number_of_filters,
+			.number_of_filters_per_user = header->number_of_filters_per_user,
+		};
+		written = fwrite(&result, sizeof(result), 1, out) == 1
+			&& fwrite(hits + s * request.nr_hashes, sizeof(uint32_t), request.nr_hashes, out) == request.nr_hashes;
+	}
+	if (!written)
+		log_msg(DEBUG, "Failed to write binary search results");
+
+	free(bit_offsets);
+	free(hits);
+	free(hashes);
+}
+
+/* Serve a single client connection; the request type is determined by its first byte */
+static void searchd_serve_client(int fd)
+{
+	struct timeval timeout = { SEARCHD_CLIENT_TIMEOUT, 0 };
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)
+		log_perror(WARNING, "Failed to set client socket timeouts");
+
+	int out_fd = dup(fd);
+	FILE* in = fdopen(fd, "r");
+	FILE* out = out_fd == -1 ? NULL : fdopen(out_fd, "w");
+	if (in == NULL || out == NULL) {
+		log_perror(ERR, "Failed to open client connection");
+		if (in != NULL)
+			fclose(in);
+		else
+			close(fd);
+		if (out == NULL && out_fd != -1)
+			close(out_fd);
+		if (out != NULL)
+			fclose(out);
+		return;
+	}
+
+	int c = fgetc(in);
+	if (c != EOF) {
+		ungetc(c, in);
+		struct searchd_archive* archive = searchd_archive_acquire();
+		if (c == SEARCHD_REQUEST_MAGIC[0])
+			searchd_binary_search(archive, in, out);
+		else
+			searchd_json_search(archive, in, out);
+		searchd_archive_release(archive);
+	}
+
+	if (fclose(out) != 0)
+		log_perror(DEBUG, "Failed to send search results to client");
+	fclose(in);
+}
+
+/* Take the next pending client; returns -1 once shutting down and no clients are left */
+static int searchd_next_client(void)
+{
+	pthread_mutex_lock(&ctx.clients_lock);
+	while (ctx.nr_pending == 0 && !ctx.stopping)
+		pthread_cond_wait(&ctx.clients_pending, &ctx.clients_lock);
+	int fd = -1;
+	if (ctx.nr_pending > 0) {
+		fd = ctx.pending_clients[ctx.pending_head];
+		ctx.pending_head = (ctx.pending_head + 1) % SEARCHD_MAX_PENDING_CLIENTS;
+		ctx.nr_pending--;
+	}
+	pthread_mutex_unlock(&ctx.clients_lock);
+	return fd;
+}
+
+/* Serve clients, one at a time, until shutting down */
+static void* searchd_client_thread(void* arg __attribute__((unused)))
+{
+	int fd;
+	while ((fd = searchd_next_client()) != -1)
+		searchd_serve_client(fd);
+	return NULL;
+}
+
+/* Queue the client for the client threads, so the number of concurrent searches (and their search threads) is bounded */
+static void cb_accept_conn(struct evconnlistener* listener __attribute__((unused)), evutil_socket_t fd, struct sockaddr* sa __attribute__((unused)), int socklen __attribute__((unused)), void* arg __attribute__((unused)))
+{
+	pthread_mutex_lock(&ctx.clients_lock);
+	bool queued = ctx.nr_pending < SEARCHD_MAX_PENDING_CLIENTS;
+	if (queued) {
+		ctx.pending_clients[(ctx.pending_head + ctx.nr_pending) % SEARCHD_MAX_PENDING_CLIENTS] = fd;
+		ctx.nr_pending++;
+		pthread_cond_signal(&ctx.clients_pending);
+	}
+	pthread_mutex_unlock(&ctx.clients_lock);
+	if (!queued) {
+		log_msg(WARNING, "Too many clients waiting to be served, turning client away");
+		close(fd);
+	}
+}
+
+/* Start the client threads; the shutdown signals are left to the event loop */
+static bool start_client_threads(void)
+{
+	ctx.client_threads = calloc(ctx.nr_client_threads, sizeof(pthread_t));
+	if (ctx.client_threads == NULL)
+		return false;
+
+	sigset_t all_signals, old_signals;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	int err = 0;
+	for (unsigned int i = 0; err == 0 && i < ctx.nr_client_threads; i++) {
+		err = pthread_create(&ctx.client_threads[i], NULL, searchd_client_thread, NULL);
+		if (err != 0) {
+			log_msg(ERR, "Failed to start client thread: %s", strerror(err));
+			ctx.nr_client_threads = i;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	return err == 0;
+}
+
+/* Serve the clients that are still waiting, then stop the client threads */
+static void stop_client_threads(void)
+{
+	pthread_mutex_lock(&ctx.clients_lock);
+	ctx.stopping = true;
+	pthread_cond_broadcast(&ctx.clients_pending);
+	pthread_mutex_unlock(&ctx.clients_lock);
+	for (unsigned int i = 0; i < ctx.nr_client_threads; i++)
+		pthread_join(ctx.client_threads[i], NULL);
+	free(ctx.client_threads);
+}
+
+static void cb_accept_error(struct evconnlistener* listener __attribute__((unused)), void* arg __attribute__((unused)))
+{
+	log_perror(ERR, "Failed to accept client connection");
+}
+
+/* Wait for the state directories to settle before reloading */
+static void cb_inotify(evutil_socket_t fd, short events __attribute__((unused)), void* arg __attribute__((unused)))
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	struct timeval delay = { SEARCHD_RELOAD_DELAY, 0 };
+	evtimer_add(ctx.ev_reload, &delay);
+}
+
+static void cb_reload(evutil_socket_t fd __attribute__((unused)), short events __attribute__((unused)), void* arg __attribute__((unused)))
+{
+	searchd_reload();
+}
+
+static void cb_shutdown(evutil_socket_t signum __attribute__((unused)), short events __attribute__((unused)), void* arg __attribute__((unused)))
+{
+	event_base_loopexit(ctx.ev_base, NULL);
+}
+
+/* The shutdown signals are handled by the event loop, as the client threads could be interrupted by them as well */
+static bool setup_signal_handlers()
+{
+	static const int shutdown_signals[] = { SIGTERM, SIGINT, SIGQUIT };
+	for (size_t i = 0; i < sizeof(shutdown_signals) / sizeof(shutdown_signals[0]); i++) {
+		ctx.ev_shutdown[i] = evsignal_new(ctx.ev_base, shutdown_signals[i], cb_shutdown, NULL);
+		if (ctx.ev_shutdown[i] == NULL || event_add(ctx.ev_shutdown[i], NULL) != 0)
+			return false;
+	}
+
+	/* Clients that go away while results are being sent shouldn't take the daemon down */
+	struct sigaction ignore = { .sa_handler = SIG_IGN };
+	if (sigemptyset(&ignore.sa_mask) != 0 || sigaction(SIGPIPE, &ignore, NULL) != 0)
+		return false;
+	return true;
+}
+
+static bool init_socket_listener(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(ctx.socket_path) >= sizeof(addr.sun_path)) {
+		log_msg(ERR, "Socket path '%s' is too long", ctx.socket_path);
+		return false;
+	}
+	strncpy(addr.sun_path, ctx.socket_path, sizeof(addr.sun_path) - 1);
+
+	// If the process was killed ungracefully, the socket file is still present.
+	if (access(ctx.socket_path, F_OK) != -1) {
+		log_msg(INFO, "Unlinking existing socket file %s...", ctx.socket_path);
+		unlink(ctx.socket_path);
+	}
+
+	unsigned flags = LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_LEAVE_SOCKETS_BLOCKING;
+	ctx.ev_connlistener = evconnlistener_new_bind(ctx.ev_base, cb_accept_conn, NULL, flags, -1, (struct sockaddr*)&addr, sizeof(addr));
+	if (ctx.ev_connlistener == NULL) {
+		log_perror(ERR, "Failed to listen on socket '%s'", ctx.socket_path);
+		return false;
+	}
+	evconnlistener_set_error_cb(ctx.ev_connlistener, cb_accept_error);
+	return true;
+}
+
+static bool init_directory_watches(void)
+{
+	ctx.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ctx.inotify_fd == -1) {
+		log_perror(ERR, "Failed to initialize inotify");
+		return false;
+	}
+	for (size_t d = 0; d < ctx.nr_directories; d++) {
+		if (inotify_add_watch(ctx.inotify_fd, ctx.directories[d], IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) == -1) {
+			log_perror(ERR, "Failed to watch state directory '%s'", ctx.directories[d]);
+			return false;
+		}
+	}
+
+	ctx.ev_inotify = event_new(ctx.ev_base, ctx.inotify_fd, EV_READ | EV_PERSIST, cb_inotify, NULL);
+	ctx.ev_reload = evtimer_new(ctx.ev_base, cb_reload, NULL);
+	ctx.ev_hangup = evsignal_new(ctx.ev_base, SIGHUP, cb_reload, NULL);
+	if (ctx.ev_inotify == NULL || ctx.ev_reload == NULL || ctx.ev_hangup == NULL)
+		return false;
+	return event_add(ctx.ev_inotify, NULL) == 0 && event_add(ctx.ev_hangup, NULL) == 0;
+}
+
+static void show_usage(const char* program_name, FILE* out)
+{
+	fprintf(out, "Usage: %s [<options>] --directory <dir>...\n\n", program_name);
+	fprintf(out, "Options:\n");
+	fprintf(out, "  -h|--help           Show this message\n");
+	fprintf(out, "  -d|--directory <dir>\n");
+	fprintf(out, "                      Directory with state files to serve (can be used multiple times)\n");
+	fprintf(out, "  -S|--socket <path>  Unix socket to listen on (default: " DEFAULT_SEARCHD_SOCKET_PATH ")\n");
+	fprintf(out, "  -F|--flatten-threshold <clients>\n");
+	fprintf(out, "                      If fewer than this amount of clients have been seen then\n");
+	fprintf(out, "                      flatten the JSON results (default: never flatten)\n");
+	fprintf(out, "  -t|--threads <count>\n");
+	fprintf(out, "                      Number of threads used for checking the host names of a\n");
+	fprintf(out, "                      JSON search job (default: number of online CPUs)\n");
+	fprintf(out, "  -c|--clients <count>\n");
+	fprintf(out, "                      Number of clients that are served at once (default: %d)\n", SEARCHD_DEFAULT_CLIENT_THREADS);
+	fprintf(out, "  -m|--mlock          Lock the state files in memory\n");
+	fprintf(out, "  -H|--hugepages      Ask for the state files to be backed by huge pages\n");
+	fprintf(out, "  -q|--quiet          Be more quiet (can be used multiple times)\n");
+	fprintf(out, "  -s|--syslog         Log messages to syslog\n");
+	fprintf(out, "  -v|--verbose        Be more verbose (can be used multiple times)\n");
+	fprintf(out, "  -f|--fork           Fork the process as daemon (syslog must be enabled)\n");
+}
+
+static const struct option long_options[] = {
+	{ "help", no_argument, 0, 'h' },
+	{ "directory", required_argument, 0, 'd' },
+	{ "socket", required_argument, 0, 'S' },
+	{ "flatten-threshold", required_argument, 0, 'F' },
+	{ "threads", required_argument, 0, 't' },
+	{ "clients", required_argument, 0, 'c' },
+	{ "mlock", no_argument, 0, 'm' },
+	{ "hugepages", no_argument, 0, 'H' },
+	{ "quiet", no_argument, 0, 'q' },
+	{ "syslog", no_argument, 0, 's' },
+	{ "verbose", no_argument, 0, 'v' },
+	{ "fork", no_argument, 0, 'f' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char** argv)
+{
+	const char* program_name = "honas-searchd";
+	bool daemonize = false;
+	bool syslogenabled = false;
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long nr_client_threads = SEARCHD_DEFAULT_CLIENT_THREADS;
+	char* endptr;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.socket_path = DEFAULT_SEARCHD_SOCKET_PATH;
+	ctx.inotify_fd = -1;
+	ctx.directories = calloc(argc, sizeof(const char*));
+	log_passert(ctx.directories != NULL, "Failed to allocate state directories");
+
+	/* Parse command line arguments */
+	while (1) {
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "hd:S:F:t:c:mHqsvf", long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+			log_msg(CRIT, "Unimplemented option %s; Aborting!", long_options[option_index].name);
+			return 1;
+
+		case 'h':
+			show_usage(program_name, stdout);
+			return 0;
+
+		case 'd':
+			ctx.directories[ctx.nr_directories++] = optarg;
+			break;
+
+		case 'S':
+			ctx.socket_path = optarg;
+			break;
+
+		case 'F':
+			if (!my_strtouint32(optarg, &ctx.flatten_threshold, NULL, 10)) {
+				fprintf(stderr, "Invalid value for 'flatten-threshold': %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 't':
+			nr_threads = strtol(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || nr_threads < 1 || nr_threads > 1024) {
+				fprintf(stderr, "Invalid number of threads '%s'!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'c':
+			nr_client_threads = strtol(optarg, &endptr, 10);
+			if (*optarg == '\0' || *endptr != '\0' || nr_client_threads < 1 || nr_client_threads > 1024) {
+				fprintf(stderr, "Invalid number of clients '%s'!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'm':
+			ctx.mlock = true;
+			break;
+
+		case 'H':
+			ctx.hugepages = true;
+			break;
+
+		case 'q':
+			log_set_min_log_level(log_get_min_log_level() - 1);
+			break;
+
+		case 's':
+			log_init_syslog(program_name, DEFAULT_LOG_FACILITY);
+			syslogenabled = true;
+			break;
+
+		case 'v':
+			log_set_min_log_level(log_get_min_log_level() + 1);
+			break;
+
+		case 'f':
+			daemonize = true;
+			break;
+
+		case '?':
+			show_usage(program_name, stderr);
+			return 1;
+
+		default:
+			log_msg(CRIT, "Unimplemented option '%c'; Aborting!", c);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		log_msg(CRIT, "Unsupported argument supplied: %s!", argv[optind]);
+		show_usage(program_name, stderr);
+		return 1;
+	}
+	if (ctx.nr_directories == 0) {
+		fprintf(stderr, "Required '--directory' option missing!\n");
+		return 1;
+	}
+	ctx.nr_threads = nr_threads > 1 ? nr_threads - 1 : 0;
+	ctx.nr_client_threads = nr_client_threads;
+
+	if (daemonize) {
+		if (!syslogenabled) {
+			log_msg(ERR, "Cannot fork if syslog is not enabled for logging!");
+			return 1;
+		}
+
+		pid_t process_id = fork();
+		if (process_id < 0) {
+			log_msg(ERR, "Failed to fork the search daemon process!");
+			return 1;
+		} else if (process_id > 0) {
+			log_msg(DEBUG, "PID of forked process is %d", process_id);
+			return 0;
+		}
+	}
+
+	log_msg(INFO, "%s (version %s)", program_name, VERSION);
+
+	pthread_mutex_init(&ctx.archive_lock, NULL);
+	pthread_mutex_init(&ctx.clients_lock, NULL);
+	pthread_cond_init(&ctx.clients_pending, NULL);
+
+	ctx.ev_base = event_base_new();
+	log_passert(ctx.ev_base != NULL, "Failed to create event base");
+
+	if (!setup_signal_handlers()) {
+		log_msg(ERR, "Failed to install signal handlers!");
+		return 1;
+	}
+
+	/* Watch the state directories before the initial load, so no new state files are missed */
+	if (!init_directory_watches())
+		return 1;
+	searchd_reload();
+	if (!start_client_threads()) {
+		log_msg(ERR, "Failed to start client threads!");
+		return 1;
+	}
+	if (!init_socket_listener())
+		return 1;
+
+	log_msg(INFO, "Listening for search requests on %s", ctx.socket_path);
+	if (event_base_dispatch(ctx.ev_base) != 0) {
+		log_msg(ERR, "The main processing loop failed to start!");
+		return 1;
+	}
+	log_msg(NOTICE, "Shutting down");
+
+	/* Stop accepting clients and wait for those still being served */
+	evconnlistener_free(ctx.ev_connlistener);
+	unlink(ctx.socket_path);
+	stop_client_threads();
+
+	for (size_t i = 0; i < sizeof(ctx.ev_shutdown) / sizeof(ctx.ev_shutdown[0]); i++)
+		event_free(ctx.ev_shutdown[i]);
+	event_free(ctx.ev_hangup);
+	event_free(ctx.ev_reload);
+	event_free(ctx.ev_inotify);
+	close(ctx.inotify_fd);
+	event_base_free(ctx.ev_base);
+
+	searchd_archive_release(ctx.archive);
+	pthread_cond_destroy(&ctx.clients_pending);
+	pthread_mutex_destroy(&ctx.clients_lock);
+	pthread_mutex_destroy(&ctx.archive_lock);
+	free(ctx.directories);
+
+	log_msg(NOTICE, "Exiting");
+	log_destroy();
+	return 0;
+}
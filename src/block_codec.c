@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "block_codec.h"
+
+#include "defines.h"
+
+#ifdef HAS_ZSTD
+#include <zstd.h>
+
+/* Compression level used for zstd; sealing is done once, lookups are done many times */
+#define BLOCK_CODEC_ZSTD_LEVEL 9
+#endif
+
+/* Number of bits covered by each entry in the index of the indexed sparse codec */
+#define SPARSE_INDEX_BITS 4096
+
+static const char* block_codec_names[BLOCK_CODEC_MAX] = {
+	[BLOCK_CODEC_RAW] = "raw",
+	[BLOCK_CODEC_RLE] = "rle",
+	[BLOCK_CODEC_SPARSE] = "sparse",
+	[BLOCK_CODEC_ZSTD] = "zstd",
+	[BLOCK_CODEC_SPARSE_INDEXED] = "isparse",
+};
+
+const char* block_codec_name(enum block_codec codec)
+{
+	if (codec >= BLOCK_CODEC_MAX)
+		return NULL;
+	return block_codec_names[codec];
+}
+
+bool block_codec_from_name(const char* name, enum block_codec* codec)
+{
+	for (int i = 0; i < BLOCK_CODEC_MAX; i++) {
+		if (strcmp(name, block_codec_names[i]) == 0) {
+			*codec = (enum block_codec)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool block_codec_available(enum block_codec codec)
+{
+	switch (codec) {
+	case BLOCK_CODEC_RAW:
+	case BLOCK_CODEC_RLE:
+	case BLOCK_CODEC_SPARSE:
+	case BLOCK_CODEC_SPARSE_INDEXED:
+		return true;
+	case BLOCK_CODEC_ZSTD:
+#ifdef HAS_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+/* LEB128 style variable length integers */
+static bool put_varint(byte_slice_t dst, size_t* pos, uint64_t value)
+{
+	do {
+		if (*pos >= dst.len)
+			return false;
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		dst.bytes[(*pos)++] = byte | (value ? 0x80 : 0);
+	} while (value);
+	return true;
+}
+
+static bool get_varint(const byte_slice_t src, size_t* pos, uint64_t* value)
+{
+	*value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (*pos >= src.len)
+			return false;
+		uint8_t byte = src.bytes[(*pos)++];
+		*value |= ((uint64_t)(byte & 0x7f)) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+/* Run length encoding: a sequence of tokens `(length << 1) | is_literal`
+ * where a zero run token is followed by nothing and a literal token is
+ * followed by `length` verbatim bytes.
+ */
+static ssize_t rle_compress(const byte_slice_t src, byte_slice_t dst)
+{
+	size_t si = 0, di = 0;
+	while (si < src.len) {
+		size_t run = 0;
+		while (si + run < src.len && src.bytes[si + run] == 0)
+			run++;
+
+		/* Single zero bytes in between other data are cheaper as literals */
+		if (run >= 2 || (run > 0 && si + run == src.len)) {
+			if (!put_varint(dst, &di, run << 1))
+				return -1;
+			si += run;
+			continue;
+		}
+
+		size_t lit_end = si;
+		while (lit_end < src.len && !(src.bytes[lit_end] == 0 && lit_end + 1 < src.len && src.bytes[lit_end + 1] == 0))
+			lit_end++;
+		size_t lit_len = lit_end - si;
+		if (!put_varint(dst, &di, (lit_len << 1) | 1) || di + lit_len > dst.len)
+			return -1;
+		memcpy(dst.bytes + di, src.bytes + si, lit_len);
+		di += lit_len;
+		si = lit_end;
+	}
+	return di;
+}
+
+static int rle_decompress(const byte_slice_t src, byte_slice_t dst)
+{
+	size_t si = 0, di = 0;
+	while (si < src.len) {
+		uint64_t token;
+		if (!get_varint(src, &si, &token))
+			return -1;
+		size_t len = token >> 1;
+		if (len > dst.len - di)
+			return -1;
+		if (token & 1) {
+			if (len > src.len - si)
+				return -1;
+			memcpy(dst.bytes + di, src.bytes + si, len);
+			si += len;
+		} else {
+			memset(dst.bytes + di, 0, len);
+		}
+		di += len;
+	}
+	return di == dst.len ? 0 : -1;
+}
+
+static int rle_bit_is_set(const byte_slice_t src, size_t block_len, size_t bit)
+{
+	size_t si = 0, di = 0;
+	while (si < src.len) {
+		uint64_t token;
+		if (!get_varint(src, &si, &token))
+			return -1;
+		size_t len = token >> 1;
+		if (len > block_len - di || ((token & 1) && len > src.len - si))
+			return -1;
+		if ((bit >> 3) < di + len)
+			return (token & 1) ? byte_slice_bit_is_set(byte_slice(src.bytes + si, len), bit - (di << 3)) : 0;
+		if (token & 1)
+			si += len;
+		di += len;
+	}
+	return -1;
+}
+
+/* Sparse encoding: the offsets of all bits set to 1, each encoded as the
+ * number of bits set to 0 since the previous bit set to 1.
+ */
+static ssize_t sparse_compress(const byte_slice_t src, byte_slice_t dst)
+{
+	size_t di = 0;
+	uint64_t next_bit = 0;
+	for (size_t i = 0; i < src.len; i++) {
+		uint8_t byte = src.bytes[i];
+		while (byte) {
+			uint64_t bit = (i << 3) + __builtin_ctz(byte);
+			if (!put_varint(dst, &di, bit - next_bit))
+				return -1;
+			next_bit = bit + 1;
+			byte &= byte - 1;
+		}
+	}
+	return di;
+}
+
+static int sparse_decompress(const byte_slice_t src, byte_slice_t dst)
+{
+	size_t si = 0;
+	uint64_t next_bit = 0, nr_bits = ((uint64_t)dst.len) << 3;
+	byte_slice_clear(dst);
+	while (si < src.len) {
+		uint64_t delta;
+		if (!get_varint(src, &si, &delta) || delta >= nr_bits - next_bit)
+			return -1;
+		byte_slice_set_bit(dst, next_bit + delta);
+		next_bit += delta + 1;
+	}
+	return 0;
+}
+
+static int sparse_bit_is_set(const byte_slice_t src, uint64_t nr_bits, uint64_t bit)
+{
+	size_t si = 0;
+	uint64_t next_bit = 0;
+	while (si < src.len) {
+		uint64_t delta;
+		if (!get_varint(src, &si, &delta) || delta >= nr_bits - next_bit)
+			return -1;
+		if (delta >= bit - next_bit)
+			return delta == bit - next_bit;
+		next_bit += delta + 1;
+	}
+	return 0;
+}
+
+/* Indexed sparse encoding: the block is divided into sub-blocks of
+ * `SPARSE_INDEX_BITS` bits which are each sparse encoded on their own. The
+ * encoded sub-blocks are preceded by an index of 32 bit offsets of where the
+ * data of each sub-block begins (relative to the end of the index).
+ */
+static size_t sparse_index_length(size_t block_len)
+{
+	return ((block_len + (SPARSE_INDEX_BITS >> 3) - 1) / (SPARSE_INDEX_BITS >> 3)) * sizeof(uint32_t);
+}
+
+static ssize_t sparse_indexed_compress(const byte_slice_t src, byte_slice_t dst)
+{
+	size_t index_len = sparse_index_length(src.len);
+	if (index_len > dst.len)
+		return -1;
+	size_t di = index_len;
+	for (size_t si = 0, entry = 0; si < src.len; si += SPARSE_INDEX_BITS >> 3, entry++) {
+		uint32_t offset = di - index_len;
+		memcpy(dst.bytes + entry * sizeof(uint32_t), &offset, sizeof(offset));
+		ssize_t size = sparse_compress(byte_slice(src.bytes + si, MIN(SPARSE_INDEX_BITS >> 3, src.len - si)), byte_slice(dst.bytes + di, dst.len - di));
+		if (size == -1)
+			return -1;
+		di += size;
+	}
+	return di;
+}
+
+/* Locate the encoded data of a sub-block */
+static bool sparse_indexed_sub_block(const byte_slice_t src, size_t index_len, size_t entry, byte_slice_t* sub_block)
+{
+	if (src.len < index_len)
+		return false;
+	uint32_t begin, end = src.len - index_len;
+	memcpy(&begin, src.bytes + entry * sizeof(uint32_t), sizeof(begin));
+	if ((entry + 1) * sizeof(uint32_t) < index_len)
+		memcpy(&end, src.bytes + (entry + 1) * sizeof(uint32_t), sizeof(end));
+	if (begin > end || end > src.len - index_len)
+		return false;
+	*sub_block = byte_slice(src.bytes + index_len + begin, end - begin);
+	return true;
+}
+
+static int sparse_indexed_decompress(const byte_slice_t src, byte_slice_t dst)
+{
+	size_t index_len = sparse_index_length(dst.len);
+	for (size_t di = 0, entry = 0; di < dst.len; di += SPARSE_INDEX_BITS >> 3, entry++) {
+		byte_slice_t sub_block;
+		if (
+			!sparse_indexed_sub_block(src, index_len, entry, &sub_block)
+			|| sparse_decompress(sub_block, byte_slice(dst.bytes + di, MIN(SPARSE_INDEX_BITS >> 3, dst.len - di))) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int sparse_indexed_bit_is_set(const byte_slice_t src, size_t block_len, size_t bit)
+{
+	size_t entry = bit / SPARSE_INDEX_BITS;
+	size_t sub_block_len = MIN(SPARSE_INDEX_BITS >> 3, block_len - entry * (SPARSE_INDEX_BITS >> 3));
+	byte_slice_t sub_block;
+	if (!sparse_indexed_sub_block(src, sparse_index_length(block_len), entry, &sub_block))
+		return -1;
+	return sparse_bit_is_set(sub_block, (uint64_t)sub_block_len << 3, bit % SPARSE_INDEX_BITS);
+}
+
+ssize_t block_codec_compress(enum block_codec codec, const byte_slice_t src, byte_slice_t dst)
+{
+	switch (codec) {
+	case BLOCK_CODEC_RAW:
+		if (src.len > dst.len)
+			return -1;
+		memcpy(dst.bytes, src.bytes, src.len);
+		return src.len;
+	case BLOCK_CODEC_RLE:
+		return rle_compress(src, dst);
+	case BLOCK_CODEC_SPARSE:
+		return sparse_compress(src, dst);
+	case BLOCK_CODEC_SPARSE_INDEXED:
+		return sparse_indexed_compress(src, dst);
+#ifdef HAS_ZSTD
+	case BLOCK_CODEC_ZSTD: {
+		size_t size = ZSTD_compress(dst.bytes, dst.len, src.bytes, src.len, BLOCK_CODEC_ZSTD_LEVEL);
+		return ZSTD_isError(size) ? -1 : (ssize_t)size;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+int block_codec_decompress(enum block_codec codec, const byte_slice_t src, byte_slice_t dst)
+{
+	switch (codec) {
+	case BLOCK_CODEC_RAW:
+		if (src.len != dst.len)
+			return -1;
+		memcpy(dst.bytes, src.bytes, src.len);
+		return 0;
+	case BLOCK_CODEC_RLE:
+		return rle_decompress(src, dst);
+	case BLOCK_CODEC_SPARSE:
+		return sparse_decompress(src, dst);
+	case BLOCK_CODEC_SPARSE_INDEXED:
+		return sparse_indexed_decompress(src, dst);
+#ifdef HAS_ZSTD
+	case BLOCK_CODEC_ZSTD: {
+		size_t size = ZSTD_decompress(dst.bytes, dst.len, src.bytes, src.len);
+		return (ZSTD_isError(size) || size != dst.len) ? -1 : 0;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+bool block_codec_supports_probing(enum block_codec codec)
+{
+	switch (codec) {
+	case BLOCK_CODEC_RAW:
+	case BLOCK_CODEC_RLE:
+	case BLOCK_CODEC_SPARSE:
+	case BLOCK_CODEC_SPARSE_INDEXED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+int block_codec_bit_is_set(enum block_codec codec, const byte_slice_t src, size_t block_len, size_t bit)
+{
+	if (bit >= ((uint64_t)block_len << 3))
+		return -1;
+	switch (codec) {
+	case BLOCK_CODEC_RAW:
+		if (src.len != block_len)
+			return -1;
+		return byte_slice_bit_is_set(src, bit);
+	case BLOCK_CODEC_RLE:
+		return rle_bit_is_set(src, block_len, bit);
+	case BLOCK_CODEC_SPARSE:
+		return sparse_bit_is_set(src, (uint64_t)block_len << 3, bit);
+	case BLOCK_CODEC_SPARSE_INDEXED:
+		return sparse_indexed_bit_is_set(src, block_len, bit);
+	default:
+		return -1;
+	}
+}
@@ -126,6 +126,48 @@ bool bloom_is_set(const byte_slice_t filter, const byte_slice_t hash, size_t num
 	return byte_slice_all_bits_set(filter, bit_offsets, num_bits);
 }
 
+void bloom_determine_folded_offsets(size_t* bit_offsets, size_t bit_offsets_len, size_t filtersize, uint32_t fold_factor, const byte_slice_t input_hash)
+{
+	bloom_determine_offsets(bit_offsets, bit_offsets_len, filtersize << fold_factor, input_hash);
+
+	/* Folding the filter in half maps each bit offset onto the lower half */
+	if (fold_factor > 0) {
+		size_t num_bits = filtersize << 3;
+		for (size_t i = 0; i < bit_offsets_len; i++)
+			bit_offsets[i] %= num_bits;
+	}
+}
+
+void bloom_set_folded(byte_slice_t filter, const byte_slice_t hash, size_t num_bits, uint32_t fold_factor)
+{
+	size_t bit_offsets[num_bits];
+	bloom_determine_folded_offsets(bit_offsets, num_bits, filter.len, fold_factor, hash);
+	byte_slice_set_bits(filter, bit_offsets, num_bits);
+}
+
+bool bloom_is_set_folded(const byte_slice_t filter, const byte_slice_t hash, size_t num_bits, uint32_t fold_factor)
+{
+	size_t bit_offsets[num_bits];
+	bloom_determine_folded_offsets(bit_offsets, num_bits, filter.len, fold_factor, hash);
+	return byte_slice_all_bits_set(filter, bit_offsets, num_bits);
+}
+
+void bloom_fold(byte_slice_t folded, const byte_slice_t filter)
+{
+	assert(folded.len > 0);
+	assert(filter.len % folded.len == 0);
+	for (size_t offset = 0; offset < filter.len; offset += folded.len) {
+		byte_slice_t part = byte_slice(filter.bytes + offset, folded.len);
+		if ((size_t)folded.bytes % sizeof(size_t) == (size_t)part.bytes % sizeof(size_t)) {
+			byte_slice_bitwise_or(folded, part);
+		} else {
+			/* The optimized version requires both slices to be equally aligned */
+			for (size_t i = 0; i < folded.len; i++)
+				folded.bytes[i] |= part.bytes[i];
+		}
+	}
+}
+
 size_t bloom_nr_bits_set(const byte_slice_t filter)
 {
 	return byte_slice_popcount(filter);
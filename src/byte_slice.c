@@ -54,6 +54,12 @@ static int popcount(popcount_t i)
 }
 #endif
 
+#if defined HAS_VECTOR_EXTENSIONS
+/* A vector of machine words; the compiler maps bitwise operations on these onto
+ * SIMD instructions. The reduced alignment allows for unaligned vector access. */
+typedef size_t opt_vector_t __attribute__((vector_size(4 * sizeof(size_t)), aligned(sizeof(size_t))));
+#endif
+
 #define _opt_align_begin(value, type) ((uint8_t*)((((size_t)value) + sizeof(type) - 1) & ~(sizeof(type) - 1)))
 #define _opt_align_end(value, type) ((type*)(((size_t)value) & ~(sizeof(type) - 1)))
 
@@ -99,10 +105,16 @@ void byte_slice_bitwise_or(byte_slice_t target, const byte_slice_t other)
 	union {
 		uint8_t* bytes;
 		size_t* opt;
+#if defined HAS_VECTOR_EXTENSIONS
+		opt_vector_t* vec;
+#endif
 	} tgt_cur = { target.bytes };
 	union {
 		const uint8_t* bytes;
 		const size_t* opt;
+#if defined HAS_VECTOR_EXTENSIONS
+		const opt_vector_t* vec;
+#endif
 	} oth_cur = { other.bytes };
 
 	if (len > sizeof(size_t) * 2) {
@@ -115,6 +127,12 @@ void byte_slice_bitwise_or(byte_slice_t target, const byte_slice_t other)
 		while (tgt_cur.bytes < tgt_opt_begin)
 			*tgt_cur.bytes++ |= *oth_cur.bytes++;
 
+#if defined HAS_VECTOR_EXTENSIONS
+		// Process as many vectors of optimally aligned bigger integers as possible
+		while ((size_t)(tgt_opt_end - tgt_cur.opt) >= sizeof(opt_vector_t) / sizeof(size_t))
+			*tgt_cur.vec++ |= *oth_cur.vec++;
+#endif
+
 		// Count as many optimally aligned bigger integers as possible
 		while (tgt_cur.opt < tgt_opt_end)
 			*tgt_cur.opt++ |= *oth_cur.opt++;
@@ -134,10 +152,16 @@ void byte_slice_bitwise_and(byte_slice_t target, const byte_slice_t other)
 	union {
 		uint8_t* bytes;
 		size_t* opt;
+#if defined HAS_VECTOR_EXTENSIONS
+		opt_vector_t* vec;
+#endif
 	} tgt_cur = { target.bytes };
 	union {
 		const uint8_t* bytes;
 		const size_t* opt;
+#if defined HAS_VECTOR_EXTENSIONS
+		const opt_vector_t* vec;
+#endif
 	} oth_cur = { other.bytes };
 
 	if (len > sizeof(size_t) * 2) {
@@ -150,6 +174,12 @@ void byte_slice_bitwise_and(byte_slice_t target, const byte_slice_t other)
 		while (tgt_cur.bytes < tgt_opt_begin)
 			*tgt_cur.bytes++ &= *oth_cur.bytes++;
 
+#if defined HAS_VECTOR_EXTENSIONS
+		// Process as many vectors of optimally aligned bigger integers as possible
+		while ((size_t)(tgt_opt_end - tgt_cur.opt) >= sizeof(opt_vector_t) / sizeof(size_t))
+			*tgt_cur.vec++ &= *oth_cur.vec++;
+#endif
+
 		// Count as many optimally aligned bigger integers as possible
 		while (tgt_cur.opt < tgt_opt_end)
 			*tgt_cur.opt++ &= *oth_cur.opt++;
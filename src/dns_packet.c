@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dns_packet.h"
+
+#include <ctype.h>
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+
+#define DNS_PORT 53
+#define DNS_HEADER_SIZE 12
+#define DNS_CLASS_IN 1
+
+static inline uint16_t load_be16(const uint8_t* p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+/* Parse the question of a DNS query into a lookup; returns false for other DNS messages */
+static bool dns_packet_parse_query(const uint8_t* message, size_t len, struct honas_input_lookup* lookup)
+{
+	/* Only queries (QR is 0) with opcode QUERY and a question are of interest */
+	if (len < DNS_HEADER_SIZE || (message[2] & 0x80) != 0 || ((message[2] >> 3) & 0x0f) != 0 || load_be16(message + 4) == 0)
+		return false;
+
+	/* Convert the name to presentation format, escaped like ldns does */
+	uint8_t* host_name = lookup->host_name;
+	size_t host_name_length = 0;
+	size_t name_len = 0;
+	size_t offset = DNS_HEADER_SIZE;
+	for (;;) {
+		if (offset >= len)
+			return false;
+		size_t label_len = message[offset++];
+		if (label_len == 0)
+			break;
+
+		/* Compression pointers (or extended labels) don't belong in the first question */
+		name_len += label_len + 1;
+		if (label_len > 63 || name_len > 254 || offset + label_len > len)
+			return false;
+		for (size_t i = 0; i < label_len; i++) {
+			const uint8_t c = message[offset + i];
+			if (c == '.' || c == ';' || c == '(' || c == ')' || c == '\\') {
+				host_name[host_name_length++] = '\\';
+				host_name[host_name_length++] = c;
+			} else if (!isascii(c) || !isgraph(c)) {
+				host_name[host_name_length++] = '\\';
+				host_name[host_name_length++] = '0' + c / 100;
+				host_name[host_name_length++] = '0' + (c / 10) % 10;
+				host_name[host_name_length++] = '0' + c % 10;
+			} else {
+				host_name[host_name_length++] = c;
+			}
+		}
+		host_name[host_name_length++] = '.';
+		offset += label_len;
+	}
+	if (host_name_length == 0)
+		host_name[host_name_length++] = '.';
+
+	if (offset + 4 > len || load_be16(message + offset + 2) != DNS_CLASS_IN)
+		return false;
+	lookup->qtype = load_be16(message + offset);
+	lookup->host_name_length = host_name_length;
+	return true;
+}
+
+/* Find the DNS payload of a packet sent to port 53, which is left empty for other packets */
+void dns_packet_parse(struct dns_packet* packet, uint32_t link_type, const uint8_t* data, size_t len)
+{
+	packet->payload_len = 0;
+	memset(&packet->client, 0, sizeof(packet->client));
+
+	/* Link layer */
+	uint16_t ether_type = 0;
+	switch (link_type) {
+	case LINKTYPE_NULL:
+	case LINKTYPE_LOOP:
+		/* The address family is in host byte order of the capturing host, so rely on the IP version instead */
+		if (len < 4)
+			return;
+		data += 4;
+		len -= 4;
+		break;
+
+	case LINKTYPE_ETHERNET:
+		if (len < 14)
+			return;
+		ether_type = load_be16(data + 12);
+		data += 14;
+		len -= 14;
+		while ((ether_type == ETHERTYPE_VLAN || ether_type == ETHERTYPE_QINQ) && len >= 4) {
+			ether_type = load_be16(data + 2);
+			data += 4;
+			len -= 4;
+		}
+		break;
+
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return;
+		ether_type = load_be16(data + 14);
+		data += 16;
+		len -= 16;
+		break;
+
+	case LINKTYPE_LINUX_SLL2:
+		if (len < 20)
+			return;
+		ether_type = load_be16(data);
+		data += 20;
+		len -= 20;
+		break;
+
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		break;
+
+	default:
+		return;
+	}
+	if (len == 0)
+		return;
+	if (ether_type == 0)
+		ether_type = (data[0] >> 4) == 4 ? ETHERTYPE_IPV4 : ETHERTYPE_IPV6;
+
+	/* Network layer */
+	uint8_t protocol;
+	if (ether_type == ETHERTYPE_IPV4) {
+		if (len < 20 || (data[0] >> 4) != 4)
+			return;
+		size_t header_len = (data[0] & 0x0f) * 4;
+		size_t total_len = load_be16(data + 2);
+		if (header_len < 20 || total_len < header_len || len < header_len)
+			return;
+		/* Only the first fragment has the transport header */
+		if ((load_be16(data + 6) & 0x1fff) != 0)
+			return;
+		if (len > total_len)
+			len = total_len;
+		protocol = data[9];
+		packet->client.af = AF_INET;
+		memcpy(&packet->client.in.addr4, data + 12, sizeof(packet->client.in.addr4));
+		data += header_len;
+		len -= header_len;
+	} else if (ether_type == ETHERTYPE_IPV6) {
+		if (len < 40 || (data[0] >> 4) != 6)
+			return;
+		size_t payload_len = load_be16(data + 4);
+		protocol = data[6];
+		packet->client.af = AF_INET6;
+		memcpy(&packet->client.in.addr6, data + 8, sizeof(packet->client.in.addr6));
+		data += 40;
+		len -= 40;
+		if (len > payload_len)
+			len = payload_len;
+
+		/* Skip the extension headers */
+		for (;;) {
+			size_t header_len;
+			if (protocol == IPPROTO_HOPOPTS || protocol == IPPROTO_ROUTING || protocol == IPPROTO_DSTOPTS) {
+				if (len < 2)
+					return;
+				header_len = (data[1] + 1) * 8;
+			} else if (protocol == IPPROTO_FRAGMENT) {
+				if (len < 8 || (load_be16(data + 2) & 0xfff8) != 0)
+					return;
+				header_len = 8;
+			} else if (protocol == IPPROTO_AH) {
+				if (len < 2)
+					return;
+				header_len = (data[1] + 2) * 4;
+			} else {
+				break;
+			}
+			if (len < header_len)
+				return;
+			protocol = data[0];
+			data += header_len;
+			len -= header_len;
+		}
+	} else {
+		return;
+	}
+
+	/* Transport layer */
+	if (protocol == IPPROTO_UDP) {
+		if (len < 8 || load_be16(data + 2) != DNS_PORT)
+			return;
+		size_t udp_len = load_be16(data + 4);
+		if (udp_len < 8)
+			return;
+		if (len > udp_len)
+			len = udp_len;
+		packet->payload = data + 8;
+		packet->payload_len = len - 8;
+		packet->payload_is_tcp = false;
+	} else if (protocol == IPPROTO_TCP) {
+		if (len < 20 || load_be16(data + 2) != DNS_PORT)
+			return;
+		size_t header_len = (data[12] >> 4) * 4;
+		if (header_len < 20 || len < header_len)
+			return;
+		packet->payload = data + header_len;
+		packet->payload_len = len - header_len;
+		packet->payload_is_tcp = true;
+	}
+}
+
+/* Take the next query from the packet being parsed; returns false once there are no more */
+bool dns_packet_next_query(struct dns_packet* packet, struct honas_input_lookup* lookup)
+{
+	while (packet->payload_len > 0) {
+		const uint8_t* message = packet->payload;
+		size_t message_len = packet->payload_len;
+		if (packet->payload_is_tcp) {
+			/* Each DNS message over TCP is preceded by its length; messages continuing in a next segment are skipped */
+			if (packet->payload_len < 2 || load_be16(packet->payload) > packet->payload_len - 2)
+				break;
+			message = packet->payload + 2;
+			message_len = load_be16(packet->payload);
+			packet->payload += 2 + message_len;
+			packet->payload_len -= 2 + message_len;
+		} else {
+			packet->payload_len = 0;
+		}
+
+		if (dns_packet_parse_query(message, message_len, lookup)) {
+			lookup->timestamp = packet->timestamp;
+			lookup->timestamp_nsec = packet->timestamp_nsec;
+			lookup->client = packet->client;
+			return true;
+		}
+	}
+	packet->payload_len = 0;
+	return false;
+}
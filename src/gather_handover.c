@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_handover.h"
+
+#include "utils.h"
+
+#include <poll.h>
+
+/* The handover message, sent along with the active state and the listening sockets (in that order) */
+struct gather_handover_message {
+	char magic[8];    ///< Handover message identification string (`HONASHND`)
+	uint32_t version; ///< Handover message version
+	uint32_t nr_fds;  ///< Number of file descriptors sent along
+};
+
+/* Acknowledgement sent by the new process */
+static const char gather_handover_ack = 'A';
+
+pid_t gather_handover_spawn(const char* program, char* const argv[], int dirfd, int* sock)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+		return -1;
+
+	pid_t pid = fork();
+	switch (pid) {
+	case -1: {
+		int saved_errno = errno;
+		close(sv[0]);
+		close(sv[1]);
+		errno = saved_errno;
+		return -1;
+	}
+
+	case 0: {
+		/* Child process; Only async-signal-safe functions from here on, except for setenv() right before execv() */
+		char fd_value[16];
+		snprintf(fd_value, sizeof(fd_value), "%d", sv[1]);
+		if (fcntl(sv[1], F_SETFD, 0) == -1 || fchdir(dirfd) == -1 || setenv(GATHER_HANDOVER_SOCKET_ENV, fd_value, 1) == -1)
+			_exit(127);
+		execv(program, argv);
+		_exit(127);
+	}
+
+	default:
+		close(sv[1]);
+		*sock = sv[0];
+		return pid;
+	}
+}
+
+int gather_handover_socket(void)
+{
+	const char* value = getenv(GATHER_HANDOVER_SOCKET_ENV);
+	if (value == NULL)
+		return -1;
+
+	uint32_t fd;
+	bool valid = my_strtouint32(value, &fd, NULL, 10) && fd <= INT_MAX && fcntl(fd, F_SETFD, FD_CLOEXEC) != -1;
+	unsetenv(GATHER_HANDOVER_SOCKET_ENV);
+	return valid ? (int)fd : -1;
+}
+
+int gather_handover_send(int sock, const int* listener_fds, size_t nr_listener_fds, int state_fd)
+{
+	assert(nr_listener_fds <= GATHER_LISTENER_MAX_ENDPOINTS);
+	struct gather_handover_message message = { .version = CURRENT_GATHER_HANDOVER_VERSION, .nr_fds = 1 + nr_listener_fds };
+	memcpy(message.magic, GATHER_HANDOVER_MAGIC, sizeof(message.magic));
+	struct iovec iov = { .iov_base = &message, .iov_len = sizeof(message) };
+
+	int fds[1 + GATHER_LISTENER_MAX_ENDPOINTS];
+	fds[0] = state_fd;
+	memcpy(fds + 1, listener_fds, nr_listener_fds * sizeof(int));
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = CMSG_SPACE(message.nr_fds * sizeof(int)) };
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(message.nr_fds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, message.nr_fds * sizeof(int));
+
+	ssize_t sent;
+	while ((sent = sendmsg(sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+		;
+	return sent == sizeof(message) ? 0 : -1;
+}
+
+int gather_handover_receive(int sock, int* listener_fds, size_t* nr_listener_fds, int* state_fd)
+{
+	struct gather_handover_message message;
+	struct iovec iov = { .iov_base = &message, .iov_len = sizeof(message) };
+	int fds[1 + GATHER_LISTENER_MAX_ENDPOINTS];
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+
+	ssize_t received;
+	while ((received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+		;
+	if (received == -1)
+		return -1;
+
+	/* Take possession of any file descriptors received, so these can be closed if the message is invalid */
+	size_t nr_fds = 0;
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+		nr_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), nr_fds * sizeof(int));
+	}
+
+	if (
+		received != sizeof(message)
+		|| (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0
+		|| memcmp(message.magic, GATHER_HANDOVER_MAGIC, sizeof(message.magic)) != 0
+		|| message.version != CURRENT_GATHER_HANDOVER_VERSION
+		|| message.nr_fds != nr_fds
+		|| nr_fds < 1) {
+		for (size_t i = 0; i < nr_fds; i++)
+			close(fds[i]);
+		errno = (received == 0 ? ECONNRESET : EPROTO);
+		return -1;
+	}
+
+	*state_fd = fds[0];
+	*nr_listener_fds = nr_fds - 1;
+	memcpy(listener_fds, fds + 1, *nr_listener_fds * sizeof(int));
+	return 0;
+}
+
+int gather_handover_acknowledge(int sock)
+{
+	ssize_t sent;
+	while ((sent = send(sock, &gather_handover_ack, sizeof(gather_handover_ack), MSG_NOSIGNAL)) == -1 && errno == EINTR)
+		;
+	return sent == sizeof(gather_handover_ack) ? 0 : -1;
+}
+
+int gather_handover_wait(int sock, int timeout)
+{
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+	int result;
+	while ((result = poll(&pfd, 1, timeout)) == -1 && errno == EINTR)
+		;
+	if (result == -1)
+		return -1;
+	if (result == 0) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	char ack;
+	ssize_t received = recv(sock, &ack, sizeof(ack), MSG_DONTWAIT);
+	if (received == -1)
+		return -1;
+	if (received != sizeof(ack) || ack != gather_handover_ack) {
+		errno = ECONNRESET;
+		return -1;
+	}
+	return 0;
+}
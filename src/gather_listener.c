@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_listener.h"
+
+#include "inet.h"
+
+#include <sys/un.h>
+
+int gather_listener_parse(const char* endpoint, struct sockaddr_storage* addr, socklen_t* addr_len)
+{
+	memset(addr, 0, sizeof(*addr));
+
+	/* Unix socket paths are absolute, so these can't be mistaken for an address */
+	if (endpoint[0] == '/') {
+		struct sockaddr_un* un = (struct sockaddr_un*)addr;
+		size_t len = strlen(endpoint);
+		if (len >= sizeof(un->sun_path))
+			return -1;
+		un->sun_family = AF_UNIX;
+		memcpy(un->sun_path, endpoint, len + 1);
+		*addr_len = sizeof(*un);
+		return 0;
+	}
+
+	char text[INET6_ADDRSTRLEN + 16];
+	if (snprintf(text, sizeof(text), "%s", endpoint) >= (int)sizeof(text))
+		return -1;
+	sa_in46 sa;
+	memset(&sa, 0, sizeof(sa));
+	if (parse_ip_port(text, &sa, 1) == -1 || sa.any.port == 0)
+		return -1;
+	if (sa.any.af == AF_INET) {
+		memcpy(addr, &sa.ipv4, sizeof(sa.ipv4));
+		*addr_len = sizeof(sa.ipv4);
+	} else {
+		memcpy(addr, &sa.ipv6, sizeof(sa.ipv6));
+		*addr_len = sizeof(sa.ipv6);
+	}
+	return 0;
+}
+
+bool gather_listener_endpoints_are_valid(const char* endpoints)
+{
+	char* copy = strdup(endpoints);
+	if (copy == NULL)
+		return false;
+
+	size_t nr_endpoints = 0;
+	bool valid = true;
+	char* saveptr = NULL;
+	for (char* endpoint = strtok_r(copy, " \t", &saveptr); endpoint != NULL && valid; endpoint = strtok_r(NULL, " \t", &saveptr)) {
+		struct sockaddr_storage addr;
+		socklen_t addr_len;
+		valid = gather_listener_parse(endpoint, &addr, &addr_len) == 0 && ++nr_endpoints <= GATHER_LISTENER_MAX_ENDPOINTS;
+	}
+	free(copy);
+	return valid && nr_endpoints > 0;
+}
+
+int gather_listener_open(const struct sockaddr* addr, socklen_t addr_len, int backlog)
+{
+	int saved_errno;
+	int fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	if (addr->sa_family == AF_UNIX) {
+		/* If the Honas process was killed ungracefully, the socket file is still present */
+		const char* path = ((const struct sockaddr_un*)addr)->sun_path;
+		struct stat path_stat;
+		if (lstat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode) && unlink(path) == -1)
+			goto err_out;
+	} else {
+		/* Let several processes listen on the same port, with the kernel spreading the connections between them */
+		int on = 1;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1)
+			goto err_out;
+	}
+
+	if (bind(fd, addr, addr_len) == -1 || listen(fd, backlog) == -1)
+		goto err_out;
+	return fd;
+
+err_out:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+const char* gather_listener_name(int fd, char* buffer, size_t buffer_len)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	if (getsockname(fd, (struct sockaddr*)&addr, &addr_len) == -1) {
+		snprintf(buffer, buffer_len, "<unknown>");
+	} else if (addr.ss_family == AF_UNIX) {
+		snprintf(buffer, buffer_len, "%s", ((struct sockaddr_un*)&addr)->sun_path);
+	} else {
+		snprintf(buffer, buffer_len, "%s", str_addr_port((sa_in46*)&addr));
+	}
+	return buffer;
+}
+
+void gather_listener_unlink(int fd)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	if (getsockname(fd, (struct sockaddr*)&addr, &addr_len) == -1 || addr.ss_family != AF_UNIX)
+		return;
+
+	const char* path = ((struct sockaddr_un*)&addr)->sun_path;
+	if (path[0] == '/')
+		unlink(path);
+}
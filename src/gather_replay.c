@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_replay.h"
+
+#include "gather_session.h"
+
+#include <fstrm.h>
+
+int gather_replay_dnstap(const uint8_t* data, size_t size, gather_replay_frame_fn_t* process, void* arg, size_t* nr_frames)
+{
+	struct fstrm_control* control = fstrm_control_init();
+	if (control == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	int result = 1;
+	bool started = false;
+	size_t offset = 0;
+	uint32_t tmp[2];
+	*nr_frames = 0;
+	while (offset + sizeof(uint32_t) <= size) {
+		memcpy(&tmp[0], data + offset, sizeof(uint32_t));
+		const size_t len_payload = ntohl(tmp[0]);
+		if (len_payload > 0) {
+			/* A data frame, which is only valid after the start frame */
+			if (!started) {
+				errno = EBADMSG;
+				result = -1;
+				break;
+			}
+			if (len_payload > size - offset - sizeof(uint32_t))
+				break;
+			if (process(arg, data + offset + sizeof(uint32_t), len_payload) == -1) {
+				result = -1;
+				break;
+			}
+			offset += sizeof(uint32_t) + len_payload;
+			(*nr_frames)++;
+			continue;
+		}
+
+		/* A control frame: the escape sequence, its length and the control frame itself */
+		if (offset + 2 * sizeof(uint32_t) > size)
+			break;
+		memcpy(&tmp[0], data + offset, 2 * sizeof(uint32_t));
+		const size_t len_control = ntohl(tmp[1]);
+		if (len_control > FSTRM_CONTROL_FRAME_LENGTH_MAX) {
+			errno = EBADMSG;
+			result = -1;
+			break;
+		}
+		const size_t len_frame = 2 * sizeof(uint32_t) + len_control;
+		if (len_frame > size - offset)
+			break;
+
+		fstrm_control_type type;
+		if (fstrm_control_decode(control, data + offset, len_frame, FSTRM_CONTROL_FLAG_WITH_HEADER) != fstrm_res_success ||
+		    fstrm_control_get_type(control, &type) != fstrm_res_success ||
+		    (type == FSTRM_CONTROL_START &&
+		     fstrm_control_match_field_content_type(control, (const uint8_t*)GATHER_SESSION_CONTENT_TYPE, strlen(GATHER_SESSION_CONTENT_TYPE)) != fstrm_res_success)) {
+			errno = EBADMSG;
+			result = -1;
+			break;
+		}
+		offset += len_frame;
+		if (type == FSTRM_CONTROL_START) {
+			started = true;
+		} else if (type == FSTRM_CONTROL_STOP) {
+			result = 0;
+			break;
+		}
+	}
+
+	fstrm_control_destroy(&control);
+	return result;
+}
+
+void gather_replay_init(struct gather_replay* replay, honas_state_t* state, gather_replay_begin_period_fn_t* begin_period, gather_replay_end_period_fn_t* end_period, void* arg)
+{
+	memset(replay, 0, sizeof(*replay));
+	replay->state = state;
+	replay->begin_period = begin_period;
+	replay->end_period = end_period;
+	replay->arg = arg;
+}
+
+bool gather_replay_advance(struct gather_replay* replay, uint64_t timestamp)
+{
+	if (timestamp != 0)
+		replay->time = timestamp;
+	if (replay->time == 0)
+		return false;
+
+	if (replay->state->header != NULL) {
+		if (replay->time < replay->state->header->period_end)
+			return true;
+		replay->end_period(replay->arg, replay->state);
+	}
+	replay->nr_periods++;
+	replay->begin_period(replay->arg, replay->state, replay->time);
+	return true;
+}
+
+void gather_replay_finish(struct gather_replay* replay)
+{
+	if (replay->state->header != NULL)
+		replay->end_period(replay->arg, replay->state);
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_session.h"
+
+#include <event2/buffer.h>
+#include <fstrm.h>
+
+/* Ends a session whose sender violated the protocol */
+static int gather_session_violation(void)
+{
+	errno = EPROTO;
+	return -1;
+}
+
+/* Adds a control frame of the given type to the output */
+static int gather_session_reply(struct gather_session* session, fstrm_control_type type, struct evbuffer* output)
+{
+	uint8_t frame[FSTRM_CONTROL_FRAME_LENGTH_MAX];
+	size_t len_frame = sizeof(frame);
+
+	fstrm_control_reset(session->control);
+	if (fstrm_control_set_type(session->control, type) != fstrm_res_success)
+		goto err_out;
+	if (type == FSTRM_CONTROL_ACCEPT &&
+	    fstrm_control_add_field_content_type(session->control, (const uint8_t*)GATHER_SESSION_CONTENT_TYPE, strlen(GATHER_SESSION_CONTENT_TYPE)) != fstrm_res_success)
+		goto err_out;
+	if (fstrm_control_encode(session->control, frame, &len_frame, FSTRM_CONTROL_FLAG_WITH_HEADER) != fstrm_res_success)
+		goto err_out;
+	if (evbuffer_add(output, frame, len_frame) == -1) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+
+err_out:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Processes a control frame (including its escape sequence and length) */
+static int gather_session_control_frame(struct gather_session* session, const uint8_t* frame, size_t len_frame, struct evbuffer* output)
+{
+	fstrm_control_type type;
+	if (fstrm_control_decode(session->control, frame, len_frame, FSTRM_CONTROL_FLAG_WITH_HEADER) != fstrm_res_success ||
+	    fstrm_control_get_type(session->control, &type) != fstrm_res_success)
+		return gather_session_violation();
+
+	switch (session->state) {
+	case GATHER_SESSION_READING_CONTROL_READY:
+		/* The sender should be able to send dnstap data, which we accept */
+		if (type != FSTRM_CONTROL_READY ||
+		    fstrm_control_match_field_content_type(session->control, (const uint8_t*)GATHER_SESSION_CONTENT_TYPE, strlen(GATHER_SESSION_CONTENT_TYPE)) != fstrm_res_success)
+			return gather_session_violation();
+		if (gather_session_reply(session, FSTRM_CONTROL_ACCEPT, output) == -1)
+			return -1;
+		session->state = GATHER_SESSION_READING_CONTROL_START;
+		return 0;
+
+	case GATHER_SESSION_READING_CONTROL_START:
+		if (type != FSTRM_CONTROL_START ||
+		    fstrm_control_match_field_content_type(session->control, (const uint8_t*)GATHER_SESSION_CONTENT_TYPE, strlen(GATHER_SESSION_CONTENT_TYPE)) != fstrm_res_success)
+			return gather_session_violation();
+		session->state = GATHER_SESSION_READING_DATA;
+		return 0;
+
+	case GATHER_SESSION_READING_DATA:
+		if (type != FSTRM_CONTROL_STOP)
+			return gather_session_violation();
+		if (gather_session_reply(session, FSTRM_CONTROL_FINISH, output) == -1)
+			return -1;
+		session->state = GATHER_SESSION_STOPPED;
+		return 0;
+
+	default:
+		return gather_session_violation();
+	}
+}
+
+int gather_session_init(struct gather_session* session, gather_session_frame_fn_t* process, void* arg)
+{
+	memset(session, 0, sizeof(*session));
+	session->control = fstrm_control_init();
+	if (session->control == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	session->state = GATHER_SESSION_READING_CONTROL_READY;
+	session->process = process;
+	session->arg = arg;
+	return 0;
+}
+
+void gather_session_destroy(struct gather_session* session)
+{
+	if (session->control != NULL)
+		fstrm_control_destroy(&session->control);
+}
+
+int gather_session_process(struct gather_session* session, struct evbuffer* input, struct evbuffer* output)
+{
+	uint32_t tmp[2];
+
+	while (session->state != GATHER_SESSION_STOPPED) {
+		const size_t len_buf = evbuffer_get_length(input);
+
+		/* Skip the rest of an oversized data frame */
+		if (session->bytes_skip > 0) {
+			const size_t skip = MIN(session->bytes_skip, len_buf);
+			if (skip == 0)
+				return 0;
+			evbuffer_drain(input, skip);
+			session->bytes_skip -= skip;
+			continue;
+		}
+
+		/* Every frame starts with its length, which is 0 for control frames */
+		if (len_buf < sizeof(uint32_t))
+			return 0;
+		evbuffer_copyout(input, &tmp[0], sizeof(uint32_t));
+		const size_t len_payload = ntohl(tmp[0]);
+
+		if (len_payload > 0) {
+			/* Data frames are only sent between the START and STOP control frames */
+			if (session->state != GATHER_SESSION_READING_DATA)
+				return gather_session_violation();
+
+			/* A data frame that doesn't fit in the input buffer is skipped as it arrives */
+			const size_t len_frame = sizeof(uint32_t) + len_payload;
+			if (len_frame > GATHER_SESSION_MAX_FRAME_SIZE) {
+				session->bytes_skip = len_frame;
+				continue;
+			}
+			if (len_buf < len_frame)
+				return 0;
+
+			const uint8_t* frame = evbuffer_pullup(input, len_frame);
+			if (frame == NULL) {
+				errno = ENOMEM;
+				return -1;
+			}
+			session->process(session->arg, frame + sizeof(uint32_t), len_payload);
+			evbuffer_drain(input, len_frame);
+			session->count_read++;
+			session->bytes_read += len_payload;
+			continue;
+		}
+
+		/* A control frame: the escape sequence, its length and the control frame itself */
+		if (len_buf < 2 * sizeof(uint32_t))
+			return 0;
+		evbuffer_copyout(input, &tmp[0], 2 * sizeof(uint32_t));
+		const size_t len_control = ntohl(tmp[1]);
+		if (len_control < sizeof(uint32_t) || len_control > FSTRM_CONTROL_FRAME_LENGTH_MAX)
+			return gather_session_violation();
+		const size_t len_frame = 2 * sizeof(uint32_t) + len_control;
+		if (len_buf < len_frame)
+			return 0;
+
+		const uint8_t* frame = evbuffer_pullup(input, len_frame);
+		if (frame == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		if (gather_session_control_frame(session, frame, len_frame, output) == -1)
+			return -1;
+		evbuffer_drain(input, len_frame);
+	}
+
+	return 1;
+}
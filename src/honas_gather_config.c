@@ -27,19 +27,26 @@
 
 #include "honas_gather_config.h"
 
+#include "gather_listener.h"
 #include "logging.h"
+#include "overload.h"
 #include "utils.h"
 
 void honas_gather_config_init(honas_gather_config_t* config)
 {
 	config->bloomfilter_path = NULL;
 	config->subnet_activity_path = NULL;
+	config->live_view_name = NULL;
+	config->listen = NULL;
+	config->overload_sampling = NULL;
 	config->period_length = 0;
 	config->number_of_filters = 0;
 	config->number_of_bits_per_filter = 0;
 	config->number_of_hashes = 0;
 	config->number_of_filters_per_user = 0;
 	config->flatten_threshold = 0;
+	config->summary_size = 0;
+	config->shared_block_size = 0;
 }
 
 static char* string_value(char* keyword, char* value)
@@ -78,14 +85,28 @@ int honas_gather_config_parse_item(const char* UNUSED(filename), honas_gather_co
 	if (strcmp(keyword, "subnet_activity_path") == 0 && config->subnet_activity_path != NULL)
 		free(config->subnet_activity_path);
 
+	if (strcmp(keyword, "live_view_name") == 0 && config->live_view_name != NULL)
+		free(config->live_view_name);
+
+	if (strcmp(keyword, "listen") == 0 && config->listen != NULL)
+		free(config->listen);
+
+	if (strcmp(keyword, "overload_sampling") == 0 && config->overload_sampling != NULL)
+		free(config->overload_sampling);
+
 	_config_parse_and_check_value(bloomfilter_path, string_value, strlen(value) > 0);
 	_config_parse_and_check_value(subnet_activity_path, string_value, strlen(value) > 0);
+	_config_parse_and_check_value(live_view_name, string_value, strlen(value) > 0);
+	_config_parse_and_check_value(listen, string_value, gather_listener_endpoints_are_valid(value));
+	_config_parse_and_check_value(overload_sampling, string_value, overload_policy_is_valid(value));
 	_config_parse_and_check_value(period_length, uint32_value, value > 0);
 	_config_parse_and_check_value(number_of_filters, uint32_value, value > 0);
 	_config_parse_and_check_value(number_of_bits_per_filter, uint32_value, value > 0);
 	_config_parse_and_check_value(number_of_hashes, uint32_value, value > 0);
 	_config_parse_and_check_value(number_of_filters_per_user, uint32_value, value > 0);
 	_config_parse_and_check_value(flatten_threshold, uint32_value, value > 0);
+	_config_parse_and_check_value(summary_size, uint32_value, true);
+	_config_parse_and_check_value(shared_block_size, uint32_value, value == 0 || (value >= HONAS_STATE_MIN_SHARED_BLOCK_SIZE && (value & (value - 1)) == 0));
 	return parsed;
 }
 
@@ -124,4 +145,22 @@ void honas_gather_config_destroy(honas_gather_config_t* config)
 		free(config->subnet_activity_path);
 		config->subnet_activity_path = NULL;
 	}
+
+	if (config->live_view_name != NULL)
+	{
+		free(config->live_view_name);
+		config->live_view_name = NULL;
+	}
+
+	if (config->listen != NULL)
+	{
+		free(config->listen);
+		config->listen = NULL;
+	}
+
+	if (config->overload_sampling != NULL)
+	{
+		free(config->overload_sampling);
+		config->overload_sampling = NULL;
+	}
 }
@@ -29,10 +29,14 @@
 #include "bitset.h"
 #include "bloom.h"
 #include "combinations.h"
+#include "crc32c.h"
 #include "logging.h"
+#include "sealed_state.h"
 
 #include <ctype.h>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
+#include <sched.h>
 
 #if BYTE_ORDER != LITTLE_ENDIAN
 #error The currrent implementation only works properly on a little endian machine!
@@ -62,6 +66,65 @@ static size_t honas_state_file_size(uint32_t first_filter_offset, uint32_t paddi
 		+ host_name_hll_size + padding_after_host_name_hll;
 }
 
+/* Determine the location of the filters and hyperloglog data in a version 1 honas state */
+static void honas_state_init_v1(honas_state_t* state)
+{
+	uint32_t filter_size = honas_state_stored_bits_per_filter(state) >> 3;
+	assert(state->size >= honas_state_file_size(state->header->first_filter_offset, state->header->padding_after_filters, state->header->number_of_filters, honas_state_stored_bits_per_filter(state), state->header->client_hll_size,
+							  state->header->padding_after_client_hll, state->header->host_name_hll_size, state->header->padding_after_host_name_hll));
+
+	for (uint32_t i = 0; i < state->header->number_of_filters; i++) {
+		size_t filter_begin = state->header->first_filter_offset
+			+ i * state->header->padding_after_filters
+			+ i * filter_size;
+		assert((filter_begin + filter_size) <= state->size);
+		state->filters[i] = byte_slice((uint8_t*)state->mmap + filter_begin, filter_size);
+	}
+	/* NOTE: Version 1 state files place the client hyperloglog data without taking the first filter offset into account */
+	state->client_count_registers = byte_slice((uint8_t*)state->mmap + (filter_size + state->header->padding_after_filters) * state->header->number_of_filters, state->header->client_hll_size);
+	state->host_name_count_registers = byte_slice((uint8_t*)state->client_count_registers.bytes + state->header->client_hll_size + state->header->padding_after_client_hll, state->header->host_name_hll_size);
+	state->filter_bits_set = (uint32_t*)((uint8_t*)state->mmap + sizeof(struct honas_state_file_header));
+}
+
+/* Determine the location of the filters and hyperloglog data in a version 2 honas state
+ *
+ * The section table should already have been validated.
+ */
+static void honas_state_init_v2(honas_state_t* state)
+{
+	uint32_t filter = 0;
+	const struct honas_state_section* section;
+	for (uint32_t i = 0; (section = honas_state_get_section(state, i)) != NULL; i++) {
+		byte_slice_t data = honas_state_section_data(state, section);
+		switch (section->type) {
+		case HONAS_STATE_SECTION_FILTER_BITS_SET:
+			state->filter_bits_set = (uint32_t*)data.bytes;
+			break;
+		case HONAS_STATE_SECTION_FILTER:
+			assert(filter < state->header->number_of_filters);
+			state->filters[filter++] = data;
+			break;
+		case HONAS_STATE_SECTION_CLIENT_HLL:
+			state->client_count_registers = data;
+			break;
+		case HONAS_STATE_SECTION_HOST_NAME_HLL:
+			state->host_name_count_registers = data;
+			break;
+		case HONAS_STATE_SECTION_SAMPLING:
+			state->sampling = (struct honas_state_sampling*)data.bytes;
+			break;
+		case HONAS_STATE_SECTION_OFFSET_SCHEME:
+			if (((const struct honas_state_offset_scheme*)data.bytes)->offset_scheme == HONAS_STATE_OFFSET_SCHEME_SHARED_BLOCKS)
+				state->shared_block_size = ((const struct honas_state_offset_scheme*)data.bytes)->block_size;
+			break;
+		}
+	}
+	assert(filter == state->header->number_of_filters);
+	assert(state->filter_bits_set != NULL);
+	assert(state->client_count_registers.bytes != NULL);
+	assert(state->host_name_count_registers.bytes != NULL);
+}
+
 static void honas_state_init_common(honas_state_t* state)
 {
 	assert(state->mmap != NULL);
@@ -69,31 +132,41 @@ static void honas_state_init_common(honas_state_t* state)
 	assert(state->header != NULL);
 	assert(state->filters == NULL);
 
-//	log_msg(ERR, "First filter offset: %zu, padding after filters: %zu, number of filters: %zu, size (m): %zu, client hll size: %zu, hll padding: %zu, hostname_hll_size: %zu, padding_after_hostname_hll: %zu. state size: %zu, all together: %zu",
-//		state->header->first_filter_offset, state->header->padding_after_filters, state->header->number_of_filters, state->header->number_of_bits_per_filter, state->header->client_hll_size, state->header->padding_after_client_hll,
-//		state->header->host_name_hll_size, state->header->padding_after_host_name_hll, state->size , honas_state_file_size(state->header->first_filter_offset, state->header->padding_after_filters, state->header->number_of_filters,
-//                                                          state->header->number_of_bits_per_filter, state->header->client_hll_size, state->header->padding_after_client_hll, state->header->host_name_hll_size, state->header->padding_after_host_name_hll));
-
-	assert(state->size >= honas_state_file_size(state->header->first_filter_offset, state->header->padding_after_filters, state->header->number_of_filters, state->header->number_of_bits_per_filter, state->header->client_hll_size,
-							  state->header->padding_after_client_hll, state->header->host_name_hll_size, state->header->padding_after_host_name_hll));
-
 	state->filters = (byte_slice_t*)calloc(state->header->number_of_filters, sizeof(byte_slice_t));
 	log_passert(state->filters != NULL, "Failed to allocation honas state filters");
 
-	for (uint32_t i = 0; i < state->header->number_of_filters; i++) {
-		size_t filter_begin = state->header->first_filter_offset
-			+ i * state->header->padding_after_filters
-			+ i * (state->header->number_of_bits_per_filter >> 3);
-		assert((filter_begin + (state->header->number_of_bits_per_filter >> 3)) <= state->size);
-		state->filters[i] = byte_slice((uint8_t*)state->mmap + filter_begin, state->header->number_of_bits_per_filter >> 3);
-	}
-	state->client_count_registers = byte_slice((uint8_t*)state->mmap + ((state->header->number_of_bits_per_filter >> 3) + state->header->padding_after_filters) * state->header->number_of_filters, state->header->client_hll_size);
-	state->host_name_count_registers = byte_slice((uint8_t*)state->client_count_registers.bytes + state->header->client_hll_size + state->header->padding_after_client_hll, state->header->host_name_hll_size);
+	if (state->section_table != NULL)
+		honas_state_init_v2(state);
+	else
+		honas_state_init_v1(state);
 	state->nr_filters_per_user_combinations = number_of_combinations(state->header->number_of_filters, state->header->number_of_filters_per_user);
-	state->filter_bits_set = (uint32_t*)((uint8_t*)state->mmap + sizeof(struct honas_state_file_header));
 }
 
-int honas_state_create(honas_state_t* state, uint32_t number_of_filters, uint32_t number_of_bits_per_filter, uint32_t number_of_hashes, uint32_t number_of_filters_per_user, uint32_t flatten_threshold)
+/* Whether the filters (of `filter_size` bytes) can be divided into shared blocks of `block_size` bytes */
+static bool honas_state_shared_block_size_is_valid(uint64_t block_size, uint64_t filter_size)
+{
+	return block_size >= HONAS_STATE_MIN_SHARED_BLOCK_SIZE && (block_size & (block_size - 1)) == 0 && filter_size % block_size == 0;
+}
+
+/* The offset scheme of a newly created honas state is located directly after its sampling information */
+static size_t honas_state_offset_scheme_offset(size_t sampling_offset)
+{
+	return round_up_to_factor_of_two(sampling_offset + sizeof(struct honas_state_sampling), 3);
+}
+
+/* Add a section to the section table of a honas state that's being created */
+static void honas_state_add_section(struct honas_state_section* sections, uint32_t* nr_sections, uint32_t type, uint32_t flags, uint64_t offset, uint64_t length)
+{
+	struct honas_state_section* section = &sections[(*nr_sections)++];
+	section->type = type;
+	section->flags = flags;
+	section->offset = offset;
+	section->length = length;
+	section->checksum = 0;
+	section->reserved = 0;
+}
+
+int honas_state_create_folded(honas_state_t* state, uint32_t number_of_filters, uint32_t number_of_bits_per_filter, uint32_t number_of_hashes, uint32_t number_of_filters_per_user, uint32_t flatten_threshold, uint32_t fold_factor)
 {
 	assert(state->mmap == NULL);
 	assert(state->header == NULL);
@@ -103,18 +176,28 @@ int honas_state_create(honas_state_t* state, uint32_t number_of_filters, uint32_
 	assert((number_of_bits_per_filter & 0x7) == 0);
 	assert(number_of_hashes > 0);
 	assert(number_of_filters_per_user > 0);
+	assert(fold_factor <= HONAS_STATE_MAX_FOLD_FACTOR);
+	assert((number_of_bits_per_filter % (8U << fold_factor)) == 0);
 	int saved_errno;
 	int err_return = -1;
-
-	/* Make sure the filters begin on new page after the state file header */
-	uint32_t first_filter_offset = round_up_to_factor_of_two(sizeof(struct honas_state_file_header) + sizeof(uint32_t) * number_of_filters, PAGE_SHIFT);
-
-	/* Make sure each filter starts on a new page after the previous one */
-	uint32_t padding_after_filters = round_up_to_factor_of_two(number_of_bits_per_filter >> 3, PAGE_SHIFT) - (number_of_bits_per_filter >> 3);
-	uint32_t padding_after_client_hll = round_up_to_factor_of_two(HLL_DENSE_SIZE, PAGE_SHIFT) - HLL_DENSE_SIZE;
-	uint32_t padding_after_host_name_hll = round_up_to_factor_of_two(HLL_DENSE_SIZE, PAGE_SHIFT) - HLL_DENSE_SIZE;
-
-	state->size = honas_state_file_size(first_filter_offset, padding_after_filters, number_of_filters, number_of_bits_per_filter, HLL_DENSE_SIZE, padding_after_client_hll, HLL_DENSE_SIZE, padding_after_host_name_hll);
+	uint32_t filter_size = (number_of_bits_per_filter >> 3) >> fold_factor;
+	uint32_t nr_sections = number_of_filters + 4;
+
+	/* The section table directly follows the header; the filter bits set counters, the sampling information and the
+	 * offset scheme follow the section table (leaving room for the offset scheme section `honas_state_use_shared_blocks()`
+	 * and the summary section `honas_state_persist()` may add) */
+	size_t section_table_offset = sizeof(struct honas_state_file_header);
+	size_t filter_bits_set_offset = round_up_to_factor_of_two(section_table_offset + sizeof(struct honas_state_section_table) + sizeof(struct honas_state_section) * (nr_sections + 2), 3);
+	size_t sampling_offset = round_up_to_factor_of_two(filter_bits_set_offset + sizeof(uint32_t) * number_of_filters, 3);
+	size_t offset_scheme_offset = honas_state_offset_scheme_offset(sampling_offset);
+
+	/* Make sure the filters and hyperloglog data each begin on a new page */
+	size_t first_filter_offset = round_up_to_factor_of_two(offset_scheme_offset + sizeof(struct honas_state_offset_scheme), PAGE_SHIFT);
+	size_t filter_stride = round_up_to_factor_of_two(filter_size, PAGE_SHIFT);
+	size_t client_hll_offset = first_filter_offset + filter_stride * number_of_filters;
+	size_t host_name_hll_offset = client_hll_offset + round_up_to_factor_of_two(HLL_DENSE_SIZE, PAGE_SHIFT);
+
+	state->size = host_name_hll_offset + round_up_to_factor_of_two(HLL_DENSE_SIZE, PAGE_SHIFT);
 	if ((state->mmap = mmap(NULL, state->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
 		goto err_out;
 
@@ -123,8 +206,6 @@ int honas_state_create(honas_state_t* state, uint32_t number_of_filters, uint32_
 	state->header->major_version = CURRENT_HONAS_STATE_MAJOR_VERSION;
 	state->header->minor_version = CURRENT_HONAS_STATE_MINOR_VERSION;
 
-	state->header->first_filter_offset = first_filter_offset;
-	state->header->padding_after_filters = padding_after_filters;
 	state->header->number_of_filters = number_of_filters;
 	state->header->number_of_bits_per_filter = number_of_bits_per_filter;
 	state->header->number_of_hashes = number_of_hashes;
@@ -132,14 +213,28 @@ int honas_state_create(honas_state_t* state, uint32_t number_of_filters, uint32_
 	state->header->flatten_threshold = flatten_threshold;
 
 	state->header->client_hll_size = HLL_DENSE_SIZE;
-	state->header->padding_after_client_hll = padding_after_client_hll;
 	state->header->host_name_hll_size = HLL_DENSE_SIZE;
-	state->header->padding_after_host_name_hll = padding_after_host_name_hll;
+
+	/* Fill the section table */
+	state->section_table = (struct honas_state_section_table*)((uint8_t*)state->mmap + section_table_offset);
+	state->section_table->section_size = sizeof(struct honas_state_section);
+	struct honas_state_section* sections = (struct honas_state_section*)(state->section_table + 1);
+	uint32_t nr_added = 0;
+	honas_state_add_section(sections, &nr_added, HONAS_STATE_SECTION_FILTER_BITS_SET, HONAS_STATE_SECTION_FLAG_REQUIRED, filter_bits_set_offset, sizeof(uint32_t) * number_of_filters);
+	for (uint32_t i = 0; i < number_of_filters; i++)
+		honas_state_add_section(sections, &nr_added, HONAS_STATE_SECTION_FILTER, HONAS_STATE_SECTION_FLAG_REQUIRED, first_filter_offset + filter_stride * i, filter_size);
+	honas_state_add_section(sections, &nr_added, HONAS_STATE_SECTION_CLIENT_HLL, HONAS_STATE_SECTION_FLAG_REQUIRED, client_hll_offset, HLL_DENSE_SIZE);
+	honas_state_add_section(sections, &nr_added, HONAS_STATE_SECTION_HOST_NAME_HLL, HONAS_STATE_SECTION_FLAG_REQUIRED, host_name_hll_offset, HLL_DENSE_SIZE);
+	honas_state_add_section(sections, &nr_added, HONAS_STATE_SECTION_SAMPLING, 0, sampling_offset, sizeof(struct honas_state_sampling));
+	assert(nr_added == nr_sections);
+	state->section_table->number_of_sections = nr_sections;
+	state->fold_factor = fold_factor;
 
 	hllInit(&state->client_count);
 	hllInit(&state->host_name_count);
 
 	honas_state_init_common(state);
+	state->sampling->sampling_rate = 1;
 	return 0;
 
 err_out:
@@ -149,6 +244,453 @@ err_out:
 	return err_return;
 }
 
+int honas_state_create(honas_state_t* state, uint32_t number_of_filters, uint32_t number_of_bits_per_filter, uint32_t number_of_hashes, uint32_t number_of_filters_per_user, uint32_t flatten_threshold)
+{
+	return honas_state_create_folded(state, number_of_filters, number_of_bits_per_filter, number_of_hashes, number_of_filters_per_user, flatten_threshold, 0);
+}
+
+int honas_state_use_shared_blocks(honas_state_t* state, uint32_t block_size)
+{
+	assert(state->section_table != NULL);
+	assert(state->section_table->number_of_sections == state->header->number_of_filters + 4);
+	assert(state->header->number_of_requests == 0);
+	if (!honas_state_shared_block_size_is_valid(block_size, state->filters[0].len)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* The section table of a newly created state has room for the offset scheme section */
+	const struct honas_state_section* sampling = honas_state_find_section(state, HONAS_STATE_SECTION_SAMPLING, 0);
+	assert(sampling != NULL);
+	size_t offset_scheme_offset = honas_state_offset_scheme_offset(sampling->offset);
+	struct honas_state_offset_scheme* offset_scheme = (struct honas_state_offset_scheme*)((uint8_t*)state->mmap + offset_scheme_offset);
+	offset_scheme->offset_scheme = HONAS_STATE_OFFSET_SCHEME_SHARED_BLOCKS;
+	offset_scheme->block_size = block_size;
+
+	struct honas_state_section* sections = (struct honas_state_section*)(state->section_table + 1);
+	uint32_t nr_sections = state->section_table->number_of_sections;
+	honas_state_add_section(sections, &nr_sections, HONAS_STATE_SECTION_OFFSET_SCHEME, HONAS_STATE_SECTION_FLAG_REQUIRED, offset_scheme_offset, sizeof(struct honas_state_offset_scheme));
+	state->section_table->number_of_sections = nr_sections;
+	state->shared_block_size = block_size;
+	return 0;
+}
+
+bool honas_state_header_fold_factor(const struct honas_state_file_header* header, size_t header_size, uint32_t* fold_factor)
+{
+	*fold_factor = 0;
+	if (header->major_version != LEGACY_HONAS_STATE_MAJOR_VERSION)
+		return false;
+
+	/* The header extension was added in version 1.1 */
+	if (header->minor_version < 1)
+		return true;
+
+	size_t extension_offset = sizeof(struct honas_state_file_header) + sizeof(uint32_t) * (size_t)header->number_of_filters;
+	if (header_size < extension_offset + HONAS_STATE_FILE_HEADER_EXTENSION_MIN_SIZE)
+		return false;
+
+	const struct honas_state_file_header_extension* extension = (const struct honas_state_file_header_extension*)((const uint8_t*)header + extension_offset);
+	if (
+		extension->extension_size < HONAS_STATE_FILE_HEADER_EXTENSION_MIN_SIZE
+		|| extension->fold_factor > HONAS_STATE_MAX_FOLD_FACTOR
+		|| (header->number_of_bits_per_filter % (8U << extension->fold_factor)) != 0)
+		return false;
+
+	*fold_factor = extension->fold_factor;
+	return true;
+}
+
+/* Locate the sampling information in the header extension of a version 1 honas state file header (if any) */
+static struct honas_state_sampling* honas_state_header_sampling(const struct honas_state_file_header* header, size_t header_size)
+{
+	size_t extension_offset = sizeof(struct honas_state_file_header) + sizeof(uint32_t) * (size_t)header->number_of_filters;
+	if (header->minor_version < 1 || header_size < extension_offset + sizeof(struct honas_state_file_header_extension))
+		return NULL;
+
+	struct honas_state_file_header_extension* extension = (struct honas_state_file_header_extension*)((uint8_t*)header + extension_offset);
+	if (extension->extension_size < sizeof(struct honas_state_file_header_extension))
+		return NULL;
+	return &extension->sampling;
+}
+
+static bool honas_state_header_is_valid(const struct honas_state_file_header* header)
+{
+	return header->number_of_filters > 0
+		&& header->number_of_bits_per_filter > 0
+		&& (header->number_of_bits_per_filter & 0x7) == 0
+		&& header->number_of_hashes > 0
+		&& header->client_hll_size == ((uint32_t)HLL_DENSE_SIZE)
+		&& header->host_name_hll_size == ((uint32_t)HLL_DENSE_SIZE);
+}
+
+/* Check the version 1 specific layout information in a honas state file header */
+static bool honas_state_header_v1_layout_is_valid(const struct honas_state_file_header* header, size_t size, uint32_t fold_factor)
+{
+	return header->first_filter_offset >= sizeof(struct honas_state_file_header)
+		&& size >= honas_state_file_size(
+					   header->first_filter_offset,
+					   header->padding_after_filters,
+					   header->number_of_filters,
+					   header->number_of_bits_per_filter >> fold_factor,
+					   header->client_hll_size,
+					   header->padding_after_client_hll,
+					   header->host_name_hll_size,
+					   header->padding_after_host_name_hll);
+}
+
+/* Check if a region of `length` bytes at `offset` lies inside a file of `size` bytes */
+static bool region_is_valid(size_t size, uint64_t offset, uint64_t length)
+{
+	return offset <= size && length <= size - offset;
+}
+
+/* Validate the section table of the version 2 honas state that has been `mmap()`-ed in `state`
+ *
+ * On success the fold factor of the honas state has been determined.
+ */
+static bool honas_state_section_table_is_valid(honas_state_t* state)
+{
+	const struct honas_state_file_header* header = state->header;
+	if (!region_is_valid(state->size, sizeof(struct honas_state_file_header), sizeof(struct honas_state_section_table)))
+		return false;
+
+	const struct honas_state_section_table* table = state->section_table;
+	if (
+		table->section_size < sizeof(struct honas_state_section)
+		|| !region_is_valid(state->size, sizeof(struct honas_state_file_header) + sizeof(struct honas_state_section_table), (uint64_t)table->number_of_sections * table->section_size))
+		return false;
+
+	uint32_t nr_filters = 0, nr_filter_bits_set = 0, nr_client_hll = 0, nr_host_name_hll = 0, nr_summaries = 0, nr_sampling = 0, nr_offset_schemes = 0;
+	uint64_t filter_size = 0, summary_size = 0, shared_block_size = 0;
+	const struct honas_state_section* section;
+	for (uint32_t i = 0; (section = honas_state_get_section(state, i)) != NULL; i++) {
+		if (!region_is_valid(state->size, section->offset, section->length))
+			return false;
+
+		switch (section->type) {
+		case HONAS_STATE_SECTION_FILTER_BITS_SET:
+			if (section->length != sizeof(uint32_t) * (uint64_t)header->number_of_filters || (section->offset & 0x7) != 0)
+				return false;
+			nr_filter_bits_set++;
+			break;
+		case HONAS_STATE_SECTION_FILTER:
+			if (nr_filters == 0)
+				filter_size = section->length;
+			if (section->length != filter_size || (section->offset & 0x7) != 0)
+				return false;
+			nr_filters++;
+			break;
+		case HONAS_STATE_SECTION_CLIENT_HLL:
+			if (section->length != header->client_hll_size)
+				return false;
+			nr_client_hll++;
+			break;
+		case HONAS_STATE_SECTION_HOST_NAME_HLL:
+			if (section->length != header->host_name_hll_size)
+				return false;
+			nr_host_name_hll++;
+			break;
+		case HONAS_STATE_SECTION_SUMMARY:
+			if (section->length == 0 || (section->offset & 0x7) != 0)
+				return false;
+			summary_size = section->length;
+			nr_summaries++;
+			break;
+		case HONAS_STATE_SECTION_SAMPLING:
+			if (section->length < sizeof(struct honas_state_sampling) || (section->offset & 0x7) != 0)
+				return false;
+			nr_sampling++;
+			break;
+		case HONAS_STATE_SECTION_OFFSET_SCHEME: {
+			if (section->length < sizeof(struct honas_state_offset_scheme) || (section->offset & 0x7) != 0)
+				return false;
+			const struct honas_state_offset_scheme* offset_scheme = (const struct honas_state_offset_scheme*)((const uint8_t*)state->mmap + section->offset);
+			if (offset_scheme->offset_scheme > HONAS_STATE_OFFSET_SCHEME_SHARED_BLOCKS)
+				return false;
+			if (offset_scheme->offset_scheme == HONAS_STATE_OFFSET_SCHEME_SHARED_BLOCKS)
+				shared_block_size = offset_scheme->block_size;
+			nr_offset_schemes++;
+			break;
+		}
+		default:
+			/* Sections of unknown types are skipped, unless they are required */
+			if (section->flags & HONAS_STATE_SECTION_FLAG_REQUIRED)
+				return false;
+			break;
+		}
+	}
+	if (nr_filter_bits_set != 1 || nr_filters != header->number_of_filters || nr_client_hll != 1 || nr_host_name_hll != 1 || nr_summaries > 1 || nr_sampling > 1 || nr_offset_schemes > 1)
+		return false;
+
+	/* The shared blocks divide the stored filters */
+	if (shared_block_size != 0 && !honas_state_shared_block_size_is_valid(shared_block_size, filter_size))
+		return false;
+
+	/* The summary is the filters folded in half at least once */
+	if (nr_summaries == 1 && (summary_size >= filter_size || filter_size % summary_size != 0 || ((filter_size / summary_size) & (filter_size / summary_size - 1)) != 0))
+		return false;
+
+	/* The fold factor follows from the size of the stored filters */
+	for (uint32_t fold_factor = 0; fold_factor <= HONAS_STATE_MAX_FOLD_FACTOR; fold_factor++) {
+		if ((header->number_of_bits_per_filter % (8U << fold_factor)) == 0 && filter_size == ((header->number_of_bits_per_filter >> 3) >> fold_factor)) {
+			state->fold_factor = fold_factor;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Load the sealed honas state that has been `mmap()`-ed in `state`
+ *
+ * When loading read-only, the sealed state is used as is. Otherwise the sealed
+ * state is decompressed into a newly created (unsealed) state which then
+ * replaces the sealed one.
+ */
+static int honas_state_load_sealed(honas_state_t* state, bool read_only)
+{
+	state->sealed = (honas_sealed_state_t*)calloc(1, sizeof(honas_sealed_state_t));
+	log_passert(state->sealed != NULL, "Failed to allocate sealed honas state");
+
+	int result = honas_sealed_state_open(state->sealed, state->mmap, state->size, DEFAULT_SEALED_STATE_CACHE_BLOCKS);
+	if (result != 0)
+		return result;
+
+	const struct honas_state_file_header* header = state->sealed->state_header;
+	if (
+		memcmp(header->file_magic, HONAS_STATE_FILE_MAGIC, sizeof(header->file_magic)) != 0
+		|| header->major_version != LEGACY_HONAS_STATE_MAJOR_VERSION)
+		return 1;
+	if (!honas_state_header_is_valid(header) || !honas_state_header_fold_factor(header, state->sealed->header->state_header_size, &state->fold_factor))
+		return 2;
+	byte_slice_t client_hll_data = honas_sealed_state_client_hll_data(state->sealed);
+	byte_slice_t host_name_hll_data = honas_sealed_state_host_name_hll_data(state->sealed);
+	struct honas_state_sampling* sampling = honas_state_header_sampling(header, state->sealed->header->state_header_size);
+
+	if (read_only) {
+		state->sampling = sampling;
+		state->shared_block_size = state->sealed->shared_block_size;
+		state->summary = state->sealed->summary;
+		state->header = (struct honas_state_file_header*)header;
+		state->filter_bits_set = (uint32_t*)(header + 1);
+		state->client_count_registers = client_hll_data;
+		state->host_name_count_registers = host_name_hll_data;
+		state->nr_filters_per_user_combinations = number_of_combinations(header->number_of_filters, header->number_of_filters_per_user);
+		hllInitFromBuffer(&state->client_count, state->client_count_registers);
+		hllInitFromBuffer(&state->host_name_count, state->host_name_count_registers);
+		return 0;
+	}
+
+	honas_state_t unsealed = { 0 };
+	if (honas_state_create_folded(&unsealed, header->number_of_filters, header->number_of_bits_per_filter, header->number_of_hashes, header->number_of_filters_per_user, header->flatten_threshold, state->fold_factor) == -1)
+		return -1;
+	if (state->sealed->shared_block_size != 0 && honas_state_use_shared_blocks(&unsealed, state->sealed->shared_block_size) == -1) {
+		honas_state_destroy(&unsealed);
+		return 2;
+	}
+	unsealed.header->period_begin = header->period_begin;
+	unsealed.header->period_end = header->period_end;
+	unsealed.header->first_request = header->first_request;
+	unsealed.header->last_request = header->last_request;
+	unsealed.header->number_of_requests = header->number_of_requests;
+	unsealed.header->estimated_number_of_clients = header->estimated_number_of_clients;
+	unsealed.header->estimated_number_of_host_names = header->estimated_number_of_host_names;
+	memcpy(unsealed.filter_bits_set, header + 1, sizeof(uint32_t) * header->number_of_filters);
+	if (sampling != NULL)
+		*unsealed.sampling = *sampling;
+
+	for (uint32_t i = 0; i < header->number_of_filters; i++) {
+		if (honas_sealed_state_decompress_filter(state->sealed, i, unsealed.filters[i]) == -1) {
+			honas_state_destroy(&unsealed);
+			return 2;
+		}
+	}
+
+	hllDestroy(&unsealed.client_count);
+	hllDestroy(&unsealed.host_name_count);
+	memcpy(unsealed.client_count_registers.bytes, client_hll_data.bytes, client_hll_data.len);
+	memcpy(unsealed.host_name_count_registers.bytes, host_name_hll_data.bytes, host_name_hll_data.len);
+	hllInitFromBuffer(&unsealed.client_count, unsealed.client_count_registers);
+	hllInitFromBuffer(&unsealed.host_name_count, unsealed.host_name_count_registers);
+
+	if (mlock(unsealed.mmap, unsealed.size) == -1)
+		log_perror(INFO, "Unable to mlock honas state");
+
+	/* Replace the sealed state with the unsealed one */
+	honas_state_destroy(state);
+	*state = unsealed;
+	return 0;
+}
+
+/* Check the compatibility and validity of the `mmap()`-ed honas state data
+ *
+ * Returns 0 when valid, 1 when it's not a honas state and 2 when it's invalid.
+ */
+static int honas_state_validate(honas_state_t* state)
+{
+	/* Check state file compatibility */
+	state->header = (struct honas_state_file_header*)state->mmap;
+	if (
+		state->size < 44 /* part of state that describes: file magic, versioning and info needed to calculate the filter size */
+		|| memcmp(state->header->file_magic, HONAS_STATE_FILE_MAGIC, sizeof(state->header->file_magic)) != 0
+		|| (state->header->major_version != CURRENT_HONAS_STATE_MAJOR_VERSION && state->header->major_version != LEGACY_HONAS_STATE_MAJOR_VERSION))
+		return 1;
+
+	/* Verify basic state file information */
+	if (state->size < sizeof(struct honas_state_file_header) || !honas_state_header_is_valid(state->header))
+		return 2;
+
+	/* Verify the location of the filters and hyperloglog data */
+	if (state->header->major_version == LEGACY_HONAS_STATE_MAJOR_VERSION) {
+		if (
+			!honas_state_header_fold_factor(state->header, MIN(state->header->first_filter_offset, state->size), &state->fold_factor)
+			|| !honas_state_header_v1_layout_is_valid(state->header, state->size, state->fold_factor))
+			return 2;
+	} else {
+		state->section_table = (struct honas_state_section_table*)((uint8_t*)state->mmap + sizeof(struct honas_state_file_header));
+		if (!honas_state_section_table_is_valid(state))
+			return 2;
+	}
+	return 0;
+}
+
+/* Size of the live view header including the snapshot of `filter_bits_set` */
+static size_t honas_live_state_header_size(uint32_t number_of_filters)
+{
+	return round_up_to_factor_of_two(sizeof(struct honas_live_state_header) + sizeof(uint32_t) * number_of_filters, PAGE_SHIFT);
+}
+
+/* Normalize the name of a live view to the form expected by `shm_open()` */
+static const char* honas_live_state_name(const char* name, char* buffer, size_t buffer_size)
+{
+	while (*name == '/')
+		name++;
+	if (*name == '\0' || strchr(name, '/') != NULL || snprintf(buffer, buffer_size, "/%s", name) >= (int)buffer_size) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return buffer;
+}
+
+/* Number of attempts at copying a consistent snapshot of a live view before giving up */
+#define HONAS_LIVE_STATE_SNAPSHOT_ATTEMPTS 1000
+
+/* Load the live view of a honas state (see `honas_state_share()`)
+ *
+ * The honas state data is mapped privately: pages that aren't written to keep
+ * reflecting the shared memory segment, so the filters are live. The header and
+ * `filter_bits_set` are overwritten with the snapshot, which gives those pages
+ * a private copy that the writer won't update underneath us.
+ */
+static int honas_state_load_shared(honas_state_t* state, const char* name, bool read_only)
+{
+	int saved_errno;
+	int err_return = -1;
+	struct honas_live_state_header* live = MAP_FAILED;
+	struct honas_live_state_header* snapshot = NULL;
+	size_t live_size = 0;
+
+	if (!read_only) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	char shm_name[NAME_MAX + 1];
+	if (honas_live_state_name(name, shm_name, sizeof(shm_name)) == NULL)
+		return -1;
+	int fd = shm_open(shm_name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	/* Check live view compatibility and layout */
+	struct stat fd_stat;
+	struct honas_live_state_header header;
+	if (fstat(fd, &fd_stat) == -1)
+		goto err_out;
+	if (
+		(size_t)fd_stat.st_size < sizeof(header)
+		|| pread(fd, &header, sizeof(header), 0) != sizeof(header)
+		|| memcmp(header.magic, HONAS_LIVE_STATE_MAGIC, sizeof(header.magic)) != 0
+		|| header.major_version != CURRENT_HONAS_LIVE_STATE_MAJOR_VERSION) {
+		err_return = 1;
+		goto err_out;
+	}
+	live_size = honas_live_state_header_size(header.state_header.number_of_filters);
+	if (
+		header.state_header.number_of_filters == 0
+		|| header.state_offset < live_size
+		|| (header.state_offset & (PAGE_SIZE - 1)) != 0
+		|| !region_is_valid(fd_stat.st_size, header.state_offset, header.state_size)
+		|| header.state_size < sizeof(struct honas_state_file_header) + sizeof(uint32_t) * header.state_header.number_of_filters) {
+		err_return = 2;
+		goto err_out;
+	}
+
+	if ((live = (struct honas_live_state_header*)mmap(NULL, live_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto err_out;
+	state->size = header.state_size;
+	if ((state->mmap = mmap(NULL, state->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, header.state_offset)) == MAP_FAILED)
+		goto err_out;
+
+	/* Copy a consistent snapshot of the header and `filter_bits_set` */
+	snapshot = (struct honas_live_state_header*)malloc(live_size);
+	log_passert(snapshot != NULL, "Failed to allocate live view snapshot");
+	uint32_t attempt;
+	for (attempt = 0; attempt < HONAS_LIVE_STATE_SNAPSHOT_ATTEMPTS; attempt++) {
+		uint64_t sequence = __atomic_load_n(&live->sequence, __ATOMIC_ACQUIRE);
+		if ((sequence & 1) == 0) {
+			memcpy(snapshot, live, live_size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&live->sequence, __ATOMIC_RELAXED) == sequence)
+				break;
+		}
+		sched_yield();
+	}
+	if (attempt == HONAS_LIVE_STATE_SNAPSHOT_ATTEMPTS) {
+		errno = EAGAIN;
+		goto err_out;
+	}
+	if (snapshot->state_header.number_of_filters != header.state_header.number_of_filters) {
+		err_return = 2;
+		goto err_out;
+	}
+	if (munmap(live, live_size) == -1)
+		log_perror(ERR, "Failed to unmap live view header");
+	live = MAP_FAILED;
+	if (close(fd) == -1)
+		log_perror(ERR, "Error closing live view '%s'", name);
+	fd = -1;
+
+	memcpy(state->mmap, &snapshot->state_header, sizeof(struct honas_state_file_header));
+	if ((err_return = honas_state_validate(state)) != 0)
+		goto err_out;
+	if (state->section_table == NULL) {
+		err_return = 2;
+		goto err_out;
+	}
+	honas_state_init_common(state);
+	memcpy(state->filter_bits_set, &snapshot->state_header + 1, sizeof(uint32_t) * state->header->number_of_filters);
+	free(snapshot);
+	snapshot = NULL;
+	if (mprotect(state->mmap, state->size, PROT_READ) == -1)
+		goto err_out;
+
+	/* The summary (if any) is outdated as soon as the filters change, so it's not used */
+	hllInitFromBuffer(&state->client_count, state->client_count_registers);
+	hllInitFromBuffer(&state->host_name_count, state->host_name_count_registers);
+	return 0;
+
+err_out:
+	saved_errno = errno;
+	free(snapshot);
+	if (live != MAP_FAILED)
+		munmap(live, live_size);
+	if (fd != -1)
+		close(fd);
+	honas_state_destroy(state);
+	errno = saved_errno;
+	return err_return;
+}
+
 int honas_state_load(honas_state_t* state, const char* filename, bool read_only)
 {
 	assert(state->mmap == NULL);
@@ -157,6 +699,10 @@ int honas_state_load(honas_state_t* state, const char* filename, bool read_only)
 	int saved_errno;
 	int err_return = -1;
 
+	/* The live view of a shared honas state is handled separately */
+	if (strncmp(filename, HONAS_STATE_SHM_PREFIX, sizeof(HONAS_STATE_SHM_PREFIX) - 1) == 0)
+		return honas_state_load_shared(state, filename + sizeof(HONAS_STATE_SHM_PREFIX) - 1, read_only);
+
 	/* attempt to open state file */
 	int fd = open(filename, O_RDONLY | O_CLOEXEC);
 	if (fd == -1)
@@ -170,47 +716,31 @@ int honas_state_load(honas_state_t* state, const char* filename, bool read_only)
 	}
 	if ((state->mmap = mmap(NULL, state->size, (read_only ? PROT_READ : PROT_READ | PROT_WRITE), MAP_PRIVATE, fd, 0)) == MAP_FAILED)
 		goto err_out;
-	if (!read_only && mlock(state->mmap, state->size) == -1)
-		log_perror(INFO, "Unable to mlock honas state");
 	if (close(fd) == -1)
 		log_perror(ERR, "Error closing loaded state file '%s'", filename);
 	fd = -1;
 
-	/* Check state file compatibility */
-	state->header = (struct honas_state_file_header*)state->mmap;
-	if (
-		state->size < 44 /* part of state that describes: file magic, versioning and info needed to calculate the filter size */
-		|| memcmp(state->header->file_magic, HONAS_STATE_FILE_MAGIC, sizeof(state->header->file_magic)) != 0
-		|| state->header->major_version != CURRENT_HONAS_STATE_MAJOR_VERSION) {
-		err_return = 1;
-		goto err_out;
+	/* Sealed state files are handled separately */
+	if (state->size >= sizeof(struct honas_sealed_state_file_header) && memcmp(state->mmap, HONAS_SEALED_STATE_FILE_MAGIC, sizeof(HONAS_SEALED_STATE_FILE_MAGIC) - 1) == 0) {
+		if ((err_return = honas_state_load_sealed(state, read_only)) != 0)
+			goto err_out;
+		return 0;
 	}
 
-	/* Verify basic state file information */
-	if (
-		state->header->first_filter_offset < sizeof(struct honas_state_file_header)
-		|| state->header->number_of_filters == 0
-		|| state->header->number_of_bits_per_filter == 0
-		|| (state->header->number_of_bits_per_filter & 0x7) != 0
-		|| state->header->number_of_hashes == 0
-		|| state->header->client_hll_size != ((uint32_t)HLL_DENSE_SIZE)
-		|| state->header->host_name_hll_size != ((uint32_t)HLL_DENSE_SIZE)
-		|| state->size < honas_state_file_size(
-							 state->header->first_filter_offset,
-							 state->header->padding_after_filters,
-							 state->header->number_of_filters,
-							 state->header->number_of_bits_per_filter,
-							 state->header->client_hll_size,
-							 state->header->padding_after_client_hll,
-							 state->header->host_name_hll_size,
-							 state->header->padding_after_host_name_hll)) {
-		err_return = 2;
+	if (!read_only && mlock(state->mmap, state->size) == -1)
+		log_perror(INFO, "Unable to mlock honas state");
+
+	if ((err_return = honas_state_validate(state)) != 0)
 		goto err_out;
-	}
 
 	honas_state_init_common(state);
 	hllInitFromBuffer(&state->client_count, state->client_count_registers);
 	hllInitFromBuffer(&state->host_name_count, state->host_name_count_registers);
+
+	/* The summary can only be relied upon as long as the filters don't change */
+	const struct honas_state_section* summary_section = honas_state_find_section(state, HONAS_STATE_SECTION_SUMMARY, 0);
+	if (read_only && summary_section != NULL)
+		state->summary = honas_state_section_data(state, summary_section);
 	return 0;
 
 err_out:
@@ -243,6 +773,124 @@ static void filter_index_host_name_hash_transform(uint32_t filter_index, const b
 	}
 }
 
+/* The block holding the bit offsets of a host name hash in all filters (see `honas_state_use_shared_blocks()`);
+ * it's chosen using the transform of the filter index following the last filter, so that it doesn't depend on
+ * the bit offsets within the block */
+static size_t honas_state_shared_block(const honas_state_t* state, const byte_slice_t host_name_hash)
+{
+	if (state->shared_block_size == 0)
+		return 0;
+
+	uint8_t transformed_host_name_hash[host_name_hash.len];
+	size_t bit_offset;
+	filter_index_host_name_hash_transform(state->header->number_of_filters, host_name_hash, byte_slice_from_array(transformed_host_name_hash));
+	bloom_determine_offsets(&bit_offset, 1, state->header->number_of_bits_per_filter >> 3, byte_slice_from_array(transformed_host_name_hash));
+	return bit_offset / ((size_t)state->shared_block_size << 3);
+}
+
+/* Determine the (unfolded) bit offsets of a host name hash in a filter; with shared blocks
+ * the transform of the filter only determines the bit offsets within the shared block */
+static void honas_state_filter_offsets(const honas_state_t* state, uint32_t filter_index, size_t shared_block, const byte_slice_t host_name_hash, size_t* bit_offsets)
+{
+	uint32_t nr_hashes = state->header->number_of_hashes;
+	uint8_t transformed_host_name_hash[host_name_hash.len];
+	filter_index_host_name_hash_transform(filter_index, host_name_hash, byte_slice_from_array(transformed_host_name_hash));
+	if (state->shared_block_size == 0) {
+		bloom_determine_offsets(bit_offsets, nr_hashes, state->header->number_of_bits_per_filter >> 3, byte_slice_from_array(transformed_host_name_hash));
+		return;
+	}
+
+	bloom_determine_offsets(bit_offsets, nr_hashes, state->shared_block_size, byte_slice_from_array(transformed_host_name_hash));
+	size_t block_begin = shared_block * ((size_t)state->shared_block_size << 3);
+	for (uint32_t j = 0; j < nr_hashes; j++)
+		bit_offsets[j] += block_begin;
+}
+
+/* Register a host name hash in the filters used for a client */
+static void honas_state_register_host_name_hash(honas_state_t* state, const uint32_t* filter_indexes, const byte_slice_t host_name_hash)
+{
+	uint32_t nr_hashes = state->header->number_of_hashes;
+	size_t stored_bits = honas_state_stored_bits_per_filter(state);
+	size_t shared_block = honas_state_shared_block(state, host_name_hash);
+	size_t bit_offsets[nr_hashes];
+	for (uint32_t i = 0; i < state->header->number_of_filters_per_user; i++) {
+		honas_state_filter_offsets(state, filter_indexes[i], shared_block, host_name_hash, bit_offsets);
+
+		/* Folding the filter in half maps each bit offset onto the lower half */
+		if (state->fold_factor > 0) {
+			for (uint32_t j = 0; j < nr_hashes; j++)
+				bit_offsets[j] %= stored_bits;
+		}
+
+		/* Keep the number of bits set up to date, so it doesn't have to be counted when publishing */
+		byte_slice_t filter = state->filters[filter_indexes[i]];
+		for (uint32_t j = 0; j < nr_hashes; j++) {
+			if (!byte_slice_bit_is_set(filter, bit_offsets[j])) {
+				byte_slice_set_bit(filter, bit_offsets[j]);
+				state->filter_bits_set[filter_indexes[i]]++;
+			}
+		}
+	}
+}
+
+size_t honas_state_canonicalize_host_name(const uint8_t* host_name, size_t host_name_length, uint8_t* canonical_host_name)
+{
+	/* Ignore possible trailing '.' */
+	if (host_name_length > 0 && host_name[host_name_length - 1] == '.')
+		host_name_length--;
+	if (host_name_length > HONAS_STATE_MAX_HOST_NAME_LENGTH)
+		host_name_length = HONAS_STATE_MAX_HOST_NAME_LENGTH;
+
+	for (size_t i = 0; i < host_name_length; i++)
+		canonical_host_name[i] = tolower(host_name[i]);
+	canonical_host_name[host_name_length] = 0;
+	return host_name_length;
+}
+
+void honas_state_host_name_hash(const uint8_t* entity_prefix, size_t entity_prefix_length, const uint8_t* host_name, size_t host_name_length, uint8_t* host_name_hash)
+{
+	if (entity_prefix == NULL) {
+		SHA256(host_name, host_name_length, host_name_hash);
+		return;
+	}
+
+	struct honas_entity_prefix prefix;
+	honas_state_entity_prefix_init(&prefix, entity_prefix, entity_prefix_length);
+	honas_state_entity_host_name_hash(&prefix, host_name, host_name_length, host_name_hash);
+	honas_state_entity_prefix_destroy(&prefix);
+}
+
+void honas_state_entity_prefix_init(struct honas_entity_prefix* prefix, const uint8_t* entity_prefix, size_t entity_prefix_length)
+{
+	/* Entity specific host names are registered as "<entity>@<host name>" */
+	prefix->sha256 = EVP_MD_CTX_new();
+	if (
+		prefix->sha256 == NULL
+		|| EVP_DigestInit_ex(prefix->sha256, EVP_sha256(), NULL) != 1
+		|| EVP_DigestUpdate(prefix->sha256, entity_prefix, entity_prefix_length) != 1
+		|| EVP_DigestUpdate(prefix->sha256, "@", 1) != 1)
+		log_die("Failed to hash entity prefix");
+}
+
+void honas_state_entity_prefix_destroy(struct honas_entity_prefix* prefix)
+{
+	EVP_MD_CTX_free(prefix->sha256);
+	prefix->sha256 = NULL;
+}
+
+void honas_state_entity_host_name_hash(const struct honas_entity_prefix* prefix, const uint8_t* host_name, size_t host_name_length, uint8_t* host_name_hash)
+{
+	/* Continue from a copy of the midstate */
+	EVP_MD_CTX* sha256 = EVP_MD_CTX_new();
+	if (
+		sha256 == NULL
+		|| EVP_MD_CTX_copy_ex(sha256, prefix->sha256) != 1
+		|| EVP_DigestUpdate(sha256, host_name, host_name_length) != 1
+		|| EVP_DigestFinal_ex(sha256, host_name_hash, NULL) != 1)
+		log_die("Failed to hash entity specific host name");
+	EVP_MD_CTX_free(sha256);
+}
+
 void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timestamp, const struct in_addr46* client, const uint8_t* host_name, size_t host_name_length
 	, const uint8_t* entity_prefix, size_t entity_prefix_length, struct dry_run_counters* p_dryrun, const ldns_rr_type qtype)
 {
@@ -272,9 +920,7 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 	hllAdd(&state->client_count, client_hash);
 
 	/* Lookup filter information */
-	byte_slice_t* filters = state->filters;
 	uint32_t nr_filters = state->header->number_of_filters;
-	uint32_t nr_hashes = state->header->number_of_hashes;
 	uint32_t nr_filters_per_user = state->header->number_of_filters_per_user;
 
 	/* Determine which filters to use for this client */
@@ -282,38 +928,24 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 	uint32_t combination = client_hash % state->nr_filters_per_user_combinations;
 	lookup_combination(nr_filters, filter_indexes, nr_filters_per_user, combination);
 
-	/* Ignore possible trailing '.' */
-	if (host_name[host_name_length - 1] == '.')
-		host_name_length--;
-
 	// Canonicalize the domain name.
-	uint8_t local_host_name[256] = { 0 };
-	for (size_t i = 0; i < host_name_length; ++i)
-	{
-		local_host_name[i] = tolower(host_name[i]);
-	}
+	uint8_t local_host_name[HONAS_STATE_MAX_HOST_NAME_LENGTH + 1];
+	host_name_length = honas_state_canonicalize_host_name(host_name, host_name_length, local_host_name);
 
-	uint8_t host_name_hash[SHA256_DIGEST_LENGTH], transformed_host_name_hash[SHA256_DIGEST_LENGTH];
+	uint8_t host_name_hash[SHA256_DIGEST_LENGTH];
 	byte_slice_t host_name_hash_slice = byte_slice_from_array(host_name_hash);
-	byte_slice_t transformed_host_name_hash_slice = byte_slice_from_array(transformed_host_name_hash);
 	const uint8_t *part_start = local_host_name, *part_end = local_host_name + host_name_length, *part_next;
-	uint8_t localbuf[512];
 	uint8_t sld_buf[256] = { 0 };
 
 	// Add the domain name as a whole, excluding the entity prefix.
-	SHA256(local_host_name, host_name_length, host_name_hash_slice.bytes);
+	honas_state_host_name_hash(NULL, 0, local_host_name, host_name_length, host_name_hash_slice.bytes);
 
 	/* Count host name */
 	assert(SHA256_DIGEST_LENGTH >= sizeof(uint64_t));
 	hllAdd(&state->host_name_count, byte_slice_as_uint64_ptr(host_name_hash_slice)[0]);
 
 	/* Register host name in filters */
-	for (uint32_t i = 0; i < nr_filters_per_user; i++)
-	{
-		uint32_t filter_index = filter_indexes[i];
-		filter_index_host_name_hash_transform(filter_index, host_name_hash_slice, transformed_host_name_hash_slice);
-		bloom_set(filters[filter_index], transformed_host_name_hash_slice, nr_hashes);
-	}
+	honas_state_register_host_name_hash(state, filter_indexes, host_name_hash_slice);
 
 	// Add to dry-run parameters.
 	if (p_dryrun)
@@ -325,15 +957,8 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 	// If present, prepend the entity name to the whole domain name.
 	if (entity_prefix)
 	{
-		// Copy the entity name as prefix to the local buffer and add a separator.
-		strncpy((char*)localbuf, (char*)entity_prefix, sizeof(localbuf));
-		localbuf[strlen((char*)localbuf)] = '@';
-
-		// Append the domain name label.
-		strncat((char*)localbuf, (char*)local_host_name, sizeof(localbuf) - strlen((char*)localbuf) - 1);
-
-		/* Calculate the hash of the label */
-		SHA256(localbuf, strlen((char*)localbuf), host_name_hash_slice.bytes);
+		/* Calculate the hash of the domain name */
+		honas_state_host_name_hash(entity_prefix, entity_prefix_length, local_host_name, host_name_length, host_name_hash_slice.bytes);
 
 		/* Count host name */
 		assert(SHA256_DIGEST_LENGTH >= sizeof(uint64_t));
@@ -347,12 +972,7 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 		}
 
 		/* Register host name in filters */
-		for (uint32_t i = 0; i < nr_filters_per_user; i++)
-		{
-			uint32_t filter_index = filter_indexes[i];
-			filter_index_host_name_hash_transform(filter_index, host_name_hash_slice, transformed_host_name_hash_slice);
-			bloom_set(filters[filter_index], transformed_host_name_hash_slice, nr_hashes);
-		}
+		honas_state_register_host_name_hash(state, filter_indexes, host_name_hash_slice);
 	}
 
 	// Check which record type we are dealing with. If it is a PTR record, we don't want to store the separate labels.
@@ -365,15 +985,8 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 			// Check if an entity name was specified.
 			if (entity_prefix)
 			{
-				// Copy the entity name as prefix to the local buffer and add a separator.
-				strncpy((char*)localbuf, (char*)entity_prefix, sizeof(localbuf));
-				localbuf[strlen((char*)localbuf)] = '@';
-
-				// Append the domain name label.
-				strncat((char*)localbuf, (char*)part_start, part_next - part_start);
-
 				/* Calculate the hash of the label */
-				SHA256(localbuf, strlen((char*)localbuf), host_name_hash_slice.bytes);
+				honas_state_host_name_hash(entity_prefix, entity_prefix_length, part_start, part_next - part_start, host_name_hash_slice.bytes);
 
 				/* Count host name */
 				assert(SHA256_DIGEST_LENGTH >= sizeof(uint64_t));
@@ -387,16 +1000,11 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 				}
 
 				/* Register host name in filters */
-				for (uint32_t i = 0; i < nr_filters_per_user; i++)
-				{
-					uint32_t filter_index = filter_indexes[i];
-					filter_index_host_name_hash_transform(filter_index, host_name_hash_slice, transformed_host_name_hash_slice);
-					bloom_set(filters[filter_index], transformed_host_name_hash_slice, nr_hashes);
-				}
+				honas_state_register_host_name_hash(state, filter_indexes, host_name_hash_slice);
 			}
 
 			/* Calculate the hash of the label */
-			SHA256(part_start, part_next - part_start, host_name_hash_slice.bytes);
+			honas_state_host_name_hash(NULL, 0, part_start, part_next - part_start, host_name_hash_slice.bytes);
 
 			/* Count host name */
 			assert(SHA256_DIGEST_LENGTH >= sizeof(uint64_t));
@@ -410,12 +1018,7 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 			}
 
 			/* Register host name in filters */
-			for (uint32_t i = 0; i < nr_filters_per_user; i++)
-			{
-				uint32_t filter_index = filter_indexes[i];
-				filter_index_host_name_hash_transform(filter_index, host_name_hash_slice, transformed_host_name_hash_slice);
-				bloom_set(filters[filter_index], transformed_host_name_hash_slice, nr_hashes);
-			}
+			honas_state_register_host_name_hash(state, filter_indexes, host_name_hash_slice);
 
 			// Copy the current label to a separate buffer, so that we can take out the SLD in the end.
 			strncpy((char*)sld_buf, (char*)part_start, part_end - part_start);
@@ -426,7 +1029,7 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 		}
 
 		// Add the SLD.TLD to the Bloom filter as well.
-		SHA256(sld_buf, strlen((char*)sld_buf), host_name_hash_slice.bytes);
+		honas_state_host_name_hash(NULL, 0, sld_buf, strlen((char*)sld_buf), host_name_hash_slice.bytes);
 
 		/* Count host name */
 		assert(SHA256_DIGEST_LENGTH >= sizeof(uint64_t));
@@ -444,27 +1047,86 @@ void honas_state_register_host_name_lookup(honas_state_t* state, uint64_t timest
 		}
 
 		/* Register host name in filters */
-		for (uint32_t i = 0; i < nr_filters_per_user; i++)
-		{
-			uint32_t filter_index = filter_indexes[i];
-			filter_index_host_name_hash_transform(filter_index, host_name_hash_slice, transformed_host_name_hash_slice);
-			bloom_set(filters[filter_index], transformed_host_name_hash_slice, nr_hashes);
-		}
+		honas_state_register_host_name_hash(state, filter_indexes, host_name_hash_slice);
+	}
+}
+
+void honas_state_register_shed_host_name_lookup(honas_state_t* state, uint64_t timestamp, uint32_t sampling_rate)
+{
+	struct honas_state_sampling* sampling = state->sampling;
+	if (sampling == NULL)
+		return;
+
+	sampling->number_of_shed_requests++;
+	sampling->sampling_rate = MAX(sampling->sampling_rate, sampling_rate);
+	if (sampling->last_shed_request < timestamp) {
+		sampling->last_shed_request = timestamp;
+		if (sampling->first_shed_request == 0)
+			sampling->first_shed_request = timestamp;
 	}
 }
 
-uint32_t honas_state_check_host_name_lookups(honas_state_t* state, const byte_slice_t host_name_hash, bitset_t* filters_hit) {
+bool honas_state_offsets_compatible(const honas_state_t* state, const honas_state_t* other)
+{
+	return state->header->number_of_filters == other->header->number_of_filters
+		&& state->header->number_of_bits_per_filter == other->header->number_of_bits_per_filter
+		&& state->header->number_of_hashes == other->header->number_of_hashes
+		&& state->shared_block_size == other->shared_block_size;
+}
+
+void honas_state_host_name_offsets(const honas_state_t* state, const byte_slice_t host_name_hash, size_t* bit_offsets)
+{
+	uint32_t nr_filters = state->header->number_of_filters;
+	uint32_t nr_hashes = state->header->number_of_hashes;
+	size_t shared_block = honas_state_shared_block(state, host_name_hash);
+
+	for (uint32_t i = 0; i < nr_filters; i++)
+		honas_state_filter_offsets(state, i, shared_block, host_name_hash, bit_offsets + (size_t)i * nr_hashes);
+}
+
+/* The summary contains all bits set in any of the filters (folded onto its size); without a summary any filter may contain the bits */
+static bool honas_state_summary_contains(const honas_state_t* state, const size_t* filter_bit_offsets, uint32_t nr_hashes)
+{
+	size_t summary_bits = state->summary.len << 3;
+	if (summary_bits == 0)
+		return true;
+
+	size_t summary_bit_offsets[nr_hashes];
+	for (uint32_t j = 0; j < nr_hashes; j++)
+		summary_bit_offsets[j] = filter_bit_offsets[j] % summary_bits;
+	return byte_slice_all_bits_set(state->summary, summary_bit_offsets, nr_hashes);
+}
+
+uint32_t honas_state_check_host_name_offsets(honas_state_t* state, const size_t* bit_offsets, bitset_t* filters_hit)
+{
 	/* Lookup filter information */
-	byte_slice_t* filters = state->filters;
 	uint32_t nr_filters = state->header->number_of_filters;
 	uint32_t nr_hashes = state->header->number_of_hashes;
+	size_t stored_bits = honas_state_stored_bits_per_filter(state);
 
 	/* Count the filters that probably contain the host name */
 	uint32_t filter_count = 0;
-	uint8_t transformed_host_name_hash[host_name_hash.len];
+	size_t folded_bit_offsets[nr_hashes];
 	for (uint32_t i = 0; i < nr_filters; i++) {
-		filter_index_host_name_hash_transform(i, host_name_hash, byte_slice_from_array(transformed_host_name_hash));
-		if (bloom_is_set(filters[i], byte_slice_from_array(transformed_host_name_hash), nr_hashes)) {
+		const size_t* filter_bit_offsets = bit_offsets + (size_t)i * nr_hashes;
+		if (!honas_state_summary_contains(state, filter_bit_offsets, nr_hashes))
+			continue;
+
+		/* Folding the filter in half maps each bit offset onto the lower half */
+		if (state->fold_factor > 0) {
+			for (uint32_t j = 0; j < nr_hashes; j++)
+				folded_bit_offsets[j] = filter_bit_offsets[j] % stored_bits;
+			filter_bit_offsets = folded_bit_offsets;
+		}
+
+		/* Sealed states only decompress the blocks containing the bits being checked;
+		 * a corrupt block (-1) marks the state as having errors and isn't a hit */
+		int is_set;
+		if (state->sealed != NULL)
+			is_set = honas_sealed_state_all_bits_set(state->sealed, i, filter_bit_offsets, nr_hashes);
+		else
+			is_set = byte_slice_all_bits_set(state->filters[i], filter_bit_offsets, nr_hashes);
+		if (is_set == 1) {
 			filter_count++;
 			if (filters_hit != NULL)
 				bitset_set_bit(filters_hit, i);
@@ -473,6 +1135,235 @@ uint32_t honas_state_check_host_name_lookups(honas_state_t* state, const byte_sl
 	return filter_count;
 }
 
+bool honas_state_has_errors(const honas_state_t* state)
+{
+	return state->sealed != NULL && state->sealed->corrupt;
+}
+
+uint32_t honas_state_check_host_name_lookups(honas_state_t* state, const byte_slice_t host_name_hash, bitset_t* filters_hit)
+{
+	size_t bit_offsets[(size_t)state->header->number_of_filters * state->header->number_of_hashes];
+	honas_state_host_name_offsets(state, host_name_hash, bit_offsets);
+	return honas_state_check_host_name_offsets(state, bit_offsets, filters_hit);
+}
+
+size_t honas_state_host_name_bytes(const honas_state_t* state, const size_t* bit_offsets, const uint8_t** addresses)
+{
+	/* Sealed states don't map the filters directly */
+	if (state->sealed != NULL)
+		return 0;
+
+	uint32_t nr_filters = state->header->number_of_filters;
+	uint32_t nr_hashes = state->header->number_of_hashes;
+	size_t stored_bits = honas_state_stored_bits_per_filter(state);
+	size_t nr_addresses = 0;
+	for (uint32_t i = 0; i < nr_filters; i++) {
+		const size_t* filter_bit_offsets = bit_offsets + (size_t)i * nr_hashes;
+		if (!honas_state_summary_contains(state, filter_bit_offsets, nr_hashes))
+			continue;
+		for (uint32_t j = 0; j < nr_hashes; j++)
+			addresses[nr_addresses++] = state->filters[i].bytes + ((filter_bit_offsets[j] % stored_bits) >> 3);
+	}
+	return nr_addresses;
+}
+
+int honas_state_advise_random_access(honas_state_t* state)
+{
+	if (state->summary.len == 0)
+		return 1;
+	if (madvise(state->mmap, state->size, MADV_RANDOM) == -1)
+		return -1;
+
+	/* The summary itself is checked for each host name */
+	uint8_t* summary_begin = (uint8_t*)((size_t)state->summary.bytes & ~((size_t)PAGE_SIZE - 1));
+	return madvise(summary_begin, state->summary.bytes + state->summary.len - summary_begin, MADV_WILLNEED);
+}
+
+const struct honas_state_section* honas_state_get_section(const honas_state_t* state, uint32_t index)
+{
+	if (state->section_table == NULL || index >= state->section_table->number_of_sections)
+		return NULL;
+	return (const struct honas_state_section*)((const uint8_t*)(state->section_table + 1) + (size_t)index * state->section_table->section_size);
+}
+
+const struct honas_state_section* honas_state_find_section(const honas_state_t* state, uint32_t type, uint32_t index)
+{
+	const struct honas_state_section* section;
+	for (uint32_t i = 0; (section = honas_state_get_section(state, i)) != NULL; i++) {
+		if (section->type == type && index-- == 0)
+			return section;
+	}
+	return NULL;
+}
+
+byte_slice_t honas_state_section_data(const honas_state_t* state, const struct honas_state_section* section)
+{
+	assert(section->offset + section->length <= state->size);
+	return byte_slice((uint8_t*)state->mmap + section->offset, section->length);
+}
+
+const char* honas_state_section_type_name(uint32_t type)
+{
+	switch (type) {
+	case HONAS_STATE_SECTION_FILTER_BITS_SET:
+		return "filter_bits_set";
+	case HONAS_STATE_SECTION_FILTER:
+		return "filter";
+	case HONAS_STATE_SECTION_CLIENT_HLL:
+		return "client_hll";
+	case HONAS_STATE_SECTION_HOST_NAME_HLL:
+		return "host_name_hll";
+	case HONAS_STATE_SECTION_SUMMARY:
+		return "summary";
+	case HONAS_STATE_SECTION_SAMPLING:
+		return "sampling";
+	case HONAS_STATE_SECTION_OFFSET_SCHEME:
+		return "offset_scheme";
+	default:
+		return NULL;
+	}
+}
+
+uint32_t honas_state_verify_sections(const honas_state_t* state)
+{
+	uint32_t mismatches = 0;
+	const struct honas_state_section* section;
+	for (uint32_t i = 0; (section = honas_state_get_section(state, i)) != NULL; i++) {
+		if ((section->flags & HONAS_STATE_SECTION_FLAG_CHECKSUM) && crc32c(0, honas_state_section_data(state, section)) != section->checksum)
+			mismatches++;
+	}
+	return mismatches;
+}
+
+/* Fold all filters into the summary */
+static void honas_state_summarize(const honas_state_t* state, byte_slice_t summary)
+{
+	memset(summary.bytes, 0, summary.len);
+	for (uint32_t i = 0; i < state->header->number_of_filters; i++)
+		bloom_fold(summary, state->filters[i]);
+}
+
+int honas_state_create_summary(const honas_state_t* state, size_t summary_size, byte_slice_t* summary)
+{
+	assert(state->filters != NULL);
+	*summary = byte_slice(NULL, 0);
+
+	/* The summary is folded at least once, so it has to be smaller than the filters */
+	size_t length = state->filters[0].len;
+	do {
+		if ((length & 0x1) != 0)
+			return 1;
+		length >>= 1;
+	} while (length > summary_size);
+
+	uint8_t* bytes = (uint8_t*)calloc(1, length);
+	if (bytes == NULL)
+		return -1;
+	honas_state_summarize(state, byte_slice(bytes, length));
+
+	/* A summary with most bits set would hardly spare any of the filters from being checked */
+	if (bloom_nr_bits_set(byte_slice(bytes, length)) > (length << 3) / 2) {
+		free(bytes);
+		return 1;
+	}
+	*summary = byte_slice(bytes, length);
+	return 0;
+}
+
+/* Check if the section table has room for another section before the data of the sections */
+static bool honas_state_section_table_has_room(const honas_state_t* state)
+{
+	const struct honas_state_section_table* table = state->section_table;
+	uint64_t table_end = sizeof(struct honas_state_file_header) + sizeof(struct honas_state_section_table) + (uint64_t)(table->number_of_sections + 1) * table->section_size;
+	const struct honas_state_section* section;
+	for (uint32_t i = 0; (section = honas_state_get_section(state, i)) != NULL; i++) {
+		if (section->length > 0 && section->offset < table_end)
+			return false;
+	}
+	return true;
+}
+
+/* Prepare a new summary section (of at most `summary_size` bytes) to be appended to the state file
+ *
+ * The summary section is filled in directly after the last section of `table`,
+ * a copy of the section table of the honas state with room for one more
+ * section, but isn't counted in it. Returns `NULL` if no (useful) summary can
+ * be added.
+ */
+static struct honas_state_section* honas_state_prepare_summary(const honas_state_t* state, struct honas_state_section_table* table, const char* filename, byte_slice_t* summary)
+{
+	if (!honas_state_section_table_has_room(state)) {
+		log_msg(WARNING, "Unable to add a summary to honas state '%s', the section table is full", filename);
+		return NULL;
+	}
+
+	int result = honas_state_create_summary(state, state->summary_size, summary);
+	log_passert(result != -1, "Failed to allocate honas state summary");
+	if (result == 1) {
+		log_msg(INFO, "Not adding a summary of at most %" PRIu32 " bytes to honas state '%s', no summary would be of use", state->summary_size, filename);
+		return NULL;
+	}
+
+	struct honas_state_section* section = (struct honas_state_section*)((uint8_t*)(table + 1) + (size_t)table->number_of_sections * table->section_size);
+	memset(section, 0, table->section_size);
+	section->type = HONAS_STATE_SECTION_SUMMARY;
+	section->flags = HONAS_STATE_SECTION_FLAG_CHECKSUM;
+	section->offset = round_up_to_factor_of_two(state->size, PAGE_SHIFT);
+	section->length = summary->len;
+	return section;
+}
+
+int honas_state_open_tmpfile(const char* filename)
+{
+	char directory[PATH_MAX];
+	snprintf(directory, sizeof(directory), "%s", filename);
+	char* slash = strrchr(directory, '/');
+	if (slash == NULL)
+		strcpy(directory, ".");
+	else if (slash == directory)
+		slash[1] = '\0';
+	else
+		slash[0] = '\0';
+	return open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+}
+
+/* Make the hyperloglog data dense and store it in the honas state data */
+static void honas_state_store_counts(honas_state_t* state)
+{
+	if (state->client_count.registers_owned) {
+		hllSparseToDense(&state->client_count);
+		byte_slice_bitwise_or(state->client_count_registers, state->client_count.registers);
+		hllDestroy(&state->client_count);
+		hllInitFromBuffer(&state->client_count, state->client_count_registers);
+	}
+	if (state->host_name_count.registers_owned) {
+		hllSparseToDense(&state->host_name_count);
+		byte_slice_bitwise_or(state->host_name_count_registers, state->host_name_count.registers);
+		hllDestroy(&state->host_name_count);
+		hllInitFromBuffer(&state->host_name_count, state->host_name_count_registers);
+	}
+}
+
+/* Copy part of the honas state data, to be updated before it's written to the state file */
+static byte_slice_t honas_state_persist_copy(const honas_state_t* state, const uint8_t* bytes, size_t length, size_t extra_length)
+{
+	assert(bytes >= (const uint8_t*)state->mmap && bytes + length <= (const uint8_t*)state->mmap + state->size);
+	uint8_t* copy = (uint8_t*)calloc(1, MAX(length + extra_length, 1));
+	log_passert(copy != NULL, "Failed to allocate honas state data to save");
+	memcpy(copy, bytes, length);
+	return byte_slice(copy, length);
+}
+
+/* Write `data` to the state file at `offset` */
+static void honas_state_persist_write(int fd, const char* filename, uint64_t offset, byte_slice_t data)
+{
+	for (size_t total_written = 0; total_written < data.len;) {
+		ssize_t written = pwrite(fd, data.bytes + total_written, data.len - total_written, offset + total_written);
+		log_passert(written != -1, "Unable to save honas state to '%s', failed to write", filename);
+		total_written += written;
+	}
+}
+
 void honas_state_persist(honas_state_t* state, const char* filename, bool blocking)
 {
 	if (!blocking) {
@@ -489,40 +1380,104 @@ void honas_state_persist(honas_state_t* state, const char* filename, bool blocki
 		}
 	}
 
+	/* The honas state data may be shared with other processes (see `honas_state_share()`),
+	 * so the header, section table, filter bits set, hyperloglog data and summary are
+	 * updated in copies that are written over the state data in the state file.
+	 */
+	const uint8_t* head_end = state->section_table != NULL
+		? (const uint8_t*)(state->section_table + 1) + (size_t)state->section_table->number_of_sections * state->section_table->section_size
+		: (const uint8_t*)(state->header + 1);
+	byte_slice_t head = honas_state_persist_copy(state, (const uint8_t*)state->mmap, head_end - (const uint8_t*)state->mmap, state->section_table != NULL ? state->section_table->section_size : 0);
+	struct honas_state_file_header* header = (struct honas_state_file_header*)head.bytes;
+	struct honas_state_section_table* section_table = state->section_table != NULL ? (struct honas_state_section_table*)(head.bytes + ((const uint8_t*)state->section_table - (const uint8_t*)state->mmap)) : NULL;
+	byte_slice_t filter_bits_set = honas_state_persist_copy(state, (const uint8_t*)state->filter_bits_set, sizeof(uint32_t) * header->number_of_filters, 0);
+	byte_slice_t client_count_registers = honas_state_persist_copy(state, state->client_count_registers.bytes, state->client_count_registers.len, 0);
+	byte_slice_t host_name_count_registers = honas_state_persist_copy(state, state->host_name_count_registers.bytes, state->host_name_count_registers.len, 0);
+
 	/* Make sure all hyperloglog data is dense and present in the state file */
 	if (state->client_count.registers_owned) {
 		hllSparseToDense(&state->client_count);
-		byte_slice_bitwise_or(state->client_count_registers, state->client_count.registers);
-		hllDestroy(&state->client_count);
-		hllInitFromBuffer(&state->client_count, state->client_count_registers);
+		byte_slice_bitwise_or(client_count_registers, state->client_count.registers);
 	}
-	state->header->estimated_number_of_clients = hllCount(&state->client_count, NULL);
-
 	if (state->host_name_count.registers_owned) {
 		hllSparseToDense(&state->host_name_count);
-		byte_slice_bitwise_or(state->host_name_count_registers, state->host_name_count.registers);
-		hllDestroy(&state->host_name_count);
-		hllInitFromBuffer(&state->host_name_count, state->host_name_count_registers);
+		byte_slice_bitwise_or(host_name_count_registers, state->host_name_count.registers);
 	}
-	state->header->estimated_number_of_host_names = hllCount(&state->host_name_count, NULL);
+	header->estimated_number_of_clients = hllCount(&state->client_count, NULL);
+	header->estimated_number_of_host_names = hllCount(&state->host_name_count, NULL);
 
 	/* Count the number of filter bits set in each filter */
-	for (uint32_t i = 0; i < state->header->number_of_filters; i++)
-		state->filter_bits_set[i] = bloom_nr_bits_set(state->filters[i]);
+	for (uint32_t i = 0; i < header->number_of_filters; i++)
+		((uint32_t*)filter_bits_set.bytes)[i] = bloom_nr_bits_set(state->filters[i]);
+
+	/* Update the summary of all filters, or prepare a new one to be appended to the state file */
+	const struct honas_state_section* existing_summary_section = honas_state_find_section(state, HONAS_STATE_SECTION_SUMMARY, 0);
+	struct honas_state_section* summary_section = NULL;
+	byte_slice_t summary = { 0 };
+	if (existing_summary_section != NULL) {
+		byte_slice_t summary_data = honas_state_section_data(state, existing_summary_section);
+		summary = honas_state_persist_copy(state, summary_data.bytes, summary_data.len, 0);
+		honas_state_summarize(state, summary);
+	} else if (state->summary_size > 0 && section_table != NULL) {
+		summary_section = honas_state_prepare_summary(state, section_table, filename, &summary);
+	}
 
-	/* Create a preallocated tempfile */
-	int fd = open(".", O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
-	log_passert(fd != -1, "Unable to save honas state to '%s', failed to open file", filename);
-	log_passert(fallocate(fd, 0, 0, state->size) != -1, "Unable to save honas state to '%s', failed to preallocat file", filename);
+	/* Update the checksums of all sections, over the updated data for those that have been copied */
+	for (uint32_t i = 0; section_table != NULL && i < section_table->number_of_sections; i++) {
+		struct honas_state_section* section = (struct honas_state_section*)((uint8_t*)(section_table + 1) + (size_t)i * section_table->section_size);
+		byte_slice_t data;
+		switch (section->type) {
+		case HONAS_STATE_SECTION_FILTER_BITS_SET:
+			data = filter_bits_set;
+			break;
+		case HONAS_STATE_SECTION_CLIENT_HLL:
+			data = client_count_registers;
+			break;
+		case HONAS_STATE_SECTION_HOST_NAME_HLL:
+			data = host_name_count_registers;
+			break;
+		case HONAS_STATE_SECTION_SUMMARY:
+			data = summary;
+			break;
+		default:
+			data = honas_state_section_data(state, section);
+			break;
+		}
+		section->checksum = crc32c(0, data);
+		section->flags |= HONAS_STATE_SECTION_FLAG_CHECKSUM;
+	}
 
-	/* Write the state data to the tempfile */
-	size_t total_written = 0;
-	while (total_written < state->size) {
-		ssize_t written = write(fd, ((uint8_t*)state->mmap) + total_written, state->size - total_written);
-		log_passert(written != -1, "Unable to save honas state to '%s', failed to write", filename);
-		total_written += written;
+	/* The new summary section lies beyond the `mmap()`-ed data, so it's only counted in the state file */
+	size_t file_size = state->size;
+	if (summary_section != NULL) {
+		summary_section->checksum = crc32c(0, summary);
+		section_table->number_of_sections++;
+		head.len += section_table->section_size;
+		file_size = summary_section->offset + summary_section->length;
 	}
 
+	/* Create a preallocated tempfile */
+	int fd = honas_state_open_tmpfile(filename);
+	log_passert(fd != -1, "Unable to save honas state to '%s', failed to open file", filename);
+	log_passert(fallocate(fd, 0, 0, file_size) != -1, "Unable to save honas state to '%s', failed to preallocat file", filename);
+
+	/* Write the state data to the tempfile, followed by the updated copies */
+	const uint8_t* data = (const uint8_t*)state->mmap;
+	honas_state_persist_write(fd, filename, 0, byte_slice((uint8_t*)data, state->size));
+	honas_state_persist_write(fd, filename, 0, head);
+	honas_state_persist_write(fd, filename, (const uint8_t*)state->filter_bits_set - data, filter_bits_set);
+	honas_state_persist_write(fd, filename, state->client_count_registers.bytes - data, client_count_registers);
+	honas_state_persist_write(fd, filename, state->host_name_count_registers.bytes - data, host_name_count_registers);
+	if (existing_summary_section != NULL)
+		honas_state_persist_write(fd, filename, existing_summary_section->offset, summary);
+	else if (summary_section != NULL)
+		honas_state_persist_write(fd, filename, summary_section->offset, summary);
+	free(head.bytes);
+	free(filter_bits_set.bytes);
+	free(client_count_registers.bytes);
+	free(host_name_count_registers.bytes);
+	free(summary.bytes);
+
 	/* Release the honas state resources after writing them to file in the child process */
 	if (!blocking)
 		honas_state_destroy(state);
@@ -542,6 +1497,166 @@ void honas_state_persist(honas_state_t* state, const char* filename, bool blocki
 	}
 }
 
+int honas_state_share(honas_state_t* state, const char* name)
+{
+	assert(state->mmap != NULL);
+	assert(state->header != NULL);
+	assert(state->live == NULL);
+	int saved_errno;
+
+	if (state->section_table == NULL || state->sealed != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	char shm_name[NAME_MAX + 1];
+	if (honas_live_state_name(name, shm_name, sizeof(shm_name)) == NULL)
+		return -1;
+
+	/* Replace any previous live view by the same name; processes that have it loaded keep using it */
+	if (shm_unlink(shm_name) == -1 && errno != ENOENT)
+		return -1;
+	int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd == -1)
+		return -1;
+
+	size_t live_size = honas_live_state_header_size(state->header->number_of_filters);
+	void* live = MAP_FAILED;
+	void* shared = MAP_FAILED;
+	if (ftruncate(fd, live_size + state->size) == -1)
+		goto err_out;
+	for (size_t total_written = 0; total_written < state->size;) {
+		ssize_t written = pwrite(fd, (uint8_t*)state->mmap + total_written, state->size - total_written, live_size + total_written);
+		if (written == -1)
+			goto err_out;
+		total_written += written;
+	}
+	if ((live = mmap(NULL, live_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto err_out;
+	if ((shared = mmap(NULL, state->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, live_size)) == MAP_FAILED)
+		goto err_out;
+
+	/* Move the shared data in place of the current data, so all pointers into it remain valid */
+	if (mremap(shared, state->size, state->size, MREMAP_MAYMOVE | MREMAP_FIXED, state->mmap) == MAP_FAILED)
+		goto err_out;
+	if (mlock(state->mmap, state->size) == -1)
+		log_perror(INFO, "Unable to mlock honas state");
+	if (close(fd) == -1)
+		log_perror(ERR, "Error closing live view '%s'", name);
+
+	state->live = (struct honas_live_state_header*)live;
+	memcpy(state->live->magic, HONAS_LIVE_STATE_MAGIC, sizeof(state->live->magic));
+	state->live->major_version = CURRENT_HONAS_LIVE_STATE_MAJOR_VERSION;
+	state->live->minor_version = CURRENT_HONAS_LIVE_STATE_MINOR_VERSION;
+	state->live->state_offset = live_size;
+	state->live->state_size = state->size;
+	honas_state_publish(state);
+	return 0;
+
+err_out:
+	saved_errno = errno;
+	if (shared != MAP_FAILED)
+		munmap(shared, state->size);
+	if (live != MAP_FAILED)
+		munmap(live, live_size);
+	close(fd);
+	shm_unlink(shm_name);
+	errno = saved_errno;
+	return -1;
+}
+
+void honas_state_publish(honas_state_t* state)
+{
+	if (state->live == NULL)
+		return;
+
+	/* The number of bits set is kept up to date while registering host name lookups */
+	struct honas_state_file_header header = *state->header;
+	header.estimated_number_of_clients = hllCount(&state->client_count, NULL);
+	header.estimated_number_of_host_names = hllCount(&state->host_name_count, NULL);
+
+	/* Update the snapshot under the sequence lock */
+	uint64_t sequence = state->live->sequence;
+	__atomic_store_n(&state->live->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	state->live->state_header = header;
+	memcpy(&state->live->state_header + 1, state->filter_bits_set, sizeof(uint32_t) * header.number_of_filters);
+	state->live->published = time(NULL);
+	__atomic_store_n(&state->live->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+int honas_state_export(honas_state_t* state)
+{
+	assert(state->mmap != NULL);
+	assert(state->header != NULL);
+	int saved_errno;
+
+	if (state->sealed != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = memfd_create("honas-state", MFD_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (ftruncate(fd, state->size) == -1)
+		goto err_out;
+
+	honas_state_store_counts(state);
+	for (size_t total_written = 0; total_written < state->size;) {
+		ssize_t written = pwrite(fd, (uint8_t*)state->mmap + total_written, state->size - total_written, total_written);
+		if (written == -1)
+			goto err_out;
+		total_written += written;
+	}
+	return fd;
+
+err_out:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+int honas_state_import(honas_state_t* state, int fd)
+{
+	assert(state->mmap == NULL);
+	assert(state->header == NULL);
+	assert(state->filters == NULL);
+	int saved_errno;
+	int err_return = -1;
+
+	struct stat fd_stat;
+	if (fstat(fd, &fd_stat) == -1)
+		return -1;
+	state->size = fd_stat.st_size;
+	if ((state->mmap = mmap(NULL, state->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto err_out;
+	if (mlock(state->mmap, state->size) == -1)
+		log_perror(INFO, "Unable to mlock honas state");
+
+	if ((err_return = honas_state_validate(state)) != 0)
+		goto err_out;
+
+	honas_state_init_common(state);
+	hllInitFromBuffer(&state->client_count, state->client_count_registers);
+	hllInitFromBuffer(&state->host_name_count, state->host_name_count_registers);
+	return 0;
+
+err_out:
+	saved_errno = errno;
+	honas_state_destroy(state);
+	errno = saved_errno;
+	return err_return;
+}
+
+int honas_state_unshare(const char* name)
+{
+	char shm_name[NAME_MAX + 1];
+	if (honas_live_state_name(name, shm_name, sizeof(shm_name)) == NULL)
+		return -1;
+	return shm_unlink(shm_name);
+}
+
 void honas_state_destroy(honas_state_t* state)
 {
 	if (state->client_count.registers.bytes != NULL)
@@ -552,8 +1667,22 @@ void honas_state_destroy(honas_state_t* state)
 		free(state->filters);
 		state->filters = NULL;
 	}
+	if (state->sealed != NULL) {
+		honas_sealed_state_close(state->sealed);
+		free(state->sealed);
+		state->sealed = NULL;
+	}
 	if (state->header != NULL)
 		state->header = NULL;
+	if (state->live != NULL) {
+		if (munmap(state->live, state->live->state_offset) == -1)
+			log_perror(ERR, "Failed to unmap live view header");
+		state->live = NULL;
+	}
+	state->section_table = NULL;
+	state->sampling = NULL;
+	state->shared_block_size = 0;
+	state->summary = byte_slice(NULL, 0);
 	if (state->mmap != NULL) {
 		if (state->mmap != MAP_FAILED && munmap(state->mmap, state->size) == -1)
 			log_perror(ERR, "Failed to unmap honas state");
@@ -562,26 +1691,128 @@ void honas_state_destroy(honas_state_t* state)
 	}
 }
 
+int honas_state_fold(honas_state_t* folded, honas_state_t* state, uint32_t fold_factor)
+{
+	const struct honas_state_file_header* header = state->header;
+
+	if (fold_factor < state->fold_factor || fold_factor > HONAS_STATE_MAX_FOLD_FACTOR || (header->number_of_bits_per_filter % (8U << fold_factor)) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (honas_state_create_folded(folded, header->number_of_filters, header->number_of_bits_per_filter, header->number_of_hashes, header->number_of_filters_per_user, header->flatten_threshold, fold_factor) == -1)
+		return -1;
+	if (state->shared_block_size != 0 && honas_state_use_shared_blocks(folded, state->shared_block_size) == -1) {
+		int saved_errno = errno;
+		honas_state_destroy(folded);
+		errno = saved_errno;
+		return -1;
+	}
+	folded->header->period_begin = header->period_begin;
+	folded->header->period_end = header->period_end;
+	folded->header->first_request = header->first_request;
+	folded->header->last_request = header->last_request;
+	folded->header->number_of_requests = header->number_of_requests;
+	folded->header->estimated_number_of_clients = header->estimated_number_of_clients;
+	folded->header->estimated_number_of_host_names = header->estimated_number_of_host_names;
+	honas_state_combine_sampling(folded, state);
+
+	/* Fold all filters; the filters of a sealed state are decompressed one at a time */
+	byte_slice_t unsealed = { 0 };
+	if (state->filters == NULL) {
+		unsealed = byte_slice(malloc(state->sealed->filter_size), state->sealed->filter_size);
+		log_passert(unsealed.bytes != NULL, "Failed to allocate honas state filter buffer");
+	}
+	for (uint32_t i = 0; i < header->number_of_filters; i++) {
+		byte_slice_t filter = unsealed;
+		if (state->filters != NULL) {
+			filter = state->filters[i];
+		} else if (honas_sealed_state_decompress_filter(state->sealed, i, filter) == -1) {
+			free(unsealed.bytes);
+			honas_state_destroy(folded);
+			errno = EINVAL;
+			return -1;
+		}
+		bloom_fold(folded->filters[i], filter);
+		folded->filter_bits_set[i] = bloom_nr_bits_set(folded->filters[i]);
+	}
+	free(unsealed.bytes);
+
+	/* Take over the cardinality estimation data */
+	hllDestroy(&folded->client_count);
+	hllInitFromBuffer(&folded->client_count, folded->client_count_registers);
+	hllMerge(&folded->client_count, &state->client_count);
+	hllDestroy(&folded->host_name_count);
+	hllInitFromBuffer(&folded->host_name_count, folded->host_name_count_registers);
+	hllMerge(&folded->host_name_count, &state->host_name_count);
+	return 0;
+}
+
+void honas_state_combine_sampling(honas_state_t* target, const honas_state_t* source)
+{
+	struct honas_state_sampling* sampling = target->sampling;
+	const struct honas_state_sampling* other = source->sampling;
+	if (sampling == NULL || other == NULL)
+		return;
+
+	sampling->sampling_rate = MAX(sampling->sampling_rate, other->sampling_rate);
+	sampling->number_of_shed_requests += other->number_of_shed_requests;
+	if (other->first_shed_request != 0 && (sampling->first_shed_request == 0 || other->first_shed_request < sampling->first_shed_request))
+		sampling->first_shed_request = other->first_shed_request;
+	sampling->last_shed_request = MAX(sampling->last_shed_request, other->last_shed_request);
+}
+
 // NOTE: This function assumes that the order of the Bloom filters in each state file is the same!
 // For example: If the seed for the Bloom filters is a sequence number, the sequence number must
 // be applied in the same order in both target and source.
 const bool honas_state_aggregate_combine(honas_state_t* target, honas_state_t* source)
 {
 	// Check whether the pointers are valid.
-	if (target && source)
+	if (target && source && target->filters)
 	{
 		// Check whether the parameters k and m are the same, and if the state files both
-		// contain the same number of filters.
+		// contain the same number of filters which have been folded the same number of times
+		// and use the same bit offsets.
 		if (target->header->number_of_bits_per_filter == source->header->number_of_bits_per_filter
 			&& target->header->number_of_hashes == source->header->number_of_hashes
-			&& target->header->number_of_filters == source->header->number_of_filters)
+			&& target->header->number_of_filters == source->header->number_of_filters
+			&& target->fold_factor == source->fold_factor
+			&& target->shared_block_size == source->shared_block_size)
 		{
+			// A corrupt block in a sealed source state fails the aggregation. Decompress
+			// every filter once before touching the target, so that the target is left
+			// as it was instead of being half aggregated.
+			byte_slice_t scratch = { 0 };
+			if (source->sealed)
+			{
+				scratch = byte_slice(malloc(source->sealed->filter_size), source->sealed->filter_size);
+				log_passert(scratch.bytes != NULL, "Failed to allocate filter decompression buffer");
+				for (size_t i = 0; i < source->header->number_of_filters; ++i)
+				{
+					if (honas_sealed_state_decompress_filter(source->sealed, i, scratch) == -1)
+					{
+						free(scratch.bytes);
+						return false;
+					}
+				}
+			}
+
 			// Loop over all filters in the target state.
 			for (size_t i = 0; i < target->header->number_of_filters; ++i)
 			{
-				// Take the bitwise OR of the target and source Bloom filter.
-				byte_slice_bitwise_or(target->filters[i], source->filters[i]);
+				// Take the bitwise OR of the target and source Bloom filter. The blocks of
+				// a sealed source have all been verified above, so this can't fail anymore.
+				if (source->sealed)
+				{
+					if (honas_sealed_state_decompress_filter(source->sealed, i, scratch) == -1)
+						log_die("Sealed honas state changed during aggregation");
+					byte_slice_bitwise_or(target->filters[i], scratch);
+				}
+				else
+					byte_slice_bitwise_or(target->filters[i], source->filters[i]);
+				target->filter_bits_set[i] = bloom_nr_bits_set(target->filters[i]);
 			}
+			free(scratch.bytes);
 
 			// Merge the HyperLogLog structure for client count in both states.
 			hllMerge(&target->client_count, &source->client_count);
@@ -598,6 +1829,9 @@ const bool honas_state_aggregate_combine(honas_state_t* target, honas_state_t* s
 			target->header->first_request = MIN(target->header->first_request, source->header->first_request);
 			target->header->last_request = MAX(target->header->last_request, source->header->last_request);
 
+			// Combine the sampling information.
+			honas_state_combine_sampling(target, source);
+
 			// The operation succeeded.
 			return true;
 		}
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "input_afpacket.h"
+
+#include "dns_packet.h"
+#include "logging.h"
+#include "utils.h"
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+/* Maximum number of worker threads */
+#define INPUT_AFPACKET_MAX_THREADS 64
+
+/* Size of the blocks of the receive ring; each block is handed back and forth with the kernel as a whole */
+#define INPUT_AFPACKET_BLOCK_SIZE (1024 * 1024)
+
+/* Frame size of the receive ring, which TPACKET_V3 only uses to check the ring layout */
+#define INPUT_AFPACKET_FRAME_SIZE 2048
+
+/* Time in milliseconds after which the kernel hands over a block that isn't full */
+#define INPUT_AFPACKET_BLOCK_TIMEOUT 10
+
+/* Time in milliseconds a worker waits for a block before checking whether it should stop */
+#define INPUT_AFPACKET_POLL_TIMEOUT 100
+
+/* Time in seconds between the checks of the number of dropped packets */
+#define INPUT_AFPACKET_STATISTICS_INTERVAL 60
+
+/* Number of lookups handed over at once, and number of batches per worker */
+#define INPUT_AFPACKET_BATCH_SIZE 256
+#define INPUT_AFPACKET_BATCHES_PER_THREAD 8
+
+#define INPUT_AFPACKET_DEFAULT_RING_SIZE 64
+
+struct input_afpacket_batch {
+	struct input_afpacket_batch* next;
+	size_t nr_lookups;
+	struct honas_input_lookup lookups[INPUT_AFPACKET_BATCH_SIZE];
+};
+
+struct input_afpacket_worker {
+	struct input_afpacket_state* state;
+	unsigned int id;
+	pthread_t thread;
+	bool started;
+
+	int fd;
+	uint8_t* ring;
+	unsigned int nr_blocks;
+	unsigned int next_block;
+
+	/* The batch that's being filled */
+	struct input_afpacket_batch* batch;
+	time_t next_statistics;
+};
+
+struct input_afpacket_state {
+	/* The configuration */
+	char* interface;
+	unsigned int ifindex;
+	uint32_t nr_threads;
+	uint32_t fanout_group;
+	bool fanout_group_set;
+	uint32_t ring_size;
+
+	struct input_afpacket_worker* workers;
+	bool running;
+
+	/* The batches, which are either free, ready to be read or being filled or read */
+	struct input_afpacket_batch* batches;
+	pthread_mutex_t lock;
+	pthread_cond_t batch_freed;
+	struct input_afpacket_batch* free_batches;
+	struct input_afpacket_batch* ready_head;
+	struct input_afpacket_batch* ready_tail;
+	int event_fd;
+
+	/* The batch that's being read, from lookup `read_offset` on */
+	struct input_afpacket_batch* reading;
+	size_t read_offset;
+
+	/* The lookup returned by `input_afpacket_next()` */
+	struct honas_input_lookup lookup;
+};
+
+/* Take a free batch to fill; returns NULL if the workers are stopping */
+static struct input_afpacket_batch* input_afpacket_acquire_batch(struct input_afpacket_state* state)
+{
+	pthread_mutex_lock(&state->lock);
+	while (state->free_batches == NULL && state->running)
+		pthread_cond_wait(&state->batch_freed, &state->lock);
+	struct input_afpacket_batch* batch = NULL;
+	if (state->running) {
+		batch = state->free_batches;
+		state->free_batches = batch->next;
+		batch->next = NULL;
+		batch->nr_lookups = 0;
+	}
+	pthread_mutex_unlock(&state->lock);
+	return batch;
+}
+
+/* Hand the batch that's being filled over to the reader */
+static void input_afpacket_submit_batch(struct input_afpacket_worker* worker)
+{
+	struct input_afpacket_state* state = worker->state;
+	struct input_afpacket_batch* batch = worker->batch;
+	worker->batch = NULL;
+
+	pthread_mutex_lock(&state->lock);
+	if (state->ready_tail != NULL)
+		state->ready_tail->next = batch;
+	else
+		state->ready_head = batch;
+	state->ready_tail = batch;
+	pthread_mutex_unlock(&state->lock);
+
+	const uint64_t one = 1;
+	if (write(state->event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		log_perror(WARN, "Failed to signal captured lookups");
+}
+
+/* Report the packets the kernel dropped since the previous check */
+static void input_afpacket_check_statistics(struct input_afpacket_worker* worker)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+	if (getsockopt(worker->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == -1) {
+		log_perror(WARN, "Failed to get the capture statistics of worker %u", worker->id);
+		return;
+	}
+	if (stats.tp_drops > 0)
+		log_msg(WARN, "Capture worker %u on '%s' dropped %u of %u packets", worker->id, worker->state->interface, stats.tp_drops, stats.tp_packets);
+	else
+		log_msg(DEBUG, "Capture worker %u on '%s' received %u packets", worker->id, worker->state->interface, stats.tp_packets);
+}
+
+/* Parse the DNS queries of the packets in a block of the receive ring into batches */
+static void input_afpacket_read_block(struct input_afpacket_worker* worker, const struct tpacket_block_desc* block)
+{
+	struct dns_packet packet;
+	const uint8_t* frame = (const uint8_t*)block + block->hdr.bh1.offset_to_first_pkt;
+	for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; frame += ((const struct tpacket3_hdr*)frame)->tp_next_offset, i++) {
+		const struct tpacket3_hdr* header = (const struct tpacket3_hdr*)frame;
+		const struct sockaddr_ll* address = (const struct sockaddr_ll*)(frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+		/* Packets sent by this host itself are seen twice on the loopback interface */
+		if (address->sll_pkttype == PACKET_OUTGOING || header->tp_net < header->tp_mac || header->tp_net - header->tp_mac >= header->tp_snaplen)
+			continue;
+
+		/* The kernel has already found the network header (past the VLAN tags, if any) */
+		packet.timestamp = header->tp_sec;
+		packet.timestamp_nsec = header->tp_nsec;
+		dns_packet_parse(&packet, LINKTYPE_RAW, frame + header->tp_net, header->tp_snaplen - (header->tp_net - header->tp_mac));
+		while (packet.payload_len > 0) {
+			if (worker->batch == NULL && (worker->batch = input_afpacket_acquire_batch(worker->state)) == NULL)
+				return;
+			if (!dns_packet_next_query(&packet, &worker->batch->lookups[worker->batch->nr_lookups]))
+				break;
+			if (++worker->batch->nr_lookups == INPUT_AFPACKET_BATCH_SIZE)
+				input_afpacket_submit_batch(worker);
+		}
+	}
+}
+
+static void* input_afpacket_worker(void* arg)
+{
+	struct input_afpacket_worker* worker = arg;
+	struct input_afpacket_state* state = worker->state;
+
+	while (__atomic_load_n(&state->running, __ATOMIC_RELAXED)) {
+		struct tpacket_block_desc* block = (struct tpacket_block_desc*)(worker->ring + (size_t)worker->next_block * INPUT_AFPACKET_BLOCK_SIZE);
+		if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+			/* Hand over what has been parsed so far, instead of waiting for a full batch */
+			if (worker->batch != NULL && worker->batch->nr_lookups > 0)
+				input_afpacket_submit_batch(worker);
+
+			struct pollfd pfd = { .fd = worker->fd, .events = POLLIN | POLLERR };
+			if (poll(&pfd, 1, INPUT_AFPACKET_POLL_TIMEOUT) == -1 && errno != EINTR) {
+				log_perror(ERR, "Failed to wait for captured packets of worker %u", worker->id);
+				break;
+			}
+		} else {
+			input_afpacket_read_block(worker, block);
+			__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+			worker->next_block = (worker->next_block + 1) % worker->nr_blocks;
+		}
+
+		const time_t now = time(NULL);
+		if (now >= worker->next_statistics) {
+			input_afpacket_check_statistics(worker);
+			worker->next_statistics = now + INPUT_AFPACKET_STATISTICS_INTERVAL;
+		}
+	}
+	return NULL;
+}
+
+/* Open the socket of a worker, with its receive ring, and join the fanout group; returns false on failure */
+static bool input_afpacket_open(struct input_afpacket_worker* worker)
+{
+	struct input_afpacket_state* state = worker->state;
+	worker->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+	if (worker->fd == -1) {
+		log_perror(ERR, "Failed to open capture socket");
+		return false;
+	}
+
+	int version = TPACKET_V3;
+	if (setsockopt(worker->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+		log_perror(ERR, "Failed to select TPACKET_V3 for the capture socket");
+		return false;
+	}
+
+	worker->nr_blocks = MAX((size_t)state->ring_size * 1024 * 1024 / INPUT_AFPACKET_BLOCK_SIZE, 2);
+	worker->next_block = 0;
+	struct tpacket_req3 req = {
+		.tp_block_size = INPUT_AFPACKET_BLOCK_SIZE,
+		.tp_block_nr = worker->nr_blocks,
+		.tp_frame_size = INPUT_AFPACKET_FRAME_SIZE,
+		.tp_frame_nr = INPUT_AFPACKET_BLOCK_SIZE / INPUT_AFPACKET_FRAME_SIZE * worker->nr_blocks,
+		.tp_retire_blk_tov = INPUT_AFPACKET_BLOCK_TIMEOUT,
+	};
+	if (setsockopt(worker->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+		log_perror(ERR, "Failed to set up the receive ring of the capture socket");
+		return false;
+	}
+	worker->ring = mmap(NULL, (size_t)worker->nr_blocks * INPUT_AFPACKET_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, worker->fd, 0);
+	if (worker->ring == MAP_FAILED) {
+		worker->ring = NULL;
+		log_perror(ERR, "Failed to map the receive ring of the capture socket");
+		return false;
+	}
+
+	struct sockaddr_ll address = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ALL),
+		.sll_ifindex = state->ifindex,
+	};
+	if (bind(worker->fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+		log_perror(ERR, "Failed to bind capture socket to interface '%s'", state->interface);
+		return false;
+	}
+
+	/* A mirror port receives packets for other hosts */
+	struct packet_mreq mreq = {
+		.mr_ifindex = state->ifindex,
+		.mr_type = PACKET_MR_PROMISC,
+	};
+	if (setsockopt(worker->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+		log_perror(WARN, "Failed to enable promiscuous mode on interface '%s'", state->interface);
+
+	uint32_t fanout = state->fanout_group | (uint32_t)(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16;
+	if (setsockopt(worker->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1) {
+		log_perror(ERR, "Failed to join capture fanout group %" PRIu32, state->fanout_group);
+		return false;
+	}
+	return true;
+}
+
+void input_afpacket_stop(void* input_state)
+{
+	struct input_afpacket_state* state = input_state;
+	pthread_mutex_lock(&state->lock);
+	__atomic_store_n(&state->running, false, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&state->batch_freed);
+	pthread_mutex_unlock(&state->lock);
+
+	for (uint32_t i = 0; i < state->nr_threads; i++) {
+		struct input_afpacket_worker* worker = &state->workers[i];
+		if (worker->started) {
+			pthread_join(worker->thread, NULL);
+			worker->started = false;
+			input_afpacket_check_statistics(worker);
+		}
+
+		/* Hand over the lookups parsed so far, so that these can still be read */
+		if (worker->batch != NULL && worker->batch->nr_lookups > 0) {
+			input_afpacket_submit_batch(worker);
+		} else if (worker->batch != NULL) {
+			pthread_mutex_lock(&state->lock);
+			worker->batch->next = state->free_batches;
+			state->free_batches = worker->batch;
+			pthread_mutex_unlock(&state->lock);
+			worker->batch = NULL;
+		}
+
+		if (worker->ring != NULL)
+			munmap(worker->ring, (size_t)worker->nr_blocks * INPUT_AFPACKET_BLOCK_SIZE);
+		worker->ring = NULL;
+		if (worker->fd != -1)
+			close(worker->fd);
+		worker->fd = -1;
+	}
+}
+
+int input_afpacket_start(void* input_state)
+{
+	struct input_afpacket_state* state = input_state;
+	if (state->running)
+		return 0;
+
+	for (uint32_t i = 0; i < state->nr_threads; i++) {
+		if (!input_afpacket_open(&state->workers[i])) {
+			input_afpacket_stop(state);
+			return -1;
+		}
+	}
+
+	/* The signals are left to the thread reading the input */
+	sigset_t all_signals, old_signals;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	state->running = true;
+	for (uint32_t i = 0; i < state->nr_threads; i++) {
+		int err = pthread_create(&state->workers[i].thread, NULL, input_afpacket_worker, &state->workers[i]);
+		if (err != 0) {
+			errno = err;
+			log_perror(ERR, "Failed to start capture worker thread");
+			break;
+		}
+		state->workers[i].started = true;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if (!state->workers[state->nr_threads - 1].started) {
+		input_afpacket_stop(state);
+		return -1;
+	}
+
+	log_msg(INFO, "Capturing on interface '%s' with %" PRIu32 " threads in fanout group %" PRIu32, state->interface, state->nr_threads, state->fanout_group);
+	return 0;
+}
+
+static int input_afpacket_init(void** input_state_ptr)
+{
+	struct input_afpacket_state* state = calloc(1, sizeof(struct input_afpacket_state));
+	if (state == NULL)
+		return -1;
+	state->nr_threads = 1;
+	state->ring_size = INPUT_AFPACKET_DEFAULT_RING_SIZE;
+	state->event_fd = -1;
+	*input_state_ptr = state;
+	return 0;
+}
+
+static uint32_t input_afpacket_uint32_value(char* keyword, char* value)
+{
+	uint32_t result;
+	if (!my_strtouint32(value, &result, NULL, 10))
+		log_die("Invalid value for '%s'", keyword);
+	return result;
+}
+
+static int input_afpacket_parse_config_item(const char* UNUSED(filename), void* input_state, unsigned int UNUSED(lineno), char* keyword, char* value, unsigned int UNUSED(length))
+{
+	struct input_afpacket_state* state = input_state;
+
+	/* The capture is only set up once, so the values read on config reloads are ignored */
+	if (strcmp(keyword, "capture_interface") == 0) {
+		if (strlen(value) == 0 || strlen(value) >= IFNAMSIZ)
+			log_die("Invalid value for config option 'capture_interface'");
+		if (state->workers == NULL) {
+			free(state->interface);
+			state->interface = strdup(value);
+			log_passert(state->interface != NULL, "Failed to allocate string for config option '%s'", keyword);
+		}
+	} else if (strcmp(keyword, "capture_threads") == 0) {
+		uint32_t nr_threads = input_afpacket_uint32_value(keyword, value);
+		if (nr_threads == 0 || nr_threads > INPUT_AFPACKET_MAX_THREADS)
+			log_die("Invalid value for config option 'capture_threads', should be 1 up to %d", INPUT_AFPACKET_MAX_THREADS);
+		if (state->workers == NULL)
+			state->nr_threads = nr_threads;
+	} else if (strcmp(keyword, "capture_fanout_group") == 0) {
+		uint32_t fanout_group = input_afpacket_uint32_value(keyword, value);
+		if (fanout_group > UINT16_MAX)
+			log_die("Invalid value for config option 'capture_fanout_group', should be 0 up to %d", UINT16_MAX);
+		if (state->workers == NULL) {
+			state->fanout_group = fanout_group;
+			state->fanout_group_set = true;
+		}
+	} else if (strcmp(keyword, "capture_ring_size") == 0) {
+		uint32_t ring_size = input_afpacket_uint32_value(keyword, value);
+		if (ring_size == 0 || ring_size > 4096)
+			log_die("Invalid value for config option 'capture_ring_size', should be 1 up to 4096 MiB");
+		if (state->workers == NULL)
+			state->ring_size = ring_size;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static void input_afpacket_finalize_config(void* input_state)
+{
+	struct input_afpacket_state* state = input_state;
+	if (state->interface == NULL)
+		log_die("Unset required config option 'capture_interface'");
+	state->ifindex = if_nametoindex(state->interface);
+	log_passert(state->ifindex != 0, "Failed to find capture interface '%s'", state->interface);
+	if (!state->fanout_group_set)
+		state->fanout_group = getpid() & UINT16_MAX;
+
+	const size_t nr_batches = (size_t)state->nr_threads * INPUT_AFPACKET_BATCHES_PER_THREAD;
+	state->batches = calloc(nr_batches, sizeof(struct input_afpacket_batch));
+	log_passert(state->batches != NULL, "Failed to allocate capture batches");
+	for (size_t i = 0; i < nr_batches; i++) {
+		state->batches[i].next = state->free_batches;
+		state->free_batches = &state->batches[i];
+	}
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->batch_freed, NULL);
+	state->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	log_passert(state->event_fd != -1, "Failed to create capture event file descriptor");
+
+	state->workers = calloc(state->nr_threads, sizeof(struct input_afpacket_worker));
+	log_passert(state->workers != NULL, "Failed to allocate capture workers");
+	for (uint32_t i = 0; i < state->nr_threads; i++) {
+		state->workers[i].state = state;
+		state->workers[i].id = i;
+		state->workers[i].fd = -1;
+	}
+	log_passert(input_afpacket_start(state) != -1, "Failed to start capturing on interface '%s'", state->interface);
+}
+
+/* Take the next batch that's ready to be read; returns false if there's none */
+static bool input_afpacket_next_ready(struct input_afpacket_state* state)
+{
+	pthread_mutex_lock(&state->lock);
+	state->reading = state->ready_head;
+	if (state->reading != NULL) {
+		state->ready_head = state->reading->next;
+		if (state->ready_head == NULL)
+			state->ready_tail = NULL;
+	}
+	pthread_mutex_unlock(&state->lock);
+	state->read_offset = 0;
+	return state->reading != NULL;
+}
+
+static ssize_t input_afpacket_next_batch(void* input_state, struct honas_input_lookup* lookups, size_t max_lookups)
+{
+	struct input_afpacket_state* state = input_state;
+	size_t nr_lookups = 0;
+	while (nr_lookups < max_lookups) {
+		if (state->reading == NULL && !input_afpacket_next_ready(state)) {
+			/* Clear the notification before checking again, so that a batch submitted in between notifies anew */
+			uint64_t count;
+			if (read(state->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+				return nr_lookups > 0 ? (ssize_t)nr_lookups : -1;
+			if (!input_afpacket_next_ready(state))
+				break;
+		}
+
+		/* Only copy the used part of the host names */
+		const struct honas_input_lookup* lookup = &state->reading->lookups[state->read_offset++];
+		lookups[nr_lookups].timestamp = lookup->timestamp;
+		lookups[nr_lookups].timestamp_nsec = lookup->timestamp_nsec;
+		lookups[nr_lookups].client = lookup->client;
+		lookups[nr_lookups].qtype = lookup->qtype;
+		lookups[nr_lookups].host_name_length = lookup->host_name_length;
+		memcpy(lookups[nr_lookups].host_name, lookup->host_name, lookup->host_name_length);
+		nr_lookups++;
+
+		if (state->read_offset == state->reading->nr_lookups) {
+			pthread_mutex_lock(&state->lock);
+			state->reading->next = state->free_batches;
+			state->free_batches = state->reading;
+			pthread_cond_signal(&state->batch_freed);
+			pthread_mutex_unlock(&state->lock);
+			state->reading = NULL;
+		}
+	}
+	if (nr_lookups == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return nr_lookups;
+}
+
+static ssize_t input_afpacket_next(void* input_state, struct in_addr46* client, uint8_t** host_name)
+{
+	struct input_afpacket_state* state = input_state;
+	ssize_t result = input_afpacket_next_batch(state, &state->lookup, 1);
+	if (result <= 0)
+		return result;
+	*client = state->lookup.client;
+	*host_name = state->lookup.host_name;
+	return state->lookup.host_name_length;
+}
+
+static void input_afpacket_destroy(void* input_state)
+{
+	struct input_afpacket_state* state = input_state;
+	if (state == NULL)
+		return;
+	if (state->workers != NULL) {
+		input_afpacket_stop(state);
+		pthread_cond_destroy(&state->batch_freed);
+		pthread_mutex_destroy(&state->lock);
+		close(state->event_fd);
+	}
+	free(state->workers);
+	free(state->batches);
+	free(state->interface);
+	free(state);
+}
+
+bool input_afpacket_is_configured(void* input_state)
+{
+	struct input_afpacket_state* state = input_state;
+	return state->interface != NULL;
+}
+
+int input_afpacket_fd(void* input_state)
+{
+	struct input_afpacket_state* state = input_state;
+	return state->event_fd;
+}
+
+const honas_input_t input_afpacket = {
+	.name = "afpacket",
+	.init = input_afpacket_init,
+	.parse_config_item = input_afpacket_parse_config_item,
+	.finalize_config = input_afpacket_finalize_config,
+	.next = input_afpacket_next,
+	.next_batch = input_afpacket_next_batch,
+	.destroy = input_afpacket_destroy,
+};
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "input_pcap.h"
+
+#include "dns_packet.h"
+#include "logging.h"
+
+#include <byteswap.h>
+
+/* Size of the buffer the capture is read into (larger records are skipped) */
+#define INPUT_PCAP_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* Maximum number of interfaces of a pcapng section (packets of others are skipped) */
+#define INPUT_PCAP_MAX_INTERFACES 64
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+#define PCAPNG_SECTION_HEADER_BLOCK 0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_INTERFACE_DESCRIPTION_BLOCK 1
+#define PCAPNG_SIMPLE_PACKET_BLOCK 3
+#define PCAPNG_ENHANCED_PACKET_BLOCK 6
+#define PCAPNG_OPTION_END 0
+#define PCAPNG_OPTION_IF_TSRESOL 9
+
+enum input_pcap_format {
+	INPUT_PCAP_FORMAT_UNKNOWN,
+	INPUT_PCAP_FORMAT_PCAP,
+	INPUT_PCAP_FORMAT_PCAPNG,
+};
+
+struct input_pcap_interface {
+	uint32_t link_type;
+	/* The timestamp in seconds is `(timestamp >> ts_shift) / ts_divisor` */
+	uint8_t ts_shift;
+	uint64_t ts_divisor;
+};
+
+struct input_pcap_state {
+	int fd;
+	bool close_fd;
+	bool done;
+
+	/* The buffered part of the capture: from `begin` up to `end` */
+	uint8_t* buffer;
+	size_t begin;
+	size_t end;
+	bool eof;
+	/* The length of the record being parsed (which starts at `begin`) */
+	size_t record_len;
+	/* The number of bytes still to skip of a record that's larger than the buffer */
+	size_t skip;
+
+	enum input_pcap_format format;
+	bool swapped;
+	struct input_pcap_interface interfaces[INPUT_PCAP_MAX_INTERFACES];
+	size_t nr_interfaces;
+
+	/* The packet being parsed */
+	struct dns_packet packet;
+
+	/* The lookup returned by `input_pcap_next()` */
+	struct honas_input_lookup lookup;
+};
+
+static inline uint16_t input_pcap_u16(const struct input_pcap_state* state, const uint8_t* p)
+{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return state->swapped ? bswap_16(value) : value;
+}
+
+static inline uint32_t input_pcap_u32(const struct input_pcap_state* state, const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return state->swapped ? bswap_32(value) : value;
+}
+
+/* Make sure that at least `len` bytes are buffered
+ *
+ * Returns 1 if so, 0 if the end of the input comes first or -1 on error.
+ */
+static int input_pcap_fill(struct input_pcap_state* state, size_t len)
+{
+	while (state->end - state->begin < len && !state->eof) {
+		if (state->begin > 0) {
+			memmove(state->buffer, state->buffer + state->begin, state->end - state->begin);
+			state->end -= state->begin;
+			state->begin = 0;
+		}
+		ssize_t result = read(state->fd, state->buffer + state->end, INPUT_PCAP_BUFFER_SIZE - state->end);
+		if (result == -1)
+			return -1;
+		if (result == 0)
+			state->eof = true;
+		state->end += result;
+	}
+	return state->end - state->begin >= len;
+}
+
+/* End the input, as there's no way to find the next record of a malformed capture */
+static int input_pcap_malformed(struct input_pcap_state* state, const char* reason)
+{
+	log_msg(WARN, "Capture is %s, skipping the rest of it", reason);
+	state->done = true;
+	return 0;
+}
+
+/* Handle a record that isn't buffered completely after `input_pcap_fill()` returned `result` */
+static int input_pcap_incomplete(struct input_pcap_state* state, int result)
+{
+	if (result == -1)
+		return -1;
+	if (state->begin == state->end) {
+		/* The input ends after the previous record, as it should */
+		state->done = true;
+		return 0;
+	}
+	return input_pcap_malformed(state, "truncated");
+}
+
+/* Read the file header of a pcap capture; pcapng captures begin with a regular block */
+static int input_pcap_read_file_header(struct input_pcap_state* state)
+{
+	int result = input_pcap_fill(state, sizeof(uint32_t));
+	if (result != 1)
+		return input_pcap_incomplete(state, result);
+
+	uint32_t magic;
+	memcpy(&magic, state->buffer + state->begin, sizeof(magic));
+	if (magic == PCAPNG_SECTION_HEADER_BLOCK) {
+		state->format = INPUT_PCAP_FORMAT_PCAPNG;
+		return 1;
+	}
+	if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC && bswap_32(magic) != PCAP_MAGIC_USEC && bswap_32(magic) != PCAP_MAGIC_NSEC)
+		return input_pcap_malformed(state, "neither in pcap nor in pcapng format");
+
+	result = input_pcap_fill(state, PCAP_FILE_HEADER_SIZE);
+	if (result != 1)
+		return input_pcap_incomplete(state, result);
+	state->format = INPUT_PCAP_FORMAT_PCAP;
+	state->swapped = magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC;
+	/* The upper bits of the link type may hold the FCS length */
+	state->interfaces[0].link_type = input_pcap_u32(state, state->buffer + state->begin + 20) & 0x0fffffff;
+	state->nr_interfaces = 1;
+	state->record_len = PCAP_FILE_HEADER_SIZE;
+	return 1;
+}
+
+/* Read a packet record of a pcap capture */
+static int input_pcap_read_record(struct input_pcap_state* state)
+{
+	int result = input_pcap_fill(state, PCAP_RECORD_HEADER_SIZE);
+	if (result != 1)
+		return input_pcap_incomplete(state, result);
+
+	size_t captured_len = input_pcap_u32(state, state->buffer + state->begin + 8);
+	if (captured_len > INPUT_PCAP_BUFFER_SIZE - PCAP_RECORD_HEADER_SIZE) {
+		state->skip = PCAP_RECORD_HEADER_SIZE + captured_len;
+		return 1;
+	}
+	result = input_pcap_fill(state, PCAP_RECORD_HEADER_SIZE + captured_len);
+	if (result != 1)
+		return result == -1 ? -1 : input_pcap_malformed(state, "truncated");
+
+	const uint8_t* record = state->buffer + state->begin;
+	state->record_len = PCAP_RECORD_HEADER_SIZE + captured_len;
+	state->packet.timestamp = input_pcap_u32(state, record);
+	dns_packet_parse(&state->packet, state->interfaces[0].link_type, record + PCAP_RECORD_HEADER_SIZE, captured_len);
+	return 1;
+}
+
+/* Add the interface described by an interface description block of a pcapng capture */
+static void input_pcap_add_interface(struct input_pcap_state* state, const uint8_t* block, size_t block_len)
+{
+	if (state->nr_interfaces == INPUT_PCAP_MAX_INTERFACES) {
+		log_msg(DEBUG, "Skipping the packets of pcapng interface %zu", state->nr_interfaces);
+		return;
+	}
+	struct input_pcap_interface* interface = &state->interfaces[state->nr_interfaces++];
+	interface->link_type = input_pcap_u16(state, block + 8);
+	interface->ts_shift = 0;
+	interface->ts_divisor = 1000000;
+
+	/* The timestamp resolution is a negative power of 10 or (with the top bit set) of 2 */
+	size_t offset = 16;
+	while (offset + 4 <= block_len - 4) {
+		uint16_t code = input_pcap_u16(state, block + offset);
+		uint16_t len = input_pcap_u16(state, block + offset + 2);
+		if (code == PCAPNG_OPTION_END || offset + 4 + len > block_len - 4)
+			break;
+		if (code == PCAPNG_OPTION_IF_TSRESOL && len >= 1) {
+			uint8_t resolution = block[offset + 4];
+			interface->ts_shift = 0;
+			interface->ts_divisor = 1;
+			if (resolution & 0x80)
+				interface->ts_shift = MIN(resolution & 0x7f, 63);
+			else
+				for (uint8_t i = 0; i < MIN(resolution, 19); i++)
+					interface->ts_divisor *= 10;
+		}
+		offset += 4 + ((len + 3) & ~3);
+	}
+}
+
+/* Read a block of a pcapng capture */
+static int input_pcap_read_block(struct input_pcap_state* state)
+{
+	int result = input_pcap_fill(state, 12);
+	if (result != 1)
+		return input_pcap_incomplete(state, result);
+
+	/* The byte order is set by each section header block, whose type reads the same either way */
+	const uint8_t* block = state->buffer + state->begin;
+	uint32_t block_type;
+	memcpy(&block_type, block, sizeof(block_type));
+	if (block_type == PCAPNG_SECTION_HEADER_BLOCK) {
+		uint32_t magic;
+		memcpy(&magic, block + 8, sizeof(magic));
+		if (magic != PCAPNG_BYTE_ORDER_MAGIC && bswap_32(magic) != PCAPNG_BYTE_ORDER_MAGIC)
+			return input_pcap_malformed(state, "malformed");
+		state->swapped = magic != PCAPNG_BYTE_ORDER_MAGIC;
+		state->nr_interfaces = 0;
+	} else {
+		block_type = input_pcap_u32(state, block);
+	}
+	size_t block_len = input_pcap_u32(state, block + 4);
+	if (block_len < 12 || block_len % 4 != 0)
+		return input_pcap_malformed(state, "malformed");
+	if (block_len > INPUT_PCAP_BUFFER_SIZE) {
+		state->skip = block_len;
+		return 1;
+	}
+	result = input_pcap_fill(state, block_len);
+	if (result != 1)
+		return result == -1 ? -1 : input_pcap_malformed(state, "truncated");
+
+	block = state->buffer + state->begin;
+	state->record_len = block_len;
+	state->packet.payload_len = 0;
+	switch (block_type) {
+	case PCAPNG_INTERFACE_DESCRIPTION_BLOCK:
+		if (block_len < 20)
+			return input_pcap_malformed(state, "malformed");
+		input_pcap_add_interface(state, block, block_len);
+		break;
+
+	case PCAPNG_ENHANCED_PACKET_BLOCK: {
+		if (block_len < 32)
+			return input_pcap_malformed(state, "malformed");
+		uint32_t interface_id = input_pcap_u32(state, block + 8);
+		size_t captured_len = input_pcap_u32(state, block + 20);
+		if (captured_len > block_len - 32)
+			return input_pcap_malformed(state, "malformed");
+		if (interface_id >= state->nr_interfaces)
+			break;
+		const struct input_pcap_interface* interface = &state->interfaces[interface_id];
+		uint64_t timestamp = ((uint64_t)input_pcap_u32(state, block + 12) << 32) | input_pcap_u32(state, block + 16);
+		state->packet.timestamp = (timestamp >> interface->ts_shift) / interface->ts_divisor;
+		dns_packet_parse(&state->packet, interface->link_type, block + 28, captured_len);
+		break;
+	}
+
+	case PCAPNG_SIMPLE_PACKET_BLOCK: {
+		/* Simple packet blocks belong to the first interface and have no timestamp */
+		if (block_len < 16)
+			return input_pcap_malformed(state, "malformed");
+		if (state->nr_interfaces == 0)
+			break;
+		size_t captured_len = MIN(input_pcap_u32(state, block + 8), block_len - 16);
+		state->packet.timestamp = 0;
+		dns_packet_parse(&state->packet, state->interfaces[0].link_type, block + 12, captured_len);
+		break;
+	}
+
+	default:
+		/* Other blocks (statistics, name resolution, ...) are of no interest */
+		break;
+	}
+	return 1;
+}
+
+/* Read the next record of the capture
+ *
+ * Returns 1 if a record was read (whose payload is empty if it isn't a DNS
+ * packet), 0 if the end of the input has been reached or -1 on error.
+ */
+static int input_pcap_read_next(struct input_pcap_state* state)
+{
+	/* Skip what's left of the previous record */
+	state->begin += state->record_len;
+	state->record_len = 0;
+	state->packet.payload_len = 0;
+	while (state->skip > 0) {
+		if (state->begin == state->end) {
+			int result = input_pcap_fill(state, 1);
+			if (result != 1)
+				return result == -1 ? -1 : input_pcap_malformed(state, "truncated");
+		}
+		size_t len = MIN(state->skip, state->end - state->begin);
+		state->begin += len;
+		state->skip -= len;
+	}
+	if (state->done)
+		return 0;
+
+	switch (state->format) {
+	case INPUT_PCAP_FORMAT_UNKNOWN:
+		return input_pcap_read_file_header(state);
+	case INPUT_PCAP_FORMAT_PCAP:
+		return input_pcap_read_record(state);
+	case INPUT_PCAP_FORMAT_PCAPNG:
+		return input_pcap_read_block(state);
+	}
+	return 0;
+}
+
+static int input_pcap_init(void** input_state_ptr)
+{
+	struct input_pcap_state* state = calloc(1, sizeof(struct input_pcap_state));
+	if (state == NULL)
+		return -1;
+	state->buffer = malloc(INPUT_PCAP_BUFFER_SIZE);
+	if (state->buffer == NULL) {
+		free(state);
+		return -1;
+	}
+	state->fd = STDIN_FILENO;
+	*input_state_ptr = state;
+	return 0;
+}
+
+static ssize_t input_pcap_next_batch(void* input_state, struct honas_input_lookup* lookups, size_t max_lookups)
+{
+	struct input_pcap_state* state = input_state;
+	size_t nr_lookups = 0;
+	while (nr_lookups < max_lookups) {
+		if (dns_packet_next_query(&state->packet, &lookups[nr_lookups])) {
+			nr_lookups++;
+			continue;
+		}
+
+		int result = input_pcap_read_next(state);
+		if (result == -1)
+			return nr_lookups > 0 ? (ssize_t)nr_lookups : -1;
+		if (result == 0)
+			break;
+	}
+	return nr_lookups;
+}
+
+static ssize_t input_pcap_next(void* input_state, struct in_addr46* client, uint8_t** host_name)
+{
+	struct input_pcap_state* state = input_state;
+	ssize_t result = input_pcap_next_batch(state, &state->lookup, 1);
+	if (result <= 0)
+		return result;
+	*client = state->lookup.client;
+	*host_name = state->lookup.host_name;
+	return state->lookup.host_name_length;
+}
+
+static void input_pcap_destroy(void* input_state)
+{
+	struct input_pcap_state* state = input_state;
+	if (state == NULL)
+		return;
+	if (state->close_fd)
+		close(state->fd);
+	free(state->buffer);
+	free(state);
+}
+
+void input_pcap_set_fd(void* input_state, int fd)
+{
+	struct input_pcap_state* state = input_state;
+	if (state->close_fd)
+		close(state->fd);
+	state->fd = fd;
+	state->close_fd = true;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+bool input_pcap_is_capture(int fd)
+{
+	uint32_t magic;
+	if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+		return false;
+	return magic == PCAPNG_SECTION_HEADER_BLOCK ||
+		magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+		bswap_32(magic) == PCAP_MAGIC_USEC || bswap_32(magic) == PCAP_MAGIC_NSEC;
+}
+
+const honas_input_t input_pcap = {
+	.name = "pcap",
+	.init = input_pcap_init,
+	.next = input_pcap_next,
+	.next_batch = input_pcap_next_batch,
+	.destroy = input_pcap_destroy,
+};
@@ -104,12 +104,12 @@ void instrumentation_dump(struct instrumentation* p_inst, char* const out_str, c
 		p_inst->memory_usage_kb = r_usage.ru_maxrss;
 
 		// Dump the instrumentation data to a structured single-line string.
-		snprintf(out_str, str_length, "Instrumentation: n_proc=%zu,n_acc=%zu,n_skip=%zu,n_qsec=%zu,n_qa=%zu,n_qaaaa=%zu,n_qns=%zu,n_qmx=%zu,n_qptr=%zu,mem_usg_kb=%zu,n_qcat=%zu,n_qncat=%zu,n_invfrm=%zu\n"
+		snprintf(out_str, str_length, "Instrumentation: n_proc=%zu,n_acc=%zu,n_skip=%zu,n_qsec=%zu,n_qa=%zu,n_qaaaa=%zu,n_qns=%zu,n_qmx=%zu,n_qptr=%zu,mem_usg_kb=%zu,n_qcat=%zu,n_qncat=%zu,n_invfrm=%zu,n_shed=%zu,max_lag=%zu,max_smpl=%zu\n"
 			, p_inst->n_processed_queries, p_inst->n_accepted_queries, p_inst->n_skipped_queries
 			, p_inst->n_queries_sec, p_inst->n_a_queries, p_inst->n_aaaa_queries
 			, p_inst->n_ns_queries, p_inst->n_mx_queries, p_inst->n_ptr_queries, p_inst->memory_usage_kb
 			, p_inst->subnet_aggregates.n_queries_in_subnet, p_inst->subnet_aggregates.n_queries_not_in_subnet
-			, p_inst->n_invalid_frames);
+			, p_inst->n_invalid_frames, p_inst->n_shed_queries, p_inst->max_lag, p_inst->max_sampling_rate);
 	}
 }
 
@@ -130,6 +130,9 @@ void instrumentation_reset(struct instrumentation* p_inst)
 		p_inst->subnet_aggregates.n_queries_in_subnet = 0;
 		p_inst->subnet_aggregates.n_queries_not_in_subnet = 0;
 		p_inst->n_invalid_frames = 0;
+		p_inst->n_shed_queries = 0;
+		p_inst->max_lag = 0;
+		p_inst->max_sampling_rate = 0;
 	}
 }
 
@@ -176,3 +179,28 @@ void instrumentation_increment_invalid(struct instrumentation* p_inst)
 		++p_inst->n_invalid_frames;
 	}
 }
+
+// Increments the number of queries that were shed because of overload.
+void instrumentation_increment_shed(struct instrumentation* p_inst)
+{
+	if (p_inst)
+	{
+		++p_inst->n_shed_queries;
+	}
+}
+
+// Updates the maximum processing lag of the input and the maximum sampling rate.
+void instrumentation_update_lag(struct instrumentation* p_inst, const size_t lag, const size_t sampling_rate)
+{
+	if (p_inst)
+	{
+		if (lag > p_inst->max_lag)
+		{
+			p_inst->max_lag = lag;
+		}
+		if (sampling_rate > p_inst->max_sampling_rate)
+		{
+			p_inst->max_sampling_rate = sampling_rate;
+		}
+	}
+}
@@ -217,6 +217,13 @@ void json_printer_end(json_printer_t* ctx)
 	ctx->out = NULL;
 }
 
+void json_printer_abort(json_printer_t* ctx)
+{
+	fflush_unlocked(ctx->out);
+	funlockfile(ctx->out);
+	ctx->out = NULL;
+}
+
 void json_printer_uint32(json_printer_t* ctx, uint32_t val)
 {
 	json_printer_stack_assert_expect_value(ctx);
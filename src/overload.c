@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "overload.h"
+
+#include "byte_slice.h"
+
+#include <ctype.h>
+
+/* Seed of the client sampling hash (differs from the one used for filter selection, to keep these independent) */
+#define OVERLOAD_CLIENT_HASH_SEED 0x9e3779b9U
+
+/* Parse a single `<lag>:<sampling rate>` level */
+static int overload_level_parse(const char* text, struct overload_level* level)
+{
+	char* end;
+	errno = 0;
+	unsigned long long lag = strtoull(text, &end, 10);
+	if (errno != 0 || end == text || !isdigit((unsigned char)text[0]))
+		return -1;
+
+	uint64_t unit;
+	if (strncmp(end, "ms:", 3) == 0) {
+		unit = 1;
+		end += 2;
+	} else if (strncmp(end, "s:", 2) == 0) {
+		unit = 1000;
+		end += 1;
+	} else {
+		return -1;
+	}
+	if (lag == 0 || lag > UINT64_MAX / unit)
+		return -1;
+
+	text = end + 1;
+	unsigned long sampling_rate = strtoul(text, &end, 10);
+	if (errno != 0 || end == text || *end != '\0' || !isdigit((unsigned char)text[0]) || sampling_rate < 2 || sampling_rate > UINT32_MAX)
+		return -1;
+
+	level->lag = lag * unit;
+	level->sampling_rate = sampling_rate;
+	return 0;
+}
+
+int overload_policy_parse(struct overload_policy* policy, const char* spec)
+{
+	memset(policy, 0, sizeof(*policy));
+	if (spec == NULL)
+		return 0;
+
+	char* copy = strdup(spec);
+	if (copy == NULL)
+		return -1;
+
+	int result = 0;
+	char* saveptr = NULL;
+	for (char* text = strtok_r(copy, " \t", &saveptr); text != NULL; text = strtok_r(NULL, " \t", &saveptr)) {
+		struct overload_level level;
+		if (policy->nr_levels == OVERLOAD_MAX_LEVELS || overload_level_parse(text, &level) == -1) {
+			result = -1;
+			break;
+		}
+
+		/* Each level should shed more load than the previous one */
+		if (policy->nr_levels > 0) {
+			const struct overload_level* previous = &policy->levels[policy->nr_levels - 1];
+			if (level.lag <= previous->lag || level.sampling_rate <= previous->sampling_rate) {
+				result = -1;
+				break;
+			}
+		}
+		policy->levels[policy->nr_levels++] = level;
+	}
+	free(copy);
+
+	if (result == -1 || policy->nr_levels == 0) {
+		result = -1;
+		memset(policy, 0, sizeof(*policy));
+		errno = EINVAL;
+	}
+	return result;
+}
+
+bool overload_policy_is_valid(const char* spec)
+{
+	struct overload_policy policy;
+	return overload_policy_parse(&policy, spec) == 0;
+}
+
+uint32_t overload_policy_update(struct overload_policy* policy, uint64_t lag, uint64_t now)
+{
+	if (policy->level < policy->nr_levels && lag >= policy->levels[policy->level].lag) {
+		while (policy->level < policy->nr_levels && lag >= policy->levels[policy->level].lag)
+			policy->level++;
+		policy->raised = now;
+	} else if (now >= policy->raised + OVERLOAD_MIN_HOLD_TIME) {
+		while (policy->level > 0 && lag < policy->levels[policy->level - 1].lag / 2)
+			policy->level--;
+	}
+	return overload_policy_sampling_rate(policy);
+}
+
+bool overload_client_is_sampled(const struct in_addr46* client, uint32_t sampling_rate)
+{
+	if (sampling_rate <= 1)
+		return true;
+
+	uint64_t client_hash;
+	if (client->af == AF_INET)
+		client_hash = byte_slice_MurmurHash64A(byte_slice_from_scalar(client->in.addr4.s_addr), OVERLOAD_CLIENT_HASH_SEED);
+	else
+		client_hash = byte_slice_MurmurHash64A(byte_slice_from_scalar(client->in.addr6.s6_addr), OVERLOAD_CLIENT_HASH_SEED);
+
+	/* The upper 32 bits of the hash are evenly spread, so 1 in `sampling_rate` of these are below 2^32 / `sampling_rate` */
+	return (client_hash >> 32) * sampling_rate < (UINT64_C(1) << 32);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "page_prefetch.h"
+
+#include "defines.h"
+#include "logging.h"
+
+/* Number of recently requested pages that are remembered, so that these aren't requested again */
+#define PAGE_PREFETCH_RECENT_PAGES 256
+
+struct page_prefetch {
+	uintptr_t recent_pages[PAGE_PREFETCH_RECENT_PAGES];
+	uintptr_t* pages;   ///< The collected pages for which no readahead hints have been given yet
+	size_t nr_queued;   ///< Number of collected pages
+	size_t batch_size;  ///< Maximum number of collected pages
+	size_t nr_pages;
+	size_t nr_hints;
+	size_t nr_failed;
+};
+
+static int page_prefetch_compare(const void* a, const void* b)
+{
+	uintptr_t page_a = *(const uintptr_t*)a;
+	uintptr_t page_b = *(const uintptr_t*)b;
+	return page_a < page_b ? -1 : page_a > page_b;
+}
+
+struct page_prefetch* page_prefetch_create(unsigned int batch_size)
+{
+	assert(batch_size > 0);
+	struct page_prefetch* prefetch = calloc(1, sizeof(struct page_prefetch));
+	log_passert(prefetch != NULL, "Failed to allocate page prefetcher");
+	prefetch->pages = malloc(batch_size * sizeof(uintptr_t));
+	log_passert(prefetch->pages != NULL, "Failed to allocate page prefetcher batch");
+	prefetch->batch_size = batch_size;
+	return prefetch;
+}
+
+void page_prefetch_page(struct page_prefetch* prefetch, const void* address)
+{
+	uintptr_t page = (uintptr_t)address & ~((uintptr_t)PAGE_SIZE - 1);
+	uintptr_t* recent_page = &prefetch->recent_pages[(page >> PAGE_SHIFT) % PAGE_PREFETCH_RECENT_PAGES];
+	if (*recent_page == page)
+		return;
+	*recent_page = page;
+	prefetch->nr_pages++;
+
+	prefetch->pages[prefetch->nr_queued++] = page;
+	if (prefetch->nr_queued == prefetch->batch_size)
+		page_prefetch_submit(prefetch);
+}
+
+void page_prefetch_submit(struct page_prefetch* prefetch)
+{
+	/* Each run of adjacent pages gets a single hint (pages requested more than once are part of the same run) */
+	qsort(prefetch->pages, prefetch->nr_queued, sizeof(uintptr_t), page_prefetch_compare);
+	for (size_t i = 0, end; i < prefetch->nr_queued; i = end) {
+		uintptr_t last = prefetch->pages[i];
+		for (end = i + 1; end < prefetch->nr_queued && prefetch->pages[end] - last <= PAGE_SIZE; end++)
+			last = prefetch->pages[end];
+		prefetch->nr_hints++;
+		if (madvise((void*)prefetch->pages[i], last - prefetch->pages[i] + PAGE_SIZE, MADV_WILLNEED) == -1)
+			prefetch->nr_failed++;
+	}
+	prefetch->nr_queued = 0;
+}
+
+size_t page_prefetch_nr_pages(const struct page_prefetch* prefetch)
+{
+	return prefetch->nr_pages;
+}
+
+size_t page_prefetch_nr_hints(const struct page_prefetch* prefetch)
+{
+	return prefetch->nr_hints;
+}
+
+void page_prefetch_destroy(struct page_prefetch* prefetch)
+{
+	page_prefetch_submit(prefetch);
+	if (prefetch->nr_failed > 0)
+		log_msg(DEBUG, "Failed %zu of %zu readahead hint(s) for %zu page(s)", prefetch->nr_failed, prefetch->nr_hints, prefetch->nr_pages);
+	free(prefetch->pages);
+	free(prefetch);
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "probe_cache.h"
+
+#include "logging.h"
+#include "uthash.h"
+
+#include <openssl/sha.h>
+#include <stddef.h>
+
+/* A cached probe result */
+struct probe_cache_entry {
+	UT_hash_handle hh;
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	uint32_t hits;
+	uint8_t filters_hit[];
+};
+
+struct probe_cache {
+	char* filename;
+	struct probe_cache_file_header header; ///< The identity of the state file; written as is when saving
+	struct probe_cache_entry* entries;
+	size_t nr_entries;
+	bool dirty;                            ///< Whether results were added since the cache was read
+};
+
+/* The part of the header that has to match for the cache to be valid */
+#define PROBE_CACHE_IDENTITY_BEGIN offsetof(struct probe_cache_file_header, state_device)
+#define PROBE_CACHE_IDENTITY_END offsetof(struct probe_cache_file_header, number_of_entries)
+
+static struct probe_cache_entry* probe_cache_entry_alloc(const struct probe_cache* cache)
+{
+	struct probe_cache_entry* entry = malloc(sizeof(struct probe_cache_entry) + cache->header.filters_hit_size);
+	log_passert(entry != NULL, "Failed to allocate probe cache entry");
+	return entry;
+}
+
+/* Read the cached probe results, if the cache file still belongs to the state file */
+static void probe_cache_read(struct probe_cache* cache)
+{
+	FILE* fh = fopen(cache->filename, "r");
+	if (fh == NULL) {
+		if (errno != ENOENT)
+			log_perror(WARNING, "Unable to open probe cache '%s'", cache->filename);
+		return;
+	}
+
+	struct probe_cache_file_header header;
+	if (
+		fread(&header, sizeof(header), 1, fh) != 1
+		|| memcmp(header.file_magic, PROBE_CACHE_FILE_MAGIC, sizeof(header.file_magic)) != 0
+		|| header.major_version != CURRENT_PROBE_CACHE_MAJOR_VERSION
+		|| memcmp((uint8_t*)&header + PROBE_CACHE_IDENTITY_BEGIN, (uint8_t*)&cache->header + PROBE_CACHE_IDENTITY_BEGIN, PROBE_CACHE_IDENTITY_END - PROBE_CACHE_IDENTITY_BEGIN) != 0) {
+		log_msg(INFO, "Ignoring outdated probe cache '%s'", cache->filename);
+		fclose(fh);
+		return;
+	}
+
+	for (uint64_t i = 0; i < header.number_of_entries && cache->nr_entries < PROBE_CACHE_MAX_ENTRIES; i++) {
+		struct probe_cache_entry* entry = probe_cache_entry_alloc(cache);
+		if (
+			fread(entry->hash, sizeof(entry->hash), 1, fh) != 1
+			|| fread(&entry->hits, sizeof(entry->hits), 1, fh) != 1
+			|| fread(entry->filters_hit, header.filters_hit_size, 1, fh) != 1) {
+			log_msg(WARNING, "Probe cache '%s' is truncated", cache->filename);
+			free(entry);
+			break;
+		}
+		HASH_ADD(hh, cache->entries, hash, sizeof(entry->hash), entry);
+		cache->nr_entries++;
+	}
+	fclose(fh);
+	log_msg(DEBUG, "Read %zu cached probe results from '%s'", cache->nr_entries, cache->filename);
+}
+
+struct probe_cache* probe_cache_open(const char* state_file, const honas_state_t* state)
+{
+	struct stat st;
+	if (stat(state_file, &st) == -1)
+		return NULL;
+
+	struct probe_cache* cache = calloc(1, sizeof(struct probe_cache));
+	log_passert(cache != NULL, "Failed to allocate probe cache");
+	cache->filename = malloc(strlen(state_file) + sizeof(PROBE_CACHE_FILE_SUFFIX));
+	log_passert(cache->filename != NULL, "Failed to allocate probe cache filename");
+	sprintf(cache->filename, "%s%s", state_file, PROBE_CACHE_FILE_SUFFIX);
+
+	struct probe_cache_file_header* header = &cache->header;
+	memcpy(header->file_magic, PROBE_CACHE_FILE_MAGIC, sizeof(header->file_magic));
+	header->major_version = CURRENT_PROBE_CACHE_MAJOR_VERSION;
+	header->minor_version = CURRENT_PROBE_CACHE_MINOR_VERSION;
+	header->state_device = st.st_dev;
+	header->state_inode = st.st_ino;
+	header->state_size = st.st_size;
+	header->state_mtime_sec = st.st_mtim.tv_sec;
+	header->state_mtime_nsec = st.st_mtim.tv_nsec;
+	header->number_of_filters = state->header->number_of_filters;
+	header->filters_hit_size = (state->header->number_of_filters + 7) / 8;
+
+	probe_cache_read(cache);
+	return cache;
+}
+
+bool probe_cache_lookup(const struct probe_cache* cache, const uint8_t* hash, uint32_t* hits, byte_slice_t filters_hit)
+{
+	struct probe_cache_entry* entry;
+	HASH_FIND(hh, cache->entries, hash, SHA256_DIGEST_LENGTH, entry);
+	if (entry == NULL)
+		return false;
+
+	*hits = entry->hits;
+	memset(filters_hit.bytes, 0, filters_hit.len);
+	memcpy(filters_hit.bytes, entry->filters_hit, MIN(filters_hit.len, cache->header.filters_hit_size));
+	return true;
+}
+
+void probe_cache_add(struct probe_cache* cache, const uint8_t* hash, uint32_t hits, const byte_slice_t filters_hit)
+{
+	if (cache->nr_entries >= PROBE_CACHE_MAX_ENTRIES)
+		return;
+
+	struct probe_cache_entry* entry;
+	HASH_FIND(hh, cache->entries, hash, SHA256_DIGEST_LENGTH, entry);
+	if (entry != NULL)
+		return;
+
+	entry = probe_cache_entry_alloc(cache);
+	memcpy(entry->hash, hash, sizeof(entry->hash));
+	entry->hits = hits;
+	size_t len = MIN(filters_hit.len, cache->header.filters_hit_size);
+	memcpy(entry->filters_hit, filters_hit.bytes, len);
+	memset(entry->filters_hit + len, 0, cache->header.filters_hit_size - len);
+	HASH_ADD(hh, cache->entries, hash, sizeof(entry->hash), entry);
+	cache->nr_entries++;
+	cache->dirty = true;
+}
+
+int probe_cache_save(struct probe_cache* cache)
+{
+	if (!cache->dirty)
+		return 0;
+	int saved_errno;
+	FILE* fh = NULL;
+
+	/* The cache file is replaced at once, so concurrent searches never read a partially written cache */
+	char* tmp_filename = alloca(strlen(cache->filename) + 8);
+	sprintf(tmp_filename, "%s.XXXXXX", cache->filename);
+	int fd = mkstemp(tmp_filename);
+	if (fd == -1)
+		return -1;
+	if ((fh = fdopen(fd, "w")) == NULL || fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP) == -1)
+		goto err_out;
+
+	cache->header.number_of_entries = cache->nr_entries;
+	fwrite(&cache->header, sizeof(cache->header), 1, fh);
+	for (struct probe_cache_entry* entry = cache->entries; entry != NULL; entry = entry->hh.next) {
+		fwrite(entry->hash, sizeof(entry->hash), 1, fh);
+		fwrite(&entry->hits, sizeof(entry->hits), 1, fh);
+		fwrite(entry->filters_hit, cache->header.filters_hit_size, 1, fh);
+	}
+	if (ferror(fh))
+		goto err_out;
+	int err = fclose(fh);
+	fh = NULL;
+	fd = -1;
+	if (err != 0 || rename(tmp_filename, cache->filename) == -1)
+		goto err_out;
+
+	log_msg(DEBUG, "Saved %zu probe results to '%s'", cache->nr_entries, cache->filename);
+	cache->dirty = false;
+	return 0;
+
+err_out:
+	saved_errno = errno;
+	if (fh != NULL)
+		fclose(fh);
+	else if (fd != -1)
+		close(fd);
+	unlink(tmp_filename);
+	errno = saved_errno;
+	return -1;
+}
+
+void probe_cache_destroy(struct probe_cache* cache)
+{
+	struct probe_cache_entry *entry, *tmp;
+	HASH_ITER(hh, cache->entries, entry, tmp)
+	{
+		HASH_DEL(cache->entries, entry);
+		free(entry);
+	}
+	free(cache->filename);
+	free(cache);
+}
@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "sealed_state.h"
+#include "crc32c.h"
+#include "logging.h"
+
+#if BYTE_ORDER != LITTLE_ENDIAN
+#error The currrent implementation only works properly on a little endian machine!
+#endif
+
+/* Keeps the data 8 byte aligned (for efficient bitwise operations) */
+static uint64_t round_up_to_8(uint64_t value)
+{
+	return (value + 7) & ~7ULL;
+}
+
+static bool region_is_valid(size_t size, uint64_t offset, uint64_t length)
+{
+	return offset <= size && length <= size - offset;
+}
+
+static size_t block_length(const honas_sealed_state_t* sealed, uint32_t block)
+{
+	size_t block_begin = (size_t)block * sealed->header->block_size;
+	return MIN(sealed->header->block_size, sealed->filter_size - block_begin);
+}
+
+static byte_slice_t block_compressed_data(const honas_sealed_state_t* sealed, const struct honas_sealed_state_block* block)
+{
+	return byte_slice((uint8_t*)sealed->data + block->offset, block->size);
+}
+
+/* Marks the sealed state as corrupt; always returns -1 */
+static int block_corrupt(honas_sealed_state_t* sealed, uint32_t filter, uint32_t block)
+{
+	if (!sealed->corrupt)
+		log_msg(ERR, "Block %u of filter %u in sealed honas state is corrupt", block, filter);
+	sealed->corrupt = true;
+	errno = EBADMSG;
+	return -1;
+}
+
+/* Verifies the checksum of the compressed data of a block, the first time it's used */
+static int block_verify(honas_sealed_state_t* sealed, uint32_t filter, uint32_t block)
+{
+	uint32_t block_nr = filter * sealed->header->blocks_per_filter + block;
+	if (sealed->block_checksums == NULL || sealed->block_verified[block_nr])
+		return 0;
+	if (crc32c(0, block_compressed_data(sealed, &sealed->blocks[block_nr])) != sealed->block_checksums[block_nr])
+		return block_corrupt(sealed, filter, block);
+	sealed->block_verified[block_nr] = 1;
+	return 0;
+}
+
+int honas_sealed_state_open(honas_sealed_state_t* sealed, const void* data, size_t size, uint32_t cache_blocks)
+{
+	assert(sealed->data == NULL);
+	assert(cache_blocks > 0);
+	const struct honas_sealed_state_file_header* header = (const struct honas_sealed_state_file_header*)data;
+
+	/* Check sealed state file compatibility */
+	if (
+		size < sizeof(struct honas_sealed_state_file_header)
+		|| memcmp(header->file_magic, HONAS_SEALED_STATE_FILE_MAGIC, sizeof(header->file_magic)) != 0
+		|| (header->major_version != CURRENT_HONAS_SEALED_STATE_MAJOR_VERSION && header->major_version != INTERLEAVED_HONAS_SEALED_STATE_MAJOR_VERSION))
+		return 1;
+
+	/* Version 2 sealed states have interleaved filters and all features of version 1.3 */
+	bool interleaved = header->major_version == INTERLEAVED_HONAS_SEALED_STATE_MAJOR_VERSION;
+	if (interleaved != ((header->flags & HONAS_SEALED_STATE_FLAG_INTERLEAVED) != 0))
+		return 2;
+
+	/* Verify the location of the different parts of the sealed state file */
+	if (
+		header->block_size == 0
+		|| (header->block_size & 0x7) != 0
+		|| header->state_header_size < sizeof(struct honas_state_file_header)
+		|| !region_is_valid(size, header->state_header_offset, header->state_header_size))
+		return 2;
+
+	const struct honas_state_file_header* state_header = (const struct honas_state_file_header*)((const uint8_t*)data + header->state_header_offset);
+	uint32_t fold_factor;
+	if (
+		state_header->number_of_filters == 0
+		|| header->state_header_size < sizeof(struct honas_state_file_header) + sizeof(uint32_t) * (uint64_t)state_header->number_of_filters
+		|| !honas_state_header_fold_factor(state_header, header->state_header_size, &fold_factor))
+		return 2;
+
+	size_t filter_size = (state_header->number_of_bits_per_filter >> 3) >> fold_factor;
+	if (
+		filter_size == 0
+		|| (interleaved && (header->block_size < HONAS_STATE_MIN_SHARED_BLOCK_SIZE || (header->block_size & (header->block_size - 1)) != 0 || filter_size % header->block_size != 0))
+		|| !region_is_valid(size, header->client_hll_offset, state_header->client_hll_size)
+		|| !region_is_valid(size, header->host_name_hll_offset, state_header->host_name_hll_size)
+		|| header->blocks_per_filter != (filter_size + header->block_size - 1) / header->block_size
+		|| !region_is_valid(size, header->block_index_offset, (uint64_t)state_header->number_of_filters * header->blocks_per_filter * sizeof(struct honas_sealed_state_block)))
+		return 2;
+
+	const struct honas_sealed_state_block* blocks = (const struct honas_sealed_state_block*)((const uint8_t*)data + header->block_index_offset);
+	size_t nr_blocks = (size_t)state_header->number_of_filters * header->blocks_per_filter;
+	for (size_t i = 0; i < nr_blocks; i++) {
+		if (blocks[i].codec >= BLOCK_CODEC_MAX || !region_is_valid(size, blocks[i].offset, blocks[i].size))
+			return 2;
+	}
+
+	/* The checksums follow the block index */
+	const uint32_t* block_checksums = NULL;
+	uint64_t block_checksums_offset = header->block_index_offset + nr_blocks * sizeof(struct honas_sealed_state_block);
+	if ((interleaved || header->minor_version >= 2) && (header->flags & HONAS_SEALED_STATE_FLAG_BLOCK_CHECKSUMS)) {
+		if (!region_is_valid(size, block_checksums_offset, nr_blocks * sizeof(uint32_t)))
+			return 2;
+		block_checksums = (const uint32_t*)((const uint8_t*)data + block_checksums_offset);
+	}
+
+	/* The summary follows the checksums; it's the filters folded in half at least once */
+	byte_slice_t summary = { 0 };
+	if ((interleaved || header->minor_version >= 3) && (header->flags & HONAS_SEALED_STATE_FLAG_SUMMARY)) {
+		uint64_t summary_offset = round_up_to_8(block_checksums_offset + (block_checksums != NULL ? nr_blocks * sizeof(uint32_t) : 0));
+		if (!region_is_valid(size, summary_offset, sizeof(struct honas_sealed_state_summary)))
+			return 2;
+		const struct honas_sealed_state_summary* summary_header = (const struct honas_sealed_state_summary*)((const uint8_t*)data + summary_offset);
+		summary = byte_slice((uint8_t*)(summary_header + 1), summary_header->size);
+		if (
+			!region_is_valid(size, summary_offset + sizeof(struct honas_sealed_state_summary), summary_header->size)
+			|| summary.len == 0
+			|| summary.len >= filter_size
+			|| filter_size % summary.len != 0
+			|| ((filter_size / summary.len) & (filter_size / summary.len - 1)) != 0
+			|| crc32c(0, summary) != summary_header->checksum)
+			return 2;
+	}
+
+	sealed->header = header;
+	sealed->state_header = state_header;
+	sealed->blocks = blocks;
+	sealed->block_checksums = block_checksums;
+	sealed->summary = summary;
+	sealed->data = (const uint8_t*)data;
+	sealed->size = size;
+	sealed->filter_size = filter_size;
+	sealed->shared_block_size = interleaved ? header->block_size : 0;
+
+	/* Allocate the block cache */
+	sealed->probe_uncached = cache_blocks < nr_blocks;
+	sealed->cache_blocks = MIN(cache_blocks, nr_blocks);
+	sealed->cache_data = (uint8_t*)malloc((size_t)sealed->cache_blocks * header->block_size);
+	sealed->cache_block_nrs = (uint32_t*)calloc(sealed->cache_blocks, sizeof(uint32_t));
+	sealed->cache_last_used = (uint64_t*)calloc(sealed->cache_blocks, sizeof(uint64_t));
+	sealed->block_cache_slots = (int32_t*)malloc(nr_blocks * sizeof(int32_t));
+	log_passert(sealed->cache_data != NULL && sealed->cache_block_nrs != NULL && sealed->cache_last_used != NULL && sealed->block_cache_slots != NULL,
+		"Failed to allocate sealed honas state block cache");
+	for (size_t i = 0; i < nr_blocks; i++)
+		sealed->block_cache_slots[i] = -1;
+	sealed->cache_clock = 0;
+	sealed->cache_hits = 0;
+	sealed->cache_misses = 0;
+	sealed->block_probes = 0;
+	sealed->block_verified = NULL;
+	if (block_checksums != NULL) {
+		sealed->block_verified = (uint8_t*)calloc(nr_blocks, 1);
+		log_passert(sealed->block_verified != NULL, "Failed to allocate sealed honas state block checksum administration");
+	}
+	sealed->corrupt = false;
+	pthread_mutex_init(&sealed->lock, NULL);
+	return 0;
+}
+
+void honas_sealed_state_close(honas_sealed_state_t* sealed)
+{
+	if (sealed->data != NULL)
+		pthread_mutex_destroy(&sealed->lock);
+	free(sealed->cache_data);
+	free(sealed->cache_block_nrs);
+	free(sealed->cache_last_used);
+	free(sealed->block_cache_slots);
+	free(sealed->block_verified);
+	memset(sealed, 0, sizeof(honas_sealed_state_t));
+}
+
+byte_slice_t honas_sealed_state_client_hll_data(const honas_sealed_state_t* sealed)
+{
+	return byte_slice((uint8_t*)sealed->data + sealed->header->client_hll_offset, sealed->state_header->client_hll_size);
+}
+
+byte_slice_t honas_sealed_state_host_name_hll_data(const honas_sealed_state_t* sealed)
+{
+	return byte_slice((uint8_t*)sealed->data + sealed->header->host_name_hll_offset, sealed->state_header->host_name_hll_size);
+}
+
+int honas_sealed_state_block(honas_sealed_state_t* sealed, uint32_t filter, uint32_t block, byte_slice_t* data)
+{
+	assert(filter < sealed->state_header->number_of_filters);
+	assert(block < sealed->header->blocks_per_filter);
+	uint32_t block_nr = filter * sealed->header->blocks_per_filter + block;
+	size_t length = block_length(sealed, block);
+
+	int32_t slot = sealed->block_cache_slots[block_nr];
+	if (slot != -1) {
+		sealed->cache_hits++;
+		sealed->cache_last_used[slot] = ++sealed->cache_clock;
+		*data = byte_slice(sealed->cache_data + (size_t)slot * sealed->header->block_size, length);
+		return 0;
+	}
+	sealed->cache_misses++;
+	if (block_verify(sealed, filter, block) == -1)
+		return -1;
+
+	/* Evict the least recently used block (unused slots have never been used) */
+	slot = 0;
+	for (uint32_t i = 1; i < sealed->cache_blocks; i++) {
+		if (sealed->cache_last_used[i] < sealed->cache_last_used[slot])
+			slot = i;
+	}
+	if (sealed->cache_last_used[slot] != 0)
+		sealed->block_cache_slots[sealed->cache_block_nrs[slot]] = -1;
+
+	byte_slice_t decompressed = byte_slice(sealed->cache_data + (size_t)slot * sealed->header->block_size, length);
+	const struct honas_sealed_state_block* entry = &sealed->blocks[block_nr];
+	if (block_codec_decompress(entry->codec, block_compressed_data(sealed, entry), decompressed) == -1) {
+		/* The slot may have been partially overwritten */
+		sealed->cache_last_used[slot] = 0;
+		return block_corrupt(sealed, filter, block);
+	}
+
+	sealed->cache_block_nrs[slot] = block_nr;
+	sealed->cache_last_used[slot] = ++sealed->cache_clock;
+	sealed->block_cache_slots[block_nr] = slot;
+	*data = decompressed;
+	return 0;
+}
+
+/* Check the bits of a filter; the caller holds the lock */
+static int filter_all_bits_set(honas_sealed_state_t* sealed, uint32_t filter, const size_t* bit_offsets, size_t nr_offsets)
+{
+	size_t block_bits = (size_t)sealed->header->block_size << 3;
+	uint32_t current_block = UINT32_MAX;
+	const struct honas_sealed_state_block* entry = NULL;
+	bool probe = false;
+	byte_slice_t block_data = { 0 };
+
+	for (size_t i = 0; i < nr_offsets; i++) {
+		uint32_t block = bit_offsets[i] / block_bits;
+		size_t bit = bit_offsets[i] - block * block_bits;
+		if (block != current_block) {
+			uint32_t block_nr = filter * sealed->header->blocks_per_filter + block;
+			entry = &sealed->blocks[block_nr];
+			probe = sealed->probe_uncached && sealed->block_cache_slots[block_nr] == -1 && block_codec_supports_probing(entry->codec);
+			if (probe) {
+				if (block_verify(sealed, filter, block) == -1)
+					return -1;
+				block_data = block_compressed_data(sealed, entry);
+			} else if (honas_sealed_state_block(sealed, filter, block, &block_data) == -1) {
+				return -1;
+			}
+			current_block = block;
+		}
+		if (probe) {
+			sealed->block_probes++;
+			int is_set = block_codec_bit_is_set(entry->codec, block_data, block_length(sealed, block), bit);
+			if (is_set == -1)
+				return block_corrupt(sealed, filter, block);
+			if (!is_set)
+				return 0;
+		} else if (!byte_slice_bit_is_set(block_data, bit)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Decompress a whole filter; the caller holds the lock */
+static int filter_decompress(honas_sealed_state_t* sealed, uint32_t filter, byte_slice_t dst)
+{
+	assert(filter < sealed->state_header->number_of_filters);
+	assert(dst.len == sealed->filter_size);
+
+	for (uint32_t block = 0; block < sealed->header->blocks_per_filter; block++) {
+		const struct honas_sealed_state_block* entry = &sealed->blocks[filter * sealed->header->blocks_per_filter + block];
+		byte_slice_t decompressed = byte_slice(dst.bytes + (size_t)block * sealed->header->block_size, block_length(sealed, block));
+		if (block_verify(sealed, filter, block) == -1)
+			return -1;
+		if (block_codec_decompress(entry->codec, block_compressed_data(sealed, entry), decompressed) == -1)
+			return block_corrupt(sealed, filter, block);
+	}
+	return 0;
+}
+
+/* Bitwise OR a filter into `target`; the caller holds the lock */
+static int filter_bitwise_or(honas_sealed_state_t* sealed, uint32_t filter, byte_slice_t target)
+{
+	assert(target.len == sealed->filter_size);
+
+	for (uint32_t block = 0; block < sealed->header->blocks_per_filter; block++) {
+		byte_slice_t block_data;
+		if (honas_sealed_state_block(sealed, filter, block, &block_data) == -1)
+			return -1;
+		byte_slice_bitwise_or(byte_slice(target.bytes + (size_t)block * sealed->header->block_size, block_data.len), block_data);
+	}
+	return 0;
+}
+
+int honas_sealed_state_all_bits_set(honas_sealed_state_t* sealed, uint32_t filter, const size_t* bit_offsets, size_t nr_offsets)
+{
+	pthread_mutex_lock(&sealed->lock);
+	int result = filter_all_bits_set(sealed, filter, bit_offsets, nr_offsets);
+	pthread_mutex_unlock(&sealed->lock);
+	return result;
+}
+
+int honas_sealed_state_decompress_filter(honas_sealed_state_t* sealed, uint32_t filter, byte_slice_t dst)
+{
+	pthread_mutex_lock(&sealed->lock);
+	int result = filter_decompress(sealed, filter, dst);
+	pthread_mutex_unlock(&sealed->lock);
+	return result;
+}
+
+int honas_sealed_state_bitwise_or_filter(honas_sealed_state_t* sealed, uint32_t filter, byte_slice_t target)
+{
+	pthread_mutex_lock(&sealed->lock);
+	int result = filter_bitwise_or(sealed, filter, target);
+	pthread_mutex_unlock(&sealed->lock);
+	return result;
+}
+
+uint64_t honas_sealed_state_filter_compressed_size(const honas_sealed_state_t* sealed, uint32_t filter)
+{
+	uint64_t compressed_size = 0;
+	for (uint32_t block = 0; block < sealed->header->blocks_per_filter; block++)
+		compressed_size += sealed->blocks[filter * sealed->header->blocks_per_filter + block].size;
+	return compressed_size;
+}
+
+static int pwrite_all(int fd, const void* data, size_t size, uint64_t offset)
+{
+	size_t total_written = 0;
+	while (total_written < size) {
+		ssize_t written = pwrite(fd, (const uint8_t*)data + total_written, size - total_written, offset + total_written);
+		if (written == -1)
+			return -1;
+		total_written += written;
+	}
+	return 0;
+}
+
+int honas_sealed_state_write(const honas_state_t* state, const char* filename, uint32_t block_size, uint32_t codec_mask, struct honas_sealed_state_write_stats* stats)
+{
+	assert(state->header != NULL);
+	assert(state->filters != NULL);
+	assert(block_size > 0 && (block_size & 0x7) == 0);
+	int saved_errno;
+	int fd = -1;
+	struct honas_sealed_state_block* blocks = NULL;
+	uint32_t* block_checksums = NULL;
+	uint8_t* trial_buf = NULL;
+	uint8_t* best_buf = NULL;
+	uint8_t* created_summary = NULL;
+
+	/* The filters of honas states with shared blocks are interleaved, a shared block at a time */
+	bool interleaved = state->shared_block_size != 0;
+	if (interleaved)
+		block_size = state->shared_block_size;
+
+	uint32_t nr_filters = state->header->number_of_filters;
+	size_t filter_size = state->filters[0].len;
+	uint32_t blocks_per_filter = (filter_size + block_size - 1) / block_size;
+	size_t nr_blocks = (size_t)nr_filters * blocks_per_filter;
+
+	/* Determine the layout of the sealed state file */
+	struct honas_sealed_state_file_header header = { { 0 } };
+	memcpy(header.file_magic, HONAS_SEALED_STATE_FILE_MAGIC, sizeof(header.file_magic));
+	header.major_version = interleaved ? INTERLEAVED_HONAS_SEALED_STATE_MAJOR_VERSION : CURRENT_HONAS_SEALED_STATE_MAJOR_VERSION;
+	header.minor_version = interleaved ? INTERLEAVED_HONAS_SEALED_STATE_MINOR_VERSION : CURRENT_HONAS_SEALED_STATE_MINOR_VERSION;
+	header.block_size = block_size;
+	header.blocks_per_filter = blocks_per_filter;
+	header.flags = HONAS_SEALED_STATE_FLAG_BLOCK_CHECKSUMS | (interleaved ? HONAS_SEALED_STATE_FLAG_INTERLEAVED : 0);
+	header.state_header_offset = sizeof(struct honas_sealed_state_file_header);
+	header.state_header_size = sizeof(struct honas_state_file_header) + sizeof(uint32_t) * nr_filters + sizeof(struct honas_state_file_header_extension);
+	struct honas_state_file_header_extension extension = { sizeof(extension), state->fold_factor, { 0 } };
+	if (state->sampling != NULL)
+		extension.sampling = *state->sampling;
+	else
+		extension.sampling.sampling_rate = 1;
+
+	/* The sealed state embeds a version 1.1 state file header; the filter and
+	 * hyperloglog layout information in it is not used */
+	struct honas_state_file_header state_header = *state->header;
+	state_header.major_version = LEGACY_HONAS_STATE_MAJOR_VERSION;
+	state_header.minor_version = LEGACY_HONAS_STATE_MINOR_VERSION;
+	state_header.first_filter_offset = header.state_header_size;
+	state_header.padding_after_filters = 0;
+	state_header.client_hll_size = state->client_count_registers.len;
+	state_header.padding_after_client_hll = 0;
+	state_header.host_name_hll_size = state->host_name_count_registers.len;
+	state_header.padding_after_host_name_hll = 0;
+	header.client_hll_offset = round_up_to_8(header.state_header_offset + header.state_header_size);
+	header.host_name_hll_offset = round_up_to_8(header.client_hll_offset + state->client_count_registers.len);
+	header.block_index_offset = round_up_to_8(header.host_name_hll_offset + state->host_name_count_registers.len);
+	uint64_t block_checksums_offset = header.block_index_offset + nr_blocks * sizeof(struct honas_sealed_state_block);
+	uint64_t data_offset = block_checksums_offset + nr_blocks * sizeof(uint32_t);
+
+	/* Carry over the summary, or create one */
+	byte_slice_t summary = state->summary;
+	if (summary.len == 0 && state->summary_size > 0) {
+		if (honas_state_create_summary(state, state->summary_size, &summary) == -1)
+			goto err_out;
+		created_summary = summary.bytes;
+	}
+	uint64_t summary_offset = round_up_to_8(data_offset);
+	struct honas_sealed_state_summary summary_header = { summary.len, 0, 0 };
+	if (summary.len > 0) {
+		header.flags |= HONAS_SEALED_STATE_FLAG_SUMMARY;
+		summary_header.checksum = crc32c(0, summary);
+		data_offset = summary_offset + sizeof(summary_header) + summary.len;
+	}
+
+	if ((fd = honas_state_open_tmpfile(filename)) == -1)
+		goto err_out;
+	blocks = (struct honas_sealed_state_block*)calloc(nr_blocks, sizeof(struct honas_sealed_state_block));
+	block_checksums = (uint32_t*)calloc(nr_blocks, sizeof(uint32_t));
+	trial_buf = (uint8_t*)malloc(block_size);
+	best_buf = (uint8_t*)malloc(block_size);
+	if (blocks == NULL || block_checksums == NULL || trial_buf == NULL || best_buf == NULL)
+		goto err_out;
+
+	if (stats != NULL) {
+		memset(stats->codec_blocks, 0, sizeof(stats->codec_blocks));
+		if (stats->filter_compressed_sizes != NULL)
+			memset(stats->filter_compressed_sizes, 0, sizeof(uint64_t) * nr_filters);
+	}
+
+	/* Compress and write all filter blocks; interleaved filters are written ordered by block, then by filter */
+	for (size_t i = 0; i < nr_blocks; i++) {
+		uint32_t filter = interleaved ? i % nr_filters : i / blocks_per_filter;
+		uint32_t block = interleaved ? i / nr_filters : i % blocks_per_filter;
+		size_t block_begin = (size_t)block * block_size;
+		byte_slice_t src = byte_slice(state->filters[filter].bytes + block_begin, MIN(block_size, filter_size - block_begin));
+
+		/* Keep the smallest result; it has to be smaller than the raw data to be of any use */
+		enum block_codec codec = BLOCK_CODEC_RAW;
+		const uint8_t* compressed = src.bytes;
+		size_t compressed_size = src.len;
+		for (int c = BLOCK_CODEC_RAW + 1; c < BLOCK_CODEC_MAX && compressed_size > 0; c++) {
+			if ((codec_mask & (1U << c)) == 0 || !block_codec_available((enum block_codec)c))
+				continue;
+			ssize_t size = block_codec_compress((enum block_codec)c, src, byte_slice(trial_buf, compressed_size - 1));
+			if (size == -1)
+				continue;
+			uint8_t* swap = best_buf;
+			best_buf = trial_buf;
+			trial_buf = swap;
+			codec = (enum block_codec)c;
+			compressed = best_buf;
+			compressed_size = size;
+		}
+
+		if (pwrite_all(fd, compressed, compressed_size, data_offset) == -1)
+			goto err_out;
+
+		struct honas_sealed_state_block* entry = &blocks[filter * blocks_per_filter + block];
+		entry->offset = data_offset;
+		entry->size = compressed_size;
+		entry->codec = codec;
+		block_checksums[filter * blocks_per_filter + block] = crc32c(0, byte_slice((uint8_t*)compressed, compressed_size));
+		data_offset += compressed_size;
+		if (stats != NULL) {
+			stats->codec_blocks[codec]++;
+			if (stats->filter_compressed_sizes != NULL)
+				stats->filter_compressed_sizes[filter] += compressed_size;
+		}
+	}
+
+	/* Write the headers, hyperloglog data and block index */
+	if (
+		pwrite_all(fd, &header, sizeof(header), 0) == -1
+		|| pwrite_all(fd, &state_header, sizeof(state_header), header.state_header_offset) == -1
+		|| pwrite_all(fd, state->filter_bits_set, sizeof(uint32_t) * nr_filters, header.state_header_offset + sizeof(struct honas_state_file_header)) == -1
+		|| pwrite_all(fd, &extension, sizeof(extension), header.state_header_offset + sizeof(struct honas_state_file_header) + sizeof(uint32_t) * nr_filters) == -1
+		|| pwrite_all(fd, state->client_count_registers.bytes, state->client_count_registers.len, header.client_hll_offset) == -1
+		|| pwrite_all(fd, state->host_name_count_registers.bytes, state->host_name_count_registers.len, header.host_name_hll_offset) == -1
+		|| pwrite_all(fd, blocks, nr_blocks * sizeof(struct honas_sealed_state_block), header.block_index_offset) == -1
+		|| pwrite_all(fd, block_checksums, nr_blocks * sizeof(uint32_t), block_checksums_offset) == -1)
+		goto err_out;
+	if (
+		summary.len > 0
+		&& (pwrite_all(fd, &summary_header, sizeof(summary_header), summary_offset) == -1
+			|| pwrite_all(fd, summary.bytes, summary.len, summary_offset + sizeof(summary_header)) == -1))
+		goto err_out;
+
+	/* Create a link from tempfile to the indicated filename */
+	char fdpath[PATH_MAX];
+	snprintf(fdpath, PATH_MAX, "/proc/self/fd/%d", fd);
+	if (linkat(AT_FDCWD, fdpath, AT_FDCWD, filename, AT_SYMLINK_FOLLOW) == -1)
+		goto err_out;
+
+	if (stats != NULL) {
+		stats->summary_size = summary.len;
+		stats->file_size = data_offset;
+	}
+
+	free(blocks);
+	free(block_checksums);
+	free(trial_buf);
+	free(best_buf);
+	free(created_summary);
+	return close(fd);
+
+err_out:
+	saved_errno = errno;
+	if (fd != -1)
+		close(fd);
+	free(blocks);
+	free(block_checksums);
+	free(trial_buf);
+	free(best_buf);
+	free(created_summary);
+	errno = saved_errno;
+	return -1;
+}
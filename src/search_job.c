@@ -0,0 +1,1727 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "search_job.h"
+
+#include "bitset.h"
+#include "bloom.h"
+#include "defines.h"
+#include "json_printer.h"
+#include "logging.h"
+#include "page_prefetch.h"
+#include "uthash.h"
+
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <yajl/yajl_parse.h>
+
+#define READ_BLOCK_SIZE 65536
+
+
+// Compute the fill rate of a Bloom filter, given s and m.
+static const double bloom_fill_rate(const uint32_t s, const uint32_t m)
+{
+        return (double)s / (double)m;
+}
+
+// Compute the actual false positive rate of a Bloom filter, given s, m and k.
+static const double bloom_actual_fpr(const double fr, const uint32_t k)
+{
+        return pow(fr, (double)k);
+}
+
+static bool _decode_nibble(char c, int* r)
+{
+	if (c >= '0' && c <= '9') {
+		*r = c - '0';
+	} else if (c >= 'A' && c <= 'F') {
+		*r = c - 'A' + 10;
+	} else if (c >= 'a' && c <= 'f') {
+		*r = c - 'a' + 10;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool decode_string_hex(const char* str, size_t strlen, uint8_t* dec, size_t declen)
+{
+	if (strlen != declen * 2)
+		return false;
+	int high, low;
+	for (size_t si = 0, di = 0; di < declen; si++, di++) {
+		if (!_decode_nibble(str[si], &high) || !_decode_nibble(str[++si], &low))
+			return false;
+		dec[di] = (high << 4) | low;
+	}
+	return true;
+}
+
+static char* get_version_string(uint32_t major_version, uint32_t minor_version, char strbuf[22])
+{
+	sprintf(strbuf, "%u.%u", major_version, minor_version);
+	return strbuf;
+}
+
+static void add_general_information(honas_state_t* state, json_printer_t* printer)
+{
+	/* Gather and search versions */
+	char version[22];
+	json_printer_object_pair_string(printer, "node_version", VERSION);
+	json_printer_object_pair_string(printer, "state_file_version", get_version_string(state->header->major_version, state->header->minor_version, version));
+
+	/* Period information */
+	json_printer_object_pair_uint64(printer, "period_begin", state->header->period_begin);
+	json_printer_object_pair_uint64(printer, "first_request", state->header->first_request);
+	json_printer_object_pair_uint64(printer, "last_request", state->header->last_request);
+	json_printer_object_pair_uint64(printer, "period_end", state->header->period_end);
+	json_printer_object_pair_uint32(printer, "estimated_number_of_clients", state->header->estimated_number_of_clients);
+	json_printer_object_pair_uint32(printer, "estimated_number_of_host_names", state->header->estimated_number_of_host_names);
+	json_printer_object_pair_uint32(printer, "number_of_requests", state->header->number_of_requests);
+
+	/* Sampling information (only when host name lookups were shed while overloaded) */
+	if (state->sampling != NULL && state->sampling->number_of_shed_requests > 0) {
+		json_printer_object_pair_uint32(printer, "sampling_rate", state->sampling->sampling_rate);
+		json_printer_object_pair_uint64(printer, "number_of_shed_requests", state->sampling->number_of_shed_requests);
+		json_printer_object_pair_uint64(printer, "first_shed_request", state->sampling->first_shed_request);
+		json_printer_object_pair_uint64(printer, "last_shed_request", state->sampling->last_shed_request);
+	}
+
+	/* Filter configuration */
+	json_printer_object_pair_uint32(printer, "number_of_filters", state->header->number_of_filters);
+	json_printer_object_pair_uint32(printer, "number_of_filters_per_user", state->header->number_of_filters_per_user);
+	json_printer_object_pair_uint32(printer, "number_of_hashes", state->header->number_of_hashes);
+	json_printer_object_pair_uint32(printer, "number_of_bits_per_filter", state->header->number_of_bits_per_filter);
+	json_printer_object_pair_uint32(printer, "flatten_threshold", state->header->flatten_threshold);
+	if (state->fold_factor > 0)
+		json_printer_object_pair_uint32(printer, "fold_factor", state->fold_factor);
+
+	/* Filter information */
+	uint32_t filter_size = honas_state_stored_bits_per_filter(state) >> 3;
+	json_printer_object_key(printer, "filters");
+	json_printer_array_begin(printer);
+	for (uint32_t i = 0; i < state->header->number_of_filters; i++) {
+		json_printer_object_begin(printer);
+		json_printer_object_pair_uint32(printer, "number_of_bits_set", state->filter_bits_set[i]);
+		json_printer_object_pair_uint32(printer, "estimated_number_of_host_names", bloom_approx_count(filter_size, state->header->number_of_hashes, state->filter_bits_set[i]));
+
+		// Calculate and print the actual false positive rate of this Bloom filter.
+		char fprstr[64];
+		const double act_fpr = bloom_actual_fpr(bloom_fill_rate(state->filter_bits_set[i], honas_state_stored_bits_per_filter(state)), state->header->number_of_hashes);
+		snprintf(fprstr, sizeof(fprstr), "%.10f", act_fpr);
+		json_printer_object_pair_string(printer, "actual_false_positive_rate", fprstr);
+		json_printer_object_end(printer);
+	}
+	json_printer_array_end(printer);
+}
+
+/* An element of the search job, in the order in which it was parsed */
+struct search_entry {
+	enum {
+		ENTRY_GROUP_BEGIN,
+		ENTRY_HOST_NAME,
+		ENTRY_GROUP_END
+	} type;
+	uint64_t group_id;   ///< The group id (for group ends)
+	size_t key_offset;   ///< Offset of the host name key in the batch data
+	size_t hash_offset;  ///< Offset of the host name hash (or compiled bit offsets) in the batch data
+	size_t hash_len;     ///< Length of the host name hash
+	bool plaintext;      ///< Whether the canonical host name has to be hashed instead
+	uint32_t entity;     ///< The entity of an entity specific variant of a plaintext host name (index + 1; 0 for none)
+	size_t digest_offset; ///< Offset of the hash of a plaintext host name in the batch data (only when using probe caches)
+	struct search_memo* memo; ///< The results shared by all occurrences of this host name in the search job (or NULL)
+	bool memo_first;     ///< Whether this is the first occurrence, which is checked and fills the memo
+};
+
+/* The results of a host name that occurs more than once in the search job */
+struct search_memo {
+	UT_hash_handle hh;
+	uint32_t* hits;       ///< Number of filters hit (`nr_results`)
+	uint8_t* filters_hit; ///< The filters hit (`filters_hit_stride` bytes per searched state)
+	uint8_t* key;         ///< The entity (index + 1), whether it's plaintext and the host name (hash)
+	size_t key_len;
+};
+
+/* A batch of search job entries that is checked by the worker threads as a whole */
+struct search_batch {
+	struct search_entry* entries;
+	size_t nr_entries;
+	size_t entries_alloc;
+	size_t nr_host_names;
+
+	uint8_t* data;            ///< Host name keys and hashes
+	size_t data_len;
+	size_t data_alloc;
+
+	/* The results of each entry for each searched state */
+	uint32_t* hits;           ///< Number of filters hit (`nr_results` per entry)
+	uint8_t* filters_hit;     ///< The filters hit (`filters_hit_stride` bytes per entry per searched state)
+	size_t results_alloc;     ///< Number of entries for which `hits` and `filters_hit` have room
+
+	/* Worker thread bookkeeping */
+	struct search_spec_context* ctx;
+	size_t next_entry;
+	pthread_t* threads;
+	unsigned int nr_started;
+	bool in_progress;
+};
+
+/* A searched honas state and the state of its search result */
+struct search_result {
+	honas_state_t* state;
+	bool flatten_results;
+	uint32_t offsets_class;   ///< States in the same class share the host name bit offsets
+	struct probe_cache* probe_cache;
+	size_t covered_by;        ///< Index of the coarse state covering this state (or `SIZE_MAX`)
+	bool prefetch;            ///< Whether the filter pages are prefetched before checking the host names
+	uint8_t* prefetched_pages; ///< Bitmap of the pages of the state that have been prefetched (when prefetching)
+
+	json_printer_t printer;
+	FILE* out;
+	char* out_buf;
+	size_t out_len;
+
+	/* Group state while reporting results */
+	bool group_has_results;
+	bool group_all_host_names_found;
+	bool group_filters_initialized;
+	bitset_t group_filters_hit;
+
+	/* CSV lines of the current group; these can only be written at the end of the group */
+	char* csv_rows;           ///< Zero terminated "<key>,<hits>" rows
+	size_t csv_rows_len;
+	size_t csv_rows_alloc;
+};
+
+/* A coarser state that is only checked to skip checking the states it covers */
+struct search_coarse_state {
+	honas_state_t* state;
+	uint32_t offsets_class;
+	size_t covered_by;        ///< Index of the coarse state covering this one (or `SIZE_MAX`)
+	bool prefetch;            ///< Whether the filter pages are prefetched before checking the host names
+	uint8_t* prefetched_pages; ///< Bitmap of the pages of the state that have been prefetched (when prefetching)
+};
+
+/* The host name of a search entry being checked; its hash and bit offsets are only determined once */
+struct search_probe {
+	struct search_batch* batch;
+	struct search_entry* entry;
+	bool sealed;              ///< Whether the sealed or the other states are being checked
+	byte_slice_t hash;
+	uint8_t hash_buf[SHA256_DIGEST_LENGTH];
+	size_t* bit_offsets;      ///< The bit offsets of all offsets classes
+	bool* have_offsets;       ///< Whether the bit offsets of each offsets class have been determined
+	int8_t* coarse_hits;      ///< Whether each coarse state may contain the host name (-1 if not checked yet)
+	bitset_t* filters_hit;
+	size_t nr_probes;         ///< Number of host names checked against states
+	size_t nr_coarse_probes;  ///< Number of host names checked against coarse states
+	size_t nr_pruned_probes;  ///< Number of host names not checked against states thanks to coarse states
+};
+
+/* The bit offsets of a chunk of entries, which are determined up front to prefetch the filter pages they point at */
+struct search_prefetch {
+	struct page_prefetch* pages;
+	size_t* bit_offsets;      ///< The bit offsets of all offsets classes of each entry of the chunk
+	bool* have_offsets;       ///< Whether the bit offsets of each offsets class of each entry have been determined
+};
+
+struct search_spec_context {
+	enum {
+		INIT,
+		SEARCH_SPEC,
+		SEARCH_SPEC_EXPECT_GROUPS_ARRAY,
+		GROUPS_ARRAY,
+		GROUP,
+		GROUP_EXPECT_ID,
+		GROUP_EXPECT_HOST_NAME_MAP,
+		HOST_NAME_MAP,
+		HOST_NAME_MAP_EXPECT_VALUE,
+		GROUP_EXPECT_NAME_ARRAY,
+		NAME_ARRAY
+	} state;
+
+	struct search_result* results;
+	size_t nr_results;
+	struct search_coarse_state* coarse_states;
+	size_t nr_coarse_states;
+	enum search_result_format format;
+	uint64_t host_name_index;     ///< Index of the host name being reported
+	bool has_sealed_results;
+	bool has_unsealed_results;
+	bool has_probe_caches;
+	bool has_prefetch;            ///< Whether the filter pages of any of the (not sealed) states are prefetched
+	unsigned int nr_threads;
+
+	/* Bit offsets are determined once for each class of states sharing them */
+	uint32_t nr_offsets_classes;
+	size_t* offsets_class_begin;  ///< Position of the bit offsets of each class
+	const honas_state_t** offsets_class_leader; ///< The first state in each class
+	size_t nr_offsets;            ///< Number of bit offsets of all classes together
+	uint32_t max_nr_filters;
+
+	/* Checks against the states that were done and skipped thanks to the coarse states */
+	size_t nr_probes;
+	size_t nr_coarse_probes;
+	size_t nr_pruned_probes;
+
+	/* Filter pages prefetched by the worker threads */
+	size_t nr_prefetched_pages;
+	size_t nr_prefetch_hints;
+
+	/* Entities whose specific variants of plaintext host names are checked as well */
+	struct honas_entity_prefix* entity_prefixes;
+	const char** entity_names;
+	uint32_t nr_entities;
+	char* report_key;
+	size_t report_key_alloc;
+
+	/* Host names that occur more than once in the search job are only checked once */
+	struct search_memo* memos;
+	size_t memos_size;
+	uint8_t* memo_key;
+	size_t memo_key_alloc;
+
+	/* Binary and compiled search jobs */
+	bool compiled;                         ///< Whether the bit offsets are read from a compiled search job
+	FILE* job_out_fh;                      ///< The file a binary or compiled search job is written to (when converting or compiling)
+	const honas_state_t* compile_geometry; ///< The state geometry to compile the search job for (when compiling)
+
+	/* While one batch is being filled by the parser the other one can be checked by the workers */
+	struct search_batch batches[2];
+	struct search_batch* filling;
+	size_t filters_hit_stride;
+
+	/* Group state while parsing */
+	uint64_t group_id;
+
+	char* host_name_key;
+	size_t host_name_key_alloc;
+	size_t host_name_key_len;
+};
+
+/* Reserve room for `len` bytes (aligned to 8 bytes) in the batch data */
+static size_t search_batch_reserve_data(struct search_batch* batch, size_t len)
+{
+	size_t offset = (batch->data_len + 7) & ~((size_t)7);
+	if (offset + len > batch->data_alloc) {
+		batch->data_alloc = (offset + len) * 2;
+		batch->data = realloc(batch->data, batch->data_alloc);
+		log_passert(batch->data != NULL, "Failed to allocate search batch data");
+	}
+	batch->data_len = offset + len;
+	return offset;
+}
+
+static struct search_entry* search_batch_add_entry(struct search_spec_context* ctx, int type)
+{
+	struct search_batch* batch = ctx->filling;
+	if (batch->nr_entries == batch->entries_alloc) {
+		batch->entries_alloc = batch->entries_alloc ? batch->entries_alloc * 2 : 1024;
+		batch->entries = realloc(batch->entries, batch->entries_alloc * sizeof(struct search_entry));
+		log_passert(batch->entries != NULL, "Failed to allocate search batch entries");
+	}
+	struct search_entry* entry = &batch->entries[batch->nr_entries++];
+	memset(entry, 0, sizeof(*entry));
+	entry->type = type;
+	return entry;
+}
+
+/* Determine the hash of a host name; plaintext host names are hashed here, by the worker threads */
+static byte_slice_t search_entry_hash(const struct search_batch* batch, const struct search_entry* entry, uint8_t* hash_buf)
+{
+	if (!entry->plaintext)
+		return byte_slice(batch->data + entry->hash_offset, entry->hash_len);
+	if (entry->entity > 0)
+		honas_state_entity_host_name_hash(&batch->ctx->entity_prefixes[entry->entity - 1], batch->data + entry->hash_offset, entry->hash_len, hash_buf);
+	else
+		honas_state_host_name_hash(NULL, 0, batch->data + entry->hash_offset, entry->hash_len, hash_buf);
+	return byte_slice(hash_buf, SHA256_DIGEST_LENGTH);
+}
+
+static byte_slice_t search_probe_hash(struct search_probe* probe)
+{
+	if (probe->hash.bytes == NULL)
+		probe->hash = search_entry_hash(probe->batch, probe->entry, probe->hash_buf);
+	return probe->hash;
+}
+
+/* Determine the bit offsets only once for all states sharing them */
+static const size_t* search_probe_offsets(struct search_probe* probe, uint32_t offsets_class)
+{
+	struct search_spec_context* ctx = probe->batch->ctx;
+	size_t* class_bit_offsets = probe->bit_offsets + ctx->offsets_class_begin[offsets_class];
+	if (!probe->have_offsets[offsets_class]) {
+		if (ctx->compiled) {
+			/* All states share the bit offsets of the compiled search job */
+			const uint32_t* compiled_bit_offsets = (const uint32_t*)(probe->batch->data + probe->entry->hash_offset);
+			for (size_t o = 0; o < ctx->nr_offsets; o++)
+				class_bit_offsets[o] = compiled_bit_offsets[o];
+		} else {
+			honas_state_host_name_offsets(ctx->offsets_class_leader[offsets_class], search_probe_hash(probe), class_bit_offsets);
+		}
+		probe->have_offsets[offsets_class] = true;
+	}
+	return class_bit_offsets;
+}
+
+/* Whether the host name may be contained by a coarse state, for which the coarse states covering it are
+ * checked first; coarse states of the other kind (sealed or not) can't be checked and may contain it */
+static bool search_probe_coarse_hit(struct search_probe* probe, size_t c)
+{
+	struct search_coarse_state* coarse = &probe->batch->ctx->coarse_states[c];
+	if (probe->coarse_hits[c] < 0) {
+		if ((coarse->state->sealed != NULL) != probe->sealed) {
+			probe->coarse_hits[c] = 1;
+		} else if (coarse->covered_by != SIZE_MAX && !search_probe_coarse_hit(probe, coarse->covered_by)) {
+			probe->coarse_hits[c] = 0;
+		} else {
+			bitset_clear(probe->filters_hit);
+			probe->coarse_hits[c] = honas_state_check_host_name_offsets(coarse->state, search_probe_offsets(probe, coarse->offsets_class), probe->filters_hit) > 0;
+
+			/* A coarse state with corrupt blocks can't rule anything out anymore */
+			if (honas_state_has_errors(coarse->state))
+				probe->coarse_hits[c] = 1;
+			probe->nr_coarse_probes++;
+		}
+	}
+	return probe->coarse_hits[c] > 0;
+}
+
+/* Prefetch the filter pages of a state that checking a host name may read; each page is only requested once per search */
+static void search_prefetch_state(struct search_prefetch* prefetch, const honas_state_t* state, uint8_t* prefetched_pages, const size_t* bit_offsets)
+{
+	const uint8_t* addresses[(size_t)state->header->number_of_filters * state->header->number_of_hashes];
+	size_t nr_addresses = honas_state_host_name_bytes(state, bit_offsets, addresses);
+	for (size_t a = 0; a < nr_addresses; a++) {
+		size_t page = (size_t)(addresses[a] - (const uint8_t*)state->mmap) >> PAGE_SHIFT;
+		uint8_t mask = 1 << (page & 7);
+		if ((__atomic_load_n(&prefetched_pages[page >> 3], __ATOMIC_RELAXED) & mask) == 0
+			&& (__atomic_fetch_or(&prefetched_pages[page >> 3], mask, __ATOMIC_RELAXED) & mask) == 0)
+			page_prefetch_page(prefetch->pages, addresses[a]);
+	}
+}
+
+/* Prefetch the filter pages of the states that checking a chunk of entries may read, so that these are read concurrently */
+static void search_prefetch_entries(struct search_batch* batch, size_t begin, size_t end, struct search_prefetch* prefetch, struct search_probe* probe)
+{
+	struct search_spec_context* ctx = batch->ctx;
+
+	for (size_t i = begin; i < end; i++) {
+		struct search_entry* entry = &batch->entries[i];
+		if (entry->type != ENTRY_HOST_NAME || (entry->memo != NULL && !entry->memo_first))
+			continue;
+		probe->entry = entry;
+		probe->hash = (byte_slice_t) { 0 };
+		probe->bit_offsets = prefetch->bit_offsets + (i - begin) * ctx->nr_offsets;
+		probe->have_offsets = prefetch->have_offsets + (i - begin) * ctx->nr_offsets_classes;
+		memset(probe->have_offsets, 0, ctx->nr_offsets_classes * sizeof(bool));
+
+		/* Covered states are mostly pruned by the (prefetched) coarse states covering them; states with a probe cache are mostly not checked */
+		for (size_t r = 0; r < ctx->nr_results; r++) {
+			struct search_result* result = &ctx->results[r];
+			if (result->prefetch && result->covered_by == SIZE_MAX && result->probe_cache == NULL)
+				search_prefetch_state(prefetch, result->state, result->prefetched_pages, search_probe_offsets(probe, result->offsets_class));
+		}
+		for (size_t c = 0; c < ctx->nr_coarse_states; c++) {
+			struct search_coarse_state* coarse = &ctx->coarse_states[c];
+			if (coarse->prefetch && coarse->covered_by == SIZE_MAX)
+				search_prefetch_state(prefetch, coarse->state, coarse->prefetched_pages, search_probe_offsets(probe, coarse->offsets_class));
+		}
+	}
+	page_prefetch_submit(prefetch->pages);
+}
+
+/* Check the host names of a range of batch entries against either the sealed or the other states
+ *
+ * When prefetching, the filter pages of the whole range are requested first
+ * and the bit offsets determined meanwhile are reused for checking the entries.
+ */
+static void search_check_entries(struct search_batch* batch, size_t begin, size_t end, bool sealed, bitset_t* filters_hit, struct search_prefetch* prefetch)
+{
+	struct search_spec_context* ctx = batch->ctx;
+	byte_slice_t filters_hit_bytes = bitset_as_byte_slice(filters_hit);
+	size_t bit_offsets[ctx->nr_offsets];
+	bool have_offsets[ctx->nr_offsets_classes];
+	int8_t coarse_hits[MAX(ctx->nr_coarse_states, 1)];
+	struct search_probe probe = { batch, NULL, sealed, { 0 }, { 0 }, bit_offsets, have_offsets, coarse_hits, filters_hit, 0, 0, 0 };
+
+	if (prefetch != NULL)
+		search_prefetch_entries(batch, begin, end, prefetch, &probe);
+
+	for (size_t i = begin; i < end; i++) {
+		struct search_entry* entry = &batch->entries[i];
+		if (entry->type != ENTRY_HOST_NAME || (entry->memo != NULL && !entry->memo_first))
+			continue;
+		if (prefetch != NULL) {
+			probe.bit_offsets = prefetch->bit_offsets + (i - begin) * ctx->nr_offsets;
+			probe.have_offsets = prefetch->have_offsets + (i - begin) * ctx->nr_offsets_classes;
+		} else {
+			memset(have_offsets, 0, sizeof(have_offsets));
+		}
+		memset(coarse_hits, -1, sizeof(coarse_hits));
+		probe.entry = entry;
+		probe.hash = (byte_slice_t) { 0 };
+
+		/* The hash of a plaintext host name is stored for the probe caches by only one of the passes */
+		if (entry->plaintext && ctx->has_probe_caches && sealed != ctx->has_unsealed_results)
+			probe.hash = search_entry_hash(batch, entry, batch->data + entry->digest_offset);
+
+		for (size_t r = 0; r < ctx->nr_results; r++) {
+			struct search_result* result = &ctx->results[r];
+			if ((result->state->sealed != NULL) != sealed)
+				continue;
+
+			/* Earlier results of the state are used instead of checking its filters */
+			size_t index = i * ctx->nr_results + r;
+			if (result->probe_cache != NULL) {
+				byte_slice_t hash = search_probe_hash(&probe);
+				if (hash.len == SHA256_DIGEST_LENGTH && probe_cache_lookup(result->probe_cache, hash.bytes, &batch->hits[index], byte_slice(batch->filters_hit + index * ctx->filters_hit_stride, ctx->filters_hit_stride)))
+					continue;
+			}
+
+			/* Host names that the covering coarse state doesn't contain can't be found in this state */
+			if (result->covered_by != SIZE_MAX && !search_probe_coarse_hit(&probe, result->covered_by)) {
+				batch->hits[index] = 0;
+				memset(batch->filters_hit + index * ctx->filters_hit_stride, 0, ctx->filters_hit_stride);
+				probe.nr_pruned_probes++;
+				continue;
+			}
+
+			bitset_clear(filters_hit);
+			batch->hits[index] = honas_state_check_host_name_offsets(result->state, search_probe_offsets(&probe, result->offsets_class), filters_hit);
+			memcpy(batch->filters_hit + index * ctx->filters_hit_stride, filters_hit_bytes.bytes, filters_hit_bytes.len);
+			probe.nr_probes++;
+		}
+	}
+
+	if (ctx->nr_coarse_states > 0) {
+		__atomic_fetch_add(&ctx->nr_probes, probe.nr_probes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&ctx->nr_coarse_probes, probe.nr_coarse_probes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&ctx->nr_pruned_probes, probe.nr_pruned_probes, __ATOMIC_RELAXED);
+	}
+}
+
+/* Check the host names of a batch against all but the sealed states until all entries have been claimed */
+static void* search_worker(void* arg)
+{
+	struct search_batch* batch = (struct search_batch*)arg;
+	struct search_spec_context* ctx = batch->ctx;
+	bitset_t filters_hit;
+	bitset_create(&filters_hit, ctx->max_nr_filters);
+
+	/* Each worker thread prefetches the filter pages of the chunks it checks */
+	struct search_prefetch prefetch = { 0 };
+	if (ctx->has_prefetch) {
+		prefetch.pages = page_prefetch_create(SEARCH_PREFETCH_BATCH_SIZE);
+		prefetch.bit_offsets = malloc(SEARCH_CHUNK_SIZE * MAX(ctx->nr_offsets, 1) * sizeof(size_t));
+		prefetch.have_offsets = malloc(SEARCH_CHUNK_SIZE * MAX(ctx->nr_offsets_classes, 1) * sizeof(bool));
+		log_passert(prefetch.bit_offsets != NULL && prefetch.have_offsets != NULL, "Failed to allocate search prefetch bit offsets");
+	}
+
+	for (;;) {
+		size_t begin = __atomic_fetch_add(&batch->next_entry, SEARCH_CHUNK_SIZE, __ATOMIC_RELAXED);
+		if (begin >= batch->nr_entries)
+			break;
+		search_check_entries(batch, begin, MIN(begin + SEARCH_CHUNK_SIZE, batch->nr_entries), false, &filters_hit, ctx->has_prefetch ? &prefetch : NULL);
+	}
+
+	if (ctx->has_prefetch) {
+		__atomic_fetch_add(&ctx->nr_prefetched_pages, page_prefetch_nr_pages(prefetch.pages), __ATOMIC_RELAXED);
+		__atomic_fetch_add(&ctx->nr_prefetch_hints, page_prefetch_nr_hints(prefetch.pages), __ATOMIC_RELAXED);
+		page_prefetch_destroy(prefetch.pages);
+		free(prefetch.bit_offsets);
+		free(prefetch.have_offsets);
+	}
+	bitset_destroy(&filters_hit);
+	return NULL;
+}
+
+static void search_write_binary_result(FILE* out, uint16_t type, uint16_t flags, uint32_t hits, uint64_t value)
+{
+	struct binary_search_result_entry entry = { type, flags, hits, value };
+	fwrite(&entry, sizeof(entry), 1, out);
+}
+
+/* Remember a CSV row for a host name with hits until the end of the group */
+static void search_add_csv_row(struct search_result* result, const char* key, uint32_t hits)
+{
+	/* Keys containing special characters are quoted, doubling any quotes */
+	size_t key_len = strlen(key);
+	bool quote = strpbrk(key, ",\"\r\n") != NULL;
+	size_t max_len = key_len * 2 + 2 + 12;
+	if (result->csv_rows_len + max_len > result->csv_rows_alloc) {
+		result->csv_rows_alloc = (result->csv_rows_len + max_len) * 2;
+		result->csv_rows = realloc(result->csv_rows, result->csv_rows_alloc);
+		log_passert(result->csv_rows != NULL, "Failed to allocate CSV search result rows");
+	}
+
+	char* row = result->csv_rows + result->csv_rows_len;
+	if (quote) {
+		*row++ = '"';
+		for (const char* c = key; *c; c++) {
+			if (*c == '"')
+				*row++ = '"';
+			*row++ = *c;
+		}
+		*row++ = '"';
+	} else {
+		memcpy(row, key, key_len);
+		row += key_len;
+	}
+	row += sprintf(row, ",%u", hits) + 1;
+	result->csv_rows_len = row - result->csv_rows;
+}
+
+/* Report the results of a checked host name, just like they would have been when checked while parsing */
+static void search_report_host_name(struct search_spec_context* ctx, struct search_result* result, struct search_batch* batch, size_t index)
+{
+	struct search_entry* entry = &batch->entries[index];
+	size_t result_index = index * ctx->nr_results + (result - ctx->results);
+	byte_slice_t group_filters_hit = bitset_as_byte_slice(&result->group_filters_hit);
+	byte_slice_t filters_hit = byte_slice(batch->filters_hit + result_index * ctx->filters_hit_stride, group_filters_hit.len);
+
+	uint32_t hits = batch->hits[result_index];
+	if (result->flatten_results)
+		hits = hits < result->state->header->number_of_filters_per_user ? 0 : 1;
+
+	/* The first host name of a group determines the initial filters hit by all host names; entity specific variants don't count */
+	if (entry->entity == 0 && result->group_all_host_names_found) {
+		if (hits == 0) {
+			result->group_all_host_names_found = false;
+		} else if (!result->group_filters_initialized) {
+			memcpy(group_filters_hit.bytes, filters_hit.bytes, group_filters_hit.len);
+			result->group_filters_initialized = true;
+		} else {
+			byte_slice_bitwise_and(group_filters_hit, filters_hit);
+		}
+	}
+
+	if (hits > 0) {
+		if (!result->group_has_results) {
+			/* First group results starts the group result output */
+			if (ctx->format == SEARCH_RESULT_FORMAT_JSON) {
+				json_printer_object_begin(&result->printer);
+				json_printer_object_key(&result->printer, "hostnames");
+				json_printer_object_begin(&result->printer);
+			}
+			result->group_has_results = true;
+		}
+
+		/* Entity specific variants are reported as "<entity>@<host name>" */
+		const char* key = (char*)batch->data + entry->key_offset;
+		if (entry->entity > 0) {
+			const char* entity_name = ctx->entity_names[entry->entity - 1];
+			size_t key_len = strlen(entity_name) + 1 + strlen(key) + 1;
+			if (key_len > ctx->report_key_alloc) {
+				ctx->report_key_alloc = key_len * 2;
+				ctx->report_key = realloc(ctx->report_key, ctx->report_key_alloc);
+				log_passert(ctx->report_key != NULL, "Failed to allocate host name key");
+			}
+			sprintf(ctx->report_key, "%s@%s", entity_name, key);
+			key = ctx->report_key;
+		}
+		switch (ctx->format) {
+		case SEARCH_RESULT_FORMAT_JSON:
+			json_printer_object_pair_uint32(&result->printer, key, hits);
+			break;
+		case SEARCH_RESULT_FORMAT_CSV:
+			search_add_csv_row(result, key, hits);
+			break;
+		case SEARCH_RESULT_FORMAT_BINARY:
+			search_write_binary_result(result->out, BINARY_SEARCH_RESULT_HOST_NAME, 0, hits, ctx->host_name_index);
+			break;
+		}
+	}
+}
+
+/* Report the end of a group, if it had any host name hits */
+static void search_report_group_end(struct search_spec_context* ctx, struct search_result* result, uint64_t group_id)
+{
+	if (!result->group_has_results)
+		return;
+
+	uint32_t hits = bitset_popcount(&result->group_filters_hit);
+	if (result->flatten_results)
+		hits = hits < result->state->header->number_of_filters_per_user ? 0 : 1;
+	if (!result->group_all_host_names_found)
+		hits = 0;
+
+	switch (ctx->format) {
+	case SEARCH_RESULT_FORMAT_JSON:
+		json_printer_object_end(&result->printer);
+		json_printer_object_pair_uint64(&result->printer, "id", group_id);
+		json_printer_object_pair_uint32(&result->printer, "hits_by_all_hostnames", hits);
+		json_printer_object_end(&result->printer);
+		break;
+
+	case SEARCH_RESULT_FORMAT_CSV:
+		for (const char* row = result->csv_rows; row < result->csv_rows + result->csv_rows_len; row += strlen(row) + 1)
+			fprintf(result->out, "%" PRIu64 ",%" PRIu64 ",%s,%u\n", result->state->header->period_begin, group_id, row, hits);
+		result->csv_rows_len = 0;
+		break;
+
+	case SEARCH_RESULT_FORMAT_BINARY:
+		search_write_binary_result(result->out, BINARY_SEARCH_RESULT_GROUP, 0, hits, group_id);
+		break;
+	}
+}
+
+static int compare_bit_offsets(const void* a, const void* b)
+{
+	uint32_t offset_a = *(const uint32_t*)a;
+	uint32_t offset_b = *(const uint32_t*)b;
+	return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+/* Write the entries of a batch to the binary or compiled search job; host
+ * names are followed by their hash or, when compiling, their bit offsets */
+static void search_write_job_batch(struct search_spec_context* ctx, struct search_batch* batch)
+{
+	size_t bit_offsets[ctx->nr_offsets];
+	uint32_t compiled_bit_offsets[ctx->nr_offsets];
+	uint8_t hash_buf[SHA256_DIGEST_LENGTH];
+
+	for (size_t i = 0; i < batch->nr_entries; i++) {
+		struct search_entry* entry = &batch->entries[i];
+		struct search_job_file_entry file_entry = { 0 };
+		switch (entry->type) {
+		case ENTRY_GROUP_BEGIN:
+			file_entry.type = SEARCH_JOB_FILE_GROUP_BEGIN;
+			fwrite(&file_entry, sizeof(file_entry), 1, ctx->job_out_fh);
+			break;
+
+		case ENTRY_HOST_NAME: {
+			const char* key = (char*)batch->data + entry->key_offset;
+			byte_slice_t hash = search_entry_hash(batch, entry, hash_buf);
+			if (ctx->compile_geometry == NULL && hash.len != SHA256_DIGEST_LENGTH) {
+				log_msg(WARNING, "Skipping host name '%s' with a hash of %zu bytes", key, hash.len);
+				break;
+			}
+			file_entry.type = SEARCH_JOB_FILE_HOST_NAME;
+			file_entry.key_length = MIN(strlen(key), SEARCH_JOB_FILE_MAX_KEY_LENGTH);
+			fwrite(&file_entry, sizeof(file_entry), 1, ctx->job_out_fh);
+			fwrite(key, 1, file_entry.key_length, ctx->job_out_fh);
+			if (ctx->compile_geometry != NULL) {
+				honas_state_host_name_offsets(ctx->compile_geometry, hash, bit_offsets);
+				for (size_t o = 0; o < ctx->nr_offsets; o++)
+					compiled_bit_offsets[o] = bit_offsets[o];
+
+				/* The bit offsets of each filter are checked (and their pages prefetched) in ascending order */
+				uint32_t nr_hashes = ctx->compile_geometry->header->number_of_hashes;
+				for (size_t o = 0; o < ctx->nr_offsets; o += nr_hashes)
+					qsort(compiled_bit_offsets + o, nr_hashes, sizeof(uint32_t), compare_bit_offsets);
+				fwrite(compiled_bit_offsets, sizeof(uint32_t), ctx->nr_offsets, ctx->job_out_fh);
+			} else {
+				fwrite(hash.bytes, 1, hash.len, ctx->job_out_fh);
+			}
+			break;
+		}
+
+		case ENTRY_GROUP_END:
+			file_entry.type = SEARCH_JOB_FILE_GROUP_END;
+			file_entry.group_id = entry->group_id;
+			fwrite(&file_entry, sizeof(file_entry), 1, ctx->job_out_fh);
+			break;
+		}
+	}
+}
+
+/* Share the results of a checked host name with its later occurrences and the probe caches;
+ * later occurrences weren't checked and take the results of the first one */
+static void search_share_results(struct search_spec_context* ctx, struct search_batch* batch, size_t index)
+{
+	struct search_entry* entry = &batch->entries[index];
+	uint32_t* hits = batch->hits + index * ctx->nr_results;
+	uint8_t* filters_hit = batch->filters_hit + index * ctx->nr_results * ctx->filters_hit_stride;
+	size_t filters_hit_len = ctx->nr_results * ctx->filters_hit_stride;
+	if (entry->memo != NULL && !entry->memo_first) {
+		memcpy(hits, entry->memo->hits, ctx->nr_results * sizeof(uint32_t));
+		memcpy(filters_hit, entry->memo->filters_hit, filters_hit_len);
+		return;
+	}
+	if (entry->memo != NULL) {
+		memcpy(entry->memo->hits, hits, ctx->nr_results * sizeof(uint32_t));
+		memcpy(entry->memo->filters_hit, filters_hit, filters_hit_len);
+	}
+
+	if (!ctx->has_probe_caches || (!entry->plaintext && entry->hash_len != SHA256_DIGEST_LENGTH))
+		return;
+	const uint8_t* hash = batch->data + (entry->plaintext ? entry->digest_offset : entry->hash_offset);
+	for (size_t r = 0; r < ctx->nr_results; r++) {
+		struct search_result* result = &ctx->results[r];
+		if (result->probe_cache != NULL && !honas_state_has_errors(result->state))
+			probe_cache_add(result->probe_cache, hash, hits[r], byte_slice(filters_hit + r * ctx->filters_hit_stride, ctx->filters_hit_stride));
+	}
+}
+
+/* Report the results of all entries in a checked batch, in order */
+static void search_report_batch(struct search_spec_context* ctx, struct search_batch* batch)
+{
+	if (ctx->job_out_fh != NULL)
+		search_write_job_batch(ctx, batch);
+
+	for (size_t i = 0; i < batch->nr_entries; i++) {
+		struct search_entry* entry = &batch->entries[i];
+		if (entry->type == ENTRY_HOST_NAME && ctx->nr_results > 0)
+			search_share_results(ctx, batch, i);
+		for (size_t r = 0; r < ctx->nr_results; r++) {
+			struct search_result* result = &ctx->results[r];
+			switch (entry->type) {
+			case ENTRY_GROUP_BEGIN:
+				/* Reset group info; But only generate output if there are host name hits */
+				result->group_has_results = false;
+				result->group_all_host_names_found = true;
+				result->group_filters_initialized = false;
+				break;
+
+			case ENTRY_HOST_NAME:
+				search_report_host_name(ctx, result, batch, i);
+				break;
+
+			case ENTRY_GROUP_END:
+				search_report_group_end(ctx, result, entry->group_id);
+				break;
+			}
+		}
+		if (entry->type == ENTRY_HOST_NAME)
+			ctx->host_name_index++;
+	}
+
+	batch->nr_entries = 0;
+	batch->nr_host_names = 0;
+	batch->data_len = 0;
+}
+
+/* Wait for the batch that's being checked by the workers and report its results */
+static void search_finish_batch(struct search_spec_context* ctx)
+{
+	struct search_batch* batch = ctx->filling == &ctx->batches[0] ? &ctx->batches[1] : &ctx->batches[0];
+	if (!batch->in_progress)
+		return;
+
+	/* Lookups in a sealed state are serialized by the lock of its block cache, so these are checked by this thread only */
+	if (ctx->has_sealed_results) {
+		bitset_t filters_hit;
+		bitset_create(&filters_hit, ctx->max_nr_filters);
+		search_check_entries(batch, 0, batch->nr_entries, true, &filters_hit, NULL);
+		bitset_destroy(&filters_hit);
+	}
+
+	/* This thread helps finishing the batch (or does all of it, if no threads could be started) */
+	search_worker(batch);
+	for (unsigned int i = 0; i < batch->nr_started; i++)
+		pthread_join(batch->threads[i], NULL);
+	batch->in_progress = false;
+
+	search_report_batch(ctx, batch);
+}
+
+/* Hand the batch that's being filled over to the workers and start filling the other one */
+static void search_start_batch(struct search_spec_context* ctx)
+{
+	search_finish_batch(ctx);
+
+	struct search_batch* batch = ctx->filling;
+	ctx->filling = batch == &ctx->batches[0] ? &ctx->batches[1] : &ctx->batches[0];
+	if (batch->nr_entries == 0)
+		return;
+
+	if (ctx->nr_results > 0 && batch->results_alloc < batch->nr_entries) {
+		batch->results_alloc = batch->entries_alloc;
+		free(batch->hits);
+		free(batch->filters_hit);
+		batch->hits = malloc(batch->results_alloc * ctx->nr_results * sizeof(uint32_t));
+		batch->filters_hit = malloc(batch->results_alloc * ctx->nr_results * ctx->filters_hit_stride);
+		log_passert(batch->hits != NULL && batch->filters_hit != NULL, "Failed to allocate search batch results");
+	}
+	batch->next_entry = 0;
+	batch->in_progress = true;
+
+	unsigned int nr_threads = MIN(ctx->nr_threads, (batch->nr_entries + SEARCH_CHUNK_SIZE - 1) / SEARCH_CHUNK_SIZE);
+	for (batch->nr_started = 0; batch->nr_started < nr_threads; batch->nr_started++) {
+		int err = pthread_create(&batch->threads[batch->nr_started], NULL, search_worker, batch);
+		if (err != 0) {
+			log_msg(WARNING, "Failed to start search worker thread: %s", strerror(err));
+			break;
+		}
+	}
+}
+
+/* Check and report all host names parsed so far */
+static void search_flush(struct search_spec_context* ctx)
+{
+	search_start_batch(ctx);
+	search_finish_batch(ctx);
+}
+
+/* Begin the result of each state with the general state information */
+static void search_begin_results(struct search_spec_context* ctx)
+{
+	for (size_t r = 0; r < ctx->nr_results; r++) {
+		struct search_result* result = &ctx->results[r];
+		if (ctx->format == SEARCH_RESULT_FORMAT_JSON) {
+			json_printer_object_begin(&result->printer);
+			add_general_information(result->state, &result->printer);
+		} else if (ctx->format == SEARCH_RESULT_FORMAT_BINARY) {
+			search_write_binary_result(result->out, BINARY_SEARCH_RESULT_STATE, result->flatten_results ? BINARY_SEARCH_RESULT_FLATTENED : 0,
+				result->state->header->number_of_filters, result->state->header->period_begin);
+		}
+	}
+}
+
+static void search_end_results(struct search_spec_context* ctx)
+{
+	if (ctx->format != SEARCH_RESULT_FORMAT_JSON)
+		return;
+	for (size_t r = 0; r < ctx->nr_results; r++)
+		json_printer_object_end(&ctx->results[r].printer);
+}
+
+static void search_begin_groups(struct search_spec_context* ctx)
+{
+	if (ctx->format != SEARCH_RESULT_FORMAT_JSON)
+		return;
+	for (size_t r = 0; r < ctx->nr_results; r++) {
+		json_printer_object_pair_boolean(&ctx->results[r].printer, "flattened_results", ctx->results[r].flatten_results);
+		json_printer_object_key(&ctx->results[r].printer, "groups");
+		json_printer_array_begin(&ctx->results[r].printer);
+	}
+}
+
+static void search_end_groups(struct search_spec_context* ctx)
+{
+	search_flush(ctx);
+	if (ctx->format != SEARCH_RESULT_FORMAT_JSON)
+		return;
+	for (size_t r = 0; r < ctx->nr_results; r++)
+		json_printer_array_end(&ctx->results[r].printer);
+}
+
+/* Find the earlier occurrence of a queued host name, or remember its results for later occurrences */
+static void search_memo_host_name(struct search_spec_context* ctx, struct search_entry* entry)
+{
+	/* The bit offsets of compiled search jobs would make for big keys */
+	if (ctx->nr_results == 0 || ctx->compiled)
+		return;
+
+	size_t key_len = sizeof(entry->entity) + 1 + entry->hash_len;
+	if (key_len > ctx->memo_key_alloc) {
+		ctx->memo_key_alloc = key_len * 2;
+		ctx->memo_key = realloc(ctx->memo_key, ctx->memo_key_alloc);
+		log_passert(ctx->memo_key != NULL, "Failed to allocate search memo key");
+	}
+	memcpy(ctx->memo_key, &entry->entity, sizeof(entry->entity));
+	ctx->memo_key[sizeof(entry->entity)] = entry->plaintext;
+	memcpy(ctx->memo_key + sizeof(entry->entity) + 1, ctx->filling->data + entry->hash_offset, entry->hash_len);
+
+	struct search_memo* memo;
+	HASH_FIND(hh, ctx->memos, ctx->memo_key, key_len, memo);
+	if (memo != NULL) {
+		entry->memo = memo;
+		return;
+	}
+
+	size_t results_size = ctx->nr_results * (sizeof(uint32_t) + ctx->filters_hit_stride);
+	size_t memo_size = sizeof(struct search_memo) + results_size + key_len;
+	if (ctx->memos_size + memo_size > SEARCH_MEMO_MAX_SIZE)
+		return;
+	memo = malloc(memo_size);
+	log_passert(memo != NULL, "Failed to allocate search memo");
+	memo->hits = (uint32_t*)(memo + 1);
+	memo->filters_hit = (uint8_t*)(memo->hits + ctx->nr_results);
+	memo->key = memo->filters_hit + ctx->nr_results * ctx->filters_hit_stride;
+	memo->key_len = key_len;
+	memcpy(memo->key, ctx->memo_key, key_len);
+	HASH_ADD_KEYPTR(hh, ctx->memos, memo->key, memo->key_len, memo);
+	ctx->memos_size += memo_size;
+	entry->memo = memo;
+	entry->memo_first = true;
+}
+
+/* Queue a host name to be checked by the workers; `hash_offset` is its hash (or canonical plaintext host name) in the batch being filled */
+static struct search_entry* search_queue_host_name(struct search_spec_context* ctx, const char* key, size_t key_len, size_t hash_offset, size_t hash_len, bool plaintext)
+{
+	struct search_batch* batch = ctx->filling;
+	size_t key_offset = search_batch_reserve_data(batch, key_len + 1);
+	memcpy(batch->data + key_offset, key, key_len);
+	batch->data[key_offset + key_len] = 0;
+	struct search_entry* entry = search_batch_add_entry(ctx, ENTRY_HOST_NAME);
+	entry->key_offset = key_offset;
+	entry->hash_offset = hash_offset;
+	entry->hash_len = hash_len;
+	entry->plaintext = plaintext;
+	if (plaintext && ctx->has_probe_caches)
+		entry->digest_offset = search_batch_reserve_data(batch, SHA256_DIGEST_LENGTH);
+	search_memo_host_name(ctx, entry);
+	batch->nr_host_names++;
+	return entry;
+}
+
+/* Queue a host name and start checking the batch once it's full */
+static void search_add_host_name(struct search_spec_context* ctx, const char* key, size_t key_len, size_t hash_offset, size_t hash_len, bool plaintext)
+{
+	search_queue_host_name(ctx, key, key_len, hash_offset, hash_len, plaintext);
+	if (ctx->filling->nr_host_names >= SEARCH_BATCH_SIZE)
+		search_start_batch(ctx);
+}
+
+/* Queue a plaintext host name, which is reported using the host name as given */
+static void search_add_plaintext_host_name(struct search_spec_context* ctx, const char* host_name, size_t host_name_len)
+{
+	/* Entity specific host names ("<entity>@<host name>") keep their entity name as is */
+	const char* at = memrchr(host_name, '@', host_name_len);
+	size_t prefix_len = at != NULL ? (size_t)(at - host_name) + 1 : 0;
+
+	/* A host name and its entity specific variants share their data, so they have to be in the same batch */
+	if (ctx->nr_entities > 0 && ctx->filling->nr_host_names > 0 && ctx->filling->nr_host_names + 1 + ctx->nr_entities > SEARCH_BATCH_SIZE)
+		search_start_batch(ctx);
+
+	/* The host name is canonicalized just like `honas-gather` does */
+	struct search_batch* batch = ctx->filling;
+	size_t name_offset = search_batch_reserve_data(batch, prefix_len + HONAS_STATE_MAX_HOST_NAME_LENGTH + 1);
+	uint8_t* name = batch->data + name_offset;
+	memcpy(name, host_name, prefix_len);
+	size_t name_len = prefix_len + honas_state_canonicalize_host_name((const uint8_t*)host_name + prefix_len, host_name_len - prefix_len, name + prefix_len);
+	batch->data_len = name_offset + name_len;
+	size_t key_offset = search_queue_host_name(ctx, host_name, host_name_len, name_offset, name_len, true)->key_offset;
+
+	/* Check the "<entity>@<host name>" variants using the SHA-256 midstates of the entity names */
+	if (prefix_len == 0) {
+		for (uint32_t e = 1; e <= ctx->nr_entities; e++) {
+			struct search_entry* entry = search_batch_add_entry(ctx, ENTRY_HOST_NAME);
+			entry->key_offset = key_offset;
+			entry->hash_offset = name_offset;
+			entry->hash_len = name_len;
+			entry->plaintext = true;
+			entry->entity = e;
+			if (ctx->has_probe_caches)
+				entry->digest_offset = search_batch_reserve_data(batch, SHA256_DIGEST_LENGTH);
+			search_memo_host_name(ctx, entry);
+		}
+		batch->nr_host_names += ctx->nr_entities;
+	}
+	if (batch->nr_host_names >= SEARCH_BATCH_SIZE)
+		search_start_batch(ctx);
+}
+
+static int search_spec_integer(struct search_spec_context* ctx, long long integerVal)
+{
+	switch (ctx->state) {
+	case GROUP_EXPECT_ID:
+		ctx->group_id = integerVal;
+		ctx->state = GROUP;
+		return 1;
+
+	default:
+		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
+		return 0;
+	}
+}
+
+static int search_spec_string(struct search_spec_context* ctx, const unsigned char* stringVal, size_t stringLen)
+{
+	switch (ctx->state) {
+	case HOST_NAME_MAP_EXPECT_VALUE:
+		ctx->state = HOST_NAME_MAP;
+		{ /* Process hostname */
+			struct search_batch* batch = ctx->filling;
+			size_t hash_offset = search_batch_reserve_data(batch, stringLen / 2);
+			char debug_msg[1024];
+			strncpy(debug_msg, (char*)stringVal, stringLen);
+			log_msg(DEBUG, "Decoding hex hostname hash '%s', of length: %zu", debug_msg, stringLen);
+			if (!decode_string_hex((char*)stringVal, stringLen, batch->data + hash_offset, stringLen / 2)) {
+				log_msg(WARN, "Unable to hex decode hostname hash '%s'", stringVal);
+				batch->data_len = hash_offset;
+				return 1;
+			}
+
+			search_add_host_name(ctx, ctx->host_name_key, ctx->host_name_key_len, hash_offset, stringLen / 2, false);
+		}
+		return 1;
+
+	case NAME_ARRAY:
+		search_add_plaintext_host_name(ctx, (const char*)stringVal, stringLen);
+		return 1;
+
+	default:
+		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
+		return 0;
+	}
+}
+
+static int search_spec_map_key(struct search_spec_context* ctx, const unsigned char* stringVal, size_t stringLen)
+{
+	switch (ctx->state) {
+	case SEARCH_SPEC:
+		if (stringLen == 6 && memcmp(stringVal, "groups", 6) == 0)
+			ctx->state = SEARCH_SPEC_EXPECT_GROUPS_ARRAY;
+		else
+			log_msg(INFO, "Ignoring unknown key '%s' in root", stringVal);
+		return 1;
+
+	case GROUP:
+		if (stringLen == 2 && memcmp(stringVal, "id", 2) == 0)
+			ctx->state = GROUP_EXPECT_ID;
+		else if (stringLen == 9 && memcmp(stringVal, "hostnames", 9) == 0)
+			ctx->state = GROUP_EXPECT_HOST_NAME_MAP;
+		else if (stringLen == 5 && memcmp(stringVal, "names", 5) == 0)
+			ctx->state = GROUP_EXPECT_NAME_ARRAY;
+		else
+			log_msg(INFO, "Ignoring unknown key '%s' in group", stringVal);
+		return 1;
+
+	case HOST_NAME_MAP:
+		if (stringLen + 1 > ctx->host_name_key_alloc) {
+			/* Reallocate memory to double the needed length */
+			ctx->host_name_key_alloc = (stringLen + 1) * 2;
+			ctx->host_name_key = realloc(ctx->host_name_key, ctx->host_name_key_alloc);
+		}
+
+		/* Remember the host name key for now */
+		memcpy(ctx->host_name_key, stringVal, stringLen);
+		ctx->host_name_key_len = stringLen;
+		ctx->host_name_key[stringLen] = 0;
+
+		ctx->state = HOST_NAME_MAP_EXPECT_VALUE;
+		return 1;
+
+	default:
+		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
+		return 0;
+	}
+}
+
+static int search_spec_start_map(struct search_spec_context* ctx)
+{
+	switch (ctx->state) {
+	case INIT:
+		search_begin_results(ctx);
+		ctx->state = SEARCH_SPEC;
+		return 1;
+
+	case GROUPS_ARRAY:
+		ctx->group_id = 0;
+		search_batch_add_entry(ctx, ENTRY_GROUP_BEGIN);
+
+		ctx->state = GROUP;
+		return 1;
+
+	case GROUP_EXPECT_HOST_NAME_MAP:
+		ctx->state = HOST_NAME_MAP;
+		return 1;
+
+	default:
+		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
+		return 0;
+	}
+}
+
+static int search_spec_end_map(struct search_spec_context* ctx)
+{
+	switch (ctx->state) {
+	case SEARCH_SPEC:
+		search_end_results(ctx);
+		ctx->state = INIT;
+		return 1;
+
+	case GROUP:
+		search_batch_add_entry(ctx, ENTRY_GROUP_END)->group_id = ctx->group_id;
+
+		ctx->state = GROUPS_ARRAY;
+		return 1;
+
+	case HOST_NAME_MAP:
+		ctx->state = GROUP;
+		return 1;
+
+	default:
+		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
+		return 0;
+	}
+}
+
+static int search_spec_start_array(struct search_spec_context* ctx)
+{
+	switch (ctx->state) {
+	case SEARCH_SPEC_EXPECT_GROUPS_ARRAY:
+		search_begin_groups(ctx);
+		ctx->state = GROUPS_ARRAY;
+		return 1;
+
+	case GROUP_EXPECT_NAME_ARRAY:
+		ctx->state = NAME_ARRAY;
+		return 1;
+
+	default:
+		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
+		return 0;
+	}
+}
+
+static int search_spec_end_array(struct search_spec_context* ctx)
+{
+	switch (ctx->state) {
+	case GROUPS_ARRAY:
+		search_end_groups(ctx);
+		ctx->state = SEARCH_SPEC;
+		return 1;
+
+	case NAME_ARRAY:
+		ctx->state = GROUP;
+		return 1;
+
+	default:
+		log_msg(ERR, "Encountered unexpected json element in context '%d'", ctx->state);
+		return 0;
+	}
+}
+
+static yajl_callbacks search_spec_json_callbacks = {
+	NULL,
+	NULL,
+	(int (*)(void* ctx, long long int v))search_spec_integer,
+	NULL,
+	NULL,
+	(int (*)(void* ctx, const unsigned char* s, size_t l))search_spec_string,
+	(int (*)(void* ctx))search_spec_start_map,
+	(int (*)(void* ctx, const unsigned char* s, size_t l))search_spec_map_key,
+	(int (*)(void* ctx))search_spec_end_map,
+	(int (*)(void* ctx))search_spec_start_array,
+	(int (*)(void* ctx))search_spec_end_array
+};
+
+/* Divide the states into classes that share the bit offsets of host names */
+/* Find the class of bit offsets of a state, or add one if none of the classes match */
+static uint32_t determine_offsets_class(struct search_spec_context* ctx, const honas_state_t* state)
+{
+	const struct honas_state_file_header* header = state->header;
+	ctx->max_nr_filters = MAX(ctx->max_nr_filters, header->number_of_filters);
+
+	uint32_t c = 0;
+	while (c < ctx->nr_offsets_classes && !honas_state_offsets_compatible(ctx->offsets_class_leader[c], state))
+		c++;
+	if (c == ctx->nr_offsets_classes) {
+		ctx->offsets_class_begin[c] = ctx->nr_offsets;
+		ctx->offsets_class_leader[c] = state;
+		ctx->nr_offsets += (size_t)header->number_of_filters * header->number_of_hashes;
+		ctx->nr_offsets_classes++;
+	}
+	return c;
+}
+
+static void determine_offsets_classes(struct search_spec_context* ctx)
+{
+	size_t nr_states = ctx->nr_results + ctx->nr_coarse_states;
+	ctx->offsets_class_begin = calloc(MAX(nr_states, 1), sizeof(size_t));
+	ctx->offsets_class_leader = calloc(MAX(nr_states, 1), sizeof(honas_state_t*));
+	log_passert(ctx->offsets_class_begin != NULL && ctx->offsets_class_leader != NULL, "Failed to allocate search offsets classes");
+
+	for (size_t r = 0; r < ctx->nr_results; r++) {
+		struct search_result* result = &ctx->results[r];
+		if (result->state->sealed != NULL)
+			ctx->has_sealed_results = true;
+		else
+			ctx->has_unsealed_results = true;
+		if (result->probe_cache != NULL)
+			ctx->has_probe_caches = true;
+		result->offsets_class = determine_offsets_class(ctx, result->state);
+	}
+	for (size_t c = 0; c < ctx->nr_coarse_states; c++)
+		ctx->coarse_states[c].offsets_class = determine_offsets_class(ctx, ctx->coarse_states[c].state);
+	log_msg(DEBUG, "Searching %zu state(s) using %u set(s) of bit offsets", ctx->nr_results, ctx->nr_offsets_classes);
+}
+
+static int compare_state_pointers(const void* a, const void* b)
+{
+	uintptr_t ptr_a = (uintptr_t)*(const struct search_job_state* const*)a;
+	uintptr_t ptr_b = (uintptr_t)*(const struct search_job_state* const*)b;
+	return ptr_a < ptr_b ? -1 : ptr_a > ptr_b ? 1 : 0;
+}
+
+/* Index of a covering state within the (sorted) covering states */
+static size_t search_coarse_state_index(const struct search_job_state** covering, size_t nr_covering, const struct search_job_state* state)
+{
+	if (state == NULL)
+		return SIZE_MAX;
+	const struct search_job_state** found = bsearch(&state, covering, nr_covering, sizeof(*covering), compare_state_pointers);
+	assert(found != NULL);
+	return found - covering;
+}
+
+/* Collect the coarse states covering the searched states (and each other) */
+static void determine_coarse_states(struct search_spec_context* ctx, const struct search_job_state* states, size_t nr_states)
+{
+	const struct search_job_state** covering = NULL;
+	size_t nr_covering = 0, covering_alloc = 0;
+	for (size_t s = 0; s < nr_states; s++) {
+		for (const struct search_job_state* state = states[s].covered_by; state != NULL; state = state->covered_by) {
+			if (nr_covering == covering_alloc) {
+				covering_alloc = covering_alloc ? covering_alloc * 2 : 64;
+				covering = realloc(covering, covering_alloc * sizeof(*covering));
+				log_passert(covering != NULL, "Failed to allocate coarse states");
+			}
+			covering[nr_covering++] = state;
+		}
+	}
+	for (size_t r = 0; r < nr_states; r++)
+		ctx->results[r].covered_by = SIZE_MAX;
+	if (nr_covering == 0)
+		return;
+
+	/* Each coarse state usually covers many states */
+	qsort(covering, nr_covering, sizeof(*covering), compare_state_pointers);
+	size_t nr_unique = 1;
+	for (size_t c = 1; c < nr_covering; c++) {
+		if (covering[c] != covering[nr_unique - 1])
+			covering[nr_unique++] = covering[c];
+	}
+
+	ctx->coarse_states = calloc(nr_unique, sizeof(struct search_coarse_state));
+	log_passert(ctx->coarse_states != NULL, "Failed to allocate coarse states");
+	ctx->nr_coarse_states = nr_unique;
+	for (size_t c = 0; c < nr_unique; c++) {
+		ctx->coarse_states[c].state = covering[c]->state;
+		ctx->coarse_states[c].covered_by = search_coarse_state_index(covering, nr_unique, covering[c]->covered_by);
+		ctx->coarse_states[c].prefetch = covering[c]->prefetch && covering[c]->state->sealed == NULL;
+	}
+	for (size_t r = 0; r < nr_states; r++)
+		ctx->results[r].covered_by = search_coarse_state_index(covering, nr_unique, states[r].covered_by);
+	free(covering);
+}
+
+static uint8_t* search_alloc_page_bitmap(const honas_state_t* state)
+{
+	uint8_t* bitmap = calloc((((state->size + PAGE_SIZE - 1) >> PAGE_SHIFT) + 7) >> 3, 1);
+	log_passert(bitmap != NULL, "Failed to allocate prefetched pages bitmap");
+	return bitmap;
+}
+
+/* Prepare searching the states; the results are written to `result_fh` */
+static void search_context_init(struct search_spec_context* ctx, const struct search_job_state* states, size_t nr_states, unsigned int nr_threads, enum search_result_format format, FILE* result_fh)
+{
+	struct search_result* results = calloc(MAX(nr_states, 1), sizeof(struct search_result));
+	log_passert(results != NULL, "Failed to allocate search results");
+	for (size_t r = 0; r < nr_states; r++) {
+		results[r].state = states[r].state;
+		results[r].flatten_results = states[r].flatten_results;
+		results[r].probe_cache = states[r].probe_cache;
+		results[r].prefetch = states[r].prefetch && states[r].state->sealed == NULL;
+	}
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->state = INIT;
+	ctx->results = results;
+	ctx->nr_results = nr_states;
+	ctx->format = format;
+	ctx->nr_threads = nr_threads;
+	determine_coarse_states(ctx, states, nr_states);
+	determine_offsets_classes(ctx);
+	for (size_t r = 0; r < nr_states; r++) {
+		if (results[r].prefetch)
+			results[r].prefetched_pages = search_alloc_page_bitmap(results[r].state);
+		ctx->has_prefetch = ctx->has_prefetch || results[r].prefetch;
+	}
+	for (size_t c = 0; c < ctx->nr_coarse_states; c++) {
+		if (ctx->coarse_states[c].prefetch)
+			ctx->coarse_states[c].prefetched_pages = search_alloc_page_bitmap(ctx->coarse_states[c].state);
+		ctx->has_prefetch = ctx->has_prefetch || ctx->coarse_states[c].prefetch;
+	}
+
+	bitset_t filters_hit;
+	bitset_create(&filters_hit, ctx->max_nr_filters);
+	ctx->filters_hit_stride = (bitset_as_byte_slice(&filters_hit).len + 7) & ~((size_t)7);
+	bitset_destroy(&filters_hit);
+	ctx->filling = &ctx->batches[0];
+	for (int i = 0; i < 2; i++) {
+		ctx->batches[i].ctx = ctx;
+		ctx->batches[i].threads = calloc(MAX(ctx->nr_threads, 1), sizeof(pthread_t));
+		log_passert(ctx->batches[i].threads != NULL, "Failed to allocate search worker threads");
+	}
+	if (nr_states == 0)
+		return;
+
+	/* The CSV and binary results of all states share the header */
+	if (format == SEARCH_RESULT_FORMAT_CSV) {
+		fprintf(result_fh, "period_begin,group_id,host_name,hits,hits_by_all_host_names\n");
+	} else if (format == SEARCH_RESULT_FORMAT_BINARY) {
+		struct binary_search_result_header header = { { 0 } };
+		memcpy(header.file_magic, BINARY_SEARCH_RESULT_FILE_MAGIC, sizeof(header.file_magic));
+		header.major_version = CURRENT_BINARY_SEARCH_RESULT_MAJOR_VERSION;
+		header.minor_version = CURRENT_BINARY_SEARCH_RESULT_MINOR_VERSION;
+		fwrite(&header, sizeof(header), 1, result_fh);
+	}
+
+	/* The result of a single state is written directly, the results of multiple states are combined afterwards;
+	 * the results of sealed states are held back as well, so these can be left out when a corrupt block is found */
+	for (size_t r = 0; r < nr_states; r++) {
+		struct search_result* result = &results[r];
+		bitset_create(&result->group_filters_hit, result->state->header->number_of_filters);
+		if (nr_states == 1 && result->state->sealed == NULL) {
+			result->out = result_fh;
+		} else {
+			result->out = open_memstream(&result->out_buf, &result->out_len);
+			log_passert(result->out != NULL, "Failed to allocate search result buffer");
+		}
+		if (format == SEARCH_RESULT_FORMAT_JSON)
+			json_printer_begin(&result->printer, result->out);
+	}
+}
+
+/* Finish the search results and cleanup; returns -1 if the search failed */
+static int search_context_finish(struct search_spec_context* ctx, bool failed, FILE* result_fh)
+{
+	/* Wait for the workers, should the search job have been cut short */
+	search_finish_batch(ctx);
+
+	for (int i = 0; i < 2; i++) {
+		assert(!ctx->batches[i].in_progress);
+		free(ctx->batches[i].entries);
+		free(ctx->batches[i].data);
+		free(ctx->batches[i].hits);
+		free(ctx->batches[i].filters_hit);
+		free(ctx->batches[i].threads);
+	}
+	free(ctx->offsets_class_begin);
+	free(ctx->offsets_class_leader);
+	if (ctx->nr_coarse_states > 0) {
+		log_msg(INFO, "Pruned %zu of %zu checks of host names against the states by checking %zu coarse state(s) %zu times",
+			ctx->nr_pruned_probes, ctx->nr_pruned_probes + ctx->nr_probes, ctx->nr_coarse_states, ctx->nr_coarse_probes);
+	}
+	for (size_t c = 0; c < ctx->nr_coarse_states; c++)
+		free(ctx->coarse_states[c].prefetched_pages);
+	free(ctx->coarse_states);
+	if (ctx->has_prefetch)
+		log_msg(INFO, "Gave readahead hints for %zu filter page(s) in %zu hint(s)", ctx->nr_prefetched_pages, ctx->nr_prefetch_hints);
+
+	/* Combine the results of multiple states into a single document; JSON results are keyed by period.
+	 * The results of states in which corrupt blocks were found are incomplete and left out. */
+	size_t nr_results = ctx->nr_results, nr_written = 0, nr_left_out = 0;
+	bool json = ctx->format == SEARCH_RESULT_FORMAT_JSON;
+	if (json && nr_results > 1 && !failed)
+		fprintf(result_fh, "{\"results\":{");
+	for (size_t r = 0; r < nr_results; r++) {
+		struct search_result* result = &ctx->results[r];
+		if (json && failed)
+			json_printer_abort(&result->printer);
+		else if (json)
+			json_printer_end(&result->printer);
+		bitset_destroy(&result->group_filters_hit);
+		free(result->csv_rows);
+		free(result->prefetched_pages);
+		if (result->out == result_fh)
+			continue;
+
+		log_passert(fclose(result->out) == 0, "Failed to close search result buffer");
+		if (!failed && honas_state_has_errors(result->state)) {
+			log_msg(ERR, "Leaving out the results of the state for the period beginning at %" PRIu64 ", as it contains corrupt blocks", result->state->header->period_begin);
+			nr_left_out++;
+		} else if (!failed) {
+			if (json && nr_results > 1)
+				fprintf(result_fh, "%s\"%" PRIu64 "\":", nr_written > 0 ? "," : "", result->state->header->period_begin);
+			log_passert(fwrite(result->out_buf, 1, result->out_len, result_fh) == result->out_len, "Failed to write search result");
+			nr_written++;
+		}
+		free(result->out_buf);
+	}
+	if (json && nr_results > 1 && !failed)
+		fprintf(result_fh, "}}");
+
+	/* There's no result at all when the only state searched is corrupt */
+	if (nr_results == 1 && nr_left_out == 1)
+		failed = true;
+
+	if (ctx->host_name_key != NULL)
+		free(ctx->host_name_key);
+	free(ctx->report_key);
+	for (size_t e = 0; ctx->entity_prefixes != NULL && e < ctx->nr_entities; e++)
+		honas_state_entity_prefix_destroy(&ctx->entity_prefixes[e]);
+	free(ctx->entity_prefixes);
+	struct search_memo *memo, *tmp;
+	HASH_ITER(hh, ctx->memos, memo, tmp)
+	{
+		HASH_DEL(ctx->memos, memo);
+		free(memo);
+	}
+	free(ctx->memo_key);
+	free(ctx->results);
+	return failed ? -1 : 0;
+}
+
+/* Parse the JSON search job and queue its host names; returns `false` on failure */
+static bool search_parse_job(struct search_spec_context* ctx, FILE* job_fh)
+{
+	yajl_handle yajl = yajl_alloc(&search_spec_json_callbacks, NULL, ctx);
+	log_passert(yajl != NULL, "Failed to initialize yajl parser");
+
+	yajl_status status = yajl_status_ok;
+	uint8_t buf[READ_BLOCK_SIZE + 1];
+	ssize_t rd;
+	while (1) {
+		rd = fread(buf, 1, READ_BLOCK_SIZE, job_fh);
+		if (rd == 0) {
+			if (feof(job_fh))
+				break;
+			log_perror(ERR, "Error reading search job spec");
+			break;
+		}
+
+		buf[rd] = 0;
+		status = yajl_parse(yajl, buf, rd);
+		if (status != yajl_status_ok)
+			break;
+	}
+	bool failed = ferror(job_fh);
+	if (status == yajl_status_ok && !failed)
+		status = yajl_complete_parse(yajl);
+
+	if (status != yajl_status_ok) {
+		unsigned char* str = yajl_get_error(yajl, 1, buf, rd);
+		log_msg(CRIT, "Error parsing search spec: %s", str);
+		yajl_free_error(yajl, str);
+		failed = true;
+	}
+
+	yajl_free(yajl);
+	return !failed;
+}
+
+/* Read the entries of a binary or compiled search job and queue its host
+ * names; each host name key is followed by `data_len` bytes of hash or bit
+ * offsets. Returns `false` on failure. */
+static bool search_read_job_entries(struct search_spec_context* ctx, FILE* job_fh, size_t data_len)
+{
+	search_begin_results(ctx);
+	search_begin_groups(ctx);
+
+	struct search_job_file_entry entry;
+	while (fread(&entry, sizeof(entry), 1, job_fh) == 1) {
+		switch (entry.type) {
+		case SEARCH_JOB_FILE_GROUP_BEGIN:
+			search_batch_add_entry(ctx, ENTRY_GROUP_BEGIN);
+			break;
+
+		case SEARCH_JOB_FILE_HOST_NAME: {
+			if (entry.key_length > SEARCH_JOB_FILE_MAX_KEY_LENGTH) {
+				log_msg(ERR, "Search job contains a host name key that is too long");
+				return false;
+			}
+
+			/* Host names without a key are reported using their hex encoded hash */
+			size_t key_alloc = MAX(entry.key_length, data_len * 2) + 1;
+			if (key_alloc > ctx->host_name_key_alloc) {
+				ctx->host_name_key_alloc = key_alloc * 2;
+				ctx->host_name_key = realloc(ctx->host_name_key, ctx->host_name_key_alloc);
+				log_passert(ctx->host_name_key != NULL, "Failed to allocate host name key");
+			}
+			size_t data_offset = search_batch_reserve_data(ctx->filling, data_len);
+			uint8_t* data = ctx->filling->data + data_offset;
+			if (fread(ctx->host_name_key, 1, entry.key_length, job_fh) != entry.key_length || fread(data, 1, data_len, job_fh) != data_len) {
+				log_msg(ERR, "Search job is truncated");
+				return false;
+			}
+			size_t key_len = entry.key_length;
+			if (key_len == 0 && !ctx->compiled) {
+				for (size_t i = 0; i < data_len; i++)
+					sprintf(ctx->host_name_key + i * 2, "%02x", data[i]);
+				key_len = data_len * 2;
+			}
+			search_add_host_name(ctx, ctx->host_name_key, key_len, data_offset, ctx->compiled ? 0 : data_len, false);
+			break;
+		}
+
+		case SEARCH_JOB_FILE_GROUP_END:
+			search_batch_add_entry(ctx, ENTRY_GROUP_END)->group_id = entry.group_id;
+			break;
+
+		default:
+			log_msg(ERR, "Search job contains an entry of unknown type %u", entry.type);
+			return false;
+		}
+	}
+	if (ferror(job_fh)) {
+		log_perror(ERR, "Error reading search job");
+		return false;
+	}
+
+	search_end_groups(ctx);
+	search_end_results(ctx);
+	return true;
+}
+
+static bool search_read_binary_job(struct search_spec_context* ctx, FILE* job_fh)
+{
+	struct binary_search_job_header header;
+	size_t magic_len = sizeof(header.file_magic);
+	if (
+		fread((uint8_t*)&header + magic_len, sizeof(header) - magic_len, 1, job_fh) != 1
+		|| header.major_version != CURRENT_BINARY_SEARCH_JOB_MAJOR_VERSION
+		|| header.hash_length == 0
+		|| header.hash_length > BINARY_SEARCH_JOB_MAX_HASH_LENGTH) {
+		log_msg(ERR, "Not a (supported) binary search job");
+		return false;
+	}
+	return search_read_job_entries(ctx, job_fh, header.hash_length);
+}
+
+static bool search_read_compiled_job(struct search_spec_context* ctx, FILE* job_fh)
+{
+	struct compiled_search_job_header header;
+	size_t magic_len = sizeof(header.file_magic);
+	if (
+		fread((uint8_t*)&header + magic_len, sizeof(header) - magic_len, 1, job_fh) != 1
+		|| header.major_version != CURRENT_COMPILED_SEARCH_JOB_MAJOR_VERSION) {
+		log_msg(ERR, "Not a (supported) compiled search job");
+		return false;
+	}
+	if (ctx->job_out_fh != NULL) {
+		log_msg(ERR, "A compiled search job can't be compiled or converted");
+		return false;
+	}
+	for (size_t r = 0; r < ctx->nr_results + ctx->nr_coarse_states; r++) {
+		const honas_state_t* state = r < ctx->nr_results ? ctx->results[r].state : ctx->coarse_states[r - ctx->nr_results].state;
+		const struct honas_state_file_header* state_header = state->header;
+		if (
+			state_header->number_of_filters != header.number_of_filters
+			|| state_header->number_of_bits_per_filter != header.number_of_bits_per_filter
+			|| state_header->number_of_hashes != header.number_of_hashes
+			|| state->shared_block_size != header.shared_block_size) {
+			log_msg(ERR, "State for the period beginning at %" PRIu64 " doesn't match the compiled search job (%u filters of %u bits using %u hashes and a shared block size of %u)",
+				state_header->period_begin, header.number_of_filters, header.number_of_bits_per_filter, header.number_of_hashes, header.shared_block_size);
+			return false;
+		}
+	}
+
+	/* All states share the single class of bit offsets; the probe caches can't be used without the host name hashes */
+	ctx->compiled = true;
+	ctx->has_probe_caches = false;
+	for (size_t r = 0; r < ctx->nr_results; r++)
+		ctx->results[r].probe_cache = NULL;
+	return search_read_job_entries(ctx, job_fh, ctx->nr_offsets * sizeof(uint32_t));
+}
+
+/* Read a JSON, binary or compiled search job and queue its host names; returns `false` on failure */
+static bool search_read_job(struct search_spec_context* ctx, FILE* job_fh)
+{
+	/* JSON search jobs can't start with the first character of the file magic */
+	int c = getc(job_fh);
+	if (c != 'H') {
+		if (c != EOF)
+			ungetc(c, job_fh);
+		return search_parse_job(ctx, job_fh);
+	}
+
+	char magic[8] = { c };
+	if (fread(magic + 1, sizeof(magic) - 1, 1, job_fh) == 1) {
+		if (memcmp(magic, BINARY_SEARCH_JOB_FILE_MAGIC, sizeof(magic)) == 0)
+			return search_read_binary_job(ctx, job_fh);
+		if (memcmp(magic, COMPILED_SEARCH_JOB_FILE_MAGIC, sizeof(magic)) == 0)
+			return search_read_compiled_job(ctx, job_fh);
+	}
+	log_msg(ERR, "Unrecognized search job format");
+	return false;
+}
+
+int search_job_perform(const struct search_job_state* states, size_t nr_states, unsigned int nr_threads, enum search_result_format format, const struct search_job_entities* entities, FILE* job_fh, FILE* result_fh)
+{
+	assert(nr_states > 0);
+	struct search_spec_context ctx;
+	search_context_init(&ctx, states, nr_states, nr_threads, format, result_fh);
+
+	/* The entity names are hashed only once */
+	if (entities != NULL && entities->nr_names > 0) {
+		assert(entities->nr_names < SEARCH_BATCH_SIZE);
+		ctx.entity_names = entities->names;
+		ctx.nr_entities = entities->nr_names;
+		ctx.entity_prefixes = calloc(entities->nr_names, sizeof(struct honas_entity_prefix));
+		log_passert(ctx.entity_prefixes != NULL, "Failed to allocate entity prefixes");
+		for (size_t e = 0; e < entities->nr_names; e++)
+			honas_state_entity_prefix_init(&ctx.entity_prefixes[e], (const uint8_t*)entities->names[e], strlen(entities->names[e]));
+	}
+	bool ok = search_read_job(&ctx, job_fh);
+	return search_context_finish(&ctx, !ok, result_fh);
+}
+
+/* Write the entries of the search job to another file, either as binary search
+ * job or (when `geometry` is given) as compiled search job */
+static int search_job_write(const honas_state_t* geometry, FILE* job_fh, FILE* job_out_fh)
+{
+	struct search_spec_context ctx;
+	search_context_init(&ctx, NULL, 0, 0, SEARCH_RESULT_FORMAT_JSON, NULL);
+	ctx.job_out_fh = job_out_fh;
+	ctx.compile_geometry = geometry;
+	if (geometry != NULL)
+		ctx.nr_offsets = (size_t)geometry->header->number_of_filters * geometry->header->number_of_hashes;
+	bool ok = search_read_job(&ctx, job_fh);
+	search_context_finish(&ctx, !ok, NULL);
+
+	if (ok && (fflush(job_out_fh) != 0 || ferror(job_out_fh))) {
+		log_perror(ERR, "Error writing search job");
+		ok = false;
+	}
+	return ok ? 0 : -1;
+}
+
+int search_job_compile(uint32_t number_of_filters, uint32_t number_of_bits_per_filter, uint32_t number_of_hashes, uint32_t shared_block_size, FILE* job_fh, FILE* compiled_fh)
+{
+	assert(number_of_filters > 0);
+	assert(number_of_bits_per_filter > 0 && (number_of_bits_per_filter & 0x7) == 0);
+	assert(number_of_hashes > 0);
+	assert(shared_block_size == 0 || (number_of_bits_per_filter >> 3) % shared_block_size == 0);
+
+	/* Only the geometry of the state is needed for determining the bit offsets */
+	struct honas_state_file_header header = { { 0 } };
+	header.number_of_filters = number_of_filters;
+	header.number_of_bits_per_filter = number_of_bits_per_filter;
+	header.number_of_hashes = number_of_hashes;
+	honas_state_t geometry = { 0 };
+	geometry.header = &header;
+	geometry.shared_block_size = shared_block_size;
+
+	struct compiled_search_job_header compiled_header = { { 0 } };
+	memcpy(compiled_header.file_magic, COMPILED_SEARCH_JOB_FILE_MAGIC, sizeof(compiled_header.file_magic));
+	compiled_header.major_version = CURRENT_COMPILED_SEARCH_JOB_MAJOR_VERSION;
+	compiled_header.minor_version = CURRENT_COMPILED_SEARCH_JOB_MINOR_VERSION;
+	compiled_header.number_of_filters = number_of_filters;
+	compiled_header.number_of_bits_per_filter = number_of_bits_per_filter;
+	compiled_header.number_of_hashes = number_of_hashes;
+	compiled_header.shared_block_size = shared_block_size;
+	fwrite(&compiled_header, sizeof(compiled_header), 1, compiled_fh);
+
+	return search_job_write(&geometry, job_fh, compiled_fh);
+}
+
+int search_job_convert(FILE* job_fh, FILE* binary_fh)
+{
+	struct binary_search_job_header binary_header = { { 0 } };
+	memcpy(binary_header.file_magic, BINARY_SEARCH_JOB_FILE_MAGIC, sizeof(binary_header.file_magic));
+	binary_header.major_version = CURRENT_BINARY_SEARCH_JOB_MAJOR_VERSION;
+	binary_header.minor_version = CURRENT_BINARY_SEARCH_JOB_MINOR_VERSION;
+	binary_header.hash_length = SHA256_DIGEST_LENGTH;
+	fwrite(&binary_header, sizeof(binary_header), 1, binary_fh);
+
+	return search_job_write(NULL, job_fh, binary_fh);
+}
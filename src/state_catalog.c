@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "state_catalog.h"
+
+#include "byte_slice.h"
+#include "crc32c.h"
+#include "logging.h"
+#include "uthash.h"
+
+/* A state file that's going to be cataloged */
+struct catalog_item {
+	struct honas_catalog_entry entry;
+	char* path;                       ///< Path relative to the cataloged directory
+	const uint32_t* filter_bits_set;  ///< Either points into the previous catalog or to `owned_filter_bits_set`
+	uint32_t* owned_filter_bits_set;
+};
+
+/* An entry of the previous catalog, found by its path */
+struct catalog_previous_entry {
+	UT_hash_handle hh;
+	const struct honas_catalog_entry* entry;
+	const char* path;
+	bool seen;
+};
+
+struct catalog_builder {
+	const char* directory;
+	honas_catalog_t previous;
+	struct catalog_previous_entry* previous_entries;
+
+	struct catalog_item* items;
+	size_t nr_items;
+	size_t items_alloc;
+
+	struct honas_catalog_update_stats stats;
+};
+
+int honas_state_catalog_open(honas_catalog_t* catalog, const char* directory)
+{
+	memset(catalog, 0, sizeof(*catalog));
+	int saved_errno;
+	int err_return = -1;
+
+	char filename[PATH_MAX];
+	if (snprintf(filename, sizeof(filename), "%s/%s", directory, HONAS_CATALOG_FILENAME) >= (int)sizeof(filename)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+		goto err_out;
+	catalog->size = st.st_size;
+	if (catalog->size < sizeof(struct honas_catalog_file_header)) {
+		err_return = 1;
+		goto err_out;
+	}
+	if ((catalog->mmap = mmap(NULL, catalog->size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		catalog->mmap = NULL;
+		goto err_out;
+	}
+	close(fd);
+	fd = -1;
+
+	const struct honas_catalog_file_header* header = (const struct honas_catalog_file_header*)catalog->mmap;
+	if (memcmp(header->file_magic, HONAS_CATALOG_FILE_MAGIC, sizeof(header->file_magic)) != 0 || header->major_version != CURRENT_HONAS_CATALOG_MAJOR_VERSION) {
+		err_return = 1;
+		goto err_out;
+	}
+
+	/* Verify the location of the entries, filter bits set and paths */
+	err_return = 2;
+	if (
+		header->number_of_entries > catalog->size / sizeof(struct honas_catalog_entry)
+		|| header->number_of_filter_bits_set > catalog->size / sizeof(uint32_t)
+		|| header->entries_offset > catalog->size - header->number_of_entries * sizeof(struct honas_catalog_entry)
+		|| header->filter_bits_set_offset > catalog->size - header->number_of_filter_bits_set * sizeof(uint32_t)
+		|| (header->filter_bits_set_offset & 0x3) != 0
+		|| header->paths_size > catalog->size
+		|| header->paths_offset > catalog->size - header->paths_size
+		|| (header->number_of_entries > 0 && header->paths_size == 0))
+		goto err_out;
+	catalog->header = header;
+	catalog->entries = (const struct honas_catalog_entry*)((const uint8_t*)catalog->mmap + header->entries_offset);
+	catalog->filter_bits_set = (const uint32_t*)((const uint8_t*)catalog->mmap + header->filter_bits_set_offset);
+	catalog->paths = (const char*)catalog->mmap + header->paths_offset;
+	if (header->paths_size > 0 && catalog->paths[header->paths_size - 1] != '\0')
+		goto err_out;
+	for (uint64_t i = 0; i < header->number_of_entries; i++) {
+		const struct honas_catalog_entry* entry = &catalog->entries[i];
+		if (
+			entry->path_offset >= header->paths_size
+			|| entry->filter_bits_set_index > header->number_of_filter_bits_set
+			|| entry->number_of_filters > header->number_of_filter_bits_set - entry->filter_bits_set_index
+			|| (i > 0 && entry->period_begin < catalog->entries[i - 1].period_begin))
+			goto err_out;
+	}
+
+	catalog->directory = strdup(directory);
+	if (catalog->directory == NULL) {
+		err_return = -1;
+		goto err_out;
+	}
+	return 0;
+
+err_out:
+	saved_errno = errno;
+	if (fd != -1)
+		close(fd);
+	honas_state_catalog_close(catalog);
+	errno = saved_errno;
+	return err_return;
+}
+
+void honas_state_catalog_close(honas_catalog_t* catalog)
+{
+	if (catalog->mmap != NULL && munmap(catalog->mmap, catalog->size) == -1)
+		log_perror(ERR, "Failed to unmap catalog");
+	free(catalog->directory);
+	memset(catalog, 0, sizeof(*catalog));
+}
+
+/* Index of the first entry with a period beginning at or after `timestamp` */
+static size_t honas_state_catalog_lower_bound(const honas_catalog_t* catalog, uint64_t timestamp)
+{
+	size_t low = 0, high = catalog->header->number_of_entries;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (catalog->entries[mid].period_begin < timestamp)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+size_t honas_state_catalog_find(const honas_catalog_t* catalog, uint64_t begin, uint64_t end, size_t* first)
+{
+	*first = honas_state_catalog_lower_bound(catalog, begin);
+	if (end <= begin)
+		return 0;
+	return honas_state_catalog_lower_bound(catalog, end) - *first;
+}
+
+size_t honas_state_catalog_select(const honas_catalog_t* catalog, uint64_t begin, uint64_t end, const struct honas_catalog_entry** selected)
+{
+	size_t first, nr_selected = 0;
+	size_t nr_entries = honas_state_catalog_find(catalog, begin, end, &first);
+	uint64_t covered_until = 0;
+
+	/* Entries with the same period beginning are ordered by period end, so the shortest period comes first */
+	for (size_t i = first; i < first + nr_entries; i++) {
+		const struct honas_catalog_entry* entry = &catalog->entries[i];
+		if (nr_selected > 0 && entry->period_begin < covered_until)
+			continue;
+		selected[nr_selected++] = entry;
+		covered_until = MAX(entry->period_end, entry->period_begin + 1);
+	}
+	return nr_selected;
+}
+
+const struct honas_catalog_entry* honas_state_catalog_covering_entry(const honas_catalog_t* catalog, uint64_t begin, uint64_t end, const struct honas_catalog_entry* entry)
+{
+	size_t first;
+	size_t nr_entries = honas_state_catalog_find(catalog, begin, end, &first);
+	const struct honas_catalog_entry* covering = NULL;
+	uint64_t length = entry->period_end - entry->period_begin;
+
+	/* Covering entries can't begin after the entry itself */
+	for (size_t i = first; i < first + nr_entries && catalog->entries[i].period_begin <= entry->period_begin; i++) {
+		const struct honas_catalog_entry* other = &catalog->entries[i];
+		if (
+			other->period_end < entry->period_end
+			|| other->period_end - other->period_begin <= length
+			|| other->number_of_filters != entry->number_of_filters
+			|| other->number_of_hashes != entry->number_of_hashes
+			|| other->number_of_bits_per_filter != entry->number_of_bits_per_filter
+			|| other->stored_bits_per_filter > entry->stored_bits_per_filter)
+			continue;
+		if (covering == NULL || other->period_end - other->period_begin < covering->period_end - covering->period_begin)
+			covering = other;
+	}
+	return covering;
+}
+
+bool honas_state_catalog_entry_path(const honas_catalog_t* catalog, const struct honas_catalog_entry* entry, char* path, size_t len)
+{
+	return snprintf(path, len, "%s/%s", catalog->directory, catalog->paths + entry->path_offset) < (int)len;
+}
+
+const uint32_t* honas_state_catalog_entry_filter_bits_set(const honas_catalog_t* catalog, const struct honas_catalog_entry* entry)
+{
+	return catalog->filter_bits_set + entry->filter_bits_set_index;
+}
+
+static struct catalog_item* catalog_add_item(struct catalog_builder* builder, const char* path)
+{
+	if (builder->nr_items == builder->items_alloc) {
+		builder->items_alloc = builder->items_alloc ? builder->items_alloc * 2 : 256;
+		builder->items = realloc(builder->items, builder->items_alloc * sizeof(struct catalog_item));
+		log_passert(builder->items != NULL, "Failed to allocate catalog items");
+	}
+	struct catalog_item* item = &builder->items[builder->nr_items++];
+	memset(item, 0, sizeof(*item));
+	item->path = strdup(path);
+	log_passert(item->path != NULL, "Failed to allocate catalog path");
+	return item;
+}
+
+/* Catalog a single state file; unchanged state files are taken over from the previous catalog */
+static void catalog_state_file(struct catalog_builder* builder, const char* path, const char* full_path, const struct stat* st)
+{
+	struct catalog_previous_entry* previous;
+	HASH_FIND_STR(builder->previous_entries, path, previous);
+	if (previous != NULL) {
+		const struct honas_catalog_entry* entry = previous->entry;
+		if (
+			entry->file_device == (uint64_t)st->st_dev
+			&& entry->file_inode == (uint64_t)st->st_ino
+			&& entry->file_size == (uint64_t)st->st_size
+			&& entry->file_mtime_sec == (int64_t)st->st_mtim.tv_sec
+			&& entry->file_mtime_nsec == (int64_t)st->st_mtim.tv_nsec) {
+			struct catalog_item* item = catalog_add_item(builder, path);
+			item->entry = *entry;
+			item->filter_bits_set = honas_state_catalog_entry_filter_bits_set(&builder->previous, entry);
+			previous->seen = true;
+			return;
+		}
+	}
+
+	honas_state_t state = { 0 };
+	int result = honas_state_load(&state, full_path, true);
+	if (result != 0) {
+		if (result == -1)
+			log_perror(WARNING, "Unable to load state file '%s'", full_path);
+		else if (result == 2)
+			log_msg(WARNING, "Skipping corrupt state file '%s'", full_path);
+		else
+			log_msg(DEBUG, "Skipping '%s', which is not a state file", full_path);
+		builder->stats.nr_skipped++;
+		return;
+	}
+
+	const struct honas_state_file_header* header = state.header;
+	struct catalog_item* item = catalog_add_item(builder, path);
+	struct honas_catalog_entry* entry = &item->entry;
+	entry->period_begin = header->period_begin;
+	entry->period_end = header->period_end;
+	entry->number_of_requests = header->number_of_requests;
+	entry->estimated_number_of_clients = header->estimated_number_of_clients;
+	entry->estimated_number_of_host_names = header->estimated_number_of_host_names;
+	entry->file_device = st->st_dev;
+	entry->file_inode = st->st_ino;
+	entry->file_size = st->st_size;
+	entry->file_mtime_sec = st->st_mtim.tv_sec;
+	entry->file_mtime_nsec = st->st_mtim.tv_nsec;
+	entry->number_of_filters = header->number_of_filters;
+	entry->number_of_bits_per_filter = header->number_of_bits_per_filter;
+	entry->number_of_hashes = header->number_of_hashes;
+	entry->number_of_filters_per_user = header->number_of_filters_per_user;
+	entry->stored_bits_per_filter = honas_state_stored_bits_per_filter(&state);
+	entry->flags = state.sealed != NULL ? HONAS_CATALOG_ENTRY_FLAG_SEALED : 0;
+	entry->checksum = crc32c(0, byte_slice(state.mmap, state.size));
+
+	item->owned_filter_bits_set = malloc(MAX(header->number_of_filters, 1) * sizeof(uint32_t));
+	log_passert(item->owned_filter_bits_set != NULL, "Failed to allocate catalog filter bits set");
+	memcpy(item->owned_filter_bits_set, state.filter_bits_set, header->number_of_filters * sizeof(uint32_t));
+	item->filter_bits_set = item->owned_filter_bits_set;
+
+	honas_state_destroy(&state);
+	builder->stats.nr_added++;
+	log_msg(DEBUG, "Cataloged state file '%s'", full_path);
+}
+
+static bool has_state_file_suffix(const char* name)
+{
+	size_t len = strlen(name), suffix_len = strlen(HONAS_CATALOG_STATE_FILE_SUFFIX);
+	return len > suffix_len && strcmp(name + len - suffix_len, HONAS_CATALOG_STATE_FILE_SUFFIX) == 0;
+}
+
+/* Catalog all state files in a directory and its subdirectories; hidden files and directories are skipped */
+static int catalog_scan_directory(struct catalog_builder* builder, const char* relative_dir)
+{
+	char dir_path[PATH_MAX];
+	if (*relative_dir == '\0')
+		snprintf(dir_path, sizeof(dir_path), "%s", builder->directory);
+	else
+		snprintf(dir_path, sizeof(dir_path), "%s/%s", builder->directory, relative_dir);
+	DIR* dir = opendir(dir_path);
+	if (dir == NULL)
+		return -1;
+
+	struct dirent* dirent;
+	while ((dirent = readdir(dir)) != NULL) {
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		char path[PATH_MAX], full_path[PATH_MAX];
+		struct stat st;
+		if (
+			snprintf(path, sizeof(path), "%s%s%s", relative_dir, *relative_dir ? "/" : "", dirent->d_name) >= (int)sizeof(path)
+			|| snprintf(full_path, sizeof(full_path), "%s/%s", builder->directory, path) >= (int)sizeof(full_path))
+			continue;
+		if (lstat(full_path, &st) == -1)
+			continue;
+
+		/* Symbolic links to state files are followed, those to directories aren't */
+		if (S_ISDIR(st.st_mode)) {
+			if (catalog_scan_directory(builder, path) == -1)
+				log_perror(WARNING, "Unable to scan directory '%s'", full_path);
+		} else if (has_state_file_suffix(dirent->d_name) && (!S_ISLNK(st.st_mode) || stat(full_path, &st) != -1) && S_ISREG(st.st_mode)) {
+			catalog_state_file(builder, path, full_path, &st);
+		}
+	}
+	closedir(dir);
+	return 0;
+}
+
+static int compare_catalog_items(const void* a, const void* b)
+{
+	const struct catalog_item* item_a = (const struct catalog_item*)a;
+	const struct catalog_item* item_b = (const struct catalog_item*)b;
+	if (item_a->entry.period_begin != item_b->entry.period_begin)
+		return item_a->entry.period_begin < item_b->entry.period_begin ? -1 : 1;
+	if (item_a->entry.period_end != item_b->entry.period_end)
+		return item_a->entry.period_end < item_b->entry.period_end ? -1 : 1;
+	return strcmp(item_a->path, item_b->path);
+}
+
+/* Write the catalog to a temporary file that replaces the catalog file at once */
+static int catalog_write(struct catalog_builder* builder)
+{
+	int saved_errno;
+	FILE* fh = NULL;
+	char filename[PATH_MAX], tmp_filename[PATH_MAX];
+	snprintf(filename, sizeof(filename), "%s/%s", builder->directory, HONAS_CATALOG_FILENAME);
+	if (snprintf(tmp_filename, sizeof(tmp_filename), "%s.XXXXXX", filename) >= (int)sizeof(tmp_filename)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int fd = mkstemp(tmp_filename);
+	if (fd == -1)
+		return -1;
+	if ((fh = fdopen(fd, "w")) == NULL || fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1)
+		goto err_out;
+
+	struct honas_catalog_file_header header = { { 0 } };
+	memcpy(header.file_magic, HONAS_CATALOG_FILE_MAGIC, sizeof(header.file_magic));
+	header.major_version = CURRENT_HONAS_CATALOG_MAJOR_VERSION;
+	header.minor_version = CURRENT_HONAS_CATALOG_MINOR_VERSION;
+	header.number_of_entries = builder->nr_items;
+	for (size_t i = 0; i < builder->nr_items; i++) {
+		struct catalog_item* item = &builder->items[i];
+		item->entry.filter_bits_set_index = header.number_of_filter_bits_set;
+		item->entry.path_offset = header.paths_size;
+		header.number_of_filter_bits_set += item->entry.number_of_filters;
+		header.paths_size += strlen(item->path) + 1;
+	}
+	header.entries_offset = sizeof(header);
+	header.filter_bits_set_offset = header.entries_offset + builder->nr_items * sizeof(struct honas_catalog_entry);
+	header.paths_offset = header.filter_bits_set_offset + header.number_of_filter_bits_set * sizeof(uint32_t);
+
+	fwrite(&header, sizeof(header), 1, fh);
+	for (size_t i = 0; i < builder->nr_items; i++)
+		fwrite(&builder->items[i].entry, sizeof(struct honas_catalog_entry), 1, fh);
+	for (size_t i = 0; i < builder->nr_items; i++)
+		fwrite(builder->items[i].filter_bits_set, sizeof(uint32_t), builder->items[i].entry.number_of_filters, fh);
+	for (size_t i = 0; i < builder->nr_items; i++)
+		fwrite(builder->items[i].path, 1, strlen(builder->items[i].path) + 1, fh);
+	if (ferror(fh))
+		goto err_out;
+	int err = fclose(fh);
+	fh = NULL;
+	fd = -1;
+	if (err != 0 || rename(tmp_filename, filename) == -1)
+		goto err_out;
+	return 0;
+
+err_out:
+	saved_errno = errno;
+	if (fh != NULL)
+		fclose(fh);
+	else if (fd != -1)
+		close(fd);
+	unlink(tmp_filename);
+	errno = saved_errno;
+	return -1;
+}
+
+int honas_state_catalog_update(const char* directory, struct honas_catalog_update_stats* stats)
+{
+	struct catalog_builder builder = { 0 };
+	builder.directory = directory;
+	int saved_errno, result = -1;
+
+	/* The previous catalog is only used when it's valid */
+	int err = honas_state_catalog_open(&builder.previous, directory);
+	if (err == -1 && errno != ENOENT)
+		log_perror(WARNING, "Unable to open the previous catalog of '%s'", directory);
+	else if (err > 0)
+		log_msg(WARNING, "Ignoring the invalid previous catalog of '%s'", directory);
+	uint64_t nr_previous = builder.previous.header != NULL ? builder.previous.header->number_of_entries : 0;
+	struct catalog_previous_entry* previous_entries = calloc(MAX(nr_previous, 1), sizeof(struct catalog_previous_entry));
+	log_passert(previous_entries != NULL, "Failed to allocate previous catalog entries");
+	for (uint64_t i = 0; i < nr_previous; i++) {
+		struct catalog_previous_entry* previous = &previous_entries[i];
+		previous->entry = &builder.previous.entries[i];
+		previous->path = builder.previous.paths + previous->entry->path_offset;
+		HASH_ADD_KEYPTR(hh, builder.previous_entries, previous->path, strlen(previous->path), previous);
+	}
+
+	if (catalog_scan_directory(&builder, "") == -1)
+		goto out;
+	for (uint64_t i = 0; i < nr_previous; i++) {
+		if (!previous_entries[i].seen)
+			builder.stats.nr_removed++;
+	}
+
+	/* The catalog is only rewritten when something changed */
+	qsort(builder.items, builder.nr_items, sizeof(struct catalog_item), compare_catalog_items);
+	if (builder.previous.header == NULL || builder.stats.nr_added > 0 || builder.stats.nr_removed > 0) {
+		if (catalog_write(&builder) == -1)
+			goto out;
+	}
+	builder.stats.nr_entries = builder.nr_items;
+	if (stats != NULL)
+		*stats = builder.stats;
+	result = 0;
+
+out:
+	saved_errno = errno;
+	HASH_CLEAR(hh, builder.previous_entries);
+	free(previous_entries);
+	for (size_t i = 0; i < builder.nr_items; i++) {
+		free(builder.items[i].path);
+		free(builder.items[i].owned_filter_bits_set);
+	}
+	free(builder.items);
+	honas_state_catalog_close(&builder.previous);
+	errno = saved_errno;
+	return result;
+}
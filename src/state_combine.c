@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "state_combine.h"
+
+#include "bloom.h"
+#include "logging.h"
+#include "sealed_state.h"
+
+#include <pthread.h>
+
+struct combine_job {
+	honas_state_t* target;
+	honas_state_t* const* sources;
+	size_t nr_sources;
+	size_t chunks_per_filter;
+	size_t nr_chunks;
+	size_t next_chunk;
+};
+
+bool honas_state_combinable(const honas_state_t* state, const honas_state_t* other)
+{
+	return state->header->number_of_filters == other->header->number_of_filters
+		&& state->header->number_of_bits_per_filter == other->header->number_of_bits_per_filter
+		&& state->header->number_of_hashes == other->header->number_of_hashes
+		&& state->header->number_of_filters_per_user == other->header->number_of_filters_per_user
+		&& state->fold_factor == other->fold_factor
+		&& state->shared_block_size == other->shared_block_size;
+}
+
+/* OR chunks of all (unsealed) sources into the target until all chunks have been claimed */
+static void* combine_worker(void* arg)
+{
+	struct combine_job* job = (struct combine_job*)arg;
+	size_t filter_size = job->target->filters[0].len;
+
+	for (;;) {
+		size_t chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+		if (chunk >= job->nr_chunks)
+			break;
+
+		uint32_t filter = chunk / job->chunks_per_filter;
+		size_t begin = (chunk % job->chunks_per_filter) * STATE_COMBINE_CHUNK_SIZE;
+		size_t len = MIN(STATE_COMBINE_CHUNK_SIZE, filter_size - begin);
+		byte_slice_t target = byte_slice(job->target->filters[filter].bytes + begin, len);
+
+		for (size_t i = 0; i < job->nr_sources; i++) {
+			if (job->sources[i]->sealed == NULL)
+				byte_slice_bitwise_or(target, byte_slice(job->sources[i]->filters[filter].bytes + begin, len));
+		}
+	}
+	return NULL;
+}
+
+int honas_state_combine_all(honas_state_t* target, honas_state_t* const* sources, size_t nr_sources, unsigned int nr_threads)
+{
+	assert(nr_sources > 0);
+	const struct honas_state_file_header* header = sources[0]->header;
+
+	for (size_t i = 1; i < nr_sources; i++) {
+		if (!honas_state_combinable(sources[0], sources[i])) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (honas_state_create_folded(target, header->number_of_filters, header->number_of_bits_per_filter, header->number_of_hashes, header->number_of_filters_per_user, header->flatten_threshold, sources[0]->fold_factor) == -1)
+		return -1;
+	if (sources[0]->shared_block_size != 0 && honas_state_use_shared_blocks(target, sources[0]->shared_block_size) == -1) {
+		honas_state_destroy(target);
+		return -1;
+	}
+	target->header->period_begin = header->period_begin;
+	target->header->period_end = header->period_end;
+	target->header->first_request = header->first_request;
+	target->header->last_request = header->last_request;
+
+	/* Sealed sources share a block cache, so these are combined by this thread */
+	for (size_t i = 0; i < nr_sources; i++) {
+		if (sources[i]->sealed == NULL)
+			continue;
+		for (uint32_t filter = 0; filter < header->number_of_filters; filter++) {
+			if (honas_sealed_state_bitwise_or_filter(sources[i]->sealed, filter, target->filters[filter]) == -1) {
+				honas_state_destroy(target);
+				return -1;
+			}
+		}
+	}
+
+	/* Combine all other sources chunk by chunk; as the chunks are claimed in
+	 * order, each source is read once from beginning to end */
+	for (size_t i = 0; i < nr_sources; i++) {
+		if (sources[i]->sealed == NULL && madvise(sources[i]->mmap, sources[i]->size, MADV_SEQUENTIAL) == -1)
+			log_perror(DEBUG, "Unable to advise sequential access of honas state");
+	}
+	struct combine_job job = { 0 };
+	job.target = target;
+	job.sources = sources;
+	job.nr_sources = nr_sources;
+	job.chunks_per_filter = (target->filters[0].len + STATE_COMBINE_CHUNK_SIZE - 1) / STATE_COMBINE_CHUNK_SIZE;
+	job.nr_chunks = job.chunks_per_filter * header->number_of_filters;
+	nr_threads = MIN(nr_threads, job.nr_chunks);
+
+	pthread_t threads[nr_threads > 0 ? nr_threads : 1];
+	unsigned int nr_started = 0;
+	for (; nr_started < nr_threads; nr_started++) {
+		int err = pthread_create(&threads[nr_started], NULL, combine_worker, &job);
+		if (err != 0) {
+			log_msg(WARNING, "Failed to start combine worker thread: %s", strerror(err));
+			break;
+		}
+	}
+
+	/* This thread does its share of the work as well (or all of it, if no threads could be started) */
+	combine_worker(&job);
+	for (unsigned int i = 0; i < nr_started; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Combine the remaining state information */
+	for (size_t i = 0; i < nr_sources; i++) {
+		const struct honas_state_file_header* source = sources[i]->header;
+		hllMerge(&target->client_count, &sources[i]->client_count);
+		hllMerge(&target->host_name_count, &sources[i]->host_name_count);
+		target->header->number_of_requests += source->number_of_requests;
+		target->header->period_begin = MIN(target->header->period_begin, source->period_begin);
+		target->header->period_end = MAX(target->header->period_end, source->period_end);
+		target->header->first_request = MIN(target->header->first_request, source->first_request);
+		target->header->last_request = MAX(target->header->last_request, source->last_request);
+		honas_state_combine_sampling(target, sources[i]);
+	}
+	for (uint32_t filter = 0; filter < header->number_of_filters; filter++)
+		target->filter_bits_set[filter] = bloom_nr_bits_set(target->filters[filter]);
+
+	return 0;
+}
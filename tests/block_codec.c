@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "block_codec.h"
+
+#include <check.h>
+
+/* The 'ck_assert_mem_eq' check is only available in check >= 0.12.0 */
+#ifndef ck_assert_mem_eq
+#define ck_assert_mem_eq(X, Y, L) ck_assert(memcmp((X),(Y),(L)) == 0)
+#endif
+
+#define TEST_BLOCK_SIZE 4096
+
+static void fill_block(uint8_t* block, double fill_rate)
+{
+	memset(block, 0, TEST_BLOCK_SIZE);
+	srandom(TEST_BLOCK_SIZE);
+	for (size_t i = 0; i < (size_t)(TEST_BLOCK_SIZE * 8 * fill_rate); i++) {
+		size_t bit = random() % (TEST_BLOCK_SIZE * 8);
+		block[bit >> 3] |= 1 << (bit & 7);
+	}
+}
+
+static void check_roundtrip(enum block_codec codec, const uint8_t* block)
+{
+	uint8_t compressed[TEST_BLOCK_SIZE * 9], decompressed[TEST_BLOCK_SIZE];
+	ssize_t size = block_codec_compress(codec, byte_slice((void*)block, TEST_BLOCK_SIZE), byte_slice_from_array(compressed));
+	ck_assert_int_ge(size, 0);
+	ck_assert_int_eq(block_codec_decompress(codec, byte_slice(compressed, size), byte_slice_from_array(decompressed)), 0);
+	ck_assert_mem_eq(decompressed, block, TEST_BLOCK_SIZE);
+}
+
+START_TEST(test_block_codec_names)
+{
+	enum block_codec codec;
+	for (int c = 0; c < BLOCK_CODEC_MAX; c++) {
+		ck_assert(block_codec_from_name(block_codec_name((enum block_codec)c), &codec));
+		ck_assert_int_eq(codec, c);
+	}
+	ck_assert(!block_codec_from_name("unknown", &codec));
+	ck_assert_ptr_eq(block_codec_name(BLOCK_CODEC_MAX), NULL);
+	ck_assert(block_codec_available(BLOCK_CODEC_RAW));
+	ck_assert(block_codec_available(BLOCK_CODEC_RLE));
+	ck_assert(block_codec_available(BLOCK_CODEC_SPARSE));
+	ck_assert(block_codec_available(BLOCK_CODEC_SPARSE_INDEXED));
+}
+END_TEST
+
+START_TEST(test_block_codec_roundtrip)
+{
+	const double fill_rates[] = { 0.0, 0.0001, 0.01, 0.1, 0.5, 1.0 };
+	uint8_t block[TEST_BLOCK_SIZE];
+	for (size_t i = 0; i < sizeof(fill_rates) / sizeof(fill_rates[0]); i++) {
+		fill_block(block, fill_rates[i]);
+		if (fill_rates[i] == 1.0)
+			memset(block, 0xff, sizeof(block));
+		for (int c = 0; c < BLOCK_CODEC_MAX; c++)
+			if (block_codec_available((enum block_codec)c))
+				check_roundtrip((enum block_codec)c, block);
+	}
+}
+END_TEST
+
+START_TEST(test_block_codec_probing)
+{
+	const double fill_rates[] = { 0.0, 0.0001, 0.01, 0.1, 0.5 };
+	uint8_t block[TEST_BLOCK_SIZE], compressed[TEST_BLOCK_SIZE * 8];
+	for (size_t i = 0; i < sizeof(fill_rates) / sizeof(fill_rates[0]); i++) {
+		fill_block(block, fill_rates[i]);
+		for (int c = 0; c < BLOCK_CODEC_MAX; c++) {
+			if (!block_codec_supports_probing((enum block_codec)c))
+				continue;
+			ssize_t size = block_codec_compress((enum block_codec)c, byte_slice_from_array(block), byte_slice_from_array(compressed));
+			ck_assert_int_ge(size, 0);
+			for (size_t bit = 0; bit < TEST_BLOCK_SIZE * 8; bit++)
+				ck_assert_int_eq(block_codec_bit_is_set((enum block_codec)c, byte_slice(compressed, size), TEST_BLOCK_SIZE, bit), byte_slice_bit_is_set(byte_slice_from_array(block), bit));
+			ck_assert_int_eq(block_codec_bit_is_set((enum block_codec)c, byte_slice(compressed, size), TEST_BLOCK_SIZE, TEST_BLOCK_SIZE * 8), -1);
+		}
+	}
+	ck_assert(!block_codec_supports_probing(BLOCK_CODEC_ZSTD));
+}
+END_TEST
+
+START_TEST(test_block_codec_compression)
+{
+	uint8_t block[TEST_BLOCK_SIZE], compressed[TEST_BLOCK_SIZE];
+
+	/* An empty block compresses to (almost) nothing */
+	fill_block(block, 0.0);
+	ck_assert_int_le(block_codec_compress(BLOCK_CODEC_RLE, byte_slice_from_array(block), byte_slice_from_array(compressed)), 2);
+	ck_assert_int_eq(block_codec_compress(BLOCK_CODEC_SPARSE, byte_slice_from_array(block), byte_slice_from_array(compressed)), 0);
+
+	/* A sparse block compresses well */
+	fill_block(block, 0.01);
+	ck_assert_int_lt(block_codec_compress(BLOCK_CODEC_SPARSE, byte_slice_from_array(block), byte_slice_from_array(compressed)), TEST_BLOCK_SIZE / 4);
+
+	/* Compression fails when the result doesn't fit */
+	fill_block(block, 0.5);
+	ck_assert_int_eq(block_codec_compress(BLOCK_CODEC_SPARSE, byte_slice_from_array(block), byte_slice(compressed, TEST_BLOCK_SIZE - 1)), -1);
+	ck_assert_int_eq(block_codec_compress(BLOCK_CODEC_RLE, byte_slice_from_array(block), byte_slice(compressed, TEST_BLOCK_SIZE - 1)), -1);
+	ck_assert_int_eq(block_codec_compress(BLOCK_CODEC_RAW, byte_slice_from_array(block), byte_slice(compressed, TEST_BLOCK_SIZE - 1)), -1);
+}
+END_TEST
+
+START_TEST(test_block_codec_corrupt)
+{
+	uint8_t block[TEST_BLOCK_SIZE];
+
+	/* Zero run beyond the end of the block */
+	uint8_t rle_too_long[] = { 0x82, 0x80, 0x01 };
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_RLE, byte_slice_from_array(rle_too_long), byte_slice_from_array(block)), -1);
+
+	/* Literal run beyond the end of the compressed data */
+	uint8_t rle_truncated[] = { 0x07, 0x01 };
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_RLE, byte_slice_from_array(rle_truncated), byte_slice_from_array(block)), -1);
+
+	/* Too little data */
+	uint8_t rle_too_short[] = { 0x02 };
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_RLE, byte_slice_from_array(rle_too_short), byte_slice_from_array(block)), -1);
+
+	/* Bit offset beyond the end of the block */
+	uint8_t sparse_too_far[] = { 0x80, 0x80, 0x02 };
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_SPARSE, byte_slice_from_array(sparse_too_far), byte_slice_from_array(block)), -1);
+
+	/* Unterminated variable length integer */
+	uint8_t sparse_truncated[] = { 0x80 };
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_SPARSE, byte_slice_from_array(sparse_truncated), byte_slice_from_array(block)), -1);
+
+	/* Index entry beyond the end of the compressed data */
+	uint8_t isparse_bad_index[TEST_BLOCK_SIZE / 512 * 4] = { 0 };
+	isparse_bad_index[4] = 0x01;
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_SPARSE_INDEXED, byte_slice_from_array(isparse_bad_index), byte_slice_from_array(block)), -1);
+	ck_assert_int_eq(block_codec_bit_is_set(BLOCK_CODEC_SPARSE_INDEXED, byte_slice_from_array(isparse_bad_index), TEST_BLOCK_SIZE, 0), -1);
+
+	/* Index that doesn't fit */
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_SPARSE_INDEXED, byte_slice_from_array(sparse_truncated), byte_slice_from_array(block)), -1);
+
+	/* Unknown codec */
+	ck_assert_int_eq(block_codec_decompress(BLOCK_CODEC_MAX, byte_slice_from_array(sparse_truncated), byte_slice_from_array(block)), -1);
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_block_codec_names);
+	tcase_add_test(tc_core, test_block_codec_roundtrip);
+	tcase_add_test(tc_core, test_block_codec_probing);
+	tcase_add_test(tc_core, test_block_codec_compression);
+	tcase_add_test(tc_core, test_block_codec_corrupt);
+
+	Suite* s = suite_create("Block codec");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
@@ -254,6 +254,42 @@ START_TEST(test_filter_fill_random)
 }
 END_TEST
 
+START_TEST(test_filter_fold)
+{
+	uint8_t filter_data[1024] = { 0 };
+	uint8_t folded_data[128] = { 0 };
+	byte_slice_t filter = byte_slice_from_array(filter_data);
+	byte_slice_t folded = byte_slice_from_array(folded_data);
+
+	/* These values were picked from /dev/urandom */
+	uint32_t values[5] = { 0x8cccc388, 0x30213665, 0xac26c221, 0xe3a71a13, 0xd0bc3118 };
+	for (size_t i = 0; i < 5; i++)
+		bloom_set_single(filter, values[i], 3);
+
+	/* Folding the filter 3 times should keep all values present */
+	bloom_fold(folded, filter);
+	for (size_t i = 0; i < 5; i++) {
+		ck_assert(bloom_is_set_folded(folded, byte_slice_from_scalar(values[i]), 3, 3));
+		ck_assert(!bloom_is_set_folded(folded, byte_slice_from_scalar(values[i]), 3, 0));
+	}
+	ck_assert_uint_le(bloom_nr_bits_set(folded), bloom_nr_bits_set(filter));
+
+	/* Setting values directly in a folded filter should yield the same result as folding afterwards */
+	uint8_t direct_data[128] = { 0 };
+	byte_slice_t direct = byte_slice_from_array(direct_data);
+	for (size_t i = 0; i < 5; i++)
+		bloom_set_folded(direct, byte_slice_from_scalar(values[i]), 3, 3);
+	ck_assert_int_eq(memcmp(direct_data, folded_data, sizeof(folded_data)), 0);
+
+	/* A fold factor of 0 should behave just like the regular bloom filter functions */
+	size_t bit_offsets[3];
+	bloom_determine_folded_offsets(bit_offsets, 3, 1024, 0, byte_slice_from_scalar(values[0]));
+	size_t ref_offsets[3];
+	bloom_determine_offsets_single(ref_offsets, 3, 1024, values[0]);
+	ck_assert_size_t_array_eq(3, bit_offsets, ref_offsets[0], ref_offsets[1], ref_offsets[2]);
+}
+END_TEST
+
 START_TEST(test_count_approximations)
 {
 	ck_assert_uint_eq(bloom_approx_count(1, 1, 0), 0);
@@ -307,6 +343,7 @@ Suite* make_suite(void)
 	tcase_add_test(tc_core, test_filter_basics_with_overlap);
 	tcase_add_test(tc_core, test_filter_fill);
 	tcase_add_test(tc_core, test_filter_fill_random);
+	tcase_add_test(tc_core, test_filter_fold);
 	tcase_add_test(tc_core, test_count_approximations);
 
 	Suite* s = suite_create("Bloom");
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_handover.h"
+
+#include <check.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+static int sv[2];
+
+static void setup(void)
+{
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv), 0);
+}
+
+static void teardown(void)
+{
+	close(sv[0]);
+	if (sv[1] != -1)
+		close(sv[1]);
+}
+
+/* Check that both file descriptors refer to the same file */
+static void check_same_file(int fd, int other_fd)
+{
+	struct stat fd_stat, other_fd_stat;
+	ck_assert_int_eq(fstat(fd, &fd_stat), 0);
+	ck_assert_int_eq(fstat(other_fd, &other_fd_stat), 0);
+	ck_assert_uint_eq(fd_stat.st_dev, other_fd_stat.st_dev);
+	ck_assert_uint_eq(fd_stat.st_ino, other_fd_stat.st_ino);
+	ck_assert_int_eq(fcntl(other_fd, F_GETFD), FD_CLOEXEC);
+}
+
+START_TEST(test_gather_handover)
+{
+	setup();
+	int listener_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	ck_assert_int_ne(listener_fd, -1);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX }; // autobind to an abstract address
+	ck_assert_int_eq(bind(listener_fd, (struct sockaddr*)&addr, sizeof(sa_family_t)), 0);
+	ck_assert_int_eq(listen(listener_fd, 1), 0);
+	int state_fd = memfd_create("test-state", MFD_CLOEXEC);
+	ck_assert_int_ne(state_fd, -1);
+
+	// All file descriptors are received, after which the handover is acknowledged.
+	int listener_fds[2] = { listener_fd, state_fd };
+	int received_listener_fds[GATHER_LISTENER_MAX_ENDPOINTS], received_state_fd = -1;
+	size_t nr_received_listener_fds = 0;
+	ck_assert_int_eq(gather_handover_send(sv[0], listener_fds, 2, state_fd), 0);
+	ck_assert_int_eq(gather_handover_receive(sv[1], received_listener_fds, &nr_received_listener_fds, &received_state_fd), 0);
+	ck_assert_uint_eq(nr_received_listener_fds, 2);
+	check_same_file(listener_fd, received_listener_fds[0]);
+	check_same_file(state_fd, received_listener_fds[1]);
+	check_same_file(state_fd, received_state_fd);
+	ck_assert_int_eq(gather_handover_wait(sv[0], 0), -1);
+	ck_assert_int_eq(errno, ETIMEDOUT);
+	ck_assert_int_eq(gather_handover_acknowledge(sv[1]), 0);
+	ck_assert_int_eq(gather_handover_wait(sv[0], 1000), 0);
+
+	// Other messages are refused.
+	const char message[] = "HONASHND";
+	ck_assert_int_eq(send(sv[0], message, sizeof(message), 0), sizeof(message));
+	ck_assert_int_eq(gather_handover_receive(sv[1], received_listener_fds, &nr_received_listener_fds, &received_state_fd), -1);
+	ck_assert_int_eq(errno, EPROTO);
+
+	// A handover isn't acknowledged when the new process goes away.
+	close(sv[1]);
+	sv[1] = -1;
+	ck_assert_int_eq(gather_handover_wait(sv[0], 1000), -1);
+	ck_assert_int_eq(errno, ECONNRESET);
+
+	close(listener_fd);
+	close(state_fd);
+	close(received_listener_fds[0]);
+	close(received_listener_fds[1]);
+	close(received_state_fd);
+	teardown();
+}
+END_TEST
+
+START_TEST(test_gather_handover_spawn)
+{
+	setup();
+
+	// The new process gets the handover socket through the environment.
+	char* const argv[] = { "sh", "-c", "printf A >&$" GATHER_HANDOVER_SOCKET_ENV, NULL };
+	int dirfd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	ck_assert_int_ne(dirfd, -1);
+	int sock = -1;
+	pid_t pid = gather_handover_spawn("/bin/sh", argv, dirfd, &sock);
+	ck_assert_int_gt(pid, 0);
+	ck_assert_int_ne(sock, -1);
+	ck_assert_int_eq(gather_handover_wait(sock, 10000), 0);
+	int status;
+	ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+	ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	close(sock);
+
+	// The handover socket is picked up from the environment only once.
+	char value[16];
+	snprintf(value, sizeof(value), "%d", sv[1]);
+	ck_assert_int_eq(setenv(GATHER_HANDOVER_SOCKET_ENV, value, 1), 0);
+	ck_assert_int_eq(gather_handover_socket(), sv[1]);
+	ck_assert_ptr_eq(getenv(GATHER_HANDOVER_SOCKET_ENV), NULL);
+	ck_assert_int_eq(gather_handover_socket(), -1);
+
+	close(dirfd);
+	teardown();
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_gather_handover);
+	tcase_add_test(tc_core, test_gather_handover_spawn);
+
+	Suite* s = suite_create("Gather handover");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_listener.h"
+
+#include <check.h>
+#include <poll.h>
+#include <sys/un.h>
+
+#define TEST_NUMBER_OF_CONNECTIONS 32
+
+START_TEST(test_gather_listener_parse)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	// Absolute paths are unix sockets, anything else is an address and port.
+	ck_assert_int_eq(gather_listener_parse("/var/spool/honas/honas.sock", &addr, &addr_len), 0);
+	ck_assert_int_eq(addr.ss_family, AF_UNIX);
+	ck_assert_str_eq(((struct sockaddr_un*)&addr)->sun_path, "/var/spool/honas/honas.sock");
+	ck_assert_int_eq(gather_listener_parse("127.0.0.1:6000", &addr, &addr_len), 0);
+	ck_assert_int_eq(addr.ss_family, AF_INET);
+	ck_assert_uint_eq(addr_len, sizeof(struct sockaddr_in));
+	ck_assert_uint_eq(ntohs(((struct sockaddr_in*)&addr)->sin_port), 6000);
+	ck_assert_uint_eq(ntohl(((struct sockaddr_in*)&addr)->sin_addr.s_addr), INADDR_LOOPBACK);
+	ck_assert_int_eq(gather_listener_parse("*:6000", &addr, &addr_len), 0);
+	ck_assert_uint_eq(((struct sockaddr_in*)&addr)->sin_addr.s_addr, INADDR_ANY);
+	ck_assert_int_eq(gather_listener_parse("[::1]:6001", &addr, &addr_len), 0);
+	ck_assert_int_eq(addr.ss_family, AF_INET6);
+	ck_assert_uint_eq(addr_len, sizeof(struct sockaddr_in6));
+	ck_assert_uint_eq(ntohs(((struct sockaddr_in6*)&addr)->sin6_port), 6001);
+	ck_assert(IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6*)&addr)->sin6_addr));
+
+	// TCP endpoints need a port, unix sockets an absolute path that fits.
+	char long_path[sizeof(((struct sockaddr_un*)&addr)->sun_path) + 1];
+	memset(long_path, 'a', sizeof(long_path) - 1);
+	long_path[0] = '/';
+	long_path[sizeof(long_path) - 1] = '\0';
+	ck_assert_int_eq(gather_listener_parse("127.0.0.1", &addr, &addr_len), -1);
+	ck_assert_int_eq(gather_listener_parse("[::1]", &addr, &addr_len), -1);
+	ck_assert_int_eq(gather_listener_parse("localhost:6000", &addr, &addr_len), -1);
+	ck_assert_int_eq(gather_listener_parse("127.0.0.1:65536", &addr, &addr_len), -1);
+	ck_assert_int_eq(gather_listener_parse("honas.sock", &addr, &addr_len), -1);
+	ck_assert_int_eq(gather_listener_parse(long_path, &addr, &addr_len), -1);
+
+	// Lists of endpoints.
+	ck_assert(gather_listener_endpoints_are_valid("/var/spool/honas/honas.sock"));
+	ck_assert(gather_listener_endpoints_are_valid("/var/spool/honas/honas.sock  127.0.0.1:6000\t[::]:6000"));
+	ck_assert(!gather_listener_endpoints_are_valid(""));
+	ck_assert(!gather_listener_endpoints_are_valid("/var/spool/honas/honas.sock 127.0.0.1"));
+	char endpoints[(GATHER_LISTENER_MAX_ENDPOINTS + 1) * 8] = "";
+	for (int i = 0; i < GATHER_LISTENER_MAX_ENDPOINTS; i++)
+		strcat(endpoints, "*:6000 ");
+	ck_assert(gather_listener_endpoints_are_valid(endpoints));
+	strcat(endpoints, "*:6000");
+	ck_assert(!gather_listener_endpoints_are_valid(endpoints));
+}
+END_TEST
+
+START_TEST(test_gather_listener_reuseport)
+{
+	// Open a listener on a free loopback port and a second one on the same port.
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	int listener_fds[2];
+	listener_fds[0] = gather_listener_open((struct sockaddr*)&addr, sizeof(addr), 64);
+	ck_assert_int_ne(listener_fds[0], -1);
+	socklen_t addr_len = sizeof(addr);
+	ck_assert_int_eq(getsockname(listener_fds[0], (struct sockaddr*)&addr, &addr_len), 0);
+	listener_fds[1] = gather_listener_open((struct sockaddr*)&addr, sizeof(addr), 64);
+	ck_assert_int_ne(listener_fds[1], -1);
+	char name[64];
+	char expected_name[64];
+	snprintf(expected_name, sizeof(expected_name), "127.0.0.1:%u", ntohs(addr.sin_port));
+	ck_assert_str_eq(gather_listener_name(listener_fds[1], name, sizeof(name)), expected_name);
+
+	// Connections over loopback are accepted by either listener.
+	int client_fds[TEST_NUMBER_OF_CONNECTIONS];
+	for (int i = 0; i < TEST_NUMBER_OF_CONNECTIONS; i++) {
+		client_fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		ck_assert_int_ne(client_fds[i], -1);
+		ck_assert_int_eq(connect(client_fds[i], (struct sockaddr*)&addr, sizeof(addr)), 0);
+	}
+	int nr_accepted = 0;
+	while (nr_accepted < TEST_NUMBER_OF_CONNECTIONS) {
+		struct pollfd pfds[2] = { { .fd = listener_fds[0], .events = POLLIN }, { .fd = listener_fds[1], .events = POLLIN } };
+		ck_assert_int_gt(poll(pfds, 2, 1000), 0);
+		for (int i = 0; i < 2; i++) {
+			int fd;
+			while ((fd = accept4(listener_fds[i], NULL, NULL, SOCK_CLOEXEC)) != -1) {
+				close(fd);
+				nr_accepted++;
+			}
+			ck_assert_int_eq(errno, EAGAIN);
+		}
+	}
+	ck_assert_int_eq(nr_accepted, TEST_NUMBER_OF_CONNECTIONS);
+
+	for (int i = 0; i < TEST_NUMBER_OF_CONNECTIONS; i++)
+		close(client_fds[i]);
+	close(listener_fds[0]);
+	close(listener_fds[1]);
+}
+END_TEST
+
+START_TEST(test_gather_listener_unix)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char path[] = "/tmp/test_gather_listener.XXXXXX";
+	int file_fd = mkstemp(path);
+	ck_assert_int_ne(file_fd, -1);
+	close(file_fd);
+	ck_assert_int_eq(gather_listener_parse(path, &addr, &addr_len), 0);
+
+	// Other files are never replaced by a unix socket.
+	ck_assert_int_eq(gather_listener_open((struct sockaddr*)&addr, addr_len, 1), -1);
+	ck_assert_int_eq(errno, EADDRINUSE);
+	unlink(path);
+
+	// Stale unix sockets are replaced, and the socket file is removed afterwards.
+	int stale_fd = gather_listener_open((struct sockaddr*)&addr, addr_len, 1);
+	ck_assert_int_ne(stale_fd, -1);
+	close(stale_fd);
+	int fd = gather_listener_open((struct sockaddr*)&addr, addr_len, 1);
+	ck_assert_int_ne(fd, -1);
+	char name[sizeof(path)];
+	ck_assert_str_eq(gather_listener_name(fd, name, sizeof(name)), path);
+	gather_listener_unlink(fd);
+	ck_assert_int_eq(access(path, F_OK), -1);
+	close(fd);
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_gather_listener_parse);
+	tcase_add_test(tc_core, test_gather_listener_reuseport);
+	tcase_add_test(tc_core, test_gather_listener_unix);
+
+	Suite* s = suite_create("Gather listener");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
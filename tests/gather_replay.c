@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_replay.h"
+#include "gather_session.h"
+
+#include <check.h>
+#include <fstrm.h>
+#include <ldns/ldns.h>
+
+#define TEST_CONTROL_FIELD_CONTENT_TYPE 1
+#define TEST_PERIOD_LENGTH 3600
+#define TEST_PERIOD_BEGIN (472222 * TEST_PERIOD_LENGTH)
+#define TEST_MAX_PERIODS 4
+
+/* The data frames read from a capture file */
+struct test_frames {
+	size_t nr_frames;
+	size_t length;
+	uint8_t data[256];
+	size_t max_frames;
+};
+
+static int test_process_frame(void* arg, const uint8_t* data, size_t length)
+{
+	struct test_frames* frames = arg;
+	if (frames->nr_frames == frames->max_frames) {
+		errno = EINTR;
+		return -1;
+	}
+	ck_assert_uint_le(frames->length + length, sizeof(frames->data));
+	memcpy(frames->data + frames->length, data, length);
+	frames->length += length;
+	frames->nr_frames++;
+	return 0;
+}
+
+/* Appends a big endian 32-bit value */
+static size_t test_put32(uint8_t* buffer, size_t offset, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(buffer + offset, &value, sizeof(value));
+	return offset + sizeof(value);
+}
+
+/* Appends a control frame, optionally with a content type */
+static size_t test_control_frame(uint8_t* buffer, size_t offset, uint32_t type, const char* content_type)
+{
+	size_t len = test_put32(buffer, offset, 0);
+	len = test_put32(buffer, len, 0);
+	len = test_put32(buffer, len, type);
+	if (content_type != NULL) {
+		len = test_put32(buffer, len, TEST_CONTROL_FIELD_CONTENT_TYPE);
+		len = test_put32(buffer, len, strlen(content_type));
+		memcpy(buffer + len, content_type, strlen(content_type));
+		len += strlen(content_type);
+	}
+	test_put32(buffer, offset + sizeof(uint32_t), len - offset - 2 * sizeof(uint32_t));
+	return len;
+}
+
+/* Appends a data frame */
+static size_t test_data_frame(uint8_t* buffer, size_t offset, const char* payload)
+{
+	size_t len = test_put32(buffer, offset, strlen(payload));
+	memcpy(buffer + len, payload, strlen(payload));
+	return len + strlen(payload);
+}
+
+/* Reads a capture file, returning the result of gather_replay_dnstap() */
+static int test_read(const uint8_t* data, size_t size, struct test_frames* frames)
+{
+	memset(frames, 0, sizeof(*frames));
+	frames->max_frames = SIZE_MAX;
+	size_t nr_frames = SIZE_MAX;
+	int result = gather_replay_dnstap(data, size, test_process_frame, frames, &nr_frames);
+	ck_assert_uint_eq(nr_frames, frames->nr_frames);
+	return result;
+}
+
+START_TEST(test_gather_replay_dnstap)
+{
+	uint8_t data[1024];
+	struct test_frames frames;
+	size_t size = test_control_frame(data, 0, FSTRM_CONTROL_START, GATHER_SESSION_CONTENT_TYPE);
+	size = test_data_frame(data, size, "first");
+	const size_t second_offset = size;
+	size = test_data_frame(data, size, "second");
+	const size_t stop_offset = size;
+	size = test_control_frame(data, size, FSTRM_CONTROL_STOP, NULL);
+
+	// A complete capture file ends with the stop frame, anything after it is ignored.
+	ck_assert_int_eq(test_read(data, size, &frames), 0);
+	ck_assert_uint_eq(frames.nr_frames, 2);
+	ck_assert_uint_eq(frames.length, strlen("firstsecond"));
+	ck_assert_int_eq(memcmp(frames.data, "firstsecond", frames.length), 0);
+	const size_t trailing_size = test_data_frame(data, size, "trailing");
+	ck_assert_int_eq(test_read(data, trailing_size, &frames), 0);
+	ck_assert_uint_eq(frames.nr_frames, 2);
+
+	// A truncated capture file is read up to the last complete frame.
+	ck_assert_int_eq(test_read(data, stop_offset, &frames), 1);
+	ck_assert_uint_eq(frames.nr_frames, 2);
+	ck_assert_int_eq(test_read(data, size - 1, &frames), 1);
+	ck_assert_uint_eq(frames.nr_frames, 2);
+	ck_assert_int_eq(test_read(data, stop_offset + sizeof(uint32_t) + 2, &frames), 1);
+	ck_assert_uint_eq(frames.nr_frames, 2);
+	ck_assert_int_eq(test_read(data, second_offset + sizeof(uint32_t) + 2, &frames), 1);
+	ck_assert_uint_eq(frames.nr_frames, 1);
+	ck_assert_int_eq(test_read(data, second_offset + 2, &frames), 1);
+	ck_assert_uint_eq(frames.nr_frames, 1);
+	ck_assert_int_eq(test_read(data, 0, &frames), 1);
+	ck_assert_uint_eq(frames.nr_frames, 0);
+
+	// Reading can be interrupted.
+	memset(&frames, 0, sizeof(frames));
+	frames.max_frames = 1;
+	size_t nr_frames = 0;
+	ck_assert_int_eq(gather_replay_dnstap(data, size, test_process_frame, &frames, &nr_frames), -1);
+	ck_assert_int_eq(errno, EINTR);
+	ck_assert_uint_eq(nr_frames, 1);
+}
+END_TEST
+
+START_TEST(test_gather_replay_dnstap_invalid)
+{
+	uint8_t data[1024];
+	struct test_frames frames;
+
+	// Data frames are only valid after the start frame.
+	size_t size = test_data_frame(data, 0, "first");
+	size = test_control_frame(data, size, FSTRM_CONTROL_STOP, NULL);
+	ck_assert_int_eq(test_read(data, size, &frames), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_uint_eq(frames.nr_frames, 0);
+
+	// The capture file should contain dnstap data.
+	size = test_control_frame(data, 0, FSTRM_CONTROL_START, "protobuf:other.Other");
+	size = test_data_frame(data, size, "first");
+	ck_assert_int_eq(test_read(data, size, &frames), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_uint_eq(frames.nr_frames, 0);
+
+	// Control frames should be valid and no longer than the maximum.
+	size = test_control_frame(data, 0, FSTRM_CONTROL_START, GATHER_SESSION_CONTENT_TYPE);
+	size = test_data_frame(data, size, "first");
+	const size_t control_offset = size;
+	size = test_control_frame(data, size, FSTRM_CONTROL_STOP, NULL);
+	test_put32(data, control_offset + 2 * sizeof(uint32_t), 0);
+	ck_assert_int_eq(test_read(data, size, &frames), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_uint_eq(frames.nr_frames, 1);
+	test_put32(data, control_offset + sizeof(uint32_t), FSTRM_CONTROL_FRAME_LENGTH_MAX + 1);
+	ck_assert_int_eq(test_read(data, size, &frames), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+}
+END_TEST
+
+/* The periods of a replay, saved as state files in the current directory */
+struct test_periods {
+	size_t nr_periods;
+	uint64_t period_begin[TEST_MAX_PERIODS];
+	char file_name[TEST_MAX_PERIODS][32];
+};
+
+static void test_begin_period(void* arg, honas_state_t* state, uint64_t period_begin)
+{
+	struct test_periods* periods = arg;
+	ck_assert_uint_lt(periods->nr_periods, TEST_MAX_PERIODS);
+	ck_assert_ptr_eq(state->header, NULL);
+	ck_assert_int_eq(honas_state_create(state, 2, 1024 * 1024, 10, 1, 1), 0);
+	state->header->period_begin = period_begin;
+	state->header->period_end = period_begin - (period_begin % TEST_PERIOD_LENGTH) + TEST_PERIOD_LENGTH;
+	periods->period_begin[periods->nr_periods++] = period_begin;
+}
+
+static void test_end_period(void* arg, honas_state_t* state)
+{
+	struct test_periods* periods = arg;
+	char* file_name = periods->file_name[periods->nr_periods - 1];
+	snprintf(file_name, sizeof(periods->file_name[0]), "test_replay_%" PRIu64 ".hs", state->header->period_end);
+	unlink(file_name);
+	honas_state_persist(state, file_name, true);
+	honas_state_destroy(state);
+}
+
+/* Replays a lookup of a host name at the given time */
+static void test_replay_lookup(struct gather_replay* replay, uint64_t timestamp, const char* host_name)
+{
+	struct in_addr46 client = { .af = AF_INET };
+	const uint32_t addr = htonl(0x0a000001);
+	memcpy(&client.in.addr4, &addr, sizeof(addr));
+	if (gather_replay_advance(replay, timestamp))
+		honas_state_register_host_name_lookup(replay->state, replay->time, &client, (const uint8_t*)host_name, strlen(host_name), NULL, 0, NULL, LDNS_RR_TYPE_A);
+}
+
+/* Checks the state file saved for a period */
+static void test_check_period(struct test_periods* periods, size_t period, uint64_t period_begin, uint64_t first_request, uint64_t last_request, uint64_t number_of_requests)
+{
+	honas_state_t state = { 0 };
+	ck_assert_uint_eq(periods->period_begin[period], period_begin);
+	ck_assert_int_eq(honas_state_load(&state, periods->file_name[period], true), 0);
+	ck_assert_uint_eq(state.header->period_begin, period_begin);
+	ck_assert_uint_eq(state.header->period_end, period_begin - (period_begin % TEST_PERIOD_LENGTH) + TEST_PERIOD_LENGTH);
+	ck_assert_uint_eq(state.header->first_request, first_request);
+	ck_assert_uint_eq(state.header->last_request, last_request);
+	ck_assert_uint_eq(state.header->number_of_requests, number_of_requests);
+	honas_state_destroy(&state);
+	unlink(periods->file_name[period]);
+}
+
+START_TEST(test_gather_replay_periods)
+{
+	honas_state_t state = { 0 };
+	struct test_periods periods = { 0 };
+	struct gather_replay replay;
+	gather_replay_init(&replay, &state, test_begin_period, test_end_period, &periods);
+
+	// Lookups without a time are skipped until the time is known, after which they're
+	// registered at the time of the lookup before them.
+	ck_assert(!gather_replay_advance(&replay, 0));
+	ck_assert_uint_eq(periods.nr_periods, 0);
+	test_replay_lookup(&replay, TEST_PERIOD_BEGIN + 10, "surfnet.nl");
+	test_replay_lookup(&replay, 0, "surfnet.nl");
+	test_replay_lookup(&replay, TEST_PERIOD_BEGIN + 20, "example.com");
+	ck_assert_uint_eq(periods.nr_periods, 1);
+	ck_assert_uint_eq(replay.nr_periods, 1);
+
+	// Lookups are routed by their time to the period they were made in. Lookups from
+	// before the current period (out of order) are registered in the current period.
+	test_replay_lookup(&replay, TEST_PERIOD_BEGIN + TEST_PERIOD_LENGTH + 5, "surfnet.nl");
+	ck_assert_uint_eq(periods.nr_periods, 2);
+	test_replay_lookup(&replay, TEST_PERIOD_BEGIN + 30, "example.com");
+	test_replay_lookup(&replay, 0, "example.com");
+	ck_assert_uint_eq(periods.nr_periods, 2);
+
+	// Periods without lookups are skipped, there's no state file for them.
+	test_replay_lookup(&replay, TEST_PERIOD_BEGIN + 3 * TEST_PERIOD_LENGTH + 1, "surfnet.nl");
+	ck_assert_uint_eq(periods.nr_periods, 3);
+	ck_assert_uint_eq(replay.nr_periods, 3);
+
+	// Finishing the replay saves the state of the last (partial) period as well.
+	gather_replay_finish(&replay);
+	ck_assert_ptr_eq(state.header, NULL);
+	ck_assert_uint_eq(periods.nr_periods, 3);
+	test_check_period(&periods, 0, TEST_PERIOD_BEGIN + 10, TEST_PERIOD_BEGIN + 10, TEST_PERIOD_BEGIN + 20, 3);
+	test_check_period(&periods, 1, TEST_PERIOD_BEGIN + TEST_PERIOD_LENGTH + 5, TEST_PERIOD_BEGIN + TEST_PERIOD_LENGTH + 5, TEST_PERIOD_BEGIN + TEST_PERIOD_LENGTH + 5, 3);
+	test_check_period(&periods, 2, TEST_PERIOD_BEGIN + 3 * TEST_PERIOD_LENGTH + 1, TEST_PERIOD_BEGIN + 3 * TEST_PERIOD_LENGTH + 1, TEST_PERIOD_BEGIN + 3 * TEST_PERIOD_LENGTH + 1, 1);
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_gather_replay_dnstap);
+	tcase_add_test(tc_core, test_gather_replay_dnstap_invalid);
+	tcase_add_test(tc_core, test_gather_replay_periods);
+
+	Suite* s = suite_create("Gather replay");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
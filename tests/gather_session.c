@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather_listener.h"
+#include "gather_session.h"
+
+#include <check.h>
+#include <event2/buffer.h>
+#include <fstrm.h>
+#include <poll.h>
+
+#define TEST_CONTROL_FIELD_CONTENT_TYPE 1
+#define TEST_TIMEOUT 1000
+
+/* The data frames passed on by a session */
+struct test_frames {
+	size_t nr_frames;
+	size_t length;
+	uint8_t data[256];
+};
+
+static void test_process_frame(void* arg, const uint8_t* data, size_t length)
+{
+	struct test_frames* frames = arg;
+	ck_assert_uint_le(frames->length + length, sizeof(frames->data));
+	memcpy(frames->data + frames->length, data, length);
+	frames->length += length;
+	frames->nr_frames++;
+}
+
+/* Appends a big endian 32-bit value */
+static size_t test_put32(uint8_t* buffer, size_t offset, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(buffer + offset, &value, sizeof(value));
+	return offset + sizeof(value);
+}
+
+/* Writes a control frame as a Frame Streams sender (or receiver) would: the
+ * escape sequence, the length, the control type and optionally a content type */
+static size_t test_control_frame(uint8_t* frame, uint32_t type, const char* content_type)
+{
+	size_t len = test_put32(frame, 0, 0);
+	len = test_put32(frame, len, 0);
+	len = test_put32(frame, len, type);
+	if (content_type != NULL) {
+		len = test_put32(frame, len, TEST_CONTROL_FIELD_CONTENT_TYPE);
+		len = test_put32(frame, len, strlen(content_type));
+		memcpy(frame + len, content_type, strlen(content_type));
+		len += strlen(content_type);
+	}
+	test_put32(frame, sizeof(uint32_t), len - 2 * sizeof(uint32_t));
+	return len;
+}
+
+/* Writes a data frame: the length followed by the payload */
+static size_t test_data_frame(uint8_t* frame, const char* payload)
+{
+	size_t len = test_put32(frame, 0, strlen(payload));
+	memcpy(frame + len, payload, strlen(payload));
+	return len + strlen(payload);
+}
+
+/* Connects a client to a listener on a free loopback port, returning the accepted connection */
+static int test_connect(int* client_fd)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	int listener_fd = gather_listener_open((struct sockaddr*)&addr, sizeof(addr), 1);
+	ck_assert_int_ne(listener_fd, -1);
+	socklen_t addr_len = sizeof(addr);
+	ck_assert_int_eq(getsockname(listener_fd, (struct sockaddr*)&addr, &addr_len), 0);
+
+	*client_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	ck_assert_int_ne(*client_fd, -1);
+	ck_assert_int_eq(connect(*client_fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+	struct pollfd pfd = { .fd = listener_fd, .events = POLLIN };
+	ck_assert_int_eq(poll(&pfd, 1, TEST_TIMEOUT), 1);
+	int fd = accept4(listener_fd, NULL, NULL, SOCK_CLOEXEC);
+	ck_assert_int_ne(fd, -1);
+	close(listener_fd);
+	return fd;
+}
+
+/* Sends data from the client, and has the session process it once all of it has been read */
+static int test_send(struct gather_session* session, int client_fd, int fd, struct evbuffer* input, struct evbuffer* output, const uint8_t* data, size_t len)
+{
+	ck_assert_int_eq(send(client_fd, data, len, 0), len);
+	const size_t expected = evbuffer_get_length(input) + len;
+	while (evbuffer_get_length(input) < expected) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		ck_assert_int_eq(poll(&pfd, 1, TEST_TIMEOUT), 1);
+		ck_assert_int_gt(evbuffer_read(input, fd, -1), 0);
+	}
+	return gather_session_process(session, input, output);
+}
+
+/* Writes the output of the session and checks what the client receives */
+static void test_receive(int client_fd, int fd, struct evbuffer* output, const uint8_t* expected, size_t len)
+{
+	while (evbuffer_get_length(output) > 0)
+		ck_assert_int_gt(evbuffer_write(output, fd), 0);
+
+	uint8_t reply[FSTRM_CONTROL_FRAME_LENGTH_MAX];
+	size_t received = 0;
+	while (received < len) {
+		struct pollfd pfd = { .fd = client_fd, .events = POLLIN };
+		ck_assert_int_eq(poll(&pfd, 1, TEST_TIMEOUT), 1);
+		ssize_t n = recv(client_fd, reply + received, sizeof(reply) - received, 0);
+		ck_assert_int_gt(n, 0);
+		received += n;
+	}
+	ck_assert_uint_eq(received, len);
+	ck_assert_int_eq(memcmp(reply, expected, len), 0);
+}
+
+START_TEST(test_gather_session_handshake)
+{
+	int client_fd;
+	int fd = test_connect(&client_fd);
+	struct evbuffer* input = evbuffer_new();
+	struct evbuffer* output = evbuffer_new();
+	struct test_frames frames = { 0 };
+	struct gather_session session;
+	ck_assert_int_eq(gather_session_init(&session, test_process_frame, &frames), 0);
+	uint8_t frame[FSTRM_CONTROL_FRAME_LENGTH_MAX];
+	uint8_t expected[FSTRM_CONTROL_FRAME_LENGTH_MAX];
+	size_t len;
+
+	// A sender that's ready to send dnstap data is accepted.
+	len = test_control_frame(frame, FSTRM_CONTROL_READY, GATHER_SESSION_CONTENT_TYPE);
+	ck_assert_int_eq(test_send(&session, client_fd, fd, input, output, frame, len), 0);
+	ck_assert_int_eq(session.state, GATHER_SESSION_READING_CONTROL_START);
+	len = test_control_frame(expected, FSTRM_CONTROL_ACCEPT, GATHER_SESSION_CONTENT_TYPE);
+	test_receive(client_fd, fd, output, expected, len);
+
+	// The start frame isn't answered, the data frames that follow are passed on as they arrive.
+	len = test_control_frame(frame, FSTRM_CONTROL_START, GATHER_SESSION_CONTENT_TYPE);
+	len += test_data_frame(frame + len, "first");
+	ck_assert_int_eq(test_send(&session, client_fd, fd, input, output, frame, len), 0);
+	ck_assert_int_eq(session.state, GATHER_SESSION_READING_DATA);
+	ck_assert_uint_eq(evbuffer_get_length(output), 0);
+	ck_assert_uint_eq(frames.nr_frames, 1);
+	len = test_data_frame(frame, "second");
+	ck_assert_int_eq(test_send(&session, client_fd, fd, input, output, frame, 3), 0);
+	ck_assert_uint_eq(frames.nr_frames, 1);
+	ck_assert_uint_eq(evbuffer_get_length(input), 3);
+	ck_assert_int_eq(test_send(&session, client_fd, fd, input, output, frame + 3, len - 3), 0);
+	ck_assert_uint_eq(frames.nr_frames, 2);
+	ck_assert_uint_eq(frames.length, strlen("firstsecond"));
+	ck_assert_int_eq(memcmp(frames.data, "firstsecond", frames.length), 0);
+	ck_assert_uint_eq(session.count_read, 2);
+	ck_assert_uint_eq(session.bytes_read, strlen("firstsecond"));
+
+	// The stop frame is answered with a finish frame, which ends the session.
+	len = test_control_frame(frame, FSTRM_CONTROL_STOP, NULL);
+	ck_assert_int_eq(test_send(&session, client_fd, fd, input, output, frame, len), 1);
+	ck_assert_int_eq(session.state, GATHER_SESSION_STOPPED);
+	len = test_control_frame(expected, FSTRM_CONTROL_FINISH, NULL);
+	test_receive(client_fd, fd, output, expected, len);
+	ck_assert_uint_eq(evbuffer_get_length(input), 0);
+
+	gather_session_destroy(&session);
+	evbuffer_free(input);
+	evbuffer_free(output);
+	close(client_fd);
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_gather_session_violation)
+{
+	struct evbuffer* input = evbuffer_new();
+	struct evbuffer* output = evbuffer_new();
+	struct test_frames frames = { 0 };
+	struct gather_session session;
+	uint8_t frame[FSTRM_CONTROL_FRAME_LENGTH_MAX];
+	size_t len;
+
+	// Senders of other content types aren't accepted.
+	ck_assert_int_eq(gather_session_init(&session, test_process_frame, &frames), 0);
+	len = test_control_frame(frame, FSTRM_CONTROL_READY, "protobuf:other.Other");
+	evbuffer_add(input, frame, len);
+	ck_assert_int_eq(gather_session_process(&session, input, output), -1);
+	ck_assert_int_eq(errno, EPROTO);
+	ck_assert_uint_eq(evbuffer_get_length(output), 0);
+	gather_session_destroy(&session);
+	evbuffer_drain(input, evbuffer_get_length(input));
+
+	// The stream has to be started before data is sent.
+	ck_assert_int_eq(gather_session_init(&session, test_process_frame, &frames), 0);
+	len = test_control_frame(frame, FSTRM_CONTROL_START, GATHER_SESSION_CONTENT_TYPE);
+	evbuffer_add(input, frame, len);
+	ck_assert_int_eq(gather_session_process(&session, input, output), -1);
+	ck_assert_int_eq(errno, EPROTO);
+	gather_session_destroy(&session);
+	evbuffer_drain(input, evbuffer_get_length(input));
+
+	ck_assert_int_eq(gather_session_init(&session, test_process_frame, &frames), 0);
+	len = test_control_frame(frame, FSTRM_CONTROL_READY, GATHER_SESSION_CONTENT_TYPE);
+	len += test_data_frame(frame + len, "early");
+	evbuffer_add(input, frame, len);
+	ck_assert_int_eq(gather_session_process(&session, input, output), -1);
+	ck_assert_int_eq(errno, EPROTO);
+	ck_assert_uint_eq(frames.nr_frames, 0);
+	gather_session_destroy(&session);
+	evbuffer_drain(input, evbuffer_get_length(input));
+	evbuffer_drain(output, evbuffer_get_length(output));
+
+	// Control frames have a minimum and maximum length.
+	ck_assert_int_eq(gather_session_init(&session, test_process_frame, &frames), 0);
+	len = test_put32(frame, 0, 0);
+	len = test_put32(frame, len, FSTRM_CONTROL_FRAME_LENGTH_MAX + 1);
+	evbuffer_add(input, frame, len);
+	ck_assert_int_eq(gather_session_process(&session, input, output), -1);
+	ck_assert_int_eq(errno, EPROTO);
+	gather_session_destroy(&session);
+
+	evbuffer_free(input);
+	evbuffer_free(output);
+}
+END_TEST
+
+START_TEST(test_gather_session_oversized_frame)
+{
+	struct evbuffer* input = evbuffer_new();
+	struct evbuffer* output = evbuffer_new();
+	struct test_frames frames = { 0 };
+	struct gather_session session;
+	ck_assert_int_eq(gather_session_init(&session, test_process_frame, &frames), 0);
+	uint8_t frame[FSTRM_CONTROL_FRAME_LENGTH_MAX];
+	size_t len = test_control_frame(frame, FSTRM_CONTROL_READY, GATHER_SESSION_CONTENT_TYPE);
+	len += test_control_frame(frame + len, FSTRM_CONTROL_START, GATHER_SESSION_CONTENT_TYPE);
+	evbuffer_add(input, frame, len);
+	ck_assert_int_eq(gather_session_process(&session, input, output), 0);
+
+	// A data frame that doesn't fit is skipped as it arrives, the frame after it is processed.
+	const size_t len_payload = GATHER_SESSION_MAX_FRAME_SIZE;
+	uint8_t* payload = calloc(1, len_payload);
+	ck_assert_ptr_ne(payload, NULL);
+	len = test_put32(frame, 0, len_payload);
+	evbuffer_add(input, frame, len);
+	evbuffer_add(input, payload, len_payload / 2);
+	ck_assert_int_eq(gather_session_process(&session, input, output), 0);
+	ck_assert_uint_eq(evbuffer_get_length(input), 0);
+	evbuffer_add(input, payload, len_payload / 2);
+	len = test_data_frame(frame, "after");
+	evbuffer_add(input, frame, len);
+	ck_assert_int_eq(gather_session_process(&session, input, output), 0);
+	ck_assert_uint_eq(frames.nr_frames, 1);
+	ck_assert_int_eq(memcmp(frames.data, "after", frames.length), 0);
+	free(payload);
+
+	gather_session_destroy(&session);
+	evbuffer_free(input);
+	evbuffer_free(output);
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_gather_session_handshake);
+	tcase_add_test(tc_core, test_gather_session_violation);
+	tcase_add_test(tc_core, test_gather_session_oversized_frame);
+
+	Suite* s = suite_create("Gather session");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
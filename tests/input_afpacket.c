@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "input_afpacket.h"
+
+#include <check.h>
+#include <linux/if_ether.h>
+#include <poll.h>
+
+#define TEST_NUMBER_OF_QUERIES 64
+#define TEST_MAX_LOOKUPS 256
+#define TEST_SUFFIX "honas-test.example."
+
+static void* input_state;
+static struct honas_input_lookup lookups[TEST_MAX_LOOKUPS];
+
+static void setup(void)
+{
+	ck_assert_int_eq(input_afpacket.init(&input_state), 0);
+}
+
+static void teardown(void)
+{
+	input_afpacket.destroy(input_state);
+}
+
+static int configure(const char* keyword, const char* value)
+{
+	char keyword_buf[64], value_buf[64];
+	strcpy(keyword_buf, keyword);
+	strcpy(value_buf, value);
+	return input_afpacket.parse_config_item("test.conf", input_state, 1, keyword_buf, value_buf, strlen(value_buf));
+}
+
+/* Capturing needs CAP_NET_RAW, without which the capture tests are skipped */
+static bool can_capture(void)
+{
+	int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (fd == -1) {
+		fprintf(stderr, "Skipping capture test: %s\n", strerror(errno));
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+/* Build a DNS message with a single question for `name` (in presentation format) */
+static size_t build_message(uint8_t* message, const char* name, uint16_t qtype, bool response)
+{
+	static const uint8_t header[12] = { 0x12, 0x34, 0x01, 0x00, 0x00, 0x01 };
+	memcpy(message, header, sizeof(header));
+	if (response)
+		message[2] |= 0x80;
+	size_t len = sizeof(header);
+	for (const char* label = name; *label != '\0';) {
+		const char* end = strchr(label, '.');
+		message[len++] = end - label;
+		memcpy(message + len, label, end - label);
+		len += end - label;
+		label = end + 1;
+	}
+	message[len++] = 0;
+	message[len++] = qtype >> 8;
+	message[len++] = qtype & 0xff;
+	message[len++] = 0;
+	message[len++] = 1;
+	return len;
+}
+
+/* Send a DNS message over UDP to a loopback address (from a new source port each time) */
+static bool send_message(int af, uint16_t port, const char* name, uint16_t qtype, bool response)
+{
+	uint8_t message[512];
+	size_t len = build_message(message, name, qtype, response);
+	struct sockaddr_storage addr = { 0 };
+	socklen_t addr_len;
+	if (af == AF_INET) {
+		struct sockaddr_in* sin = (struct sockaddr_in*)&addr;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr_len = sizeof(*sin);
+	} else {
+		struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&addr;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		sin6->sin6_addr = in6addr_loopback;
+		addr_len = sizeof(*sin6);
+	}
+	int fd = socket(af, SOCK_DGRAM, 0);
+	if (fd == -1)
+		return false;
+	bool sent = sendto(fd, message, len, 0, (struct sockaddr*)&addr, addr_len) == (ssize_t)len;
+	close(fd);
+	return sent;
+}
+
+/* Read the test lookups until `expected` of them have been captured, or a second passes without any */
+static size_t read_lookups(size_t expected)
+{
+	size_t nr_lookups = 0;
+	struct pollfd pfd = { .fd = input_afpacket_fd(input_state), .events = POLLIN };
+	while (poll(&pfd, 1, nr_lookups < expected ? 1000 : 100) == 1) {
+		struct honas_input_lookup batch[16];
+		ssize_t result;
+		while ((result = input_afpacket.next_batch(input_state, batch, 16)) > 0) {
+			for (ssize_t i = 0; i < result; i++) {
+				/* Other DNS traffic on the loopback interface is ignored */
+				if (batch[i].host_name_length < strlen(TEST_SUFFIX) ||
+					memcmp(batch[i].host_name + batch[i].host_name_length - strlen(TEST_SUFFIX), TEST_SUFFIX, strlen(TEST_SUFFIX)) != 0)
+					continue;
+				ck_assert_uint_lt(nr_lookups, TEST_MAX_LOOKUPS);
+				lookups[nr_lookups++] = batch[i];
+			}
+		}
+		ck_assert_int_eq(result, -1);
+		ck_assert_int_eq(errno, EAGAIN);
+	}
+	return nr_lookups;
+}
+
+START_TEST(test_input_afpacket_config)
+{
+	setup();
+	ck_assert(!input_afpacket_is_configured(input_state));
+	ck_assert_int_eq(configure("capture_interface", "lo"), 1);
+	ck_assert_int_eq(configure("capture_threads", "4"), 1);
+	ck_assert_int_eq(configure("capture_fanout_group", "4242"), 1);
+	ck_assert_int_eq(configure("capture_ring_size", "8"), 1);
+	ck_assert_int_eq(configure("listen", "/tmp/honas.sock"), 0);
+	ck_assert(input_afpacket_is_configured(input_state));
+	teardown();
+}
+END_TEST
+
+START_TEST(test_input_afpacket_loopback)
+{
+	if (!can_capture())
+		return;
+	setup();
+	configure("capture_interface", "lo");
+	configure("capture_threads", "3");
+	configure("capture_ring_size", "4");
+	input_afpacket.finalize_config(input_state);
+
+	/* Each query is sent from its own port, so that these are spread over the threads */
+	char name[64];
+	size_t nr_queries = 0;
+	for (int i = 0; i < TEST_NUMBER_OF_QUERIES; i++) {
+		snprintf(name, sizeof(name), "host%d." TEST_SUFFIX, i);
+		ck_assert(send_message(AF_INET, 53, name, 1, false));
+		nr_queries++;
+	}
+	if (send_message(AF_INET6, 53, "ipv6." TEST_SUFFIX, 28, false))
+		nr_queries++;
+
+	/* Neither responses nor queries to other ports are lookups */
+	ck_assert(send_message(AF_INET, 53, "response." TEST_SUFFIX, 1, true));
+	ck_assert(send_message(AF_INET, 5353, "mdns." TEST_SUFFIX, 1, false));
+
+	/* Every query is captured once, even though the loopback interface sees it sent as well as received */
+	size_t nr_lookups = read_lookups(nr_queries);
+	ck_assert_uint_eq(nr_lookups, nr_queries);
+	bool seen[TEST_NUMBER_OF_QUERIES] = { false };
+	for (size_t i = 0; i < nr_lookups; i++) {
+		const struct honas_input_lookup* lookup = &lookups[i];
+		ck_assert_uint_ne(lookup->timestamp, 0);
+		if (lookup->client.af == AF_INET6) {
+			ck_assert(memcmp(&lookup->client.in.addr6, &in6addr_loopback, sizeof(in6addr_loopback)) == 0);
+			ck_assert_uint_eq(lookup->qtype, 28);
+			continue;
+		}
+		ck_assert_int_eq(lookup->client.af, AF_INET);
+		ck_assert_uint_eq(ntohl(lookup->client.in.addr4.s_addr), INADDR_LOOPBACK);
+		ck_assert_uint_eq(lookup->qtype, 1);
+		int id;
+		ck_assert_int_eq(sscanf((const char*)lookup->host_name, "host%d.", &id), 1);
+		ck_assert(id >= 0 && id < TEST_NUMBER_OF_QUERIES && !seen[id]);
+		seen[id] = true;
+	}
+	teardown();
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_input_afpacket_config);
+	tcase_add_test(tc_core, test_input_afpacket_loopback);
+
+	Suite* s = suite_create("Afpacket input");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "input_pcap.h"
+
+#include <byteswap.h>
+#include <check.h>
+
+#define TEST_TIMESTAMP 1700000000
+#define TEST_MAX_LOOKUPS 16
+
+/* The capture file being built */
+static uint8_t capture[65536];
+static size_t capture_len;
+static bool capture_swapped;
+static char capture_file[32];
+static struct honas_input_lookup lookups[TEST_MAX_LOOKUPS];
+
+static void setup(void)
+{
+	capture_len = 0;
+	capture_swapped = false;
+	strcpy(capture_file, "/tmp/test_input_pcap.XXXXXX");
+	int fd = mkstemp(capture_file);
+	ck_assert_int_ne(fd, -1);
+	close(fd);
+}
+
+static void teardown(void)
+{
+	unlink(capture_file);
+}
+
+static void put(const void* data, size_t len)
+{
+	memcpy(capture + capture_len, data, len);
+	capture_len += len;
+}
+
+static void put_u16(uint16_t value)
+{
+	value = capture_swapped ? bswap_16(value) : value;
+	put(&value, sizeof(value));
+}
+
+static void put_u32(uint32_t value)
+{
+	value = capture_swapped ? bswap_32(value) : value;
+	put(&value, sizeof(value));
+}
+
+static void put_padding(size_t len)
+{
+	static const uint8_t zeroes[4] = { 0 };
+	put(zeroes, (4 - len % 4) % 4);
+}
+
+static size_t put_be16(uint8_t* out, uint16_t value)
+{
+	out[0] = value >> 8;
+	out[1] = value & 0xff;
+	return 2;
+}
+
+/* Build a DNS message asking for a name (in wire format) */
+static size_t make_dns(uint8_t* out, uint8_t flags, const char* name, size_t name_len, uint16_t qtype, uint16_t qclass)
+{
+	const uint8_t header[12] = { 0x12, 0x34, flags, 0, 0, 1 };
+	memcpy(out, header, sizeof(header));
+	memcpy(out + sizeof(header), name, name_len);
+	size_t len = sizeof(header) + name_len;
+	len += put_be16(out + len, qtype);
+	len += put_be16(out + len, qclass);
+	return len;
+}
+
+/* Build an Ethernet frame (with a VLAN tag) holding an IPv4 UDP packet */
+static size_t make_udp4(uint8_t* out, uint16_t dport, const uint8_t* payload, size_t payload_len)
+{
+	static const uint8_t ethernet[18] = { 2, 0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 2, 0x81, 0x00, 0, 42, 0x08, 0x00 };
+	static const uint8_t ipv4[20] = { 0x45, 0, 0, 0, 0, 0, 0x40, 0, 64, IPPROTO_UDP, 0, 0, 192, 0, 2, 1, 192, 0, 2, 53 };
+	size_t len = 0;
+	memcpy(out, ethernet, sizeof(ethernet));
+	len += sizeof(ethernet);
+	memcpy(out + len, ipv4, sizeof(ipv4));
+	put_be16(out + len + 2, sizeof(ipv4) + 8 + payload_len);
+	len += sizeof(ipv4);
+	len += put_be16(out + len, 40000);
+	len += put_be16(out + len, dport);
+	len += put_be16(out + len, 8 + payload_len);
+	len += put_be16(out + len, 0);
+	memcpy(out + len, payload, payload_len);
+	return len + payload_len;
+}
+
+/* Build an IPv6 TCP packet (with a hop-by-hop options header) */
+static size_t make_tcp6(uint8_t* out, const uint8_t* payload, size_t payload_len)
+{
+	static const uint8_t ipv6[48] = {
+		0x60, 0, 0, 0, 0, 0, 0, 64,
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x53,
+		IPPROTO_TCP, 0, 1, 4, 0, 0, 0, 0
+	};
+	static const uint8_t tcp[20] = { 0x9c, 0x40, 0, 53, 0, 0, 0, 1, 0, 0, 0, 1, 0x50, 0x18, 0xff, 0xff };
+	memcpy(out, ipv6, sizeof(ipv6));
+	put_be16(out + 4, 8 + sizeof(tcp) + payload_len);
+	memcpy(out + sizeof(ipv6), tcp, sizeof(tcp));
+	memcpy(out + sizeof(ipv6) + sizeof(tcp), payload, payload_len);
+	return sizeof(ipv6) + sizeof(tcp) + payload_len;
+}
+
+static void put_pcap_header(uint32_t magic, uint32_t link_type)
+{
+	put_u32(magic);
+	put_u16(2);
+	put_u16(4);
+	put_u32(0);
+	put_u32(0);
+	put_u32(65535);
+	put_u32(link_type);
+}
+
+static void put_pcap_record(uint32_t timestamp, const uint8_t* packet, size_t len)
+{
+	put_u32(timestamp);
+	put_u32(123456);
+	put_u32(len);
+	put_u32(len);
+	put(packet, len);
+}
+
+static void put_pcapng_section_header(void)
+{
+	put_u32(0x0a0d0d0a);
+	put_u32(28);
+	put_u32(0x1a2b3c4d);
+	put_u16(1);
+	put_u16(0);
+	put_u32(0xffffffff);
+	put_u32(0xffffffff);
+	put_u32(28);
+}
+
+static void put_pcapng_interface(uint16_t link_type, int tsresol)
+{
+	const uint8_t resolution = tsresol;
+	put_u32(1);
+	put_u32(tsresol >= 0 ? 32 : 20);
+	put_u16(link_type);
+	put_u16(0);
+	put_u32(65535);
+	if (tsresol >= 0) {
+		put_u16(9);
+		put_u16(1);
+		put(&resolution, 1);
+		put_padding(1);
+		put_u32(0);
+	}
+	put_u32(tsresol >= 0 ? 32 : 20);
+}
+
+static void put_pcapng_packet(uint32_t interface_id, uint64_t timestamp, const uint8_t* packet, size_t len)
+{
+	uint32_t block_len = 32 + (len + 3) / 4 * 4;
+	put_u32(6);
+	put_u32(block_len);
+	put_u32(interface_id);
+	put_u32(timestamp >> 32);
+	put_u32(timestamp & 0xffffffff);
+	put_u32(len);
+	put_u32(len);
+	put(packet, len);
+	put_padding(len);
+	put_u32(block_len);
+}
+
+static void put_pcapng_simple_packet(const uint8_t* packet, size_t len)
+{
+	uint32_t block_len = 16 + (len + 3) / 4 * 4;
+	put_u32(3);
+	put_u32(block_len);
+	put_u32(len);
+	put(packet, len);
+	put_padding(len);
+	put_u32(block_len);
+}
+
+/* Read all lookups from the first `len` bytes of the capture */
+static size_t read_lookups(size_t len)
+{
+	int fd = open(capture_file, O_RDWR | O_TRUNC | O_CLOEXEC);
+	ck_assert_int_ne(fd, -1);
+	ck_assert_int_eq(write(fd, capture, len), len);
+	ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+	ck_assert(len < 4 || input_pcap_is_capture(fd) == (capture[0] != 'h'));
+
+	void* input_state = NULL;
+	ck_assert_int_eq(input_pcap.init(&input_state), 0);
+	input_pcap_set_fd(input_state, fd);
+	size_t nr_lookups = 0;
+	ssize_t result;
+	while ((result = input_pcap.next_batch(input_state, lookups + nr_lookups, 2)) > 0)
+		nr_lookups += result;
+	ck_assert_int_eq(result, 0);
+	ck_assert_int_eq(input_pcap.next_batch(input_state, lookups, 1), 0);
+	input_pcap.destroy(input_state);
+	return nr_lookups;
+}
+
+static void check_lookup(size_t i, uint64_t timestamp, const char* client, uint16_t qtype, const char* host_name)
+{
+	ck_assert_uint_eq(lookups[i].timestamp, timestamp);
+	ck_assert_str_eq(str_in_addr(&lookups[i].client), client);
+	ck_assert_uint_eq(lookups[i].qtype, qtype);
+	ck_assert_uint_eq(lookups[i].host_name_length, strlen(host_name));
+	ck_assert(memcmp(lookups[i].host_name, host_name, strlen(host_name)) == 0);
+}
+
+START_TEST(test_input_pcap)
+{
+	setup();
+	uint8_t dns[512], packet[1024];
+	size_t dns_len;
+	static const char name[] = "\3www\7Example\3com";
+	static const char escaped_name[] = "\3a.b\2\1x";
+
+	// Only queries of the Internet class sent to port 53 are read.
+	put_pcap_header(0xa1b2c3d4, 1);
+	dns_len = make_dns(dns, 0x01, name, sizeof(name), 1, 1);
+	put_pcap_record(TEST_TIMESTAMP, packet, make_udp4(packet, 53, dns, dns_len));
+	put_pcap_record(TEST_TIMESTAMP + 1, packet, make_udp4(packet, 5353, dns, dns_len));
+	dns_len = make_dns(dns, 0x81, name, sizeof(name), 1, 1);
+	put_pcap_record(TEST_TIMESTAMP + 2, packet, make_udp4(packet, 53, dns, dns_len));
+	dns_len = make_dns(dns, 0x01, name, sizeof(name), 1, 3);
+	put_pcap_record(TEST_TIMESTAMP + 3, packet, make_udp4(packet, 53, dns, dns_len));
+	dns_len = make_dns(dns, 0x01, escaped_name, sizeof(escaped_name), 28, 1);
+	put_pcap_record(TEST_TIMESTAMP + 4, packet, make_udp4(packet, 53, dns, dns_len));
+	ck_assert_uint_eq(read_lookups(capture_len), 2);
+	check_lookup(0, TEST_TIMESTAMP, "192.0.2.1", 1, "www.Example.com.");
+	check_lookup(1, TEST_TIMESTAMP + 4, "192.0.2.1", 28, "a\\.b.\\001x.");
+
+	// The same, in nanosecond resolution and the other byte order.
+	capture_len = 0;
+	capture_swapped = true;
+	put_pcap_header(0xa1b23c4d, 1);
+	dns_len = make_dns(dns, 0x01, name, sizeof(name), 15, 1);
+	put_pcap_record(TEST_TIMESTAMP, packet, make_udp4(packet, 53, dns, dns_len));
+	ck_assert_uint_eq(read_lookups(capture_len), 1);
+	check_lookup(0, TEST_TIMESTAMP, "192.0.2.1", 15, "www.Example.com.");
+
+	// A truncated record ends the capture, as does anything that isn't a capture.
+	ck_assert_uint_eq(read_lookups(capture_len - 1), 0);
+	ck_assert_uint_eq(read_lookups(20), 0);
+	strcpy((char*)capture, "hello world");
+	ck_assert_uint_eq(read_lookups(strlen("hello world")), 0);
+	teardown();
+}
+END_TEST
+
+START_TEST(test_input_pcapng)
+{
+	setup();
+	uint8_t dns[512], segment[1024], packet[1024];
+	size_t segment_len = 0;
+	static const char name[] = "\7example\4test";
+	static const char other_name[] = "\5other\4test";
+
+	// A TCP segment holding two queries and the beginning of a third.
+	segment_len += put_be16(segment, make_dns(segment + 2, 0x01, name, sizeof(name), 1, 1));
+	segment_len += make_dns(segment + segment_len, 0x01, name, sizeof(name), 1, 1);
+	segment_len += put_be16(segment + segment_len, make_dns(segment + segment_len + 2, 0x01, other_name, sizeof(other_name), 28, 1));
+	segment_len += make_dns(segment + segment_len, 0x01, other_name, sizeof(other_name), 28, 1);
+	segment_len += put_be16(segment + segment_len, 100);
+	segment_len += make_dns(segment + segment_len, 0x01, name, sizeof(name), 1, 1);
+
+	// Big endian, with interfaces of different link types and timestamp resolutions.
+	capture_swapped = true;
+	put_pcapng_section_header();
+	put_pcapng_interface(101, 9);
+	put_pcapng_packet(0, (uint64_t)TEST_TIMESTAMP * 1000000000 + 999999999, packet, make_tcp6(packet, segment, segment_len));
+	put_u32(5);
+	put_u32(16);
+	put_u32(0);
+	put_u32(16);
+	put_pcapng_interface(1, -1);
+	size_t dns_len = make_dns(dns, 0x01, other_name, sizeof(other_name), 2, 1);
+	put_pcapng_packet(1, (uint64_t)(TEST_TIMESTAMP + 1) * 1000000, packet, make_udp4(packet, 53, dns, dns_len));
+	put_pcapng_packet(2, (uint64_t)(TEST_TIMESTAMP + 2) * 1000000, packet, make_udp4(packet, 53, dns, dns_len));
+
+	// A new section, in the other byte order, with a binary timestamp resolution.
+	capture_swapped = false;
+	put_pcapng_section_header();
+	put_pcapng_interface(1, 0x80 | 10);
+	put_pcapng_packet(0, (uint64_t)(TEST_TIMESTAMP + 3) << 10, packet, make_udp4(packet, 53, dns, dns_len));
+	put_pcapng_simple_packet(packet, make_udp4(packet, 53, dns, dns_len));
+
+	ck_assert_uint_eq(read_lookups(capture_len), 5);
+	check_lookup(0, TEST_TIMESTAMP, "2001:db8::1", 1, "example.test.");
+	check_lookup(1, TEST_TIMESTAMP, "2001:db8::1", 28, "other.test.");
+	check_lookup(2, TEST_TIMESTAMP + 1, "192.0.2.1", 2, "other.test.");
+	check_lookup(3, TEST_TIMESTAMP + 3, "192.0.2.1", 2, "other.test.");
+	check_lookup(4, 0, "192.0.2.1", 2, "other.test.");
+	teardown();
+}
+END_TEST
+
+START_TEST(test_input_pcap_next)
+{
+	setup();
+	uint8_t dns[512], packet[1024];
+	static const char name[] = "";
+
+	put_pcap_header(0xa1b2c3d4, 1);
+	size_t dns_len = make_dns(dns, 0x01, name, sizeof(name), 2, 1);
+	put_pcap_record(TEST_TIMESTAMP, packet, make_udp4(packet, 53, dns, dns_len));
+	int fd = open(capture_file, O_RDWR | O_CLOEXEC);
+	ck_assert_int_eq(write(fd, capture, capture_len), capture_len);
+	ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+
+	// Lookups can be read one by one as well.
+	void* input_state = NULL;
+	ck_assert_int_eq(input_pcap.init(&input_state), 0);
+	input_pcap_set_fd(input_state, fd);
+	struct in_addr46 client = { 0 };
+	uint8_t* host_name = NULL;
+	ck_assert_int_eq(input_pcap.next(input_state, &client, &host_name), 1);
+	ck_assert_str_eq(str_in_addr(&client), "192.0.2.1");
+	ck_assert_uint_eq(host_name[0], '.');
+	ck_assert_int_eq(input_pcap.next(input_state, &client, &host_name), 0);
+	input_pcap.destroy(input_state);
+	teardown();
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_input_pcap);
+	tcase_add_test(tc_core, test_input_pcapng);
+	tcase_add_test(tc_core, test_input_pcap_next);
+
+	Suite* s = suite_create("Pcap input");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
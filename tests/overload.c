@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "overload.h"
+
+#include <check.h>
+
+START_TEST(test_overload_policy_parse)
+{
+	struct overload_policy policy;
+
+	// Levels have a lag in milliseconds or seconds and a sampling rate.
+	ck_assert_int_eq(overload_policy_parse(&policy, "50ms:2 2s:4\t1500ms:8"), -1);
+	ck_assert_int_eq(overload_policy_parse(&policy, "50ms:2 1500ms:4\t2s:64"), 0);
+	ck_assert_uint_eq(policy.nr_levels, 3);
+	ck_assert_uint_eq(policy.levels[0].lag, 50);
+	ck_assert_uint_eq(policy.levels[0].sampling_rate, 2);
+	ck_assert_uint_eq(policy.levels[1].lag, 1500);
+	ck_assert_uint_eq(policy.levels[2].lag, 2000);
+	ck_assert_uint_eq(policy.levels[2].sampling_rate, 64);
+	ck_assert_uint_eq(overload_policy_sampling_rate(&policy), 1);
+
+	// Without a policy no load is ever shed.
+	ck_assert_int_eq(overload_policy_parse(&policy, NULL), 0);
+	ck_assert_uint_eq(policy.nr_levels, 0);
+	ck_assert_uint_eq(overload_policy_update(&policy, UINT64_MAX, 1000), 1);
+
+	// Invalid levels, and levels that don't shed more load than the previous one are refused.
+	const char* invalid[] = { "", "16s", "16s:", ":2", "100:2", "16M:2", "16s:1", "16s:-2", "-16s:2", "16m:2", "16ms2", "16s:2x", "0ms:2", "1s:4 1000ms:8", "1s:4 2s:4", "2s:2 1s:4", "1s:2 2s:3 3s:4 4s:5 5s:6 6s:7 7s:8 8s:9 9s:10" };
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		errno = 0;
+		ck_assert_msg(overload_policy_parse(&policy, invalid[i]) == -1, "Policy '%s' should be invalid", invalid[i]);
+		ck_assert_int_eq(errno, EINVAL);
+		ck_assert(!overload_policy_is_valid(invalid[i]));
+	}
+	ck_assert(overload_policy_is_valid("1ms:2"));
+}
+END_TEST
+
+START_TEST(test_overload_policy_update)
+{
+	struct overload_policy policy;
+	ck_assert_int_eq(overload_policy_parse(&policy, "1s:2 4s:8"), 0);
+
+	// Levels are entered once the lag reaches their threshold, possibly several at once.
+	ck_assert_uint_eq(overload_policy_update(&policy, 999, 1000), 1);
+	ck_assert_uint_eq(overload_policy_update(&policy, 1000, 1000), 2);
+	ck_assert_uint_eq(overload_policy_update(&policy, 5000, 1001), 8);
+
+	// Levels are kept for a while after the sampling rate was raised, even when the lag is gone.
+	ck_assert_uint_eq(overload_policy_update(&policy, 0, 1001 + OVERLOAD_MIN_HOLD_TIME - 1), 8);
+
+	// Levels are only left once the lag drops below half their threshold.
+	const uint64_t now = 1001 + OVERLOAD_MIN_HOLD_TIME;
+	ck_assert_uint_eq(overload_policy_update(&policy, 3000, now), 8);
+	ck_assert_uint_eq(overload_policy_update(&policy, 2000, now), 8);
+	ck_assert_uint_eq(overload_policy_update(&policy, 1999, now), 2);
+	ck_assert_uint_eq(overload_policy_update(&policy, 500, now), 2);
+	ck_assert_uint_eq(overload_policy_update(&policy, 5000, now), 8);
+	ck_assert_uint_eq(overload_policy_update(&policy, 0, now + OVERLOAD_MIN_HOLD_TIME - 1), 8);
+	ck_assert_uint_eq(overload_policy_update(&policy, 0, now + OVERLOAD_MIN_HOLD_TIME), 1);
+	ck_assert_uint_eq(overload_policy_sampling_rate(&policy), 1);
+}
+END_TEST
+
+START_TEST(test_overload_lag)
+{
+	struct overload_lag lag = { 0 };
+
+	// The highest lag since it was last taken counts, and lookups from the future don't lag.
+	ck_assert(overload_lag_is_idle(&lag));
+	overload_lag_measure(&lag, 1000, 1020);
+	overload_lag_measure(&lag, 1010, 1100);
+	overload_lag_measure(&lag, 1200, 1100);
+
+	// An input is idle when no lookups were measured since the previous check.
+	ck_assert(!overload_lag_is_idle(&lag));
+	ck_assert(overload_lag_is_idle(&lag));
+
+	// The lag is only taken when any lookups were measured since it was last taken.
+	uint64_t taken = 0;
+	ck_assert(overload_lag_take(&lag, &taken));
+	ck_assert_uint_eq(taken, 90);
+	ck_assert(!overload_lag_take(&lag, &taken));
+
+	// Lookups processed right away don't lag either.
+	overload_lag_measure(&lag, 1100, 1100);
+	ck_assert(overload_lag_take(&lag, &taken));
+	ck_assert_uint_eq(taken, 0);
+}
+END_TEST
+
+START_TEST(test_overload_falling_behind)
+{
+	struct overload_policy policy;
+	struct overload_lag lag = { 0 };
+	ck_assert_int_eq(overload_policy_parse(&policy, "100ms:2 1s:8"), 0);
+
+	// Lookups are made every millisecond and processed in batches of 10, normally in 5ms. For
+	// a while processing a batch takes 20ms, so the input falls behind, until it catches up again.
+	const uint64_t start = 1000000;
+	uint64_t processed = start;
+	uint32_t max_rate = 1;
+	for (uint64_t lookup = 0; lookup < 12000; lookup += 10) {
+		const uint64_t cost = lookup >= 4000 && lookup < 6000 ? 20 : 5;
+		processed = (processed > start + lookup + 10 ? processed : start + lookup + 10) + cost;
+		for (uint64_t i = lookup; i < lookup + 10; i++)
+			overload_lag_measure(&lag, start + i, processed);
+
+		uint64_t batch_lag;
+		ck_assert(overload_lag_take(&lag, &batch_lag));
+		uint32_t rate = overload_policy_update(&policy, batch_lag, processed / 1000);
+		ck_assert_uint_ge(rate, max_rate);
+		max_rate = rate;
+
+		// Normally the lag is less than a batch, so no load is shed.
+		if (lookup < 4000)
+			ck_assert_uint_eq(rate, 1);
+	}
+	ck_assert_uint_eq(max_rate, 8);
+
+	// Once it has caught up, the input goes idle and the levels are left after the hold time.
+	ck_assert(!overload_lag_is_idle(&lag));
+	ck_assert(overload_lag_is_idle(&lag));
+	ck_assert_uint_eq(overload_policy_update(&policy, 0, processed / 1000 + 1), 8);
+	ck_assert_uint_eq(overload_policy_update(&policy, 0, processed / 1000 + OVERLOAD_MIN_HOLD_TIME), 1);
+}
+END_TEST
+
+START_TEST(test_overload_client_sampling)
+{
+	const uint32_t nr_clients = 100000;
+	const uint32_t sampling_rates[] = { 2, 8, 64 };
+	uint32_t nr_sampled[3] = { 0 };
+	struct in_addr46 client = { 0 };
+
+	for (uint32_t i = 0; i < nr_clients; i++) {
+		if (i & 1) {
+			client.af = AF_INET;
+			client.in.addr4.s_addr = htonl(0x0a000000 + i);
+		} else {
+			client.af = AF_INET6;
+			memset(&client.in.addr6, 0, sizeof(client.in.addr6));
+			client.in.addr6.s6_addr[0] = 0x20;
+			client.in.addr6.s6_addr[1] = 0x01;
+			memcpy(&client.in.addr6.s6_addr[12], &i, sizeof(i));
+		}
+
+		// All clients are sampled when not overloaded, and sampling is deterministic.
+		ck_assert(overload_client_is_sampled(&client, 1));
+		for (size_t j = 0; j < 3; j++) {
+			bool sampled = overload_client_is_sampled(&client, sampling_rates[j]);
+			ck_assert(sampled == overload_client_is_sampled(&client, sampling_rates[j]));
+			if (sampled) {
+				nr_sampled[j]++;
+
+				// Clients sampled at a higher sampling rate are sampled at the lower ones as well.
+				for (size_t k = 0; k < j; k++)
+					ck_assert(overload_client_is_sampled(&client, sampling_rates[k]));
+			}
+		}
+	}
+
+	// About 1 in N clients is sampled.
+	for (size_t j = 0; j < 3; j++) {
+		double expected = (double)nr_clients / sampling_rates[j];
+		ck_assert_msg(fabs(nr_sampled[j] - expected) < expected * 0.1, "%u of %u clients sampled at 1 in %u", nr_sampled[j], nr_clients, sampling_rates[j]);
+	}
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_overload_policy_parse);
+	tcase_add_test(tc_core, test_overload_policy_update);
+	tcase_add_test(tc_core, test_overload_lag);
+	tcase_add_test(tc_core, test_overload_falling_behind);
+	tcase_add_test(tc_core, test_overload_client_sampling);
+
+	Suite* s = suite_create("Overload");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
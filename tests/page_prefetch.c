@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "page_prefetch.h"
+
+#include <check.h>
+
+#define TEST_NUMBER_OF_PAGES 64
+
+static char test_file[32];
+static uint8_t* test_mmap;
+
+static void setup(void)
+{
+	strcpy(test_file, "/tmp/test_page_prefetch.XXXXXX");
+	int fd = mkstemp(test_file);
+	ck_assert_int_ne(fd, -1);
+	uint8_t page[PAGE_SIZE];
+	for (int i = 0; i < TEST_NUMBER_OF_PAGES; i++) {
+		memset(page, i, sizeof(page));
+		ck_assert_int_eq(write(fd, page, sizeof(page)), sizeof(page));
+	}
+
+	/* Drop the pages from the page cache (as far as possible), so that these are actually read */
+	ck_assert_int_eq(fdatasync(fd), 0);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	test_mmap = mmap(NULL, TEST_NUMBER_OF_PAGES * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	ck_assert_ptr_ne(test_mmap, MAP_FAILED);
+	close(fd);
+}
+
+static void teardown(void)
+{
+	munmap(test_mmap, TEST_NUMBER_OF_PAGES * PAGE_SIZE);
+	unlink(test_file);
+}
+
+/* Prefetch all pages (twice in a row, and once again afterwards) and check their contents */
+static void check_prefetch_pages(struct page_prefetch* prefetch)
+{
+	for (int i = 0; i < TEST_NUMBER_OF_PAGES; i++) {
+		page_prefetch_page(prefetch, test_mmap + i * PAGE_SIZE + i);
+		page_prefetch_page(prefetch, test_mmap + i * PAGE_SIZE + PAGE_SIZE - 1);
+	}
+	page_prefetch_submit(prefetch);
+	ck_assert_uint_eq(page_prefetch_nr_pages(prefetch), TEST_NUMBER_OF_PAGES);
+	page_prefetch_page(prefetch, test_mmap);
+	ck_assert_uint_eq(page_prefetch_nr_pages(prefetch), TEST_NUMBER_OF_PAGES);
+
+	for (int i = 0; i < TEST_NUMBER_OF_PAGES; i++) {
+		ck_assert_uint_eq(test_mmap[i * PAGE_SIZE], i);
+		ck_assert_uint_eq(test_mmap[i * PAGE_SIZE + PAGE_SIZE - 1], i);
+	}
+}
+
+START_TEST(test_page_prefetch_batches)
+{
+	/* A batch smaller than the number of pages gives hints whenever the batch is full */
+	setup();
+	struct page_prefetch* prefetch = page_prefetch_create(4);
+	check_prefetch_pages(prefetch);
+	ck_assert_uint_eq(page_prefetch_nr_hints(prefetch), TEST_NUMBER_OF_PAGES / 4);
+	page_prefetch_destroy(prefetch);
+	teardown();
+}
+END_TEST
+
+START_TEST(test_page_prefetch_adjacent_pages)
+{
+	setup();
+	struct page_prefetch* prefetch = page_prefetch_create(TEST_NUMBER_OF_PAGES);
+	check_prefetch_pages(prefetch);
+	ck_assert_uint_eq(page_prefetch_nr_hints(prefetch), 1);
+	page_prefetch_destroy(prefetch);
+
+	/* Pages that aren't adjacent get a hint each, in whatever order they're requested */
+	prefetch = page_prefetch_create(TEST_NUMBER_OF_PAGES);
+	for (int i = TEST_NUMBER_OF_PAGES - 2; i >= 0; i -= 2)
+		page_prefetch_page(prefetch, test_mmap + i * PAGE_SIZE);
+	for (int i = 0; i < 4; i++)
+		page_prefetch_page(prefetch, test_mmap + (2 * i + 1) * PAGE_SIZE);
+	page_prefetch_submit(prefetch);
+	ck_assert_uint_eq(page_prefetch_nr_pages(prefetch), TEST_NUMBER_OF_PAGES / 2 + 4);
+	ck_assert_uint_eq(page_prefetch_nr_hints(prefetch), TEST_NUMBER_OF_PAGES / 2 - 4);
+	page_prefetch_destroy(prefetch);
+	teardown();
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_page_prefetch_batches);
+	tcase_add_test(tc_core, test_page_prefetch_adjacent_pages);
+
+	Suite* s = suite_create("Page prefetch");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
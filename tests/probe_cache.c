@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "probe_cache.h"
+
+#include <check.h>
+#include <openssl/sha.h>
+
+/* The 'ck_assert_mem_eq' check is only available in check >= 0.12.0 */
+#ifndef ck_assert_mem_eq
+#define ck_assert_mem_eq(X, Y, L) ck_assert(memcmp((X),(Y),(L)) == 0)
+#endif
+
+#define TEST_NUMBER_OF_FILTERS 12
+
+static char test_dir[32];
+static char state_file[sizeof(test_dir) + 16];
+static char cache_file[sizeof(state_file) + sizeof(PROBE_CACHE_FILE_SUFFIX)];
+static struct honas_state_file_header test_header;
+static honas_state_t test_state;
+
+static void setup(void)
+{
+	strcpy(test_dir, "/tmp/test_probe_cache.XXXXXX");
+	ck_assert_ptr_ne(mkdtemp(test_dir), NULL);
+	snprintf(state_file, sizeof(state_file), "%s/state.hs", test_dir);
+	snprintf(cache_file, sizeof(cache_file), "%s%s", state_file, PROBE_CACHE_FILE_SUFFIX);
+
+	/* Only the number of filters of the state is used by the probe cache */
+	memset(&test_header, 0, sizeof(test_header));
+	test_header.number_of_filters = TEST_NUMBER_OF_FILTERS;
+	memset(&test_state, 0, sizeof(test_state));
+	test_state.header = &test_header;
+
+	FILE* fh = fopen(state_file, "w");
+	ck_assert_ptr_ne(fh, NULL);
+	ck_assert_int_eq(fwrite("state", 5, 1, fh), 1);
+	ck_assert_int_eq(fclose(fh), 0);
+}
+
+static void teardown(void)
+{
+	unlink(cache_file);
+	unlink(state_file);
+	rmdir(test_dir);
+}
+
+static void test_hash(uint8_t* hash, int nr)
+{
+	memset(hash, 0, SHA256_DIGEST_LENGTH);
+	hash[0] = nr;
+}
+
+START_TEST(test_probe_cache_roundtrip)
+{
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	uint8_t filters_hit[16] = { 0x05, 0x0a };
+	uint8_t no_filters_hit[2] = { 0 };
+	uint8_t looked_up[16];
+	uint32_t hits;
+	setup();
+
+	/* A missing cache file results in an empty cache */
+	struct probe_cache* cache = probe_cache_open(state_file, &test_state);
+	ck_assert_ptr_ne(cache, NULL);
+	test_hash(hash, 1);
+	ck_assert(!probe_cache_lookup(cache, hash, &hits, byte_slice_from_array(looked_up)));
+
+	/* Adding results only writes a cache file when saved */
+	probe_cache_add(cache, hash, 4, byte_slice_from_array(filters_hit));
+	test_hash(hash, 2);
+	probe_cache_add(cache, hash, 0, byte_slice_from_array(no_filters_hit));
+	ck_assert_int_eq(access(cache_file, F_OK), -1);
+	ck_assert_int_eq(probe_cache_save(cache), 0);
+	ck_assert_int_eq(access(cache_file, F_OK), 0);
+	probe_cache_destroy(cache);
+
+	/* The results are read back; only the bits of the filters of the state are kept */
+	cache = probe_cache_open(state_file, &test_state);
+	ck_assert_ptr_ne(cache, NULL);
+	test_hash(hash, 1);
+	memset(looked_up, 0xff, sizeof(looked_up));
+	ck_assert(probe_cache_lookup(cache, hash, &hits, byte_slice_from_array(looked_up)));
+	ck_assert_uint_eq(hits, 4);
+	ck_assert_mem_eq(looked_up, filters_hit, sizeof(filters_hit));
+	test_hash(hash, 2);
+	ck_assert(probe_cache_lookup(cache, hash, &hits, byte_slice_from_array(looked_up)));
+	ck_assert_uint_eq(hits, 0);
+	test_hash(hash, 3);
+	ck_assert(!probe_cache_lookup(cache, hash, &hits, byte_slice_from_array(looked_up)));
+
+	/* Results that are already cached aren't replaced */
+	test_hash(hash, 1);
+	probe_cache_add(cache, hash, 1, byte_slice_from_array(no_filters_hit));
+	ck_assert(probe_cache_lookup(cache, hash, &hits, byte_slice_from_array(looked_up)));
+	ck_assert_uint_eq(hits, 4);
+	probe_cache_destroy(cache);
+	teardown();
+}
+END_TEST
+
+START_TEST(test_probe_cache_invalidation)
+{
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	uint8_t filters_hit[2] = { 0x01 };
+	uint32_t hits;
+	setup();
+
+	struct probe_cache* cache = probe_cache_open(state_file, &test_state);
+	ck_assert_ptr_ne(cache, NULL);
+	test_hash(hash, 1);
+	probe_cache_add(cache, hash, 1, byte_slice_from_array(filters_hit));
+	ck_assert_int_eq(probe_cache_save(cache), 0);
+	probe_cache_destroy(cache);
+
+	/* The cache isn't used for a state with a different number of filters */
+	test_header.number_of_filters = TEST_NUMBER_OF_FILTERS + 1;
+	cache = probe_cache_open(state_file, &test_state);
+	ck_assert(!probe_cache_lookup(cache, hash, &hits, byte_slice_from_array(filters_hit)));
+	probe_cache_destroy(cache);
+	test_header.number_of_filters = TEST_NUMBER_OF_FILTERS;
+
+	/* Nor once the state file has been changed */
+	FILE* fh = fopen(state_file, "a");
+	ck_assert_ptr_ne(fh, NULL);
+	ck_assert_int_eq(fwrite("changed", 7, 1, fh), 1);
+	ck_assert_int_eq(fclose(fh), 0);
+	cache = probe_cache_open(state_file, &test_state);
+	ck_assert(!probe_cache_lookup(cache, hash, &hits, byte_slice_from_array(filters_hit)));
+	probe_cache_destroy(cache);
+
+	/* A missing state file can't have a cache */
+	unlink(state_file);
+	ck_assert_ptr_eq(probe_cache_open(state_file, &test_state), NULL);
+	teardown();
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_probe_cache_roundtrip);
+	tcase_add_test(tc_core, test_probe_cache_invalidation);
+
+	Suite* s = suite_create("Probe cache");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "search_job.h"
+#include "state_combine.h"
+
+#include <check.h>
+#include <openssl/sha.h>
+#include <ldns/ldns.h>
+
+/* The 'ck_assert_mem_eq' check is only available in check >= 0.12.0 */
+#ifndef ck_assert_mem_eq
+#define ck_assert_mem_eq(X, Y, L) ck_assert(memcmp((X),(Y),(L)) == 0)
+#endif
+
+/* Every lookup sets all filters, so host names that were looked up hit all of them */
+#define TEST_NUMBER_OF_FILTERS 4
+#define TEST_NUMBER_OF_BITS_PER_FILTER (64 * 1024)
+#define TEST_NUMBER_OF_HASHES 4
+
+/* Enough host names for the search job to be checked in more than one batch */
+#define TEST_NUMBER_OF_HOST_NAMES (SEARCH_BATCH_SIZE + 3 * SEARCH_CHUNK_SIZE + 7)
+
+#define CSV_HEADER "period_begin,group_id,host_name,hits,hits_by_all_host_names\n"
+
+/* Create a honas state for the period beginning at `period_begin` in which the host names were looked up */
+static void create_state(honas_state_t* state, uint32_t number_of_bits_per_filter, uint64_t period_begin, const char* entity, const char** host_names, size_t nr_host_names)
+{
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+
+	memset(state, 0, sizeof(*state));
+	ck_assert_int_eq(honas_state_create(state, TEST_NUMBER_OF_FILTERS, number_of_bits_per_filter, TEST_NUMBER_OF_HASHES, TEST_NUMBER_OF_FILTERS, 0), 0);
+	state->header->period_begin = period_begin;
+	for (size_t i = 0; i < nr_host_names; i++) {
+		client.in.addr4.s_addr = htonl(0x0a000000 + i);
+		honas_state_register_host_name_lookup(state, period_begin + i, &client, (const uint8_t*)host_names[i], strlen(host_names[i]),
+			(const uint8_t*)entity, entity != NULL ? strlen(entity) : 0, NULL, LDNS_RR_TYPE_A);
+	}
+}
+
+/* The host name of the many host names search job; every 97th of these is looked up */
+static void many_host_name(size_t i, char* buf, size_t len)
+{
+	snprintf(buf, len, "host%zu.example.net", i);
+}
+
+static void create_many_state(honas_state_t* state, uint64_t period_begin, size_t offset)
+{
+	size_t nr_host_names = (TEST_NUMBER_OF_HOST_NAMES + 96) / 97;
+	char names[nr_host_names][32];
+	const char* host_names[nr_host_names];
+	for (size_t i = 0; i < nr_host_names; i++) {
+		many_host_name(i * 97 + offset, names[i], sizeof(names[i]));
+		host_names[i] = names[i];
+	}
+	create_state(state, TEST_NUMBER_OF_BITS_PER_FILTER, period_begin, NULL, host_names, nr_host_names);
+}
+
+/* A JSON search job with groups of 50 host names of which the odd groups use the hashed host names */
+static char* many_host_names_job(size_t* job_len)
+{
+	char* job;
+	FILE* fh = open_memstream(&job, job_len);
+	ck_assert_ptr_ne(fh, NULL);
+	fprintf(fh, "{\"groups\":[");
+	for (size_t i = 0; i < TEST_NUMBER_OF_HOST_NAMES; i++) {
+		char host_name[32];
+		many_host_name(i, host_name, sizeof(host_name));
+		bool hashed = (i / 50) & 1;
+		if (i % 50 == 0)
+			fprintf(fh, "%s{\"id\":%zu,\"%s\":%s", i > 0 ? "}," : "", i / 50, hashed ? "hostnames" : "names", hashed ? "{" : "[");
+		else
+			fprintf(fh, ",");
+		if (hashed) {
+			uint8_t hash[SHA256_DIGEST_LENGTH];
+			honas_state_host_name_hash(NULL, 0, (const uint8_t*)host_name, strlen(host_name), hash);
+			fprintf(fh, "\"%s\":\"", host_name);
+			for (size_t b = 0; b < sizeof(hash); b++)
+				fprintf(fh, "%02x", hash[b]);
+			fprintf(fh, "\"");
+		}
+		else {
+			fprintf(fh, "\"%s\"", host_name);
+		}
+		if (i % 50 == 49 || i == TEST_NUMBER_OF_HOST_NAMES - 1)
+			fprintf(fh, "%s", hashed ? "}" : "]");
+	}
+	fprintf(fh, "}]}");
+	ck_assert_int_eq(fclose(fh), 0);
+	return job;
+}
+
+/* Perform a search job, held in memory, and return the results */
+static char* perform_job(const struct search_job_state* states, size_t nr_states, unsigned int nr_threads, enum search_result_format format,
+	const struct search_job_entities* entities, const char* job, size_t job_len, size_t* result_len)
+{
+	char* result;
+	FILE* job_fh = fmemopen((void*)job, job_len, "r");
+	FILE* result_fh = open_memstream(&result, result_len);
+	ck_assert_ptr_ne(job_fh, NULL);
+	ck_assert_ptr_ne(result_fh, NULL);
+	ck_assert_int_eq(search_job_perform(states, nr_states, nr_threads, format, entities, job_fh, result_fh), 0);
+	ck_assert_int_eq(fclose(job_fh), 0);
+	ck_assert_int_eq(fclose(result_fh), 0);
+	return result;
+}
+
+static char* perform(const struct search_job_state* states, size_t nr_states, unsigned int nr_threads, enum search_result_format format,
+	const struct search_job_entities* entities, const char* job)
+{
+	size_t result_len;
+	return perform_job(states, nr_states, nr_threads, format, entities, job, strlen(job), &result_len);
+}
+
+/* Compile (when given the geometry of `state`) or convert a search job */
+static char* write_job(const honas_state_t* state, const char* job, size_t job_len, size_t* written_len)
+{
+	char* written;
+	FILE* job_fh = fmemopen((void*)job, job_len, "r");
+	FILE* written_fh = open_memstream(&written, written_len);
+	ck_assert_ptr_ne(job_fh, NULL);
+	ck_assert_ptr_ne(written_fh, NULL);
+	if (state != NULL)
+		ck_assert_int_eq(search_job_compile(state->header->number_of_filters, state->header->number_of_bits_per_filter, state->header->number_of_hashes, state->shared_block_size, job_fh, written_fh), 0);
+	else
+		ck_assert_int_eq(search_job_convert(job_fh, written_fh), 0);
+	ck_assert_int_eq(fclose(job_fh), 0);
+	ck_assert_int_eq(fclose(written_fh), 0);
+	return written;
+}
+
+static const char* test_host_names[] = { "www.example.com", "surfnet.nl", "sidn.nl" };
+static const char* test_job =
+	"{\"groups\":["
+	"{\"id\":1,\"names\":[\"www.example.com\",\"Example.COM.\",\"surfnet.nl\"]},"
+	"{\"id\":2,\"names\":[\"www.example.com\",\"unknown.example.org\"]},"
+	"{\"id\":3,\"names\":[\"unknown.example.org\"]},"
+	"{\"id\":4,\"names\":[\"sidn.nl\",\"surfnet.nl\"]}"
+	"]}";
+
+START_TEST(test_search_job_results)
+{
+	honas_state_t state;
+	create_state(&state, TEST_NUMBER_OF_BITS_PER_FILTER, 1000, NULL, test_host_names, 3);
+	struct search_job_state job_state = { &state, false, NULL, NULL, false };
+
+	/* Host names are canonicalized and parent domains are found as well; groups without hits are left out */
+	char* result = perform(&job_state, 1, 0, SEARCH_RESULT_FORMAT_JSON, NULL, test_job);
+	ck_assert_ptr_ne(strstr(result, "\"period_begin\":1000,"), NULL);
+	const char* groups = strstr(result, "\"flattened_results\":");
+	ck_assert_ptr_ne(groups, NULL);
+	ck_assert_str_eq(groups, "\"flattened_results\":false,\"groups\":["
+		"{\"hostnames\":{\"www.example.com\":4,\"Example.COM.\":4,\"surfnet.nl\":4},\"id\":1,\"hits_by_all_hostnames\":4},"
+		"{\"hostnames\":{\"www.example.com\":4},\"id\":2,\"hits_by_all_hostnames\":0},"
+		"{\"hostnames\":{\"sidn.nl\":4,\"surfnet.nl\":4},\"id\":4,\"hits_by_all_hostnames\":4}"
+		"]}");
+	free(result);
+
+	result = perform(&job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, test_job);
+	ck_assert_str_eq(result, CSV_HEADER
+		"1000,1,www.example.com,4,4\n"
+		"1000,1,Example.COM.,4,4\n"
+		"1000,1,surfnet.nl,4,4\n"
+		"1000,2,www.example.com,4,0\n"
+		"1000,4,sidn.nl,4,4\n"
+		"1000,4,surfnet.nl,4,4\n");
+	free(result);
+
+	/* Flattened results only tell whether a host name was found */
+	job_state.flatten_results = true;
+	result = perform(&job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, "{\"groups\":[{\"id\":5,\"names\":[\"surfnet.nl\"]}]}");
+	ck_assert_str_eq(result, CSV_HEADER "1000,5,surfnet.nl,1,1\n");
+	free(result);
+
+	honas_state_destroy(&state);
+}
+END_TEST
+
+START_TEST(test_search_job_threads)
+{
+	honas_state_t states[2];
+	create_many_state(&states[0], 1000, 0);
+	create_many_state(&states[1], 2000, 5);
+	struct search_job_state job_states[2] = {
+		{ &states[0], false, NULL, NULL, false },
+		{ &states[1], false, NULL, NULL, false },
+	};
+	size_t job_len;
+	char* job = many_host_names_job(&job_len);
+
+	/* The results are the same whichever threads checked which chunks of the batches */
+	size_t expected_len;
+	char* expected = perform_job(job_states, 2, 0, SEARCH_RESULT_FORMAT_JSON, NULL, job, job_len, &expected_len);
+	ck_assert_ptr_ne(strstr(expected, "\"host97.example.net\":4"), NULL);
+	ck_assert_ptr_ne(strstr(expected, "\"host102.example.net\":4"), NULL);
+	ck_assert_ptr_eq(strstr(expected, "\"host98.example.net\""), NULL);
+	for (unsigned int nr_threads = 1; nr_threads <= 3; nr_threads++) {
+		size_t result_len;
+		char* result = perform_job(job_states, 2, nr_threads, SEARCH_RESULT_FORMAT_JSON, NULL, job, job_len, &result_len);
+		ck_assert_uint_eq(result_len, expected_len);
+		ck_assert_mem_eq(result, expected, expected_len);
+		free(result);
+	}
+
+	/* Nor does prefetching the filter pages change the results */
+	job_states[0].prefetch = true;
+	job_states[1].prefetch = true;
+	for (unsigned int nr_threads = 0; nr_threads <= 2; nr_threads += 2) {
+		size_t result_len;
+		char* result = perform_job(job_states, 2, nr_threads, SEARCH_RESULT_FORMAT_JSON, NULL, job, job_len, &result_len);
+		ck_assert_uint_eq(result_len, expected_len);
+		ck_assert_mem_eq(result, expected, expected_len);
+		free(result);
+	}
+
+	free(expected);
+	free(job);
+	honas_state_destroy(&states[0]);
+	honas_state_destroy(&states[1]);
+}
+END_TEST
+
+START_TEST(test_search_job_shared_offsets)
+{
+	/* The first two states share their bit offsets, the third one has smaller filters */
+	honas_state_t states[3];
+	create_state(&states[0], TEST_NUMBER_OF_BITS_PER_FILTER, 1000, NULL, test_host_names, 1);
+	create_state(&states[1], TEST_NUMBER_OF_BITS_PER_FILTER, 2000, NULL, test_host_names + 1, 1);
+	create_state(&states[2], TEST_NUMBER_OF_BITS_PER_FILTER / 2, 3000, NULL, test_host_names, 3);
+	ck_assert(honas_state_offsets_compatible(&states[0], &states[1]));
+	ck_assert(!honas_state_offsets_compatible(&states[0], &states[2]));
+	struct search_job_state job_states[3] = {
+		{ &states[0], false, NULL, NULL, false },
+		{ &states[1], false, NULL, NULL, false },
+		{ &states[2], false, NULL, NULL, false },
+	};
+
+	/* The results of multiple states are those of each state on its own, keyed by period */
+	char* results[3];
+	size_t results_len = 0;
+	for (int s = 0; s < 3; s++) {
+		results[s] = perform(&job_states[s], 1, 0, SEARCH_RESULT_FORMAT_JSON, NULL, test_job);
+		results_len += strlen(results[s]) + 16;
+	}
+	char expected[results_len + 32];
+	snprintf(expected, sizeof(expected), "{\"results\":{\"1000\":%s,\"2000\":%s,\"3000\":%s}}", results[0], results[1], results[2]);
+	for (unsigned int nr_threads = 0; nr_threads <= 2; nr_threads += 2) {
+		char* result = perform(job_states, 3, nr_threads, SEARCH_RESULT_FORMAT_JSON, NULL, test_job);
+		ck_assert_str_eq(result, expected);
+		free(result);
+	}
+
+	char* result = perform(job_states, 3, 0, SEARCH_RESULT_FORMAT_CSV, NULL, test_job);
+	ck_assert_str_eq(result, CSV_HEADER
+		"1000,1,www.example.com,4,0\n"
+		"1000,1,Example.COM.,4,0\n"
+		"1000,2,www.example.com,4,0\n"
+		"2000,1,surfnet.nl,4,0\n"
+		"2000,4,surfnet.nl,4,0\n"
+		"3000,1,www.example.com,4,4\n"
+		"3000,1,Example.COM.,4,4\n"
+		"3000,1,surfnet.nl,4,4\n"
+		"3000,2,www.example.com,4,0\n"
+		"3000,4,sidn.nl,4,4\n"
+		"3000,4,surfnet.nl,4,4\n");
+	free(result);
+
+	for (int s = 0; s < 3; s++) {
+		free(results[s]);
+		honas_state_destroy(&states[s]);
+	}
+}
+END_TEST
+
+START_TEST(test_search_job_compiled)
+{
+	honas_state_t states[2];
+	create_many_state(&states[0], 1000, 0);
+	create_many_state(&states[1], 2000, 5);
+	struct search_job_state job_states[2] = {
+		{ &states[0], false, NULL, NULL, false },
+		{ &states[1], false, NULL, NULL, false },
+	};
+	size_t job_len, compiled_len;
+	char* job = many_host_names_job(&job_len);
+	char* compiled = write_job(&states[0], job, job_len, &compiled_len);
+	ck_assert_mem_eq(compiled, COMPILED_SEARCH_JOB_FILE_MAGIC, 8);
+
+	/* The bit offsets of each filter are sorted */
+	const struct compiled_search_job_header* header = (const struct compiled_search_job_header*)compiled;
+	size_t nr_host_names = 0;
+	for (size_t pos = sizeof(*header); pos < compiled_len;) {
+		struct search_job_file_entry entry;
+		memcpy(&entry, compiled + pos, sizeof(entry));
+		pos += sizeof(entry);
+		if (entry.type != SEARCH_JOB_FILE_HOST_NAME)
+			continue;
+		const uint32_t* bit_offsets = (const uint32_t*)(compiled + pos + entry.key_length);
+		for (uint32_t f = 0; f < header->number_of_filters; f++) {
+			for (uint32_t h = 1; h < header->number_of_hashes; h++)
+				ck_assert_uint_le(bit_offsets[f * header->number_of_hashes + h - 1], bit_offsets[f * header->number_of_hashes + h]);
+		}
+		pos += entry.key_length + sizeof(uint32_t) * header->number_of_filters * header->number_of_hashes;
+		nr_host_names++;
+	}
+	ck_assert_uint_gt(nr_host_names, 0);
+
+	/* Performing the compiled search job gives the same results as the original one */
+	size_t expected_len;
+	char* expected = perform_job(job_states, 2, 0, SEARCH_RESULT_FORMAT_CSV, NULL, job, job_len, &expected_len);
+	ck_assert_ptr_ne(strstr(expected, "\n1000,1,host97.example.net,4,0\n"), NULL);
+	for (unsigned int nr_threads = 0; nr_threads <= 2; nr_threads += 2) {
+		size_t result_len;
+		char* result = perform_job(job_states, 2, nr_threads, SEARCH_RESULT_FORMAT_CSV, NULL, compiled, compiled_len, &result_len);
+		ck_assert_uint_eq(result_len, expected_len);
+		ck_assert_mem_eq(result, expected, expected_len);
+		free(result);
+	}
+	free(expected);
+
+	/* It can't be performed on states of another geometry */
+	honas_state_t other;
+	create_state(&other, TEST_NUMBER_OF_BITS_PER_FILTER / 2, 3000, NULL, test_host_names, 3);
+	struct search_job_state other_job_state = { &other, false, NULL, NULL, false };
+	size_t result_len;
+	char* result;
+	FILE* job_fh = fmemopen(compiled, compiled_len, "r");
+	FILE* result_fh = open_memstream(&result, &result_len);
+	ck_assert_int_eq(search_job_perform(&other_job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, job_fh, result_fh), -1);
+	fclose(job_fh);
+	fclose(result_fh);
+	free(result);
+	honas_state_destroy(&other);
+
+	/* Nor on states of the same geometry with shared blocks */
+	ck_assert_int_eq(honas_state_create(&other, TEST_NUMBER_OF_FILTERS, TEST_NUMBER_OF_BITS_PER_FILTER, TEST_NUMBER_OF_HASHES, TEST_NUMBER_OF_FILTERS, 0), 0);
+	ck_assert_int_eq(honas_state_use_shared_blocks(&other, 4096), 0);
+	other.header->period_begin = 3000;
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	honas_state_register_host_name_lookup(&other, 3000, &client, (const uint8_t*)"host97.example.net", strlen("host97.example.net"), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	job_fh = fmemopen(compiled, compiled_len, "r");
+	result_fh = open_memstream(&result, &result_len);
+	ck_assert_int_eq(search_job_perform(&other_job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, job_fh, result_fh), -1);
+	fclose(job_fh);
+	fclose(result_fh);
+	free(result);
+
+	/* Which a search job compiled for shared blocks can be performed on */
+	free(compiled);
+	compiled = write_job(&other, job, job_len, &compiled_len);
+	expected = perform_job(&other_job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, job, job_len, &expected_len);
+	ck_assert_ptr_ne(strstr(expected, "\n3000,1,host97.example.net,4,0\n"), NULL);
+	result = perform_job(&other_job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, compiled, compiled_len, &result_len);
+	ck_assert_uint_eq(result_len, expected_len);
+	ck_assert_mem_eq(result, expected, expected_len);
+	free(result);
+	free(expected);
+
+	honas_state_destroy(&other);
+	free(compiled);
+	free(job);
+	honas_state_destroy(&states[0]);
+	honas_state_destroy(&states[1]);
+}
+END_TEST
+
+START_TEST(test_search_job_binary)
+{
+	honas_state_t state;
+	create_state(&state, TEST_NUMBER_OF_BITS_PER_FILTER, 1000, NULL, test_host_names, 3);
+	struct search_job_state job_state = { &state, false, NULL, NULL, false };
+
+	/* A binary search job gives the same results as the JSON search job it was converted from */
+	size_t binary_len;
+	char* binary = write_job(NULL, test_job, strlen(test_job), &binary_len);
+	ck_assert_mem_eq(binary, BINARY_SEARCH_JOB_FILE_MAGIC, 8);
+	size_t expected_len, result_len;
+	char* expected = perform_job(&job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, test_job, strlen(test_job), &expected_len);
+	char* result = perform_job(&job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, binary, binary_len, &result_len);
+	ck_assert_str_eq(result, expected);
+	free(result);
+	free(expected);
+	free(binary);
+
+	/* Binary results number the host names in the order of the search job; groups follow their host names */
+	result = perform_job(&job_state, 1, 0, SEARCH_RESULT_FORMAT_BINARY, NULL, test_job, strlen(test_job), &result_len);
+	const struct binary_search_result_entry expected_entries[] = {
+		{ BINARY_SEARCH_RESULT_STATE, 0, TEST_NUMBER_OF_FILTERS, 1000 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 0 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 1 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 2 },
+		{ BINARY_SEARCH_RESULT_GROUP, 0, 4, 1 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 3 },
+		{ BINARY_SEARCH_RESULT_GROUP, 0, 0, 2 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 6 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 7 },
+		{ BINARY_SEARCH_RESULT_GROUP, 0, 4, 4 },
+	};
+	struct binary_search_result_header header;
+	ck_assert_uint_eq(result_len, sizeof(header) + sizeof(expected_entries));
+	memcpy(&header, result, sizeof(header));
+	ck_assert_mem_eq(header.file_magic, BINARY_SEARCH_RESULT_FILE_MAGIC, sizeof(header.file_magic));
+	ck_assert_uint_eq(header.major_version, CURRENT_BINARY_SEARCH_RESULT_MAJOR_VERSION);
+	ck_assert_mem_eq(result + sizeof(header), expected_entries, sizeof(expected_entries));
+	free(result);
+
+	honas_state_destroy(&state);
+}
+END_TEST
+
+START_TEST(test_search_job_entities)
+{
+	honas_state_t state;
+	create_state(&state, TEST_NUMBER_OF_BITS_PER_FILTER, 1000, "netSURF", test_host_names + 2, 1);
+	struct search_job_state job_state = { &state, false, NULL, NULL, false };
+	const char* entity_names[] = { "netSURF", "other" };
+	struct search_job_entities entities = { entity_names, 2 };
+
+	/* Only the variants with hits are reported, right after their host name; these don't count for the group */
+	const char* job = "{\"groups\":["
+		"{\"id\":1,\"names\":[\"sidn.nl\",\"surfnet.nl\"]},"
+		"{\"id\":2,\"names\":[\"surfnet.nl\"]},"
+		"{\"id\":3,\"names\":[\"other@sidn.nl\",\"netSURF@SIDN.nl\"]}"
+		"]}";
+	char* result = perform(&job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, &entities, job);
+	ck_assert_str_eq(result, CSV_HEADER
+		"1000,1,sidn.nl,4,0\n"
+		"1000,1,netSURF@sidn.nl,4,0\n"
+		"1000,3,netSURF@SIDN.nl,4,0\n");
+	free(result);
+
+	/* Without entities only the explicit variants are checked */
+	result = perform(&job_state, 1, 0, SEARCH_RESULT_FORMAT_CSV, NULL, job);
+	ck_assert_str_eq(result, CSV_HEADER
+		"1000,1,sidn.nl,4,0\n"
+		"1000,3,netSURF@SIDN.nl,4,0\n");
+	free(result);
+
+	/* In binary results the variants are numbered right after their host name */
+	size_t result_len;
+	result = perform_job(&job_state, 1, 0, SEARCH_RESULT_FORMAT_BINARY, &entities, job, strlen(job), &result_len);
+	const struct binary_search_result_entry expected_entries[] = {
+		{ BINARY_SEARCH_RESULT_STATE, 0, TEST_NUMBER_OF_FILTERS, 1000 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 0 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 1 },
+		{ BINARY_SEARCH_RESULT_GROUP, 0, 0, 1 },
+		{ BINARY_SEARCH_RESULT_HOST_NAME, 0, 4, 10 },
+		{ BINARY_SEARCH_RESULT_GROUP, 0, 0, 3 },
+	};
+	ck_assert_uint_eq(result_len, sizeof(struct binary_search_result_header) + sizeof(expected_entries));
+	ck_assert_mem_eq(result + sizeof(struct binary_search_result_header), expected_entries, sizeof(expected_entries));
+	free(result);
+
+	honas_state_destroy(&state);
+}
+END_TEST
+
+START_TEST(test_search_job_duplicate_host_names)
+{
+	honas_state_t state;
+	create_state(&state, TEST_NUMBER_OF_BITS_PER_FILTER, 1000, "netSURF", test_host_names, 3);
+	struct search_job_state job_state = { &state, false, NULL, NULL, false };
+	const char* entity_names[] = { "netSURF" };
+	struct search_job_entities entities = { entity_names, 1 };
+
+	/* Host names that occur again, also in later batches, are reported just like their first occurrence */
+	char* job;
+	size_t job_len;
+	FILE* fh = open_memstream(&job, &job_len);
+	ck_assert_ptr_ne(fh, NULL);
+	fprintf(fh, "{\"groups\":[{\"id\":1,\"names\":[\"surfnet.nl\",\"unknown.example.org\",\"surfnet.nl\"]},{\"id\":2,\"names\":[");
+	for (size_t i = 0; i < SEARCH_BATCH_SIZE; i++)
+		fprintf(fh, "%s\"host%zu.example.net\"", i > 0 ? "," : "", i % 100);
+	fprintf(fh, "]},{\"id\":3,\"names\":[\"sidn.nl\",\"unknown.example.org\"]},{\"id\":4,\"names\":[\"sidn.nl\",\"surfnet.nl\"]}]}");
+	ck_assert_int_eq(fclose(fh), 0);
+
+	for (unsigned int nr_threads = 0; nr_threads <= 2; nr_threads += 2) {
+		size_t result_len;
+		char* result = perform_job(&job_state, 1, nr_threads, SEARCH_RESULT_FORMAT_CSV, &entities, job, job_len, &result_len);
+		ck_assert_str_eq(result, CSV_HEADER
+			"1000,1,surfnet.nl,4,0\n"
+			"1000,1,netSURF@surfnet.nl,4,0\n"
+			"1000,1,surfnet.nl,4,0\n"
+			"1000,1,netSURF@surfnet.nl,4,0\n"
+			"1000,3,sidn.nl,4,0\n"
+			"1000,3,netSURF@sidn.nl,4,0\n"
+			"1000,4,sidn.nl,4,4\n"
+			"1000,4,netSURF@sidn.nl,4,4\n"
+			"1000,4,surfnet.nl,4,4\n"
+			"1000,4,netSURF@surfnet.nl,4,4\n");
+		free(result);
+	}
+
+	free(job);
+	honas_state_destroy(&state);
+}
+END_TEST
+
+START_TEST(test_search_job_coarse_states)
+{
+	/* Hourly states, a daily state combined from these and a weekly state covering the daily state */
+	honas_state_t hourly[4], daily = { 0 }, weekly = { 0 };
+	honas_state_t* sources[4];
+	for (int h = 0; h < 4; h++) {
+		create_many_state(&hourly[h], 1000 + h * 3600, h * 5);
+		sources[h] = &hourly[h];
+	}
+	ck_assert_int_eq(honas_state_combine_all(&daily, sources, 4, 0), 0);
+	ck_assert_int_eq(honas_state_combine_all(&weekly, sources, 4, 0), 0);
+	struct search_job_state weekly_job_state = { &weekly, false, NULL, NULL, false };
+	struct search_job_state daily_job_state = { &daily, false, NULL, &weekly_job_state, false };
+	struct search_job_state job_states[4];
+	for (int h = 0; h < 4; h++)
+		job_states[h] = (struct search_job_state) { &hourly[h], false, NULL, NULL, false };
+	size_t job_len;
+	char* job = many_host_names_job(&job_len);
+
+	/* Drilling down from the coarse states gives the same results as searching all hourly states */
+	size_t expected_len;
+	char* expected = perform_job(job_states, 4, 0, SEARCH_RESULT_FORMAT_JSON, NULL, job, job_len, &expected_len);
+	ck_assert_ptr_ne(strstr(expected, "\"host112.example.net\":4"), NULL);
+	for (int h = 0; h < 4; h++)
+		job_states[h].covered_by = &daily_job_state;
+	for (unsigned int nr_threads = 0; nr_threads <= 2; nr_threads += 2) {
+		size_t result_len;
+		char* result = perform_job(job_states, 4, nr_threads, SEARCH_RESULT_FORMAT_JSON, NULL, job, job_len, &result_len);
+		ck_assert_uint_eq(result_len, expected_len);
+		ck_assert_mem_eq(result, expected, expected_len);
+		free(result);
+	}
+	free(expected);
+
+	/* Host names that aren't contained by a covering state aren't checked against the states it covers */
+	honas_state_t empty;
+	create_state(&empty, TEST_NUMBER_OF_BITS_PER_FILTER, 1000, NULL, NULL, 0);
+	struct search_job_state empty_job_state = { &empty, false, NULL, NULL, false };
+	const char* drill_down_job = "{\"groups\":[{\"id\":1,\"names\":[\"host0.example.net\",\"host5.example.net\"]}]}";
+	job_states[0].covered_by = &empty_job_state;
+	char* result = perform(job_states, 2, 0, SEARCH_RESULT_FORMAT_CSV, NULL, drill_down_job);
+	ck_assert_str_eq(result, CSV_HEADER "4600,1,host5.example.net,4,0\n");
+	free(result);
+	weekly_job_state.covered_by = &empty_job_state;
+	result = perform(job_states, 2, 0, SEARCH_RESULT_FORMAT_CSV, NULL, drill_down_job);
+	ck_assert_str_eq(result, CSV_HEADER);
+	free(result);
+
+	honas_state_destroy(&empty);
+	free(job);
+	honas_state_destroy(&weekly);
+	honas_state_destroy(&daily);
+	for (int h = 0; h < 4; h++)
+		honas_state_destroy(&hourly[h]);
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_search_job_results);
+	tcase_add_test(tc_core, test_search_job_threads);
+	tcase_add_test(tc_core, test_search_job_shared_offsets);
+	tcase_add_test(tc_core, test_search_job_compiled);
+	tcase_add_test(tc_core, test_search_job_binary);
+	tcase_add_test(tc_core, test_search_job_entities);
+	tcase_add_test(tc_core, test_search_job_duplicate_host_names);
+	tcase_add_test(tc_core, test_search_job_coarse_states);
+
+	Suite* s = suite_create("Search job");
+	suite_add_tcase(s, tc_core);
+	return s;
+}
@@ -25,10 +25,14 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "bloom.h"
 #include "honas_state.h"
+#include "sealed_state.h"
+#include "state_combine.h"
 
 #include <check.h>
 #include <openssl/sha.h>
+#include <pthread.h>
 #include <ldns/ldns.h>
 
 #define SHA256_STRING_LENGTH	64
@@ -220,10 +224,925 @@ START_TEST(test_aggregate_states)
 }
 END_TEST
 
+/* Checks host names in a (shared) sealed state over and over, counting the results that differ */
+struct sealed_check_thread {
+	honas_state_t* state;
+	const uint8_t (*host_name_hashes)[SHA256_DIGEST_LENGTH];
+	const uint32_t* expected;
+	size_t nr_host_names;
+	uint32_t mismatches;
+};
+
+static void* sealed_check_thread(void* arg)
+{
+	struct sealed_check_thread* check = (struct sealed_check_thread*)arg;
+	for (size_t round = 0; round < 500; round++) {
+		for (size_t i = 0; i < check->nr_host_names; i++) {
+			if (honas_state_check_host_name_lookups(check->state, byte_slice((uint8_t*)check->host_name_hashes[i], SHA256_DIGEST_LENGTH), NULL) != check->expected[i])
+				check->mismatches++;
+		}
+	}
+	return NULL;
+}
+
+START_TEST(test_aggregate_sealed_state)
+{
+	const char* sealed_state_file = "test_sealed_state.hs";
+	const char* host_names[] = { "google.com", "surfnet.nl", "unbound.prutsnet.nl", "example.org" };
+	honas_state_t state = { 0 };
+	honas_state_t sealed_state = { 0 };
+	honas_state_t target_state = { 0 };
+	honas_state_t unsealed_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+
+	// Create a state with a few domain names, all but the last one.
+	honas_state_create(&state, 2, 1024 * 1024, 10, 1, 1);
+	for (size_t i = 0; i < 3; i++)
+		honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_names[i]
+			, strlen(host_names[i]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+
+	// Seal the state using small blocks (so they don't all fit in the block cache) and load it again.
+	unlink(sealed_state_file);
+	ck_assert_int_eq(honas_sealed_state_write(&state, sealed_state_file, 1024, UINT32_MAX, NULL), 0);
+	ck_assert_int_eq(honas_state_load(&sealed_state, sealed_state_file, true), 0);
+	ck_assert(sealed_state.sealed != NULL);
+	ck_assert_int_eq(sealed_state.header->number_of_requests, 3);
+
+	// The sealed state should give the same results as the original state.
+	uint8_t bytes[SHA256_DIGEST_LENGTH];
+	for (size_t i = 0; i < 4; i++) {
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes);
+		const uint32_t original = honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL);
+		const uint32_t sealed = honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(bytes), NULL);
+		ck_assert_int_eq(original, sealed);
+		if (i < 3)
+			ck_assert_int_gt(sealed, 0);
+		else
+			ck_assert_int_eq(sealed, 0);
+	}
+	ck_assert(sealed_state.sealed->block_probes > 0);
+
+	// Concurrent threads can check host names in the same sealed state.
+	uint8_t host_name_hashes[4][SHA256_DIGEST_LENGTH];
+	uint32_t expected[4];
+	for (size_t i = 0; i < 4; i++) {
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), host_name_hashes[i]);
+		expected[i] = honas_state_check_host_name_lookups(&state, byte_slice_from_array(host_name_hashes[i]), NULL);
+	}
+	pthread_t threads[4];
+	struct sealed_check_thread checks[4];
+	for (size_t i = 0; i < 4; i++) {
+		checks[i] = (struct sealed_check_thread){ &sealed_state, (const uint8_t(*)[SHA256_DIGEST_LENGTH])host_name_hashes, expected, 4, 0 };
+		ck_assert_int_eq(pthread_create(&threads[i], NULL, sealed_check_thread, &checks[i]), 0);
+	}
+	for (size_t i = 0; i < 4; i++) {
+		ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+		ck_assert_uint_eq(checks[i].mismatches, 0);
+	}
+	ck_assert(!honas_state_has_errors(&sealed_state));
+
+	// Aggregating the sealed state into an empty state should result in the original filters.
+	honas_state_create(&target_state, 2, 1024 * 1024, 10, 1, 1);
+	ck_assert(honas_state_aggregate_combine(&target_state, &sealed_state) == true);
+	for (uint32_t i = 0; i < 2; i++)
+		ck_assert(memcmp(target_state.filters[i].bytes, state.filters[i].bytes, state.filters[i].len) == 0);
+
+	// A sealed state can't be the target of an aggregation.
+	ck_assert(honas_state_aggregate_combine(&sealed_state, &target_state) == false);
+
+	// Loading the sealed state read-write unseals it entirely.
+	ck_assert_int_eq(honas_state_load(&unsealed_state, sealed_state_file, false), 0);
+	ck_assert(unsealed_state.sealed == NULL);
+	ck_assert_int_eq(unsealed_state.header->number_of_requests, 3);
+	for (uint32_t i = 0; i < 2; i++)
+		ck_assert(memcmp(unsealed_state.filters[i].bytes, state.filters[i].bytes, state.filters[i].len) == 0);
+
+	// Destroy the states.
+	honas_state_destroy(&state);
+	honas_state_destroy(&sealed_state);
+	honas_state_destroy(&target_state);
+	honas_state_destroy(&unsealed_state);
+	unlink(sealed_state_file);
+}
+END_TEST
+
+START_TEST(test_interleaved_sealed_state)
+{
+	const char* state_file = "test_interleaved_state.hs";
+	const char* sealed_state_file = "test_interleaved_sealed_state.hs";
+	const uint32_t nr_filters = 16;
+	const uint32_t nr_hashes = 10;
+	const uint32_t block_size = 4096;
+	honas_state_t state = { 0 };
+	honas_state_t per_filter_state = { 0 };
+	honas_state_t loaded_state = { 0 };
+	honas_state_t sealed_state = { 0 };
+	honas_state_t target_state = { 0 };
+	honas_state_t unsealed_state = { 0 };
+	honas_state_t folded_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+
+	// Create a state with shared blocks; the block size has to divide the filters.
+	honas_state_create(&state, nr_filters, 1024 * 1024, nr_hashes, 3, 1);
+	ck_assert_int_eq(honas_state_use_shared_blocks(&state, 100), -1);
+	ck_assert_int_eq(honas_state_use_shared_blocks(&state, 256 * 1024), -1);
+	ck_assert_int_eq(honas_state_use_shared_blocks(&state, block_size), 0);
+	ck_assert_uint_eq(state.shared_block_size, block_size);
+	char host_names[100][32];
+	for (size_t i = 0; i < 100; i++) {
+		snprintf(host_names[i], sizeof(host_names[i]), "host%zu.example.net", i);
+		client.in.addr4.s_addr = htonl(0x0a000000 + i);
+		honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_names[i]
+			, strlen(host_names[i]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	}
+
+	// The bit offsets of all filters lie in the same block, but differ within the block.
+	uint8_t bytes[SHA256_DIGEST_LENGTH];
+	size_t bit_offsets[nr_filters * nr_hashes];
+	SHA256((uint8_t*)host_names[0], strlen(host_names[0]), bytes);
+	honas_state_host_name_offsets(&state, byte_slice_from_array(bytes), bit_offsets);
+	for (uint32_t i = 0; i < nr_filters * nr_hashes; i++)
+		ck_assert_uint_eq(bit_offsets[i] / (block_size * 8), bit_offsets[0] / (block_size * 8));
+	for (uint32_t i = 1; i < nr_filters; i++)
+		ck_assert(memcmp(bit_offsets + i * nr_hashes, bit_offsets, nr_hashes * sizeof(size_t)) != 0);
+	honas_state_create(&per_filter_state, nr_filters, 1024 * 1024, nr_hashes, 3, 1);
+	ck_assert(!honas_state_offsets_compatible(&state, &per_filter_state));
+	ck_assert(!honas_state_combinable(&state, &per_filter_state));
+
+	// The shared block size survives persisting the state.
+	unlink(state_file);
+	state.summary_size = 4096;
+	honas_state_persist(&state, state_file, true);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_uint_eq(loaded_state.shared_block_size, block_size);
+	ck_assert_ptr_ne(honas_state_find_section(&loaded_state, HONAS_STATE_SECTION_OFFSET_SCHEME, 0), NULL);
+	ck_assert(honas_state_offsets_compatible(&state, &loaded_state));
+
+	// Sealing the state interleaves the shared blocks of its filters.
+	struct honas_sealed_state_write_stats stats = { 0 };
+	unlink(sealed_state_file);
+	ck_assert_int_eq(honas_sealed_state_write(&loaded_state, sealed_state_file, 1024, UINT32_MAX, &stats), 0);
+	ck_assert_uint_eq(stats.summary_size, 4096);
+	ck_assert_int_eq(honas_state_load(&sealed_state, sealed_state_file, true), 0);
+	ck_assert(sealed_state.sealed != NULL);
+	ck_assert_uint_eq(sealed_state.shared_block_size, block_size);
+	ck_assert_uint_eq(sealed_state.sealed->header->major_version, INTERLEAVED_HONAS_SEALED_STATE_MAJOR_VERSION);
+	ck_assert(sealed_state.sealed->header->flags & HONAS_SEALED_STATE_FLAG_INTERLEAVED);
+	ck_assert_uint_eq(sealed_state.sealed->header->block_size, block_size);
+	uint32_t blocks_per_filter = sealed_state.sealed->header->blocks_per_filter;
+	for (uint32_t i = 1; i < nr_filters; i++) {
+		const struct honas_sealed_state_block* previous = &sealed_state.sealed->blocks[(i - 1) * blocks_per_filter + 1];
+		ck_assert_uint_eq(sealed_state.sealed->blocks[i * blocks_per_filter + 1].offset, previous->offset + previous->size);
+	}
+
+	// The sealed state should give the same results as the original state, for the same filters.
+	bitset_t original_hit, sealed_hit;
+	bitset_create(&original_hit, nr_filters);
+	bitset_create(&sealed_hit, nr_filters);
+	for (size_t i = 0; i < 200; i++) {
+		char host_name[32];
+		snprintf(host_name, sizeof(host_name), "host%zu.example.net", i);
+		SHA256((uint8_t*)host_name, strlen(host_name), bytes);
+		bitset_clear(&original_hit);
+		bitset_clear(&sealed_hit);
+		const uint32_t original = honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), &original_hit);
+		const uint32_t sealed = honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(bytes), &sealed_hit);
+		ck_assert_int_eq(original, sealed);
+		for (uint32_t f = 0; f < nr_filters; f++)
+			ck_assert(bitset_bit_is_set(&original_hit, f) == bitset_bit_is_set(&sealed_hit, f));
+		if (i < 100)
+			ck_assert_int_ge(sealed, 3);
+	}
+	ck_assert(!honas_state_has_errors(&sealed_state));
+	bitset_destroy(&original_hit);
+	bitset_destroy(&sealed_hit);
+
+	// Aggregating the sealed state only works into a state with the same shared blocks.
+	ck_assert(honas_state_aggregate_combine(&per_filter_state, &sealed_state) == false);
+	honas_state_create(&target_state, nr_filters, 1024 * 1024, nr_hashes, 3, 1);
+	ck_assert_int_eq(honas_state_use_shared_blocks(&target_state, block_size), 0);
+	ck_assert(honas_state_aggregate_combine(&target_state, &sealed_state) == true);
+	for (uint32_t i = 0; i < nr_filters; i++)
+		ck_assert(memcmp(target_state.filters[i].bytes, state.filters[i].bytes, state.filters[i].len) == 0);
+
+	// Loading the sealed state read-write unseals it into a state with shared blocks.
+	ck_assert_int_eq(honas_state_load(&unsealed_state, sealed_state_file, false), 0);
+	ck_assert(unsealed_state.sealed == NULL);
+	ck_assert_uint_eq(unsealed_state.shared_block_size, block_size);
+	for (uint32_t i = 0; i < nr_filters; i++)
+		ck_assert(memcmp(unsealed_state.filters[i].bytes, state.filters[i].bytes, state.filters[i].len) == 0);
+
+	// The filters can be folded down to the shared block size, but no further.
+	ck_assert_int_eq(honas_state_fold(&folded_state, &sealed_state, 6), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	ck_assert_int_eq(honas_state_fold(&folded_state, &sealed_state, 5), 0);
+	ck_assert_uint_eq(folded_state.shared_block_size, block_size);
+	for (size_t i = 0; i < 100; i++) {
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes);
+		ck_assert_int_ge(honas_state_check_host_name_lookups(&folded_state, byte_slice_from_array(bytes), NULL), 3);
+	}
+
+	// Destroy the states.
+	honas_state_destroy(&state);
+	honas_state_destroy(&per_filter_state);
+	honas_state_destroy(&loaded_state);
+	honas_state_destroy(&sealed_state);
+	honas_state_destroy(&target_state);
+	honas_state_destroy(&unsealed_state);
+	honas_state_destroy(&folded_state);
+	unlink(state_file);
+	unlink(sealed_state_file);
+}
+END_TEST
+
+START_TEST(test_combine_all_states)
+{
+	const char* host_names[] = { "google.com", "surfnet.nl", "unbound.prutsnet.nl", "example.org" };
+	honas_state_t states[3] = { { 0 } };
+	honas_state_t* sources[3] = { &states[0], &states[1], &states[2] };
+	honas_state_t aggregated_state = { 0 };
+	honas_state_t threaded_state = { 0 };
+	honas_state_t unthreaded_state = { 0 };
+	honas_state_t other_state = { 0 };
+	honas_state_t other_result = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+
+	// Create three states with filters spanning multiple chunks, each with a different domain name.
+	for (size_t i = 0; i < 3; i++) {
+		honas_state_create(&states[i], 2, STATE_COMBINE_CHUNK_SIZE * 8 * 3, 10, 1, 1);
+		states[i].header->period_begin = 1000 + i * 3600;
+		states[i].header->period_end = 1000 + (i + 1) * 3600;
+		honas_state_register_host_name_lookup(&states[i], time(NULL), &client, (uint8_t*)host_names[i]
+			, strlen(host_names[i]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	}
+
+	// Combining all at once should give the same filters as aggregating them one by one.
+	honas_state_create(&aggregated_state, 2, STATE_COMBINE_CHUNK_SIZE * 8 * 3, 10, 1, 1);
+	for (size_t i = 0; i < 3; i++)
+		ck_assert(honas_state_aggregate_combine(&aggregated_state, &states[i]) == true);
+	for (uint32_t i = 0; i < 2; i++)
+		ck_assert_uint_eq(aggregated_state.filter_bits_set[i], bloom_nr_bits_set(aggregated_state.filters[i]));
+	ck_assert_int_eq(honas_state_combine_all(&threaded_state, sources, 3, 4), 0);
+	ck_assert_int_eq(honas_state_combine_all(&unthreaded_state, sources, 3, 0), 0);
+	for (uint32_t i = 0; i < 2; i++) {
+		ck_assert(memcmp(threaded_state.filters[i].bytes, aggregated_state.filters[i].bytes, aggregated_state.filters[i].len) == 0);
+		ck_assert(memcmp(unthreaded_state.filters[i].bytes, aggregated_state.filters[i].bytes, aggregated_state.filters[i].len) == 0);
+		ck_assert_uint_eq(threaded_state.filter_bits_set[i], bloom_nr_bits_set(aggregated_state.filters[i]));
+	}
+	ck_assert_int_eq(threaded_state.header->number_of_requests, 3);
+	ck_assert_int_eq(threaded_state.header->period_begin, 1000);
+	ck_assert_int_eq(threaded_state.header->period_end, 1000 + 3 * 3600);
+
+	// All domain names but the last one should be present.
+	uint8_t bytes[SHA256_DIGEST_LENGTH];
+	for (size_t i = 0; i < 4; i++) {
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes);
+		if (i < 3)
+			ck_assert_int_gt(honas_state_check_host_name_lookups(&threaded_state, byte_slice_from_array(bytes), NULL), 0);
+		else
+			ck_assert_int_eq(honas_state_check_host_name_lookups(&threaded_state, byte_slice_from_array(bytes), NULL), 0);
+	}
+
+	// States with a different filter configuration can't be combined.
+	honas_state_create(&other_state, 2, 1024 * 1024, 10, 1, 1);
+	sources[1] = &other_state;
+	ck_assert_int_eq(honas_state_combine_all(&other_result, sources, 3, 4), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	// Destroy the states.
+	for (size_t i = 0; i < 3; i++)
+		honas_state_destroy(&states[i]);
+	honas_state_destroy(&aggregated_state);
+	honas_state_destroy(&threaded_state);
+	honas_state_destroy(&unthreaded_state);
+	honas_state_destroy(&other_state);
+}
+END_TEST
+
+START_TEST(test_sealed_state_corrupt_block)
+{
+	const char* sealed_state_file = "test_corrupt_sealed_state.hs";
+	const char* host_names[] = { "google.com", "surfnet.nl" };
+	honas_state_t state = { 0 };
+	honas_state_t sealed_state = { 0 };
+	honas_state_t target_state = { 0 };
+	honas_state_t unsealed_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+
+	honas_state_create(&state, 2, 1024 * 1024, 10, 1, 1);
+	for (size_t i = 0; i < 2; i++)
+		honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_names[i]
+			, strlen(host_names[i]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	unlink(sealed_state_file);
+	ck_assert_int_eq(honas_sealed_state_write(&state, sealed_state_file, 1024, UINT32_MAX, NULL), 0);
+
+	// Damage the compressed data of the block of filter 0 that holds the first bit of the first host name.
+	uint8_t bytes[SHA256_DIGEST_LENGTH];
+	size_t bit_offsets[2 * 10];
+	SHA256((uint8_t*)host_names[0], strlen(host_names[0]), bytes);
+	honas_state_host_name_offsets(&state, byte_slice_from_array(bytes), bit_offsets);
+	struct honas_sealed_state_file_header header;
+	struct honas_sealed_state_block block;
+	int fd = open(sealed_state_file, O_RDWR);
+	ck_assert_int_ne(fd, -1);
+	ck_assert_int_eq(pread(fd, &header, sizeof(header), 0), sizeof(header));
+	ck_assert(header.flags & HONAS_SEALED_STATE_FLAG_BLOCK_CHECKSUMS);
+	uint64_t block_offset = header.block_index_offset + (bit_offsets[0] / (header.block_size * 8)) * sizeof(block);
+	ck_assert_int_eq(pread(fd, &block, sizeof(block), block_offset), sizeof(block));
+	uint8_t byte;
+	ck_assert_int_eq(pread(fd, &byte, 1, block.offset), 1);
+	byte ^= 0x5a;
+	ck_assert_int_eq(pwrite(fd, &byte, 1, block.offset), 1);
+	close(fd);
+
+	// Checking the host name reports the state as having errors instead of ending the process.
+	ck_assert_int_eq(honas_state_load(&sealed_state, sealed_state_file, true), 0);
+	SHA256((uint8_t*)host_names[1], strlen(host_names[1]), bytes);
+	ck_assert_int_eq(honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(bytes), NULL)
+		, honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL));
+	ck_assert(!honas_state_has_errors(&sealed_state));
+	SHA256((uint8_t*)host_names[0], strlen(host_names[0]), bytes);
+	ck_assert_int_le(honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(bytes), NULL), 1);
+	ck_assert(honas_state_has_errors(&sealed_state));
+
+	// Aggregating or unsealing the state fails.
+	honas_state_create(&target_state, 2, 1024 * 1024, 10, 1, 1);
+	ck_assert(honas_state_aggregate_combine(&target_state, &sealed_state) == false);
+	for (size_t i = 0; i < target_state.filters[0].len; i++)
+		ck_assert_int_eq(target_state.filters[0].bytes[i], 0);
+	ck_assert_int_eq(honas_state_load(&unsealed_state, sealed_state_file, false), 2);
+
+	honas_state_destroy(&state);
+	honas_state_destroy(&sealed_state);
+	honas_state_destroy(&target_state);
+	unlink(sealed_state_file);
+}
+END_TEST
+
+START_TEST(test_fold_state)
+{
+	const char* folded_state_file = "test_folded_state.hs";
+	const char* host_names[] = { "google.com", "surfnet.nl", "unbound.prutsnet.nl", "example.org" };
+	honas_state_t state = { 0 };
+	honas_state_t folded_state = { 0 };
+	honas_state_t refolded_state = { 0 };
+	honas_state_t loaded_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+
+	// Create a state with a few domain names, all but the last one.
+	honas_state_create(&state, 2, 1024 * 1024, 10, 1, 1);
+	for (size_t i = 0; i < 3; i++)
+		honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_names[i]
+			, strlen(host_names[i]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+
+	// Fold the state 4 times, which should make the filters 16 times smaller.
+	ck_assert_int_eq(honas_state_fold(&folded_state, &state, 4), 0);
+	ck_assert_uint_eq(folded_state.fold_factor, 4);
+	ck_assert_uint_eq(folded_state.header->number_of_bits_per_filter, 1024 * 1024);
+	ck_assert_uint_eq(folded_state.filters[0].len, (1024 * 1024 / 8) >> 4);
+	ck_assert_int_eq(folded_state.header->number_of_requests, 3);
+
+	// The folded state should still find all domain names.
+	uint8_t bytes[SHA256_DIGEST_LENGTH];
+	for (size_t i = 0; i < 4; i++) {
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes);
+		const uint32_t original = honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL);
+		const uint32_t folded = honas_state_check_host_name_lookups(&folded_state, byte_slice_from_array(bytes), NULL);
+		if (i < 3)
+			ck_assert_int_eq(original, folded);
+		else
+			ck_assert_int_eq(original, 0);
+	}
+
+	// Registering a domain name in the folded state should work just like in the original state.
+	honas_state_register_host_name_lookup(&folded_state, time(NULL), &client, (uint8_t*)host_names[3]
+		, strlen(host_names[3]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	SHA256((uint8_t*)host_names[3], strlen(host_names[3]), bytes);
+	ck_assert_int_gt(honas_state_check_host_name_lookups(&folded_state, byte_slice_from_array(bytes), NULL), 0);
+
+	// States with a different fold factor can't be aggregated, and states can't be unfolded.
+	ck_assert(honas_state_aggregate_combine(&folded_state, &state) == false);
+	ck_assert_int_eq(honas_state_fold(&refolded_state, &folded_state, 3), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	ck_assert_int_eq(honas_state_fold(&refolded_state, &folded_state, 5), 0);
+	ck_assert_uint_eq(refolded_state.filters[0].len, folded_state.filters[0].len / 2);
+
+	// The fold factor should be saved along with the state.
+	unlink(folded_state_file);
+	honas_state_persist(&folded_state, folded_state_file, true);
+	ck_assert_int_eq(honas_state_load(&loaded_state, folded_state_file, true), 0);
+	ck_assert_uint_eq(loaded_state.fold_factor, 4);
+	ck_assert_int_gt(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes), NULL), 0);
+	ck_assert(honas_state_aggregate_combine(&refolded_state, &loaded_state) == false);
+
+	// Destroy the states.
+	honas_state_destroy(&state);
+	honas_state_destroy(&folded_state);
+	honas_state_destroy(&refolded_state);
+	honas_state_destroy(&loaded_state);
+	unlink(folded_state_file);
+}
+END_TEST
+
+START_TEST(test_state_file_sections)
+{
+	const char* state_file = "test_sections_state.hs";
+	const char* legacy_state_file = "test_legacy_state.hs";
+	const char* host_name = "surfnet.nl";
+	honas_state_t state = { 0 };
+	honas_state_t loaded_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+	uint8_t bytes[SHA256_DIGEST_LENGTH];
+	SHA256((uint8_t*)host_name, strlen(host_name), bytes);
+
+	// New states are version 2 states with a section for each filter and the other data.
+	honas_state_create(&state, 3, 1024 * 1024, 10, 1, 1);
+	honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_name, strlen(host_name), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	ck_assert_uint_eq(state.header->major_version, 2);
+	ck_assert_uint_eq(state.section_table->number_of_sections, 7);
+	ck_assert_ptr_eq(honas_state_section_data(&state, honas_state_find_section(&state, HONAS_STATE_SECTION_FILTER, 2)).bytes, state.filters[2].bytes);
+	ck_assert_ptr_eq(honas_state_find_section(&state, HONAS_STATE_SECTION_FILTER, 3), NULL);
+	ck_assert_uint_eq((size_t)state.filters[0].bytes % PAGE_SIZE, 0);
+	ck_assert_uint_eq((size_t)state.client_count_registers.bytes % PAGE_SIZE, 0);
+
+	// Persisting a state adds checksums for all sections.
+	unlink(state_file);
+	honas_state_persist(&state, state_file, true);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert(honas_state_get_section(&loaded_state, 0)->flags & HONAS_STATE_SECTION_FLAG_CHECKSUM);
+	ck_assert_uint_eq(honas_state_verify_sections(&loaded_state), 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes), NULL), 1);
+	honas_state_destroy(&loaded_state);
+
+	// Corrupting the data of a section should be detected.
+	int fd = open(state_file, O_RDWR);
+	ck_assert_int_ne(fd, -1);
+	const struct honas_state_section* filter_section = honas_state_find_section(&state, HONAS_STATE_SECTION_FILTER, 1);
+	uint8_t corrupt = state.filters[1].bytes[0] ^ 0x1;
+	ck_assert_int_eq(pwrite(fd, &corrupt, 1, filter_section->offset), 1);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_uint_eq(honas_state_verify_sections(&loaded_state), 1);
+	honas_state_destroy(&loaded_state);
+
+	// Sections of unknown types are skipped, unless they are required.
+	struct honas_state_section_table table = { state.section_table->number_of_sections + 1, sizeof(struct honas_state_section) };
+	struct honas_state_section sections[8];
+	memcpy(sections, state.section_table + 1, sizeof(struct honas_state_section) * 7);
+	sections[0].offset = 2048;
+	sections[7] = (struct honas_state_section){ 1000, 0, 3072, 16, 0, 0 };
+	ck_assert_int_eq(pwrite(fd, state.filter_bits_set, sizeof(uint32_t) * 3, 2048), sizeof(uint32_t) * 3);
+	ck_assert_int_eq(pwrite(fd, &table, sizeof(table), sizeof(struct honas_state_file_header)), sizeof(table));
+	ck_assert_int_eq(pwrite(fd, sections, sizeof(sections), sizeof(struct honas_state_file_header) + sizeof(table)), sizeof(sections));
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_ptr_eq(loaded_state.filter_bits_set, (uint32_t*)((uint8_t*)loaded_state.mmap + 2048));
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes), NULL), 1);
+	honas_state_destroy(&loaded_state);
+	sections[7].flags = HONAS_STATE_SECTION_FLAG_REQUIRED;
+	ck_assert_int_eq(pwrite(fd, sections, sizeof(sections), sizeof(struct honas_state_file_header) + sizeof(table)), sizeof(sections));
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 2);
+	close(fd);
+
+	// Version 1 state files should still be loaded.
+	const uint32_t filter_size = state.filters[0].len;
+	struct honas_state_file_header header = *state.header;
+	header.major_version = 1;
+	header.minor_version = 0;
+	header.first_filter_offset = PAGE_SIZE;
+	header.padding_after_filters = 0;
+	header.padding_after_client_hll = 0;
+	header.padding_after_host_name_hll = 0;
+	unlink(legacy_state_file);
+	fd = open(legacy_state_file, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	ck_assert_int_ne(fd, -1);
+	ck_assert_int_eq(pwrite(fd, &header, sizeof(header), 0), sizeof(header));
+	ck_assert_int_eq(pwrite(fd, state.filter_bits_set, sizeof(uint32_t) * 3, sizeof(header)), sizeof(uint32_t) * 3);
+	for (uint32_t i = 0; i < 3; i++)
+		ck_assert_int_eq(pwrite(fd, state.filters[i].bytes, filter_size, PAGE_SIZE + i * filter_size), filter_size);
+	ck_assert_int_eq(pwrite(fd, state.client_count_registers.bytes, HLL_DENSE_SIZE, 3 * filter_size), HLL_DENSE_SIZE);
+	ck_assert_int_eq(pwrite(fd, state.host_name_count_registers.bytes, HLL_DENSE_SIZE, 3 * filter_size + HLL_DENSE_SIZE), HLL_DENSE_SIZE);
+	ck_assert_int_eq(ftruncate(fd, PAGE_SIZE + 3 * filter_size + 2 * HLL_DENSE_SIZE), 0);
+	close(fd);
+	ck_assert_int_eq(honas_state_load(&loaded_state, legacy_state_file, true), 0);
+	ck_assert_ptr_eq(loaded_state.section_table, NULL);
+	ck_assert_ptr_eq(honas_state_get_section(&loaded_state, 0), NULL);
+	ck_assert_uint_eq(loaded_state.fold_factor, 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes), NULL), 1);
+	honas_state_destroy(&loaded_state);
+
+	// Destroy the states.
+	honas_state_destroy(&state);
+	unlink(state_file);
+	unlink(legacy_state_file);
+}
+END_TEST
+
+START_TEST(test_state_summary)
+{
+	const char* state_file = "test_summary_state.hs";
+	const char* host_names[] = { "surfnet.nl", "www.example.com" };
+	honas_state_t state = { 0 };
+	honas_state_t loaded_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+	uint8_t bytes[2][SHA256_DIGEST_LENGTH];
+	for (int i = 0; i < 2; i++)
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes[i]);
+
+	// Persisting a state with a summary size adds a summary section of all filters folded.
+	honas_state_create(&state, 3, 1024 * 1024, 10, 1, 1);
+	honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_names[0], strlen(host_names[0]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	state.summary_size = 5000;
+	unlink(state_file);
+	honas_state_persist(&state, state_file, true);
+	ck_assert_uint_eq(state.section_table->number_of_sections, 7);
+	ck_assert_ptr_eq(honas_state_find_section(&state, HONAS_STATE_SECTION_SUMMARY, 0), NULL);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_uint_eq(loaded_state.section_table->number_of_sections, 8);
+	ck_assert_uint_eq(loaded_state.summary.len, 4096);
+	ck_assert_uint_eq((size_t)loaded_state.summary.bytes % PAGE_SIZE, 0);
+	ck_assert_uint_eq(honas_state_verify_sections(&loaded_state), 0);
+	uint8_t summary[4096] = { 0 };
+	for (uint32_t i = 0; i < 3; i++)
+		bloom_fold(byte_slice_from_array(summary), state.filters[i]);
+	ck_assert_int_eq(memcmp(loaded_state.summary.bytes, summary, sizeof(summary)), 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes[0]), NULL), 1);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes[1]), NULL), 0);
+
+	// The filters are only checked when the summary contains the bit offsets as well.
+	memset(summary, 0, sizeof(summary));
+	loaded_state.summary = byte_slice_from_array(summary);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes[0]), NULL), 0);
+	honas_state_destroy(&loaded_state);
+
+	// The summary of a state file that's loaded read-write isn't used, but updated when persisting.
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, false), 0);
+	ck_assert_uint_eq(loaded_state.summary.len, 0);
+	honas_state_register_host_name_lookup(&loaded_state, time(NULL), &client, (uint8_t*)host_names[1], strlen(host_names[1]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	unlink(state_file);
+	honas_state_persist(&loaded_state, state_file, true);
+	honas_state_destroy(&loaded_state);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_uint_eq(loaded_state.summary.len, 4096);
+	ck_assert_uint_eq(honas_state_verify_sections(&loaded_state), 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes[0]), NULL), 1);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&loaded_state, byte_slice_from_array(bytes[1]), NULL), 1);
+	honas_state_destroy(&loaded_state);
+
+	// No summary is added when most of its bits would be set.
+	memset(state.filters[1].bytes, 0xff, state.filters[1].len / 2);
+	unlink(state_file);
+	honas_state_persist(&state, state_file, true);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_ptr_eq(honas_state_find_section(&loaded_state, HONAS_STATE_SECTION_SUMMARY, 0), NULL);
+	ck_assert_uint_eq(loaded_state.summary.len, 0);
+	honas_state_destroy(&loaded_state);
+
+	// Destroy the state.
+	honas_state_destroy(&state);
+	unlink(state_file);
+}
+END_TEST
+
+START_TEST(test_sealed_state_summary)
+{
+	const char* state_file = "test_summary_state.hs";
+	const char* sealed_state_file = "test_summary_sealed_state.hs";
+	const char* host_names[] = { "surfnet.nl", "www.example.com" };
+	honas_state_t state = { 0 };
+	honas_state_t loaded_state = { 0 };
+	honas_state_t sealed_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	uint8_t bytes[2][SHA256_DIGEST_LENGTH];
+	for (int i = 0; i < 2; i++)
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes[i]);
+
+	honas_state_create(&state, 3, 1024 * 1024, 10, 1, 1);
+	honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_names[0], strlen(host_names[0]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	state.summary_size = 5000;
+	unlink(state_file);
+	honas_state_persist(&state, state_file, true);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_uint_eq(loaded_state.summary.len, 4096);
+
+	// Sealing a state file carries over its summary.
+	struct honas_sealed_state_write_stats stats = { 0 };
+	unlink(sealed_state_file);
+	ck_assert_int_eq(honas_sealed_state_write(&loaded_state, sealed_state_file, 1024, UINT32_MAX, &stats), 0);
+	ck_assert_uint_eq(stats.summary_size, 4096);
+	ck_assert_int_eq(honas_state_load(&sealed_state, sealed_state_file, true), 0);
+	ck_assert(sealed_state.sealed != NULL);
+	ck_assert_uint_eq(sealed_state.summary.len, 4096);
+	ck_assert_int_eq(memcmp(sealed_state.summary.bytes, loaded_state.summary.bytes, 4096), 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(bytes[0]), NULL), 1);
+
+	// Host names that the summary rules out don't touch any blocks.
+	const uint64_t blocks_touched = sealed_state.sealed->cache_hits + sealed_state.sealed->cache_misses + sealed_state.sealed->block_probes;
+	ck_assert_uint_gt(blocks_touched, 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(bytes[1]), NULL), 0);
+	ck_assert_uint_eq(sealed_state.sealed->cache_hits + sealed_state.sealed->cache_misses + sealed_state.sealed->block_probes, blocks_touched);
+	honas_state_destroy(&sealed_state);
+
+	// A state without a summary only gets one when a summary size is set.
+	state.summary_size = 0;
+	unlink(sealed_state_file);
+	ck_assert_int_eq(honas_sealed_state_write(&state, sealed_state_file, 1024, UINT32_MAX, &stats), 0);
+	ck_assert_uint_eq(stats.summary_size, 0);
+	ck_assert_int_eq(honas_state_load(&sealed_state, sealed_state_file, true), 0);
+	ck_assert_uint_eq(sealed_state.summary.len, 0);
+	ck_assert(!(sealed_state.sealed->header->flags & HONAS_SEALED_STATE_FLAG_SUMMARY));
+	honas_state_destroy(&sealed_state);
+	state.summary_size = 5000;
+	unlink(sealed_state_file);
+	ck_assert_int_eq(honas_sealed_state_write(&state, sealed_state_file, 1024, UINT32_MAX, &stats), 0);
+	ck_assert_uint_eq(stats.summary_size, 4096);
+	ck_assert_int_eq(honas_state_load(&sealed_state, sealed_state_file, true), 0);
+	ck_assert_int_eq(memcmp(sealed_state.summary.bytes, loaded_state.summary.bytes, 4096), 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&sealed_state, byte_slice_from_array(bytes[0]), NULL), 1);
+	honas_state_destroy(&sealed_state);
+
+	// A corrupt summary is refused.
+	struct honas_sealed_state_file_header header;
+	int fd = open(sealed_state_file, O_RDWR);
+	ck_assert_int_ne(fd, -1);
+	ck_assert_int_eq(pread(fd, &header, sizeof(header), 0), sizeof(header));
+	uint64_t summary_offset = header.block_index_offset + (uint64_t)3 * header.blocks_per_filter * (sizeof(struct honas_sealed_state_block) + sizeof(uint32_t));
+	summary_offset = (summary_offset + 7) & ~7ULL;
+	uint8_t byte;
+	ck_assert_int_eq(pread(fd, &byte, 1, summary_offset + sizeof(struct honas_sealed_state_summary)), 1);
+	byte ^= 0x5a;
+	ck_assert_int_eq(pwrite(fd, &byte, 1, summary_offset + sizeof(struct honas_sealed_state_summary)), 1);
+	close(fd);
+	ck_assert_int_eq(honas_state_load(&sealed_state, sealed_state_file, true), 2);
+
+	honas_state_destroy(&state);
+	honas_state_destroy(&loaded_state);
+	unlink(state_file);
+	unlink(sealed_state_file);
+}
+END_TEST
+
+START_TEST(test_state_live_view)
+{
+	const char* live_view_name = "honas-test-live-view";
+	const char* host_names[] = { "surfnet.nl", "www.example.com" };
+	honas_state_t state = { 0 };
+	honas_state_t live_state = { 0 };
+	honas_state_t updated_live_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+	uint8_t bytes[2][SHA256_DIGEST_LENGTH];
+	for (int i = 0; i < 2; i++)
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes[i]);
+
+	// Sharing a state keeps it usable and publishes a snapshot of its header.
+	honas_state_create(&state, 3, 1024 * 1024, 10, 1, 1);
+	state.summary_size = 5000;
+	honas_state_register_host_name_lookup(&state, 1000, &client, (uint8_t*)host_names[0], strlen(host_names[0]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	uint8_t* filter = state.filters[0].bytes;
+	ck_assert_int_eq(honas_state_share(&state, live_view_name), 0);
+	ck_assert_ptr_ne(state.live, NULL);
+	ck_assert_ptr_eq(state.filters[0].bytes, filter);
+	ck_assert_uint_eq(state.live->state_header.number_of_requests, 1);
+	ck_assert_uint_gt(state.live->state_header.estimated_number_of_host_names, 0);
+
+	// Loading the live view is only possible read-only.
+	ck_assert_int_eq(honas_state_load(&live_state, HONAS_STATE_SHM_PREFIX "honas-test-live-view", false), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	ck_assert_int_eq(honas_state_load(&live_state, HONAS_STATE_SHM_PREFIX "honas-test-live-view", true), 0);
+	ck_assert_uint_eq(live_state.header->number_of_requests, 1);
+	ck_assert_uint_eq(live_state.header->first_request, 1000);
+	ck_assert_uint_eq(live_state.filter_bits_set[0], bloom_nr_bits_set(state.filters[0]));
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&live_state, byte_slice_from_array(bytes[0]), NULL), 1);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&live_state, byte_slice_from_array(bytes[1]), NULL), 0);
+
+	// The filters of a loaded live view are live, its header is the snapshot at load time.
+	honas_state_register_host_name_lookup(&state, 2000, &client, (uint8_t*)host_names[1], strlen(host_names[1]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&live_state, byte_slice_from_array(bytes[1]), NULL), 1);
+	ck_assert_uint_eq(live_state.header->number_of_requests, 1);
+	honas_state_publish(&state);
+	for (uint32_t i = 0; i < 3; i++)
+		ck_assert_uint_eq(state.filter_bits_set[i], bloom_nr_bits_set(state.filters[i]));
+	ck_assert_uint_eq(live_state.header->number_of_requests, 1);
+	ck_assert_int_eq(honas_state_load(&updated_live_state, HONAS_STATE_SHM_PREFIX "/honas-test-live-view", true), 0);
+	ck_assert_uint_eq(updated_live_state.header->number_of_requests, 2);
+	ck_assert_uint_eq(updated_live_state.header->last_request, 2000);
+	ck_assert_uint_gt(updated_live_state.header->estimated_number_of_host_names, live_state.header->estimated_number_of_host_names);
+	ck_assert_uint_eq(updated_live_state.summary.len, 0);
+	honas_state_destroy(&updated_live_state);
+
+	// Persisting a shared state still writes a regular state file, without changing the shared data.
+	const char* state_file = "test_live_view_state.hs";
+	unlink(state_file);
+	uint8_t* shared_copy = malloc(state.size);
+	ck_assert_ptr_ne(shared_copy, NULL);
+	memcpy(shared_copy, state.mmap, state.size);
+	honas_state_persist(&state, state_file, true);
+	ck_assert(memcmp(shared_copy, state.mmap, state.size) == 0);
+	free(shared_copy);
+	ck_assert_int_eq(honas_state_load(&updated_live_state, state_file, true), 0);
+	ck_assert_uint_eq(updated_live_state.header->number_of_requests, 2);
+	ck_assert_uint_eq(honas_state_verify_sections(&updated_live_state), 0);
+	ck_assert_ptr_ne(honas_state_find_section(&updated_live_state, HONAS_STATE_SECTION_SUMMARY, 0), NULL);
+	ck_assert_uint_eq(updated_live_state.filter_bits_set[1], bloom_nr_bits_set(state.filters[1]));
+	ck_assert_uint_gt(updated_live_state.header->estimated_number_of_host_names, 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&updated_live_state, byte_slice_from_array(bytes[1]), NULL), 1);
+	honas_state_destroy(&updated_live_state);
+	unlink(state_file);
+
+	// Processes that loaded the live view keep using it when it's removed.
+	honas_state_destroy(&state);
+	ck_assert_int_eq(honas_state_unshare(live_view_name), 0);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&live_state, byte_slice_from_array(bytes[0]), NULL), 1);
+	honas_state_destroy(&live_state);
+	ck_assert_int_eq(honas_state_load(&live_state, HONAS_STATE_SHM_PREFIX "honas-test-live-view", true), -1);
+	ck_assert_int_eq(errno, ENOENT);
+}
+END_TEST
+
+START_TEST(test_state_export_import)
+{
+	const char* host_names[] = { "surfnet.nl", "www.example.com" };
+	honas_state_t state = { 0 };
+	honas_state_t imported_state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+	uint8_t bytes[2][SHA256_DIGEST_LENGTH];
+	for (int i = 0; i < 2; i++)
+		SHA256((uint8_t*)host_names[i], strlen(host_names[i]), bytes[i]);
+
+	// The exported state includes the (sparse) hyperloglog data and remains usable.
+	honas_state_create(&state, 3, 1024 * 1024, 10, 1, 1);
+	honas_state_register_host_name_lookup(&state, 1000, &client, (uint8_t*)host_names[0], strlen(host_names[0]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	uint64_t host_name_count = hllCount(&state.host_name_count, NULL);
+	int fd = honas_state_export(&state);
+	ck_assert_int_ne(fd, -1);
+	ck_assert_uint_eq(hllCount(&state.host_name_count, NULL), host_name_count);
+	honas_state_register_host_name_lookup(&state, 2000, &client, (uint8_t*)host_names[1], strlen(host_names[1]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes[1]), NULL), 1);
+	honas_state_destroy(&state);
+
+	// The imported state is the state as it was exported.
+	ck_assert_int_eq(honas_state_import(&imported_state, fd), 0);
+	close(fd);
+	ck_assert_uint_eq(imported_state.header->number_of_requests, 1);
+	ck_assert_uint_eq(imported_state.header->last_request, 1000);
+	ck_assert_uint_eq(hllCount(&imported_state.host_name_count, NULL), host_name_count);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&imported_state, byte_slice_from_array(bytes[0]), NULL), 1);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&imported_state, byte_slice_from_array(bytes[1]), NULL), 0);
+	honas_state_register_host_name_lookup(&imported_state, 3000, &client, (uint8_t*)host_names[1], strlen(host_names[1]), NULL, 0, NULL, LDNS_RR_TYPE_A);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&imported_state, byte_slice_from_array(bytes[1]), NULL), 1);
+	ck_assert_uint_gt(hllCount(&imported_state.host_name_count, NULL), host_name_count);
+	honas_state_destroy(&imported_state);
+
+	// Anything but a honas state is refused.
+	fd = memfd_create("test-state", MFD_CLOEXEC);
+	ck_assert_int_eq(ftruncate(fd, 4096), 0);
+	ck_assert_int_eq(honas_state_import(&imported_state, fd), 1);
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_state_sampling)
+{
+	const char* state_file = "test_sampling_state.hs";
+	const char* sealed_state_file = "test_sampling_sealed_state.hs";
+	honas_state_t states[2] = { { 0 } };
+	honas_state_t* sources[2] = { &states[0], &states[1] };
+	honas_state_t loaded_state = { 0 };
+	honas_state_t folded_state = { 0 };
+	honas_state_t combined_state = { 0 };
+
+	// New states haven't been sampled, and have an optional sampling section.
+	for (size_t i = 0; i < 2; i++)
+		honas_state_create(&states[i], 2, 1024 * 1024, 10, 1, 1);
+	ck_assert_uint_eq(states[0].sampling->sampling_rate, 1);
+	ck_assert_uint_eq(states[0].sampling->number_of_shed_requests, 0);
+	const struct honas_state_section* section = honas_state_find_section(&states[0], HONAS_STATE_SECTION_SAMPLING, 0);
+	ck_assert_ptr_ne(section, NULL);
+	ck_assert_uint_eq(section->flags & HONAS_STATE_SECTION_FLAG_REQUIRED, 0);
+
+	// Shed lookups are counted with the highest sampling rate and the period in which lookups were shed.
+	honas_state_register_shed_host_name_lookup(&states[0], 2000, 4);
+	honas_state_register_shed_host_name_lookup(&states[0], 2100, 16);
+	honas_state_register_shed_host_name_lookup(&states[0], 2050, 2);
+	honas_state_register_shed_host_name_lookup(&states[1], 1500, 8);
+	ck_assert_uint_eq(states[0].sampling->sampling_rate, 16);
+	ck_assert_uint_eq(states[0].sampling->number_of_shed_requests, 3);
+	ck_assert_uint_eq(states[0].sampling->first_shed_request, 2000);
+	ck_assert_uint_eq(states[0].sampling->last_shed_request, 2100);
+
+	// The sampling information is persisted.
+	unlink(state_file);
+	honas_state_persist(&states[0], state_file, true);
+	ck_assert_int_eq(honas_state_load(&loaded_state, state_file, true), 0);
+	ck_assert_int_eq(memcmp(loaded_state.sampling, states[0].sampling, sizeof(struct honas_state_sampling)), 0);
+	honas_state_destroy(&loaded_state);
+
+	// The sampling information is kept when folding and sealing, both read-only and read-write.
+	ck_assert_int_eq(honas_state_fold(&folded_state, &states[0], 2), 0);
+	ck_assert_int_eq(memcmp(folded_state.sampling, states[0].sampling, sizeof(struct honas_state_sampling)), 0);
+	unlink(sealed_state_file);
+	ck_assert_int_eq(honas_sealed_state_write(&folded_state, sealed_state_file, 1024, UINT32_MAX, NULL), 0);
+	ck_assert_int_eq(honas_state_load(&loaded_state, sealed_state_file, true), 0);
+	ck_assert(loaded_state.sealed != NULL);
+	ck_assert_int_eq(memcmp(loaded_state.sampling, states[0].sampling, sizeof(struct honas_state_sampling)), 0);
+	honas_state_destroy(&loaded_state);
+	ck_assert_int_eq(honas_state_load(&loaded_state, sealed_state_file, false), 0);
+	ck_assert(loaded_state.sealed == NULL);
+	ck_assert_int_eq(memcmp(loaded_state.sampling, states[0].sampling, sizeof(struct honas_state_sampling)), 0);
+	honas_state_destroy(&loaded_state);
+
+	// Combining states combines their sampling information.
+	ck_assert_int_eq(honas_state_combine_all(&combined_state, sources, 2, 0), 0);
+	ck_assert_uint_eq(combined_state.sampling->sampling_rate, 16);
+	ck_assert_uint_eq(combined_state.sampling->number_of_shed_requests, 4);
+	ck_assert_uint_eq(combined_state.sampling->first_shed_request, 1500);
+	ck_assert_uint_eq(combined_state.sampling->last_shed_request, 2100);
+	ck_assert(honas_state_aggregate_combine(&states[1], &states[0]) == true);
+	ck_assert_int_eq(memcmp(states[1].sampling, combined_state.sampling, sizeof(struct honas_state_sampling)), 0);
+
+	// Destroy the states.
+	for (size_t i = 0; i < 2; i++)
+		honas_state_destroy(&states[i]);
+	honas_state_destroy(&folded_state);
+	honas_state_destroy(&combined_state);
+	unlink(state_file);
+	unlink(sealed_state_file);
+}
+END_TEST
+
+START_TEST(test_host_name_canonicalization)
+{
+	const char* host_name = "WWW.SURFnet.NL.";
+	honas_state_t state = { 0 };
+	struct in_addr46 client = { 0 };
+	client.af = AF_INET;
+	const unsigned int addr = 0xDE329823;
+	memcpy(&client.in.addr4, &addr, sizeof(unsigned int));
+	uint8_t canonical_host_name[HONAS_STATE_MAX_HOST_NAME_LENGTH + 1];
+	uint8_t bytes[SHA256_DIGEST_LENGTH];
+
+	// Host names are registered in lower case and without trailing '.'.
+	ck_assert_uint_eq(honas_state_canonicalize_host_name((uint8_t*)host_name, strlen(host_name), canonical_host_name), 14);
+	ck_assert_str_eq((char*)canonical_host_name, "www.surfnet.nl");
+	ck_assert_uint_eq(honas_state_canonicalize_host_name((uint8_t*)"", 0, canonical_host_name), 0);
+
+	// The canonical host name, its entity specific variant and its labels are found.
+	honas_state_create(&state, 1, 1024 * 1024, 10, 1, 1);
+	honas_state_register_host_name_lookup(&state, time(NULL), &client, (uint8_t*)host_name, strlen(host_name), (uint8_t*)"SURFnet", 7, NULL, LDNS_RR_TYPE_A);
+	honas_state_host_name_hash(NULL, 0, canonical_host_name, honas_state_canonicalize_host_name((uint8_t*)host_name, strlen(host_name), canonical_host_name), bytes);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL), 1);
+	honas_state_host_name_hash((uint8_t*)"SURFnet", 7, canonical_host_name, 14, bytes);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL), 1);
+	SHA256((uint8_t*)"SURFnet@www.surfnet.nl", 22, bytes);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL), 1);
+	honas_state_host_name_hash(NULL, 0, (uint8_t*)"surfnet", 7, bytes);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL), 1);
+	honas_state_host_name_hash(NULL, 0, (uint8_t*)host_name, strlen(host_name), bytes);
+	ck_assert_uint_eq(honas_state_check_host_name_lookups(&state, byte_slice_from_array(bytes), NULL), 0);
+
+	// Destroy the state.
+	honas_state_destroy(&state);
+}
+END_TEST
+
 Suite* make_suite(void)
 {
 	TCase* tc_core = tcase_create("Tests");
 	tcase_add_test(tc_core, test_aggregate_states);
+	tcase_add_test(tc_core, test_aggregate_sealed_state);
+	tcase_add_test(tc_core, test_interleaved_sealed_state);
+	tcase_add_test(tc_core, test_sealed_state_corrupt_block);
+	tcase_add_test(tc_core, test_fold_state);
+	tcase_add_test(tc_core, test_combine_all_states);
+	tcase_add_test(tc_core, test_state_file_sections);
+	tcase_add_test(tc_core, test_state_summary);
+	tcase_add_test(tc_core, test_sealed_state_summary);
+	tcase_add_test(tc_core, test_state_live_view);
+	tcase_add_test(tc_core, test_state_export_import);
+	tcase_add_test(tc_core, test_state_sampling);
+	tcase_add_test(tc_core, test_host_name_canonicalization);
 
 	Suite* s = suite_create("Honas State Aggregation");
 	suite_add_tcase(s, tc_core);
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2018, SURFnet
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the company nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "state_catalog.h"
+
+#include <check.h>
+
+static char test_dir[32];
+
+static void setup(void)
+{
+	strcpy(test_dir, "/tmp/test_state_catalog.XXXXXX");
+	ck_assert_ptr_ne(mkdtemp(test_dir), NULL);
+}
+
+static void teardown(void)
+{
+	char command[sizeof(test_dir) + 16];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	ck_assert_int_eq(system(command), 0);
+}
+
+static void create_state_file(const char* name, uint64_t period_begin, uint64_t period_end)
+{
+	char path[sizeof(test_dir) + 64];
+	honas_state_t state = { 0 };
+	snprintf(path, sizeof(path), "%s/%s", test_dir, name);
+	ck_assert_int_eq(honas_state_create(&state, 2, 1024, 10, 1, 1), 0);
+	state.header->period_begin = period_begin;
+	state.header->period_end = period_end;
+	state.filters[1].bytes[0] = 0x2a;
+	honas_state_persist(&state, path, true);
+	honas_state_destroy(&state);
+}
+
+START_TEST(test_state_catalog_select)
+{
+	honas_catalog_t catalog;
+	struct honas_catalog_update_stats stats;
+	const struct honas_catalog_entry* selected[4];
+	char path[PATH_MAX], day_dir[sizeof(test_dir) + 16];
+	size_t first;
+	setup();
+
+	/* Without catalog there's nothing to open */
+	ck_assert_int_eq(honas_state_catalog_open(&catalog, test_dir), -1);
+	ck_assert_int_eq(errno, ENOENT);
+
+	/* The hourly state files of (part of) a day and the daily state file, including a subdirectory */
+	snprintf(day_dir, sizeof(day_dir), "%s/day", test_dir);
+	ck_assert_int_eq(mkdir(day_dir, 0755), 0);
+	create_state_file("day/1.hs", 0, 3600);
+	create_state_file("day/2.hs", 3600, 7200);
+	create_state_file("day/3.hs", 7200, 10800);
+	create_state_file("day.hs", 0, 86400);
+	create_state_file(".hidden.hs", 0, 3600);
+	create_state_file("other", 0, 3600);
+	ck_assert_int_eq(honas_state_catalog_update(test_dir, &stats), 0);
+	ck_assert_uint_eq(stats.nr_entries, 4);
+	ck_assert_uint_eq(stats.nr_added, 4);
+	ck_assert_uint_eq(stats.nr_removed, 0);
+
+	/* Entries are ordered by period, the shortest period first */
+	ck_assert_int_eq(honas_state_catalog_open(&catalog, test_dir), 0);
+	ck_assert_uint_eq(catalog.header->number_of_entries, 4);
+	ck_assert_uint_eq(catalog.entries[0].period_end, 3600);
+	ck_assert_uint_eq(catalog.entries[1].period_end, 86400);
+	ck_assert(honas_state_catalog_entry_path(&catalog, &catalog.entries[1], path, sizeof(path)));
+	ck_assert_str_eq(path + strlen(test_dir), "/day.hs");
+	ck_assert_uint_eq(catalog.entries[1].number_of_filters, 2);
+	ck_assert_uint_eq(honas_state_catalog_entry_filter_bits_set(&catalog, &catalog.entries[1])[1], 3);
+
+	/* Finding entries by the period beginning */
+	ck_assert_uint_eq(honas_state_catalog_find(&catalog, 0, 3600, &first), 2);
+	ck_assert_uint_eq(first, 0);
+	ck_assert_uint_eq(honas_state_catalog_find(&catalog, 3600, UINT64_MAX, &first), 2);
+	ck_assert_uint_eq(first, 2);
+	ck_assert_uint_eq(honas_state_catalog_find(&catalog, 10801, UINT64_MAX, &first), 0);
+
+	/* Selecting prefers the hourly state files over the overlapping daily one */
+	ck_assert_uint_eq(honas_state_catalog_select(&catalog, 0, UINT64_MAX, selected), 3);
+	ck_assert_uint_eq(selected[0]->period_end, 3600);
+	ck_assert_uint_eq(selected[1]->period_begin, 3600);
+	ck_assert_uint_eq(selected[2]->period_begin, 7200);
+	ck_assert_uint_eq(honas_state_catalog_select(&catalog, 3600, 7200, selected), 1);
+	ck_assert_uint_eq(selected[0]->period_begin, 3600);
+
+	/* The daily state file covers the hourly ones */
+	ck_assert_ptr_eq(honas_state_catalog_covering_entry(&catalog, 0, UINT64_MAX, &catalog.entries[0]), &catalog.entries[1]);
+	ck_assert_ptr_eq(honas_state_catalog_covering_entry(&catalog, 0, UINT64_MAX, &catalog.entries[3]), &catalog.entries[1]);
+	ck_assert_ptr_eq(honas_state_catalog_covering_entry(&catalog, 3600, UINT64_MAX, &catalog.entries[3]), NULL);
+	ck_assert_ptr_eq(honas_state_catalog_covering_entry(&catalog, 0, UINT64_MAX, &catalog.entries[1]), NULL);
+	honas_state_catalog_close(&catalog);
+	teardown();
+}
+END_TEST
+
+START_TEST(test_state_catalog_update)
+{
+	honas_catalog_t catalog;
+	struct honas_catalog_update_stats stats;
+	char path[sizeof(test_dir) + 16];
+	setup();
+
+	create_state_file("1.hs", 0, 3600);
+	create_state_file("2.hs", 3600, 7200);
+	ck_assert_int_eq(honas_state_catalog_update(test_dir, &stats), 0);
+	ck_assert_uint_eq(stats.nr_added, 2);
+
+	/* Unchanged state files aren't opened again */
+	ck_assert_int_eq(honas_state_catalog_update(test_dir, &stats), 0);
+	ck_assert_uint_eq(stats.nr_entries, 2);
+	ck_assert_uint_eq(stats.nr_added, 0);
+	ck_assert_uint_eq(stats.nr_removed, 0);
+
+	/* Added, replaced and removed state files are noticed */
+	create_state_file("3.hs", 7200, 10800);
+	snprintf(path, sizeof(path), "%s/2.hs", test_dir);
+	ck_assert_int_eq(unlink(path), 0);
+	create_state_file("2.hs", 3600, 5400);
+	snprintf(path, sizeof(path), "%s/1.hs", test_dir);
+	ck_assert_int_eq(unlink(path), 0);
+	ck_assert_int_eq(honas_state_catalog_update(test_dir, &stats), 0);
+	ck_assert_uint_eq(stats.nr_entries, 2);
+	ck_assert_uint_eq(stats.nr_added, 2);
+	ck_assert_uint_eq(stats.nr_removed, 2);
+
+	ck_assert_int_eq(honas_state_catalog_open(&catalog, test_dir), 0);
+	ck_assert_uint_eq(catalog.header->number_of_entries, 2);
+	ck_assert_uint_eq(catalog.entries[0].period_begin, 3600);
+	ck_assert_uint_eq(catalog.entries[0].period_end, 5400);
+	ck_assert_uint_eq(catalog.entries[1].period_begin, 7200);
+	honas_state_catalog_close(&catalog);
+
+	/* Files that aren't state files are skipped */
+	snprintf(path, sizeof(path), "%s/4.hs", test_dir);
+	FILE* fh = fopen(path, "w");
+	ck_assert_ptr_ne(fh, NULL);
+	ck_assert_int_eq(fwrite("not a state", 11, 1, fh), 1);
+	ck_assert_int_eq(fclose(fh), 0);
+	ck_assert_int_eq(honas_state_catalog_update(test_dir, &stats), 0);
+	ck_assert_uint_eq(stats.nr_entries, 2);
+	ck_assert_uint_eq(stats.nr_skipped, 1);
+	teardown();
+}
+END_TEST
+
+Suite* make_suite(void)
+{
+	TCase* tc_core = tcase_create("Tests");
+	tcase_add_test(tc_core, test_state_catalog_select);
+	tcase_add_test(tc_core, test_state_catalog_update);
+
+	Suite* s = suite_create("State catalog");
+	suite_add_tcase(s, tc_core);
+	return s;
+}